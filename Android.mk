@@ -53,19 +53,27 @@ LOCAL_SRC_FILES := \
 	common/core/overlaybuffer.cpp \
 	common/core/overlaybuffermanager.cpp \
 	common/core/overlaylayer.cpp \
+	common/display/colorlut.cpp \
 	common/display/display.cpp \
 	common/display/displayplane.cpp \
 	common/display/displayplanemanager.cpp \
 	common/display/displayqueue.cpp \
+	common/display/framelatency.cpp \
+	common/display/layercapture.cpp \
 	common/display/headless.cpp \
+	common/display/presentcache.cpp \
 	common/display/vblankeventhandler.cpp \
         common/display/kmsfencehandler.cpp \
 	common/display/virtualdisplay.cpp \
 	common/utils/drmscopedtypes.cpp \
 	common/utils/fdhandler.cpp \
+	common/utils/fencewaiter.cpp \
+	common/utils/frametrace.cpp \
 	common/utils/hwcevent.cpp \
 	common/utils/hwcthread.cpp \
+	common/utils/hwcloglevel.cpp \
 	common/utils/hwcutils.cpp \
+	common/utils/latencyhistogram.cpp \
 	common/utils/disjoint_layers.cpp \
 	os/android/grallocbufferhandler.cpp \
 	os/android/drmhwctwo.cpp
@@ -80,6 +88,10 @@ LOCAL_CPPFLAGS += \
 	-fstack-protector-strong \
 	-Wformat -Wformat-security
 
+ifneq ($(strip $(BOARD_HWC_MAX_LOG_LEVEL)),)
+LOCAL_CPPFLAGS += -DHWC_LOG_LEVEL_MAX=$(BOARD_HWC_MAX_LOG_LEVEL)
+endif
+
 ifeq ($(strip $(BOARD_DISABLE_NATIVE_COLOR_MODES)),true)
 LOCAL_CPPFLAGS += -DDISABLE_NATIVE_COLOR_MODES
 endif
@@ -28,15 +28,74 @@ Content::Content()
 {
 }
 
+Content::Content(const Content& other) :
+    mDisplays(other.mDisplays)
+{
+}
+
 Content::~Content()
 {
 }
 
+Content& Content::operator=(const Content& other)
+{
+    if (this != &other)
+    {
+        if (mSpareDisplays.size() < mDisplays.size())
+        {
+            mSpareDisplays.resize(mDisplays.size());
+        }
+        for (uint32_t d = 0; d < mDisplays.size(); d++)
+        {
+            if (mDisplays[d].use_count() == 1)
+            {
+                mSpareDisplays[d] = std::move(mDisplays[d]);
+            }
+        }
+        mDisplays = other.mDisplays;
+    }
+    return *this;
+}
+
+Content::Display& Content::editDisplay(uint32_t l)
+{
+    std::shared_ptr<Display>& pDisplay = mDisplays.at(l);
+    if (pDisplay.use_count() > 1)
+    {
+        // Another copy of the content still refers to this display, take our own.
+        if (l < mSpareDisplays.size() && mSpareDisplays[l])
+        {
+            *mSpareDisplays[l] = *pDisplay;
+            pDisplay.swap(mSpareDisplays[l]);
+            mSpareDisplays[l].reset();
+        }
+        else
+        {
+            pDisplay = std::make_shared<Display>(*pDisplay);
+        }
+    }
+    return *pDisplay;
+}
+
+void Content::resize(uint32_t size)
+{
+    const uint32_t oldSize = mDisplays.size();
+    mDisplays.resize(size);
+    for (uint32_t d = oldSize; d < size; d++)
+    {
+        mDisplays[d] = std::make_shared<Display>();
+    }
+}
+
 void Content::setGeometryChanged(bool geometry)
 {
     for (size_t d = 0; d < size(); d++)
     {
-        editDisplay(d).setGeometryChanged(geometry);
+        // Displays that already have the flag stay shared.
+        if (getDisplay(d).isGeometryChanged() != geometry)
+        {
+            editDisplay(d).setGeometryChanged(geometry);
+        }
     }
 }
 
@@ -112,22 +171,105 @@ Content::LayerStack::LayerStack(const Layer* pLayers, uint32_t num) :
     mbVideo(false),
     mbFrontBufferRendered(false)
 {
-    for (uint32_t i = 0; i < num; i++)
+    if (num)
     {
-        mpLayers.push_back(&pLayers[i]);
+        std::vector<const Layer*>& layers = editLayers();
+        layers.reserve(num);
+        for (uint32_t i = 0; i < num; i++)
+        {
+            layers.push_back(&pLayers[i]);
+        }
     }
 }
 
+Content::LayerStack::LayerStack(const LayerStack& other) :
+    mpLayers(other.mpLayers),
+    mbGeometry(other.mbGeometry),
+    mbEncrypted(other.mbEncrypted),
+    mbVideo(other.mbVideo),
+    mbFrontBufferRendered(other.mbFrontBufferRendered)
+{
+}
+
 Content::LayerStack::~LayerStack()
 {
 }
 
+Content::LayerStack& Content::LayerStack::operator=(const LayerStack& other)
+{
+    if (this != &other)
+    {
+        if (mpLayers.use_count() == 1)
+        {
+            mpSpareLayers = std::move(mpLayers);
+        }
+        mpLayers = other.mpLayers;
+        mbGeometry = other.mbGeometry;
+        mbEncrypted = other.mbEncrypted;
+        mbVideo = other.mbVideo;
+        mbFrontBufferRendered = other.mbFrontBufferRendered;
+    }
+    return *this;
+}
+
+std::vector<const Layer*>& Content::LayerStack::editLayers()
+{
+    if (!mpLayers)
+    {
+        if (mpSpareLayers)
+        {
+            mpLayers.swap(mpSpareLayers);
+            mpLayers->clear();
+        }
+        else
+        {
+            mpLayers = std::make_shared<std::vector<const Layer*>>();
+        }
+    }
+    else if (mpLayers.use_count() > 1)
+    {
+        // Another copy of the stack still refers to this list, take our own.
+        if (mpSpareLayers)
+        {
+            *mpSpareLayers = *mpLayers;
+            mpLayers.swap(mpSpareLayers);
+            mpSpareLayers.reset();
+        }
+        else
+        {
+            mpLayers = std::make_shared<std::vector<const Layer*>>(*mpLayers);
+        }
+    }
+    return *mpLayers;
+}
+
+void Content::LayerStack::setLayer(uint32_t ly, const Layer* pL)
+{
+    // Setting a layer to itself is common (e.g. reusing a filter's layer); keep sharing.
+    if ((*mpLayers)[ly] != pL)
+    {
+        editLayers()[ly] = pL;
+    }
+}
+
+void Content::LayerStack::resize(uint32_t size)
+{
+    if (size == 0)
+    {
+        mpLayers.reset();
+    }
+    else if (size != this->size())
+    {
+        editLayers().resize(size);
+    }
+}
+
 uint32_t Content::LayerStack::getNumEnabledLayers() const
 {
     uint32_t numEnabled = 0;
-    for (uint32_t ly = 0; ly < mpLayers.size(); ly++)
+    for (uint32_t ly = 0; ly < size(); ly++)
     {
-        const Layer& layer = *(mpLayers[ly]);
+        const Layer& layer = getLayer(ly);
         if (layer.isEnabled())
         {
             ++numEnabled;
@@ -143,9 +285,9 @@ void Content::LayerStack::updateLayerFlags()
     mbVideo = false;
     mbFrontBufferRendered = false;
 
-    for ( uint32_t ly = 0; ly < mpLayers.size(); ly++ )
+    for ( uint32_t ly = 0; ly < size(); ly++ )
     {
-        const Layer& layer = *(mpLayers[ly]);
+        const Layer& layer = getLayer(ly);
         mbEncrypted             |= layer.isEncrypted();
         mbVideo                 |= layer.isVideo();
         mbFrontBufferRendered   |= layer.isFrontBufferRendered();
@@ -167,12 +309,13 @@ void Content::LayerStack::removeLayer(uint32_t ly, bool bUpdateSource)
         // If we are removing a layer from the stack, then we need to ensure its acquire fence is closed and
         // its release fence is set to -1.
 
-        const Layer& layer = *mpLayers[ly];
+        const Layer& layer = getLayer(ly);
         layer.closeAcquireFence();
         layer.returnReleaseFence(-1);
     }
 
-    mpLayers.erase(mpLayers.begin() + ly);
+    std::vector<const Layer*>& layers = editLayers();
+    layers.erase(layers.begin() + ly);
 }
 
 void Content::LayerStack::removeAllLayers(bool bUpdateSource)
@@ -182,14 +325,15 @@ void Content::LayerStack::removeAllLayers(bool bUpdateSource)
         // If we are removing a layer from the stack, then we need to ensure its acquire fence is closed and
         // its release fence is set to -1.
 
-        for (unsigned ly = 0; ly < mpLayers.size(); ++ly)
+        for (unsigned ly = 0; ly < size(); ++ly)
         {
-            const Layer& layer = *mpLayers[ly];
+            const Layer& layer = getLayer(ly);
             layer.closeAcquireFence();
             layer.returnReleaseFence(-1);
         }
     }
-    mpLayers.clear();
+    // Other copies keep their list.
+    mpLayers.reset();
 }
 
 void Content::LayerStack::setAllReleaseFences(int fence) const
@@ -235,9 +379,9 @@ void Content::LayerStack::setAllReleaseFences(int fence) const
 
 void Content::LayerStack::onCompose()
 {
-    for (uint32_t ly = 0; ly < mpLayers.size(); ly++)
+    for (uint32_t ly = 0; ly < size(); ly++)
     {
-        const Layer& layer = *mpLayers[ly];
+        const Layer& layer = getLayer(ly);
         if (layer.isComposition())
         {
             layer.getComposition()->onCompose();
@@ -248,15 +392,25 @@ void Content::LayerStack::onCompose()
 void Content::LayerStack::subset(const LayerStack source, uint32_t start, uint32_t size)
 {
     HWCASSERT( start + size <= source.size() );
-    this->resize(size);
+    std::vector<const Layer*>& layers = editLayers();
+    layers.resize(size);
     for (uint32_t ly = 0; ly < size; ly++)
     {
-        this->setLayer(ly, &source.getLayer(start + ly));
+        layers[ly] = &source.getLayer(start + ly);
     }
 }
 
 bool Content::LayerStack::matches( const LayerStack& other, bool* pbMatchesHandles ) const
 {
+    if ( isShared( other ) )
+    {
+        // Same list, same layers.
+        if ( pbMatchesHandles )
+        {
+            *pbMatchesHandles = true;
+        }
+        return true;
+    }
     if ( size() != other.size() )
     {
         DTRACEIF( CONTENT_DEBUG, "Content::LayerStack mismatch layer size %u v %u", size(), other.size() );
@@ -300,9 +454,9 @@ HWCString Content::LayerStack::dump(const char* pIdentifier) const
 
     HWCString output = dumpHeader() + "\n";
 
-    for (uint32_t ly = 0; ly < mpLayers.size(); ly++)
+    for (uint32_t ly = 0; ly < size(); ly++)
     {
-        output += mpLayers[ly]->dump(String8::format("%s %d", pIdentifier, ly)) + "\n";
+        output += getLayer(ly).dump(String8::format("%s %d", pIdentifier, ly)) + "\n";
     }
 
     return output;
@@ -313,15 +467,15 @@ bool Content::LayerStack::dumpContentToTGA(const String8& prefix) const
     if (!sbInternalBuild)
         return false;
 
-    if ( !mpLayers.size() )
+    if ( !size() )
         return false;
 
     bool bOK = true;
 
-    for (uint32_t ly = 0; ly < mpLayers.size(); ly++)
+    for (uint32_t ly = 0; ly < size(); ly++)
     {
         HWCString lyPrefix = HWCString::format( "%s_l%u", prefix.string(), ly );
-        if ( !mpLayers[ly]->dumpContentToTGA( lyPrefix ) )
+        if ( !getLayer(ly).dumpContentToTGA( lyPrefix ) )
             bOK = false;
     }
 
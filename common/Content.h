@@ -18,6 +18,7 @@
 #define INTEL_COMMON_HWC_CONTENTREFERENCE_H
 
 #include "hwcutils.h"
+#include <memory>
 #include <vector>
 #include <hwcdefs.h>
 
@@ -34,6 +35,14 @@ class Layer;
 
 // While this class is initially expected to directly reference a content class, as filters
 // get applied to it, its likely to diverge significantly
+
+// Copies are copy-on-write: a copied Content shares its displays with the original until
+// editDisplay is called for one, and a copied display shares its layer list until the list is
+// changed. A filter that copies the content and changes one layer only pays for that display
+// and layer. The layers themselves are never copied, filters own any replacement layers.
+// A reference returned by editDisplay is only valid until the Content is next copied or resized.
+// Assigning over a content keeps the displays and lists it alone owned as spares, and the next
+// edit copies into those, so a filter that edits the same display each frame does not allocate.
 class Content
 {
 public:
@@ -44,18 +53,24 @@ public:
 
 
     Content();
+    Content(const Content& other);
     ~Content();
+    Content&                    operator=(const Content& other);
 #ifdef uncomment_hwc1
     // TODO: Remove this later. Temporary constructor
     Content(hwc_display_contents_1_t** pDisplay, uint32_t num);
 #else
 #endif
 
-    const Display&              getDisplay(uint32_t l) const            { return mDisplays[l]; }
-    Display&                    editDisplay(uint32_t l)                 { return mDisplays.at(l); }
+    const Display&              getDisplay(uint32_t l) const            { return *mDisplays[l]; }
+    Display&                    editDisplay(uint32_t l);
 
     uint32_t                    size() const                            { return mDisplays.size(); }
-    void                        resize(uint32_t size)                   { mDisplays.resize(size); }
+    void                        resize(uint32_t size);
+
+    // True if display l of both contents is the same object (neither copy edited it).
+    bool                        isDisplayShared(const Content& other, uint32_t l) const
+                                                                        { return mDisplays[l] == other.mDisplays[l]; }
 
     void                        setGeometryChanged(bool geometry);
 
@@ -71,7 +86,9 @@ public:
     HWCString                     dump(const char* pIdentifier = "Content") const;
 
 private:
-    std::vector<Display>             mDisplays;
+    std::vector<std::shared_ptr<Display>> mDisplays;
+    // Displays only this content referred to when it was last assigned, for editDisplay to reuse.
+    std::vector<std::shared_ptr<Display>> mSpareDisplays;
 };
 
 // The Content class owns its display objects. This allows a filter to adjust a display
@@ -82,17 +99,22 @@ class Content::LayerStack
 public:
     LayerStack();
     LayerStack(const Layer* pLayers, uint32_t num);
+    LayerStack(const LayerStack& other);
     virtual ~LayerStack();
+    LayerStack&             operator=(const LayerStack& other);
 
-    const Layer&            getLayer(uint32_t ly) const                 { HWCASSERT(mpLayers[ly]); return *(mpLayers[ly]); }
+    const Layer&            getLayer(uint32_t ly) const                 { HWCASSERT((*mpLayers)[ly]); return *((*mpLayers)[ly]); }
 
-    const Layer* const*     getLayerArray() const                       { return mpLayers.data(); }
-    void                    setLayer(uint32_t ly, const Layer* pL)      { mpLayers[ly] = pL; }
+    const Layer* const*     getLayerArray() const                       { return mpLayers ? mpLayers->data() : NULL; }
+    void                    setLayer(uint32_t ly, const Layer* pL);
 
-    const Layer&            operator[](uint32_t ly) const               { return *(mpLayers[ly]); }
+    const Layer&            operator[](uint32_t ly) const               { return *((*mpLayers)[ly]); }
 
-    uint32_t                size() const                                { return mpLayers.size(); }
-    void                    resize(uint32_t size)                       { mpLayers.resize(size); }
+    uint32_t                size() const                                { return mpLayers ? mpLayers->size() : 0; }
+    void                    resize(uint32_t size);
+
+    // True if both stacks use the same layer list (neither copy changed it).
+    bool                    isShared(const LayerStack& other) const     { return mpLayers == other.mpLayers; }
     uint32_t                getNumEnabledLayers() const;
 
     bool                    isGeometryChanged() const                   { return mbGeometry; }
@@ -127,7 +149,13 @@ public:
 
 
 private:
-    std::vector<const Layer*>    mpLayers;                   // List of the layers that are currently on this stack
+    // The layer list, for changing. Copied first if another stack shares it.
+    std::vector<const Layer*>&  editLayers();
+
+    // List of the layers that are currently on this stack, shared between copies until changed. NULL if empty.
+    std::shared_ptr<std::vector<const Layer*>> mpLayers;
+    // List only this stack referred to when it was last assigned, for editLayers to reuse.
+    std::shared_ptr<std::vector<const Layer*>> mpSpareLayers;
     bool                    mbGeometry:1;               // Geometry change with this stack
     bool                    mbEncrypted:1;              // At least one layer on this display is encrypted
     bool                    mbVideo:1;                  // At least one video plane is present
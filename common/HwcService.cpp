@@ -20,6 +20,7 @@
 #include "HwcService.h"
 #include "AbstractPlatform.h"
 #include "PlatformServices.h"
+#include "framelatency.h"
 
 #include <binder/IInterface.h>
 #include <binder/IServiceManager.h>
@@ -184,6 +185,28 @@ status_t HwcService::Diagnostic::readLogParcel(Parcel* parcel)
         return INVALID_OPERATION;
 }
 
+status_t HwcService::Diagnostic::readLatencyParcel(uint32_t d, Parcel* parcel)
+{
+    hwcomposer::FrameLatency::Summary summary;
+    if (!hwcomposer::FrameLatency::GetSummary(d, summary))
+        return NAME_NOT_FOUND;
+
+    parcel->writeInt32(hwcomposer::FrameLatency::kNumStages);
+    for (uint32_t i = 0; i < hwcomposer::FrameLatency::kNumStages; i++)
+    {
+        const hwcomposer::LatencyHistogram::Summary& stage = summary.stages[i];
+        parcel->writeInt64(stage.count);
+        parcel->writeInt32(stage.samples);
+        parcel->writeInt32(stage.p50);
+        parcel->writeInt32(stage.p90);
+        parcel->writeInt32(stage.p99);
+        parcel->writeInt32(stage.max);
+    }
+    parcel->writeInt64(summary.frames);
+    parcel->writeInt64(summary.missed_vblanks);
+    return OK;
+}
+
 #if INTEL_HWC_INTERNAL_BUILD
 void HwcService::Diagnostic::enableDisplay(uint32_t d)
 {
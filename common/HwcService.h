@@ -46,6 +46,7 @@ public:
         Diagnostic(Hwc& hwc) : mHwc(hwc) { HWC_UNUSED( mHwc ); }
 
         virtual status_t readLogParcel(Parcel* parcel);
+        virtual status_t readLatencyParcel(uint32_t d, Parcel* parcel);
         virtual void enableDisplay(uint32_t d);
         virtual void disableDisplay(uint32_t d, bool bBlank);
         virtual void maskLayer(uint32_t d, uint32_t layer, bool bHide);
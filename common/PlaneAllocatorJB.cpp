@@ -24,6 +24,10 @@
 #include <ufo/graphics.h>
 #include <cutils/properties.h>
 
+#include <algorithm>
+#include <bitset>
+#include <vector>
+
 namespace intel {
 namespace ufo {
 namespace hwc {
@@ -53,12 +57,48 @@ public:
 
 PlaneAllocatorJB::Options* PlaneAllocatorJB::spOptions = NULL;
 
+// Assignments found for recent allocator inputs. Plane allocation runs on each geometry change,
+// but the pre-evaluated inputs often repeat (e.g. toggling between layouts, or re-analysis for
+// idle), in which case the previous assignment is rebuilt and validated instead of searched for.
+class PlaneAllocatorJB::Memo
+{
+public:
+    static const uint32_t NUM_ENTRIES = 8;
+
+    class Entry
+    {
+    public:
+        Entry() : mpCaps( NULL ), mLastUsed( 0 ) { }
+        const DisplayCaps*      mpCaps;         //< Display the inputs were for.
+        uint32_t                mLastUsed;      //< Lookup count when last used.
+        std::vector<int64_t>    mSignature;     //< The allocator inputs.
+        std::vector<uint32_t>   mAssigned;      //< Best assignment found, per layer.
+        std::vector<uint32_t>   mShared;        //< Shared plane of each unhandled layer.
+    };
+
+    Memo() : mLookups( 0 ) { }
+
+    // Returns the entry for these inputs, or NULL.
+    Entry* find( const DisplayCaps* pCaps, const std::vector<int64_t>& signature );
+
+    // Returns the least recently used entry, set up for these inputs.
+    Entry& replace( const DisplayCaps* pCaps, const std::vector<int64_t>& signature );
+
+private:
+    uint32_t mLookups;
+    Entry    maEntries[ NUM_ENTRIES ];
+};
+
+PlaneAllocatorJB::Memo* PlaneAllocatorJB::spMemo = NULL;
+
 // **************************************************************************************************************
 //
 // Overview:
 // The allocator algorithm iterates all permutations of planes allocated to layers (with no repeats).
 // Constraints are applied to reject invalid permutations.
 // Scores are generated for each valid permutation to determine the best permutation to use.
+// Once a valid permutation is found, branches whose score plus the best each remaining layer
+// could add does not beat it are not searched further; the result is the same as searching all.
 //
 // Terminology:
 // Plane   - A plane is a hardware surface with which a layer can be presented to the display.
@@ -90,6 +130,20 @@ public:
     static const int64_t MIN_SCORE      = -0xFFFFFFFFFFFFLL;
     static const int64_t MAX_SCORE      = +0xFFFFFFFFFFFFLL;
 
+    // A set of planes (bit0=>p0).
+    // DisplayCaps describes zorder constraints for the first 32 planes, any others are unconstrained.
+    typedef std::bitset<MAX_PLANES> PlaneMask;
+    static PlaneMask toPlaneMask( uint32_t capsMask )
+    {
+        PlaneMask mask;
+        for ( uint32_t pl = 0; pl < MAX_PLANES; ++pl )
+        {
+            if ( ( pl >= 32 ) || ( capsMask & ( 1U << pl ) ) )
+                mask.set( pl );
+        }
+        return mask;
+    }
+
 
     // Dummy composition (we don't expect this to be called into).
     class ProposedComposition : public AbstractComposition
@@ -250,12 +304,12 @@ public:
             FLAG_HINT_REQUIRED  = (1<<16)    //< The plane is required (can not be disabled).
         };
         CachedPlaneCaps( ) :
-            mSupportedZOrderPreMask( ~0U ),
-            mSupportedZOrderPostMask( ~0U ),
+            mSupportedZOrderPreMask( PlaneMask().set() ),
+            mSupportedZOrderPostMask( PlaneMask().set() ),
             mFlags( 0 )
         { }
-        uint32_t    mSupportedZOrderPreMask;    //< The set of planes that may be placed before this plane.
-        uint32_t    mSupportedZOrderPostMask;   //< The set of planes that may be placed after this plane.
+        PlaneMask   mSupportedZOrderPreMask;    //< The set of planes that may be placed before this plane.
+        PlaneMask   mSupportedZOrderPostMask;   //< The set of planes that may be placed after this plane.
         uint32_t    mFlags;                     //< Flags indicating behaviour/capabilities.
     };
 
@@ -293,7 +347,11 @@ public:
         mNumLayers( 0 ),
         maLayerConfig( NULL),
         mMaxHandledSets( MAX_PLANES ),
-        mMaxUnhandledSets( MAX_PLANES )
+        mMaxUnhandledSets( MAX_PLANES ),
+        mPermutations( 0 ),
+        mPruned( 0 ),
+        mBestScore( 0 ),
+        mbReused( false )
     {
     }
 
@@ -323,8 +381,13 @@ public:
     void preEvaluate( PlaneAllocatorJB::Options* pOptions, bool bOptimizeIdleDisplay );
 
     // Run allocator to find an optimal solution.
+    // If pMemo is provided, the solution for recently seen inputs is reused and new ones are added.
+    // If bPrune is false every valid permutation is scored (this finds the same solution, slower).
     // On success, returns a pointer to the best solution.
-    const Solution* findOptimalSolution( void );
+    const Solution* findOptimalSolution( PlaneAllocatorJB::Memo* pMemo = NULL, bool bPrune = true );
+
+    // Describe the last solution found and the search for it.
+    void getStats( PlaneAllocatorJB::Stats& stats ) const;
 
 private:
 
@@ -383,6 +446,16 @@ private:
     // Internal solutions.
     Solution mSolution[2];
 
+    // Valid permutations scored, and branches pruned, by the last findOptimalSolution().
+    uint32_t mPermutations;
+    uint32_t mPruned;
+
+    // The per-layer assignment behind the last solution, its score, and whether it came from the memo.
+    std::vector<uint32_t> mBestAssigned;
+    std::vector<uint32_t> mBestShared;
+    int64_t mBestScore;
+    bool mbReused;
+
     // For displays requiring complex validation.
     Content::Display mDisplayOutput;
 
@@ -405,6 +478,20 @@ private:
     // Solution is only valid if this returns true.
     bool validateSolution( const Solution& solution );
 
+    class Scratch;
+
+    // Set up solution from the per-layer assignment in scratch, and validate it.
+    // Solution is only valid if this returns true.
+    bool buildSolution( const Scratch* scratch, Solution& solution );
+
+    // Check a per-layer assignment that was not found by the search (i.e. from the memo)
+    // meets the constraints the search applies as it goes, and score it.
+    // buildSolution() only checks what the search leaves to the end.
+    bool checkAssignment( const Scratch* scratch, int64_t& score ) const;
+
+    // Describe the inputs findOptimalSolution() depends on, for memoization.
+    void getSignature( std::vector<int64_t>& signature ) const;
+
     // Helper to accumulate score.
     // Issues LOGE error and clamps if an overflow has occurred.
     static int64_t& AccumulateScore( int64_t& score, int64_t acc )
@@ -445,7 +532,8 @@ private:
             sharedPlane(INVALID_PLANE),
             nextPlane(0),
             runHandled(0),
-            runUnhandled(0)
+            runUnhandled(0),
+            score(0)
         { }
         // Current allocator state.
         uint32_t assignedPlane;        //< The assigned plane (if set to mNumPlanes => not using dedicated plane).
@@ -454,6 +542,7 @@ private:
         uint32_t nextPlane;            //< The next plane.
         uint32_t runHandled;        //< Accumulated run of handled layers (prior to this layer).
         uint32_t runUnhandled;      //< Accumulated run of unhandled layers (prior to this layer).
+        int64_t  score;             //< Accumulated score (prior to this layer).
     };
 }; // PlaneAllocator
 
@@ -483,8 +572,8 @@ bool PlaneAllocator::init( uint32_t enabledPlanes, uint32_t maxUnhandledSets )
     for ( uint32_t pl = 0; pl < mNumPlanes; ++pl )
     {
         // ZOrders.
-        maCachedPlaneCaps[ pl ].mSupportedZOrderPreMask = mDisplayCaps.getZOrderPreMask(pl);
-        maCachedPlaneCaps[ pl ].mSupportedZOrderPostMask = mDisplayCaps.getZOrderPostMask(pl);
+        maCachedPlaneCaps[ pl ].mSupportedZOrderPreMask = toPlaneMask( mDisplayCaps.getZOrderPreMask(pl) );
+        maCachedPlaneCaps[ pl ].mSupportedZOrderPostMask = toPlaneMask( mDisplayCaps.getZOrderPostMask(pl) );
         maCachedPlaneCaps[ pl ].mFlags = 0;
         // For now, we can assume that any sprite planes have at least the same level of capability
         // as the main plane. If this changes for any future chips, we will need to adjust this. However,
@@ -839,11 +928,8 @@ void PlaneAllocator::preEvaluate( PlaneAllocatorJB::Options* pOptions, bool bOpt
     }
 }
 
-const PlaneAllocator::Solution* PlaneAllocator::findOptimalSolution( void )
+const PlaneAllocator::Solution* PlaneAllocator::findOptimalSolution( PlaneAllocatorJB::Memo* pMemo, bool bPrune )
 {
-    // We use uint32_t bit fields to track assigment - this limits us to no more than 32 planes.
-    ALOG_ASSERT(MAX_PLANES <= 32);
-
     if ( maLayerConfig == NULL )
     {
         ALOGE( "Missing maLayerConfig!" );
@@ -892,20 +978,22 @@ const PlaneAllocator::Solution* PlaneAllocator::findOptimalSolution( void )
         for ( uint32_t pl = 0; pl < mNumPlanes; ++pl )
         {
             PlaneAllocator::CachedPlaneCaps& cpc = maCachedPlaneCaps[ pl ];
-            ALOGD( "CachedPlaneCaps P%02u : Flags==%s|%s|%s|%s(0x%08x), ZOrderPreMask==0x%08x, ZOrderPostMask==0x%08x.",
+            ALOGD( "CachedPlaneCaps P%02u : Flags==%s|%s|%s|%s(0x%08x), ZOrderPreMask==%s, ZOrderPostMask==%s.",
                 pl,
                 cpc.mFlags & PlaneAllocator::CachedPlaneCaps::FLAG_CAP_COLLAPSE  ? "Coll" : "----",
                 cpc.mFlags & PlaneAllocator::CachedPlaneCaps::FLAG_CAP_BLEND     ? "Blnd" : "----",
                 cpc.mFlags & PlaneAllocator::CachedPlaneCaps::FLAG_CAP_DECRYPT   ? "Dcrp" : "----",
                 cpc.mFlags & PlaneAllocator::CachedPlaneCaps::FLAG_HINT_REQUIRED ? "Reqd" : "----",
                 cpc.mFlags,
-                cpc.mSupportedZOrderPreMask,
-                cpc.mSupportedZOrderPostMask );
+                cpc.mSupportedZOrderPreMask.to_string().c_str(),
+                cpc.mSupportedZOrderPostMask.to_string().c_str() );
         }
     }
 
     // Internal output work.
-    uint32_t permutations = 0;
+    mPermutations = 0;
+    mPruned = 0;
+    mbReused = false;
     int64_t bestScore = INT64_MIN;
     bool bValidSolution = false;
     uint32_t solutionIndex = 0;
@@ -917,6 +1005,51 @@ const PlaneAllocator::Solution* PlaneAllocator::findOptimalSolution( void )
         return NULL;
     }
 
+    Scratch *scratch = new Scratch[ mNumLayers ];
+    if( !scratch )
+    {
+        ALOGE("Failed to allocate memory for scratch!!!");
+        return NULL;
+    }
+
+    // If these inputs were seen recently then try the solution found for them first.
+    // It is still rebuilt and validated against the current layers.
+    std::vector<int64_t> signature;
+    PlaneAllocatorJB::Memo::Entry* pMemoEntry = NULL;
+    if ( pMemo )
+    {
+        getSignature( signature );
+        pMemoEntry = pMemo->find( &mDisplayCaps, signature );
+    }
+    if ( pMemoEntry
+      && ( pMemoEntry->mAssigned.size() == mNumLayers )
+      && ( pMemoEntry->mShared.size() == mNumLayers ) )
+    {
+        for ( uint32_t ly = 0; ly < mNumLayers; ++ly )
+        {
+            scratch[ ly ].assignedPlane = pMemoEntry->mAssigned[ ly ];
+            scratch[ ly ].sharedPlane = pMemoEntry->mShared[ ly ];
+        }
+        int64_t score = 0;
+        if ( checkAssignment( scratch, score ) && buildSolution( scratch, mSolution[ 0 ] ) )
+        {
+            ALOGD_IF( PLANEALLOC_SUMMARY_DEBUG,
+                "PlaneAllocator::optimizeSolution %s Reused\n--SOLUTION--\n%s",
+                mDisplayCaps.getName(), mSolution[ 0 ].dump().string() );
+            mBestAssigned = pMemoEntry->mAssigned;
+            mBestShared = pMemoEntry->mShared;
+            mBestScore = score;
+            mbReused = true;
+            delete[] scratch;
+            return &mSolution[ 0 ];
+        }
+        ALOGD_IF( PLANEALLOC_OPT_DEBUG, "Memoized solution no longer valid, searching" );
+        for ( uint32_t ly = 0; ly < mNumLayers; ++ly )
+        {
+            scratch[ ly ] = Scratch();
+        }
+    }
+
     const uint32_t lastLayer           = mNumLayers-1;
 
     // Layers can be:
@@ -929,25 +1062,46 @@ const PlaneAllocator::Solution* PlaneAllocator::findOptimalSolution( void )
     const uint32_t exhaustedPlaneIdx = mNumPlanes+2;
 
     // Set up mask of planes that must be assigned.
-    uint32_t maskRequiredPlanes = 0;
+    PlaneMask maskRequiredPlanes;
     for (  uint32_t pl = 0; pl < mNumPlanes; ++pl )
         if ( maCachedPlaneCaps[ pl ].mFlags & CachedPlaneCaps::FLAG_HINT_REQUIRED )
-            maskRequiredPlanes |= (1<<pl);
+            maskRequiredPlanes.set( pl );
+
+    // The best score layers ly onwards could add, whatever they are assigned.
+    // A permutation is only taken if it beats the best so far, so once one is found any branch
+    // that can not beat it even with this bound is not searched further.
+    int64_t* aBestRemaining = new int64_t[ mNumLayers + 1 ];
+    if( !aBestRemaining )
+    {
+        ALOGE("Failed to allocate memory for score bounds!!!");
+        delete[] scratch;
+        return NULL;
+    }
+    aBestRemaining[ mNumLayers ] = 0;
+    for ( uint32_t ly = mNumLayers; ly > 0; --ly )
+    {
+        const LayerConfig& layerConfig = maLayerConfig[ ly-1 ];
+        int64_t best = layerConfig.mbOptional ? 0 : INT64_MIN;
+        if ( layerConfig.mUnhandledEval.mbValid )
+            best = std::max( best, layerConfig.mUnhandledEval.mScore );
+        for ( uint32_t pl = 0; pl < mNumPlanes; ++pl )
+        {
+            if ( layerConfig.mHandledEval[ pl ].mbValid )
+                best = std::max( best, layerConfig.mHandledEval[ pl ].mScore );
+        }
+        // No option for this layer leaves nothing to search.
+        aBestRemaining[ ly-1 ] = ( ( best == INT64_MIN ) || ( aBestRemaining[ ly ] == INT64_MIN ) )
+                               ? INT64_MIN : best + aBestRemaining[ ly ];
+    }
 
     // Allocate mNumPlanes to mNumLayers.
     // Each plane can be allocated once, to any one or none of the layers.
-    uint32_t maskAssigned = 0;     //< The set of assigned planes (bit0=>p0)
+    PlaneMask maskAssigned;     //< The set of assigned planes (bit0=>p0)
     uint32_t assigned = 0;      //< The count of assigned planes.
     uint32_t layer = 0;         //< The layer 'level'.
     uint32_t handledSets = 0;   //< Count of handled sets.
     uint32_t unhandledSets = 0; //< Count of unhandled sets.
 
-    Scratch *scratch = new Scratch[ mNumLayers ];
-    if( !scratch )
-    {
-        ALOGE("Failed to allocate memory for scratch!!!");
-        return NULL;
-    }
     Scratch* pSL = &scratch[layer];
 
     // This iterates all permutations of planes allocated to layers (no repeats).
@@ -955,8 +1109,8 @@ const PlaneAllocator::Solution* PlaneAllocator::findOptimalSolution( void )
     {
         ALOGD_IF( PLANEALLOC_OPT_DEBUG, "layer: %u/%p, assignedPlane %u, nextPlane %u, runHandled %u, runUnhandled %u",
             layer, pSL, pSL->assignedPlane, pSL->nextPlane, pSL->runHandled, pSL->runUnhandled );
-        ALOGD_IF( PLANEALLOC_OPT_DEBUG, "  1/ maskAssigned 0x%08x, assigned %u, handledSets %u, unhandledSets %u",
-            maskAssigned, assigned, handledSets, unhandledSets );
+        ALOGD_IF( PLANEALLOC_OPT_DEBUG, "  1/ maskAssigned %s, assigned %u, handledSets %u, unhandledSets %u",
+            maskAssigned.to_string().c_str(), assigned, handledSets, unhandledSets );
 
         // Release plane currently assigned (if any).
         // Decrement handled/unhandled count.
@@ -968,7 +1122,7 @@ const PlaneAllocator::Solution* PlaneAllocator::findOptimalSolution( void )
         else if ( pSL->assignedPlane < unhandledPlaneIdx )
         {
             ALOGE_IF( assigned == 0, ( "assigned==0" ) );
-            maskAssigned &= ~(1<<pSL->assignedPlane);
+            maskAssigned.reset( pSL->assignedPlane );
             --assigned;
             ALOGD_IF( PLANEALLOC_OPT_DEBUG, "  Unassigned %u", pSL->assignedPlane );
             pSL->assignedPlane = unhandledPlaneIdx;
@@ -978,8 +1132,8 @@ const PlaneAllocator::Solution* PlaneAllocator::findOptimalSolution( void )
         // Set assignedPlane to invalid.
         pSL->assignedPlane = INVALID_PLANE;
 
-        ALOGD_IF( PLANEALLOC_OPT_DEBUG, "  2/ maskAssigned 0x%08x, assigned %u, handledSets %u, unhandledSets %u",
-            maskAssigned, assigned, handledSets, unhandledSets );
+        ALOGD_IF( PLANEALLOC_OPT_DEBUG, "  2/ maskAssigned %s, assigned %u, handledSets %u, unhandledSets %u",
+            maskAssigned.to_string().c_str(), assigned, handledSets, unhandledSets );
 
         // Find next valid plane to give to this layer, or none.
         // (pl==numPlane => none).
@@ -1001,10 +1155,10 @@ const PlaneAllocator::Solution* PlaneAllocator::findOptimalSolution( void )
                     // Is it free to use for this layer?
                     // Does this plane support ordering w.r.t. the planes preceding it?
                     if ( maLayerConfig[layer].mHandledEval[ pl ].mbValid
-                     && ( !( maskAssigned & (1<<pl) ) )
+                     && ( !maskAssigned.test( pl ) )
                      && ( ( maCachedPlaneCaps[ pl ].mSupportedZOrderPreMask & maskAssigned ) == maskAssigned ) )
                     {
-                        maskAssigned |= (1<<pl);
+                        maskAssigned.set( pl );
                         ++assigned;
                         ALOGE_IF( assigned > mNumPlanes, ( "assigned > mNumPlanes" ) );
                         break;
@@ -1050,6 +1204,7 @@ const PlaneAllocator::Solution* PlaneAllocator::findOptimalSolution( void )
 
             uint32_t runHandled = 0;
             uint32_t runUnhandled = 0;
+            int64_t score = pSL->score;
 
             if ( pl == disabledPlaneIdx )
             {
@@ -1064,6 +1219,7 @@ const PlaneAllocator::Solution* PlaneAllocator::findOptimalSolution( void )
                 runUnhandled = pSL->runUnhandled + 1;
                 if ( pSL->runHandled )
                     ++handledSets;
+                AccumulateScore( score, maLayerConfig[ layer ].mUnhandledEval.mScore );
             }
             else
             {
@@ -1072,13 +1228,14 @@ const PlaneAllocator::Solution* PlaneAllocator::findOptimalSolution( void )
                 runHandled = pSL->runHandled + 1;
                 if ( pSL->runUnhandled )
                     ++unhandledSets;
+                AccumulateScore( score, maLayerConfig[ layer ].mHandledEval[ pl ].mScore );
             }
 
             ALOGD_IF( PLANEALLOC_OPT_DEBUG, "  AssignedPlane %u, nextPlane %u, runHandled %u, runUnhandled %u",
                 pSL->assignedPlane, pSL->nextPlane, runHandled, runUnhandled );
 
-            ALOGD_IF( PLANEALLOC_OPT_DEBUG, "  3/ maskAssigned 0x%08x, assigned %u, handledSets %u, unhandledSets %u",
-                maskAssigned, assigned, handledSets, unhandledSets );
+            ALOGD_IF( PLANEALLOC_OPT_DEBUG, "  3/ maskAssigned %s, assigned %u, handledSets %u, unhandledSets %u",
+                maskAssigned.to_string().c_str(), assigned, handledSets, unhandledSets );
 
             uint32_t finalHandledSets = handledSets + ( runHandled ? 1: 0 );
             uint32_t finalUnhandledSets = unhandledSets + ( runUnhandled ? 1: 0 );
@@ -1103,16 +1260,26 @@ const PlaneAllocator::Solution* PlaneAllocator::findOptimalSolution( void )
                 ALOGD_IF( PLANEALLOC_OPT_DEBUG, "  Invalid: planesRequired %u (assigned %u + finalUnhandledSets %u) > numPlanes %u",
                     planesRequired, assigned, finalUnhandledSets, mNumPlanes );
             }
+            else if ( bPrune && bValidSolution
+                   && ( ( aBestRemaining[ layer+1 ] == INT64_MIN )
+                     || ( score + aBestRemaining[ layer+1 ] <= bestScore ) ) )
+            {
+                // Do not continue here:
+                // No assignment of the remaining layers can beat the best solution so far.
+                ALOGD_IF( PLANEALLOC_OPT_DEBUG, "  Pruned: score %" PRIi64 " + bound %" PRIi64 " v best %" PRIi64,
+                    score, aBestRemaining[ layer+1 ], bestScore );
+                ++mPruned;
+            }
             else if ( layer == lastLayer )
             {
                 ALOGD_IF( PLANEALLOC_OPT_DEBUG, "***************************************************." );
-                ALOGD_IF( PLANEALLOC_OPT_DEBUG, "Eval permutation %u.", permutations );
+                ALOGD_IF( PLANEALLOC_OPT_DEBUG, "Eval permutation %u.", mPermutations );
 
                 bool bValid = true;
                 int32_t firstUnhandledLayer = -1;
                 uint32_t lastPlane = ~0U;
-                uint32_t maskEffectiveAssigned = maskAssigned;
-                uint32_t prePlanes = 0;
+                PlaneMask maskEffectiveAssigned = maskAssigned;
+                PlaneMask prePlanes;
 
                 for ( uint32_t ly = 0; bValid && (ly <= mNumLayers); ++ly )
                 {
@@ -1161,7 +1328,7 @@ const PlaneAllocator::Solution* PlaneAllocator::findOptimalSolution( void )
                             for ( freePlane = 0; freePlane < mNumPlanes; ++freePlane )
                             {
                                 // Skip planes already assigned.
-                                if ( maskEffectiveAssigned & ( 1<<freePlane ) )
+                                if ( maskEffectiveAssigned.test( freePlane ) )
                                 {
                                     ALOGD_IF( PLANEALLOC_OPT_DEBUG,
                                         "  Plane %u already assigned",
@@ -1197,8 +1364,8 @@ const PlaneAllocator::Solution* PlaneAllocator::findOptimalSolution( void )
                                 // Finally, check permitted ZOrder.
                                 // The planes that will be used after this one are the full set
                                 // less those preceding it and less this plane itself.
-                                uint32_t postPlanes = maskEffectiveAssigned & ~prePlanes;
-                                postPlanes &= ~(1<<freePlane);
+                                PlaneMask postPlanes = maskEffectiveAssigned & ~prePlanes;
+                                postPlanes.reset( freePlane );
                                 if ( ( ( maCachedPlaneCaps[freePlane].mSupportedZOrderPreMask & prePlanes ) == prePlanes )
                                   && ( ( maCachedPlaneCaps[freePlane].mSupportedZOrderPostMask & postPlanes ) == postPlanes ) )
                                     break;
@@ -1219,19 +1386,19 @@ const PlaneAllocator::Solution* PlaneAllocator::findOptimalSolution( void )
                                     if ( scratch[shly].assignedPlane != disabledPlaneIdx )
                                         scratch[shly].sharedPlane = freePlane;
                                 }
-                                maskEffectiveAssigned |= (1<<freePlane);
+                                maskEffectiveAssigned.set( freePlane );
                                 lastPlane = freePlane;
-                                prePlanes |= (1<<lastPlane);
+                                prePlanes.set( lastPlane );
                             }
                             firstUnhandledLayer = -1;
                         }
                         if ( ly < mNumLayers )
                         {
                             // Process *this* layer.
-                            ALOG_ASSERT( maskAssigned & (1<<scratch[ ly ].assignedPlane) );
+                            ALOG_ASSERT( maskAssigned.test( scratch[ ly ].assignedPlane ) );
 
                             lastPlane = scratch[ ly ].assignedPlane;
-                            prePlanes |= (1<<lastPlane);
+                            prePlanes.set( lastPlane );
                         }
                     }
                     else if ( ly < mNumLayers )
@@ -1245,44 +1412,20 @@ const PlaneAllocator::Solution* PlaneAllocator::findOptimalSolution( void )
                 }
 
                 // Check required planes are all used.
-                if ( maskRequiredPlanes & ~maskEffectiveAssigned )
+                if ( ( maskRequiredPlanes & ~maskEffectiveAssigned ).any() )
                 {
                     ALOGD_IF( PLANEALLOC_OPT_DEBUG,
-                        "  Invalid: maskRequiredPlanes 0x%08x v maskEffectiveAssigned 0x%08x",
-                        maskRequiredPlanes, maskEffectiveAssigned );
+                        "  Invalid: maskRequiredPlanes %s v maskEffectiveAssigned %s",
+                        maskRequiredPlanes.to_string().c_str(), maskEffectiveAssigned.to_string().c_str() );
                     bValid = false;
                 }
 
                 if ( bValid )
                 {
                     // ****************************************************************
-                    // Score arrangement.
+                    // Score arrangement (accumulated as layers were assigned).
                     // ****************************************************************
-                    int64_t totalScore = 0;
-
-                    for ( uint32_t ly = 0; ly < mNumLayers; ++ly )
-                    {
-                        if ( scratch[ ly ].assignedPlane == disabledPlaneIdx )
-                        {
-                            ALOGD_IF( PLANEALLOC_OPT_DEBUG, "  Layer %2u : Disabled      score:n/a", ly );
-                        }
-                        else if ( scratch[ ly ].assignedPlane == unhandledPlaneIdx )
-                        {
-                            ALOGD_IF( PLANEALLOC_OPT_DEBUG, "  Layer %2u : Collapsed P%2u score:%" PRIi64,
-                                ly,
-                                scratch[ ly ].sharedPlane,
-                                maLayerConfig[ ly ].mUnhandledEval.mScore );
-                            AccumulateScore( totalScore, maLayerConfig[ ly ].mUnhandledEval.mScore );
-                        }
-                        else
-                        {
-                            ALOGD_IF( PLANEALLOC_OPT_DEBUG, "  Layer %2u : Dedicated P%2u score:%" PRIi64,
-                                ly,
-                                scratch[ ly ].assignedPlane,
-                                maLayerConfig[ ly ].mHandledEval[scratch[ ly ].assignedPlane].mScore );
-                            AccumulateScore( totalScore, maLayerConfig[ ly ].mHandledEval[scratch[ ly ].assignedPlane].mScore );
-                        }
-                    }
+                    const int64_t totalScore = score;
 
                     ALOGD_IF( PLANEALLOC_OPT_DEBUG, "finalHandledSets   : %u", finalHandledSets );
                     ALOGD_IF( PLANEALLOC_OPT_DEBUG, "finalUnhandledSets : %u", finalUnhandledSets );
@@ -1296,137 +1439,27 @@ const PlaneAllocator::Solution* PlaneAllocator::findOptimalSolution( void )
                         // Alternate solutions to each of mSolution[].
                         // We only replace the current best result if this new result passes validateConstraints()
                         const uint32_t si = solutionIndex^1;
-                        Solution& solution = mSolution[si];
-
-                        // Reset new proposed output.
-                        solution.reset();
-
-                        // Construct pchZOrderStr as a string with each plane given name 'A','B',... etc.
-                        // The final string represents plane ZOrder, e.g.:
-                        //  "A", "ABC", "BA", "CAB", "C",
-                        //  etc.
-                        char zOrderStr[ mNumPlanes+1 ];
-                        memset( zOrderStr, 0, mNumPlanes+1 );
-                        uint32_t zorder = 0;
-
-                        for ( uint32_t ly = 0; ly < mNumLayers; ++ly )
-                        {
-                            if ( scratch[ ly ].assignedPlane == disabledPlaneIdx )
-                                continue;
-                            if ( scratch[ ly ].assignedPlane == unhandledPlaneIdx )
-                            {
-                                const uint32_t pl = scratch[ ly ].sharedPlane;
-                                Solution::Plane& plane = solution.maPlanes[ pl ];
-                                if ( plane.mbUsed )
-                                {
-                                    ALOG_ASSERT( plane.mbCollapsed );
-                                    ALOG_ASSERT( plane.mFirst < ly );
-                                    plane.mLast = ly;
-                                }
-                                else
-                                {
-                                    plane.mFirst = ly;
-                                    plane.mLast = ly;
-                                    plane.mbUsed = true;
-                                    plane.mbCollapsed = true;
-                                    ++solution.mCompositions;
-                                    zOrderStr[ zorder++ ] = 'A' + pl;
-                                }
-                            }
-                            else
-                            {
-                                const uint32_t pl = scratch[ ly ].assignedPlane;
-                                Solution::Plane& plane = solution.maPlanes[ pl ];
-                                ALOG_ASSERT( !plane.mbUsed );
-                                plane.mFirst = ly;
-                                plane.mLast = ly;
-                                plane.mbUsed = true;
-                                if ( maLayerConfig[ ly ].mHandledEval[ pl ].mFlags & Eval::FLAG_PREPROCESS )
-                                {
-                                    plane.mbPreProcess = true;
-                                    plane.mTarget = maLayerConfig[ ly ].mHandledEval[ pl ].mTarget;
-                                    ++solution.mCompositions;
-                                }
-                                zOrderStr[ zorder++ ] = 'A' + pl;
-                            }
-                        }
-                        // Establish correct formats for collapse/pre-process compositions.
-                        bool bPlanesValid = true;
-                        for ( uint32_t pl = 0; pl < mNumPlanes; ++pl )
+                        if ( buildSolution( scratch, mSolution[si] ) )
                         {
-                            Solution::Plane& plane = solution.maPlanes[ pl ];
-                            if ( !plane.mbUsed )
-                                continue;
-                            // Backmost layer needs to be made opaque.
-                            const bool bOpaque = ( plane.mFirst == 0 );
-
-                            // Set up a a layer describing the collapsed layer and ensure its valid to flip to the display
-                            if (plane.mbCollapsed)
-                            {
-                                Layer& layer = plane.mTarget;
-                                plane.mComposition.mpTarget = &layer;
-                                layer.setBufferTilingFormat( TILE_X );
-                                layer.setBlending( bOpaque ? EBlendMode::NONE : EBlendMode::PREMULT );
-                                layer.setPlaneAlpha(1.0f);
-                                layer.setComposition( &plane.mComposition );
-
-                                // Establish collapsed composition target
-                                DisplayCaps::ECSCClass formatClass = mDisplayCaps.halFormatToCSCClass( mDisplayInput.getFormat(), bOpaque );
-                                hwc_frect_t src = { 0, 0, (float)mDisplayInput.getWidth(), (float)mDisplayInput.getHeight() };
-                                hwc_rect_t dst = { 0, 0, (int32_t)mDisplayInput.getWidth(), (int32_t)mDisplayInput.getHeight() };
-                                layer.setSrc( src );
-                                layer.setDst( dst );
-                                layer.setBufferFormat( mDisplayCaps.getPlaneCaps( pl ).getCSCFormat( formatClass ) );
-                                layer.onUpdateFlags();
-
-                                // Validate that this layer is actually supported on the plane
-                                CachedOptions options( true, true, false );
-                                options.mPermittedPreProcessCSCMask = 0;
-                                bool bConsiderPreProcess = false;
-                                bPlanesValid = isLayerSupportedOnPlane(pl, layer, mDisplayCaps.getPlaneCaps( pl ), options, formatClass, bConsiderPreProcess);
-                                if (!bPlanesValid)
-                                {
-                                    ALOGD_IF( PLANEALLOC_CAPS_DEBUG, "%s No [Collapsed target invalid] ", layer.dump().string());
-                                    break;
-                                }
-                            }
-                        }
-                        if (bPlanesValid)
-                        {
-                            // Find best ZOrder given caps.
-                            solution.mZOrderStr = zOrderStr;
-                            solution.mZOrder = findBestZOrder( zOrderStr );
-
-                            ALOGD_IF( PLANEALLOC_OPT_DEBUG, "Proposed solution:\n%s", solution.dump().string() );
-
-                            // Finally, check this proposed output is valid.
-                            // Individual layers<->planes are already checked and confirmed possible.
-                            // However, it is still possible that specific plane state or combinations
-                            // of state can *NOT* be supported. For this reason, we must make a final
-                            // check with the final proposed arrangement.
-                            if ( validateSolution( solution ) )
-                            {
-                                // Replace best result.
-                                ALOGD_IF( PLANEALLOC_OPT_DEBUG, "New best %" PRIi64 "->%" PRIi64, bestScore, totalScore );
-                                bestScore = totalScore;
-                                bValidSolution = true;
-                                solutionIndex = si;
-                            }
-                            else
+                            // Replace best result.
+                            ALOGD_IF( PLANEALLOC_OPT_DEBUG, "New best %" PRIi64 "->%" PRIi64, bestScore, totalScore );
+                            bestScore = totalScore;
+                            bValidSolution = true;
+                            solutionIndex = si;
+                            mBestAssigned.resize( mNumLayers );
+                            mBestShared.resize( mNumLayers );
+                            for ( uint32_t ly = 0; ly < mNumLayers; ++ly )
                             {
-                                ALOGD_IF( PLANEALLOC_OPT_DEBUG, "Did not satisfy complex constraints" );
+                                mBestAssigned[ ly ] = scratch[ ly ].assignedPlane;
+                                mBestShared[ ly ] = scratch[ ly ].sharedPlane;
                             }
                         }
-                        else
-                        {
-                            ALOGD_IF( PLANEALLOC_OPT_DEBUG, "No valid output planes" );
-                        }
                     }
                     else
                     {
                         ALOGD_IF( PLANEALLOC_OPT_DEBUG, "No change (%" PRIi64 " v %" PRIi64 ")", bestScore, totalScore );
                     }
-                    ++permutations;
+                    ++mPermutations;
                 }
 
                 ALOGD_IF( PLANEALLOC_OPT_DEBUG, "***************************************************." );
@@ -1439,18 +1472,31 @@ const PlaneAllocator::Solution* PlaneAllocator::findOptimalSolution( void )
                 // Propogate the run info.
                 pSL->runHandled = runHandled;
                 pSL->runUnhandled = runUnhandled;
+                pSL->score = score;
                 ALOGD_IF( PLANEALLOC_OPT_DEBUG, "  --> Recurse to layer %u/%p, runHandled %u, runUnhandled %u",
                     layer, pSL, pSL->runHandled, pSL->runUnhandled );
             }
         }
     }
 
-    ALOGD_IF( PLANEALLOC_OPT_DEBUG, "Done [permutations:%u valid solution:%u score %" PRIi64"].",
-        permutations, bValidSolution, bestScore );
+    ALOGD_IF( PLANEALLOC_SUMMARY_DEBUG || PLANEALLOC_OPT_DEBUG, "Done [permutations:%u pruned:%u valid solution:%u score %" PRIi64"].",
+        mPermutations, mPruned, bValidSolution, bestScore );
 
+    delete[] aBestRemaining;
     delete[] scratch;
     if ( bValidSolution )
     {
+        mBestScore = bestScore;
+        if ( pMemo )
+        {
+            // Remember the assignment for these inputs.
+            if ( pMemoEntry == NULL )
+            {
+                pMemoEntry = &pMemo->replace( &mDisplayCaps, signature );
+            }
+            pMemoEntry->mAssigned = mBestAssigned;
+            pMemoEntry->mShared = mBestShared;
+        }
         ALOGD_IF( PLANEALLOC_SUMMARY_DEBUG,
             "PlaneAllocator::optimizeSolution %s Success\n--SOLUTION--\n%s",
             mDisplayCaps.getName(), mSolution[ solutionIndex ].dump().string() );
@@ -1459,6 +1505,342 @@ const PlaneAllocator::Solution* PlaneAllocator::findOptimalSolution( void )
     return NULL;
 }
 
+bool PlaneAllocator::checkAssignment( const Scratch* scratch, int64_t& score ) const
+{
+    const uint32_t unhandledPlaneIdx = mNumPlanes;
+    const uint32_t disabledPlaneIdx  = mNumPlanes+1;
+
+    PlaneMask maskAssigned;         //< Planes assigned to layers so far.
+    PlaneMask prePlanes;            //< Planes used by layers so far, including shared planes.
+    uint32_t assigned = 0;
+    uint32_t handledSets = 0;
+    uint32_t unhandledSets = 0;
+    bool bHandledRun = false;
+    bool bUnhandledRun = false;
+    bool bProtectedRun = false;
+    uint32_t firstUnhandledLayer = 0;
+    uint32_t sharedPlane = INVALID_PLANE;
+
+    // The planes assigned to layers are needed up front to check each shared plane's post zorder mask.
+    PlaneMask maskAllAssigned;
+    for ( uint32_t ly = 0; ly < mNumLayers; ++ly )
+    {
+        if ( scratch[ ly ].assignedPlane < unhandledPlaneIdx )
+            maskAllAssigned.set( scratch[ ly ].assignedPlane );
+    }
+
+    score = 0;
+    for ( uint32_t ly = 0; ly <= mNumLayers; ++ly )
+    {
+        const uint32_t pl = ( ly < mNumLayers ) ? scratch[ ly ].assignedPlane : INVALID_PLANE;
+        if ( ( ly < mNumLayers ) && ( pl > disabledPlaneIdx ) )
+            return false;
+        if ( pl == disabledPlaneIdx )
+        {
+            if ( !maLayerConfig[ ly ].mbOptional )
+                return false;
+            continue;
+        }
+        if ( pl == unhandledPlaneIdx )
+        {
+            const LayerConfig& layerConfig = maLayerConfig[ ly ];
+            if ( !layerConfig.mUnhandledEval.mbValid )
+                return false;
+            if ( !bUnhandledRun )
+            {
+                bUnhandledRun = true;
+                bProtectedRun = false;
+                firstUnhandledLayer = ly;
+                sharedPlane = scratch[ ly ].sharedPlane;
+                ++unhandledSets;
+            }
+            else if ( scratch[ ly ].sharedPlane != sharedPlane )
+            {
+                return false;
+            }
+            bProtectedRun |= layerConfig.mbEncrypted;
+            bHandledRun = false;
+            AccumulateScore( score, layerConfig.mUnhandledEval.mScore );
+            continue;
+        }
+
+        // A handled layer or the end of the stack closes any unhandled run, which is then given its plane.
+        if ( bUnhandledRun )
+        {
+            if ( ( sharedPlane >= mNumPlanes ) || maskAllAssigned.test( sharedPlane ) || prePlanes.test( sharedPlane ) )
+                return false;
+            const CachedPlaneCaps& cpc = maCachedPlaneCaps[ sharedPlane ];
+            if ( !( cpc.mFlags & CachedPlaneCaps::FLAG_CAP_COLLAPSE ) )
+                return false;
+            if ( !( cpc.mFlags & CachedPlaneCaps::FLAG_CAP_BLEND ) && ( maLayerConfig[ firstUnhandledLayer ].mIndex > 0 ) )
+                return false;
+            if ( bProtectedRun && !( cpc.mFlags & CachedPlaneCaps::FLAG_CAP_DECRYPT ) )
+                return false;
+            const PlaneMask postPlanes = maskAllAssigned & ~prePlanes;
+            if ( ( ( cpc.mSupportedZOrderPreMask & prePlanes ) != prePlanes )
+              || ( ( cpc.mSupportedZOrderPostMask & postPlanes ) != postPlanes ) )
+                return false;
+            prePlanes.set( sharedPlane );
+            bUnhandledRun = false;
+        }
+        if ( ly == mNumLayers )
+            break;
+
+        if ( !maLayerConfig[ ly ].mHandledEval[ pl ].mbValid
+          || maskAssigned.test( pl )
+          || ( ( maCachedPlaneCaps[ pl ].mSupportedZOrderPreMask & maskAssigned ) != maskAssigned ) )
+            return false;
+        maskAssigned.set( pl );
+        prePlanes.set( pl );
+        ++assigned;
+        if ( !bHandledRun )
+        {
+            bHandledRun = true;
+            ++handledSets;
+        }
+        AccumulateScore( score, maLayerConfig[ ly ].mHandledEval[ pl ].mScore );
+    }
+
+    if ( ( handledSets > mMaxHandledSets )
+      || ( unhandledSets > mMaxUnhandledSets )
+      || ( assigned + unhandledSets > mNumPlanes ) )
+        return false;
+
+    // Check required planes are all used.
+    for ( uint32_t pl = 0; pl < mNumPlanes; ++pl )
+    {
+        if ( ( maCachedPlaneCaps[ pl ].mFlags & CachedPlaneCaps::FLAG_HINT_REQUIRED ) && !prePlanes.test( pl ) )
+            return false;
+    }
+    return true;
+}
+
+void PlaneAllocator::getStats( PlaneAllocatorJB::Stats& stats ) const
+{
+    stats.mPermutations = mPermutations;
+    stats.mPruned = mPruned;
+    stats.mbReused = mbReused;
+    stats.mScore = mBestScore;
+    stats.mAssigned = mBestAssigned;
+    stats.mShared = mBestShared;
+}
+
+bool PlaneAllocator::buildSolution( const Scratch* scratch, Solution& solution )
+{
+    const uint32_t unhandledPlaneIdx = mNumPlanes;
+    const uint32_t disabledPlaneIdx  = mNumPlanes+1;
+
+    // Reset new proposed output.
+    solution.reset();
+
+    // Construct pchZOrderStr as a string with each plane given name 'A','B',... etc.
+    // The final string represents plane ZOrder, e.g.:
+    //  "A", "ABC", "BA", "CAB", "C",
+    //  etc.
+    char zOrderStr[ mNumPlanes+1 ];
+    memset( zOrderStr, 0, mNumPlanes+1 );
+    uint32_t zorder = 0;
+
+    for ( uint32_t ly = 0; ly < mNumLayers; ++ly )
+    {
+        if ( scratch[ ly ].assignedPlane == disabledPlaneIdx )
+            continue;
+        if ( scratch[ ly ].assignedPlane == unhandledPlaneIdx )
+        {
+            const uint32_t pl = scratch[ ly ].sharedPlane;
+            if ( pl >= mNumPlanes )
+                return false;
+            Solution::Plane& plane = solution.maPlanes[ pl ];
+            if ( plane.mbUsed )
+            {
+                ALOG_ASSERT( plane.mbCollapsed );
+                ALOG_ASSERT( plane.mFirst < ly );
+                plane.mLast = ly;
+            }
+            else
+            {
+                plane.mFirst = ly;
+                plane.mLast = ly;
+                plane.mbUsed = true;
+                plane.mbCollapsed = true;
+                ++solution.mCompositions;
+                zOrderStr[ zorder++ ] = 'A' + pl;
+            }
+        }
+        else
+        {
+            const uint32_t pl = scratch[ ly ].assignedPlane;
+            if ( pl >= mNumPlanes )
+                return false;
+            Solution::Plane& plane = solution.maPlanes[ pl ];
+            ALOG_ASSERT( !plane.mbUsed );
+            plane.mFirst = ly;
+            plane.mLast = ly;
+            plane.mbUsed = true;
+            if ( maLayerConfig[ ly ].mHandledEval[ pl ].mFlags & Eval::FLAG_PREPROCESS )
+            {
+                plane.mbPreProcess = true;
+                plane.mTarget = maLayerConfig[ ly ].mHandledEval[ pl ].mTarget;
+                ++solution.mCompositions;
+            }
+            zOrderStr[ zorder++ ] = 'A' + pl;
+        }
+    }
+    // Establish correct formats for collapse/pre-process compositions.
+    for ( uint32_t pl = 0; pl < mNumPlanes; ++pl )
+    {
+        Solution::Plane& plane = solution.maPlanes[ pl ];
+        if ( !plane.mbUsed )
+            continue;
+        // Backmost layer needs to be made opaque.
+        const bool bOpaque = ( plane.mFirst == 0 );
+
+        // Set up a a layer describing the collapsed layer and ensure its valid to flip to the display
+        if (plane.mbCollapsed)
+        {
+            Layer& layer = plane.mTarget;
+            plane.mComposition.mpTarget = &layer;
+            layer.setBufferTilingFormat( TILE_X );
+            layer.setBlending( bOpaque ? EBlendMode::NONE : EBlendMode::PREMULT );
+            layer.setPlaneAlpha(1.0f);
+            layer.setComposition( &plane.mComposition );
+
+            // Establish collapsed composition target
+            DisplayCaps::ECSCClass formatClass = mDisplayCaps.halFormatToCSCClass( mDisplayInput.getFormat(), bOpaque );
+            hwc_frect_t src = { 0, 0, (float)mDisplayInput.getWidth(), (float)mDisplayInput.getHeight() };
+            hwc_rect_t dst = { 0, 0, (int32_t)mDisplayInput.getWidth(), (int32_t)mDisplayInput.getHeight() };
+            layer.setSrc( src );
+            layer.setDst( dst );
+            layer.setBufferFormat( mDisplayCaps.getPlaneCaps( pl ).getCSCFormat( formatClass ) );
+            layer.onUpdateFlags();
+
+            // Validate that this layer is actually supported on the plane
+            CachedOptions options( true, true, false );
+            options.mPermittedPreProcessCSCMask = 0;
+            bool bConsiderPreProcess = false;
+            if ( !isLayerSupportedOnPlane(pl, layer, mDisplayCaps.getPlaneCaps( pl ), options, formatClass, bConsiderPreProcess) )
+            {
+                ALOGD_IF( PLANEALLOC_CAPS_DEBUG, "%s No [Collapsed target invalid] ", layer.dump().string());
+                ALOGD_IF( PLANEALLOC_OPT_DEBUG, "No valid output planes" );
+                return false;
+            }
+        }
+    }
+
+    // Find best ZOrder given caps.
+    solution.mZOrderStr = zOrderStr;
+    solution.mZOrder = findBestZOrder( zOrderStr );
+
+    ALOGD_IF( PLANEALLOC_OPT_DEBUG, "Proposed solution:\n%s", solution.dump().string() );
+
+    // Finally, check this proposed output is valid.
+    // Individual layers<->planes are already checked and confirmed possible.
+    // However, it is still possible that specific plane state or combinations
+    // of state can *NOT* be supported. For this reason, we must make a final
+    // check with the final proposed arrangement.
+    if ( !validateSolution( solution ) )
+    {
+        ALOGD_IF( PLANEALLOC_OPT_DEBUG, "Did not satisfy complex constraints" );
+        return false;
+    }
+    return true;
+}
+
+void PlaneAllocator::getSignature( std::vector<int64_t>& signature ) const
+{
+    signature.clear();
+    signature.push_back( mNumPlanes );
+    signature.push_back( mNumLayers );
+    signature.push_back( mMaxHandledSets );
+    signature.push_back( mMaxUnhandledSets );
+    signature.push_back( mDisplayInput.getWidth() );
+    signature.push_back( mDisplayInput.getHeight() );
+    signature.push_back( mDisplayInput.getFormat() );
+    signature.push_back( mDisplayInput.getRefresh() );
+    for ( uint32_t pl = 0; pl < mNumPlanes; ++pl )
+    {
+        const CachedPlaneCaps& cpc = maCachedPlaneCaps[ pl ];
+        signature.push_back( cpc.mFlags );
+        for ( uint32_t b = 0; b < mNumPlanes; ++b )
+        {
+            signature.push_back( ( cpc.mSupportedZOrderPreMask.test( b ) ? 1 : 0 )
+                               | ( cpc.mSupportedZOrderPostMask.test( b ) ? 2 : 0 ) );
+        }
+    }
+
+    const Content::LayerStack& inputStack = mDisplayInput.getLayerStack();
+    const bool bComplex = mDisplayCaps.hasComplexConstraints();
+    for ( uint32_t ly = 0; ly < mNumLayers; ++ly )
+    {
+        const LayerConfig& layerConfig = maLayerConfig[ ly ];
+        signature.push_back( layerConfig.mIndex );
+        signature.push_back( ( layerConfig.mbOptional ? 1 : 0 )
+                           | ( layerConfig.mbEncrypted ? 2 : 0 )
+                           | ( layerConfig.mUnhandledEval.mbValid ? 4 : 0 ) );
+        signature.push_back( layerConfig.mUnhandledEval.mScore );
+        for ( uint32_t pl = 0; pl < mNumPlanes; ++pl )
+        {
+            const Eval& eval = layerConfig.mHandledEval[ pl ];
+            signature.push_back( eval.mbValid ? eval.mFlags : -1 );
+            signature.push_back( eval.mbValid ? eval.mScore : 0 );
+        }
+
+        // Complex constraints are checked against the layers themselves (e.g. the bandwidth
+        // or buffer space they need), so the solution only stands if those match too.
+        if ( bComplex )
+        {
+            const Layer& layer = inputStack[ ly ];
+            const hwc_rect_t& dst = layer.getDst();
+            const hwc_frect_t& src = layer.getSrc();
+            signature.push_back( ( int64_t( dst.left ) << 32 ) | uint32_t( dst.top ) );
+            signature.push_back( ( int64_t( dst.right ) << 32 ) | uint32_t( dst.bottom ) );
+            signature.push_back( int64_t( src.left * 65536.0f ) );
+            signature.push_back( int64_t( src.top * 65536.0f ) );
+            signature.push_back( int64_t( src.right * 65536.0f ) );
+            signature.push_back( int64_t( src.bottom * 65536.0f ) );
+            signature.push_back( layer.getBufferFormat() );
+            signature.push_back( layer.getBufferTilingFormat() );
+            signature.push_back( layer.getBufferCompression() );
+            signature.push_back( int64_t( layer.getTransform() ) );
+            signature.push_back( int64_t( layer.getBlending() ) );
+            signature.push_back( int64_t( layer.getPlaneAlpha() * 65536.0f ) );
+        }
+    }
+}
+
+PlaneAllocatorJB::Memo::Entry* PlaneAllocatorJB::Memo::find( const DisplayCaps* pCaps, const std::vector<int64_t>& signature )
+{
+    ++mLookups;
+    for ( uint32_t e = 0; e < NUM_ENTRIES; ++e )
+    {
+        Entry& entry = maEntries[ e ];
+        if ( ( entry.mpCaps == pCaps ) && ( entry.mSignature == signature ) )
+        {
+            entry.mLastUsed = mLookups;
+            return &entry;
+        }
+    }
+    return NULL;
+}
+
+PlaneAllocatorJB::Memo::Entry& PlaneAllocatorJB::Memo::replace( const DisplayCaps* pCaps, const std::vector<int64_t>& signature )
+{
+    // Replace the least recently used entry.
+    uint32_t oldest = 0;
+    for ( uint32_t e = 1; e < NUM_ENTRIES; ++e )
+    {
+        if ( maEntries[ e ].mLastUsed < maEntries[ oldest ].mLastUsed )
+            oldest = e;
+    }
+    Entry& entry = maEntries[ oldest ];
+    entry.mpCaps = pCaps;
+    entry.mSignature = signature;
+    entry.mLastUsed = mLookups;
+    entry.mAssigned.clear();
+    entry.mShared.clear();
+    return entry;
+}
+
 uint32_t PlaneAllocator::findBestZOrder( const char *pchZOrderStr )
 {
     // Get ZOrder LUT.
@@ -1608,6 +1990,7 @@ bool PlaneAllocator::validateSolution( const Solution& solution )
 }
 
 PlaneAllocatorJB::PlaneAllocatorJB( bool bOptimizeIdleDisplay ) :
+    mSearch( SEARCH_MEMOIZED ),
     mbOptimizeIdleDisplay( bOptimizeIdleDisplay )
 {
     // Lazy allocation lookup of composition options on first access of the allocator.
@@ -1615,6 +1998,9 @@ PlaneAllocatorJB::PlaneAllocatorJB( bool bOptimizeIdleDisplay ) :
     if (spOptions == NULL)
         spOptions = new Options;
     ALOG_ASSERT(spOptions);
+    if (spMemo == NULL)
+        spMemo = new Memo;
+    ALOG_ASSERT(spMemo);
 }
 
 PlaneAllocatorJB::~PlaneAllocatorJB()
@@ -1642,12 +2028,14 @@ bool PlaneAllocatorJB::analyze( const Content::Display& display, const DisplayCa
     allocator.preEvaluate( spOptions, mbOptimizeIdleDisplay );
 
     // Run optimizer
-    const PlaneAllocator::Solution* pSolution = allocator.findOptimalSolution( );
+    const PlaneAllocator::Solution* pSolution =
+        allocator.findOptimalSolution( ( mSearch == SEARCH_MEMOIZED ) ? spMemo : NULL, mSearch != SEARCH_EXHAUSTIVE );
     if ( pSolution == NULL )
     {
         ALOGE( "PlaneAllocator::optimizeSolution %s Failed\n%s", caps.getName(), display.getLayerStack().dump().string() );
         return false;
     }
+    allocator.getStats( mStats );
 
     // Process solution.
     for ( uint32_t pl = 0; pl < pSolution->mNumPlanes; ++pl )
@@ -17,6 +17,8 @@
 #ifndef INTEL_UFO_HWC_OVERLAYMANAGER_H
 #define INTEL_UFO_HWC_OVERLAYMANAGER_H
 
+#include <vector>
+
 #include "base.h"
 #include "Common.h"
 #include "DisplayCaps.h"
@@ -48,8 +50,37 @@ public:
     // Returns true if succesful.
     bool analyze( const Content::Display& display, const DisplayCaps& caps, PlaneComposition& out );
 
+    // How analyze() searches for the best assignment of layers to planes.
+    // Every mode finds the same assignment; the exhaustive search is kept to check the others against.
+    enum ESearch
+    {
+        SEARCH_EXHAUSTIVE,      //< Score every valid assignment.
+        SEARCH_PRUNED,          //< Skip branches that can not beat the best assignment found so far.
+        SEARCH_MEMOIZED         //< Pruned, and reuse the assignment found for recently seen inputs (default).
+    };
+    void setSearch( ESearch search )            { mSearch = search; }
+
+    // What the last successful analyze() chose and how much searching it took.
+    class Stats
+    {
+    public:
+        Stats() : mPermutations( 0 ), mPruned( 0 ), mbReused( false ), mScore( 0 ) { }
+        uint32_t                mPermutations;  //< Valid assignments scored.
+        uint32_t                mPruned;        //< Branches not searched.
+        bool                    mbReused;       //< The assignment was taken from the memo.
+        int64_t                 mScore;         //< Score of the assignment.
+        std::vector<uint32_t>   mAssigned;      //< Plane of each layer (numPlanes => collapsed, numPlanes+1 => disabled).
+        std::vector<uint32_t>   mShared;        //< Plane of each collapsed layer.
+    };
+    const Stats& getStats() const               { return mStats; }
+
+    class Memo;
+
 private:
     static Options* spOptions;
+    static Memo* spMemo;
+    ESearch mSearch;
+    Stats mStats;
     bool mbOptimizeIdleDisplay : 1;
 };
 
@@ -15,6 +15,7 @@
 */
 
 #include <cinttypes>
+#include <time.h>
 
 #include "AbstractBufferManager.h"
 #include "BufferQueue.h"
@@ -22,6 +23,10 @@
 
 namespace hwcomposer {
 
+// A larger buffer is used for a sub-rect only if the sub-rect covers at least
+// 100/cMaxSubRectAreaPercent of it.
+static const uint32_t cMaxSubRectAreaPercent = 150;
+
 // This class should be private to the buffer queue.
 // It's a helper class to wrap a graphic buffer and an acquire fence.
 class Buffer
@@ -36,13 +41,13 @@ public:
     };
 
     // Construct a Buffer with the specified size, format and usage flags.
-    Buffer( uint32_t w, uint32_t h, int32_t format, uint32_t usage );
+    Buffer( AbstractBufferManager& bm, uint32_t w, uint32_t h, int32_t format, uint32_t usage );
 
     // Construct a Buffer from an existing GraphicBuffer.
-    Buffer( std::shared_ptr<HWCNativeHandlesp> pBuffer );
+    Buffer( AbstractBufferManager& bm, std::shared_ptr<HWCNativeHandlesp> pBuffer );
 
     // Check underlying allocation was succesful.
-    bool allocationOK( void )  { return  ( ( mpGraphicBuffer != NULL )
+    bool allocationOK( void ) const { return  ( ( mpGraphicBuffer != NULL )
                                         && ( mpGraphicBuffer->handle != NULL ) ); }
 
     // Allocate the actual graphics buffer.
@@ -52,10 +57,14 @@ public:
     void reallocate( uint32_t w, uint32_t h, int32_t format, uint32_t  usage );
 
     // Reconfigue this Buffer with a new size, format and usage flags.
-    void reconfigure( uint32_t w, uint32_t h, int32_t format, uint32_t  usage );
+    // Returns true if the buffer had to be (re)allocated.
+    bool reconfigure( uint32_t w, uint32_t h, int32_t format, uint32_t  usage );
 
     // Compare buffer with required configuration.
     bool matchesConfiguration( uint32_t w, uint32_t h, int32_t format, uint32_t  usage );
+    // Returns true if the buffer is a larger size class that can hold a w x h sub-rect
+    // that covers enough of its area (see cMaxSubRectAreaPercent).
+    bool fitsConfiguration( uint32_t w, uint32_t h, int32_t format, uint32_t  usage );
 
     // Get human-readable description of Buffer state.
     HWCString dump( void );
@@ -75,18 +84,19 @@ public:
 };
 
 
-Buffer::Buffer( uint32_t w, uint32_t h, int32_t format, uint32_t usage ) :
-     mBM( AbstractBufferManager::get() ),
+Buffer::Buffer( AbstractBufferManager& bm, uint32_t w, uint32_t h, int32_t format, uint32_t usage ) :
+     mBM( bm ),
      mSizeBytes( 0 ),
      mpRef(NULL),
      mUse(0),
+     mLastFrameUsedTime(0),
      mbShared( false )
 {
     allocate( w, h, format, usage );
 }
 
-Buffer::Buffer( std::shared_ptr<HWCNativeHandlesp> pBuffer ) :
-    mBM( AbstractBufferManager::get() ),
+Buffer::Buffer( AbstractBufferManager& bm, std::shared_ptr<HWCNativeHandlesp> pBuffer ) :
+    mBM( bm ),
     mpGraphicBuffer( pBuffer ),
     mSizeBytes( 0 ),
     mpRef(NULL),
@@ -138,16 +148,18 @@ void Buffer::reallocate( uint32_t w, uint32_t h, int32_t format, uint32_t  usage
     }
 }
 
-void Buffer::reconfigure( uint32_t w, uint32_t h, int32_t format, uint32_t  usage )
+bool Buffer::reconfigure( uint32_t w, uint32_t h, int32_t format, uint32_t  usage )
 {
     HWCASSERT( w );
     HWCASSERT( h );
     HWCASSERT( format );
     HWCASSERT( usage & GRALLOC_USAGE_HW_COMPOSER );
+    bool bAllocated = false;
     if ( !allocationOK() )
     {
         // Attempt to allocate a buffer that was not yet successfully allocated.
         allocate( w, h, format, usage );
+        bAllocated = true;
     }
     else if ( ( mBuffer.width != w )
 	   || ( mBuffer.height != h )
@@ -157,9 +169,11 @@ void Buffer::reconfigure( uint32_t w, uint32_t h, int32_t format, uint32_t  usag
         // Re-allocate an existing buffer.
         mAcquireFence.waitAndClose();
         reallocate( w, h, format, usage );
+        bAllocated = true;
     }
     ETRACEIF( !allocationOK(), "BufferQueue failed to reconfigure [%ux%u fmt:%u/%s usage:0x%x]",
 	    w, h, format, getDRMFormatString(format), usage );
+    return bAllocated;
 }
 
 bool Buffer::matchesConfiguration(uint32_t w, uint32_t h, int32_t format, uint32_t  usage)
@@ -180,6 +194,19 @@ bool Buffer::matchesConfiguration(uint32_t w, uint32_t h, int32_t format, uint32
     return bMatch;
 }
 
+bool Buffer::fitsConfiguration(uint32_t w, uint32_t h, int32_t format, uint32_t  usage)
+{
+    if ( !allocationOK() )
+        return false;
+
+    return ( mBuffer.width >= w )
+        && ( mBuffer.height >= h )
+        && ( mBuffer.format == format )
+        && ( mBuffer.usage == usage )
+        && ( (uint64_t)mBuffer.width * mBuffer.height * 100
+             <= (uint64_t)w * h * cMaxSubRectAreaPercent );
+}
+
 HWCString Buffer::dump( void )
 {
     if ( !allocationOK() )
@@ -203,14 +230,48 @@ HWCString Buffer::dump( void )
 		    mpRef
 		    mAcquireFence.dump().string()
                     );
+#else
+    return HWCString::format("Record:%p %8u bytes%s %4dx%4d 0x%08x usage:0x%x use:%c|%c %03" PRIi64 "ms ref:%-18p %s",
+		    this, mSizeBytes, mbShared ? " (shared)" : "",
+		    mBuffer.width, mBuffer.height, mBuffer.format, mBuffer.usage,
+                    mUse & EUsedThisFrame ? 'U' : '-',
+                    mUse & EUsedRecently ? 'R' : '-',
+                    ( mLastFrameUsedTime / 1000000 ) % 1000,
+		    mpRef,
+		    mAcquireFence.dump().string()
+                    );
 #endif
 }
 
+static nsecs_t monotonicTime( void )
+{
+    struct timespec t;
+    clock_gettime( CLOCK_MONOTONIC, &t );
+    return ( (nsecs_t)t.tv_sec * 1000000000LL ) + t.tv_nsec;
+}
+
+// Size class demand decays by this much per frame, so a class that is no longer
+// requested drops below cMinClassDemand after about one second at 60fps.
+static const float cClassDemandDecay = 0.95f;
+static const float cMinClassDemand = 0.05f;
+
 BufferQueue::BufferQueue() :
+    BufferQueue( AbstractBufferManager::get() )
+{
+}
+
+BufferQueue::BufferQueue( AbstractBufferManager& bm ) :
 #if INTEL_HWC_INTERNAL_BUILD
     mStatsEnabled( "compbufferstats", 0 ),
 #endif
     mOptionGCTimeout( "compbuffergc", 8000 ),
+    mOptionWaitTimeout( "compbufferwait", 500 ),
+    mOptionSizeClasses( "compbufferclass", 1 ),
+    mBM( bm ),
+    mAllocationCount(0),
+    mPeakAllocBytes(0),
+    mWaitTimeouts(0),
+    mWaitNoCandidates(0),
     mMaxBufferCount(0),
     mMaxBufferAlloc(0),
     mBufferAllocBytes(0),
@@ -232,9 +293,21 @@ void BufferQueue::setConstraints( uint32_t maxBufferCount, uint32_t maxBufferAll
     DTRACEIF( BUFFERQUEUE_DEBUG, "BufferQueue x%u %uMB", mMaxBufferCount, mMaxBufferAlloc );
 }
 
+uint32_t BufferQueue::sizeClass( uint32_t size )
+{
+    uint32_t step = cMinSizeClassStep;
+    while ( step * 16 <= size )
+    {
+        step <<= 1;
+    }
+    return alignTo( size, step );
+}
+
 HWCString BufferQueue::dump( void ) const
 {
     HWCString output;
+    output.appendFormat( "BufferQueue: x%zu %u bytes (peak %u, budget %u) allocations %u classes %zu\n",
+        mBuffers.size(), mBufferAllocBytes, mPeakAllocBytes, mMaxBufferAlloc, mAllocationCount, mClassDemand.size() );
     for (uint32_t i = 0; i < mBuffers.size(); i++)
     {
         if ( mBuffers[i]->allocationOK() )
@@ -246,9 +319,53 @@ HWCString BufferQueue::dump( void ) const
             output.appendFormat( "BufferQueue: i%u !ALLOCATION FAILED!\n", i );
         }
     }
+    if ( mWaitHistogram.mSamples )
+    {
+        output += mWaitHistogram.dump( "all" );
+        output += mWaitHistogramRecent.dump( "recent" );
+        output.appendFormat( "BufferQueue: wait timeouts %u, no buffer to wait for %u\n", mWaitTimeouts, mWaitNoCandidates );
+    }
+    return output;
+}
+
+HWCString BufferQueue::WaitHistogram::dump( const char* pchName ) const
+{
+    HWCString output = HWCString::format( "BufferQueue: wait %-6s x%u avg %" PRIu64 "us max %" PRIu64 "us :",
+                                          pchName, mSamples, mSamples ? mTotalUs / mSamples : 0, mMaxUs );
+    for ( uint32_t s = 0; s < HISTOGRAM_SLOTS; ++s )
+    {
+        if ( s == 0 )
+            output.appendFormat( " <1ms %u", mSlot[ s ] );
+        else if ( s < HISTOGRAM_SLOTS-1 )
+            output.appendFormat( ", <%ums %u", 1U << s, mSlot[ s ] );
+        else
+            output.appendFormat( ", >=%ums %u", 1U << ( s - 1 ), mSlot[ s ] );
+    }
+    output += "\n";
     return output;
 }
 
+void BufferQueue::sampleWait( nsecs_t startTime, EWaitResult result )
+{
+    const uint64_t us = (uint64_t)( monotonicTime() - startTime ) / 1000;
+    if ( mWaitHistogramRecent.mSamples >= RECENT_WAITS )
+    {
+        mWaitHistogramRecent.reset( );
+    }
+    mWaitHistogram.sample( us );
+    mWaitHistogramRecent.sample( us );
+    if ( result == EWaitTimeout )
+    {
+        ++mWaitTimeouts;
+    }
+    else if ( result == EWaitNoCandidates )
+    {
+        ++mWaitNoCandidates;
+    }
+    DTRACEIF( BUFFERQUEUE_DEBUG, "BufferQueue: waited %" PRIu64 "us for a buffer%s", us,
+              result == EWaitTimeout ? " (timeout)" : result == EWaitNoCandidates ? " (nothing to wait for)" : "" );
+}
+
 void BufferQueue::dumpBlockedBuffers( void )
 {
     for (uint32_t i = 0; i < mBuffers.size(); i++)
@@ -536,6 +653,14 @@ BufferQueue::BufferHandle BufferQueue::dequeue(uint32_t width, uint32_t height,
         bufferFormat = altFormat;
     }
 
+    // Pool buffers by size class so that a target that changes size a little keeps reusing
+    // its buffers. The user only renders to the requested sub-rect.
+    if ( mOptionSizeClasses )
+    {
+        width = sizeClass( width );
+        height = sizeClass( height );
+    }
+
     // First check to see if any current buffers have been released
     pBuffer = checkForMatchingAvailableBuffer(width, height, bufferFormat, usage);
     if (pBuffer == NULL)
@@ -546,19 +671,19 @@ BufferQueue::BufferHandle BufferQueue::dequeue(uint32_t width, uint32_t height,
 	DTRACEIF( BUFFERQUEUE_DEBUG, " Need new/reuse buffers %zu/%u alloc %u/%u est +%u bytes",
             mBuffers.size(), mMaxBufferCount, mBufferAllocBytes, mMaxBufferAlloc,  estimateWorstCaseSize );
 
-        if ( ( !mMaxBufferCount || ( mBuffers.size() < mMaxBufferCount) )
-          && ( !mMaxBufferAlloc || ( ( mBufferAllocBytes + estimateWorstCaseSize ) < mMaxBufferAlloc ) ) )
+        // Evicting free buffers that are unlikely to be reused if that makes enough room.
+        if ( makeRoom( estimateWorstCaseSize ) )
         {
 	    DTRACEIF(BUFFERQUEUE_DEBUG, "BufferQueue::dequeue New buffer allocated");
             // Add new Buffers on demand.
-            pBuffer = new Buffer(width, height, bufferFormat, usage);
+            pBuffer = new Buffer(mBM, width, height, bufferFormat, usage);
             if ( ( pBuffer == NULL ) || ( !pBuffer->allocationOK() ) )
             {
 		ETRACE( "BufferQueue::Buffer allocation failure" );
                 delete pBuffer;
                 return NULL;
             }
-            mBufferAllocBytes += pBuffer->mSizeBytes;
+            addAllocation( pBuffer->mSizeBytes );
             mLatestAvailableBuffer = mBuffers.size();
             mBuffers.push_back(pBuffer);
 	    DTRACEIF(BUFFERQUEUE_DEBUG, "BufferQueue::dequeue pool grown - new size %u", mLatestAvailableBuffer+1);
@@ -580,13 +705,20 @@ BufferQueue::BufferHandle BufferQueue::dequeue(uint32_t width, uint32_t height,
             }
             // Ensure it matches the current configuration.
             mBufferAllocBytes -= pBuffer->mSizeBytes;
-            pBuffer->reconfigure(width, height, bufferFormat, usage);
+            const bool bAllocated = pBuffer->reconfigure(width, height, bufferFormat, usage);
             if ( !pBuffer->allocationOK() )
             {
 		ETRACE( "BufferQueue::Buffer reconfigure alloc failure" );
                 return NULL;
             }
-            mBufferAllocBytes += pBuffer->mSizeBytes;
+            if ( bAllocated )
+            {
+                addAllocation( pBuffer->mSizeBytes );
+            }
+            else
+            {
+                mBufferAllocBytes += pBuffer->mSizeBytes;
+            }
         }
     }
 
@@ -636,6 +768,12 @@ std::shared_ptr<HWCNativeHandlesp> BufferQueue::getGraphicBuffer( BufferHandle h
         return handle->mpGraphicBuffer;
 }
 
+const HwcBuffer& BufferQueue::getBufferDetails( BufferHandle handle ) const
+{
+    HWCASSERT( handle );
+    return handle->mBuffer;
+}
+
 void BufferQueue::registerReference( BufferHandle handle, BufferReference* pExternalObject )
 {
     HWCASSERT( handle );
@@ -679,6 +817,11 @@ Buffer* BufferQueue::checkForMatchingAvailableBuffer( uint32_t w, uint32_t h, in
 {
     DTRACEIF( BUFFERQUEUE_DEBUG, "checkForMatchingAvailableBuffer" );
 
+    // With size classes, a free buffer of a larger class is used for the sub-rect if no
+    // buffer of the exact class is free. The smallest such buffer is preferred.
+    uint32_t bestFit = ~0U;
+    uint64_t bestFitArea = ~0ULL;
+
     for ( uint32_t i = 0; i < mBuffers.size(); i++ )
     {
         Buffer& nb = *mBuffers[ i ];
@@ -712,6 +855,26 @@ Buffer* BufferQueue::checkForMatchingAvailableBuffer( uint32_t w, uint32_t h, in
             }
 	    DTRACEIF( BUFFERQUEUE_DEBUG, "  is matched and unused but not ready, looking for another" );
         }
+        else if ( mOptionSizeClasses
+               && ( i != mDequeuedBuffer )
+               && nb.fitsConfiguration( w, h, format, usage ) )
+        {
+            const uint64_t area = (uint64_t)nb.mBuffer.width * nb.mBuffer.height;
+            if ( ( area < bestFitArea )
+              && ( nb.mAcquireFence.isNull()
+                || ( nb.mAcquireFence.isValid() && nb.mAcquireFence.checkAndClose() ) ) )
+            {
+		DTRACEIF( BUFFERQUEUE_DEBUG, "  fits as a sub-rect and is ready" );
+                bestFit = i;
+                bestFitArea = area;
+            }
+        }
+    }
+    if ( bestFit != ~0U )
+    {
+	DTRACEIF( BUFFERQUEUE_DEBUG, "checkForMatchingAvailableBuffer Using larger buffer %u", bestFit );
+        mLatestAvailableBuffer = bestFit;
+        return mBuffers[ bestFit ];
     }
     DTRACEIF(BUFFERQUEUE_DEBUG, "checkForMatchingAvailableBuffer No match" );
     return NULL;
@@ -721,10 +884,22 @@ Buffer* BufferQueue::waitForFirstAvailableBuffer( uint32_t w, uint32_t h, int32_
 {
     DTRACEIF( BUFFERQUEUE_DEBUG, "waitForFirstAvailableBuffer" );
 
-    const uint32_t retryAttempts = 50; // 0.5 second retries,
-    const uint32_t retryDelayMS  = 10;
-    for ( uint32_t retries = retryAttempts; retries; --retries )
+    // Hwc fences can also be released by cancel(), which does not signal the native fence,
+    // so the candidates are re-checked at least this often while waiting.
+    const uint32_t recheckMS = 10;
+    const nsecs_t startTime = monotonicTime();
+    const nsecs_t deadline = startTime + (nsecs_t)mOptionWaitTimeout.get() * 1000000;
+
+    std::vector<Timeline::NativeFence> fences;
+    std::vector<uint32_t> candidates;
+    fences.reserve( mBuffers.size() );
+    candidates.reserve( mBuffers.size() );
+    EWaitResult result = EWaitTimeout;
+    for (;;)
     {
+        fences.clear();
+        candidates.clear();
+        bool bAwaitingFence = false;
         for ( uint32_t i = 0; i < mBuffers.size(); i++ )
         {
             Buffer& nb = *mBuffers[ i ];
@@ -745,25 +920,76 @@ Buffer* BufferQueue::waitForFirstAvailableBuffer( uint32_t w, uint32_t h, int32_
                 {
 		    DTRACEIF( BUFFERQUEUE_DEBUG, "  is unused and fence is null, returning" );
                     mLatestAvailableBuffer = i;
+                    sampleWait( startTime, EWaitReleased );
                     return &nb;
                 }
-                else if ( nb.mAcquireFence.isValid()
-                       && nb.mAcquireFence.checkAndClose() )
+                else if ( nb.mAcquireFence.isValid() )
                 {
-		    DTRACEIF( BUFFERQUEUE_DEBUG, "  is unused and signalled, returning" );
-                    mLatestAvailableBuffer = i;
-                    return &nb;
+                    if ( nb.mAcquireFence.checkAndClose() )
+                    {
+		        DTRACEIF( BUFFERQUEUE_DEBUG, "  is unused and signalled, returning" );
+                        mLatestAvailableBuffer = i;
+                        sampleWait( startTime, EWaitReleased );
+                        return &nb;
+                    }
+                    fences.push_back( nb.mAcquireFence.get() );
+                    candidates.push_back( i );
+                }
+                else
+                {
+                    // Dequeued, or queued before its release fence was provided.
+                    bAwaitingFence = true;
                 }
             }
         }
-	DTRACEIF(BUFFERQUEUE_DEBUG, " waiting for %dms for a free buffer", retryDelayMS);
-        usleep( retryDelayMS * 1000 );
+
+        if ( fences.empty() && !bAwaitingFence )
+        {
+            result = EWaitNoCandidates;
+            break;
+        }
+        const nsecs_t remaining = deadline - monotonicTime();
+        if ( remaining <= 0 )
+        {
+            break;
+        }
+
+        uint32_t waitMS = (uint32_t)( ( remaining + 999999 ) / 1000000 );
+        if ( waitMS > recheckMS )
+        {
+            waitMS = recheckMS;
+        }
+        if ( fences.empty() )
+        {
+	    DTRACEIF( BUFFERQUEUE_DEBUG, " waiting for %ums for a release fence", waitMS );
+            usleep( waitMS * 1000 );
+            continue;
+        }
+	DTRACEIF( BUFFERQUEUE_DEBUG, " waiting up to %ums for one of x%zu release fences", waitMS, fences.size() );
+        const int32_t signalled = Timeline::waitAny( fences.data(), fences.size(), waitMS );
+        if ( ( signalled >= 0 )
+          && mBuffers[ candidates[ signalled ] ]->mAcquireFence.checkAndClose() )
+        {
+            const uint32_t i = candidates[ signalled ];
+	    DTRACEIF( BUFFERQUEUE_DEBUG, "  Buffer %u signalled, returning", i );
+            mLatestAvailableBuffer = i;
+            sampleWait( startTime, EWaitReleased );
+            return mBuffers[ i ];
+        }
     }
+    sampleWait( startTime, result );
 
     // Fallback path.
     // This is to cover the situation where all composition buffers (count/allocation)
     // are exhausted and blocking.
-    Log::aloge(true, "%s: Timeout waiting for client to release buffers.", __FUNCTION__ );
+    if ( result == EWaitNoCandidates )
+    {
+        Log::aloge(true, "%s: No buffer to wait for, all are in use this frame.", __FUNCTION__ );
+    }
+    else
+    {
+        Log::aloge(true, "%s: Timeout waiting for client to release buffers.", __FUNCTION__ );
+    }
     dumpBlockedBuffers( );
 
     // Find an existing buffer that can be used as a fallback.
@@ -780,8 +1006,8 @@ Buffer* BufferQueue::waitForFirstAvailableBuffer( uint32_t w, uint32_t h, int32_
     {
 	Log::aloge(true, "%s: Fallback buffer %u no suitable buffer to share/kick",
             __FUNCTION__, mBuffers.size() );
-        pBuffer = new Buffer( w, h, format, usage );
-        mBufferAllocBytes += pBuffer->mSizeBytes;
+        pBuffer = new Buffer( mBM, w, h, format, usage );
+        addAllocation( pBuffer->mSizeBytes );
     }
     else
     {
@@ -805,15 +1031,15 @@ Buffer* BufferQueue::waitForFirstAvailableBuffer( uint32_t w, uint32_t h, int32_
                         pFallback->mpGraphicBuffer == NULL ? 0 : pFallback->mpGraphicBuffer->handle,
                         fallback, pFallback->dump().string() );
 
-            pBuffer = new Buffer( pFallback->mpGraphicBuffer );
+            pBuffer = new Buffer( mBM, pFallback->mpGraphicBuffer );
         }
         else
         {
             // Create a new allocation at the required size/format.
-            pBuffer = new Buffer( w, h, format, usage );
+            pBuffer = new Buffer( mBM, w, h, format, usage );
             if ( pBuffer && pBuffer->allocationOK() )
             {
-                mBufferAllocBytes += pBuffer->mSizeBytes;
+                addAllocation( pBuffer->mSizeBytes );
                 // Drop the fallback record's existing allocation and replace it
                 // with a share to our pBuffer record's new GraphicBuffer.
 		Log::aloge( true,
@@ -891,6 +1117,188 @@ int32_t BufferQueue::findFallbackBuffer( uint32_t w, uint32_t h, int32_t format,
     return fallback;
 }
 
+BufferQueue::ClassDemand* BufferQueue::findClassDemand( const Buffer& b )
+{
+    for ( ClassDemand& d : mClassDemand )
+    {
+        if ( ( d.mWidth == b.mBuffer.width )
+          && ( d.mHeight == b.mBuffer.height )
+          && ( d.mFormat == (int32_t)b.mBuffer.format )
+          && ( d.mUsage == b.mBuffer.usage ) )
+        {
+            return &d;
+        }
+    }
+    return NULL;
+}
+
+const BufferQueue::ClassDemand* BufferQueue::findClassDemand( const Buffer& b ) const
+{
+    return const_cast<BufferQueue*>( this )->findClassDemand( b );
+}
+
+void BufferQueue::updateClassDemand( void )
+{
+    // Count the buffers of each class used this frame.
+    std::vector<uint32_t> used( mClassDemand.size(), 0 );
+    for ( Buffer* b : mBuffers )
+    {
+        if ( b->mbShared || !( b->mUse & Buffer::EUsedThisFrame ) || !b->allocationOK() )
+        {
+            continue;
+        }
+        ClassDemand* pDemand = findClassDemand( *b );
+        if ( pDemand == NULL )
+        {
+            ClassDemand d = { b->mBuffer.width, b->mBuffer.height, (int32_t)b->mBuffer.format, b->mBuffer.usage, 0.0f };
+            mClassDemand.push_back( d );
+            used.push_back( 0 );
+            pDemand = &mClassDemand.back();
+        }
+        ++used[ pDemand - mClassDemand.data() ];
+    }
+
+    for ( int32_t c = mClassDemand.size()-1; c >= 0; c-- )
+    {
+        ClassDemand& d = mClassDemand[c];
+        d.mDemand *= cClassDemandDecay;
+        if ( d.mDemand < used[c] )
+        {
+            d.mDemand = used[c];
+        }
+        if ( d.mDemand < cMinClassDemand )
+        {
+            DTRACEIF( BUFFERQUEUE_DEBUG, "BufferQueue: class %ux%u %d 0x%x no longer requested",
+                d.mWidth, d.mHeight, d.mFormat, d.mUsage );
+            mClassDemand.erase( mClassDemand.begin() + c );
+        }
+    }
+}
+
+float BufferQueue::getReuseLikelihood( uint32_t index ) const
+{
+    const Buffer& b = *mBuffers[ index ];
+    const ClassDemand* pDemand = findClassDemand( b );
+    float likelihood = pDemand ? pDemand->mDemand : 0.0f;
+
+    // Buffers of the same class that were used more recently are picked first.
+    for ( uint32_t i = 0; i < mBuffers.size(); i++ )
+    {
+        const Buffer& other = *mBuffers[ i ];
+        if ( ( i == index ) || other.mbShared || !other.allocationOK() )
+        {
+            continue;
+        }
+        if ( ( other.mBuffer.width != b.mBuffer.width )
+          || ( other.mBuffer.height != b.mBuffer.height )
+          || ( other.mBuffer.format != b.mBuffer.format )
+          || ( other.mBuffer.usage != b.mBuffer.usage ) )
+        {
+            continue;
+        }
+        if ( ( other.mUse & Buffer::EUsedThisFrame )
+          || ( other.mLastFrameUsedTime > b.mLastFrameUsedTime )
+          || ( ( other.mLastFrameUsedTime == b.mLastFrameUsedTime ) && ( i < index ) ) )
+        {
+            likelihood -= 1.0f;
+        }
+    }
+    return likelihood;
+}
+
+int32_t BufferQueue::findEvictionCandidate( void ) const
+{
+    int32_t candidate = -1;
+    float candidateLikelihood = 0.0f;
+    for ( uint32_t i = 0; i < mBuffers.size(); i++ )
+    {
+        const Buffer& b = *mBuffers[ i ];
+        if ( b.mbShared || ( b.mUse & Buffer::EUsedThisFrame ) || !b.mAcquireFence.isNull() || ( i == mDequeuedBuffer ) )
+        {
+            continue;
+        }
+        const float likelihood = getReuseLikelihood( i );
+        if ( ( candidate < 0 )
+          || ( likelihood < candidateLikelihood )
+          || ( ( likelihood == candidateLikelihood )
+            && ( b.mLastFrameUsedTime < mBuffers[ candidate ]->mLastFrameUsedTime ) ) )
+        {
+            candidate = i;
+            candidateLikelihood = likelihood;
+        }
+    }
+    DTRACEIF( BUFFERQUEUE_DEBUG && ( candidate >= 0 ), "BufferQueue: eviction candidate %d likelihood %.2f", candidate, candidateLikelihood );
+    return candidate;
+}
+
+bool BufferQueue::makeRoom( uint32_t bytes )
+{
+    // Free buffers that have signalled are only closed lazily, so check them first.
+    uint32_t freeCount = 0;
+    uint32_t freeBytes = 0;
+    for ( Buffer* b : mBuffers )
+    {
+        if ( b->mAcquireFence.isValid() )
+        {
+            b->mAcquireFence.checkAndClose();
+        }
+        if ( !b->mbShared && !( b->mUse & Buffer::EUsedThisFrame ) && b->mAcquireFence.isNull() )
+        {
+            ++freeCount;
+            freeBytes += b->mSizeBytes;
+        }
+    }
+
+    // Evict nothing unless evicting would be enough.
+    const uint32_t count = mBuffers.size();
+    if ( ( mMaxBufferCount && ( count - freeCount >= mMaxBufferCount ) )
+      || ( mMaxBufferAlloc && ( mBufferAllocBytes - freeBytes + bytes >= mMaxBufferAlloc ) ) )
+    {
+        return false;
+    }
+
+    while ( ( mMaxBufferCount && ( mBuffers.size() >= mMaxBufferCount ) )
+         || ( mMaxBufferAlloc && ( mBufferAllocBytes + bytes >= mMaxBufferAlloc ) ) )
+    {
+        const int32_t victim = findEvictionCandidate( );
+        if ( victim < 0 )
+        {
+            return false;
+        }
+        Log::alogd( BUFFERQUEUE_DEBUG, "InternalBuffer:%02d evicted for +%u bytes (likelihood %.2f) %s",
+            victim, bytes, getReuseLikelihood( victim ), mBuffers[ victim ]->dump().string() );
+        evictBuffer( victim );
+    }
+    return true;
+}
+
+void BufferQueue::evictBuffer( uint32_t i )
+{
+    Buffer& b = *mBuffers[i];
+    if ( b.mpRef )
+    {
+        // Inform an existing external reference that this buffer is no longer valid.
+	DTRACEIF( BUFFERQUEUE_DEBUG, "Invalidating external reference %p", b.mpRef );
+        b.mpRef->referenceInvalidate( &b );
+    }
+    DTRACEIF( BUFFERQUEUE_DEBUG, "Deleting buffer record %p", &b );
+
+    mBufferAllocBytes -= b.mSizeBytes;
+    delete mBuffers[i];
+    mBuffers.erase(mBuffers.begin() + i);
+    mLatestAvailableBuffer = 0;
+}
+
+void BufferQueue::addAllocation( uint32_t bytes )
+{
+    ++mAllocationCount;
+    mBufferAllocBytes += bytes;
+    if ( mBufferAllocBytes > mPeakAllocBytes )
+    {
+        mPeakAllocBytes = mBufferAllocBytes;
+    }
+}
+
 void BufferQueue::idleTimeoutHandler( void )
 {
     Log::alogd( BUFFERQUEUE_DEBUG, "BufferQueue: idle timeout" );
@@ -971,13 +1379,30 @@ void BufferQueue::processBuffers( void )
         }
     }
 
+    // Update size class demand from this frame's usage.
+    updateClassDemand( );
+
     uint32_t trimmed = 0;
-#ifdef uncomment
+
+    // Evict the buffers least likely to be reused while we are over the constraints.
+    while ( ( ( mMaxBufferAlloc > 0 ) && ( mBufferAllocBytes > mMaxBufferAlloc ) )
+         || ( ( mMaxBufferCount > 0 ) && ( mBuffers.size() > mMaxBufferCount ) ) )
+    {
+        const int32_t victim = findEvictionCandidate( );
+        if ( victim < 0 )
+        {
+            break;
+        }
+        Log::alogd( BUFFERQUEUE_DEBUG, "InternalBuffer:%02d GC overallocated (x%zu v %u, %8u v %8u bytes) likelihood %.2f %s",
+            victim, mBuffers.size(), mMaxBufferCount, mBufferAllocBytes, mMaxBufferAlloc,
+            getReuseLikelihood( victim ), mBuffers[ victim ]->dump().string() );
+        evictBuffer( victim );
+        ++trimmed;
+    }
+
     // Tag used buffers with system time.
-    nsecs_t nowTime = systemTime(CLOCK_MONOTONIC);
-#else
-	nsecs_t nowTime = 0;
-#endif
+    nsecs_t nowTime = monotonicTime();
+
     // Iterate buffers in reverse order in case we garbage collect them.
     for ( int32_t i = mBuffers.size()-1; i >= 0; i-- )
     {
@@ -1013,41 +1438,24 @@ void BufferQueue::processBuffers( void )
 
         bool bRemoveBuffer = false;
 
-        if ( ( mMaxBufferAlloc > 0 ) && ( mBufferAllocBytes > mMaxBufferAlloc ) )
-        {
-            // Remove because we are exceeding the buffer allocation limit.
-            Log::alogd( BUFFERQUEUE_DEBUG, "InternalBuffer:%02d GC overallocated bytes (%8u v %8u) %s",
-                i, mBufferAllocBytes, mMaxBufferAlloc, b.dump().string() );
-            bRemoveBuffer = true;
-        }
-        else if ( ( mMaxBufferCount > 0 ) && ( mBuffers.size() > mMaxBufferCount ) )
+        if ( !( b.mUse & Buffer::EUsedRecently ) )
         {
-            // Remove because we are exceeding the buffer count limit.
-            Log::alogd( BUFFERQUEUE_DEBUG, "InternalBuffer:%02d GC overallocated count (%02zd v %02u) %s",
-                i, mBuffers.size(), mMaxBufferCount, b.dump().string() );
+            // Remove because it has not be used for a long time.
+            Log::alogd( BUFFERQUEUE_DEBUG, "InternalBuffer:%02d GC unused %s",
+                i, b.dump().string() );
             bRemoveBuffer = true;
         }
-        else if ( !( b.mUse & Buffer::EUsedRecently ) )
+        else if ( !b.mbShared && ( findClassDemand( b ) == NULL ) )
         {
-            // Remove because it has not be used for a long time.
-            Log::alogd( BUFFERQUEUE_DEBUG, "InternalBuffer:%02d GC unused %s",
+            // Remove because nothing has asked for a buffer of this size class for a while.
+            Log::alogd( BUFFERQUEUE_DEBUG, "InternalBuffer:%02d GC class not requested %s",
                 i, b.dump().string() );
             bRemoveBuffer = true;
         }
 
         if ( bRemoveBuffer )
         {
-            if ( b.mpRef )
-            {
-                // Inform an existing external reference that this buffer is no longer valid.
-		DTRACEIF( BUFFERQUEUE_DEBUG, "Invalidating external reference %p", b.mpRef );
-                b.mpRef->referenceInvalidate( &b );
-            }
-	    DTRACEIF( BUFFERQUEUE_DEBUG, "Deleting buffer record %p", &b );
-
-            mBufferAllocBytes -= mBuffers[i]->mSizeBytes;
-            delete mBuffers[i];
-	    mBuffers.erase(mBuffers.begin() + i);
+            evictBuffer( i );
             ++trimmed;
         }
     }
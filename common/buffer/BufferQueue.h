@@ -17,6 +17,7 @@
 #ifndef COMMON_BUFFER_BUFFERQUEUE_H
 #define COMMON_BUFFER_BUFFERQUEUE_H
 
+#include "hwcbuffer.h"
 #include "timeline.h"
 #include "utils.h"
 #include "Timer.h"
@@ -26,6 +27,7 @@
 
 namespace hwcomposer {
 
+class AbstractBufferManager;
 class Buffer;
 
 //*****************************************************************************
@@ -33,6 +35,8 @@ class Buffer;
 // BufferQueue class.
 // Manages a cyclic list of GraphicBuffers + associated fence.
 // Buffers are allocated on demand (when they are first dequeued).
+// Buffers are pooled by size class, so a target that changes size slightly keeps its buffers.
+// When the pool is over its constraints, the buffers least likely to be reused are evicted first.
 // The BufferQueue may be dynamically reconfigured using setConfigure.
 //
 //*****************************************************************************
@@ -48,6 +52,9 @@ private:
     static const int DEQUEUED_BUFFER = -2;              // Fence value set initially on a dequeue
     static const int AWAITING_RELEASE_FENCE = -3;       // Fence value set on a queue when we still dont yet know the actual fence is.
 
+    // Smallest spacing between buffer size classes (see sizeClass).
+    static const uint32_t cMinSizeClassStep = 64;
+
 public:
 
     // Opaque handle to a BufferQueue buffer.
@@ -69,6 +76,9 @@ public:
     // General constructor for a buffer queue of the requested number and type of formats
     BufferQueue();
 
+    // Construct a buffer queue that allocates from a specific buffer manager.
+    BufferQueue( AbstractBufferManager& bm );
+
     // Destructor.
     ~BufferQueue();
 
@@ -76,10 +86,27 @@ public:
     // Either or both these may be zero which means unconstrained.
     void setConstraints( uint32_t maxBufferCount, uint32_t maxBufferAlloc );
 
+    // Round buffer sizes up to size classes (see sizeClass). On by default ("compbufferclass").
+    void setSizeClasses( bool bEnable ) { mOptionSizeClasses.set( bEnable ? 1 : 0 ); }
+
     // Generate debug trace for all buffers.
     HWCString dump( void ) const;
 
+    // Number of buffer allocations (including reallocations) made so far.
+    uint32_t getAllocationCount( void ) const { return mAllocationCount; }
+
+    // Highest total allocation in bytes seen so far.
+    uint32_t getPeakAllocBytes( void ) const { return mPeakAllocBytes; }
+
+    // Round a requested buffer dimension up to its size class.
+    // Classes are spaced 1/8th of the power of two below the size apart (at least cMinSizeClassStep),
+    // so no more than 12.5% is wasted in each dimension.
+    static uint32_t sizeClass( uint32_t size );
+
     // Get access to the next buffer on the queue.
+    // With size classes enabled the buffer may be larger than width x height (see sizeClass); the
+    // user must only render to and present the width x height sub-rect at the top left of the buffer
+    // (see getBufferDetails).
     // The user must wait on the returned acquireFenceFd before using the Buffer.
     // Use queue( ) to insert the Buffers back into the queue.
     // Calls to dequeue and queue should be paired.
@@ -95,6 +122,9 @@ public:
     // Get graphic buffer from handle.
     std::shared_ptr<HWCNativeHandlesp> getGraphicBuffer( BufferHandle handle );
 
+    // Get the allocated size, format and pitches of the buffer from handle.
+    const HwcBuffer& getBufferDetails( BufferHandle handle ) const;
+
     // Register an external buffer reference.
     // Only one external reference can be registered at any time.
     // BufferReference::referenceInvalidate will be called when the buffer is garbage collected or repurposed.
@@ -121,8 +151,9 @@ private:
     Buffer* checkForMatchingAvailableBuffer(uint32_t w, uint32_t h, int32_t format, uint32_t usage);
 
     // Try to find the next available (unblocked) buffer.
-    // Try a few times with a small delay between each retry.
-    // If a free buffer can still not be found after several waits/retries,
+    // Waits on the release fences of all candidate buffers at once, until the first
+    //  one signals or mOptionWaitTimeout expires.
+    // If a free buffer can still not be found by then,
     //  then fallback to sharing or evicting+replacing an existing buffer.
     // This is heavier than the above checkForMatchingAvailableBuffer as it may result in a buffer reallocation
     Buffer* waitForFirstAvailableBuffer( uint32_t w, uint32_t h, int32_t format, uint32_t usage );
@@ -144,12 +175,92 @@ private:
     // and also asynchronously if no frames have been received for some time (see mOptionGCTimeout).
     void processBuffers( void );
 
+    // Estimated likelihood that a free buffer will be dequeued again, in expected uses per frame.
+    // This is the demand for the buffer's size class less the buffers of that class used more recently.
+    float getReuseLikelihood( uint32_t index ) const;
+
+    // Find the free buffer that is least likely to be reused.
+    // Returns -1 if there are no free buffers.
+    int32_t findEvictionCandidate( void ) const;
+
+    // Evict free buffers, least likely to be reused first, until a buffer of the given size
+    // fits within the constraints. Returns false if it still would not fit.
+    bool makeRoom( uint32_t bytes );
+
+    // Release buffer i.
+    void evictBuffer( uint32_t i );
+
+    // Account for a new allocation of bytes.
+    void addAllocation( uint32_t bytes );
+
+    // Demand for each size class, tracked at the end of each frame.
+    struct ClassDemand
+    {
+        uint32_t mWidth;
+        uint32_t mHeight;
+        int32_t  mFormat;
+        uint32_t mUsage;
+        float    mDemand;               //< Peak buffers used in a frame, decayed each frame.
+    };
+    ClassDemand* findClassDemand( const Buffer& b );
+    const ClassDemand* findClassDemand( const Buffer& b ) const;
+    void updateClassDemand( void );
+
     // Generate debug trace for buffers that are currently blocking.
     void dumpBlockedBuffers( void );
 
     // Get a count and (optionally) a mask of which buffers are currently blocking.
     uint32_t getBlockedBuffers( uint32_t* pBitmask = NULL );
 
+    // Histogram of time spent waiting for a buffer in waitForFirstAvailableBuffer.
+    // Slot 0 counts waits under 1ms, slot N waits of [2^(N-1), 2^N) ms and the last slot the rest.
+    class WaitHistogram
+    {
+    public:
+        enum { HISTOGRAM_SLOTS = 11 };
+        uint32_t mSlot[ HISTOGRAM_SLOTS ];
+        uint32_t mSamples;
+        uint64_t mTotalUs;
+        uint64_t mMaxUs;
+        WaitHistogram( )
+        {
+            reset( );
+        }
+        void reset( void )
+        {
+            memset( mSlot, 0, sizeof( mSlot ) );
+            mSamples = 0;
+            mTotalUs = 0;
+            mMaxUs = 0;
+        }
+        void sample( uint64_t us )
+        {
+            uint32_t histSlot = 0;
+            for ( uint64_t ms = us / 1000; ms && ( histSlot < HISTOGRAM_SLOTS-1 ); ms >>= 1 )
+            {
+                ++histSlot;
+            }
+            ++mSlot[ histSlot ];
+            ++mSamples;
+            mTotalUs += us;
+            if ( us > mMaxUs )
+                mMaxUs = us;
+        }
+        HWCString dump( const char* pchName ) const;
+    };
+
+    // How a waitForFirstAvailableBuffer ended.
+    enum EWaitResult
+    {
+        EWaitReleased,              //< A buffer was released.
+        EWaitTimeout,               //< Buffers were in flight but none was released in time.
+        EWaitNoCandidates           //< Every buffer was in use this frame, so there was nothing to wait for.
+    };
+
+    // Record the time taken by one waitForFirstAvailableBuffer.
+    void sampleWait( nsecs_t startTime, EWaitResult result );
+
+
 
 #if INTEL_HWC_INTERNAL_BUILD
     class Stat
@@ -248,6 +359,17 @@ private:
 #endif
 
     Option                      mOptionGCTimeout;                           //< Time in milliseconds after which unused buffers are released.
+    Option                      mOptionWaitTimeout;                         //< Time in milliseconds to wait for a buffer release before using a fallback.
+    Option                      mOptionSizeClasses;                         //< Round buffer sizes up to size classes.
+    AbstractBufferManager&      mBM;                                        //< Buffer manager to allocate from.
+    std::vector< ClassDemand >  mClassDemand;                               //< Demand for each size class that is in use or was recently.
+    uint32_t                    mAllocationCount;                           //< Number of allocations so far.
+    uint32_t                    mPeakAllocBytes;                            //< Highest mBufferAllocBytes so far.
+    enum { RECENT_WAITS = 500 };
+    WaitHistogram               mWaitHistogram;                             //< Wait times for all waits.
+    WaitHistogram               mWaitHistogramRecent;                       //< Wait times for the last RECENT_WAITS waits or fewer.
+    uint32_t                    mWaitTimeouts;                              //< Waits that timed out and used the fallback path.
+    uint32_t                    mWaitNoCandidates;                          //< Waits that had nothing to wait for and used the fallback path.
     uint32_t                    mMaxBufferCount;                            //< Max buffer count to grow pool by; if zero then unbound.
     uint32_t                    mMaxBufferAlloc;                            //< Max buffer allocation in MB to grow pool by; if zero then unbound.
     std::vector< Buffer* >      mBuffers;                                   //< List of Buffer records.
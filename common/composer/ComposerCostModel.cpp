@@ -0,0 +1,314 @@
+/*
+// Copyright (c) 2017 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "ComposerCostModel.h"
+#include "hwctrace.h"
+#include "log.h"
+#include "utils.h"
+
+namespace hwcomposer {
+
+// Assumed update rate of compositions that do not report one.
+static const float cDefaultFps = 60.0f;
+
+// Coefficient names used in the calibration file.
+static const struct
+{
+    const char*                          mName;
+    float ComposerCostModel::Coefficients::* mpValue;
+} cCoefficientNames[] =
+{
+    { "callUs",                 &ComposerCostModel::Coefficients::mCallUs },
+    { "layerUs",                &ComposerCostModel::Coefficients::mLayerUs },
+    { "readUsPerMB",            &ComposerCostModel::Coefficients::mReadUsPerMB },
+    { "writeUsPerMB",           &ComposerCostModel::Coefficients::mWriteUsPerMB },
+    { "aluUsPerMPixel",         &ComposerCostModel::Coefficients::mAluUsPerMPixel },
+    { "yuvUsPerMPixel",         &ComposerCostModel::Coefficients::mYuvUsPerMPixel },
+    { "activeMw",               &ComposerCostModel::Coefficients::mActiveMw },
+    { "dramNjPerMB",            &ComposerCostModel::Coefficients::mDramNjPerMB },
+    { "scaleQualityPerMPixel",  &ComposerCostModel::Coefficients::mScaleQualityPerMPixel },
+    { "yuvQualityPerMPixel",    &ComposerCostModel::Coefficients::mYuvQualityPerMPixel },
+};
+
+ComposerCostModel::Workload::Workload() :
+    mCalls(0),
+    mLayers(0),
+    mReadMB(0),
+    mWriteMB(0),
+    mMPixels(0),
+    mYuvMPixels(0),
+    mScaledMPixels(0),
+    mMemoryBytes(0),
+    mFps(0)
+{
+}
+
+// Defaults are for a GPU composer sustaining roughly 16GB/s with a 30us
+// submission overhead. They only need to be right relative to each other
+// until a calibration file is provided.
+ComposerCostModel::Coefficients::Coefficients() :
+    mCallUs(30),
+    mLayerUs(10),
+    mReadUsPerMB(60),
+    mWriteUsPerMB(60),
+    mAluUsPerMPixel(120),
+    mYuvUsPerMPixel(150),
+    mActiveMw(3000),
+    mDramNjPerMB(160000),
+    mScaleQualityPerMPixel(1),
+    mYuvQualityPerMPixel(1)
+{
+}
+
+ComposerCostModel::ComposerCostModel() :
+    mOptionCostFile( "composercost", "" )
+{
+    // The partitioned composer partitions the stack on the CPU and sets up a
+    // program per cell set before drawing, so each composition pays more up
+    // front. In return every destination pixel is only written once.
+    Coefficients partitioned;
+    partitioned.mCallUs = 200;
+    partitioned.mLayerUs = 20;
+    mCoefficients[ "PartitionedComp" ] = partitioned;
+    mCoefficients[ "SurfaceFlingerComposer" ] = mDefault;
+
+    const char* pchPath = mOptionCostFile;
+    if ( pchPath && *pchPath )
+    {
+        load( pchPath );
+    }
+}
+
+ComposerCostModel::~ComposerCostModel()
+{
+}
+
+float ComposerCostModel::megabytes( uint32_t w, uint32_t h, int32_t format )
+{
+    return float( w ) * h * bitsPerPixelForFormat( format ) / ( 8 * 1024 * 1024 );
+}
+
+float ComposerCostModel::estimateUs( const Coefficients& c, const Workload& w )
+{
+    return c.mCallUs * w.mCalls
+         + c.mLayerUs * w.mLayers
+         + c.mReadUsPerMB * w.mReadMB
+         + c.mWriteUsPerMB * w.mWriteMB
+         + c.mAluUsPerMPixel * w.mMPixels
+         + c.mYuvUsPerMPixel * w.mYuvMPixels;
+}
+
+float ComposerCostModel::evaluate( const char* pComposerName, const Workload& w, AbstractComposer::Cost type ) const
+{
+    const Coefficients& c = getCoefficients( pComposerName );
+    const float fps = w.mFps > 0 ? w.mFps : cDefaultFps;
+
+    float cost = AbstractComposer::Eval_Not_Supported;
+    switch ( type )
+    {
+        case AbstractComposer::Bandwidth:
+            cost = ( w.mReadMB + w.mWriteMB ) * 1024 * fps;
+            break;
+        case AbstractComposer::Performance:
+            cost = estimateUs( c, w );
+            break;
+        case AbstractComposer::Power:
+            // nJ per frame times fps is nW; report uW.
+            cost = ( estimateUs( c, w ) * c.mActiveMw
+                   + ( w.mReadMB + w.mWriteMB ) * c.mDramNjPerMB ) * fps / 1000;
+            break;
+        case AbstractComposer::Memory:
+            cost = w.mMemoryBytes;
+            break;
+        case AbstractComposer::Quality:
+            cost = w.mScaledMPixels * c.mScaleQualityPerMPixel
+                 + w.mYuvMPixels * c.mYuvQualityPerMPixel;
+            break;
+    }
+    DTRACEIF( COMPOSITION_DEBUG, "ComposerCostModel: %s cost(%d) = %f", pComposerName, type, cost );
+    return cost;
+}
+
+bool ComposerCostModel::fit( const std::vector<Sample>& samples, Coefficients& c )
+{
+    const uint32_t N = 6;
+    double ata[ N ][ N + 1 ];
+    memset( ata, 0, sizeof( ata ) );
+
+    // Accumulate the normal equations (A'A | A'b).
+    for ( const Sample& s : samples )
+    {
+        const Workload& w = s.mWorkload;
+        const double f[ N ] = { (double)w.mCalls, (double)w.mLayers, w.mReadMB, w.mWriteMB, w.mMPixels, w.mYuvMPixels };
+        for ( uint32_t r = 0; r < N; r++ )
+        {
+            for ( uint32_t col = 0; col < N; col++ )
+            {
+                ata[ r ][ col ] += f[ r ] * f[ col ];
+            }
+            ata[ r ][ N ] += f[ r ] * s.mMeasuredUs;
+        }
+    }
+
+    // Gaussian elimination with partial pivoting.
+    for ( uint32_t col = 0; col < N; col++ )
+    {
+        uint32_t pivot = col;
+        for ( uint32_t r = col + 1; r < N; r++ )
+        {
+            if ( fabs( ata[ r ][ col ] ) > fabs( ata[ pivot ][ col ] ) )
+                pivot = r;
+        }
+        if ( fabs( ata[ pivot ][ col ] ) < 1e-9 )
+        {
+            ETRACE( "ComposerCostModel: %zu samples do not determine coefficient %s",
+                    samples.size(), cCoefficientNames[ col ].mName );
+            return false;
+        }
+        for ( uint32_t k = 0; k <= N; k++ )
+        {
+            double t = ata[ col ][ k ];
+            ata[ col ][ k ] = ata[ pivot ][ k ];
+            ata[ pivot ][ k ] = t;
+        }
+        for ( uint32_t r = 0; r < N; r++ )
+        {
+            if ( r == col )
+                continue;
+            const double m = ata[ r ][ col ] / ata[ col ][ col ];
+            for ( uint32_t k = col; k <= N; k++ )
+            {
+                ata[ r ][ k ] -= m * ata[ col ][ k ];
+            }
+        }
+    }
+
+    // The time coefficients are the first N entries of cCoefficientNames.
+    // Noise can drive an unimportant term slightly negative; clamp it.
+    for ( uint32_t r = 0; r < N; r++ )
+    {
+        const double v = ata[ r ][ N ] / ata[ r ][ r ];
+        c.*cCoefficientNames[ r ].mpValue = v > 0 ? (float)v : 0.0f;
+    }
+    return true;
+}
+
+const ComposerCostModel::Coefficients& ComposerCostModel::getCoefficients( const char* pComposerName ) const
+{
+    auto it = mCoefficients.find( pComposerName );
+    return it == mCoefficients.end() ? mDefault : it->second;
+}
+
+void ComposerCostModel::setCoefficients( const char* pComposerName, const Coefficients& c )
+{
+    mCoefficients[ pComposerName ] = c;
+}
+
+bool ComposerCostModel::load( const char* pchPath )
+{
+    FILE* fp = fopen( pchPath, "r" );
+    if ( fp == NULL )
+    {
+        ETRACE( "ComposerCostModel: Failed to open %s", pchPath );
+        return false;
+    }
+
+    bool bOK = true;
+    char line[ 256 ];
+    uint32_t lineNumber = 0;
+    while ( fgets( line, sizeof( line ), fp ) )
+    {
+        lineNumber++;
+        char* pComment = strchr( line, '#' );
+        if ( pComment )
+            *pComment = '\0';
+
+        char key[ 128 ];
+        float value;
+        int fields = sscanf( line, "%127s %f", key, &value );
+        if ( fields <= 0 )
+            continue;
+
+        char* pDot = strrchr( key, '.' );
+        bool bKnown = false;
+        if ( ( fields == 2 ) && pDot && ( pDot != key ) )
+        {
+            *pDot = '\0';
+            for ( const auto& name : cCoefficientNames )
+            {
+                if ( strcmp( pDot + 1, name.mName ) == 0 )
+                {
+                    auto it = mCoefficients.find( key );
+                    if ( it == mCoefficients.end() )
+                        it = mCoefficients.insert( std::make_pair( std::string( key ), mDefault ) ).first;
+                    it->second.*name.mpValue = value;
+                    bKnown = true;
+                    break;
+                }
+            }
+        }
+        if ( !bKnown )
+        {
+            ETRACE( "ComposerCostModel: %s:%u not understood", pchPath, lineNumber );
+            bOK = false;
+        }
+    }
+    fclose( fp );
+    DTRACEIF( COMPOSITION_DEBUG, "ComposerCostModel: Loaded %s\n%s", pchPath, dump().string() );
+    return bOK;
+}
+
+bool ComposerCostModel::save( const char* pchPath ) const
+{
+    FILE* fp = fopen( pchPath, "w" );
+    if ( fp == NULL )
+    {
+        ETRACE( "ComposerCostModel: Failed to create %s", pchPath );
+        return false;
+    }
+    fprintf( fp, "# Composer cost model coefficients\n" );
+    for ( const auto& entry : mCoefficients )
+    {
+        for ( const auto& name : cCoefficientNames )
+        {
+            fprintf( fp, "%s.%s %g\n", entry.first.c_str(), name.mName, entry.second.*name.mpValue );
+        }
+    }
+    bool bOK = !ferror( fp );
+    fclose( fp );
+    return bOK;
+}
+
+HWCString ComposerCostModel::dump() const
+{
+    HWCString output;
+    for ( const auto& entry : mCoefficients )
+    {
+        const Coefficients& c = entry.second;
+        output += HWCString::format( "%s: call %.1fus layer %.1fus read %.1fus/MB write %.1fus/MB alu %.1fus/MP yuv %.1fus/MP"
+                                   " active %.0fmW dram %.0fnJ/MB quality scale %.2f yuv %.2f\n",
+                                   entry.first.c_str(), c.mCallUs, c.mLayerUs, c.mReadUsPerMB, c.mWriteUsPerMB,
+                                   c.mAluUsPerMPixel, c.mYuvUsPerMPixel, c.mActiveMw, c.mDramNjPerMB,
+                                   c.mScaleQualityPerMPixel, c.mYuvQualityPerMPixel );
+    }
+    return output;
+}
+
+}; // namespace hwcomposer
@@ -0,0 +1,136 @@
+/*
+// Copyright (c) 2017 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+#ifndef COMMON_HWC_COMPOSERCOSTMODEL_H
+#define COMMON_HWC_COMPOSERCOSTMODEL_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "AbstractComposer.h"
+#include "option.h"
+#include "singleton.h"
+
+namespace hwcomposer {
+
+// Shared cost model for the composers.
+// Each composer describes the work a composition needs from it (a Workload) and the model turns
+// that into a cost of the requested type using per-composer coefficients. Because every composer
+// is costed by the same model in the same units, CompositionManager::chooseBestCompositionEngine
+// can compare them directly.
+//
+// The coefficients come from an offline calibration run: composercalibrate (tests/apps) composes
+// a range of stacks with each composer, records the workload and the measured GPU time of each
+// composition and calls fit() then save(). The resulting file is loaded at startup from the path in the
+// "composercost" option. Built-in defaults are used for any coefficient the file does not set.
+//
+// File format, one coefficient per line, '#' starts a comment:
+//   <composer name>.<coefficient> <value>
+// e.g.
+//   PartitionedComp.callUs 150
+class ComposerCostModel : public Singleton<ComposerCostModel>
+{
+public:
+    // The work one composition needs from a composer.
+    struct Workload
+    {
+        Workload();
+
+        uint32_t mCalls;            //< Draw calls/passes issued.
+        uint32_t mLayers;           //< Source layers bound.
+        float    mReadMB;           //< Bytes read per frame, in MB.
+        float    mWriteMB;          //< Bytes written per frame, in MB.
+        float    mMPixels;          //< Pixels shaded per frame, in millions.
+        float    mYuvMPixels;       //< Pixels that also need YUV->RGB conversion.
+        float    mScaledMPixels;    //< Pixels sampled from a scaled source.
+        float    mMemoryBytes;      //< Additional memory the composition commits.
+        float    mFps;              //< Frames per second the composition is updated at.
+    };
+
+    // Per-composer coefficients.
+    struct Coefficients
+    {
+        Coefficients();
+
+        // GPU time model, microseconds per frame.
+        float mCallUs;              //< Fixed overhead per call.
+        float mLayerUs;             //< Fixed overhead per source layer.
+        float mReadUsPerMB;
+        float mWriteUsPerMB;
+        float mAluUsPerMPixel;      //< Shader work per shaded pixel.
+        float mYuvUsPerMPixel;      //< Additional shader work per converted pixel.
+
+        // Power model.
+        float mActiveMw;            //< Power drawn by the engine while busy.
+        float mDramNjPerMB;         //< Memory energy per MB transferred (in nJ).
+
+        // Quality model, relative penalty per pixel (lower is better).
+        float mScaleQualityPerMPixel;
+        float mYuvQualityPerMPixel;
+    };
+
+    // A measured composition, as recorded by the calibration benchmark.
+    struct Sample
+    {
+        Workload mWorkload;
+        float    mMeasuredUs;
+    };
+
+    // Returns the cost of the workload on the named composer in the units of type:
+    //   Bandwidth   - KB transferred per second.
+    //   Performance - GPU microseconds per frame.
+    //   Power       - microwatts (energy per frame times fps).
+    //   Memory      - bytes committed.
+    //   Quality     - relative penalty.
+    float evaluate( const char* pComposerName, const Workload& workload, AbstractComposer::Cost type ) const;
+
+    // Size of a w x h buffer of the given format in MB.
+    static float megabytes( uint32_t w, uint32_t h, int32_t format );
+
+    // Estimated GPU time of one frame of the workload in microseconds.
+    static float estimateUs( const Coefficients& c, const Workload& workload );
+
+    // Least squares fit of the time model coefficients of c to the samples. The power and quality
+    // coefficients are left alone. Returns false if the samples do not determine the coefficients.
+    static bool fit( const std::vector<Sample>& samples, Coefficients& c );
+
+    const Coefficients& getCoefficients( const char* pComposerName ) const;
+    void setCoefficients( const char* pComposerName, const Coefficients& c );
+
+    // Load coefficients from a calibration file. Returns false if the file cannot be read or has
+    // malformed lines; well formed lines are still applied.
+    bool load( const char* pchPath );
+
+    // Write all per-composer coefficients in the calibration file format.
+    bool save( const char* pchPath ) const;
+
+    HWCString dump() const;
+
+protected:
+    ComposerCostModel();
+    ~ComposerCostModel();
+    friend class Singleton<ComposerCostModel>;
+
+private:
+    Option                              mOptionCostFile;    //< Path of the calibration file.
+    Coefficients                        mDefault;           //< Used for composers without coefficients.
+    std::map<std::string, Coefficients> mCoefficients;
+};
+
+}; // namespace hwcomposer
+
+#endif // COMMON_HWC_COMPOSERCOSTMODEL_H
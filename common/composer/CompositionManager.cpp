@@ -18,6 +18,8 @@
 #include "log.h"
 #include "utils.h"
 
+#include <algorithm>
+
 #include "gbmbufferhandler.h"
 
 namespace hwcomposer {
@@ -41,10 +43,9 @@ static const uint32_t cBufferHeightAlignment = 8;
 // The number of milliseconds for which compositions are held pending imminent reuse
 static const uint32_t cReuseCompositionMs = 100;
 
-// This is an internal class which describes a composition. Initially, this is a simple 1:1 source to target.
-// However, longer term we may want to augment this to support multiple targets at different resolutions
-// which gives us the opportunity to scale an existing render target instead of generating it from source
-// whenever this is cheaper.
+// This is an internal class which describes a composition. Mostly this is a simple 1:1 source to target.
+// When the same source is wanted at a smaller resolution in the same frame (e.g. a cloned display), a
+// composition can instead take another composition's render target as its only source layer and scale it.
 
 // There are multiple uses for this class. If a composition has been requested twice on a single HWC update,
 // this class allows us to return the same result as last time. Also if a composition from a previous frame
@@ -93,12 +94,20 @@ private:
     friend class CompositionManager;
 
     bool match(const Content::LayerStack& src, uint32_t width, uint32_t height, uint32_t format, ECompressionType compression, bool* pbMatchedHandles = NULL, bool* pbContainsComposition = NULL) const;
+    // Does src, laid out for a width x height target, show the same buffers as this composition at its own size.
+    bool matchScaled(const Content::LayerStack& src, uint32_t width, uint32_t height, uint32_t format, ECompressionType compression) const;
     void onUpdateAll(const Content::LayerStack& src, uint32_t width, uint32_t height, uint32_t format, ECompressionType compression, nsecs_t timestamp);
     void onUpdateTimestamp(nsecs_t timestamp) { mTimestamp = timestamp; };
     void onUpdateBufferPavpSession();
     void onUpdateMediaTimestampFps();
     void expireBuffer( HWCNativeHandle bufferHandle );
 
+    // Recalculate the signature and move this composition in the manager's index if it changed.
+    void updateSignature();
+
+    // Bring the manager's handle index up to date with the handles this composition uses.
+    void updateHandleIndex();
+
 private:
     CompositionManager*                     mpCompositionManager;   // Pointer back to the manager
     AbstractComposer*                       mpComposer;             // Pointer to the composer for this composition. Null pointer means the composition is impossible
@@ -126,18 +135,32 @@ private:
     nsecs_t                                 mTimestamp;             // Timestamp for when this was last valid
     uint32_t                                mLocks;                 // A count of locks on this composition (a lock will keep the composition 'live')..
 
+    uint32_t                                mSlot;                  // Index of this composition in mCompositions.
+    Composition*                            mpScaleSource;          // Composition whose target this one scales, NULL if composed from source.
+    uint32_t                                mScaleUsers;            // Number of compositions scaling this one's target.
+    uint64_t                                mSignature;             // Signature this composition is indexed under (if mbIndexed).
+    std::vector<HWCNativeHandle>            mIndexedHandles;        // Sorted handles this composition is indexed under.
+    bool                                    mbNestedSources;        // A source layer is itself a composition (indexed as nested).
+
 
     bool                                    mbEvaluationValid:1;    // The evaluation was performed and is valid.
     bool                                    mbTargetValid:1;        // This indicates that the target needs to be regenerated as something changed.
     bool                                    mbTargetProvided:1;     // The target buffer was allocated externally and provided already.
     bool                                    mbConsiderForReuse:1;   // Anything left as invalid at the end of a frame should be marked for reuse in the next frame.
+    bool                                    mbIndexed:1;            // This composition is in the manager's signature index.
 };
 
 CompositionManager::Composition::Composition() :
     mpCompositionManager(NULL),
     mRenderTargetBuffer(NULL),
     mpComposerCompositionState(NULL),
-    mLocks(0)
+    mLocks(0),
+    mSlot(0),
+    mpScaleSource(NULL),
+    mScaleUsers(0),
+    mSignature(0),
+    mbNestedSources(false),
+    mbIndexed(false)
     // Initialization should be in the clear function
 {
     clear();
@@ -178,6 +201,7 @@ void CompositionManager::Composition::invalidateRenderTarget( void )
     setRenderTargetBuffer( NULL );
     mbTargetValid = false;
     mbTargetProvided = false;
+    updateHandleIndex();
 }
 
 void CompositionManager::Composition::referenceInvalidate( BufferQueue::BufferHandle handle )
@@ -210,6 +234,68 @@ void CompositionManager::Composition::clear()
     mbTargetProvided        = false;
     setRenderTargetBuffer( NULL );
     mRenderTarget.clear();
+    if ( mpScaleSource )
+    {
+        HWCASSERT( mpScaleSource->mScaleUsers > 0 );
+        mpScaleSource->mScaleUsers--;
+        mpScaleSource = NULL;
+    }
+    if ( mbIndexed )
+    {
+        mpCompositionManager->unindexComposition( *this );
+    }
+    if ( !mIndexedHandles.empty() || mbNestedSources )
+    {
+        std::vector<HWCNativeHandle> none;
+        mpCompositionManager->indexHandles( *this, none, false );
+    }
+}
+
+void CompositionManager::Composition::updateHandleIndex()
+{
+    std::vector<HWCNativeHandle> handles;
+    bool bNested = false;
+    handles.reserve( mSourceLayers.size() + 1 );
+    for (size_t i = 0; i < mSourceLayers.size(); i++)
+    {
+        // A composition layer's handle is its source composition's current target, which can
+        // change without this composition being updated. Those are checked on every expiry.
+        if ( mSourceLayers[i].isComposition() )
+        {
+            bNested = true;
+        }
+        else if ( mSourceLayers[i].getHandle() )
+        {
+            handles.push_back( mSourceLayers[i].getHandle() );
+        }
+    }
+    if ( mRenderTarget.getHandle() )
+    {
+        handles.push_back( mRenderTarget.getHandle() );
+    }
+    std::sort( handles.begin(), handles.end() );
+    handles.erase( std::unique( handles.begin(), handles.end() ), handles.end() );
+
+    if ( ( handles == mIndexedHandles ) && ( bNested == mbNestedSources ) )
+    {
+        return;
+    }
+    mpCompositionManager->indexHandles( *this, handles, bNested );
+}
+
+void CompositionManager::Composition::updateSignature()
+{
+    uint64_t signature = CompositionManager::signatureOf( mSourceStack, mRenderTarget.getDstWidth(), mRenderTarget.getDstHeight(),
+                                                          mCompositionFormat, mRenderTarget.getBufferCompression() );
+    if ( mbIndexed && ( signature == mSignature ) )
+    {
+        return;
+    }
+    if ( mbIndexed )
+    {
+        mpCompositionManager->unindexComposition( *this );
+    }
+    mpCompositionManager->indexComposition( *this, signature );
 }
 
 bool CompositionManager::Composition::match(const Content::LayerStack& src, uint32_t width, uint32_t height, uint32_t format,
@@ -225,7 +311,7 @@ bool CompositionManager::Composition::match(const Content::LayerStack& src, uint
     {
         DTRACEIF(COMPOSITION_DEBUG, "Mismatched width %d=%d , height %d=%d, format %s=%s or compression %u=%u",
             width, mRenderTarget.getDstWidth(), height, mRenderTarget.getDstHeight(),
-            getHALFormatShortString(format), getHALFormatShortString(mCompositionFormat),
+            getDRMFormatString(format), getDRMFormatString(mCompositionFormat),
             compression, mRenderTarget.getBufferCompression());
         return false;
     }
@@ -268,6 +354,29 @@ bool CompositionManager::Composition::match(const Content::LayerStack& src, uint
     return true;
 }
 
+bool CompositionManager::Composition::matchScaled(const Content::LayerStack& src, uint32_t width, uint32_t height, uint32_t format,
+                                                  ECompressionType compression) const
+{
+    if ( ( format != mCompositionFormat )
+      || ( compression != mRenderTarget.getBufferCompression() )
+      || ( src.size() != mSourceLayers.size() ) )
+    {
+        return false;
+    }
+
+    const float scaleX = float( width ) / mRenderTarget.getDstWidth();
+    const float scaleY = float( height ) / mRenderTarget.getDstHeight();
+    for (size_t i = 0; i < mSourceLayers.size(); i++)
+    {
+        bool bMatchedHandle = false;
+        if ( !mSourceLayers[i].matchesScaled( src.getLayer(i), scaleX, scaleY, &bMatchedHandle ) || !bMatchedHandle )
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
 void CompositionManager::Composition::expireBuffer( HWCNativeHandle bufferHandle )
 {
     if ( mRenderTarget.getHandle() == bufferHandle )
@@ -289,6 +398,7 @@ void CompositionManager::Composition::expireBuffer( HWCNativeHandle bufferHandle
             mbTargetValid = false;
         }
     }
+    updateHandleIndex();
 }
 
 void CompositionManager::Composition::onUpdateAll(const Content::LayerStack& src, uint32_t width, uint32_t height, uint32_t format, ECompressionType compression, nsecs_t timestamp)
@@ -341,14 +451,14 @@ void CompositionManager::Composition::onUpdateAll(const Content::LayerStack& src
     {
         mRenderTarget.setBlending( EBlendMode::PREMULT );
         DTRACEIF( COMPOSITION_DEBUG, "CompositionManager::onUpdateAll: Enable blending for requested alpha format %d/%s",
-            mCompositionFormat, getHALFormatShortString( mCompositionFormat ) );
+            mCompositionFormat, getDRMFormatString( mCompositionFormat ) );
     }
     else
 #endif
     {
         mRenderTarget.setBlending( EBlendMode::NONE );
         DTRACEIF( COMPOSITION_DEBUG, "CompositionManager::onUpdateAll: Disable blending for requested opaque format %d/%s",
-            mCompositionFormat, getHALFormatShortString( mCompositionFormat ) );
+            mCompositionFormat, getDRMFormatString( mCompositionFormat ) );
     }
     mRenderTarget.setPlaneAlpha(1.0f);
     mRenderTarget.setBufferFormat(format);
@@ -379,6 +489,9 @@ void CompositionManager::Composition::onUpdateAll(const Content::LayerStack& src
     // Propagate media timestamp to the render target if required.
     onUpdateMediaTimestampFps();
 
+    updateSignature();
+    updateHandleIndex();
+
     HWCASSERT( mRenderTarget.getComposition() == this );
 }
 
@@ -426,6 +539,10 @@ void CompositionManager::Composition::onUpdate(const Content::LayerStack& src)
         Log::add(mSourceStack, mRenderTarget, "Smart Composition Reuse: ");
 #endif
 
+    // onUpdateFrameState also copies plane alpha and buffer state, which are part of the signature.
+    updateSignature();
+    updateHandleIndex();
+
     HWCASSERT( mRenderTarget.getComposition() == this );
 }
 
@@ -456,6 +573,10 @@ void CompositionManager::Composition::onUpdateOutputLayer(const Layer& target)
     mbTargetProvided = true;
     mbTargetValid = false;
 
+    // The provided target may differ in size or compression from the one we were evaluated for.
+    updateSignature();
+    updateHandleIndex();
+
     HWCASSERT( mRenderTarget.getComposition() == this );
 }
 
@@ -556,6 +677,17 @@ void CompositionManager::Composition::onCompose()
             // Update the handle of the render target
             mRenderTarget.onUpdateFrameState(pGB->handle, mpCompositionManager->getTimestamp());
 #endif
+            // The buffer may be from a larger size class. Only the requested allocW x allocH sub-rect at
+            // its top left is ours, so the target must crop and size to that, not to the allocation.
+            const HwcBuffer& details = mpCompositionManager->getBufferQueue().getBufferDetails( handle );
+            HWCASSERT( ( details.width >= allocW ) && ( details.height >= allocH ) );
+            mRenderTarget.setBufferSubRect( allocW, allocH, details.width, details.height, details.pitches[0] );
+            HwcRect<float>& s = mRenderTarget.editSrc();
+            s.left = 0;
+            s.top = 0;
+            s.right = mRenderTarget.getDstWidth();
+            s.bottom = mRenderTarget.getDstHeight();
+            mRenderTarget.onUpdateFlags();
             // Queue this immediately, the release fence will be filled in later.
             mpCompositionManager->getBufferQueue().queue();
         }
@@ -630,8 +762,12 @@ CompositionManager::CompositionManager() :
 
 CompositionManager::~CompositionManager()
 {
+    // The surfaceflinger composer is a member, only the added composers are owned.
     for (auto c : mpComposers)
-        delete c;
+    {
+        if (c != &mSurfaceFlingerComposer)
+            delete c;
+    }
 }
 
 void CompositionManager::firstFrameInit( void )
@@ -662,17 +798,36 @@ void CompositionManager::onPrepareBegin(size_t numDisplays, hwc_display_contents
         HWCASSERT( mPrimaryTid == gettid() );
     }
 
-    mTimestamp = timestamp;
-
-    // Process the stale buffer handle list at the top of the frame.
-    expireBuffers();
-
+    onFrameBegin(timestamp);
     mSurfaceFlingerComposer.onPrepareBegin(numDisplays, displays, timestamp);
     mBufferQueue.onPrepareBegin();
     return;
 }
 #endif
 
+void CompositionManager::onFrameBegin(nsecs_t timestamp)
+{
+    // A scaled composition that was not requested in the last frame gives up its source, so the
+    // source's slot can be reused. It is not matched again, so its own slot is freed too.
+    for (Composition* pc : mCompositionSlots)
+    {
+        Composition& c = *pc;
+        if ( c.mpScaleSource && ( c.mTimestamp != mTimestamp ) && ( c.mRefCount == 0 ) && ( c.mLocks == 0 ) )
+        {
+            DTRACEIF( COMPOSITION_DEBUG, "CompositionManager::onFrameBegin: composition %d no longer scales composition %d",
+                c.mSlot, c.mpScaleSource->mSlot );
+            c.clear();
+            c.mbConsiderForReuse = true;
+        }
+    }
+
+    mTimestamp = timestamp;
+    mFrameCompositions.clear();
+
+    // Process the stale buffer handle list at the top of the frame.
+    expireBuffers();
+}
+
 void CompositionManager::onPrepareEnd()
 {
     mSurfaceFlingerComposer.onPrepareEnd();
@@ -682,13 +837,22 @@ void CompositionManager::onPrepareEnd()
 
 void CompositionManager::invalidate(HWCNativeHandle handle)
 {
-    for (uint32_t i = 0; i < mCompositions.size(); i++)
+    // Take a copy, expireBuffer removes the composition from this handle's entry.
+    std::vector<Composition*> affected;
+    mHandleIndex.find( handle, affected );
+
+    for (Composition* pc : affected)
     {
-        Composition& c = mCompositions[i];
-        c.expireBuffer( handle );
+        DTRACEIF( COMPOSITION_DEBUG, "CompositionManager::invalidate: Checking composition %d/%p %s", pc->mSlot, pc, pc->dump(mTimestamp).string() );
+        pc->expireBuffer( handle );
     }
 }
 
+void CompositionManager::indexHandles(Composition& c, std::vector<HWCNativeHandle>& handles, bool bNested)
+{
+    mHandleIndex.update( &c, c.mIndexedHandles, c.mbNestedSources, handles, bNested );
+}
+
 void CompositionManager::onAccept(const Content::Display& display, uint32_t d)
 {
     // TODO: Get d from Content::Display as soon as its available
@@ -800,109 +964,283 @@ void CompositionManager::onEndOfFrame( uint32_t hwcFrameIndex )
     mBufferQueue.onSetEnd( );
 }
 
+uint64_t CompositionManager::signatureOf(const Content::LayerStack& src, uint32_t width, uint32_t height, uint32_t format, ECompressionType compression)
+{
+    uint64_t signature = hashCombine( 0, width );
+    signature = hashCombine( signature, height );
+    signature = hashCombine( signature, format );
+    signature = hashCombine( signature, uint64_t( compression ) );
+    signature = hashCombine( signature, src.size() );
+    for (uint32_t ly = 0; ly < src.size(); ly++)
+    {
+        signature = hashCombine( signature, src.getLayer(ly).getMatchSignature() );
+    }
+    return signature;
+}
+
+void CompositionManager::indexComposition(Composition& c, uint64_t signature)
+{
+    HWCASSERT( !c.mbIndexed );
+    std::vector<Composition*>& entry = mCompositionIndex[signature];
+    auto pos = entry.begin();
+    while ( ( pos != entry.end() ) && ( (*pos)->mSlot < c.mSlot ) )
+    {
+        ++pos;
+    }
+    entry.insert( pos, &c );
+    c.mSignature = signature;
+    c.mbIndexed = true;
+}
+
+void CompositionManager::unindexComposition(Composition& c)
+{
+    HWCASSERT( c.mbIndexed );
+    auto it = mCompositionIndex.find( c.mSignature );
+    HWCASSERT( it != mCompositionIndex.end() );
+    if ( it != mCompositionIndex.end() )
+    {
+        std::vector<Composition*>& entry = it->second;
+        for (auto pos = entry.begin(); pos != entry.end(); ++pos)
+        {
+            if ( *pos == &c )
+            {
+                entry.erase( pos );
+                break;
+            }
+        }
+        if ( entry.empty() )
+        {
+            mCompositionIndex.erase( it );
+        }
+    }
+    c.mbIndexed = false;
+}
+
 AbstractComposition* CompositionManager::requestComposition(const Content::LayerStack& src, uint32_t width, uint32_t height, uint32_t format, ECompressionType compression, AbstractComposer::Cost type)
 {
-    DTRACEIF( COMPOSITION_DEBUG, "CompositionManager::requestComposition: Looking for composition to %dx%d %s. compositions known:%d %p", width, height, getHALFormatShortString(format), mCompositions.size(), this);
+    DTRACEIF( COMPOSITION_DEBUG, "CompositionManager::requestComposition: Looking for composition to %dx%d %s. compositions known:%d %p", width, height, getDRMFormatString(format), mCompositions.size(), this);
     DTRACEIF( COMPOSITION_DEBUG, "%s", src.dump().string());
 
     DTRACEIF( src.isFrontBufferRendered(),
               "Composition request includes a front buffer rendered layer\n%s",
               src.dump().string() );
 
-    // Default newEntrySlot to the first element after the end of the list. The iteration over the composition vector
-    // will update this if there is something reusable.
-    uint32_t newEntrySlot = mCompositions.size();
-    nsecs_t  newEntryTimestamp = mTimestamp;
-
-    for (uint32_t i = 0; i < mCompositions.size(); i++)
+    // Only compositions with the same signature can match, so only those need the full comparison.
+    Composition* pOlder = NULL;
+    const uint64_t signature = signatureOf(src, width, height, format, compression);
+    auto candidates = mCompositionIndex.find(signature);
+    if (candidates != mCompositionIndex.end())
     {
-        Composition& c = mCompositions[i];
-
-        DTRACEIF( COMPOSITION_DEBUG, "CompositionManager::requestComposition: Checking composition %d/%p", i, &c);
-        DTRACEIF( COMPOSITION_DEBUG, "%s", c.dump(mTimestamp).string());
-
-        // If this composition is old, then skip it but remember its index, we will reuse the oldest record
-        if (c.mRefCount == 0 && c.mbConsiderForReuse)
+        for (Composition* pc : candidates->second)
         {
-            if (c.mLocks==0 && c.mTimestamp < newEntryTimestamp)
-            {
-                DTRACEIF( COMPOSITION_DEBUG, "CompositionManager::requestComposition: Discarding old composition %d. May reuse index", i);
-                newEntrySlot = i;
-                newEntryTimestamp = c.mTimestamp;
-            }
-            continue;
-        }
+            Composition& c = *pc;
 
-        bool bMatchedHandles = false;
-        bool bContainsComposition = false;
+            DTRACEIF( COMPOSITION_DEBUG, "CompositionManager::requestComposition: Checking composition %d/%p", c.mSlot, &c);
+            DTRACEIF( COMPOSITION_DEBUG, "%s", c.dump(mTimestamp).string());
 
-        if ( c.match(src, width, height, format, compression, &bMatchedHandles, &bContainsComposition) )
-        {
-            // If the composition is impossible then we can just say so!
-            if (c.isImpossible())
+            // Old compositions are left for reuse by a new entry.
+            if (c.mRefCount == 0 && c.mbConsiderForReuse)
             {
-                DTRACEIF( COMPOSITION_DEBUG, "CompositionManager::requestComposition: composition matched as impossible");
-                return NULL;
+                continue;
             }
 
-            // If our handles all matched and this composition is either current or last frame, then
-            // we can skip the handle lookup
-            if (bMatchedHandles)
+            bool bMatchedHandles = false;
+            bool bContainsComposition = false;
+
+            if ( c.match(src, width, height, format, compression, &bMatchedHandles, &bContainsComposition) )
             {
-                DTRACEIF( COMPOSITION_DEBUG, "CompositionManager::requestComposition: composition matched current frame");
-                // Update the counter to indicate that this composition is now current for this frame
-                // No need to recompose, this is the smart composition case
-                c.onUpdateFences(src);
-                c.onUpdateTimestamp(mTimestamp);
+                // If the composition is impossible then we can just say so!
+                if (c.isImpossible())
+                {
+                    DTRACEIF( COMPOSITION_DEBUG, "CompositionManager::requestComposition: composition matched as impossible");
+                    return NULL;
+                }
 
-                if (bContainsComposition)
+                // If our handles all matched and this composition is either current or last frame, then
+                // we can skip the handle lookup
+                if (bMatchedHandles)
                 {
+                    DTRACEIF( COMPOSITION_DEBUG, "CompositionManager::requestComposition: composition matched current frame");
+                    // Update the counter to indicate that this composition is now current for this frame
+                    // No need to recompose, this is the smart composition case
+                    c.onUpdateFences(src);
+                    c.onUpdateTimestamp(mTimestamp);
+
+                    if (bContainsComposition)
+                    {
 #ifdef uncomment
-                    // Have to recompose this entry if there is a composition present
-                    Log::add(src, c.getTarget(), "Smart Composition Invalidate: Contains Composition");
+                        // Have to recompose this entry if there is a composition present
+                        Log::add(src, c.getTarget(), "Smart Composition Invalidate: Contains Composition");
 #endif
-                    c.invalidate();
-                }
-                else
-                {
+                        c.invalidate();
+                    }
+                    else
+                    {
 #ifdef uncomment
-                    Log::add(src, c.getTarget(), "Smart Composition Reuse: ");
+                        Log::add(src, c.getTarget(), "Smart Composition Reuse: ");
 #endif
+                    }
+                    addFrameComposition(c);
+                    return &c;
                 }
-                return &c;
-            }
-            if (c.mTimestamp != mTimestamp)
-            {
-                DTRACEIF( COMPOSITION_DEBUG, "CompositionManager::requestComposition: composition matched older frame - update handles");
-                // This matches an older composition. Update the handles and reuse this entry.
-                c.onUpdate(src);
-                c.onUpdateTimestamp(mTimestamp);
-                return &c;
+                if (c.mTimestamp != mTimestamp)
+                {
+                    // This matches an older composition. Reuse it unless it can be scaled from this frame's (below).
+                    pOlder = &c;
+                    break;
+                }
+
+                // While we matched and its a current composition, the handles were different, which means that we cannot reuse this one.
             }
+        }
+    }
 
-            // While we matched and its a current composition, the handles were different, which means that we cannot reuse this one.
+    // A clone of a display composed earlier this frame only needs that composition scaled.
+    // With nothing else composed yet this frame, there is nothing to scale from.
+    Composition* pScaleSource = mFrameCompositions.empty() ? NULL : findScaleSource(src, width, height, format, compression);
+    if (pScaleSource)
+    {
+        Composition* pScaled = requestScaledComposition(*pScaleSource, width, height, format, compression, type);
+        if (pScaled)
+        {
+            return pScaled;
         }
     }
 
-    DTRACEIF( COMPOSITION_DEBUG, "CompositionManager::requestComposition: No suitable previous composition found, adding composition at entry %d", newEntrySlot);
+    if (pOlder)
+    {
+        DTRACEIF( COMPOSITION_DEBUG, "CompositionManager::requestComposition: composition matched older frame - update handles");
+        // Update the handles and reuse this entry.
+        pOlder->onUpdate(src);
+        pOlder->onUpdateTimestamp(mTimestamp);
+        addFrameComposition(*pOlder);
+        return pOlder;
+    }
+
+    DTRACEIF( COMPOSITION_DEBUG, "CompositionManager::requestComposition: No suitable previous composition found, adding a new composition");
 
     // No match was found, need to recreate a new composition entry
     // TODO: We may want to limit the size of this table here by now looking for unused composition entries
     // However, there is also a fair chance of reuse of composition entries which will avoid re-evaluation
-    if (newEntrySlot >= mCompositions.size())
+    Composition& ce = allocateComposition();
+    ce.onUpdateAll(src, width, height, format, compression, mTimestamp);
+
+    // Now do a preliminary search for the best composition engine for this composition
+    chooseBestCompositionEngine(ce, type);
+
+    if (ce.isImpossible())
+    {
+        return NULL;
+    }
+
+    addFrameComposition(ce);
+    return &ce;
+}
+
+void CompositionManager::addFrameComposition(Composition& c)
+{
+    if ( std::find( mFrameCompositions.begin(), mFrameCompositions.end(), &c ) == mFrameCompositions.end() )
+    {
+        mFrameCompositions.push_back( &c );
+    }
+}
+
+CompositionManager::Composition& CompositionManager::allocateComposition()
+{
+    // Default newEntrySlot to the first element after the end of the list. Reuse the oldest record that
+    // is marked for reuse if there is one. Compositions other compositions scale from are kept.
+    uint32_t newEntrySlot = mCompositionSlots.size();
+    nsecs_t  newEntryTimestamp = mTimestamp;
+
+    for (uint32_t i = 0; i < mCompositionSlots.size(); i++)
+    {
+        const Composition& c = *mCompositionSlots[i];
+        if (c.mRefCount == 0 && c.mbConsiderForReuse && c.mLocks==0 && c.mScaleUsers==0 && c.mTimestamp < newEntryTimestamp)
+        {
+            DTRACEIF( COMPOSITION_DEBUG, "CompositionManager::requestComposition: Discarding old composition %d. May reuse index", i);
+            newEntrySlot = i;
+            newEntryTimestamp = c.mTimestamp;
+        }
+    }
+
+    DTRACEIF( COMPOSITION_DEBUG, "CompositionManager::allocateComposition: Using entry %d", newEntrySlot);
+
+    if (newEntrySlot >= mCompositionSlots.size())
     {
         mCompositions.grow(newEntrySlot+1);
+        mCompositionSlots.push_back(&mCompositions[newEntrySlot]);
     }
 
-    Composition& ce = mCompositions[newEntrySlot];
+    Composition& ce = *mCompositionSlots[newEntrySlot];
     ce.clear();
     ce.mpCompositionManager = this;
+    ce.mSlot = newEntrySlot;
 #ifdef uncomment
     ce.mRenderTarget.setComposition(&ce);
 #endif
-    ce.onUpdateAll(src, width, height, format, compression, mTimestamp);
+    return ce;
+}
+
+CompositionManager::Composition* CompositionManager::findScaleSource(const Content::LayerStack& src, uint32_t width, uint32_t height, uint32_t format, ECompressionType compression)
+{
+    for (Composition* pc : mFrameCompositions)
+    {
+        Composition& c = *pc;
+        if ( ( c.mTimestamp != mTimestamp ) || c.mpScaleSource || !c.mbEvaluationValid || c.isImpossible()
+          || ( c.mRefCount == 0 && c.mbConsiderForReuse ) )
+        {
+            continue;
+        }
+
+        // Only scale down. Scaling up would lose detail that composing from source keeps.
+        const uint32_t sourceWidth = c.mRenderTarget.getDstWidth();
+        const uint32_t sourceHeight = c.mRenderTarget.getDstHeight();
+        if ( ( sourceWidth < width ) || ( sourceHeight < height ) || ( ( sourceWidth == width ) && ( sourceHeight == height ) ) )
+        {
+            continue;
+        }
+
+        if ( c.matchScaled(src, width, height, format, compression) )
+        {
+            DTRACEIF( COMPOSITION_DEBUG, "CompositionManager::findScaleSource: %ux%u can scale from composition %d at %ux%u",
+                width, height, c.mSlot, sourceWidth, sourceHeight );
+            return pc;
+        }
+    }
+    return NULL;
+}
+
+CompositionManager::Composition* CompositionManager::requestScaledComposition(Composition& source, uint32_t width, uint32_t height, uint32_t format, ECompressionType compression, AbstractComposer::Cost type)
+{
+    // The only source layer is the shared composition's target, stretched over the whole of this one.
+    // Composing this composition composes the shared one first if nobody has yet.
+    Layer layer = source.mRenderTarget;
+    layer.setComposition(&source);
+    layer.setDst(HwcRect<int>(0, 0, width, height));
+    layer.onUpdateFlags();
+    Content::LayerStack stack(&layer, 1);
+
+    for (Composition* pc : mCompositionSlots)
+    {
+        Composition& c = *pc;
+        if ( ( c.mpScaleSource == &source ) && c.match(stack, width, height, format, compression) )
+        {
+            if (c.isImpossible())
+            {
+                return NULL;
+            }
+            DTRACEIF( COMPOSITION_DEBUG, "CompositionManager::requestScaledComposition: reusing scaled composition %d", c.mSlot);
+            c.onUpdate(stack);
+            c.onUpdateTimestamp(mTimestamp);
+            return pc;
+        }
+    }
+
+    Composition& ce = allocateComposition();
+    ce.onUpdateAll(stack, width, height, format, compression, mTimestamp);
+    ce.mpScaleSource = &source;
+    source.mScaleUsers++;
 
-    // Now do a preliminary search for the best composition engine for this composition
     chooseBestCompositionEngine(ce, type);
 
     if (ce.isImpossible())
@@ -910,6 +1248,7 @@ AbstractComposition* CompositionManager::requestComposition(const Content::Layer
         return NULL;
     }
 
+    DTRACEIF( COMPOSITION_DEBUG, "CompositionManager::requestScaledComposition: composition %d scales composition %d", ce.mSlot, source.mSlot);
     return &ce;
 }
 
@@ -1038,13 +1377,8 @@ void CompositionManager::expireBuffers( void )
         for (HWCNativeHandle handle : mStaleBufferHandles)
         {
             DTRACEIF( COMPOSITION_DEBUG, "CompositionManager::expireBuffers buffer %p", handle );
-            // Expire any compositions for which this buffer was a source.
-            for (uint32_t i = 0; i < mCompositions.size(); i++)
-            {
-                Composition& c = mCompositions[i];
-                DTRACEIF( COMPOSITION_DEBUG, "CompositionManager::expireComposition: Checking composition %d/%p %s", i, &c, c.dump(mTimestamp).string() );
-                c.expireBuffer( handle );
-            }
+            // Expire any compositions for which this buffer was a source or target.
+            invalidate( handle );
         }
         mStaleBufferHandles.clear();
     }
@@ -1077,6 +1411,16 @@ HWCString CompositionManager::dump() const
 
     HWCString output;
     output += mBufferQueue.dump();
+    output.appendFormat("Composition index: %zu signatures\n", mCompositionIndex.size());
+    uint32_t scaled = 0;
+    for (const Composition* pc : mCompositionSlots)
+    {
+        if ( pc->mpScaleSource && ( pc->mTimestamp == mTimestamp ) )
+        {
+            scaled++;
+        }
+    }
+    output.appendFormat("Compositions scaled from a shared composition this frame: %u\n", scaled);
     for (uint32_t i = 0; i < mCompositions.size(); i++)
     {
         output.appendFormat("Composition %d/%d ", i, mCompositions.size());
@@ -1106,6 +1450,10 @@ HWCString CompositionManager::Composition::dump(nsecs_t now, const char* pIdenti
         const Layer& src = mSourceLayers[i];
         output.appendFormat("   S %u %s\n", i, src.dump().string() );
     }
+    if (mpScaleSource)
+    {
+        output.appendFormat("     Scaled from composition %u\n", mpScaleSource->mSlot);
+    }
     output.appendFormat("     T %s %s BufferQueue:%p\n", mRenderTarget.dump().string(), mbTargetValid ? "Target:Valid": "Target:NotValid", mRenderTargetBuffer);
     return output;
 }
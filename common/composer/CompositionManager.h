@@ -20,12 +20,14 @@
 #include <vector>
 #include <mutex>
 #include <map>
+#include <unordered_map>
 #include <bitset>
 
 #include "AbstractComposer.h"
 #include "AbstractComposition.h"
 #include "AbstractBufferManager.h"
 #include "BufferQueue.h"
+#include "HandleIndex.h"
 #include "HwcList.h"
 #include "layer.h"
 #include "SurfaceFlingerComposer.h"
@@ -62,6 +64,9 @@ public:
 #ifdef uncommenthwc1
     void onPrepareBegin(size_t numDisplays, hwc_display_contents_1_t** displays, nsecs_t timestamp);
 #endif
+    // Start of frame housekeeping that does not depend on the display contents (onPrepareBegin calls this).
+    // Compositions requested with the same timestamp belong to the same frame.
+    void onFrameBegin(nsecs_t timestamp);
     void onPrepareEnd();
     void onAccept(const Content::Display& display, uint32_t d);
 #ifdef uncommenthwc1
@@ -71,6 +76,8 @@ public:
 
     // Request a composition of the source layer stack to the requested resolution.
     // Once a composition has been requested for a frame then the src layers must remain available (must not be deleted or modified).
+    // Displays showing the same stack in the same frame share one composition. If one is already composing the stack
+    // at a larger resolution, the request is met by scaling that composition's target rather than composing the stack again.
     AbstractComposition* requestComposition(const Content::LayerStack& src, uint32_t width, uint32_t height, uint32_t format, ECompressionType compression, AbstractComposer::Cost type = AbstractComposer::Power);
 
     // Compositions may be removed automatically if they have not been used for a while.
@@ -103,9 +110,16 @@ public:
     virtual void notifyBufferAlloc( HWCNativeHandle handle );
     virtual void notifyBufferFree( HWCNativeHandle handle );
 
+    // Expire buffers - drain the mStaleBufferHandles list.
+    // Must be called on the main thread, at the start of a frame.
+    void expireBuffers( void );
+
     // Dump a little info about all the composer
     HWCString dump() const;
 
+    // The pool composition targets are dequeued from, e.g. for its allocation statistics.
+    const BufferQueue& getCompositionBuffers() const { return mBufferQueue; }
+
 private:
     friend class Singleton<CompositionManager>;
 
@@ -115,9 +129,6 @@ private:
     // Internal function to search for the best composition engine for a particular composition
     void chooseBestCompositionEngine(Composition& c, AbstractComposer::Cost type);
 
-    // Expire buffers - drain the mStaleBufferHandles list.
-    void expireBuffers( void );
-
     // These accessors used from composition class
     nsecs_t                         getTimestamp() const        { return mTimestamp;   }
     BufferQueue&                    getBufferQueue()            { return mBufferQueue; }
@@ -125,8 +136,40 @@ private:
     // Invalidate any compositions containing this buffer handle
     void                            invalidate(HWCNativeHandle handle);
 
+    // Take the oldest entry marked for reuse, or a new one, cleared and ready for onUpdateAll.
+    Composition&                    allocateComposition();
+
+    // Note c as requested this frame, once, so later requests this frame can scale from it.
+    void                            addFrameComposition(Composition& c);
+
+    // Find a composition of src made for this frame that a request at width x height can be scaled from.
+    Composition*                    findScaleSource(const Content::LayerStack& src, uint32_t width, uint32_t height, uint32_t format, ECompressionType compression);
+
+    // Get the composition that scales source's target to width x height, creating it if needed.
+    Composition*                    requestScaledComposition(Composition& source, uint32_t width, uint32_t height, uint32_t format, ECompressionType compression, AbstractComposer::Cost type);
+
+    // Hash of everything Composition::match compares, except the source handles.
+    static uint64_t                 signatureOf(const Content::LayerStack& src, uint32_t width, uint32_t height, uint32_t format, ECompressionType compression);
+
+    // Keep the signature index up to date as a composition's state changes.
+    void                            indexComposition(Composition& c, uint64_t signature);
+    void                            unindexComposition(Composition& c);
+
+    // Replace the handles c is indexed under with handles (sorted, unique).
+    // bNested marks a composition with composition layers in its source.
+    void                            indexHandles(Composition& c, std::vector<HWCNativeHandle>& handles, bool bNested);
+
 private:
     HwcList<Composition>            mCompositions;              // List of currently active compositions
+    std::vector<Composition*>       mCompositionSlots;          // Entry i of mCompositions, without walking the list.
+    std::vector<Composition*>       mFrameCompositions;         // Compositions requested this frame, in request order.
+
+    // Compositions by signature. Each entry is in slot order so the first match is the same as a linear search.
+    std::unordered_map<uint64_t, std::vector<Composition*>> mCompositionIndex;
+
+    // Compositions using each buffer handle as a source or render target, so expiring a buffer only visits those.
+    // Compositions with composition layers can't be indexed by those layers' handles and are always visited.
+    HandleIndex<Composition>        mHandleIndex;
     std::vector<AbstractComposer*>  mpComposers;
 
     SurfaceFlingerComposer          mSurfaceFlingerComposer;    // Composer that manages surfaceflinger compositions
@@ -36,6 +36,8 @@
 
 #define GL_RENDER_TO_NV12_OPTION_NAME    "glrendertonv12"
 #define GL_RENDER_TO_NV12_OPTION_DEFAULT 1
+#define GL_NV12_MATRIX_OPTION_NAME       "glnv12matrix"
+#define GL_NV12_MATRIX_OPTION_DEFAULT    0
 
 //using namespace android;
 
@@ -407,8 +409,11 @@ GlCellComposer::CProgramStore::createProgram(
     uint32_t opaqueLayerMask,
     uint32_t premultLayerMask,
     uint32_t blankLayerMask,
-    bool renderToNV12)
+    EProgramType type,
+    bool bBlendPass,
+    const Nv12Converter* pNv12Converter)
 {
+    HWCASSERT((type == eCellRenderProgram) || pNv12Converter);
     HWCString vertexShaderSource;
 
     if (numLayers)
@@ -461,41 +466,21 @@ GlCellComposer::CProgramStore::createProgram(
 #endif
     HWCString fragmentShaderSource;
 
-    // Additional output declarations for NV12
-    static const char fragmentShaderNV12OutputDecls[] =
-        "#extension GL_EXT_YUV_target : require\n"
-        "layout(yuv) "; // will add before "out vec4 cOut;\n"
+    // The layers are composed into outColor for an RGBA target. NV12 programs compose into color
+    // and end with the conversion to their plane; the chroma program composes in a function, as
+    // it needs the colour at each chroma tap.
+    const char* pColor = (type == eCellRenderProgram) ? "outColor" : "color";
+    HWCString blendingBlock;
 
     if (numLayers)
     {
-        // Final Color Conversion for NV12
-        static const char fragmentShaderNV12OutputConversion[] =
-            "    vec3 yuvColor = rgb_2_yuv(outColor.xyz, itu_601);\n"
-            "    outColor = vec4(yuvColor.xyz, outColor.w);\n";
-
-        // Fragment shader main body
-        static const char fragmentShaderFormat[] =
-            "#version 300 es\n"
-            "#extension GL_OES_EGL_image_external : require\n"
-            "%sout vec4 outColor;\n" // Output Decls
-            "\n"
-            "uniform mediump sampler2D uTexture[%d];\n"
-            "uniform mediump float uPlaneAlpha[%d];\n"
-            "\n"
-            "in mediump vec2 finTexCoords[%d];\n"
-            "\n"
-            "void main()\n"
-            "{\n"
-            "    mediump vec4 incoming;\n"
-            "    mediump float planeAlpha;\n"
-            "%s" // Layers
-            "%s" // Output conversion
-            "}";
-
-        // Sample the given texture
+        // Sample the given texture, offset by offset target pixels for chroma taps
         static const char blendingFormatSample[] =
             "    incoming = texture(uTexture[%d], finTexCoords[%d]);\n";
 
+        static const char blendingFormatSampleOffset[] =
+            "    incoming = texture(uTexture[%d], finTexCoords[%d] + dFdx(finTexCoords[%d]) * offset.x + dFdy(finTexCoords[%d]) * offset.y);\n";
+
         // Treat the incoming as black (opaque)
         static const char blendingFormatSampleBlack[] =
             "    incoming = vec4(0,0,0,1);\n";
@@ -535,18 +520,18 @@ GlCellComposer::CProgramStore::createProgram(
 
         // Write the colour directly for the first layer
         static const char blendingFormatWrite[] =
-            "    outColor = incoming;\n";
+            "    %s = incoming;\n";
 
         // Otherwise blend and write
         static const char blendingFormatWritePremultBlend[] =
-            "    outColor = outColor * (1.0-incoming.a) + incoming;\n";
-
-        HWCString blendingBlock;
+            "    %s = %s * (1.0-incoming.a) + incoming;\n";
 
         for (uint32_t i = 0; i < numLayers; ++i)
         {
             if (blankLayerMask & (1 << i))
                 blendingBlock += blendingFormatSampleBlack;
+            else if (type == eCellRenderProgramChroma)
+                blendingBlock += HWCString::format(blendingFormatSampleOffset, i, i, i, i);
             else
                 blendingBlock += HWCString::format(blendingFormatSample, i, i);
             blendingBlock += HWCString::format(blendingFormatSamplePlaneAlpha, i);
@@ -570,46 +555,53 @@ GlCellComposer::CProgramStore::createProgram(
             if (!premult)
                 blendingBlock += blendingFormatCoverageMultiply;
             if (i == 0)
-                blendingBlock += blendingFormatWrite;
+                blendingBlock += HWCString::format(blendingFormatWrite, pColor);
             else
-                blendingBlock += blendingFormatWritePremultBlend;
-        }
-
-        HWCString outputDecls;
-        HWCString outputConversion;
-
-        if (renderToNV12)
-        {
-            outputDecls = fragmentShaderNV12OutputDecls;
-            outputConversion = fragmentShaderNV12OutputConversion;
+                blendingBlock += HWCString::format(blendingFormatWritePremultBlend, pColor, pColor);
         }
-
-        fragmentShaderSource = HWCString::format(fragmentShaderFormat, outputDecls.string(), numLayers, numLayers, numLayers, blendingBlock.string(), outputConversion.string());
     }
     else
     {
         // Zero layers should result in clear to transparent
-        static const char fragmentShaderFormat[] =
-            "#version 300 es\n"
-            "%sout vec4 outColor;\n"
-            "void main()\n"
-            "{\n"
-            "    outColor = %s;\n"
-            "}";
+        blendingBlock = HWCString::format("    %s = vec4(0,0,0,0);\n", pColor);
+    }
 
-        HWCString outputDecls;
-        HWCString outputValue;
-        if (renderToNV12)
-        {
-            outputDecls = fragmentShaderNV12OutputDecls;
-            outputValue = "vec4(rgb_2_yuv(vec3(0,0,0), itu_601), 0)";
-        }
-        else
-        {
-            outputValue = "vec4(0,0,0,0)";
-        }
+    // Declarations of the layer inputs, if there are any
+    static const char layerDeclarationsFormat[] =
+        "\n"
+        "uniform mediump sampler2D uTexture[%d];\n"
+        "uniform mediump float uPlaneAlpha[%d];\n"
+        "\n"
+        "in mediump vec2 finTexCoords[%d];\n";
+
+    // Locals used by the composition
+    static const char compositionLocals[] =
+        "    mediump vec4 incoming;\n"
+        "    mediump float planeAlpha;\n";
+
+    fragmentShaderSource =
+        "#version 300 es\n"
+        "#extension GL_OES_EGL_image_external : require\n"
+        "out vec4 outColor;\n";
+    if (numLayers)
+    {
+        fragmentShaderSource += HWCString::format(layerDeclarationsFormat, numLayers, numLayers, numLayers);
+    }
+    fragmentShaderSource += "\n";
 
-        fragmentShaderSource = HWCString::format(fragmentShaderFormat, outputDecls.string(), outputValue.string());
+    switch (type)
+    {
+    case eCellRenderProgram:
+        fragmentShaderSource += HWCString("void main()\n{\n") + compositionLocals + blendingBlock + "}";
+        break;
+    case eCellRenderProgramLuma:
+        fragmentShaderSource += HWCString("void main()\n{\n") + compositionLocals + "    mediump vec4 color;\n"
+            + blendingBlock + pNv12Converter->getLumaOutput(bBlendPass) + "}";
+        break;
+    case eCellRenderProgramChroma:
+        fragmentShaderSource += HWCString("mediump vec4 compose(mediump vec2 offset)\n{\n") + compositionLocals + "    mediump vec4 color;\n"
+            + blendingBlock + "    return color;\n}\n\nvoid main()\n{\n" + pNv12Converter->getChromaOutput(bBlendPass) + "}";
+        break;
     }
 
     DTRACEIF(COMPOSITION_DEBUG, "Fragment Shader:\n%s\n", fragmentShaderSource.string());
@@ -663,21 +655,25 @@ bool GlCellComposer::CProgramStore::bind(
     uint32_t opaqueLayerMask,
     uint32_t premultLayerMask,
     uint32_t blankLayerMask,
-    bool renderToNV12)
+    EProgramType type,
+    bool bBlendPass,
+    const Nv12Converter* pNv12Converter)
 {
     HWCASSERT(numLayers <= maxNumLayers);
 
     ProgramKey key;
-    key.type = (renderToNV12 ? eCellRenderProgramNV12 : eCellRenderProgram);
+    key.type = type;
     key.numLayers = numLayers;
     key.opaqueLayerMask = opaqueLayerMask;
     key.premultLayerMask = premultLayerMask;
     key.blankLayerMask = blankLayerMask;
+    key.blendPass = bBlendPass;
+    key.nv12Params = pNv12Converter ? pNv12Converter->getParams().pack() : 0;
 #ifdef uncomment
     // Make sure the program exists
     if (mPrograms.get(key) == NULL)
     {
-        mPrograms.put(key, createProgram(numLayers, opaqueLayerMask, premultLayerMask, blankLayerMask, renderToNV12));
+        mPrograms.put(key, createProgram(numLayers, opaqueLayerMask, premultLayerMask, blankLayerMask, type, bBlendPass, pNv12Converter));
     }
     const RenderProgHandle &program = mPrograms.get(key);
 
@@ -716,7 +712,8 @@ GLint GlCellComposer::CProgramStore::getTexCoordsVertexAttribute(uint32_t index)
 GlCellComposer::GlCellComposer(std::shared_ptr<GLContext> context):
     mBm( AbstractBufferManager::get() ),
     mContext(context),
-    mNv12RenderingEnabled(GL_RENDER_TO_NV12_OPTION_NAME, GL_RENDER_TO_NV12_OPTION_DEFAULT)
+    mNv12RenderingEnabled(GL_RENDER_TO_NV12_OPTION_NAME, GL_RENDER_TO_NV12_OPTION_DEFAULT),
+    mNv12Matrix(GL_NV12_MATRIX_OPTION_NAME, GL_NV12_MATRIX_OPTION_DEFAULT)
 {
 }
 
@@ -987,26 +984,54 @@ std::shared_ptr<GlCellComposer> GlCellComposer::create(std::shared_ptr<GLContext
     glDisable(GL_BLEND);
     getGLError("glEnable");
 
-    // Query the context for extension support
-    const char* pExtensions = reinterpret_cast<const char*>(glGetString(GL_EXTENSIONS));
-    composer->mNv12TargetSupported = (pExtensions != NULL) && (strstr(pExtensions, "GL_EXT_YUV_target") != NULL);
+    // Query the context for extension support. NV12 targets are written a
+    // plane at a time through R8 and RG88 imports of the buffer, so both
+    // must be importable and renderable.
+    const char* pExtensions = eglQueryString(context->getDisplay(), EGL_EXTENSIONS);
+    composer->mNv12TargetSupported = (pExtensions != NULL) && (strstr(pExtensions, "EGL_EXT_image_dma_buf_import") != NULL)
+        && isRenderable(GL_R8_EXT, GL_RED_EXT) && isRenderable(GL_RG8_EXT, GL_RG_EXT);
+    if (composer->mNv12TargetSupported && (strstr(pExtensions, "EGL_EXT_image_dma_buf_import_modifiers") != NULL))
+    {
+        // The driver lists the formats it can import; without the list any format may fail at import.
+        PFNEGLQUERYDMABUFFORMATSEXTPROC pQueryFormats = (PFNEGLQUERYDMABUFFORMATSEXTPROC)eglGetProcAddress("eglQueryDmaBufFormatsEXT");
+        EGLint numFormats = 0;
+        if (pQueryFormats && pQueryFormats(context->getDisplay(), 0, NULL, &numFormats) && (numFormats > 0))
+        {
+            std::vector<EGLint> formats(numFormats);
+            pQueryFormats(context->getDisplay(), numFormats, formats.data(), &numFormats);
+            formats.resize(numFormats);
+            composer->mNv12TargetSupported =
+                (std::find(formats.begin(), formats.end(), EGLint(DRM_FORMAT_R8)) != formats.end())
+                && (std::find(formats.begin(), formats.end(), EGLint(DRM_FORMAT_GR88)) != formats.end());
+        }
+    }
     DTRACEIF(COMPOSITION_DEBUG, "NV12HWC: NV12 rendering is %s", composer->mNv12TargetSupported ? "supported" : "unsupported");
 
     return composer;
 }
 
+// Checks that a texture of the given format can be rendered to.
+bool GlCellComposer::isRenderable(GLenum internalFormat, GLenum format)
+{
+    GLuint texture = 0;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, 2, 2, 0, format, GL_UNSIGNED_BYTE, NULL);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+    bool bRenderable = !getGLError("glFramebufferTexture2D")
+        && (glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, 0, 0);
+    glDeleteTextures(1, &texture);
+    getGLError("glDeleteTextures");
+    return bRenderable;
+}
+
 bool GlCellComposer::attachToFBO(GLuint textureId)
 {
     bool done = false;
 
-    GLenum texTarget;
-    if (mDestTextureExternal)
-        texTarget = GL_TEXTURE_EXTERNAL_OES;
-    else
-        texTarget = GL_TEXTURE_2D;
-
     // Attach the colour buffer
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, texTarget, textureId, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, textureId, 0);
     if (!getGLError("glFramebufferTexture2D", "A temporary texture could not be attached to the frame buffer object"))
     {
         GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
@@ -1030,7 +1055,7 @@ GlCellComposer::Texture::~Texture()
     // Destroy the destination EGL image
     if (EGL_NO_IMAGE_KHR != mEglImage)
     {
-        //eglDestroyImageKHR(mDisplay, mEglImage);
+        eglDestroyImageKHR(mDisplay, mEglImage);
         getEGLError("eglDestroyImageKHR");
     }
 }
@@ -1088,6 +1113,53 @@ std::unique_ptr<GlCellComposer::Texture> GlCellComposer::Texture::createTexture(
 #endif
 }
 
+std::unique_ptr<GlCellComposer::Texture> GlCellComposer::Texture::createPlaneTexture(const Layer& layer, uint32_t plane, AbstractBufferManager& bm, EGLDisplay display)
+{
+    HWCASSERT(layer.getHandle());
+    HWCASSERT(plane < 2);
+
+    HwcBuffer bo;
+    if (!bm.getBufferDetails(layer.getHandle(), &bo))
+    {
+        DTRACE("NV12HWC: No details for the destination buffer");
+        return NULL;
+    }
+
+    // The chroma plane is subsampled by two in each direction.
+    const EGLint attributes[] =
+    {
+        EGL_WIDTH,                     static_cast<EGLint>(plane ? (bo.width + 1) / 2 : bo.width),
+        EGL_HEIGHT,                    static_cast<EGLint>(plane ? (bo.height + 1) / 2 : bo.height),
+        EGL_LINUX_DRM_FOURCC_EXT,      static_cast<EGLint>(plane ? DRM_FORMAT_GR88 : DRM_FORMAT_R8),
+        EGL_DMA_BUF_PLANE0_FD_EXT,     static_cast<EGLint>(bo.prime_fd),
+        EGL_DMA_BUF_PLANE0_PITCH_EXT,  static_cast<EGLint>(bo.pitches[plane]),
+        EGL_DMA_BUF_PLANE0_OFFSET_EXT, static_cast<EGLint>(bo.offsets[plane]),
+        EGL_NONE
+    };
+    EGLImageKHR eglImage = eglCreateImageKHR(display, EGL_NO_CONTEXT, EGL_LINUX_DMA_BUF_EXT, static_cast<EGLClientBuffer>(nullptr), attributes);
+    if (getEGLError("eglCreateImageKHR", "A plane EGL image could not be created") || eglImage == EGL_NO_IMAGE_KHR)
+        return NULL;
+
+    GLuint textureId = 0;
+    glGenTextures(1, &textureId);
+    if (getGLError("glGenTextures", "A plane texture could not be created"))
+    {
+        eglDestroyImageKHR(display, eglImage);
+        return NULL;
+    }
+    std::unique_ptr<Texture> pTex(new Texture(NULL, eglImage, textureId, display));
+
+    glBindTexture(GL_TEXTURE_2D, textureId);
+    if (getGLError("glBindTexture", "A plane texture could not be set"))
+        return NULL;
+
+    glEGLImageTargetTexture2DOES(GL_TEXTURE_2D, (GLeglImageOES)eglImage);
+    if (getGLError("glEGLImageTargetTexture2DOES", "A plane texture could not be set"))
+        return NULL;
+
+    return pTex;
+}
+
 bool GlCellComposer::bindTexture(
     GLuint texturingUnit,
     GLuint textureId)
@@ -1246,8 +1318,6 @@ bool GlCellComposer::beginFrame(const Content::LayerStack& source, const Layer&
 
     mpLayers = &source;
 
-    // Set the destination texture
-    mDestTexture = Texture::createTexture(target, mBm, mContext->getDisplay());
     mDestWidth = target.getDstWidth();
     mDestHeight = target.getDstHeight();
 
@@ -1259,17 +1329,31 @@ bool GlCellComposer::beginFrame(const Content::LayerStack& source, const Layer&
     case HWC_PIXEL_FORMAT_NV12_LINEAR_INTEL:
     case HWC_PIXEL_FORMAT_NV12_LINEAR_PACKED_INTEL:
     case HWC_PIXEL_FORMAT_NV12_X_TILED_INTEL:
-        mDestTextureExternal = true;
+        mDestNv12 = true;
         break;
     default:
-        mDestTextureExternal = false;
+        mDestNv12 = false;
         break;
     }
 
-    if (!mDestTexture || !attachToFBO(mDestTexture->getId()))
+    // Set the destination texture
+    if (mDestNv12)
     {
-        mDestTexture.reset();
-        return UNKNOWN_ERROR;
+        if (!beginNv12Frame(target))
+        {
+            mDestPlanes[0].reset();
+            mDestPlanes[1].reset();
+            return UNKNOWN_ERROR;
+        }
+    }
+    else
+    {
+        mDestTexture = Texture::createTexture(target, mBm, mContext->getDisplay());
+        if (!mDestTexture || !attachToFBO(mDestTexture->getId()))
+        {
+            mDestTexture.reset();
+            return UNKNOWN_ERROR;
+        }
     }
 
     // Create the source textures
@@ -1299,30 +1383,26 @@ bool GlCellComposer::beginFrame(const Content::LayerStack& source, const Layer&
     return OK;
 }
 
-#ifdef uncomment
-HWCString static dump(uint32_t numIndices, const uint32_t* pIndices, const Region& region)
+HWCString static dump(uint32_t numIndices, const uint32_t* pIndices, uint32_t numRects, const HwcRect<int>* pRects)
 {
     HWCString output = HWCString::format("numIndices:%d ", numIndices);
     for(uint32_t i=0; i < numIndices; i++)
         output += HWCString::format("%d,", pIndices[i]);
 
-    size_t size;
-    const HwcRect<int>* pRects = region.getArray(&size);
-
-    output += HWCString::format(" numRects:%zd ", size);
-    for (uint32_t i = 0; i < size; i++)
+    output += HWCString::format(" numRects:%u ", numRects);
+    for (uint32_t i = 0; i < numRects; i++)
         output += HWCString::format("(%d, %d, %d, %d) ", pRects[i].left, pRects[i].top, pRects[i].right, pRects[i].bottom);
     return output;
 }
 
-bool GlCellComposer::drawLayerSetInternal(uint32_t numIndices, const uint32_t* pIndices, const Region& region)
+bool GlCellComposer::drawLayerSetInternal(EProgramType type, bool bBlendPass, uint32_t numIndices, const uint32_t* pIndices, uint32_t numRects, const HwcRect<int>* pRects)
 {
     ATRACE_CALL_IF(HWC_TRACE);
 
-    DTRACEIF(COMPOSITION_DEBUG, "GlCellComposer::drawLayerSetInternal: %s", dump(numIndices, pIndices, region).string());
+    DTRACEIF(COMPOSITION_DEBUG, "GlCellComposer::drawLayerSetInternal: %s", dump(numIndices, pIndices, numRects, pRects).string());
 
     // Check that the destination texture is ready to go.
-    HWCASSERT(mDestTexture);
+    HWCASSERT(mDestTexture || mDestNv12);
 
     // Bind the source textures
     uint32_t i;
@@ -1369,13 +1449,14 @@ bool GlCellComposer::drawLayerSetInternal(uint32_t numIndices, const uint32_t* p
     }
 
     // Bind the program
-    bool isProgramBound =  mProgramStore.bind(numIndices, planeAlphas, opaqueMask, premultMask, blankMask, mDestTextureExternal);
+    bool isProgramBound =  mProgramStore.bind(numIndices, planeAlphas, opaqueMask, premultMask, blankMask,
+        type, bBlendPass, (type != eCellRenderProgram) ? mpNv12Converter.get() : NULL);
 
     if (isProgramBound)
     {
         // Todo pass this into glDrawArrays
-        size_t numVisibleRegions;
-        const HwcRect<int>* visibleRegions = region.getArray(&numVisibleRegions);
+        const size_t numVisibleRegions = numRects;
+        const HwcRect<int>* visibleRegions = pRects;
 
         // Setup the VBO contents
         uint32_t vertexStride = 2 + 2*numIndices;
@@ -1444,19 +1525,38 @@ bool GlCellComposer::drawLayerSetInternal(uint32_t numIndices, const uint32_t* p
 }
 
 bool
- GlCellComposer::drawLayerSet(uint32_t numIndices, const uint32_t* pIndices, const Region& region)
+ GlCellComposer::drawLayerSet(uint32_t numIndices, const uint32_t* pIndices, uint32_t numRects, const HwcRect<int>* pRects)
 {
     ATRACE_CALL_IF(HWC_TRACE);
 
-    DTRACEIF(COMPOSITION_DEBUG, "GlCellComposer::drawLayerSet: %s", dump(numIndices, pIndices, region).string());
+    DTRACEIF(COMPOSITION_DEBUG, "GlCellComposer::drawLayerSet: %s", dump(numIndices, pIndices, numRects, pRects).string());
 
     // Check that the destination texture is attached to the FBO
-    if (!mDestTexture)
+    if (!mDestTexture && !mDestPlanes[1])
     {
         DTRACE("The destination texture is not attached to the FBO");
         return UNKNOWN_ERROR;
     }
 
+    // NV12 cells are drawn into each plane in turn at the end of the frame.
+    if (mDestNv12)
+    {
+        if (mNumNv12Cells == mNv12Cells.size())
+        {
+            mNv12Cells.resize(mNumNv12Cells + 1);
+        }
+        Nv12Cell& cell = mNv12Cells[mNumNv12Cells++];
+        cell.mIndices.assign(pIndices, pIndices + numIndices);
+        cell.mRects.assign(pRects, pRects + numRects);
+        return OK;
+    }
+
+    return drawPasses(eCellRenderProgram, numIndices, pIndices, numRects, pRects);
+}
+
+// Draws the layers over the rects, in as many passes as the programs need.
+bool GlCellComposer::drawPasses(EProgramType type, uint32_t numIndices, const uint32_t* pIndices, uint32_t numRects, const HwcRect<int>* pRects)
+{
     const uint32_t maxTextures = CProgramStore::maxNumLayers;
 
     uint32_t startIndex = 0;
@@ -1467,9 +1567,6 @@ bool
 
         if (startIndex > 0)
         {
-            DTRACEIF(COMPOSITION_DEBUG, "NV12HWC: Enabling Blend!");
-            HWCASSERT(!mDestTextureExternal);
-
             glEnable(GL_BLEND);
             glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
         }
@@ -1478,24 +1575,34 @@ bool
             glDisable(GL_BLEND);
         }
 
-        drawLayerSetInternal(numIndicesThisPass, &pIndices[startIndex], region);
+        drawLayerSetInternal(type, startIndex > 0, numIndicesThisPass, &pIndices[startIndex], numRects, pRects);
 
         startIndex = endIndex;
     } while (startIndex < numIndices);
 
     return OK;
 }
-#endif
 
 bool GlCellComposer::endFrame()
 {
     ATRACE_CALL_IF(HWC_TRACE);
 
+    status_t result = OK;
+    if (mDestNv12 && !drawNv12Planes())
+    {
+        result = UNKNOWN_ERROR;
+    }
+
     glFlush();
-    status_t result = (getGLError("glFlush")) ? UNKNOWN_ERROR : OK;
+    if (getGLError("glFlush"))
+    {
+        result = UNKNOWN_ERROR;
+    }
 
     // Destroy the destination texture
     mDestTexture.reset();
+    mDestPlanes[0].reset();
+    mDestPlanes[1].reset();
 
     // Destroy the source textures
     mSourceTextures.clear();
@@ -1506,6 +1613,55 @@ bool GlCellComposer::endFrame()
     return result;
 }
 
+bool GlCellComposer::beginNv12Frame(const Layer& target)
+{
+    // The programs are keyed on the conversion, so a new matrix only selects other programs.
+    const Nv12Converter::Params params = Nv12Converter::select(target, mNv12Matrix);
+    if (!mpNv12Converter || mpNv12Converter->getParams() != params)
+    {
+        mpNv12Converter.reset(new Nv12Converter(params));
+        DTRACEIF(COMPOSITION_DEBUG, "NV12HWC: Converting to %s", mpNv12Converter->dump().string());
+    }
+
+    for (uint32_t plane = 0; plane < 2; plane++)
+    {
+        mDestPlanes[plane] = Texture::createPlaneTexture(target, plane, mBm, mContext->getDisplay());
+        if (!mDestPlanes[plane])
+            return false;
+    }
+    mNumNv12Cells = 0;
+    return true;
+}
+
+// Draws the cells of the frame into the destination, one plane per pass over them.
+bool GlCellComposer::drawNv12Planes()
+{
+    ATRACE_CALL_IF(HWC_TRACE);
+
+    static const EProgramType planeTypes[2] = { eCellRenderProgramLuma, eCellRenderProgramChroma };
+    for (uint32_t plane = 0; plane < 2; plane++)
+    {
+        if (!attachToFBO(mDestPlanes[plane]->getId()))
+            return false;
+
+        if (plane == 0)
+            glViewport(0, 0, mDestWidth, mDestHeight);
+        else
+            glViewport(0, 0, (mDestWidth + 1) / 2, (mDestHeight + 1) / 2);
+
+        for (uint32_t c = 0; c < mNumNv12Cells; c++)
+        {
+            const Nv12Cell& cell = mNv12Cells[c];
+            drawPasses(planeTypes[plane], cell.mIndices.size(), cell.mIndices.data(), cell.mRects.size(), cell.mRects.data());
+        }
+    }
+
+    DTRACEIF(COMPOSITION_DEBUG, "NV12HWC: %ux%u %s, %u cells, %u bytes written (%u as RGBA)",
+        mDestWidth, mDestHeight, mpNv12Converter->dump().string(), mNumNv12Cells,
+        Nv12Converter::getBytesWritten(mDestWidth, mDestHeight), mDestWidth * mDestHeight * 4);
+    return true;
+}
+
 void GlCellComposer::bindAVbo()
 {
     if (NumVboIds > 1)
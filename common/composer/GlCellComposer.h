@@ -32,6 +32,7 @@
 #include <utils/JenkinsHash.h>
 #endif
 #include "PartitionedComposer.h"
+#include "Nv12Converter.h"
 #include "option.h"
 #include "AbstractBufferManager.h"
 #include "gbmbufferhandler.h"
@@ -92,9 +93,7 @@ public:
     virtual ~GlCellComposer();
 
     bool beginFrame(const Content::LayerStack& source, const Layer& target);
-#ifdef uncomment
-    bool drawLayerSet(uint32_t numIndices, const uint32_t* pIndices, const Region& region);
-#endif
+    bool drawLayerSet(uint32_t numIndices, const uint32_t* pIndices, uint32_t numRects, const HwcRect<int>* pRects);
     bool endFrame();
 
     bool isLayerSupportedAsInput(const Layer& layer);
@@ -102,8 +101,9 @@ public:
     bool canBlankUnsupportedInputLayers();
 
     enum EProgramType {
-        eCellRenderProgram,
-        eCellRenderProgramNV12,
+        eCellRenderProgram,         // RGBA target.
+        eCellRenderProgramLuma,     // R8 view of plane 0 of an NV12 target.
+        eCellRenderProgramChroma,   // RG88 view of plane 1 of an NV12 target.
     };
 
     struct ProgramKey
@@ -115,6 +115,9 @@ public:
         uint32_t opaqueLayerMask;
         uint32_t premultLayerMask;
         uint32_t blankLayerMask;
+        // NV12 programs only: blended over an earlier pass, and the packed conversion parameters.
+        uint32_t blendPass;
+        uint32_t nv12Params;
 
         bool operator==(const GlCellComposer::ProgramKey& right) const
         {
@@ -132,10 +135,13 @@ private:
 
     bool attachToFBO(GLuint textureId);
 
+    bool beginNv12Frame(const Layer& target);
+    bool drawNv12Planes();
+    static bool isRenderable(GLenum internalFormat, GLenum format);
+
     bool bindTexture(GLuint texturingUnit, GLuint textureId);
-#ifdef uncomment
-    bool drawLayerSetInternal(uint32_t numIndices, const uint32_t* pIndices, const Region& region);
-#endif
+    bool drawPasses(EProgramType type, uint32_t numIndices, const uint32_t* pIndices, uint32_t numRects, const HwcRect<int>* pRects);
+    bool drawLayerSetInternal(EProgramType type, bool bBlendPass, uint32_t numIndices, const uint32_t* pIndices, uint32_t numRects, const HwcRect<int>* pRects);
     bool shouldBlankLayer(const Layer& layer);
 
     /** \brief OpenGL shader
@@ -176,7 +182,9 @@ private:
             uint32_t opaqueLayerMask,
             uint32_t premultLayerMask,
             uint32_t blankLayerMask,
-            bool renderToNV12);
+            EProgramType type = eCellRenderProgram,
+            bool bBlendPass = false,
+            const Nv12Converter* pNv12Converter = NULL);
 
         GLint getPositionVertexAttribute() const;
         uint32_t getNumTexCoords() const;
@@ -226,7 +234,9 @@ private:
             uint32_t opaqueLayerMask,
             uint32_t premultLayerMask,
             uint32_t blankLayerMask,
-            bool renderToNV12);
+            EProgramType type,
+            bool bBlendPass,
+            const Nv12Converter* pNv12Converter);
 
         RenderProgHandle mCurrent;
 #ifdef uncomment
@@ -239,6 +249,8 @@ private:
     public:
         ~Texture();
         static std::unique_ptr<Texture> createTexture(const Layer& layer, AbstractBufferManager& bm, EGLDisplay display);
+        // Texture of one plane of an NV12 layer: an R8 view of the luma or an RG88 view of the chroma.
+        static std::unique_ptr<Texture> createPlaneTexture(const Layer& layer, uint32_t plane, AbstractBufferManager& bm, EGLDisplay display);
 
         GLuint getId() { return mTextureId; }
     private:
@@ -274,9 +286,21 @@ private:
     std::unique_ptr<Texture> mDestTexture;
 
     // NV12 Rendering
-    bool                    mDestTextureExternal = false;
+    // drawLayerSet records the cells, which endFrame draws into each plane of the
+    // destination in turn with programs that end in the conversion to that plane.
+    struct Nv12Cell
+    {
+        std::vector<uint32_t>     mIndices;
+        std::vector<HwcRect<int>> mRects;
+    };
+    bool                    mDestNv12            = false;
     bool                    mNv12TargetSupported = false;
     Option                  mNv12RenderingEnabled;
+    Option                  mNv12Matrix;
+    std::unique_ptr<Nv12Converter> mpNv12Converter;
+    std::unique_ptr<Texture> mDestPlanes[2];
+    std::vector<Nv12Cell>   mNv12Cells;                 // Reused from frame to frame.
+    uint32_t                mNumNv12Cells        = 0;   // Cells recorded this frame.
 
     // Source textures
     std::vector< std::unique_ptr<Texture> > mSourceTextures;
@@ -0,0 +1,119 @@
+/*
+// Copyright (c) 2017 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+#ifndef COMMON_HWC_HANDLEINDEX_H
+#define COMMON_HWC_HANDLEINDEX_H
+
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
+#include "hwcdefs.h"
+#include "platformdefines.h"
+
+namespace hwcomposer {
+
+// Users (compositions) of each buffer handle, so expiring a buffer only visits the users of that buffer.
+// Users whose handles can change without them being updated (nested users) can't be indexed and are
+// returned for every handle.
+// Each user keeps the sorted handle list and nested flag it is indexed under; the index only updates them.
+template <typename T>
+class HandleIndex
+{
+public:
+    // Replace the handles user is indexed under (indexed) with handles, which must be sorted and unique.
+    // On return indexed holds the new handles and handles the old ones.
+    void update(T* pUser, std::vector<HWCNativeHandle>& indexed, bool& bIndexedNested,
+                std::vector<HWCNativeHandle>& handles, bool bNested)
+    {
+        // Both lists are sorted, so walk them together to find what was removed and what was added.
+        size_t o = 0, n = 0;
+        while ( ( o < indexed.size() ) || ( n < handles.size() ) )
+        {
+            if ( ( n == handles.size() ) || ( ( o < indexed.size() ) && ( indexed[o] < handles[n] ) ) )
+            {
+                auto it = mUsers.find( indexed[o] );
+                HWCASSERT( it != mUsers.end() );
+                if ( it != mUsers.end() )
+                {
+                    std::vector<T*>& users = it->second;
+                    users.erase( std::find( users.begin(), users.end(), pUser ) );
+                    if ( users.empty() )
+                    {
+                        mUsers.erase( it );
+                    }
+                }
+                o++;
+            }
+            else if ( ( o == indexed.size() ) || ( handles[n] < indexed[o] ) )
+            {
+                mUsers[ handles[n] ].push_back( pUser );
+                n++;
+            }
+            else
+            {
+                o++;
+                n++;
+            }
+        }
+        indexed.swap( handles );
+
+        if ( bNested != bIndexedNested )
+        {
+            if ( bNested )
+            {
+                mNested.push_back( pUser );
+            }
+            else
+            {
+                mNested.erase( std::find( mNested.begin(), mNested.end(), pUser ) );
+            }
+            bIndexedNested = bNested;
+        }
+    }
+
+    // Set users to every user that may be using handle.
+    void find(HWCNativeHandle handle, std::vector<T*>& users) const
+    {
+        users.clear();
+        auto it = mUsers.find( handle );
+        if ( it != mUsers.end() )
+        {
+            users = it->second;
+        }
+        for (T* pUser : mNested)
+        {
+            if ( std::find( users.begin(), users.end(), pUser ) == users.end() )
+            {
+                users.push_back( pUser );
+            }
+        }
+    }
+
+    // Number of handles with at least one user.
+    size_t size() const
+    {
+        return mUsers.size();
+    }
+
+private:
+    std::unordered_map<HWCNativeHandle, std::vector<T*>> mUsers;
+    std::vector<T*> mNested;
+};
+
+}; // namespace hwcomposer
+
+#endif // COMMON_HWC_HANDLEINDEX_H
@@ -0,0 +1,197 @@
+/*
+// Copyright (c) 2017 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+#include <string.h>
+
+#include "Nv12Converter.h"
+#include "layer.h"
+
+namespace hwcomposer {
+
+// Targets at least this tall are treated as HD content when the dataspace
+// does not say which matrix to use.
+static const uint32_t cHDHeight = 720;
+
+// Luma weights (Kr, Kb) of each matrix; Kg = 1 - Kr - Kb.
+static const float cLumaWeights[][ 2 ] =
+{
+    { 0.299f,  0.114f  },   // BT601
+    { 0.2126f, 0.0722f },   // BT709
+};
+
+// Left siting filters [1 2 1]/4 horizontally around the even column and
+// averages the two rows; centre siting averages the 2x2 block.
+static const Nv12Converter::Tap cLeftTaps[] =
+{
+    { -1, 0, 0.125f }, { 0, 0, 0.25f }, { 1, 0, 0.125f },
+    { -1, 1, 0.125f }, { 0, 1, 0.25f }, { 1, 1, 0.125f },
+};
+
+static const Nv12Converter::Tap cCenterTaps[] =
+{
+    { 0, 0, 0.25f }, { 1, 0, 0.25f },
+    { 0, 1, 0.25f }, { 1, 1, 0.25f },
+};
+
+Nv12Converter::Nv12Converter( const Params& params ) :
+    mParams( params )
+{
+    const float kr = cLumaWeights[ params.mMatrix ][ 0 ];
+    const float kb = cLumaWeights[ params.mMatrix ][ 1 ];
+    const float kg = 1.0f - kr - kb;
+
+    // Limited range puts luma in [16, 235] and chroma in [16, 240].
+    const float yScale = params.mbFullRange ? 1.0f : 219.0f / 255.0f;
+    const float yOffset = params.mbFullRange ? 0.0f : 16.0f / 255.0f;
+    const float cScale = params.mbFullRange ? 1.0f : 224.0f / 255.0f;
+    const float cOffset = 128.0f / 255.0f;
+
+    // Y = Kr R + Kg G + Kb B, Cb = (B - Y) / 2(1 - Kb), Cr = (R - Y) / 2(1 - Kr)
+    const float cb = cScale / ( 2.0f * ( 1.0f - kb ) );
+    const float cr = cScale / ( 2.0f * ( 1.0f - kr ) );
+    const float matrix[ 3 ][ 4 ] =
+    {
+        { yScale * kr,       yScale * kg,  yScale * kb,       yOffset },
+        { -cb * kr,          -cb * kg,     cb * ( 1 - kb ),   cOffset },
+        { cr * ( 1 - kr ),   -cr * kg,     -cr * kb,          cOffset },
+    };
+    memcpy( mMatrix, matrix, sizeof( mMatrix ) );
+
+    const Tap* pTaps = cLeftTaps;
+    mNumTaps = sizeof( cLeftTaps ) / sizeof( cLeftTaps[ 0 ] );
+    if ( params.mSiting == SitingCenter )
+    {
+        pTaps = cCenterTaps;
+        mNumTaps = sizeof( cCenterTaps ) / sizeof( cCenterTaps[ 0 ] );
+    }
+    memcpy( mTaps, pTaps, mNumTaps * sizeof( Tap ) );
+}
+
+Nv12Converter::Params Nv12Converter::select( const Layer& target, uint32_t matrixOverride )
+{
+    const DataSpace dataSpace = target.getDataSpace();
+
+    Params params;
+    if ( matrixOverride == 601 )
+        params.mMatrix = BT601;
+    else if ( matrixOverride == 709 )
+        params.mMatrix = BT709;
+    else if ( dataSpace.standard == EDataSpaceStandard::BT709 )
+        params.mMatrix = BT709;
+    else if ( dataSpace.standard != EDataSpaceStandard::Unspecified )
+        params.mMatrix = BT601;
+    else
+        params.mMatrix = ( target.getDstHeight() >= cHDHeight ) ? BT709 : BT601;
+
+    params.mbFullRange = ( dataSpace.range == EDataSpaceRange::Full );
+    params.mSiting = SitingLeft;
+    return params;
+}
+
+// The offset term of a conversion row: constant for a pass written over nothing, scaled by the
+// composed alpha for a pass blended over an earlier one.
+static HWCString offsetTerm( float offset, bool bBlend )
+{
+    return bBlend ? HWCString::format( "%.9g * color.a", offset ) : HWCString::format( "%.9g", offset );
+}
+
+HWCString Nv12Converter::getLumaOutput( bool bBlend ) const
+{
+    return HWCString::format(
+        "    outColor = vec4(dot(highp vec3(color.rgb), vec3(%.9g, %.9g, %.9g)) + %s, 0, 0, color.a);\n",
+        mMatrix[ 0 ][ 0 ], mMatrix[ 0 ][ 1 ], mMatrix[ 0 ][ 2 ], offsetTerm( mMatrix[ 0 ][ 3 ], bBlend ).string() );
+}
+
+HWCString Nv12Converter::getChromaOutput( bool bBlend ) const
+{
+    // The fragment centre of chroma sample (cx, cy) is luma position (2cx + 1, 2cy + 1), so a tap
+    // on luma sample (2cx + x, 2cy + y) is (x - 0.5, y - 0.5) luma samples away: half that in the
+    // chroma pixels compose() is offset in.
+    HWCString source( "    highp vec4 color = vec4(0);\n" );
+    for ( uint32_t t = 0; t < mNumTaps; t++ )
+    {
+        source += HWCString::format(
+            "    color += %.9g * compose(vec2(%.9g, %.9g));\n",
+            mTaps[ t ].mWeight, ( mTaps[ t ].mX - 0.5f ) * 0.5f, ( mTaps[ t ].mY - 0.5f ) * 0.5f );
+    }
+    source += HWCString::format(
+        "    outColor = vec4(dot(color.rgb, vec3(%.9g, %.9g, %.9g)) + %s,\n"
+        "                    dot(color.rgb, vec3(%.9g, %.9g, %.9g)) + %s, 0, color.a);\n",
+        mMatrix[ 1 ][ 0 ], mMatrix[ 1 ][ 1 ], mMatrix[ 1 ][ 2 ], offsetTerm( mMatrix[ 1 ][ 3 ], bBlend ).string(),
+        mMatrix[ 2 ][ 0 ], mMatrix[ 2 ][ 1 ], mMatrix[ 2 ][ 2 ], offsetTerm( mMatrix[ 2 ][ 3 ], bBlend ).string() );
+    return source;
+}
+
+// Conversion of a normalised value to UNORM8, as the GL does on write.
+static inline uint8_t toUnorm8( float v )
+{
+    v = v < 0.0f ? 0.0f : ( v > 1.0f ? 1.0f : v );
+    return uint8_t( v * 255.0f + 0.5f );
+}
+
+static inline int32_t clampCoord( int32_t v, int32_t last )
+{
+    return v < 0 ? 0 : ( v > last ? last : v );
+}
+
+void Nv12Converter::convert( const uint8_t* pRGBA, uint32_t stride, uint32_t w, uint32_t h,
+                             uint8_t* pY, uint32_t yStride, uint8_t* pUV, uint32_t uvStride ) const
+{
+    const float n = 1.0f / 255.0f;
+
+    for ( uint32_t y = 0; y < h; y++ )
+    {
+        const uint8_t* pSrc = pRGBA + y * stride;
+        uint8_t* pDst = pY + y * yStride;
+        for ( uint32_t x = 0; x < w; x++, pSrc += 4 )
+        {
+            const float r = pSrc[ 0 ] * n, g = pSrc[ 1 ] * n, b = pSrc[ 2 ] * n;
+            pDst[ x ] = toUnorm8( mMatrix[ 0 ][ 0 ] * r + mMatrix[ 0 ][ 1 ] * g + mMatrix[ 0 ][ 2 ] * b + mMatrix[ 0 ][ 3 ] );
+        }
+    }
+
+    const int32_t lastX = w - 1;
+    const int32_t lastY = h - 1;
+    for ( uint32_t cy = 0; cy < ( h + 1 ) / 2; cy++ )
+    {
+        uint8_t* pDst = pUV + cy * uvStride;
+        for ( uint32_t cx = 0; cx < ( w + 1 ) / 2; cx++ )
+        {
+            float r = 0, g = 0, b = 0;
+            for ( uint32_t t = 0; t < mNumTaps; t++ )
+            {
+                const int32_t sx = clampCoord( int32_t( 2 * cx ) + mTaps[ t ].mX, lastX );
+                const int32_t sy = clampCoord( int32_t( 2 * cy ) + mTaps[ t ].mY, lastY );
+                const uint8_t* pSrc = pRGBA + sy * stride + sx * 4;
+                r += mTaps[ t ].mWeight * ( pSrc[ 0 ] * n );
+                g += mTaps[ t ].mWeight * ( pSrc[ 1 ] * n );
+                b += mTaps[ t ].mWeight * ( pSrc[ 2 ] * n );
+            }
+            pDst[ 2 * cx + 0 ] = toUnorm8( mMatrix[ 1 ][ 0 ] * r + mMatrix[ 1 ][ 1 ] * g + mMatrix[ 1 ][ 2 ] * b + mMatrix[ 1 ][ 3 ] );
+            pDst[ 2 * cx + 1 ] = toUnorm8( mMatrix[ 2 ][ 0 ] * r + mMatrix[ 2 ][ 1 ] * g + mMatrix[ 2 ][ 2 ] * b + mMatrix[ 2 ][ 3 ] );
+        }
+    }
+}
+
+HWCString Nv12Converter::dump() const
+{
+    return HWCString::format( "NV12 %s %s range, %s sited chroma",
+                              mParams.mMatrix == BT709 ? "BT.709" : "BT.601",
+                              mParams.mbFullRange ? "full" : "limited",
+                              mParams.mSiting == SitingLeft ? "left" : "centre" );
+}
+
+}; // namespace hwcomposer
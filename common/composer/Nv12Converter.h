@@ -0,0 +1,132 @@
+/*
+// Copyright (c) 2017 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+#ifndef COMMON_HWC_NV12CONVERTER_H
+#define COMMON_HWC_NV12CONVERTER_H
+
+#include <stdint.h>
+
+#include "platformdefines.h"
+
+namespace hwcomposer {
+
+class Layer;
+
+// RGB to NV12 conversion for the GL cell composer.
+// Each cell is drawn twice, straight into the planes of the target: a luma pass into an R8 view of
+// plane 0 at full resolution and a chroma pass into an RG88 view of the interleaved CbCr plane 1
+// at half resolution in each direction. The cell programs compose the layers as for an RGBA target
+// and end with the conversion generated here. Each chroma sample composes the cell at every tap
+// around its sited position and filters the RGB before converting, so the result does not depend
+// on the driver's choice of siting.
+//
+// The conversion is affine, so a cell needing more than one pass converts its premultiplied
+// result with the offsets scaled by alpha and the passes blend (ONE, ONE_MINUS_SRC_ALPHA) in YUV
+// exactly as they would in RGB.
+//
+// The shader code is generated from the same matrix and taps as the CPU implementation in
+// convert(), which is what the tests validate against a reference conversion.
+class Nv12Converter
+{
+public:
+    enum EMatrix
+    {
+        BT601,
+        BT709,
+    };
+
+    enum ESiting
+    {
+        SitingLeft,     //< MPEG-2/H.264: co-sited with even luma columns, between luma rows.
+        SitingCenter,   //< MPEG-1/JPEG: centred in each 2x2 block of luma samples.
+    };
+
+    struct Params
+    {
+        Params( EMatrix matrix = BT601, bool bFullRange = false, ESiting siting = SitingLeft ) :
+            mMatrix( matrix ), mbFullRange( bFullRange ), mSiting( siting ) {}
+
+        bool operator==( const Params& other ) const
+        {
+            return mMatrix == other.mMatrix && mbFullRange == other.mbFullRange && mSiting == other.mSiting;
+        }
+        bool operator!=( const Params& other ) const { return !( *this == other ); }
+
+        // The parameters packed into a small integer, e.g. to key programs on.
+        uint32_t pack() const { return ( uint32_t( mMatrix ) << 2 ) | ( uint32_t( mbFullRange ) << 1 ) | uint32_t( mSiting ); }
+
+        EMatrix mMatrix;
+        bool    mbFullRange;
+        ESiting mSiting;
+    };
+
+    // A chroma filter tap, as an offset in luma samples from the top left luma sample of the
+    // 2x2 block the chroma sample belongs to.
+    struct Tap
+    {
+        int32_t mX;
+        int32_t mY;
+        float   mWeight;
+    };
+
+    static const uint32_t cMaxTaps = 6;
+
+    Nv12Converter( const Params& params );
+
+    // Conversion parameters for a target layer. The matrix follows the target dataspace; without
+    // one, HD sized targets get BT.709 and smaller ones BT.601. matrixOverride is 601 or 709 to
+    // force a matrix, anything else to select automatically. Chroma is left sited.
+    static Params select( const Layer& target, uint32_t matrixOverride );
+
+    const Params& getParams() const { return mParams; }
+
+    // Row r (Y, Cb, Cr) converts normalised RGB: out = m[r][0]*R + m[r][1]*G + m[r][2]*B + m[r][3].
+    float getMatrix( uint32_t row, uint32_t col ) const { return mMatrix[ row ][ col ]; }
+
+    uint32_t getNumChromaTaps() const { return mNumTaps; }
+    const Tap* getChromaTaps() const { return mTaps; }
+
+    // GLSL ES 3.0 statements that end a cell program's main(). The luma output converts the
+    // composed premultiplied colour in "color" for the R8 view of plane 0. The chroma output
+    // filters "compose(offset)", the composed colour offset by that many target pixels, over the
+    // taps for the RG88 view of plane 1. bBlend gives the output for a pass blended over an earlier
+    // one: the offsets are scaled by the composed alpha, which is also written for the blend.
+    HWCString getLumaOutput( bool bBlend ) const;
+    HWCString getChromaOutput( bool bBlend ) const;
+
+    // Converts w x h RGBA8888 pixels into the two planes, doing the same arithmetic as the shaders.
+    void convert( const uint8_t* pRGBA, uint32_t stride, uint32_t w, uint32_t h,
+                  uint8_t* pY, uint32_t yStride, uint8_t* pUV, uint32_t uvStride ) const;
+
+    // Bytes written to the two planes for a w x h target. Nothing else is written: there is no
+    // intermediate copy of the frame.
+    static uint32_t getBytesWritten( uint32_t w, uint32_t h )
+    {
+        return w * h + 2 * ( ( w + 1 ) / 2 ) * ( ( h + 1 ) / 2 );
+    }
+
+    HWCString dump() const;
+
+private:
+    Params   mParams;
+    float    mMatrix[ 3 ][ 4 ];
+    Tap      mTaps[ cMaxTaps ];
+    uint32_t mNumTaps;
+};
+
+}; // namespace hwcomposer
+
+#endif // COMMON_HWC_NV12CONVERTER_H
@@ -17,16 +17,14 @@
 #include "hwcutils.h"
 #include "layer.h"
 #include "PartitionedComposer.h"
+#include "Nv12Converter.h"
 #include "log.h"
 #include "utils.h"
 
 #include <math.h>
+#include <algorithm>
 #include <vector>
 
-#ifdef uncomment
-#include <ui/Region.h>
-#include <utils/Vector.h>
-#endif
 
 //namespace intel {
 //namespace ufo {
@@ -60,6 +58,13 @@ float PartitionedComposer::onEvaluate(const Content::LayerStack& source, const L
         return Eval_Not_Supported;
     }
 
+    // The partitioner tracks layers in a 64 bit mask.
+    if (source.size() > Partitioner::cMaxLayers)
+    {
+        DTRACEIF(COMPOSITION_DEBUG, "PartitionedComposer: Too many layers: %u", source.size());
+        return Eval_Not_Supported;
+    }
+
     bool unsupportedInput = false;
     for (uint32_t ly = 0; ly < source.size(); ly++)
     {
@@ -92,111 +97,194 @@ float PartitionedComposer::onEvaluate(const Content::LayerStack& source, const L
         return Eval_Cost_Max;
     }
 
-    float cost = Eval_Not_Supported;
-    switch (type)
-    {
-        case Bandwidth:
-        case Power:         // TODO: Implement, for now, default to bandwidth
-        case Performance:   // TODO: Implement, for now, default to bandwidth
-        case Quality:       // TODO: Implement, for now, default to bandwidth
-        {
-            float bandwidth = calculateBandwidthInKilobytes(target.getDstWidth(), target.getDstHeight(), target.getBufferFormat());
-            for (uint32_t ly = 0; ly < source.size(); ly++)
-            {
-                const Layer& layer = source[ly];
-                // 1 read of source per layer
-                bandwidth += calculateBandwidthInKilobytes(layer.getSrcWidth(), layer.getSrcHeight(), layer.getBufferFormat());
-            }
-            cost = bandwidth * target.getFps(); // Times the frames per second
-        }
-        break;
-    case Memory:
-        // This costs us a preallocated double buffered render target buffer.
-        cost = target.getDstWidth() * target.getDstHeight() * 2;
-        break;
-    }
+    ComposerCostModel::Workload workload;
+    estimateWorkload(source, target, workload);
+    float cost = ComposerCostModel::getInstance().evaluate(getName(), workload, type);
 
-    // TODO: Very simple guestimate for now based on expected bandwidth usage
     DTRACEIF(COMPOSITION_DEBUG, "PartitionedComposer: Evaluation cost(%d) = %f", type, cost);
     return cost;
 }
 
-
-class Partition
+void PartitionedComposer::estimateWorkload(const Content::LayerStack& source, const Layer& target, ComposerCostModel::Workload& workload)
 {
-public:
-    Partition() {}
-#ifdef uncomment
-    Partition(const HwcRect<int> &rect) : mRegion(rect) {}
-#endif
-    HWCString dump(const char* pStr = "") const
+    const float targetPixels = float(target.getDstWidth()) * target.getDstHeight();
+    const float targetMBPerPixel = ComposerCostModel::megabytes(1, 1, target.getBufferFormat());
+
+    // One pass over the partitions. Each source is read once and each
+    // destination pixel is written once, sampling every layer that covers it.
+    workload.mCalls = 1;
+    workload.mLayers = source.size();
+    workload.mWriteMB = targetPixels * targetMBPerPixel;
+    workload.mMPixels = targetPixels / 1000000;
+    for (uint32_t ly = 0; ly < source.size(); ly++)
     {
-        HWCString output = HWCString::format("%s numLayers:%zd ", pStr, mLayers.size());
-        for(uint32_t i=0; i < mLayers.size(); i++)
-            output += HWCString::format("%d,", mLayers[i]);
-#ifdef uncomment
-        size_t size;
-        const HwcRect<int>* pRects = mRegion.getArray(&size);
-
-        output += HWCString::format(" numRects:%zd ", size);
-        for (uint32_t i = 0; i < size; i++)
-            output += HWCString::format("(%d, %d, %d, %d) ", pRects[i].left, pRects[i].top, pRects[i].right, pRects[i].bottom);
-#endif
-        return output;
+        const Layer& layer = source[ly];
+        const float pixels = float(layer.getDstWidth()) * layer.getDstHeight() / 1000000;
+        workload.mReadMB += ComposerCostModel::megabytes(layer.getSrcWidth(), layer.getSrcHeight(), layer.getBufferFormat());
+        workload.mMPixels += pixels;
+        if (isVideoFormat(layer.getBufferFormat()))
+            workload.mYuvMPixels += pixels;
+        if (layer.isScale())
+            workload.mScaledMPixels += pixels;
     }
-#ifdef uncomment
-    Region           mRegion;
-#endif
-    std::vector<uint32_t> mLayers;
-};
+    // This costs us a preallocated double buffered render target buffer.
+    workload.mMemoryBytes = targetPixels * 2;
+
+    // A YUV target is written a plane at a time: each cell is drawn again
+    // for the chroma plane, composing its layers at every chroma tap over a
+    // quarter of the pixels. The planes are written directly, so the write
+    // is the NV12 size computed above and nothing else is allocated.
+    if (isVideoFormat(target.getBufferFormat()))
+    {
+        const uint32_t taps = Nv12Converter(Nv12Converter::select(target, 0)).getNumChromaTaps();
+        workload.mCalls += 1;
+        workload.mMPixels += targetPixels * taps / 4 / 1000000;
+    }
+    workload.mFps = target.getFps();
+}
 
-// Intersect the current partition list with the layer specified in ly and any relevant lower layers
-static void intersect(const Content::LayerStack& source, int32_t ly, std::vector<Partition> &partitions, uint32_t pi)
+
+PartitionedComposer::Partitioner::Partitioner()
 {
-    // Terminate the recursion when the layer count goes negative
-    if (ly < 0)
-        return;
+}
 
-    const Layer& layer = source.getLayer(ly);
-    const HwcRect<int>& r = source.getLayer(ly).getDst();
-    HwcRect<int> rect(r.left, r.top, r.right, r.bottom);
-#ifdef uncomment
-    Region inside = partitions[pi].mRegion.intersect(rect);
+static bool isEmpty(const HwcRect<int>& r)
+{
+    return (r.right <= r.left) || (r.bottom <= r.top);
+}
 
-    // If there is no intersection, leave this entry entirely alone and go to next layer
-    if (inside.isEmpty())
+// Intersect the cell ci with the layer specified in ly and any relevant lower layers
+void PartitionedComposer::Partitioner::intersect(const Content::LayerStack& source, int32_t ly, uint32_t ci)
+{
+    // Terminate the recursion when the layer count goes negative
+    for (; ly >= 0; ly--)
     {
-        intersect(source, ly-1, partitions, pi);
-        return;
+        const Layer& layer = source.getLayer(ly);
+        const HwcRect<int>& r = layer.getDst();
+        const HwcRect<int> cell = mCells[ci].mRect;
+        const HwcRect<int> inside(max(cell.left, r.left), max(cell.top, r.top),
+                                  min(cell.right, r.right), min(cell.bottom, r.bottom));
+
+        // If there is no intersection, leave this entry entirely alone and go to next layer
+        if (isEmpty(inside))
+            continue;
+
+        // Whatever is left outside becomes up to four new cells (full width bands above and
+        // below, then the left and right of the intersection), each partitioned with the
+        // layers below this one.
+        const HwcRect<int> outside[4] =
+        {
+            HwcRect<int>(cell.left,    cell.top,      cell.right,   inside.top),
+            HwcRect<int>(cell.left,    inside.bottom, cell.right,   cell.bottom),
+            HwcRect<int>(cell.left,    inside.top,    inside.left,  inside.bottom),
+            HwcRect<int>(inside.right, inside.top,    cell.right,   inside.bottom),
+        };
+        for (const HwcRect<int>& o : outside)
+        {
+            if (isEmpty(o))
+                continue;
+            // Capacity was reserved for the worst case, so this never reallocates.
+            HWCASSERT(mCells.size() < mCells.capacity());
+            Cell c;
+            c.mRect = o;
+            c.mLayers = mCells[ci].mLayers;
+            mCells.push_back(c);
+            intersect(source, ly - 1, mCells.size() - 1);
+        }
+
+        mCells[ci].mRect = inside;
+        mCells[ci].mLayers.add(ly);
+
+        // terminate partitioning at the first opaque layer
+        if (layer.isOpaque())
+            break;
     }
+}
 
-    Region outside = partitions[pi].mRegion.subtract(rect);
+bool PartitionedComposer::Partitioner::partition(const Content::LayerStack& source, const HwcRect<int>& target)
+{
+    mCells.clear();
+    mRects.clear();
+    mSets.clear();
 
-    // If there is something left outside, create a new partition at the end of the list
-    // and partition it with the next layer
-    if (!outside.isEmpty())
+    const uint32_t numLayers = source.size();
+    if (numLayers > cMaxLayers)
     {
-        Partition p;
-        p.mRegion = outside;
-        p.mLayers = partitions[pi].mLayers;
-        partitions.push_back(p);
-
-        // Partition this new partition with whatever is left
-        intersect(source, ly-1, partitions, partitions.size()-1);
+        DTRACEIF(PARTITION_DEBUG, "Partitioner: %u layers is more than %u", numLayers, cMaxLayers);
+        return false;
+    }
+    const uint32_t maxCells = (2 * numLayers + 1) * (2 * numLayers + 1);
+    mCells.reserve(maxCells);
+    mRects.reserve(maxCells);
+    mSets.reserve(maxCells);
+
+    // Initialise partition list to the whole target and generate the partitions from frontmost
+    // to backmost
+    Cell c;
+    c.mRect = target;
+    mCells.push_back(c);
+    intersect(source, numLayers - 1, 0);
+
+    // Group the cells by layer set.
+    std::sort(mCells.begin(), mCells.end(),
+              [](const Cell& a, const Cell& b) { return a.mLayers < b.mLayers; });
+    for (const Cell& cell : mCells)
+    {
+        if (mSets.empty() || !(mSets.back().mLayers == cell.mLayers))
+        {
+            Set set;
+            set.mLayers = cell.mLayers;
+            set.mFirstRect = mRects.size();
+            set.mNumRects = 0;
+            mSets.push_back(set);
+        }
+        mRects.push_back(cell.mRect);
+        mSets.back().mNumRects++;
+    }
+    return true;
+}
 
-        // The inside region will only change if there was an outside to handle
-        partitions.editItemAt(pi).mRegion = inside;
+uint32_t PartitionedComposer::Partitioner::getLayers(uint32_t s, uint32_t* pIndices) const
+{
+    uint32_t count = 0;
+    uint64_t bits = mSets[s].mLayers.getBits();
+    while (bits)
+    {
+        pIndices[count++] = __builtin_ctzll(bits);
+        bits &= bits - 1;
     }
+    return count;
+}
 
-    partitions.editItemAt(pi).mLayers.push_front(ly);
+uint64_t PartitionedComposer::Partitioner::getLayerSamples() const
+{
+    uint64_t samples = 0;
+    for (const Cell& cell : mCells)
+    {
+        samples += uint64_t(cell.mRect.right - cell.mRect.left) * (cell.mRect.bottom - cell.mRect.top)
+                 * __builtin_popcountll(cell.mLayers.getBits());
+    }
+    return samples;
+}
 
-    // terminate partitioning at the first opaque layer
-    if (!layer.isOpaque())
+HWCString PartitionedComposer::Partitioner::dump() const
+{
+    HWCString output;
+    uint32_t indices[cMaxLayers];
+    for (uint32_t s = 0; s < mSets.size(); s++)
     {
-        intersect(source, ly-1, partitions, pi);
+        const uint32_t numIndices = getLayers(s, indices);
+        output += HWCString::format("numLayers:%u ", numIndices);
+        for (uint32_t i = 0; i < numIndices; i++)
+            output += HWCString::format("%u,", indices[i]);
+
+        const HwcRect<int>* pRects = getRects(s);
+        output += HWCString::format(" numRects:%u ", getNumRects(s));
+        for (uint32_t i = 0; i < getNumRects(s); i++)
+            output += HWCString::format("(%d, %d, %d, %d) ", pRects[i].left, pRects[i].top, pRects[i].right, pRects[i].bottom);
+        output += "\n";
     }
-#endif
-    return;
+    return output;
 }
 
 
@@ -222,27 +310,24 @@ void PartitionedComposer::onCompose(const Content::LayerStack& source, const Lay
         srcLayer.returnReleaseFence(-1);
     }
 
-    std::vector<Partition> partitions;
-
-    // Initialise partition list to top of stack
-    const HwcRect<int>& r = target.getDst();
-#ifdef uncomment
-    partitions.push_back(Partition(HwcRect<int>(r.left, r.top, r.right, r.bottom)));
-
     // Generate the partitions from frontmost to backmost
-    intersect(source, source.size()-1, partitions, 0);
+    const HwcRect<int>& r = target.getDst();
+    if (!mPartitioner.partition(source, HwcRect<int>(r.left, r.top, r.right, r.bottom)))
+    {
+        ETRACE("PartitionedComposer: Failed to partition %u layers", source.size());
+        return;
+    }
+    DTRACEIF(PARTITION_DEBUG, "%s", mPartitioner.dump().string());
 
     // Start the frame
     mpRenderer->beginFrame(source, target);
 
-    for (uint32_t pi = 0; pi < partitions.size(); pi++)
+    uint32_t indices[Partitioner::cMaxLayers];
+    for (uint32_t s = 0; s < mPartitioner.getNumSets(); s++)
     {
-        const Partition& p = partitions[pi];
-
-        DTRACEIF(PARTITION_DEBUG, "%s", p.dump().string());
-        mpRenderer->drawLayerSet(p.mLayers.size(), p.mLayers.array(), p.mRegion);
+        const uint32_t numIndices = mPartitioner.getLayers(s, indices);
+        mpRenderer->drawLayerSet(numIndices, indices, mPartitioner.getNumRects(s), mPartitioner.getRects(s));
     }
-#endif
     mpRenderer->endFrame();
 }
 
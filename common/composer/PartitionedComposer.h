@@ -19,12 +19,12 @@
 
 #include "base.h"
 #include "AbstractComposer.h"
+#include "ComposerCostModel.h"
+#include "disjoint_layers.h"
 #include "option.h"
-#ifdef uncomment
-#include <ui/Region.h>
-#endif
 
 #include <memory>
+#include <vector>
 
 class HwcContext;
 
@@ -43,9 +43,9 @@ public:
         virtual ~CellComposer() {}
 
         virtual bool beginFrame(const Content::LayerStack& source, const Layer& target) = 0;
-#ifdef uncomment
-        virtual bool drawLayerSet(uint32_t numIndices, const uint32_t* pIndices, const Region& region) = 0;
-#endif
+        // Draw the layers in pIndices (back to front) over each of the rects. The rects are
+        // disjoint and every layer covers all of them.
+        virtual bool drawLayerSet(uint32_t numIndices, const uint32_t* pIndices, uint32_t numRects, const HwcRect<int>* pRects) = 0;
         virtual bool endFrame() = 0;
 
         virtual bool isLayerSupportedAsInput(const Layer& layer) = 0;
@@ -54,6 +54,54 @@ public:
         virtual bool canBlankUnsupportedInputLayers() = 0;
     };
 
+    // Splits the target into disjoint cells, each covered by the same set of layers. Cells are
+    // found by recursively intersecting the stack from the front, stopping at the first opaque
+    // layer, and are then grouped into one set per distinct layer list.
+    // Every cell edge is a layer or target edge and cells don't overlap, so n layers give at most
+    // (2n+1)^2 cells. Storage is reserved for that up front and reused between frames.
+    class Partitioner
+    {
+    public:
+        static const uint32_t cMaxLayers = RectIDs::max_elements;
+
+        Partitioner();
+
+        // Partition target for source. Returns false if source has more than cMaxLayers layers.
+        bool partition(const Content::LayerStack& source, const HwcRect<int>& target);
+
+        uint32_t getNumSets() const                     { return mSets.size(); }
+        uint32_t getNumCells() const                    { return mCells.size(); }
+        // Write the layer indices of set s, back to front, to pIndices (which must hold
+        // cMaxLayers entries) and return how many there are.
+        uint32_t getLayers(uint32_t s, uint32_t* pIndices) const;
+        uint32_t getNumRects(uint32_t s) const          { return mSets[s].mNumRects; }
+        const HwcRect<int>* getRects(uint32_t s) const  { return &mRects[mSets[s].mFirstRect]; }
+
+        // Layer samples the cells take to shade (each pixel samples every layer of its cell).
+        uint64_t getLayerSamples() const;
+
+        HWCString dump() const;
+
+    private:
+        struct Cell
+        {
+            HwcRect<int> mRect;
+            RectIDs      mLayers;
+        };
+        struct Set
+        {
+            RectIDs      mLayers;
+            uint32_t     mFirstRect;
+            uint32_t     mNumRects;
+        };
+
+        void intersect(const Content::LayerStack& source, int32_t ly, uint32_t ci);
+
+        std::vector<Cell>           mCells;
+        std::vector<HwcRect<int>>   mRects;
+        std::vector<Set>            mSets;
+    };
+
     PartitionedComposer(std::shared_ptr<CellComposer> renderer);
     virtual ~PartitionedComposer();
 
@@ -62,9 +110,13 @@ public:
     virtual void onCompose(const Content::LayerStack& source, const Layer& target, AbstractComposer::CompositionState* pState);
     virtual ResourceHandle onAcquire(const Content::LayerStack& source, const Layer& target);
     virtual void onRelease(ResourceHandle hResource);
+
+    // Describe the work composing source to target takes for the cost model.
+    static void estimateWorkload(const Content::LayerStack& source, const Layer& target, ComposerCostModel::Workload& workload);
 private:
     std::shared_ptr<CellComposer> mpRenderer;
     Option mOptionPartitionVideo; // Allow video to video compositions.
+    Partitioner mPartitioner;
 };
 
 };
@@ -351,36 +351,45 @@ float SurfaceFlingerComposer::onEvaluate(const Content::LayerStack& source, cons
     }
 
     // We finally matched. Calculate cost
-    int cost = Eval_Not_Supported;
-    switch (type)
-    {
-        case Bandwidth:
-        case Power:         // TODO: Implement, for now, default to bandwidth
-        case Performance:   // TODO: Implement, for now, default to bandwidth
-        case Quality:       // TODO: Implement, for now, default to bandwidth
-        {
-            int dstBandwidth = calculateBandwidthInKilobytes(target.getDstWidth(), target.getDstHeight(), target.getBufferFormat());
-            int bandwidth = dstBandwidth; // For the glClear
-            for (uint32_t ly = 0; ly < source.size(); ly++)
-            {
-                const Layer& layer = source[ly];
-                // 1 read of source, 1 read and 1 write of destination per layer
-                bandwidth += calculateBandwidthInKilobytes(layer.getSrcWidth(), layer.getSrcHeight(), layer.getBufferFormat());
-                bandwidth += 2 * dstBandwidth;
-            }
-            cost = bandwidth * target.getFps();                                         // Times the frames per second
-        }
-        break;
-    case Memory:
-        // No additional memory needs to be allocated at this time, it makes use of memory already committed by SF
-        cost = Eval_Cost_Min;
-        break;
-    }
+    ComposerCostModel::Workload workload;
+    estimateWorkload(source, target, workload);
+    float cost = ComposerCostModel::getInstance().evaluate(getName(), workload, type);
 
-    DTRACEIF(COMPOSITION_DEBUG, "SurfaceFlingerComposer: Evaluation cost(%d) = %d", type, cost);
+    DTRACEIF(COMPOSITION_DEBUG, "SurfaceFlingerComposer: Evaluation cost(%d) = %f", type, cost);
     return cost;
 }
 
+void SurfaceFlingerComposer::estimateWorkload(const Content::LayerStack& source, const Layer& target, ComposerCostModel::Workload& workload)
+{
+    const float targetPixels = float(target.getDstWidth()) * target.getDstHeight();
+    const float targetMBPerPixel = ComposerCostModel::megabytes(1, 1, target.getBufferFormat());
+
+    // A glClear of the target, then one draw per layer. Blended layers also
+    // read back the destination they cover.
+    workload.mCalls = 1 + source.size();
+    workload.mLayers = source.size();
+    workload.mWriteMB = targetPixels * targetMBPerPixel;
+    workload.mMPixels = targetPixels / 1000000;
+    for (uint32_t ly = 0; ly < source.size(); ly++)
+    {
+        const Layer& layer = source[ly];
+        const float dstPixels = float(layer.getDstWidth()) * layer.getDstHeight();
+        const float dstMB = dstPixels * targetMBPerPixel;
+        workload.mReadMB += ComposerCostModel::megabytes(layer.getSrcWidth(), layer.getSrcHeight(), layer.getBufferFormat());
+        if (layer.isBlend())
+            workload.mReadMB += dstMB;
+        workload.mWriteMB += dstMB;
+        workload.mMPixels += dstPixels / 1000000;
+        if (isVideoFormat(layer.getBufferFormat()))
+            workload.mYuvMPixels += dstPixels / 1000000;
+        if (layer.isScale())
+            workload.mScaledMPixels += dstPixels / 1000000;
+    }
+    // No additional memory needs to be allocated at this time, it makes use of memory already committed by SF
+    workload.mMemoryBytes = Eval_Cost_Min;
+    workload.mFps = target.getFps();
+}
+
 void SurfaceFlingerComposer::onCompose(const Content::LayerStack& source, const Layer&, AbstractComposer::CompositionState* pState)
 {
     ATRACE_NAME_IF(RENDER_TRACE, "SurfaceFlingerComposer");
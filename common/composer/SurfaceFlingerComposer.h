@@ -19,6 +19,7 @@
 
 #include "layer.h"
 #include "AbstractComposer.h"
+#include "ComposerCostModel.h"
 #include "abstractfilter.h"
 
 //namespace intel {
@@ -45,6 +46,9 @@ public:
     virtual void onCompose(const Content::LayerStack& source, const Layer& target, AbstractComposer::CompositionState* pState);
     virtual ResourceHandle onAcquire(const Content::LayerStack& source, const Layer& target);
     virtual void onRelease(ResourceHandle hResource);
+
+    // Describe the work composing source to target takes for the cost model.
+    static void estimateWorkload(const Content::LayerStack& source, const Layer& target, ComposerCostModel::Workload& workload);
 #ifdef uncomment_hwc1
     // Entrypoints to this composer to inform it of the layer lists
     void onPrepareBegin(size_t numDisplays, hwc_display_contents_1_t** ppDisplayContents, nsecs_t now);
@@ -22,6 +22,7 @@
 
 #include "disjoint_layers.h"
 #include "displayplanestate.h"
+#include "frametrace.h"
 #include "hwctrace.h"
 #include "nativegpuresource.h"
 #include "nativesurface.h"
@@ -66,6 +67,7 @@ bool Compositor::Draw(DisplayPlaneStateList &comp_planes,
                       std::vector<OverlayLayer> &layers,
                       const std::vector<HwcRect<int>> &display_frame) {
   CTRACE();
+  FRAME_TRACE_SCOPE(kDraw);
   const DisplayPlaneState *comp = NULL;
   std::vector<size_t> dedicated_layers;
   ScopedRendererState state(renderer_.get());
@@ -40,8 +40,11 @@
 #include "display.h"
 #include "displayplanemanager.h"
 #include "drmscopedtypes.h"
+#include "frametrace.h"
 #include "headless.h"
+#include "hwcloglevel.h"
 #include "hwcthread.h"
+#include "layercapture.h"
 #include "overlaybuffermanager.h"
 #include "spinlock.h"
 #include "vblankeventhandler.h"
@@ -72,6 +75,7 @@ class GpuDevice::DisplayManager : public HWCThread {
   void HandleRoutine() override;
 
  private:
+  bool OpenHotplugSocket();
   void HotPlugEventHandler();
   std::unique_ptr<NativeDisplay> headless_;
   std::unique_ptr<NativeDisplay> virtual_display_;
@@ -131,10 +135,36 @@ bool GpuDevice::DisplayManager::Init(uint32_t fd) {
     ETRACE("Failed to connect display.");
     return false;
   }
+#ifdef USE_FAKE_KMS
+  // A fake device sends its uevents itself.
+  std::shared_ptr<FakeKms> fake_kms = FakeKms::Get(fd_);
+  if (fake_kms) {
+    hotplug_fd_.Reset(dup(fake_kms->GetHotplugFd()));
+  } else if (!OpenHotplugSocket()) {
+    return true;
+  }
+#else
+  if (!OpenHotplugSocket())
+    return true;
+#endif
+
+  fd_handler_.AddFd(hotplug_fd_.get());
+
+  if (!InitWorker()) {
+    ETRACE("Failed to initalizer thread to monitor Hot Plug events. %s",
+           PRINTERROR());
+  }
+
+  IHOTPLUGEVENTTRACE("DisplayManager Initialization succeeded.");
+
+  return true;
+}
+
+bool GpuDevice::DisplayManager::OpenHotplugSocket() {
   hotplug_fd_.Reset(socket(PF_NETLINK, SOCK_DGRAM, NETLINK_KOBJECT_UEVENT));
   if (hotplug_fd_.get() < 0) {
     ETRACE("Failed to create socket for hot plug monitor. %s", PRINTERROR());
-    return true;
+    return false;
   }
 
   struct sockaddr_nl addr;
@@ -143,22 +173,13 @@ bool GpuDevice::DisplayManager::Init(uint32_t fd) {
   addr.nl_pid = getpid();
   addr.nl_groups = -1;
 
-  ret = bind(hotplug_fd_.get(), (struct sockaddr *)&addr, sizeof(addr));
+  int ret = bind(hotplug_fd_.get(), (struct sockaddr *)&addr, sizeof(addr));
   if (ret) {
     ETRACE("Failed to bind sockaddr_nl and hot plug monitor fd. %s",
            PRINTERROR());
-    return true;
-  }
-
-  fd_handler_.AddFd(hotplug_fd_.get());
-
-  if (!InitWorker()) {
-    ETRACE("Failed to initalizer thread to monitor Hot Plug events. %s",
-           PRINTERROR());
+    return false;
   }
 
-  IHOTPLUGEVENTTRACE("DisplayManager Initialization succeeded.");
-
   return true;
 }
 
@@ -354,12 +375,32 @@ void GpuDevice::DisplayManager::RegisterHotPlugEventCallback(
 GpuDevice::GpuDevice()
     : initialized_(false),
       mOptionVppComposer("vppcomposer", 1),
-      mOptionPartGlComp("partglcomp", 1) {
+      mOptionPartGlComp("partglcomp", 1),
+      mOptionFrameTrace("frametrace", 0, false),
+      mOptionFrameTraceFile("frametracefile", HWC_FRAME_TRACE_FILE, false),
+      mOptionLayerCapture("layercapture", 0, false),
+      mOptionLayerCaptureFile("layercapturefile", HWC_LAYER_CAPTURE_FILE,
+                              false),
+      mOptionLogLevel("loglevel", HWC_LOG_LEVEL_DEFAULT, false) {
   CTRACE();
 }
 
 GpuDevice::~GpuDevice() {
   CTRACE();
+  SaveFrameTrace();
+  SaveLayerCapture();
+}
+
+bool GpuDevice::SaveFrameTrace() {
+  if (!FrameTrace::IsEnabled())
+    return false;
+  return FrameTrace::Save(mOptionFrameTraceFile.getString());
+}
+
+bool GpuDevice::SaveLayerCapture() {
+  if (!LayerCapture::IsEnabled())
+    return false;
+  return LayerCapture::Save(mOptionLayerCaptureFile.getString());
 }
 
 bool GpuDevice::Initialize() {
@@ -367,6 +408,17 @@ bool GpuDevice::Initialize() {
   if (initialized_)
     return true;
 
+  // Can not go above the level compiled in.
+  SetLogLevel(mOptionLogLevel);
+
+  // Ring size in K events.
+  if (mOptionFrameTrace > 0)
+    FrameTrace::Enable(mOptionFrameTrace * 1024);
+
+  // Ring size in frames.
+  if (mOptionLayerCapture > 0)
+    LayerCapture::Enable(mOptionLayerCapture);
+
   fd_.Reset(drmOpen("i915", NULL));
   if (fd_.get() < 0) {
     ETRACE("Failed to open dri %s", PRINTERROR());
@@ -15,6 +15,8 @@
 */
 
 #include <inttypes.h>
+#include <math.h>
+#include <string.h>
 
 #include "AbstractBufferManager.h"
 #include "layer.h"
@@ -464,6 +466,82 @@ bool Layer::matches( const Layer& other, bool* pbMatchesHandle ) const
     return true;
 }
 
+bool Layer::matchesScaled( const Layer& other, float scaleX, float scaleY, bool* pbMatchesHandle ) const
+{
+    const HwcRect<int>& d = getDst();
+    const HwcRect<int>& o = other.getDst();
+    if ( fabsf( d.left   * scaleX - o.left   ) > 1.0f ||
+         fabsf( d.top    * scaleY - o.top    ) > 1.0f ||
+         fabsf( d.right  * scaleX - o.right  ) > 1.0f ||
+         fabsf( d.bottom * scaleY - o.bottom ) > 1.0f )
+    {
+        DTRACEIF( CONTENT_DEBUG, "Mismatched Dst(%d,%d,%d,%d) scaled %1.3fx%1.3f=(%d,%d,%d,%d)",
+            d.left, d.top, d.right, d.bottom, scaleX, scaleY, o.left, o.top, o.right, o.bottom );
+        return false;
+    }
+
+    // The rest of the rendering state must match exactly.
+    if ( getTransform()         != other.getTransform()   ||
+         getBlending()          != other.getBlending()    ||
+         getPlaneAlpha()        != other.getPlaneAlpha()  ||
+         isEncrypted()          != other.isEncrypted()    ||
+         getSrc()               != other.getSrc()         ||
+         getBufferCompression() != other.getBufferCompression() )
+    {
+        DTRACEIF( CONTENT_DEBUG, "Mismatched scaled layer state" );
+        return false;
+    }
+    if ( pbMatchesHandle )
+    {
+        *pbMatchesHandle = hasSameContent( other );
+    }
+    return true;
+}
+
+bool Layer::hasSameContent( const Layer& other ) const
+{
+    // Compare what is shown rather than getHandle(), which follows a composition to its current
+    // target and is NULL for both layers whenever neither has one yet.
+    if ( isComposition() || other.isComposition() )
+    {
+        return getComposition() == other.getComposition();
+    }
+    return ( mHandle != 0 ) && ( mHandle == other.mHandle );
+}
+
+// Bit pattern of a float for hashing. +0.0 and -0.0 compare equal so must hash the same.
+static uint64_t floatBits( float value )
+{
+    if ( value == 0.0f )
+        return 0;
+    uint32_t bits;
+    memcpy( &bits, &value, sizeof( bits ) );
+    return bits;
+}
+
+uint64_t Layer::getMatchSignature() const
+{
+    uint64_t signature = hashCombine( 0, uint64_t( getTransform() ) );
+    signature = hashCombine( signature, uint64_t( getBlending() ) );
+    signature = hashCombine( signature, floatBits( getPlaneAlpha() ) );
+    signature = hashCombine( signature, isEncrypted() );
+    signature = hashCombine( signature, floatBits( getSrc().left ) );
+    signature = hashCombine( signature, floatBits( getSrc().top ) );
+    signature = hashCombine( signature, floatBits( getSrc().right ) );
+    signature = hashCombine( signature, floatBits( getSrc().bottom ) );
+    signature = hashCombine( signature, uint32_t( getDst().left ) );
+    signature = hashCombine( signature, uint32_t( getDst().top ) );
+    signature = hashCombine( signature, uint32_t( getDst().right ) );
+    signature = hashCombine( signature, uint32_t( getDst().bottom ) );
+    // A composition's buffer details are those of its render target, which can change
+    // without this layer being updated, so leave the compression check to matches().
+    if ( !isComposition() )
+    {
+        signature = hashCombine( signature, uint64_t( getBufferCompression() ) );
+    }
+    return signature;
+}
+
 void Layer::snapshotOf( const Layer& other )
 {
     // Copy all state.
@@ -239,6 +239,13 @@ public:
     void setBufferCompression(ECompressionType compression) { mBufferDetails.setCompression( compression );   }
     void setBufferTilingFormat(ETilingFormat tileFormat)    { if ( formatToTiling( getBufferFormat() ) == TILE_UNKNOWN )
                                                                 mBufferDetails.setTilingFormat( tileFormat ); }
+    // Buffer holding w x h at the top left of an allocation of allocW x allocH with the given row pitch.
+    void setBufferSubRect(uint32_t w, uint32_t h,
+                          uint32_t allocW, uint32_t allocH, uint32_t pitch) { mBufferDetails.setWidth( w );
+                                                              mBufferDetails.setHeight( h );
+                                                              mBufferDetails.setAllocWidth( allocW );
+                                                              mBufferDetails.setAllocHeight( allocH );
+                                                              mBufferDetails.setPitch( pitch );        }
     void setHints(uint32_t hints)                           { mHints = hints;                           }
     void setFlags(uint32_t flags)                           { mFlags = flags;                           }
     void setHandle(HWCNativeHandle handle)                  { mHandle = handle;                         }
@@ -316,6 +323,19 @@ public:
     // If pbMatchesHandle is provided, then on return it will be set true iff handles also match.
     bool matches( const Layer& other, bool* pbMatchesHandle = NULL ) const;
 
+    // As matches(), except other's destination is this layer's scaled by (scaleX, scaleY), give or take
+    // a pixel of rounding on each edge. This finds the same stack shown on a display of another size.
+    // pbMatchesHandle is only set true if both layers show the same content (see hasSameContent()).
+    bool matchesScaled( const Layer& other, float scaleX, float scaleY, bool* pbMatchesHandle = NULL ) const;
+
+    // Do this layer and other show the same content: the same composition, or the same buffer.
+    // Layers without a buffer or composition never show the same content.
+    bool hasSameContent( const Layer& other ) const;
+
+    // Hash of the state compared by matches() (the handle is not included).
+    // Layers that match always have the same signature.
+    uint64_t getMatchSignature() const;
+
     // Copy a "snapshot" of another layer.
     // This will copy the layer while also removing any indirection (e.g. to composition targets).
     // This must be used when taking a copy of a layer that will persist beyond the current frame.
@@ -32,8 +32,10 @@ class NativeSync {
 
   int CreateNextTimelineFence();
 
- private:
+  // Signals every fence created up to point.
   int IncreaseTimelineToPoint(int point);
+
+ private:
 #ifndef USE_ANDROID_SYNC
   int sw_sync_fence_create(int fd, const char *name, unsigned value);
   int sw_sync_timeline_inc(int fd, unsigned count);
@@ -62,6 +62,10 @@ class OverlayBuffer {
     return fb_id_;
   }
 
+  uint32_t GetGemHandle() const {
+    return gem_handles_[0];
+  }
+
   GpuImage ImportImage(GpuDisplay egl_display);
 
   bool CreateFrameBuffer(uint32_t gpu_fd);
@@ -39,6 +39,11 @@ bool OverlayBufferManager::Initialize(uint32_t gpu_fd) {
   return true;
 }
 
+bool OverlayBufferManager::Initialize(NativeBufferHandler* buffer_handler) {
+  buffer_handler_.reset(buffer_handler);
+  return buffer_handler_ != nullptr;
+}
+
 ImportedBuffer* OverlayBufferManager::CreateBuffer(const HwcBuffer& bo) {
   buffers_.emplace_back();
   Buffer& buffer = buffers_.back();
@@ -63,6 +63,11 @@ class OverlayBufferManager {
 
   bool Initialize(uint32_t gpu_fd);
 
+  // Use buffer_handler, which the manager takes ownership of, instead of the
+  // native handler of a device; e.g. to import buffers that only exist for a
+  // fake KMS device.
+  bool Initialize(NativeBufferHandler* buffer_handler);
+
   // Creates new ImportedBuffer for bo. Also, creates
   // a sync fence object associated for this buffer.
   // Sync fence is automatically signalled when buffer
@@ -19,11 +19,14 @@
 
 #include <string.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 
 #include <platformdefines.h>
 
+#include "fencewaiter.h"
+
 static const int MaxFenceNameLength = 32;
 
 namespace hwcomposer {
@@ -217,88 +220,65 @@ bool Timeline::mergeFence( NativeFence* pFence, NativeFence* pOtherFence )
         return true;
     }
 
-    char fenceName[ MaxFenceNameLength + 32 ];
-
-    if (SYNC_FENCE_DEBUG)
+    // Both fences are valid. Check them with a single poll and close one that
+    // has already signalled rather than creating a new sync_file for it.
+    // If the poll fails then nothing is skipped and the fences are merged.
+    struct pollfd fds[ 2 ];
+    fds[ 0 ].fd = *pFence;
+    fds[ 1 ].fd = *pOtherFence;
+    fds[ 0 ].events = fds[ 1 ].events = POLLIN;
+    fds[ 0 ].revents = fds[ 1 ].revents = 0;
+    if ( poll( fds, 2, 0 ) > 0 )
     {
-        // Create a syncpoint that merges the Fences.
-	// FIXME:
-	struct sync_fence_info_data* pInfo1 = NULL;//sync_fence_info( *pFence );
-	struct sync_fence_info_data* pInfo2 = NULL;//sync_fence_info( *pOtherFence );
-
-        if ( pInfo1 )
+        if ( fds[ 1 ].revents & POLLIN )
         {
-	    DTRACEIF( SYNC_FENCE_DEBUG && pInfo1, "NativeFence Info1: %s status %d", pInfo1->name, pInfo1->status );
-            struct sync_pt_info* pSyncPointInfo = NULL;
-	    // FIXME:
-	   /* while ( ( pSyncPointInfo = sync_pt_info( pInfo1, pSyncPointInfo ) ) != NULL )
+            if ( Log::wantLog( SYNC_FENCE_DEBUG ) )
             {
-		DTRACEIF( SYNC_FENCE_DEBUG, "  SyncPoint Driver %s Status %d Timestamp %.03f",
-                    pSyncPointInfo->driver_name,
-                    pSyncPointInfo->status,
-                    (float)pSyncPointInfo->timestamp_ns * (1/1000000000.0f) );
-	    }*/
+                Log::alogd( SYNC_FENCE_DEBUG, "NativeFence: merge skip signalled %s", dumpFence(pOtherFence).string() );
+            }
+            closeFence( pOtherFence );
+            return true;
         }
-        if ( pInfo2 )
+        if ( fds[ 0 ].revents & POLLIN )
         {
-	    DTRACEIF( SYNC_FENCE_DEBUG && pInfo2, "NativeFence Info2: %s status %d", pInfo2->name, pInfo2->status );
-            struct sync_pt_info* pSyncPointInfo = NULL;
-	    // FIXME:
-	   /* while ( ( pSyncPointInfo = sync_pt_info( pInfo2, pSyncPointInfo ) ) != NULL )
+            if ( Log::wantLog( SYNC_FENCE_DEBUG ) )
             {
-		DTRACEIF( SYNC_FENCE_DEBUG, "  SyncPoint Driver %s Status %d Timestamp %.03f",
-                    pSyncPointInfo->driver_name,
-                    pSyncPointInfo->status,
-                    (float)pSyncPointInfo->timestamp_ns * (1/1000000000.0f) );
-	    } */
-        }
-	// FIXME:
-	/*
-        if ( pInfo1 && pInfo2 )
-        {
-            // Create a combined NativeFence name from info names.
-	    snprintf( fenceName, sizeof( fenceName ), "[%s && %s]", pInfo1->name, pInfo2->name );
-        }
-        else
-        {
-            // Create a combined NativeFence name from handles.
-	    snprintf( fenceName, sizeof( fenceName ), "[F%d && F%d]", *pFence, *pOtherFence );
+                Log::alogd( SYNC_FENCE_DEBUG, "NativeFence: merge skip signalled %s", dumpFence(pFence).string() );
+            }
+            closeFence( pFence );
+            *pFence = *pOtherFence;
+            *pOtherFence = NullNativeFence;
+            return true;
         }
-        if ( pInfo1 )
-            sync_fence_info_free( pInfo1 );
-        if ( pInfo2 )
-            sync_fence_info_free( pInfo2 );
-	    */
-    }
-    else
-    {
-        // Create a combined NativeFence name from handles.
-        snprintf( fenceName, sizeof( fenceName ), "[F%d && F%d]", *pFence, *pOtherFence );
     }
 
-    // Merge the two component fences.
+    char fenceName[ MaxFenceNameLength + 32 ];
+    snprintf( fenceName, sizeof( fenceName ), "[F%d && F%d]", *pFence, *pOtherFence );
     NativeFence mergedFence = sync_merge( fenceName, *pFence, *pOtherFence );
     if ( mergedFence < 0 )
     {
         Log::aloge( true, "NativeFence: merge %s + %s !ERROR!", dumpFence(pFence).string(), dumpFence(pOtherFence).string() );
         return false;
     }
-    else
+    if ( Log::wantLog( SYNC_FENCE_DEBUG ) )
     {
-        if ( Log::wantLog( SYNC_FENCE_DEBUG ) )
-        {
-            Log::alogd( SYNC_FENCE_DEBUG, "NativeFence: merge %s + %s -> %s",
-                dumpFence(pFence).string(), dumpFence(pOtherFence).string(),
-                dumpFence(&mergedFence).string() );
-        }
-        // Close the two component fences for the merge.
-	DTRACEIF( SYNC_FENCE_DEBUG, "Timeline : Merged fence %d(%s)", mergedFence, fenceName );
-        close( *pFence );
-        close( *pOtherFence );
-        *pFence = mergedFence;
-        *pOtherFence = NullNativeFence;
-        return true;
+        Log::alogd( SYNC_FENCE_DEBUG, "NativeFence: merge %s + %s -> %s",
+            dumpFence(pFence).string(), dumpFence(pOtherFence).string(),
+            dumpFence(&mergedFence).string() );
     }
+    // Close the two component fences for the merge.
+    close( *pFence );
+    close( *pOtherFence );
+    *pFence = mergedFence;
+    *pOtherFence = NullNativeFence;
+    return true;
+}
+
+int32_t Timeline::waitAny( const NativeFence* paFences, uint32_t count, uint32_t timeoutMs )
+{
+    HWCASSERT( paFences || !count );
+    DTRACEIF( SYNC_FENCE_DEBUG, "Timeline:waitAny x%u %ums", count, timeoutMs );
+    return FenceWaiter::WaitAny( paFences, count, (int)timeoutMs );
 }
 
 Timeline::NativeFence Timeline::dupFence( const NativeFence* pOtherFence )
@@ -62,13 +62,13 @@ public:
         Fence( ) : mFence( NullNativeFence ), mBoundFences( 0 ), mbSignalled( false ) { };
 
         // Returns true if the fence is currently null.
-        bool isNull( void )
+        bool isNull( void ) const
         {
             return Timeline::isNull( mFence );
         }
 
         // Returns true if the fence is a valid fence.
-        bool isValid( void )
+        bool isValid( void ) const
         {
             return Timeline::isValid( mFence );
         }
@@ -590,10 +590,18 @@ public:
     NativeFence repeatFence( uint32_t* pTimelineIndex );
 
     // Combines another fence into this existing fence, returning a fence that represents completion of both.
+    // Both fences are checked with a single poll first; if either has already signalled it is
+    // closed and no merge is issued.
     // Returns true if succesful - in which case pFence will be updated and pOtherFence will be closed and reset to NullNativeFence.
     // The returned fence must be released using close( ).
     static bool mergeFence( NativeFence* pFence, NativeFence* pOtherFence );
 
+    // Wait for the first of an array of fences to signal.
+    // This will wait up to timeoutMs milliseconds (0 just checks the fences).
+    // Invalid fences in paFences are skipped. No fences are closed.
+    // Returns the index of a signalled fence or -1 if none signalled before the timeout.
+    static int32_t waitAny( const NativeFence* paFences, uint32_t count, uint32_t timeoutMs );
+
     // Duplicate an existing fence.
     // Returns the duplicated fence if successful.
     // Returns NullNativeFence if not successful.
@@ -16,6 +16,7 @@
 
 #include "DisplayQueue.h"
 #include "timeline.h"
+#include "fencewaiter.h"
 
 namespace hwcomposer {
 
@@ -372,9 +373,27 @@ const DisplayQueue::FrameId& DisplayQueue::Frame::getFrameId( void ) const
 
 void DisplayQueue::Frame::waitRendering( void ) const
 {
+    // Wait on all the acquire fences together so a layer that completes early
+    // is released straight away and the whole frame shares one timeout.
+    if ( mLayerCount == 0 )
+    {
+        return;
+    }
+    maWaitFences.resize( mLayerCount );
+    for ( uint32_t ly = 0; ly < mLayerCount; ly++ )
+    {
+        maWaitFences[ ly ] = maLayers[ ly ].isDisabled( ) ? -1 : maLayers[ ly ].getAcquireFence( );
+    }
+    FenceWaiter::WaitAll( maWaitFences.data( ), mLayerCount, mTimeoutWaitRenderingMsec,
+                          [this]( size_t ly ) { maLayers[ ly ].closeAcquireFence( ); } );
+
+    // Layers without a fence fall back to waiting on the buffer.
     for ( uint32_t ly = 0; ly < mLayerCount; ly++ )
     {
-        maLayers[ ly ].waitRendering( );
+        if ( maWaitFences[ ly ] < 0 )
+        {
+            maLayers[ ly ].waitRendering( );
+        }
     }
 }
 
@@ -410,6 +429,8 @@ DisplayQueue::DisplayQueue( uint32_t behaviourFlags ) :
     mBehaviourFlags( behaviourFlags ),
     mpWorkQueue( NULL ),
     mQueuedWork( 0 ),
+    mAvailableWork( 0 ),
+    mbWorkerStarted( false ),
     mQueuedFrames( 0 ),
     mFramesLockedForDisplay( 0 ),
     mFramePoolUsed( 0 ),
@@ -427,6 +448,7 @@ DisplayQueue::DisplayQueue( uint32_t behaviourFlags ) :
 DisplayQueue::~DisplayQueue( )
 {
     std::lock_guard<std::mutex> _l( mLockQueue );
+    HWCASSERT( mIncoming.Empty( ) );
     HWCASSERT( !mQueuedFrames );
     HWCASSERT( !mQueuedWork );
     HWCASSERT( !mFramesLockedForDisplay );
@@ -451,8 +473,27 @@ int DisplayQueue::queueEvent( Event* pEvent )
     HWCASSERT( pEvent );
     HWCASSERT( pEvent->getWorkItemType( ) == WorkItem::WORK_ITEM_EVENT );
 
+    // Once the worker is running, hand the event over without taking the queue lock.
+    // The effective frame is resolved when the event is linked (see doDrainIncoming).
+    // Count the work before publishing it so the consumer never sees a negative count.
+    if ( mbWorkerStarted.load( std::memory_order_acquire ) )
+    {
+        ++mAvailableWork;
+        if ( mIncoming.Push( pEvent ) )
+        {
+            Log::alogd( DISPLAY_QUEUE_DEBUG, "Queue: %s Queue event %p (lock-free)", mName.string(), pEvent );
+            mpWorker->signalWork( );
+            return OK;
+        }
+        --mAvailableWork;
+    }
+
+    // Start of day or incoming queue full.
     std::lock_guard<std::mutex> _l( mLockQueue );
 
+    // Preserve ordering with respect to events already in the incoming queue.
+    doDrainIncoming( );
+
     // The effective frame for an event is just a repeat of the last queued frame.
     pEvent->setEffectiveFrame( mLastQueuedFrame );
 
@@ -469,14 +510,18 @@ int DisplayQueue::queueFrame( const Content::LayerStack& stack, uint32_t zorder,
 
     std::lock_guard<std::mutex> _l( mLockQueue );
 
+    // Any events queued ahead of this frame must be linked ahead of it.
+    doDrainIncoming( );
+
     // Queued frame sequence can not go backwards.
     mLastQueuedFrame.validateFutureFrame( id );
 
     uint32_t delta = (uint32_t)int32_t( id.getHwcIndex() - mLastIssuedFrame.getHwcIndex() );
     const uint32_t errorThreshold = 16;
     ETRACEIF( (mConsumedFramesSinceInit > 0) && mFramesLockedForDisplay && ( delta > errorThreshold),
-        "%s display worker tid:%u - display last displayed frame %s [new frame %s]",
-        mName.string(), getWorkerTid(), mLastIssuedFrame.dump().string(), id.dump().string() );
+        "%s display worker tid:%zx - display last displayed frame %s [new frame %s]",
+        mName.string(), std::hash<std::thread::id>()( getWorkerTid() ),
+        mLastIssuedFrame.dump().string(), id.dump().string() );
 
     limitUsedFrames();
 
@@ -522,6 +567,9 @@ void DisplayQueue::queueDrop( const FrameId& id )
 
     std::lock_guard<std::mutex> _l( mLockQueue );
 
+    // The last item must include any events still in the incoming queue.
+    doDrainIncoming( );
+
     // Queued frame sequence can not go backwards.
     mLastQueuedFrame.validateFutureFrame( id );
 
@@ -635,8 +683,8 @@ void DisplayQueue::notifyReady( void )
 
     DTRACEIF( DISPLAY_QUEUE_DEBUG, "%s Notified ready", mName.string() );
 
-    std::lock_guard<std::mutex> _l( mLockQueue );
-    if ( mpWorker != NULL )
+    // The worker is only ever stopped on destruction so no lock is required.
+    if ( mbWorkerStarted.load( std::memory_order_acquire ) )
     {
         mpWorker->signalWork( );
     }
@@ -712,6 +760,46 @@ void DisplayQueue::doQueueWork( WorkItem* pWork )
 
     HWCASSERT( pWork );
 
+    ++mAvailableWork;
+    doLinkWork( pWork );
+
+    if ( mpWorker == NULL )
+    {
+        startWorker( );
+    }
+
+    if ( mpWorker != NULL )
+    {
+        mpWorker->signalWork( );
+    }
+}
+
+void DisplayQueue::doDrainIncoming( void )
+{
+    // FIXME: INTEL_UFO_HWC_ASSERT_MUTEX_HELD( mLockQueue );
+
+    // Only events are queued lock-free. Frames are always linked directly after
+    // draining, so mLastQueuedFrame is the last frame queued ahead of each event.
+    // Take everything claimed so far, waiting for a producer that has claimed
+    // a slot but not yet published it; otherwise events pushed after it,
+    // including this thread's own, would be linked behind the next frame.
+    const size_t end = mIncoming.Claimed( );
+    WorkItem* pWork;
+    while ( mIncoming.PopBefore( end, &pWork ) )
+    {
+        HWCASSERT( pWork->getWorkItemType() == WorkItem::WORK_ITEM_EVENT );
+        // The effective frame for an event is just a repeat of the last queued frame.
+        pWork->setEffectiveFrame( mLastQueuedFrame );
+        doLinkWork( pWork );
+    }
+}
+
+void DisplayQueue::doLinkWork( WorkItem* pWork )
+{
+    // FIXME: INTEL_UFO_HWC_ASSERT_MUTEX_HELD( mLockQueue );
+
+    HWCASSERT( pWork );
+
     bool bIsAFrame = ( pWork->getWorkItemType() == WorkItem::WORK_ITEM_FRAME );
 
     // Tracing for production of this work item (including counter values once queued).
@@ -736,16 +824,6 @@ void DisplayQueue::doQueueWork( WorkItem* pWork )
 
     DTRACEIF( DISPLAY_QUEUE_DEBUG, "%s doQueueWork After: %s", mName.string(), dump().string() );
 
-    if ( mpWorker == NULL )
-    {
-        startWorker( );
-    }
-
-    if ( mpWorker != NULL )
-    {
-        mpWorker->signalWork( );
-    }
-
     doValidateQueue();
 }
 
@@ -755,6 +833,9 @@ bool DisplayQueue::doFlush( uint32_t frameIndex, nsecs_t timeoutNs )
 
     DTRACEIF( DISPLAY_QUEUE_DEBUG || HWC_SYNC_DEBUG, "Flush %s [flush to frame %u, timeout %" PRIi64 "]", dump().string(), frameIndex, timeoutNs );
 
+    // Flush must also cover events still in the incoming queue.
+    doDrainIncoming( );
+
     // Wait for worker to reach or pass the specified frame.
     if ( mpWorker != NULL )
     {
@@ -968,6 +1049,7 @@ void DisplayQueue::dropFrame( DisplayQueue::Frame* pFrame )
     HWCASSERT( mFramePoolUsed > 0 );
     --mQueuedFrames;
     --mQueuedWork;
+    --mAvailableWork;
     --mFramePoolUsed;
 
     // Reset with cancel.
@@ -988,6 +1070,10 @@ void DisplayQueue::doDropRedundantFrames( void )
     if ( mpWorkQueue == NULL )
         return;
 
+    // Dropping takes an older frame and a newer one; don't walk a queue of events.
+    if ( mQueuedFrames < 2 )
+        return;
+
     // Get most recent queued work.
     WorkItem* pNewer = mpWorkQueue->getLast();
 
@@ -1046,6 +1132,9 @@ bool DisplayQueue::doConsumeWork( void )
 {
     // FIXME: INTEL_UFO_HWC_ASSERT_MUTEX_HELD( mLockQueue );
 
+    // Pick up events queued lock-free since the last consume.
+    doDrainIncoming( );
+
     doValidateQueue();
 
     if ( mpWorkQueue == NULL )
@@ -1112,6 +1201,7 @@ void DisplayQueue::doConsumeEvent( void )
     HWCASSERT( mQueuedWork > 0 );
     DisplayQueue::WorkItem::dequeue( &mpWorkQueue, pEvent );
     --mQueuedWork;
+    --mAvailableWork;
     ++mConsumedWork;
 
     // Advance issued frame from this work item's effective frame.
@@ -1213,6 +1303,7 @@ void DisplayQueue::doConsumeFrame( void )
     DisplayQueue::WorkItem::dequeue( &mpWorkQueue, pFrame );
     --mQueuedFrames;
     --mQueuedWork;
+    --mAvailableWork;
     ++mConsumedFramesSinceInit;
     ++mConsumedWork;
 
@@ -1303,6 +1394,7 @@ void DisplayQueue::startWorker( void )
 	DTRACEIF( DISPLAY_QUEUE_DEBUG, "Starting worker %s", mName.string( ) );
 	mpWorker.reset(new Worker( *this, mName ));
 	ETRACEIF( mpWorker.get() == NULL, "Failed to start worker for %s", mName.string( ) );
+        mbWorkerStarted.store( mpWorker != NULL, std::memory_order_release );
     }
 }
 
@@ -1312,6 +1404,7 @@ void DisplayQueue::stopWorker( void )
     if ( mpWorker != NULL )
     {
 	DTRACEIF( DISPLAY_QUEUE_DEBUG, "Stopping worker %s", mName.string( ) );
+        mbWorkerStarted.store( false, std::memory_order_release );
         mpWorker = NULL;
     }
 }
@@ -1328,27 +1421,20 @@ std::thread::id DisplayQueue::getWorkerTid( void )
 
 DisplayQueue::Worker::Worker( DisplayQueue& queue, const HWCString& threadName ) : HWCThread(-8, threadName.string( )),
     mQueue( queue ),
-    mSignalled( 0 )
+    mbWaitForPublish( false )
 {
     start();
-    HWCASSERT( mbRunning );
-    HWCASSERT( !exitPending( ) );
 }
 
 DisplayQueue::Worker::~Worker( )
 {
     stop( );
-    ETRACEIF( mbRunning, "Display queue worker thread was not terminated" );
 }
 
 void DisplayQueue::Worker::signalWork( void )
 {
-    std::lock_guard<std::mutex> _l( mLock );
     DTRACEIF( DISPLAY_QUEUE_DEBUG, "Display queue worker signal work" );
-    HWCASSERT( !exitPending( ) );
-    HWCASSERT( mSignalled >= 0 );
-    ++mSignalled;
-    mWork.notify_all( );
+    Resume( );
 }
 
 std::thread::id DisplayQueue::Worker::getId() {
@@ -1359,8 +1445,6 @@ void DisplayQueue::Worker::stop( void )
 {
     if ( initialized_ )
     {
-       // Thread::requestExit( );
-	mWork.notify_all( );
 	HWCThread::Exit( );
     }
 }
@@ -1373,94 +1457,48 @@ void DisplayQueue::Worker::start( )
     }
 }
 
-void DisplayQueue::Worker::HandleRoutine( )
+void DisplayQueue::Worker::HandleWait( )
 {
-
-    // Spin until work is available and device is ready.
-    for (;;)
+    // A producer counts its work before publishing it, and signals once it is published.
+    if ( mbWaitForPublish )
     {
-        bool bWaitForWork = false;
-        bool bWaitForReady = false;
-
-        // Drop redundant frames as early as possible.
-        mQueue.dropRedundantFrames();
-
-        // Poll queue/device status.
-        if ( !mQueue.readyForNextWork( ) )
-        {
-            bWaitForReady = true;
-        }
-        else if ( !mQueue.getQueuedWork( ) )
-        {
-            bWaitForWork = true;
-        }
+        mbWaitForPublish = false;
+        Log::alogd( DISPLAY_QUEUE_DEBUG, "Queue: %s Waiting for work to be published", mQueue.getName().string() );
+        WaitForEvent( -1 );
+        return;
+    }
 
-        // Apply waits if necessary.
-        if ( bWaitForWork || bWaitForReady )
-        {
-	    std::lock_guard<std::mutex> _l( mLock );
+    // Drop redundant frames as early as possible.
+    mQueue.dropRedundantFrames();
 
-            // Re-check we didn't already get signalled.
-	    HWCASSERT( mSignalled >= 0 );
-            if ( mSignalled > 0 )
-            {
-                --mSignalled;
-            }
-            else
-            {
-                // Apply wait.
-                if ( bWaitForReady )
-                {
-                    // Display is not ready.
-                    // Block until signalled ready or timeout (to cover flip failure).
-		    ATRACE_NAME_IF( DISPLAY_TRACE, HWCString::format( "%s Not ready", mQueue.getName().string() ) );
-		    Log::alogd( DISPLAY_QUEUE_DEBUG, "Queue: %s Not ready", mQueue.getName().string() );
-#ifdef uncomment
-		    status_t err = mWork.wait_until( mLock, mTimeoutForReady );
-                    if ( err == OK )
-                    {
-			HWCASSERT( mSignalled > 0 );
-                        --mSignalled;
-                    }
-                    else if ( err == TIMED_OUT )
-                    {
-			DTRACEIF( DISPLAY_QUEUE_DEBUG, "Display queue timeout waiting for display to signal ready" );
-                    }
-                    else
-                    {
-			ETRACE( "Display queue error waiting for display to signal ready" );
-                    }
-#endif
-                }
-                else
-                {
-                    // Display is ready but we don't have any more work yet.
-                    // Block for new work.
-		    ATRACE_NAME_IF( DISPLAY_TRACE, HWCString::format( "%s Out of work", mQueue.getName().string() ) );
-                    Log::alogd( DISPLAY_QUEUE_DEBUG, "Queue: %s Out of work", mQueue.getName().string() );
-#ifdef uncomment
-                    status_t err = mWork.wait( mLock );
-                    if ( err == OK )
-                    {
-			HWCASSERT( mSignalled > 0 );
-                        --mSignalled;
-                    }
-                    else
-                    {
-			ETRACE( "Display queue error waiting for work" );
-		    }
-#endif
-                }
-            }
-        }
-        else
-        {
-            break;
-        }
+    // Poll queue/device status.
+    if ( !mQueue.readyForNextWork( ) )
+    {
+        // Display is not ready.
+        // Block until signalled ready or timeout (to cover flip failure).
+        ATRACE_NAME_IF( DISPLAY_TRACE, HWCString::format( "%s Not ready", mQueue.getName().string() ) );
+        Log::alogd( DISPLAY_QUEUE_DEBUG, "Queue: %s Not ready", mQueue.getName().string() );
+        WaitForEvent( (int)( mTimeoutForReady / 1000000 ) );
+    }
+    else if ( !mQueue.getQueuedWork( ) )
+    {
+        // Display is ready but we don't have any more work yet.
+        // Block for new work.
+        ATRACE_NAME_IF( DISPLAY_TRACE, HWCString::format( "%s Out of work", mQueue.getName().string() ) );
+        Log::alogd( DISPLAY_QUEUE_DEBUG, "Queue: %s Out of work", mQueue.getName().string() );
+        WaitForEvent( -1 );
     }
+    // Else work is available and the display is ready so consume without waiting.
+    // Any outstanding signals are collected on later waits.
+}
 
-    // Consume work.
-    mQueue.consumeWork( );
+void DisplayQueue::Worker::HandleRoutine( )
+{
+    if ( mQueue.readyForNextWork( ) && mQueue.getQueuedWork( ) )
+    {
+        // Consume work.
+        mbWaitForPublish = !mQueue.consumeWork( );
+    }
 }
 
 }; // namespace hwcomposer
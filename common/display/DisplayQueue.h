@@ -22,12 +22,15 @@
 #include "hwcthread.h"
 #include "layer.h"
 #include "log.h"
+#include "mpscqueue.h"
 #include "AbstractBufferManager.h"
 #include "physicaldisplay.h"
 
+#include <atomic>
 #include <cinttypes>
 #include <mutex>
 #include <condition_variable>
+#include <vector>
 
 namespace hwcomposer {
 
@@ -194,6 +197,9 @@ public:
         // Close acquire fence (if the frame is dropped).
         void closeAcquireFence( void );
 
+        // Get acquire fence (-1 if there is none or it has been closed).
+        int getAcquireFence( void ) const { return mAcquireFence; }
+
         // Is the layer disabled? (no buffer).
         bool isDisabled( void ) const;
 
@@ -326,6 +332,7 @@ public:
         uint32_t    mLayerAllocCount;       //< Count of allocated space for layers.
         uint32_t    mLayerCount;            //< Count of layers.
         FrameLayer* maLayers;               //< Array of layers.
+        mutable std::vector<int> maWaitFences; //< Acquire fences for waitRendering, kept across reuse.
         uint32_t    mZOrder;                //< ZOrder.
         FrameId     mFrameId;               //< Timeline frame index.
         bool        mbLockedForDisplay:1;   //< The frame has been locked for display.
@@ -346,6 +353,9 @@ public:
     HWCString getName( void ) { return mName; }
 
     // Queue an event for execution.
+    // This does not take the queue lock once the worker is running; the event
+    // is handed to the worker through a lock-free queue and linked in order
+    // ahead of any frame queued after it.
     // Returns OK if successful.
     int queueEvent( Event* pEvent );
 
@@ -383,6 +393,7 @@ public:
     // If the display is constrained in how/when work can be issued then it must
     // implement readyForNextWork( ) and only return true if the next work item can be issued.
     // The display must also call notifyReady( ) whenever ready status changes.
+    // This does not take the queue lock so it is safe to call from the flip/retire path.
     void notifyReady( void );
 
     // Is the display available.
@@ -425,6 +436,7 @@ protected:
 	Worker( DisplayQueue& queue, const HWCString& threadName );
         virtual ~Worker( );
 
+        // Wake the worker (signals the worker eventfd).
         void signalWork( void );
 	std::thread::id getId();
 
@@ -432,16 +444,22 @@ protected:
     protected:
 	DisplayQueue& mQueue;
 
-	std::mutex mLock;
-	std::condition_variable mWork;
-        int32_t mSignalled;
+        // Work was counted but not consumed: a producer has claimed its slot
+        // in mIncoming and not yet published it. Wait for its signal.
+        bool mbWaitForPublish;
 
 	void start( );
         void stop( void );
 
+        // Block on the worker eventfd until there is work and the display is ready.
+        void HandleWait( ) override;
 	void HandleRoutine( ) override;
     };
 
+    // Capacity of the lock-free incoming work queue.
+    // If this is ever full then producers fall back to linking under the queue lock.
+    static const size_t     mIncomingCapacity = 64;
+
     // Timeout used for wait for rendering synchronisation.
     static const uint32_t   mTimeoutWaitRenderingMsec = 3000;
 
@@ -478,9 +496,22 @@ protected:
     // mpWorkQueue->mpPrev is end of queue (most recently queued work item).
     WorkItem*               mpWorkQueue;
 
+    // Work items queued by producers but not yet linked into mpWorkQueue.
+    // Producers push without the queue lock; any thread holding mLockQueue
+    // may pop (see doDrainIncoming).
+    MPSCQueue<WorkItem*, mIncomingCapacity> mIncoming;
+
     // Count of work items queued in set( ) but yet to be consumed.
+    // This only counts items linked into mpWorkQueue.
     int32_t                 mQueuedWork;
 
+    // Count of work items queued but yet to be consumed including items
+    // still in mIncoming. This can be read without the queue lock.
+    std::atomic<int32_t>    mAvailableWork;
+
+    // Set once the worker has been started, so lock-free producers can signal it.
+    std::atomic<bool>       mbWorkerStarted;
+
     // Count of frames queued in set( ) but yet to be consumed.
     int32_t                 mQueuedFrames;
 
@@ -519,8 +550,17 @@ protected:
     bool                    mbConsumerBlocked:1;
 
     // Queue work item.
+    // Queue mutex must be held on entry.
     void doQueueWork( WorkItem* pWork );
 
+    // Link work item at the end of mpWorkQueue.
+    // Queue mutex must be held on entry.
+    void doLinkWork( WorkItem* pWork );
+
+    // Move all work items from mIncoming to the end of mpWorkQueue.
+    // Queue mutex must be held on entry.
+    void doDrainIncoming( void );
+
     // This will block until the specified frame has reached the display.
     // If frameIndex is zero, then it will block until all applied state has reached the display.
     // It will only flush work that queued before flush is called.
@@ -551,7 +591,8 @@ protected:
     void doDropRedundantFrames( void );
 
     // Returns number of queued work items.
-    uint32_t getQueuedWork( void ) { return mQueuedWork; }
+    // This does not require the queue lock.
+    uint32_t getQueuedWork( void ) { return mAvailableWork.load( std::memory_order_acquire ); }
 
     // Consume the next work item.
     // Returns true if a work item is consumed.
@@ -0,0 +1,247 @@
+/*
+// Copyright (c) 2017 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+#include "colorlut.h"
+
+#include <math.h>
+#include <string.h>
+
+#include "hwctrace.h"
+
+namespace hwcomposer {
+
+ColorLutCache::ColorLutCache(uint32_t gpu_fd, size_t max_entries)
+    : gpu_fd_(gpu_fd), max_entries_(max_entries ? max_entries : 1) {
+}
+
+ColorLutCache::~ColorLutCache() {
+  Clear();
+}
+
+void ColorLutCache::SetLutSize(size_t lut_size) {
+  if (lut_size == lut_size_)
+    return;
+
+  Clear();
+  lut_size_ = lut_size;
+  lut_.resize(lut_size);
+}
+
+void ColorLutCache::Clear() {
+  for (const Entry& entry : entries_)
+    drmModeDestroyPropertyBlob(gpu_fd_, entry.blob_id);
+  entries_.clear();
+}
+
+uint32_t ColorLutCache::GetBlob(const struct gamma_colors& gamma,
+                                uint32_t contrast, uint32_t brightness) {
+  /* reset lut when contrast and brightness are all 0 */
+  if ((contrast == 0 && brightness == 0) || lut_size_ == 0)
+    return 0;
+
+  for (size_t i = 0; i < entries_.size(); i++) {
+    const Entry& entry = entries_[i];
+    if (entry.contrast == contrast && entry.brightness == brightness &&
+        !memcmp(&entry.gamma, &gamma, sizeof(gamma))) {
+      Entry hit = entry;
+      entries_.erase(entries_.begin() + i);
+      entries_.insert(entries_.begin(), hit);
+      return hit.blob_id;
+    }
+  }
+
+  Compute(gamma, contrast, brightness, lut_.data(), lut_size_);
+
+  uint32_t blob_id = 0;
+  drmModeCreatePropertyBlob(gpu_fd_, lut_.data(),
+                            sizeof(struct drm_color_lut) * lut_size_, &blob_id);
+  if (blob_id == 0) {
+    ETRACE("Failed to create LUT blob");
+    return 0;
+  }
+
+  // Blobs already attached to the CRTC are kept alive by the kernel, so the
+  // least recently used one can be destroyed straight away.
+  if (entries_.size() == max_entries_) {
+    drmModeDestroyPropertyBlob(gpu_fd_, entries_.back().blob_id);
+    entries_.pop_back();
+  }
+
+  Entry entry;
+  entry.gamma = gamma;
+  entry.contrast = contrast;
+  entry.brightness = brightness;
+  entry.blob_id = blob_id;
+  entries_.insert(entries_.begin(), entry);
+  return blob_id;
+}
+
+// Largest gamma handled by PowUnit; keeps gamma * log2(value) well inside
+// int32_t range.
+static const float kMaxFastGamma = 64.0f;
+
+// pow() for value in (0, 1) and 0 < gamma <= kMaxFastGamma, written without
+// float compares so that the loop in ComputeRun() can be vectorised. Results
+// that would underflow return 0.
+static inline float PowUnit(float value, float gamma) {
+  // log2(value): split off the exponent and reduce the mantissa to
+  // [sqrt(0.5), sqrt(2)) so the atanh series below converges quickly.
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  int32_t exponent = static_cast<int32_t>(bits >> 23) - 127;
+  // Mantissas above sqrt(2) are halved by taking the exponent of 0.5.
+  uint32_t high = ((bits & 0x007FFFFF) > 0x003504F3) ? 1 : 0;
+  exponent += high;
+  bits = (bits & 0x007FFFFF) | (0x3F800000 - (high << 23));
+  float mantissa;
+  memcpy(&mantissa, &bits, sizeof(mantissa));
+  float t = (mantissa - 1.0f) / (mantissa + 1.0f);
+  float t2 = t * t;
+  float log2_value =
+      exponent +
+      t * (2.88539008f +
+           t2 * (0.96179669f +
+                 t2 * (0.57707801f + t2 * (0.41219858f + t2 * 0.32059889f))));
+
+  // exp2(gamma * log2(value)). y <= 0, so truncation leaves f in (-1, 0],
+  // where the series is as accurate as on [0, 1).
+  float y = gamma * log2_value;
+  int32_t whole = static_cast<int32_t>(y);
+  float f = y - whole;
+  float exp2_f =
+      1.0f +
+      f * (0.69314718f +
+           f * (0.24022651f +
+                f * (0.05550411f +
+                     f * (0.00961813f +
+                          f * (0.00133336f +
+                               f * (0.00015404f + f * 0.00001525f))))));
+  uint32_t scale_bits =
+      whole > -127 ? static_cast<uint32_t>(whole + 127) << 23 : 0;
+  float scale;
+  memcpy(&scale, &scale_bits, sizeof(scale));
+  return exp2_f * scale;
+}
+
+// Fill curve from entry first for as long as the input stays inside (0, 1),
+// using PowUnit. Returns the last entry filled.
+static size_t ComputeRun(size_t first, size_t lut_size, float brightness,
+                         float contrast, float gamma, uint16_t* curve) {
+  size_t last = first;
+  while (last + 1 < lut_size) {
+    float value = ((float)(last + 1) / lut_size - 0.5) * contrast + 0.5 +
+                  brightness;
+    if (!(value < 1.0f))
+      break;
+    last++;
+  }
+
+  // Work in fixed blocks with signed indices so the loop is vectorised even
+  // at -O2 (no epilogue, branch-free int to float conversions).
+  const int32_t kBlock = 8;
+  float size_f = static_cast<float>(static_cast<int32_t>(lut_size));
+  for (int32_t base = static_cast<int32_t>(first);
+       base <= static_cast<int32_t>(last); base += kBlock) {
+    uint16_t block[kBlock];
+    for (int32_t j = 0; j < kBlock; j++) {
+      float value =
+          ((float)(base + j) / size_f - 0.5) * contrast + 0.5 + brightness;
+      block[j] = static_cast<int32_t>(0xFFFF * PowUnit(value, gamma));
+    }
+    int32_t count = static_cast<int32_t>(last) + 1 - base;
+    memcpy(curve + base, block,
+           sizeof(uint16_t) * (count < kBlock ? count : kBlock));
+  }
+  return last;
+}
+
+float ColorLutCache::FastPow(float value, float gamma) {
+  if (value <= 0.0f)
+    return 0.0f;
+  if (value >= 1.0f || !(gamma > 0.0f && gamma <= kMaxFastGamma))
+    return pow(value, gamma);
+  return PowUnit(value, gamma);
+}
+
+void ColorLutCache::Compute(const struct gamma_colors& gamma,
+                            uint32_t contrast_c, uint32_t brightness_c,
+                            struct drm_color_lut* lut, size_t lut_size) {
+  const float gammas[3] = {gamma.red, gamma.green, gamma.blue};
+  float brightness[3];
+  float contrast[3];
+  std::vector<uint16_t> curves[3];
+
+  for (int c = 0; c < 3; c++) {
+    int shift = 16 - 8 * c;
+    /* Map brightness from -128 - 127 range into -0.5 - 0.5 range */
+    brightness[c] = (float)((brightness_c >> shift) & 0xFF) / 255 - 0.5;
+    /* Map contrast from 0 - 255 range into 0.0 - 2.0 range */
+    contrast[c] = (float)((contrast_c >> shift) & 0xFF) / 128;
+
+    // Channels with identical settings share one curve.
+    int same = -1;
+    for (int prev = 0; prev < c; prev++) {
+      if (gammas[prev] == gammas[c] && brightness[prev] == brightness[c] &&
+          contrast[prev] == contrast[c]) {
+        same = prev;
+        break;
+      }
+    }
+    if (same >= 0) {
+      curves[c] = curves[same];
+      continue;
+    }
+
+    std::vector<uint16_t>& curve = curves[c];
+    curve.resize(lut_size);
+    for (size_t i = 0; i < lut_size; i++) {
+      float value = ((float)(i) / lut_size - 0.5) * contrast[c] + 0.5 +
+                    brightness[c];
+      if (value < 0.0)
+        value = 0.0;
+      if (value > 1.0)
+        value = 1.0;
+
+      // value only grows with i, so past the first entry that needs pow()
+      // the fast path handles the rest of the run in one go.
+      if (value > 0.0f && value < 1.0f && gammas[c] > 0.0f &&
+          gammas[c] <= kMaxFastGamma) {
+        i = ComputeRun(i, lut_size, brightness[c], contrast[c], gammas[c],
+                       curve.data());
+        continue;
+      }
+
+      float result = pow(value, gammas[c]);
+      if (result < 0.0)
+        result = 0.0;
+      if (result > 1.0)
+        result = 1.0;
+      curve[i] = 0xFFFF * result;
+    }
+    /* Set lut[0] as 0 always as the darkest color should has brightness 0 */
+    if (lut_size)
+      curve[0] = 0;
+  }
+
+  for (size_t i = 0; i < lut_size; i++) {
+    lut[i].red = curves[0][i];
+    lut[i].green = curves[1][i];
+    lut[i].blue = curves[2][i];
+    lut[i].reserved = 0;
+  }
+}
+
+}  // namespace hwcomposer
@@ -0,0 +1,80 @@
+/*
+// Copyright (c) 2017 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+#ifndef COMMON_DISPLAY_COLORLUT_H_
+#define COMMON_DISPLAY_COLORLUT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <xf86drmMode.h>
+
+#include <vector>
+
+namespace hwcomposer {
+
+struct gamma_colors {
+  float red;
+  float green;
+  float blue;
+};
+
+// Builds GAMMA_LUT tables from per-channel gamma, contrast and brightness and
+// keeps the most recently used ones as property blobs, so settings that are
+// revisited (e.g. while a slider is dragged back and forth) cost nothing.
+class ColorLutCache {
+ public:
+  ColorLutCache(uint32_t gpu_fd, size_t max_entries = 8);
+  ~ColorLutCache();
+
+  // Set the number of LUT entries. Drops all cached blobs if it changes.
+  void SetLutSize(size_t lut_size);
+
+  // Returns a blob holding the LUT for these settings, or 0 if contrast and
+  // brightness are both 0 (no LUT) or the blob could not be created. The
+  // blob stays owned by the cache.
+  uint32_t GetBlob(const struct gamma_colors& gamma, uint32_t contrast,
+                   uint32_t brightness);
+
+  // Fill lut_size entries of lut. contrast and brightness hold one 8-bit
+  // value per channel as 0xRRGGBB.
+  static void Compute(const struct gamma_colors& gamma, uint32_t contrast,
+                      uint32_t brightness, struct drm_color_lut* lut,
+                      size_t lut_size);
+
+  // pow(value, gamma) for value in [0, 1] and gamma > 0, accurate to well
+  // under one 16-bit LUT step.
+  static float FastPow(float value, float gamma);
+
+ private:
+  struct Entry {
+    struct gamma_colors gamma;
+    uint32_t contrast;
+    uint32_t brightness;
+    uint32_t blob_id;
+  };
+
+  void Clear();
+
+  uint32_t gpu_fd_;
+  size_t max_entries_;
+  size_t lut_size_ = 0;
+  // Most recently used first.
+  std::vector<Entry> entries_;
+  std::vector<struct drm_color_lut> lut_;
+};
+
+}  // namespace hwcomposer
+#endif  // COMMON_DISPLAY_COLORLUT_H_
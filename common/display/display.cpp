@@ -25,6 +25,7 @@
 #include <sstream>
 
 #include "displayqueue.h"
+#include "frametrace.h"
 
 namespace hwcomposer {
 
@@ -207,13 +208,17 @@ bool Display::SetPowerMode(uint32_t power_mode) {
 bool Display::Present(std::vector<HwcLayer *> &source_layers,
                       int32_t *retire_fence) {
   CTRACE();
+  FrameTrace::Scope trace(FrameTrace::kPresent, pipe_,
+                          display_queue_->GetFrame());
 
   if (!is_connected_ || power_mode_ != kOn) {
     IHOTPLUGEVENTTRACE("Trying to update an Disconnected Display.");
     return false;
   }
 
-  return display_queue_->QueueUpdate(source_layers, retire_fence);
+  bool ret = display_queue_->QueueUpdate(source_layers, retire_fence);
+  trace.SetResult(ret);
+  return ret;
 }
 
 int Display::RegisterVsyncCallback(std::shared_ptr<VsyncCallback> callback,
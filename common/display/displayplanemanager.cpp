@@ -23,6 +23,8 @@
 
 #include "displayplane.h"
 #include "factory.h"
+#include "framelatency.h"
+#include "frametrace.h"
 #include "hwctrace.h"
 #include "nativesurface.h"
 #include "nativesync.h"
@@ -31,8 +33,10 @@
 namespace hwcomposer {
 
 DisplayPlaneManager::DisplayPlaneManager(int gpu_fd, uint32_t crtc_id,
-                                         OverlayBufferManager *buffer_manager)
+                                         OverlayBufferManager *buffer_manager,
+                                         FrameLatency *latency)
     : buffer_manager_(buffer_manager),
+      latency_(latency),
       width_(0),
       height_(0),
       crtc_id_(crtc_id),
@@ -105,7 +109,11 @@ std::tuple<bool, DisplayPlaneStateList> DisplayPlaneManager::ValidateLayers(
     std::vector<OverlayLayer> &layers, bool pending_modeset,
     bool disable_overlay) {
   CTRACE();
+  FRAME_TRACE_SCOPE(kValidateLayers);
   DisplayPlaneStateList composition;
+  // The overlay loop holds a reference to the last plane state while adding
+  // the next one; there is one state per plane at most.
+  composition.reserve(overlay_planes_.size() + 2);
   std::vector<OverlayPlane> commit_planes;
   OverlayLayer *cursor_layer = NULL;
   auto layer_begin = layers.begin();
@@ -258,7 +266,9 @@ bool DisplayPlaneManager::CommitFrame(const DisplayPlaneStateList &comp_planes,
     plane->Disable(pset);
   }
 
+  FrameTrace::Scope trace(FrameTrace::kCommit);
   int ret = drmModeAtomicCommit(gpu_fd_, pset, flags, NULL);
+  trace.SetResult(ret);
   if (ret) {
     ETRACE("Failed to commit pset ret=%s\n", PRINTERROR());
     return false;
@@ -289,6 +299,7 @@ void DisplayPlaneManager::DisablePipe(drmModeAtomicReqPtr property_set) {
 
 bool DisplayPlaneManager::TestCommit(
     const std::vector<OverlayPlane> &commit_planes) const {
+  FrameTrace::Scope trace(FrameTrace::kTestCommit);
   ScopedDrmAtomicReqPtr pset(drmModeAtomicAlloc());
   for (auto i = commit_planes.begin(); i != commit_planes.end(); i++) {
     if (!(i->plane->UpdateProperties(pset.get(), crtc_id_, i->layer))) {
@@ -296,8 +307,12 @@ bool DisplayPlaneManager::TestCommit(
     }
   }
 
-  if (drmModeAtomicCommit(gpu_fd_, pset.get(), DRM_MODE_ATOMIC_TEST_ONLY,
-                          NULL)) {
+  int ret = drmModeAtomicCommit(gpu_fd_, pset.get(),
+                                DRM_MODE_ATOMIC_TEST_ONLY, NULL);
+  trace.SetResult(ret);
+  if (latency_)
+    latency_->AddTestCommit();
+  if (ret) {
     IDISPLAYMANAGERTRACE("Test Commit Failed. %s ", PRINTERROR());
     return false;
   }
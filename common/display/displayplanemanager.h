@@ -36,14 +36,17 @@ namespace hwcomposer {
 
 class DisplayPlane;
 class DisplayPlaneState;
+class FrameLatency;
 class GpuDevice;
 class OverlayBufferManager;
 struct OverlayLayer;
 
 class DisplayPlaneManager {
  public:
+  // Test commits are counted in latency, when given.
   DisplayPlaneManager(int gpu_fd, uint32_t crtc_id,
-                      OverlayBufferManager *buffer_manager);
+                      OverlayBufferManager *buffer_manager,
+                      FrameLatency *latency = NULL);
 
   virtual ~DisplayPlaneManager();
 
@@ -83,6 +86,7 @@ class DisplayPlaneManager {
 			   std::vector<OverlayLayer> &layers);
 
   OverlayBufferManager *buffer_manager_;
+  FrameLatency *latency_;
   std::vector<std::unique_ptr<NativeSurface>> surfaces_;
   std::unique_ptr<DisplayPlane> primary_plane_;
   std::unique_ptr<DisplayPlane> cursor_plane_;
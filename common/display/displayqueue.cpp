@@ -16,13 +16,14 @@
 
 #include "displayqueue.h"
 
-#include <math.h>
 #include <hwcdefs.h>
 #include <hwclayer.h>
 
 #include <vector>
 
 #include "displayplanemanager.h"
+#include "frametrace.h"
+#include "layercapture.h"
 #include "hwctrace.h"
 #include "overlaylayer.h"
 #include "vblankeventhandler.h"
@@ -45,6 +46,7 @@ DisplayQueue_old::DisplayQueue_old(uint32_t gpu_fd, uint32_t crtc_id,
       old_blob_id_(0),
       gpu_fd_(gpu_fd),
       lut_size_(0),
+      lut_cache_(gpu_fd),
       broadcastrgb_id_(0),
       broadcastrgb_full_(-1),
       broadcastrgb_automatic_(-1),
@@ -56,12 +58,13 @@ DisplayQueue_old::DisplayQueue_old(uint32_t gpu_fd, uint32_t crtc_id,
   GetDrmObjectProperty("MODE_ID", crtc_props, &mode_id_prop_);
   GetDrmObjectProperty("GAMMA_LUT", crtc_props, &lut_id_prop_);
   GetDrmObjectPropertyValue("GAMMA_LUT_SIZE", crtc_props, &lut_size_);
+  lut_cache_.SetLutSize(lut_size_);
   GetDrmObjectProperty("OUT_FENCE_PTR", crtc_props, &out_fence_ptr_prop_);
   disable_overlay_usage_ = out_fence_ptr_prop_ == 0;
 
   memset(&mode_, 0, sizeof(mode_));
   display_plane_manager_.reset(
-      new DisplayPlaneManager(gpu_fd_, crtc_id_, buffer_manager_));
+      new DisplayPlaneManager(gpu_fd_, crtc_id_, buffer_manager_, &latency_));
 
   kms_fence_handler_.reset(new KMSFenceEventHandler(this));
   /* use 0x80 as default brightness for all colors */
@@ -97,6 +100,8 @@ bool DisplayQueue_old::Initialize(uint32_t width, uint32_t height, uint32_t pipe
 
   connector_ = connector;
   mode_ = mode_info;
+  pipe_ = pipe;
+  latency_.SetDisplay(pipe, mode_.vrefresh);
 
   ScopedDrmObjectPropertyPtr connector_props(drmModeObjectGetProperties(
       gpu_fd_, connector_, DRM_MODE_OBJECT_CONNECTOR));
@@ -245,10 +250,23 @@ void DisplayQueue_old::GetCachedLayers(const std::vector<OverlayLayer>& layers,
 bool DisplayQueue_old::QueueUpdate(std::vector<HwcLayer*>& source_layers,
                                int32_t* retire_fence) {
   CTRACE();
+  frame_++;
+  // Nothing would change on screen, so skip composition and the commit and
+  // hand back the fences of the frame that is still being scanned out.
+  if (present_cache_.Reuse(source_layers, needs_modeset_,
+                           needs_color_correction_, retire_fence)) {
+    if (LayerCapture::IsEnabled())
+      LayerCapture::AddUnchanged(pipe_, frame_ - 1, FrameLatency::Now());
+    return true;
+  }
+
+  const int64_t present_ns = FrameLatency::Now();
+
   size_t size = source_layers.size();
   size_t previous_size = previous_layers_.size();
   std::vector<OverlayLayer> layers;
   std::vector<HwcRect<int>> layers_rects;
+  std::vector<int> release_fences;
   bool layers_changed = false;
   spin_lock_.lock();
   for (size_t layer_index = 0; layer_index < size; layer_index++) {
@@ -270,6 +288,7 @@ bool DisplayQueue_old::QueueUpdate(std::vector<HwcLayer*>& source_layers,
     int ret = layer->release_fence.Reset(overlay_layer.GetReleaseFence());
     if (ret < 0)
       ETRACE("Failed to create fence for layer, error: %s", PRINTERROR());
+    release_fences.emplace_back(ret);
 
     if (!use_layer_cache_)
       continue;
@@ -285,6 +304,9 @@ bool DisplayQueue_old::QueueUpdate(std::vector<HwcLayer*>& source_layers,
   }
 
   spin_lock_.unlock();
+  if (LayerCapture::IsEnabled())
+    LayerCapture::Add(pipe_, frame_ - 1, present_ns, source_layers, layers);
+  kms_fence_handler_->WaitAcquireFences(layers, present_ns);
 
   if (!use_layer_cache_ || size != previous_size) {
     layers_changed = true;
@@ -321,6 +343,19 @@ bool DisplayQueue_old::QueueUpdate(std::vector<HwcLayer*>& source_layers,
       ETRACE("Failed to prepare for the frame composition. ");
       return false;
     }
+
+    uint64_t composed_pixels = 0;
+    for (const DisplayPlaneState& plane : current_composition_planes) {
+      if (plane.GetCompositionState() != DisplayPlaneState::State::kRender)
+        continue;
+      for (const CompositionRegion& region : plane.GetCompositionRegion()) {
+        const HwcRect<int>& frame = region.frame;
+        composed_pixels += uint64_t(frame.right - frame.left) *
+                           (frame.bottom - frame.top) *
+                           region.source_layers.size();
+      }
+    }
+    latency_.AddComposition(composed_pixels);
   }
 
   int32_t fence = 0;
@@ -341,25 +376,31 @@ bool DisplayQueue_old::QueueUpdate(std::vector<HwcLayer*>& source_layers,
     GetFence(pset.get(), &fence);
   }
 
-  if (needs_color_correction_) {
-    SetColorCorrection(gamma_, contrast_, brightness_);
-    needs_color_correction_ = false;
+  // The LUT goes out with this commit; retry on the next one if it fails.
+  bool apply_lut = needs_color_correction_;
+  needs_color_correction_ = false;
+  if (apply_lut && !ApplyPendingLUT(pset.get())) {
+    ETRACE("Failed to add LUT to pset.");
+    needs_color_correction_ = true;
   }
 
   kms_fence_handler_->EnsureReadyForNextFrame();
 
+  const int64_t commit_ns = FrameLatency::Now();
   if (!display_plane_manager_->CommitFrame(current_composition_planes,
                                            pset.get(), flags_)) {
     ETRACE("Failed to Commit layers.");
+    needs_color_correction_ |= apply_lut;
     return false;
   }
+  latency_.AddCommit(present_ns, commit_ns);
 
   if (fence > 0) {
     if (render_layers)
       compositor_.InsertFence(dup(fence));
 
     *retire_fence = dup(fence);
-    kms_fence_handler_->WaitFence(fence, previous_layers_);
+    kms_fence_handler_->WaitFence(fence, previous_layers_, commit_ns);
   } else {
     // This is the best we can do in this case, flush any 3D
     // operations and release buffers of previous layers.
@@ -369,6 +410,7 @@ bool DisplayQueue_old::QueueUpdate(std::vector<HwcLayer*>& source_layers,
     spin_lock_.lock();
     buffer_manager_->UnRegisterLayerBuffers(previous_layers_);
     spin_lock_.unlock();
+    FRAME_TRACE(kBufferRelease, previous_layers_.size());
     if (!disable_overlay_usage_) {
       flags_ = 0;
       flags_ |= DRM_MODE_ATOMIC_NONBLOCK;
@@ -377,6 +419,9 @@ bool DisplayQueue_old::QueueUpdate(std::vector<HwcLayer*>& source_layers,
     needs_modeset_ = false;
   }
 
+  present_cache_.Update(source_layers, release_fences,
+                        fence > 0 ? *retire_fence : -1);
+
   for (NativeSurface* surface : in_flight_surfaces_) {
     surface->SetInUse(false);
   }
@@ -405,6 +450,7 @@ void DisplayQueue_old::HandleCommitUpdate(
 
 void DisplayQueue_old::HandleExit() {
   kms_fence_handler_->ExitThread();
+  present_cache_.Invalidate();
 
   ScopedDrmAtomicReqPtr pset(drmModeAtomicAlloc());
   if (!pset) {
@@ -463,21 +509,18 @@ void DisplayQueue_old::GetDrmObjectPropertyValue(
     ETRACE("Could not find property value %s", name);
 }
 
-void DisplayQueue_old::ApplyPendingLUT(struct drm_color_lut* lut) const {
-  if (lut_id_prop_ == 0)
-    return;
-
-  uint32_t lut_blob_id = 0;
+bool DisplayQueue_old::ApplyPendingLUT(drmModeAtomicReqPtr property_set) {
+  if (lut_id_prop_ == 0 || lut_size_ == 0)
+    return true;
 
-  drmModeCreatePropertyBlob(
-      gpu_fd_, lut, sizeof(struct drm_color_lut) * lut_size_, &lut_blob_id);
-  if (lut_blob_id == 0) {
-    return;
-  }
+  // A blob id of 0 removes the LUT, which is what zero contrast and
+  // brightness ask for.
+  uint32_t lut_blob_id = lut_cache_.GetBlob(gamma_, contrast_, brightness_);
+  if (lut_blob_id == 0 && (contrast_ || brightness_))
+    return false;
 
-  drmModeObjectSetProperty(gpu_fd_, crtc_id_, DRM_MODE_OBJECT_CRTC,
-                           lut_id_prop_, lut_blob_id);
-  drmModeDestroyPropertyBlob(gpu_fd_, lut_blob_id);
+  return drmModeAtomicAddProperty(property_set, crtc_id_, lut_id_prop_,
+                                  lut_blob_id) >= 0;
 }
 
 void DisplayQueue_old::SetGamma(float red, float green, float blue) {
@@ -503,102 +546,6 @@ void DisplayQueue_old::SetBrightness(uint32_t red, uint32_t green, uint32_t blue
   needs_color_correction_ = true;
 }
 
-float DisplayQueue_old::TransformContrastBrightness(float value, float brightness,
-                                                float contrast) const {
-  float result;
-  result = (value - 0.5) * contrast + 0.5 + brightness;
-
-  if (result < 0.0)
-    result = 0.0;
-  if (result > 1.0)
-    result = 1.0;
-  return result;
-}
-
-float DisplayQueue_old::TransformGamma(float value, float gamma) const {
-  float result;
-
-  result = pow(value, gamma);
-  if (result < 0.0)
-    result = 0.0;
-  if (result > 1.0)
-    result = 1.0;
-
-  return result;
-}
-
-void DisplayQueue_old::SetColorCorrection(struct gamma_colors gamma,
-                                      uint32_t contrast_c,
-                                      uint32_t brightness_c) const {
-  struct drm_color_lut* lut;
-  float brightness[3];
-  float contrast[3];
-  uint8_t temp[3];
-  int32_t ret;
-
-  /* reset lut when contrast and brightness are all 0 */
-  if (contrast_c == 0 && brightness_c == 0) {
-    lut = NULL;
-    ApplyPendingLUT(lut);
-    free(lut);
-    return;
-  }
-
-  lut = (struct drm_color_lut*)malloc(sizeof(struct drm_color_lut) * lut_size_);
-  if (!lut) {
-    ETRACE("Cannot allocate LUT memory");
-    return;
-  }
-
-  /* Unpack brightness values for each channel */
-  temp[0] = (brightness_c >> 16) & 0xFF;
-  temp[1] = (brightness_c >> 8) & 0xFF;
-  temp[2] = (brightness_c)&0xFF;
-
-  /* Map brightness from -128 - 127 range into -0.5 - 0.5 range */
-  brightness[0] = (float)(temp[0]) / 255 - 0.5;
-  brightness[1] = (float)(temp[1]) / 255 - 0.5;
-  brightness[2] = (float)(temp[2]) / 255 - 0.5;
-
-  /* Unpack contrast values for each channel */
-  temp[0] = (contrast_c >> 16) & 0xFF;
-  temp[1] = (contrast_c >> 8) & 0xFF;
-  temp[2] = (contrast_c)&0xFF;
-
-  /* Map contrast from 0 - 255 range into 0.0 - 2.0 range */
-  contrast[0] = (float)(temp[0]) / 128;
-  contrast[1] = (float)(temp[1]) / 128;
-  contrast[2] = (float)(temp[2]) / 128;
-
-  uint32_t max_value = (1 << 16) - 1;
-  uint32_t mask = ((1 << 8) - 1) << 8;
-  for (uint64_t i = 0; i < lut_size_; i++) {
-    /* Set lut[0] as 0 always as the darkest color should has brightness 0 */
-    if (i == 0) {
-      lut[i].red = 0;
-      lut[i].green = 0;
-      lut[i].blue = 0;
-      continue;
-    }
-
-    lut[i].red = 0xFFFF * TransformGamma(TransformContrastBrightness(
-                                             (float)(i) / lut_size_,
-                                             brightness[0], contrast[0]),
-                                         gamma.red);
-    lut[i].green = 0xFFFF * TransformGamma(TransformContrastBrightness(
-                                               (float)(i) / lut_size_,
-                                               brightness[1], contrast[1]),
-                                           gamma.green);
-    lut[i].blue = 0xFFFF * TransformGamma(TransformContrastBrightness(
-                                              (float)(i) / lut_size_,
-                                              brightness[2], contrast[2]),
-                                          gamma.blue);
-  }
-
-  ApplyPendingLUT(lut);
-  free(lut);
-}
-
 bool DisplayQueue_old::SetBroadcastRGB(const char* range_property) {
   int64_t p_value = -1;
 
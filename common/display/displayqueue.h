@@ -29,18 +29,16 @@
 #include <memory>
 #include <vector>
 
+#include "colorlut.h"
 #include "compositor.h"
+#include "framelatency.h"
 #include "hwcthread.h"
 #include "kmsfencehandler.h"
 #include "nativesync.h"
 #include "platformdefines.h"
+#include "presentcache.h"
 
 namespace hwcomposer {
-struct gamma_colors {
-  float red;
-  float green;
-  float blue;
-};
 
 class DisplayPlaneManager;
 struct HwcLayer;
@@ -67,6 +65,15 @@ class DisplayQueue_old {
 
   void HandleExit();
 
+  // Id of the next frame QueueUpdate() will present.
+  uint32_t GetFrame() const {
+    return frame_;
+  }
+
+  FrameLatency& GetFrameLatency() {
+    return latency_;
+  }
+
   void HandleCommitUpdate(const std::vector<const OverlayBuffer*>& buffers);
 
  private:
@@ -77,17 +84,11 @@ class DisplayQueue_old {
   void GetDrmObjectProperty(const char* name,
                             const ScopedDrmObjectPropertyPtr& props,
                             uint32_t* id) const;
-  void ApplyPendingLUT(struct drm_color_lut* lut) const;
+  bool ApplyPendingLUT(drmModeAtomicReqPtr property_set);
   void GetDrmObjectPropertyValue(const char* name,
                                  const ScopedDrmObjectPropertyPtr& props,
                                  uint64_t* value) const;
 
-  void SetColorCorrection(struct gamma_colors gamma, uint32_t contrast,
-                          uint32_t brightness) const;
-  float TransformGamma(float value, float gamma) const;
-  float TransformContrastBrightness(float value, float brightness,
-                                    float contrast) const;
-
   Compositor compositor_;
   drmModeModeInfo mode_;
   uint32_t frame_;
@@ -98,6 +99,7 @@ class DisplayQueue_old {
   uint32_t mode_id_prop_;
   uint32_t lut_id_prop_;
   uint32_t crtc_id_;
+  uint32_t pipe_ = 0;
   uint32_t connector_;
   uint32_t crtc_prop_;
   uint32_t blob_id_ = 0;
@@ -108,6 +110,7 @@ class DisplayQueue_old {
   uint32_t flags_ = DRM_MODE_ATOMIC_ALLOW_MODESET;
   struct gamma_colors gamma_;
   uint64_t lut_size_;
+  ColorLutCache lut_cache_;
   uint32_t broadcastrgb_id_;
   int64_t broadcastrgb_full_;
   int64_t broadcastrgb_automatic_;
@@ -116,12 +119,15 @@ class DisplayQueue_old {
   bool use_layer_cache_ = false;
   bool needs_modeset_ = true;
   bool disable_overlay_usage_ = false;
+  // Declared before the fence handler, whose thread records into it.
+  FrameLatency latency_;
   std::unique_ptr<KMSFenceEventHandler> kms_fence_handler_;
   std::unique_ptr<DisplayPlaneManager> display_plane_manager_;
   std::vector<OverlayLayer> previous_layers_;
   DisplayPlaneStateList previous_plane_state_;
   OverlayBufferManager* buffer_manager_;
   std::vector<NativeSurface*> in_flight_surfaces_;
+  PresentCache present_cache_;
   SpinLock spin_lock_;
 };
 
@@ -0,0 +1,165 @@
+/*
+// Copyright (c) 2017 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+#include "framelatency.h"
+
+#include <time.h>
+
+#include <spinlock.h>
+
+#include <map>
+
+namespace hwcomposer {
+
+namespace {
+
+SpinLock registry_lock_;
+std::map<uint32_t, FrameLatency*> registry_;
+
+const char* const kStageNames[FrameLatency::kNumStages] = {
+    "present-to-commit", "commit-to-flip", "acquire-wait"};
+
+}  // namespace
+
+FrameLatency::FrameLatency()
+    : frames_(0),
+      missed_vblanks_(0),
+      test_commits_(0),
+      composed_pixels_(0),
+      refresh_period_ns_(0),
+      display_(0) {
+}
+
+FrameLatency::~FrameLatency() {
+  Unregister();
+}
+
+void FrameLatency::SetDisplay(uint32_t display, uint32_t refresh_rate) {
+  Unregister();
+  for (LatencyHistogram& stage : stages_)
+    stage.Reset();
+  frames_.store(0, std::memory_order_relaxed);
+  missed_vblanks_.store(0, std::memory_order_relaxed);
+  test_commits_.store(0, std::memory_order_relaxed);
+  composed_pixels_.store(0, std::memory_order_relaxed);
+  refresh_period_ns_.store(refresh_rate ? 1000000000 / refresh_rate : 0,
+                           std::memory_order_relaxed);
+
+  ScopedSpinLock lock(registry_lock_);
+  display_ = display;
+  registered_ = true;
+  registry_[display_] = this;
+}
+
+void FrameLatency::Unregister() {
+  ScopedSpinLock lock(registry_lock_);
+  if (!registered_)
+    return;
+  std::map<uint32_t, FrameLatency*>::iterator it = registry_.find(display_);
+  if (it != registry_.end() && it->second == this)
+    registry_.erase(it);
+  registered_ = false;
+}
+
+int64_t FrameLatency::Now() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return int64_t(t.tv_sec) * 1000000000 + t.tv_nsec;
+}
+
+void FrameLatency::AddCommit(int64_t present_ns, int64_t commit_ns) {
+  stages_[kPresentToCommit].Add(commit_ns - present_ns);
+  frames_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void FrameLatency::AddFlip(int64_t commit_ns, int64_t flip_ns) {
+  const int64_t latency = flip_ns - commit_ns;
+  stages_[kCommitToFlip].Add(latency);
+
+  const int64_t period = refresh_period_ns_.load(std::memory_order_relaxed);
+  if (period > 0) {
+    const int64_t missed = (latency + period / 4) / period - 1;
+    if (missed > 0)
+      missed_vblanks_.fetch_add(missed, std::memory_order_relaxed);
+  }
+}
+
+void FrameLatency::AddAcquireWait(int64_t wait_ns) {
+  stages_[kAcquireWait].Add(wait_ns);
+}
+
+void FrameLatency::AddTestCommit() {
+  test_commits_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void FrameLatency::AddComposition(uint64_t pixels) {
+  composed_pixels_.fetch_add(pixels, std::memory_order_relaxed);
+}
+
+FrameLatency::Summary FrameLatency::GetSummary() const {
+  Summary summary;
+  for (uint32_t i = 0; i < kNumStages; i++)
+    summary.stages[i] = stages_[i].GetSummary();
+  summary.frames = frames_.load(std::memory_order_relaxed);
+  summary.missed_vblanks = missed_vblanks_.load(std::memory_order_relaxed);
+  summary.test_commits = test_commits_.load(std::memory_order_relaxed);
+  summary.composed_pixels = composed_pixels_.load(std::memory_order_relaxed);
+  return summary;
+}
+
+HWCString FrameLatency::Dump() const {
+  const Summary summary = GetSummary();
+  HWCString output;
+  output.appendFormat("Display %u latency: %llu frames, %llu missed vblanks\n",
+                      display_, (unsigned long long)summary.frames,
+                      (unsigned long long)summary.missed_vblanks);
+  output.appendFormat("  %llu test commits, %llu composed pixels\n",
+                      (unsigned long long)summary.test_commits,
+                      (unsigned long long)summary.composed_pixels);
+  output.appendFormat("  %-18s %8s %8s %8s %8s %8s\n", "us", "samples", "p50",
+                      "p90", "p99", "max");
+  for (uint32_t i = 0; i < kNumStages; i++) {
+    const LatencyHistogram::Summary& stage = summary.stages[i];
+    output.appendFormat("  %-18s %8u %8u %8u %8u %8u\n", kStageNames[i],
+                        stage.samples, stage.p50, stage.p90, stage.p99,
+                        stage.max);
+  }
+  return output;
+}
+
+const char* FrameLatency::GetStageName(uint32_t stage) {
+  return stage < kNumStages ? kStageNames[stage] : "unknown";
+}
+
+bool FrameLatency::GetSummary(uint32_t display, Summary& summary) {
+  ScopedSpinLock lock(registry_lock_);
+  std::map<uint32_t, FrameLatency*>::const_iterator it =
+      registry_.find(display);
+  if (it == registry_.end())
+    return false;
+  summary = it->second->GetSummary();
+  return true;
+}
+
+HWCString FrameLatency::DumpAll() {
+  ScopedSpinLock lock(registry_lock_);
+  HWCString output;
+  for (const std::pair<const uint32_t, FrameLatency*>& entry : registry_)
+    output.append(entry.second->Dump());
+  return output;
+}
+
+}  // namespace hwcomposer
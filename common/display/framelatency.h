@@ -0,0 +1,94 @@
+/*
+// Copyright (c) 2017 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+#ifndef COMMON_DISPLAY_FRAMELATENCY_H_
+#define COMMON_DISPLAY_FRAMELATENCY_H_
+
+#include <stdint.h>
+
+#include <atomic>
+
+#include <platformdefines.h>
+
+#include "latencyhistogram.h"
+
+namespace hwcomposer {
+
+// Always on latency statistics of one display. The present thread records
+// how long it took to get each frame to the commit, and the KMS fence thread
+// how long the commit took to reach the screen and how long the frame's
+// acquire fences were still pending. Each display registers its statistics
+// by pipe so that the HWC dump and the diagnostic service can find them.
+class FrameLatency {
+ public:
+  enum Stage {
+    kPresentToCommit = 0,
+    kCommitToFlip,
+    kAcquireWait,
+    kNumStages
+  };
+
+  struct Summary {
+    LatencyHistogram::Summary stages[kNumStages];
+    uint64_t frames;
+    uint64_t missed_vblanks;
+    uint64_t test_commits;
+    // Source pixels drawn by the compositor, counting each layer of a
+    // region over its whole area.
+    uint64_t composed_pixels;
+  };
+
+  FrameLatency();
+  ~FrameLatency();
+
+  // Reports these statistics for display and starts them afresh.
+  void SetDisplay(uint32_t display, uint32_t refresh_rate);
+
+  // CLOCK_MONOTONIC, ns.
+  static int64_t Now();
+
+  void AddCommit(int64_t present_ns, int64_t commit_ns);
+  // A flip that lands more than a refresh period after its commit, with a
+  // quarter of a period to spare, missed a vblank for each period over.
+  void AddFlip(int64_t commit_ns, int64_t flip_ns);
+  void AddAcquireWait(int64_t wait_ns);
+  void AddTestCommit();
+  void AddComposition(uint64_t pixels);
+
+  Summary GetSummary() const;
+  HWCString Dump() const;
+
+  static const char* GetStageName(uint32_t stage);
+
+  // Looks up the statistics registered for display.
+  static bool GetSummary(uint32_t display, Summary& summary);
+  static HWCString DumpAll();
+
+ private:
+  void Unregister();
+
+  LatencyHistogram stages_[kNumStages];
+  std::atomic<uint64_t> frames_;
+  std::atomic<uint64_t> missed_vblanks_;
+  std::atomic<uint64_t> test_commits_;
+  std::atomic<uint64_t> composed_pixels_;
+  std::atomic<int64_t> refresh_period_ns_;
+  uint32_t display_;
+  bool registered_ = false;
+};
+
+}  // namespace hwcomposer
+#endif  // COMMON_DISPLAY_FRAMELATENCY_H_
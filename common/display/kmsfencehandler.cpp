@@ -16,24 +16,34 @@
 
 #include "kmsfencehandler.h"
 
+#include <poll.h>
+
+#include <atomic>
+#include <memory>
+
 #include "displayqueue.h"
+#include "framelatency.h"
+#include "frametrace.h"
 #include "hwcutils.h"
 #include "hwctrace.h"
 
 namespace hwcomposer {
 
 KMSFenceEventHandler::KMSFenceEventHandler(DisplayQueue_old* display_queue)
-    : HWCThread(-8, "KMSFenceEventHandler"),
-      kms_fence_(0),
-      kms_ready_fence_(0),
+    : FenceWaiter(-8, "KMSFenceEventHandler"),
+      kms_ready_fence_(-1),
+      kms_ready_sequence_(0),
       display_queue_(display_queue) {
 }
 
 KMSFenceEventHandler::~KMSFenceEventHandler() {
+  ExitThread();
+  if (kms_ready_fence_ >= 0)
+    close(kms_ready_fence_);
 }
 
 bool KMSFenceEventHandler::Initialize() {
-  if (!InitWorker()) {
+  if (!FenceWaiter::Initialize()) {
     ETRACE("Failed to initalize thread for KMSFenceEventHandler. %s",
            PRINTERROR());
     return false;
@@ -47,71 +57,138 @@ bool KMSFenceEventHandler::EnsureReadyForNextFrame() {
   // Lets ensure the job associated with previous frame
   // has been done, else commit will fail with -EBUSY.
   ready_fence_lock_.lock();
-  uint32_t kms_ready_fence = kms_ready_fence_;
-  kms_ready_fence_ = 0;
+  int kms_ready_fence = kms_ready_fence_;
+  kms_ready_fence_ = -1;
   ready_fence_lock_.unlock();
 
-  if (kms_ready_fence > 0) {
-    HWCPoll(kms_ready_fence, -1);
+  if (kms_ready_fence >= 0) {
+    FenceWaiter::WaitAll(&kms_ready_fence, 1, -1, nullptr);
     close(kms_ready_fence);
-    kms_ready_fence = 0;
   }
 
   return true;
 }
 
 void KMSFenceEventHandler::WaitFence(uint32_t kms_fence,
-                                     std::vector<OverlayLayer>& layers) {
+                                     std::vector<OverlayLayer>& layers,
+                                     int64_t commit_ns) {
   CTRACE();
-  spin_lock_.lock();
-  kms_fence_ = kms_fence;
+  std::vector<const OverlayBuffer*> buffers;
   for (OverlayLayer& layer : layers) {
     OverlayBuffer* const buffer = layer.GetBuffer();
-    buffers_.emplace_back(buffer);
+    buffers.emplace_back(buffer);
     // Instead of registering again, we mark the buffer
     // released in layer so that it's not deleted till we
     // explicitly unregister the buffer.
     layer.ReleaseBuffer();
   }
 
+  int kms_ready_fence = dup(kms_fence);
   ready_fence_lock_.lock();
-  kms_ready_fence_ = dup(kms_fence);
+  if (kms_ready_fence_ >= 0)
+    close(kms_ready_fence_);
+  kms_ready_fence_ = kms_ready_fence;
+  uint64_t sequence = ++kms_ready_sequence_;
+  // Buffers of an earlier commit whose fence could not be waited on are
+  // released with this one.
+  buffers.insert(buffers.end(), pending_buffers_.begin(),
+                 pending_buffers_.end());
+  pending_buffers_.clear();
   ready_fence_lock_.unlock();
 
-  spin_lock_.unlock();
-  Resume();
-}
+  uint32_t display = 0, frame = 0;
+  if (FrameTrace::IsEnabled())
+    FrameTrace::GetCurrentFrame(display, frame);
+
+  // Each commit keeps its own buffer list, so a later commit no longer
+  // overwrites the fence of one that has not signalled yet.
+  auto on_signalled = [this, sequence, buffers, display, frame,
+                       commit_ns](bool ok) {
+    FRAME_TRACE_FOR(kOutFence, display, frame, ok);
+    if (!ok) {
+      KeepBuffersPending(buffers);
+      return;
+    }
+    display_queue_->GetFrameLatency().AddFlip(commit_ns, FrameLatency::Now());
+    HandleCommitFence(sequence, buffers);
+    FRAME_TRACE_FOR(kBufferRelease, display, frame, buffers.size());
+  };
+
+  // Add() closes the fence it is given even if it fails, so keep a copy to
+  // block on in that case.
+  int fence = dup(kms_fence);
+  if (Add(kms_fence, -1, on_signalled)) {
+    if (fence >= 0)
+      close(fence);
+    return;
+  }
 
-void KMSFenceEventHandler::ExitThread() {
-  HWCThread::Exit();
+  ETRACE("Failed to watch KMS fence %u, waiting for it", kms_fence);
+  bool ok = fence >= 0 && FenceWaiter::WaitAll(&fence, 1, -1, nullptr) == 1;
+  if (fence >= 0)
+    close(fence);
+  on_signalled(ok);
 }
 
-void KMSFenceEventHandler::HandleRoutine() {
-  spin_lock_.lock();
-  std::vector<const OverlayBuffer*> buffers;
-  buffers.swap(buffers_);
-  uint32_t kms_fence = kms_fence_;
-  kms_fence_ = 0;
-  spin_lock_.unlock();
-
-  ready_fence_lock_.lock();
-  uint32_t kms_ready_fence = kms_ready_fence_;
-  ready_fence_lock_.unlock();
+void KMSFenceEventHandler::WaitAcquireFences(
+    const std::vector<OverlayLayer>& layers, int64_t present_ns) {
+  // Most fences have signalled by the time the frame is presented, which
+  // only costs a poll each. The rest are watched on this thread, and the
+  // last of them to signal records the wait. pending holds one extra count
+  // until every fence has been added.
+  std::shared_ptr<std::atomic<uint32_t>> pending =
+      std::make_shared<std::atomic<uint32_t>>(1);
+  FrameLatency& latency = display_queue_->GetFrameLatency();
+  auto on_signalled = [pending, &latency, present_ns](bool) {
+    if (pending->fetch_sub(1) == 1)
+      latency.AddAcquireWait(FrameLatency::Now() - present_ns);
+  };
+
+  bool waiting = false;
+  for (const OverlayLayer& layer : layers) {
+    struct pollfd fds;
+    fds.fd = layer.GetAcquireFence();
+    fds.events = POLLIN;
+    fds.revents = 0;
+    if (fds.fd < 0 || poll(&fds, 1, 0) != 0)
+      continue;
+    pending->fetch_add(1);
+    if (Add(dup(fds.fd), -1, on_signalled))
+      waiting = true;
+    else
+      pending->fetch_sub(1);
+  }
 
-  if (kms_fence > 0) {
-    HWCPoll(kms_fence, -1);
-    close(kms_fence);
-    kms_fence = 0;
+  if (!waiting) {
+    pending->store(0);
+    latency.AddAcquireWait(0);
+  } else {
+    on_signalled(true);
   }
+}
 
+void KMSFenceEventHandler::HandleCommitFence(
+    uint64_t sequence, const std::vector<const OverlayBuffer*>& buffers) {
+  // Only drop the ready fence if no later commit has replaced it.
   ready_fence_lock_.lock();
-  if (kms_ready_fence_ && kms_ready_fence == kms_ready_fence_) {
+  if (kms_ready_fence_ >= 0 && sequence == kms_ready_sequence_) {
     close(kms_ready_fence_);
-    kms_ready_fence_ = 0;
+    kms_ready_fence_ = -1;
   }
   ready_fence_lock_.unlock();
 
   display_queue_->HandleCommitUpdate(buffers);
 }
 
+void KMSFenceEventHandler::KeepBuffersPending(
+    const std::vector<const OverlayBuffer*>& buffers) {
+  // The flip may still be scanning these out, so hold them until the fence
+  // of a later commit signals.
+  ETRACE("KMS fence did not signal, keeping %zu buffers", buffers.size());
+  ready_fence_lock_.lock();
+  pending_buffers_.insert(pending_buffers_.end(), buffers.begin(),
+                          buffers.end());
+  ready_fence_lock_.unlock();
+}
+
 }  // namespace hwcomposer
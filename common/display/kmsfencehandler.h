@@ -26,32 +26,42 @@
 #include "nativesync.h"
 #include "overlaylayer.h"
 
-#include "hwcthread.h"
+#include "fencewaiter.h"
 
 namespace hwcomposer {
 
 class DisplayQueue_old;
 
-class KMSFenceEventHandler : public HWCThread {
+// Releases the buffers of each commit once its KMS out-fence signals.
+class KMSFenceEventHandler : public FenceWaiter {
  public:
   KMSFenceEventHandler(DisplayQueue_old* display_queue);
   ~KMSFenceEventHandler() override;
 
   bool Initialize();
 
-  void WaitFence(uint32_t kms_fence, std::vector<OverlayLayer>& layers);
+  // Releases the buffers of layers once kms_fence signals, and records how
+  // long after commit_ns the frame reached the screen.
+  void WaitFence(uint32_t kms_fence, std::vector<OverlayLayer>& layers,
+                 int64_t commit_ns);
 
-  bool EnsureReadyForNextFrame();
+  // Records how long after present_ns the last acquire fence of layers
+  // signalled.
+  void WaitAcquireFences(const std::vector<OverlayLayer>& layers,
+                         int64_t present_ns);
 
-  void HandleRoutine() override;
-  void ExitThread();
+  bool EnsureReadyForNextFrame();
 
  private:
-  SpinLock spin_lock_;
+  void HandleCommitFence(uint64_t sequence,
+                         const std::vector<const OverlayBuffer*>& buffers);
+  void KeepBuffersPending(const std::vector<const OverlayBuffer*>& buffers);
+
   SpinLock ready_fence_lock_;
-  std::vector<const OverlayBuffer*> buffers_;
-  uint32_t kms_fence_;
-  uint32_t kms_ready_fence_;
+  int kms_ready_fence_;
+  uint64_t kms_ready_sequence_;
+  // Buffers of commits whose fence could not be waited on.
+  std::vector<const OverlayBuffer*> pending_buffers_;
   DisplayQueue_old* display_queue_;
 };
 
@@ -0,0 +1,282 @@
+/*
+// Copyright (c) 2017 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+#include "layercapture.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <hwclayer.h>
+#include <spinlock.h>
+
+#include <algorithm>
+#include <map>
+#include <tuple>
+
+#include "hwctrace.h"
+#include "overlaybuffer.h"
+#include "overlaylayer.h"
+
+namespace hwcomposer {
+
+namespace {
+
+struct Slot {
+  LayerCapture::Frame frame;
+  std::vector<LayerCapture::Layer> layers;
+};
+
+// A GEM handle is only unique while its buffer is alive, so a freed buffer's
+// handle can come back for a different one; the size and format tell most
+// such reuses apart.
+struct BufferKey {
+  uint32_t gem_handle;
+  uint32_t width;
+  uint32_t height;
+  uint32_t format;
+
+  bool operator<(const BufferKey& rhs) const {
+    return std::tie(gem_handle, width, height, format) <
+           std::tie(rhs.gem_handle, rhs.width, rhs.height, rhs.format);
+  }
+};
+
+struct BufferId {
+  uint32_t id;
+  uint64_t last_slot;  // next_ when it was last presented.
+};
+
+// Everything below is only touched with lock_ held. Slots keep their layer
+// vectors across frames, so recording stops allocating once the ring has
+// gone round.
+SpinLock lock_;
+std::vector<Slot> ring_;
+uint64_t next_ = 0;
+std::map<BufferKey, BufferId> buffer_ids_;
+uint32_t next_buffer_id_ = 1;
+uint64_t next_sweep_ = 0;
+
+uint32_t GetBufferId(const OverlayBuffer* buffer) {
+  if (!buffer || !buffer->GetGemHandle())
+    return 0;
+
+  const BufferKey key = {buffer->GetGemHandle(), buffer->GetWidth(),
+                         buffer->GetHeight(), buffer->GetFormat()};
+  std::map<BufferKey, BufferId>::iterator it = buffer_ids_.find(key);
+  if (it == buffer_ids_.end()) {
+    const BufferId id = {next_buffer_id_++, next_};
+    it = buffer_ids_.emplace(key, id).first;
+  }
+  it->second.last_slot = next_;
+  return it->second.id;
+}
+
+// Forgets the buffers that no frame in the ring shows. They may have been
+// freed, and no record left refers to their ids. Runs once per trip round
+// the ring, so the map holds at most two rings' worth of buffers.
+void SweepBufferIds() {
+  if (next_ < next_sweep_)
+    return;
+  next_sweep_ = next_ + ring_.size();
+  for (std::map<BufferKey, BufferId>::iterator it = buffer_ids_.begin();
+       it != buffer_ids_.end();) {
+    if (it->second.last_slot + ring_.size() < next_)
+      it = buffer_ids_.erase(it);
+    else
+      ++it;
+  }
+}
+
+Slot& NextSlot(uint32_t display, uint32_t frame, int64_t timestamp,
+               uint8_t flags) {
+  Slot& slot = ring_[next_++ % ring_.size()];
+  slot.frame.timestamp = timestamp;
+  slot.frame.frame = frame;
+  slot.frame.num_layers = 0;
+  slot.frame.display = display;
+  slot.frame.flags = flags;
+  slot.layers.clear();
+  return slot;
+}
+
+}  // namespace
+
+std::atomic<bool> LayerCapture::enabled_(false);
+const char LayerCapture::kMagic[8] = "HWCLCAP";
+
+void LayerCapture::Enable(uint32_t frames) {
+  ScopedSpinLock lock(lock_);
+  std::vector<Slot>(frames ? frames : 1).swap(ring_);
+  next_ = 0;
+  buffer_ids_.clear();
+  next_buffer_id_ = 1;
+  next_sweep_ = 0;
+  enabled_.store(true, std::memory_order_relaxed);
+  ITRACE("LayerCapture: recording the last %u frames", uint32_t(ring_.size()));
+}
+
+void LayerCapture::Disable() {
+  enabled_.store(false, std::memory_order_relaxed);
+}
+
+void LayerCapture::Add(uint32_t display, uint32_t frame, int64_t timestamp,
+                       const std::vector<HwcLayer*>& source_layers,
+                       const std::vector<OverlayLayer>& layers) {
+  ScopedSpinLock lock(lock_);
+  if (ring_.empty())
+    return;
+
+  SweepBufferIds();
+  Slot& slot = NextSlot(display, frame, timestamp, 0);
+  const size_t count = std::min<size_t>(layers.size(), UINT16_MAX);
+  slot.frame.num_layers = count;
+  slot.layers.resize(count);
+  for (size_t i = 0; i < count; i++) {
+    const HwcLayer* source = source_layers[i];
+    const OverlayLayer& overlay = layers[i];
+    Layer& layer = slot.layers[i];
+    memset(&layer, 0, sizeof(layer));
+
+    const OverlayBuffer* buffer = overlay.GetBuffer();
+    layer.buffer = GetBufferId(buffer);
+    if (buffer) {
+      layer.width = buffer->GetWidth();
+      layer.height = buffer->GetHeight();
+      layer.format = buffer->GetFormat();
+    }
+    layer.transform = source->GetTransform();
+    for (int j = 0; j < 4; j++) {
+      layer.source_crop[j] = source->GetSourceCrop().bounds[j];
+      layer.display_frame[j] = source->GetDisplayFrame().bounds[j];
+    }
+
+    const HwcRegion& damage = source->GetSurfaceDamage();
+    layer.damage_rects = std::min<uint32_t>(damage.kNumRects, UINT16_MAX);
+    for (uint32_t j = 0; j < damage.kNumRects; j++) {
+      const HwcRect<int>& rect = damage.kRects[j];
+      if (j == 0) {
+        for (int k = 0; k < 4; k++)
+          layer.damage[k] = rect.bounds[k];
+        continue;
+      }
+      layer.damage[0] = std::min(layer.damage[0], rect.left);
+      layer.damage[1] = std::min(layer.damage[1], rect.top);
+      layer.damage[2] = std::max(layer.damage[2], rect.right);
+      layer.damage[3] = std::max(layer.damage[3], rect.bottom);
+    }
+
+    layer.blending = static_cast<uint16_t>(source->GetBlending());
+    layer.alpha = source->GetAlpha();
+  }
+}
+
+void LayerCapture::AddUnchanged(uint32_t display, uint32_t frame,
+                                int64_t timestamp) {
+  ScopedSpinLock lock(lock_);
+  if (!ring_.empty())
+    NextSlot(display, frame, timestamp, kUnchanged);
+}
+
+bool LayerCapture::Save(const char* path) {
+  FileHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, kMagic, sizeof(header.magic));
+  header.version = kVersion;
+  header.frame_size = sizeof(Frame);
+  header.layer_size = sizeof(Layer);
+
+  // Copied out first, so that presenting never waits on the file.
+  std::vector<Frame> frames;
+  std::vector<Layer> layers;
+  {
+    ScopedSpinLock lock(lock_);
+    const uint64_t size = ring_.size();
+    const uint64_t begin = next_ > size ? next_ - size : 0;
+    header.dropped = begin;
+    frames.reserve(next_ - begin);
+    for (uint64_t i = begin; i < next_; i++) {
+      const Slot& slot = ring_[i % size];
+      frames.push_back(slot.frame);
+      layers.insert(layers.end(), slot.layers.begin(), slot.layers.end());
+    }
+  }
+  header.frames = frames.size();
+
+  FILE* file = fopen(path, "wb");
+  if (!file) {
+    ETRACE("LayerCapture: Failed to open %s %s", path, PRINTERROR());
+    return false;
+  }
+  bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+  const Layer* frame_layers = layers.data();
+  for (const Frame& frame : frames) {
+    if (!ok)
+      break;
+    ok = fwrite(&frame, sizeof(frame), 1, file) == 1;
+    if (ok && frame.num_layers)
+      ok = fwrite(frame_layers, sizeof(Layer), frame.num_layers, file) ==
+           frame.num_layers;
+    frame_layers += frame.num_layers;
+  }
+  ok = (fclose(file) == 0) && ok;
+  if (!ok) {
+    ETRACE("LayerCapture: Failed to write %s", path);
+    return false;
+  }
+  ITRACE("LayerCapture: Saved %zu frames to %s", frames.size(), path);
+  return true;
+}
+
+bool LayerCapture::Load(const char* path, FileHeader& header,
+                        std::vector<Frame>& frames,
+                        std::vector<Layer>& layers) {
+  frames.clear();
+  layers.clear();
+  FILE* file = fopen(path, "rb");
+  if (!file) {
+    ETRACE("LayerCapture: Failed to open %s %s", path, PRINTERROR());
+    return false;
+  }
+
+  bool ok = fread(&header, sizeof(header), 1, file) == 1 &&
+            memcmp(header.magic, kMagic, sizeof(header.magic)) == 0 &&
+            header.version == kVersion && header.frame_size == sizeof(Frame) &&
+            header.layer_size == sizeof(Layer);
+  if (!ok) {
+    ETRACE("LayerCapture: %s is not a version %u capture", path, kVersion);
+    fclose(file);
+    return false;
+  }
+
+  for (uint64_t i = 0; ok && i < header.frames; i++) {
+    Frame frame;
+    ok = fread(&frame, sizeof(frame), 1, file) == 1;
+    if (!ok)
+      break;
+    frames.push_back(frame);
+    const size_t first = layers.size();
+    layers.resize(first + frame.num_layers);
+    ok = !frame.num_layers ||
+         fread(&layers[first], sizeof(Layer), frame.num_layers, file) ==
+             frame.num_layers;
+  }
+  if (!ok)
+    ETRACE("LayerCapture: %s is truncated", path);
+  fclose(file);
+  return ok;
+}
+
+}  // namespace hwcomposer
@@ -0,0 +1,118 @@
+/*
+// Copyright (c) 2017 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+#ifndef COMMON_DISPLAY_LAYERCAPTURE_H_
+#define COMMON_DISPLAY_LAYERCAPTURE_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <vector>
+
+namespace hwcomposer {
+
+struct HwcLayer;
+struct OverlayLayer;
+
+// Records the layer stacks presented to each display, so that a device's
+// frames can be replayed offline against plane allocation and composition
+// (tests/apps/layerreplay.cpp). Each frame is a fixed size record followed
+// by one record per layer with its geometry, buffer size and format,
+// transform, blending, damage and an id that is the same for every frame
+// showing the same buffer. Buffers are told apart by GEM handle, size and
+// format; one not presented for as many frames as the ring holds is
+// forgotten, as it may have been freed and its handle reused, and gets a new
+// id if it comes back. The last frames are kept in a ring in memory and
+// written out by Save().
+//
+// While disabled each frame costs one load and one branch. Enable with the
+// layercapture option (the ring size in frames); the capture is written to
+// the layercapturefile option's path when the HWC is dumped or shut down.
+class LayerCapture {
+ public:
+  enum FrameFlags : uint8_t {
+    // Same layers as the display's previous frame; no layer records follow.
+    kUnchanged = 1 << 0,
+  };
+
+  struct Frame {
+    int64_t timestamp;  // CLOCK_MONOTONIC, ns.
+    uint32_t frame;
+    uint16_t num_layers;
+    uint8_t display;
+    uint8_t flags;
+  };
+
+  struct Layer {
+    // Numbered in order of first use, from 1; 0 if the buffer could not be
+    // imported. Unique within a capture.
+    uint32_t buffer;
+    uint32_t width;
+    uint32_t height;
+    uint32_t format;
+    uint32_t transform;
+    float source_crop[4];    // left, top, right, bottom
+    int32_t display_frame[4];
+    int32_t damage[4];       // Bounds of the surface damage.
+    uint16_t damage_rects;
+    uint16_t blending;
+    uint8_t alpha;
+    uint8_t reserved[3];
+  };
+
+  // Save() writes this followed by frames Frame records, oldest first, each
+  // followed by its layers.
+  struct FileHeader {
+    char magic[8];  // kMagic
+    uint32_t version;
+    uint16_t frame_size;
+    uint16_t layer_size;
+    uint64_t frames;
+    uint64_t dropped;  // Overwritten before they were saved.
+  };
+
+  static const char kMagic[8];
+  static const uint32_t kVersion = 1;
+
+  static bool IsEnabled() {
+    return enabled_.load(std::memory_order_relaxed);
+  }
+
+  // Starts recording the last frames frames, forgetting any earlier ones.
+  static void Enable(uint32_t frames);
+  static void Disable();
+
+  // Records the layers presented as frame on display. layers are the
+  // OverlayLayers made from source_layers, with their buffers imported.
+  static void Add(uint32_t display, uint32_t frame, int64_t timestamp,
+                  const std::vector<HwcLayer*>& source_layers,
+                  const std::vector<OverlayLayer>& layers);
+  static void AddUnchanged(uint32_t display, uint32_t frame,
+                           int64_t timestamp);
+
+  static bool Save(const char* path);
+
+  // Reads a capture written by Save(). layers holds the layers of all the
+  // frames, in order.
+  static bool Load(const char* path, FileHeader& header,
+                   std::vector<Frame>& frames, std::vector<Layer>& layers);
+
+ private:
+  static std::atomic<bool> enabled_;
+};
+
+}  // namespace hwcomposer
+#endif  // COMMON_DISPLAY_LAYERCAPTURE_H_
@@ -516,7 +516,7 @@ int PhysicalDisplay::onGetDisplayConfigs( uint32_t* paConfigHandles, uint32_t* p
         return BAD_VALUE;
 
     DTRACEIF( PHYDISP_DEBUG || MODE_DEBUG,
-              "PhysicalDisplay::onGetDisplayConfigs paConfigHandles %p, pNumConfigs %p/%zd",
+              "PhysicalDisplay::onGetDisplayConfigs paConfigHandles %p, pNumConfigs %p/%u",
               paConfigHandles, pNumConfigs, *pNumConfigs );
 
     // configs are returned if num configs is non-zero on entry.
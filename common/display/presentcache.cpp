@@ -0,0 +1,104 @@
+/*
+// Copyright (c) 2017 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+#include "presentcache.h"
+
+#include <unistd.h>
+
+namespace hwcomposer {
+
+static int DupFence(int fence) {
+  return fence > 0 ? dup(fence) : -1;
+}
+
+bool PresentCache::Reuse(std::vector<HwcLayer*>& layers, bool needs_modeset,
+                         bool needs_color_correction, int32_t* retire_fence) {
+  // A modeset or a new LUT changes the screen even if the layers do not.
+  if (!needs_modeset && !needs_color_correction && IsUnchanged(layers)) {
+    ReturnPreviousFences(layers, retire_fence);
+    return true;
+  }
+
+  Invalidate();
+  return false;
+}
+
+bool PresentCache::IsUnchanged(const std::vector<HwcLayer*>& layers) const {
+  if (!valid_ || layers.size() != layers_.size())
+    return false;
+
+  for (size_t i = 0; i < layers.size(); i++) {
+    const HwcLayer* layer = layers[i];
+    const PresentedLayer& previous = layers_[i];
+    // A new acquire fence or damage means the buffer has been rendered to
+    // again, even if it is the same buffer.
+    if (layer->acquire_fence.get() > 0 ||
+        layer->GetSurfaceDamage().kNumRects > 0)
+      return false;
+
+    if (layer->GetNativeHandle() != previous.handle ||
+        layer->GetTransform() != previous.transform ||
+        layer->GetAlpha() != previous.alpha ||
+        layer->GetBlending() != previous.blending ||
+        layer->GetSourceCrop() != previous.source_crop ||
+        layer->GetDisplayFrame() != previous.display_frame)
+      return false;
+  }
+
+  return true;
+}
+
+void PresentCache::ReturnPreviousFences(std::vector<HwcLayer*>& layers,
+                                        int32_t* retire_fence) const {
+  // The buffers are still on screen from the recorded frame, so its release
+  // fences are the right ones to hand out again.
+  for (size_t i = 0; i < layers.size(); i++)
+    layers[i]->release_fence.Reset(DupFence(layers_[i].release_fence.get()));
+
+  if (retire_fence_.get() > 0)
+    *retire_fence = dup(retire_fence_.get());
+
+  reused_count_++;
+}
+
+void PresentCache::Update(const std::vector<HwcLayer*>& layers,
+                          const std::vector<int>& release_fences,
+                          int32_t retire_fence) {
+  layers_.resize(layers.size());
+  for (size_t i = 0; i < layers.size(); i++) {
+    const HwcLayer* layer = layers[i];
+    PresentedLayer& presented = layers_[i];
+    presented.handle = layer->GetNativeHandle();
+    presented.transform = layer->GetTransform();
+    presented.alpha = layer->GetAlpha();
+    presented.blending = layer->GetBlending();
+    presented.source_crop = layer->GetSourceCrop();
+    presented.display_frame = layer->GetDisplayFrame();
+    presented.release_fence.Reset(
+        i < release_fences.size() ? DupFence(release_fences[i]) : -1);
+  }
+
+  retire_fence_.Reset(DupFence(retire_fence));
+  valid_ = true;
+}
+
+void PresentCache::Invalidate() {
+  valid_ = false;
+  layers_.clear();
+  retire_fence_.Reset(-1);
+}
+
+}  // namespace hwcomposer
@@ -0,0 +1,89 @@
+/*
+// Copyright (c) 2017 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+#ifndef COMMON_DISPLAY_PRESENTCACHE_H_
+#define COMMON_DISPLAY_PRESENTCACHE_H_
+
+#include <stdint.h>
+
+#include <hwcdefs.h>
+#include <hwclayer.h>
+#include <platformdefines.h>
+#include <scopedfd.h>
+
+#include <vector>
+
+namespace hwcomposer {
+
+// Remembers the layer stack of the last frame committed to a display, so a
+// present that would not change anything on screen (same buffers, same
+// geometry, no new rendering) can be answered with the previous frame's
+// fences instead of a new composition and commit.
+class PresentCache {
+ public:
+  PresentCache() = default;
+  PresentCache(const PresentCache& rhs) = delete;
+  PresentCache& operator=(const PresentCache& rhs) = delete;
+
+  // The present-skip decision of DisplayQueue_old::QueueUpdate. If no
+  // modeset or colour correction is pending and layers match the last
+  // recorded frame, returns the previous fences and true. Otherwise forgets
+  // the recorded frame and returns false, so the present is committed.
+  bool Reuse(std::vector<HwcLayer*>& layers, bool needs_modeset,
+             bool needs_color_correction, int32_t* retire_fence);
+
+  // Returns true if layers matches the last recorded frame.
+  bool IsUnchanged(const std::vector<HwcLayer*>& layers) const;
+
+  // Give every layer a duplicate of the release fence it was given for the
+  // recorded frame, and set *retire_fence to a duplicate of the recorded
+  // retire fence if there was one. Only valid if IsUnchanged() returned true.
+  void ReturnPreviousFences(std::vector<HwcLayer*>& layers,
+                            int32_t* retire_fence) const;
+
+  // Record a committed frame. release_fences[i] is the release fence handed
+  // to layers[i] and retire_fence is the frame's retire fence, or -1. The
+  // fences are duplicated; the caller keeps ownership.
+  void Update(const std::vector<HwcLayer*>& layers,
+              const std::vector<int>& release_fences, int32_t retire_fence);
+
+  // Forget the recorded frame, so the next present is committed.
+  void Invalidate();
+
+  // Number of presents answered from the cache.
+  uint64_t GetReusedCount() const {
+    return reused_count_;
+  }
+
+ private:
+  struct PresentedLayer {
+    HWCNativeHandle handle;
+    uint32_t transform;
+    uint8_t alpha;
+    HWCBlending blending;
+    HwcRect<float> source_crop;
+    HwcRect<int> display_frame;
+    ScopedFd release_fence;
+  };
+
+  std::vector<PresentedLayer> layers_;
+  ScopedFd retire_fence_;
+  bool valid_ = false;
+  mutable uint64_t reused_count_ = 0;
+};
+
+}  // namespace hwcomposer
+#endif  // COMMON_DISPLAY_PRESENTCACHE_H_
@@ -41,10 +41,27 @@ public:
     // TODO: Make pure virtual (as required for strict Abstract class).
     virtual bool outputsPhysicalDisplays() const { return false; } // = 0;
 
+    // What the output of a filter depends on.
+    enum EDependency
+    {
+        DEPENDS_ON_GEOMETRY = (1<<0),   // Layer lists and layer geometry, changes to these are flagged as geometry changes.
+        DEPENDS_ON_BUFFERS  = (1<<1),   // Buffer handles or buffer contents.
+        DEPENDS_ON_STATE    = (1<<2),   // Anything else, eg options, timers or frame rates.
+    };
+
+    // Returns the EDependency flags of this filter. The default has onApply called every frame.
+    // A filter that only depends on DEPENDS_ON_GEOMETRY should implement onUpdateFrameState.
+    virtual uint32_t getDependencies() const { return DEPENDS_ON_STATE; }
+
     // This is called at the hwc prepare entrypoint. Each filter may choose to change the
     // layer list in some way
     virtual const Content& onApply(const Content& ref) = 0;
 
+    // Called instead of onApply when nothing this filter depends on has changed since the last
+    // onApply, so ref has the same layers with new buffers and fences. The filter returns its last
+    // output with the frame state of ref.
+    virtual const Content& onUpdateFrameState(const Content& ref) { return onApply(ref); }
+
     // Called once displays are ready but before first frame(s).
     // This provides the filter with the context (Hwc) if it is required and
     // also gives the filter opportunity to run one-time initialization.
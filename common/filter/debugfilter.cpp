@@ -49,6 +49,14 @@ const Content& DebugFilter::onApply(const Content& ref)
     // Run through each display
     for (uint32_t d = 0; d < ref.size() && d < mDebugDisplay.size(); d++)
     {
+        // Leave displays with nothing to do shared with the input.
+        const DisplayDebug& debug = mDebugDisplay[d];
+        if ( !debug.mbGeometryChange && !debug.mbDisableDisplay && !debug.mbBlankDisplay
+          && ( debug.mMask == 0 ) && ( debug.mDumpFrames == 0 ) )
+        {
+            continue;
+        }
+
         Content::Display& display = mReference.editDisplay(d);
 
         // If anything changed since last frame, propagate a geometry change through the stack
@@ -43,8 +43,21 @@ const Content& FilterManager::onApply(const Content& ref, FilterPosition first,
         if (last < mFilters[f].mPosition)
             break;
 
-        AbstractFilter* pFilter = mFilters[f].mpFilter;
-        const Content* pNewRef = &pFilter->onApply(*pRef);
+        Entry& entry = mFilters[f];
+        AbstractFilter* pFilter = entry.mpFilter;
+        const Content* pNewRef;
+        if ( isDependencyChanged( entry, *pRef ) )
+        {
+            pNewRef = &pFilter->onApply(*pRef);
+            entry.mbApplied = true;
+            mApplied++;
+        }
+        else
+        {
+            // Same layers as last time, only buffers and fences moved.
+            pNewRef = &pFilter->onUpdateFrameState(*pRef);
+            mUpdated++;
+        }
 
 #if INTEL_HWC_INTERNAL_BUILD
         validateGeometryChange( HWCString::format( "F%d %s%s",
@@ -71,9 +84,37 @@ const Content& FilterManager::onApply(const Content& ref, FilterPosition first,
     return *pRef;
 }
 
-int FilterManager::compareFilterPositions( const FilterManager::Entry* lhs, const FilterManager::Entry* rhs )
+bool FilterManager::isDependencyChanged(Entry& entry, const Content& ref)
 {
-    return static_cast<uint32_t>(lhs->mPosition) - static_cast<uint32_t>(rhs->mPosition);
+    bool bChanged = !entry.mbApplied
+                 || ( entry.mpFilter->getDependencies() & ~AbstractFilter::DEPENDS_ON_GEOMETRY )
+                 || ( entry.mInput.size() != ref.size() );
+
+    // Displays turning on or off, resizing or gaining layers are not always flagged as
+    // geometry changes, so check those too.
+    entry.mInput.resize( ref.size() );
+    for ( uint32_t d = 0; d < ref.size(); d++ )
+    {
+        const Content::Display& display = ref.getDisplay(d);
+        DisplayGeometry& last = entry.mInput[d];
+        if ( display.isEnabled() )
+        {
+            bChanged |= display.isGeometryChanged()
+                     || !last.mbEnabled
+                     || ( last.mNumLayers != display.getNumLayers() )
+                     || ( last.mWidth != display.getWidth() )
+                     || ( last.mHeight != display.getHeight() );
+        }
+        else
+        {
+            bChanged |= last.mbEnabled;
+        }
+        last.mbEnabled = display.isEnabled();
+        last.mNumLayers = display.getNumLayers();
+        last.mWidth = display.getWidth();
+        last.mHeight = display.getHeight();
+    }
+    return bChanged;
 }
 
 void FilterManager::add(AbstractFilter& filter, FilterPosition position)
@@ -87,9 +128,14 @@ void FilterManager::add(AbstractFilter& filter, FilterPosition position)
     LOG_FATAL_IF( ( position >= FilterPosition::DisplayManager ) && !filter.outputsPhysicalDisplays( ),
                   "Filters >= FilterPosition::DisplayManager must be in PHY display space [POS:%u PHY:%d v GS:%u]",
                   position, filter.outputsPhysicalDisplays( ), FilterPosition::DisplayManager );
-    mFilters.add(e);
-    mFilters.sort( compareFilterPositions );
 #endif
+    // Keep the list in position order, after any filters already at this position.
+    auto pos = mFilters.begin();
+    while ( ( pos != mFilters.end() ) && !( position < pos->mPosition ) )
+    {
+        ++pos;
+    }
+    mFilters.insert( pos, e );
     mLock.unlock();
 }
 
@@ -103,9 +149,7 @@ void FilterManager::remove(AbstractFilter& filter)
         if (mFilters[f].mpFilter == &filter)
         {
             DTRACEIF(FILTER_DEBUG, "Filter:%d %s(%p) Removing", f, mFilters[f].mpFilter->getName(), &mFilters[f].mpFilter);
-#ifdef uncomment
-            mFilters.removeAt(f);
-#endif
+            mFilters.erase( mFilters.begin() + f );
             break;
         }
     }
@@ -128,8 +172,8 @@ HWCString FilterManager::dump()
     if (!sbInternalBuild)
         return HWCString();
 
-    HWCString output;
     mLock.lock();
+    HWCString output = HWCString::format("Filters applied %u, updated %u\n", mApplied, mUpdated);
     for (const Entry& f : mFilters)
     {
         DTRACEIF(FILTER_DEBUG, "dumping filter %s", f.mpFilter->getName());
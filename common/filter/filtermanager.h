@@ -58,21 +58,37 @@ public:
 
 private:
     friend class Singleton<FilterManager>;
+    FilterManager() : mApplied(0), mUpdated(0) {}
     std::mutex                   mLock;
 
+    // The parts of each input display that are not flagged as a geometry change.
+    struct DisplayGeometry
+    {
+        bool        mbEnabled;
+        uint32_t    mNumLayers;
+        uint32_t    mWidth;
+        uint32_t    mHeight;
+    };
+
     class Entry
     {
     public:
-        Entry() : mpFilter(NULL), mPosition(FilterPosition::Invalid) {}
-        Entry(AbstractFilter& filter, FilterPosition position) : mpFilter(&filter), mPosition(position) {}
+        Entry() : mpFilter(NULL), mPosition(FilterPosition::Invalid), mbApplied(false) {}
+        Entry(AbstractFilter& filter, FilterPosition position) : mpFilter(&filter), mPosition(position), mbApplied(false) {}
         AbstractFilter* mpFilter;
         FilterPosition  mPosition;
+        bool            mbApplied;          // onApply has been called, mInput describes its input
+        std::vector<DisplayGeometry> mInput;
     };
 
+    // Returns true if the filter's dependencies changed since its last onApply, and records the geometry of ref.
+    static bool             isDependencyChanged(Entry& entry, const Content& ref);
+
     std::vector<Entry> mFilters;
 
-    // Sorting comparison function.
-    static int compareFilterPositions( const FilterManager::Entry* lhs, const FilterManager::Entry* rhs );
+    // Filters applied and updated since startup.
+    uint32_t                mApplied;
+    uint32_t                mUpdated;
 
 #if INTEL_HWC_INTERNAL_BUILD
     // Previous frame content.
@@ -32,10 +32,13 @@ public:
     virtual ~Rotate180Filter();
 
     const char* getName() const { return "Rotate180Filter"; }
+    uint32_t getDependencies() const { return DEPENDS_ON_GEOMETRY; }
     const Content& onApply(const Content& ref);
+    const Content& onUpdateFrameState(const Content& ref);
     HWCString dump();
 private:
     Option              mOptionRotate180;
+    int32_t             mRotated;               // Displays rotated by the last onApply
     Content             mContent;
     std::vector<Layer>  mLayers[cMaxSupportedSFDisplays];
 };
@@ -44,7 +47,8 @@ private:
 Rotate180Filter gRotate180Filter;
 
 Rotate180Filter::Rotate180Filter() :
-    mOptionRotate180( "rotate180", 0, false )
+    mOptionRotate180( "rotate180", 0, false ),
+    mRotated( 0 )
 {
     // If the status control actually exists
     if (mOptionRotate180 != 0) {
@@ -61,15 +65,24 @@ Rotate180Filter::~Rotate180Filter()
 
 const Content& Rotate180Filter::onApply(const Content& ref)
 {
+    // The option is not a geometry change to anything before us, but is one to what follows.
+    const int32_t toggled = mRotated ^ mOptionRotate180;
+    mRotated = mOptionRotate180;
     mContent = ref;
     for (uint32_t d = 0; d < ref.size() && d < cMaxSupportedSFDisplays; d++)
     {
-        Content::Display& display = mContent.editDisplay(d);
-        if ( !display.isEnabled() )
+        if ( !ref.getDisplay(d).isEnabled() )
             continue;
 
+        if (toggled & (1<<d))
+        {
+            mContent.editDisplay(d).setGeometryChanged(true);
+        }
+
         if (mOptionRotate180 & (1<<d))
         {
+            // Displays that are not rotated stay shared with the input.
+            Content::Display& display = mContent.editDisplay(d);
             Content::LayerStack& layerStack = display.editLayerStack();
             mLayers[d].resize(layerStack.size());
             for (uint32_t ly = 0; ly < layerStack.size(); ++ly)
@@ -100,6 +113,33 @@ const Content& Rotate180Filter::onApply(const Content& ref)
     return mContent;
 }
 
+const Content& Rotate180Filter::onUpdateFrameState(const Content& ref)
+{
+    if (mOptionRotate180 != mRotated)
+    {
+        return onApply(ref);
+    }
+
+    // Our rotated copies only need the new buffers.
+    mContent = ref;
+    for (uint32_t d = 0; d < ref.size() && d < cMaxSupportedSFDisplays; d++)
+    {
+        if ( !ref.getDisplay(d).isEnabled() || !(mRotated & (1<<d)) )
+            continue;
+
+        const Content::LayerStack& refStack = ref.getDisplay(d).getLayerStack();
+        Content::LayerStack& layerStack = mContent.editDisplay(d).editLayerStack();
+        for (uint32_t ly = 0; ly < layerStack.size(); ++ly)
+        {
+            Layer& layer = mLayers[d][ly];
+            layer.onUpdateFrameState(refStack.getLayer(ly));
+            layerStack.setLayer(ly, &layer);
+        }
+    }
+
+    return mContent;
+}
+
 HWCString Rotate180Filter::dump()
 {
     HWCString output;
@@ -0,0 +1,221 @@
+/*
+// Copyright (c) 2017 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+#include "transparencydetector.h"
+#include "hwctrace.h"
+
+#include <algorithm>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define TRANSPARENCY_DETECTOR_SSE2 1
+#endif
+
+#if defined(__GNUC__) && ( defined(__x86_64__) || defined(__i386__) )
+#include <immintrin.h>
+#define TRANSPARENCY_DETECTOR_AVX2 1
+#endif
+
+namespace hwcomposer {
+
+#define TRANSPARENCY_DETECTOR_DEBUG 0
+
+static bool checkRowScalar(const uint32_t* pRow, uint32_t count, uint32_t color1, uint32_t color2)
+{
+    for (uint32_t x = 0; x < count; x++)
+    {
+        if (pRow[x] != color1 && pRow[x] != color2)
+            return false;
+    }
+    return true;
+}
+
+#if TRANSPARENCY_DETECTOR_SSE2
+static bool checkRowSSE2(const uint32_t* pRow, uint32_t count, uint32_t color1, uint32_t color2)
+{
+    const __m128i c1 = _mm_set1_epi32(color1);
+    const __m128i c2 = _mm_set1_epi32(color2);
+    uint32_t x = 0;
+    // 16 pixels per iteration, bailing out as soon as any lane misses both colors.
+    for (; x + 16 <= count; x += 16)
+    {
+        const __m128i p0 = _mm_loadu_si128((const __m128i*)(pRow + x));
+        const __m128i p1 = _mm_loadu_si128((const __m128i*)(pRow + x + 4));
+        const __m128i p2 = _mm_loadu_si128((const __m128i*)(pRow + x + 8));
+        const __m128i p3 = _mm_loadu_si128((const __m128i*)(pRow + x + 12));
+        const __m128i m0 = _mm_or_si128(_mm_cmpeq_epi32(p0, c1), _mm_cmpeq_epi32(p0, c2));
+        const __m128i m1 = _mm_or_si128(_mm_cmpeq_epi32(p1, c1), _mm_cmpeq_epi32(p1, c2));
+        const __m128i m2 = _mm_or_si128(_mm_cmpeq_epi32(p2, c1), _mm_cmpeq_epi32(p2, c2));
+        const __m128i m3 = _mm_or_si128(_mm_cmpeq_epi32(p3, c1), _mm_cmpeq_epi32(p3, c2));
+        const __m128i m = _mm_and_si128(_mm_and_si128(m0, m1), _mm_and_si128(m2, m3));
+        if (_mm_movemask_epi8(m) != 0xFFFF)
+            return false;
+    }
+    for (; x + 4 <= count; x += 4)
+    {
+        const __m128i p = _mm_loadu_si128((const __m128i*)(pRow + x));
+        const __m128i m = _mm_or_si128(_mm_cmpeq_epi32(p, c1), _mm_cmpeq_epi32(p, c2));
+        if (_mm_movemask_epi8(m) != 0xFFFF)
+            return false;
+    }
+    return checkRowScalar(pRow + x, count - x, color1, color2);
+}
+#endif
+
+#if TRANSPARENCY_DETECTOR_AVX2
+__attribute__((target("avx2")))
+static bool checkRowAVX2(const uint32_t* pRow, uint32_t count, uint32_t color1, uint32_t color2)
+{
+    const __m256i c1 = _mm256_set1_epi32(color1);
+    const __m256i c2 = _mm256_set1_epi32(color2);
+    uint32_t x = 0;
+    // 32 pixels per iteration, bailing out as soon as any lane misses both colors.
+    for (; x + 32 <= count; x += 32)
+    {
+        const __m256i p0 = _mm256_loadu_si256((const __m256i*)(pRow + x));
+        const __m256i p1 = _mm256_loadu_si256((const __m256i*)(pRow + x + 8));
+        const __m256i p2 = _mm256_loadu_si256((const __m256i*)(pRow + x + 16));
+        const __m256i p3 = _mm256_loadu_si256((const __m256i*)(pRow + x + 24));
+        const __m256i m0 = _mm256_or_si256(_mm256_cmpeq_epi32(p0, c1), _mm256_cmpeq_epi32(p0, c2));
+        const __m256i m1 = _mm256_or_si256(_mm256_cmpeq_epi32(p1, c1), _mm256_cmpeq_epi32(p1, c2));
+        const __m256i m2 = _mm256_or_si256(_mm256_cmpeq_epi32(p2, c1), _mm256_cmpeq_epi32(p2, c2));
+        const __m256i m3 = _mm256_or_si256(_mm256_cmpeq_epi32(p3, c1), _mm256_cmpeq_epi32(p3, c2));
+        const __m256i m = _mm256_and_si256(_mm256_and_si256(m0, m1), _mm256_and_si256(m2, m3));
+        if (_mm256_movemask_epi8(m) != -1)
+            return false;
+    }
+    for (; x + 8 <= count; x += 8)
+    {
+        const __m256i p = _mm256_loadu_si256((const __m256i*)(pRow + x));
+        const __m256i m = _mm256_or_si256(_mm256_cmpeq_epi32(p, c1), _mm256_cmpeq_epi32(p, c2));
+        if (_mm256_movemask_epi8(m) != -1)
+            return false;
+    }
+    return checkRowScalar(pRow + x, count - x, color1, color2);
+}
+#endif
+
+bool TransparencyDetector::isAvailable(EImplementation impl)
+{
+    switch (impl)
+    {
+        case IMPL_AUTO:
+        case IMPL_SCALAR:
+            return true;
+        case IMPL_SSE2:
+#if TRANSPARENCY_DETECTOR_SSE2
+            return true;
+#else
+            return false;
+#endif
+        case IMPL_AVX2:
+#if TRANSPARENCY_DETECTOR_AVX2
+            return __builtin_cpu_supports("avx2");
+#else
+            return false;
+#endif
+    }
+    return false;
+}
+
+TransparencyDetector::TransparencyDetector(EImplementation impl) :
+    mImplementation(IMPL_SCALAR),
+    mpfnCheckRow(checkRowScalar)
+{
+    if (impl == IMPL_AUTO)
+    {
+        impl = isAvailable(IMPL_AVX2) ? IMPL_AVX2 : isAvailable(IMPL_SSE2) ? IMPL_SSE2 : IMPL_SCALAR;
+    }
+    else if (!isAvailable(impl))
+    {
+        DTRACEIF(TRANSPARENCY_DETECTOR_DEBUG, "TransparencyDetector: implementation %d not available", impl);
+        impl = IMPL_SCALAR;
+    }
+
+#if TRANSPARENCY_DETECTOR_SSE2
+    if (impl == IMPL_SSE2)
+    {
+        mImplementation = IMPL_SSE2;
+        mpfnCheckRow = checkRowSSE2;
+    }
+#endif
+#if TRANSPARENCY_DETECTOR_AVX2
+    if (impl == IMPL_AVX2)
+    {
+        mImplementation = IMPL_AVX2;
+        mpfnCheckRow = checkRowAVX2;
+    }
+#endif
+}
+
+const char* TransparencyDetector::getName() const
+{
+    switch (mImplementation)
+    {
+        case IMPL_SSE2:     return "SSE2";
+        case IMPL_AVX2:     return "AVX2";
+        default:            return "scalar";
+    }
+}
+
+bool TransparencyDetector::checkRegion(uint32_t color1, uint32_t color2, const uint32_t* pBuffer, uint32_t strideInPixels,
+                                       uint32_t x1, uint32_t y1, uint32_t x2, uint32_t y2, uint32_t rowStep) const
+{
+    if (x1 >= x2)
+        return true;
+
+    for (uint32_t y = y1; y < y2; y += rowStep)
+    {
+        if (!mpfnCheckRow(pBuffer + y * strideInPixels + x1, x2 - x1, color1, color2))
+        {
+            DTRACEIF(TRANSPARENCY_DETECTOR_DEBUG, "TransparencyDetector: checkRegion %d, %d, %d, %d Failed on row %d", x1, y1, x2, y2, y);
+            return false;
+        }
+    }
+    return true;
+}
+
+static inline uint32_t clampToRange(int v, uint32_t limit)
+{
+    return v < 0 ? 0 : ( uint32_t(v) > limit ? limit : uint32_t(v) );
+}
+
+bool TransparencyDetector::detect(const uint32_t* pBuffer, uint32_t w, uint32_t h, uint32_t strideInPixels,
+                                  const HwcRect<int>& mask) const
+{
+    DTRACEIF(TRANSPARENCY_DETECTOR_DEBUG, "TransparencyDetector: detect %dx%d %d (%s)", w, h, strideInPixels, getName());
+
+    const uint32_t bl = clampToRange(mask.left, w);
+    const uint32_t bt = clampToRange(mask.top, h);
+    const uint32_t br = std::max(bl, clampToRange(mask.right, w));
+    const uint32_t bb = std::max(bt, clampToRange(mask.bottom, h));
+
+    // The sampled pass rejects most buffers; the final pass verifies every row.
+    // For a fully transparent layer the area outside the mask may be black or transparent.
+    const uint32_t passes[] = { cSampleRows, 1 };
+    for (uint32_t p = 0; p < sizeof(passes) / sizeof(passes[0]); p++)
+    {
+        const uint32_t step = passes[p];
+        if (!checkRegion(BLACK, TRANSPARENT, pBuffer, strideInPixels, 0,  bb, w,  h,  step)) return false;     // Bottom
+        if (!checkRegion(BLACK, TRANSPARENT, pBuffer, strideInPixels, 0,  0,  w,  bt, step)) return false;     // Top
+        if (!checkRegion(BLACK, TRANSPARENT, pBuffer, strideInPixels, 0,  bt, bl, bb, step)) return false;     // Left
+        if (!checkRegion(BLACK, TRANSPARENT, pBuffer, strideInPixels, br, bt, w,  bb, step)) return false;     // Right
+        if (!checkRegion(TRANSPARENT, TRANSPARENT, pBuffer, strideInPixels, bl, bt, br, bb, step)) return false; // Middle
+    }
+    return true;
+}
+
+}; // namespace hwcomposer
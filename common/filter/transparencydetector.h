@@ -0,0 +1,80 @@
+/*
+// Copyright (c) 2017 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+#ifndef INTEL_COMMON_HWC_TRANSPARENCYDETECTOR_H
+#define INTEL_COMMON_HWC_TRANSPARENCYDETECTOR_H
+
+#include <stdint.h>
+
+#include <hwcdefs.h>
+
+namespace hwcomposer {
+
+// Checks a linear 32bpp copy of a UI layer for the pattern left over when an
+// application shows video underneath it: fully transparent over the video
+// and black or transparent everywhere else.
+//
+// Rows are scanned with SSE2 or AVX2 where the CPU has them. Every
+// cSampleRows'th row is scanned first so that typical UI content is rejected
+// after touching a fraction of the buffer; only then is every row verified.
+class TransparencyDetector
+{
+public:
+    enum EImplementation
+    {
+        IMPL_AUTO = 0,      // Best available.
+        IMPL_SCALAR,
+        IMPL_SSE2,
+        IMPL_AVX2,
+    };
+
+    static const uint32_t BLACK = 0xFF000000;
+    static const uint32_t TRANSPARENT = 0x00000000;
+
+    // Rows skipped between samples in the first pass.
+    static const uint32_t cSampleRows = 8;
+
+    // Returns true if impl can run on this CPU.
+    static bool isAvailable(EImplementation impl);
+
+    // Falls back to the scalar implementation if impl is not available.
+    TransparencyDetector(EImplementation impl = IMPL_AUTO);
+
+    EImplementation getImplementation() const       { return mImplementation; }
+    const char* getName() const;
+
+    // pBuffer is w x h pixels with a stride of strideInPixels.
+    // Returns true if every pixel inside mask is transparent and every pixel
+    // outside it is black or transparent. mask is clipped to the buffer.
+    bool detect(const uint32_t* pBuffer, uint32_t w, uint32_t h, uint32_t strideInPixels,
+                const HwcRect<int>& mask) const;
+
+    // Returns true if every pixel in [x1,x2) x [y1,y2) is color1 or color2,
+    // checking every rowStep'th row starting at y1.
+    bool checkRegion(uint32_t color1, uint32_t color2, const uint32_t* pBuffer, uint32_t strideInPixels,
+                     uint32_t x1, uint32_t y1, uint32_t x2, uint32_t y2, uint32_t rowStep = 1) const;
+
+private:
+    // Returns true if all count pixels of pRow are color1 or color2.
+    typedef bool (*RowCheck)(const uint32_t* pRow, uint32_t count, uint32_t color1, uint32_t color2);
+
+    EImplementation     mImplementation;
+    RowCheck            mpfnCheckRow;
+};
+
+}; // namespace hwcomposer
+
+#endif // INTEL_COMMON_HWC_TRANSPARENCYDETECTOR_H
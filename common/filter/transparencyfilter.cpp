@@ -29,6 +29,8 @@
 #include "abstractbuffermanager.h"
 #endif
 #include <utils.h>
+#include "drm_internal.h"
+#include "hwcthread.h"
 
 //namespace intel {
 //namespace ufo {
@@ -42,139 +44,152 @@ namespace hwcomposer {
 // Factory class will self register
 TransparencyFilter gTransparencyFilter;
 
-#ifdef uncomment
-class TransparencyFilter::DetectionThread : public Thread
+// Runs queued detections at background priority.
+class TransparencyFilter::DetectionThread : public HWCThread
 {
 public:
-    DetectionThread(std::sp<GraphicBuffer> pLinearBuffer, HwcRect<float> activeRect);
+    DetectionThread(DetectionItem* pItems, uint32_t count);
     virtual ~DetectionThread();
 
-    const char* getName() const                     { return "TransparencyFilter"; }
+    bool start()                                    { return InitWorker(); }
 
-    const Content& onApply(const Content& ref);
+    // Wake the thread to run any queued jobs.
+    void signal()                                   { Resume(); }
 
-    const Layer& getLayer()                         { return mDetectionLayer; }
-    Layer& editLayer()                              { return mDetectionLayer; }
-    bool isFinished()                               { return mbFinished; }
-    bool isDetected(hwc_rect* pBlackMask);
+protected:
+    void HandleRoutine() override;
 
 private:
-    void detect(uint32_t* pBuffer);
-
-    // Detection will be performed in this thread
-    virtual bool threadLoop();
+    void run(DetectionJob& job);
 
-private:
-    // Private reference to hold modified state
-    sp<GraphicBuffer>   mpLinearBuffer;     // Linear copy of the buffer for rapid processing
-    HwcRect<float>         mActiveRect;
-    Layer               mDetectionLayer;    // Layer currently being detected
-    HwcRect<int>          mBlackMask;
-    bool                mbFinished;
-    bool                mbResult;
+    DetectionItem*          mpItems;
+    uint32_t                mCount;
+    TransparencyDetector    mDetector;
 };
 
-TransparencyFilter::DetectionThread::DetectionThread(sp<GraphicBuffer> pLinearBuffer, hwc_frect_t activeRect) :
-    mpLinearBuffer(pLinearBuffer),
-    mActiveRect(activeRect),
-    mDetectionLayer(pLinearBuffer->handle),
-    mBlackMask{},
-    mbFinished(false),
-    mbResult(false)
+TransparencyFilter::DetectionThread::DetectionThread(DetectionItem* pItems, uint32_t count) :
+    HWCThread(10, "TransparencyFilter"),
+    mpItems(pItems),
+    mCount(count)
 {
-    ALOGD_IF(TRANSPARENCY_FILTER_DEBUG, "TransparencyFilter::TransparencyFilter::DetectionThread");
+    DTRACEIF(TRANSPARENCY_FILTER_DEBUG, "TransparencyFilter::DetectionThread using %s detection", mDetector.getName());
 }
 
 TransparencyFilter::DetectionThread::~DetectionThread()
 {
-    DTRACEIF(TRANSPARENCY_FILTER_DEBUG, "TransparencyFilter::TransparencyFilter::~DetectionThread");
+    Exit();
 }
 
-bool TransparencyFilter::DetectionThread::threadLoop()
+void TransparencyFilter::DetectionThread::HandleRoutine()
 {
-    DTRACEIF(TRANSPARENCY_FILTER_DEBUG, "TransparencyFilter: threadLoop");
-    mDetectionLayer.waitRendering(ms2ns( 1000 ));
+    for (uint32_t i = 0; i < mCount; i++)
+    {
+        DetectionJob& job = mpItems[i].mJob;
+        if (job.mState.load(std::memory_order_acquire) == DetectionJob::QUEUED)
+        {
+            run(job);
+            job.mState.store(DetectionJob::DONE, std::memory_order_release);
+        }
+    }
+}
+
+void TransparencyFilter::DetectionThread::run(DetectionJob& job)
+{
+    DTRACEIF(TRANSPARENCY_FILTER_DEBUG, "TransparencyFilter: run");
+    job.mbResult = false;
 
     // Look for a some kind of transparent window possibly with a black outline
     // Abort the entire check if we find any non black, non transparent pixel
-#ifdef uncomment
-    GraphicBufferMapper& mapper = GraphicBufferMapper::get();
-    void* pvBuffer = NULL;
-    status_t r = mapper.lock(mDetectionLayer.getHandle(), GRALLOC_USAGE_SW_READ_OFTEN, Rect(0, 0, mDetectionLayer.getBufferWidth(), mDetectionLayer.getBufferHeight()), &pvBuffer);
-    if (r != OK)
+    uint32_t w, h, s;
+    const uint32_t* pBuffer = job.mpSource->map(&w, &h, &s);
+    if (pBuffer)
     {
-        DTRACEIF(TRANSPARENCY_FILTER_DEBUG, "TransparencyFilter: Failed to lock surface");
-        return false;
+        job.mbResult = mDetector.detect(pBuffer, w, h, s, job.mMask);
+        job.mpSource->unmap();
     }
-#endif
-
-    detect((uint32_t*)pvBuffer);
-
-    DTRACEIF (TRANSPARENCY_FILTER_DEBUG, "Detect result: %d", mbResult);
-
-#ifdef DUMP_UNTRANSPARENT_LAYER
-    if (!mbResult)
+    else
     {
-        static int count = 0;
-        mDetectionLayer.dumpContentToTGA(HWCString::format("NotTransparent%d", count));
-        count++;
+        DTRACEIF(TRANSPARENCY_FILTER_DEBUG, "TransparencyFilter: Failed to map surface");
     }
-#endif
+    job.mpSource.reset();
 
-    mapper.unlock(mDetectionLayer.getHandle());
-    mpLinearBuffer = NULL;
-    DTRACEIF(TRANSPARENCY_FILTER_DEBUG, "TransparencyFilter: threadLoop Finished");
-    mbFinished = true;
-    return false;
+    DTRACEIF(TRANSPARENCY_FILTER_DEBUG, "Detect result: %d", job.mbResult);
 }
 
-bool TransparencyFilter::DetectionThread::isDetected(hwc_rect* pBlackMask)
+#ifdef uncomment
+// Linear copy of a layer made by the GPU. The copy is waited for on the detection thread.
+class TransparencyFilter::LinearCopySource : public TransparencyFilter::Source
 {
-    if (mbResult)
-        *pBlackMask = mBlackMask;
+public:
+    LinearCopySource(sp<GraphicBuffer> pLinearBuffer) :
+        mpLinearBuffer(pLinearBuffer),
+        mLayer(pLinearBuffer->handle)
+    {
+    }
+    Layer& editLayer()                              { return mLayer; }
 
-    return mbResult;
-}
-#endif
+    const uint32_t* map(uint32_t* pWidth, uint32_t* pHeight, uint32_t* pStrideInPixels)
+    {
+        mLayer.waitRendering(ms2ns( 1000 ));
+        void* pvBuffer = NULL;
+        status_t r = GraphicBufferMapper::get().lock(mLayer.getHandle(), GRALLOC_USAGE_SW_READ_OFTEN, Rect(0, 0, mLayer.getBufferWidth(), mLayer.getBufferHeight()), &pvBuffer);
+        if (r != OK)
+            return NULL;
+        *pWidth = mLayer.getBufferWidth();
+        *pHeight = mLayer.getBufferHeight();
+        *pStrideInPixels = mLayer.getBufferPitch() / 4;
+        return (const uint32_t*)pvBuffer;
+    }
+    void unmap()
+    {
+        GraphicBufferMapper::get().unlock(mLayer.getHandle());
+    }
 
-static inline bool checkRegionForColor(uint32_t color, uint32_t* pBuffer, uint32_t strideInPixels, uint32_t x1, uint32_t y1, uint32_t x2, uint32_t y2)
+private:
+    sp<GraphicBuffer>   mpLinearBuffer;     // Linear copy of the buffer for rapid processing
+    Layer               mLayer;
+};
+#else
+// The layer's own buffer, mapped for reading on the detection thread.
+// Only made for linear ABGR8888 buffers, which the detector reads as they are.
+// TODO: Nothing holds the buffer until the thread maps it; hook into the gralloc delete callback.
+class TransparencyFilter::MappedSource : public TransparencyFilter::Source
 {
-    DTRACEIF(DISPLAY_TRACE);
-    pBuffer += y1 * strideInPixels;
-    for (uint32_t y = y1; y < y2; y++)
+public:
+    MappedSource(NativeBufferHandler& handler, HWCNativeHandle handle, uint32_t width, uint32_t height) :
+        mHandler(handler),
+        mHandle(handle),
+        mWidth(width),
+        mHeight(height),
+        mpMapData(NULL)
     {
-        for (uint32_t x = x1; x < x2; x++)
-        {
-            if (pBuffer[x] != color)
-            {
-                DTRACEIF(TRANSPARENCY_FILTER_DEBUG, "TransparencyFilter: checkRegionForColor %d, %d, %d, %d Failed at %d, %d", x1, y1, x2, y2, x, y);
-                return false;
-            }
-        }
-        pBuffer += strideInPixels;
     }
-    return true;
-}
 
-static inline bool checkRegionForColor(uint32_t color1, uint32_t color2, uint32_t* pBuffer, uint32_t strideInPixels, uint32_t x1, uint32_t y1, uint32_t x2, uint32_t y2)
-{
-    DTRACEIF(DISPLAY_TRACE);
-    pBuffer += y1 * strideInPixels;
-    for (uint32_t y = y1; y < y2; y++)
+    const uint32_t* map(uint32_t* pWidth, uint32_t* pHeight, uint32_t* pStrideInPixels)
     {
-        for (uint32_t x = x1; x < x2; x++)
-        {
-            if (pBuffer[x] != color1 && pBuffer[x] != color2)
-            {
-                DTRACEIF(TRANSPARENCY_FILTER_DEBUG, "TransparencyFilter: checkRegionForColor %d, %d, %d, %d Failed at %d, %d", x1, y1, x2, y2, x, y);
-                return false;
-            }
-        }
-        pBuffer += strideInPixels;
+        uint32_t stride = 0;
+        void* pvBuffer = mHandler.Map(mHandle, 0, 0, mWidth, mHeight, &stride, &mpMapData, 0);
+        if (pvBuffer == NULL)
+            return NULL;
+        *pWidth = mWidth;
+        *pHeight = mHeight;
+        *pStrideInPixels = stride / 4;
+        return (const uint32_t*)pvBuffer;
+    }
+    void unmap()
+    {
+        mHandler.UnMap(mHandle, mpMapData);
+        mpMapData = NULL;
     }
-    return true;
-}
 
+private:
+    NativeBufferHandler&    mHandler;
+    HWCNativeHandle         mHandle;
+    uint32_t                mWidth;
+    uint32_t                mHeight;
+    void*                   mpMapData;
+};
+#endif
 
 static HwcRect<float> rotateRect (const HwcRect<float>& rect, ETransform transform)
 {
@@ -207,93 +222,20 @@ static HwcRect<float> rotateRect (const HwcRect<float>& rect, ETransform transfo
     return rotatedRect;
 }
 
-#ifdef uncomment
-void TransparencyFilter::DetectionThread::detect(uint32_t* pBuffer)
-{
-    DTRACEIF(DISPLAY_TRACE);
-
-    const static int BLACK = 0xFF000000;
-    const static int TRANSPARENT = 0x00000000;
-
-    uint32_t w = mDetectionLayer.getBufferWidth();
-    uint32_t h = mDetectionLayer.getBufferHeight();
-    uint32_t s = mDetectionLayer.getBufferPitch() / 4;
-    DTRACEIF(TRANSPARENCY_FILTER_DEBUG, "TransparencyFilter: detect %dx%d %d", w, h, s);
-
-    // Now we only detect the layers which intersacted with video
-    HwcRect<int> overlappedRect;
-    if (!computeOverlap (floatToIntRect(mActiveRect), mDetectionLayer.getDst(), &overlappedRect))
-    {
-        ALOGD_IF(TRANSPARENCY_FILTER_DEBUG, "Not intersacted with video layer, skip it");
-        return;
-    }
-    mActiveRect = intToFloatRect(overlappedRect);
-
-    // Compute the transparent area based on video rect
-    HwcRect<float> inCordSpace = rotateRect(intToFloatRect(mDetectionLayer.getDst()), mDetectionLayer.getTransform());
-    HwcRect<float> outCordSpace = mDetectionLayer.getSrc();
-    HwcRect<float> activeSrcRect = rotateRect(mActiveRect, mDetectionLayer.getTransform());
-    HwcRect<float> activeDstRect;
-    computeRelativeRect ( inCordSpace, outCordSpace, activeSrcRect, activeDstRect );
-
-    DTRACEIF(TRANSPARENCY_FILTER_DEBUG, "UI DST: %d %d %d %d, InCordSpace: %f %f %f %f, OutCordSpace: %f %f %f %f",
-                                        mDetectionLayer.getDst().left, mDetectionLayer.getDst().top, mDetectionLayer.getDst().right, mDetectionLayer.getDst().bottom,
-                                        inCordSpace.left, inCordSpace.top, inCordSpace.right, inCordSpace.bottom,
-                                        outCordSpace.left, outCordSpace.top, outCordSpace.right, outCordSpace.bottom);
-    DTRACEIF(TRANSPARENCY_FILTER_DEBUG, "Video SRC: %f %f %f %f, Video SRC rotate: %f %f %f %f, Video DST: %f, %f, %f, %f, Transform: %d",
-                                        mActiveRect.left, mActiveRect.top, mActiveRect.right, mActiveRect.bottom,
-                                        activeSrcRect.left, activeSrcRect.top, activeSrcRect.right, activeSrcRect.bottom,
-                                        activeDstRect.left, activeDstRect.top, activeDstRect.right, activeDstRect.bottom,
-                                        mDetectionLayer.getTransform());
-    uint32_t bl = activeDstRect.left;
-    uint32_t bt = activeDstRect.top;
-    uint32_t br = activeDstRect.right;
-    uint32_t bb = activeDstRect.bottom;
-    DTRACEIF(TRANSPARENCY_FILTER_DEBUG, "Blackmask %d %d %d %d", bl, bt, br, bb);
-
-    // Perform a complete check of a the whole layer.
-    // For the case that the layer is full transparent, we need check black and transparent simultaneously for non-video region
-    if (!checkRegionForColor(BLACK, TRANSPARENT, pBuffer, s, 0,  bb, w,  h )) return;   // Bottom
-    DTRACEIF(TRANSPARENCY_FILTER_DEBUG, "Bottom check pass, %d %d %d %d", 0, bb, w, h);
-    if (!checkRegionForColor(BLACK, TRANSPARENT, pBuffer, s, 0,  0,  w,  bt)) return;   // Top
-    DTRACEIF(TRANSPARENCY_FILTER_DEBUG, "Top check pass, %d %d %d %d", 0, 0, w, bt);
-    if (!checkRegionForColor(BLACK, TRANSPARENT, pBuffer, s, 0,  bt, bl, bb)) return;   // Left
-    DTRACEIF(TRANSPARENCY_FILTER_DEBUG, "Left check pass, %d %d %d %d", 0, bt, bl, bb);
-    if (!checkRegionForColor(BLACK, TRANSPARENT, pBuffer, s, br, bt, w,  bb)) return;   // Right
-    DTRACEIF(TRANSPARENCY_FILTER_DEBUG, "Right check pass, %d %d %d %d", br, bt, w, bb);
-    if (!checkRegionForColor(TRANSPARENT, pBuffer, s, bl, bt, br, bb)) return;   // Middle
-    DTARCEIF(TRANSPARENCY_FILTER_DEBUG, "Middle check pass, %d %d %d %d", bl, bt, br, bb);
-
-    // Setup the detected blackmask region.
-    mBlackMask.left = bl;
-    mBlackMask.top = bt;
-    mBlackMask.right = br;
-    mBlackMask.bottom = bb;
-
-    mbResult = true;
-}
-#endif
-
 TransparencyFilter::DetectionItem::DetectionItem() :
 #ifdef uncomment
     mBM( AbstractBufferManager::get() ),
-    mCurrentHandle(0),
+    mpLinearBuffer(NULL),
 #endif
+    mCurrentHandle(0),
+    mCheckedHandle(0),
+    mBlackMask(),
     mRepeatCount(0),
     mbEnabled(0),
-#ifdef uncomment
-    mpLinearBuffer(NULL),
-#endif
     mFramesBeforeCheck(0),
-#ifdef uncomment
-    mpDetectionThread(NULL),
-#endif
     mbFirstEnabledFrame(0),
     mbFirstDisabledFrame(0)
 {
-#ifdef uncomment
-    memset(&mBlackMask, 0, sizeof(mBlackMask));
-#endif
 }
 
 TransparencyFilter::DetectionItem::~DetectionItem()
@@ -303,9 +245,8 @@ TransparencyFilter::DetectionItem::~DetectionItem()
 void TransparencyFilter::DetectionItem::reset()
 {
     mRepeatCount = 0;
-#ifdef uncomment
     mCurrentHandle = 0;
-#endif
+    mCheckedHandle = 0;
 }
 
 void TransparencyFilter::DetectionItem::updateRepeatCounts(const Layer& ly)
@@ -317,7 +258,6 @@ void TransparencyFilter::DetectionItem::updateRepeatCounts(const Layer& ly)
         // invalidate on any geometry change, however this can cause a lot of costly extra
         // gpu composition and checking, so we only reset if we havnt yet checked the buffer contents
         // TODO: Hook into gralloc delete callback to invalidate instead.
-#ifdef uncomment
         if (ly.getHandle() != mCurrentHandle)
         {
             mCurrentHandle = ly.getHandle();
@@ -327,30 +267,55 @@ void TransparencyFilter::DetectionItem::updateRepeatCounts(const Layer& ly)
         {
             mRepeatCount++;
         }
-#endif
     }
     else
     {
         mRepeatCount = 0;
-#ifdef uncomment
         mCurrentHandle = 0;
-#endif
     }
 }
 
-void TransparencyFilter::DetectionItem::initiateDetection(const Layer& layer, HwcRect<float> activeRect)
+bool TransparencyFilter::DetectionItem::initiateDetection(const Layer& layer, HwcRect<float> activeRect, NativeBufferHandler* pHandler)
 {
-    DTRACEIF(DISPLAY_TRACE);
+    ATRACE_CALL_IF(DISPLAY_TRACE);
     DTRACEIF(TRANSPARENCY_FILTER_DEBUG, "TransparencyFilter: initiateDetection");
 
-#ifdef uncomment
     // Double check to ensure that detection isnt already running.
-    if (mpDetectionThread != NULL)
+    if (mJob.mState.load(std::memory_order_acquire) != DetectionJob::IDLE)
     {
         DTRACEIF(TRANSPARENCY_FILTER_DEBUG, "TransparencyFilter: Already running");
-        return;
+        return false;
     }
+    mCheckedHandle = mCurrentHandle;
 
+    // Now we only detect the layers which intersacted with video
+    HwcRect<int> overlappedRect;
+    if (!computeOverlap (floatToIntRect(activeRect), layer.getDst(), &overlappedRect))
+    {
+        DTRACEIF(TRANSPARENCY_FILTER_DEBUG, "Not intersacted with video layer, skip it");
+        return false;
+    }
+    activeRect = intToFloatRect(overlappedRect);
+
+    // Compute the transparent area based on video rect
+    HwcRect<float> inCordSpace = rotateRect(intToFloatRect(layer.getDst()), layer.getTransform());
+    HwcRect<float> outCordSpace = layer.getSrc();
+    HwcRect<float> activeSrcRect = rotateRect(activeRect, layer.getTransform());
+    HwcRect<float> activeDstRect;
+    computeRelativeRect ( inCordSpace, outCordSpace, activeSrcRect, activeDstRect );
+
+    DTRACEIF(TRANSPARENCY_FILTER_DEBUG, "UI DST: %d %d %d %d, InCordSpace: %f %f %f %f, OutCordSpace: %f %f %f %f",
+                                        layer.getDst().left, layer.getDst().top, layer.getDst().right, layer.getDst().bottom,
+                                        inCordSpace.left, inCordSpace.top, inCordSpace.right, inCordSpace.bottom,
+                                        outCordSpace.left, outCordSpace.top, outCordSpace.right, outCordSpace.bottom);
+    DTRACEIF(TRANSPARENCY_FILTER_DEBUG, "Video SRC: %f %f %f %f, Video SRC rotate: %f %f %f %f, Video DST: %f, %f, %f, %f, Transform: %d",
+                                        activeRect.left, activeRect.top, activeRect.right, activeRect.bottom,
+                                        activeSrcRect.left, activeSrcRect.top, activeSrcRect.right, activeSrcRect.bottom,
+                                        activeDstRect.left, activeDstRect.top, activeDstRect.right, activeDstRect.bottom,
+                                        layer.getTransform());
+
+    std::shared_ptr<Source> pSource;
+#ifdef uncomment
     // Check if we need re-allocate a graphic buffer
     if (mpLinearBuffer == NULL || mpLinearBuffer->getWidth() != layer.getBufferWidth() ||
         (mpLinearBuffer->getWidth() == layer.getBufferWidth() && layer.getBufferHeight() > mpLinearBuffer->getHeight()))
@@ -367,50 +332,67 @@ void TransparencyFilter::DetectionItem::initiateDetection(const Layer& layer, Hw
     if (mpLinearBuffer == NULL)
     {
         DTRACEIF(TRANSPARENCY_FILTER_DEBUG, "TransparencyFilter: Failed to allocate linear buffer");
-        return;
+        return false;
     }
 
-    mpDetectionThread = new DetectionThread(mpLinearBuffer, activeRect);
     // we only need copy the whole bufer but don't want to use other original info like src rect, dst rect, rotation flag....
+    std::shared_ptr<LinearCopySource> pCopy = std::make_shared<LinearCopySource>(mpLinearBuffer);
     Layer clonedLayer[1];
     clonedLayer[0].onUpdateAll(layer.getHandle());
-    CompositionManager::getInstance().performComposition(Content::LayerStack(clonedLayer, 1), mpDetectionThread->getLayer());
+    CompositionManager::getInstance().performComposition(Content::LayerStack(clonedLayer, 1), pCopy->editLayer());
+    pSource = pCopy;
+#else
+    if (pHandler && layer.getBufferTilingFormat() == TILE_LINEAR)
+    {
+        pSource = std::make_shared<MappedSource>(*pHandler, layer.getHandle(), layer.getBufferWidth(), layer.getBufferHeight());
+    }
+#endif
+    if (!pSource)
+    {
+        DTRACEIF(TRANSPARENCY_FILTER_DEBUG, "TransparencyFilter: No readable pixels for %p", layer.getHandle());
+        return false;
+    }
 
-    // Set needed info to detection layer
-    mpDetectionThread->editLayer().setSrc (layer.getSrc());
-    mpDetectionThread->editLayer().setDst (layer.getDst());
-    mpDetectionThread->editLayer().setTransform (layer.getTransform());
+    // Hand over to the low priority detection thread
+    mJob.mpSource = pSource;
+    mJob.mHandle = mCurrentHandle;
+    mJob.mMask = floatToIntRect(activeDstRect);
+    mJob.mState.store(DetectionJob::QUEUED, std::memory_order_release);
+    return true;
+}
 
-    // Start the low priority detection thread
-    mpDetectionThread->run("Detect_thread", PRIORITY_BACKGROUND);
-#endif
+void TransparencyFilter::DetectionItem::collectDetection()
+{
+    if (mJob.mState.load(std::memory_order_acquire) != DetectionJob::DONE)
+        return;
+
+    // Results for a buffer that has since changed are dropped.
+    if (!mbEnabled && mJob.mbResult && mJob.mHandle == mCurrentHandle && mRepeatCount >= mFramesBeforeCheck)
+    {
+        DTRACEIF(TRANSPARENCY_FILTER_DEBUG, "Blackmask %d %d %d %d", mJob.mMask.left, mJob.mMask.top, mJob.mMask.right, mJob.mMask.bottom);
+        mBlackMask = mJob.mMask;
+        mbEnabled = true;
+        mbFirstEnabledFrame = true;
+    }
+    mJob.mState.store(DetectionJob::IDLE, std::memory_order_relaxed);
 }
 
 void TransparencyFilter::DetectionItem::filterLayers(Content& ref)
 {
     for (uint32_t d = 0; d < ref.size(); d++)
     {
-        const Content::Display& display = ref.getDisplay(d);
-        const Content::LayerStack& layers = display.getLayerStack();
-        uint32_t numLayers = layers.size();
-
-        if (numLayers >= 2)
+        // Backwards so removals don't move layers still to be checked.
+        for (uint32_t i = ref.getDisplay(d).getLayerStack().size(); i-- > 1; )
         {
-            for (uint32_t i = 1; i < numLayers; i++)
+            if (ref.getDisplay(d).getLayerStack()[i].getHandle() == mCurrentHandle)
             {
-#ifdef uncomment
-                if (layers[i].getHandle() == mCurrentHandle)
-                {
-                    Content::LayerStack& layers = ref.editDisplay(d).editLayerStack();
+                Content::LayerStack& layers = ref.editDisplay(d).editLayerStack();
 
-                     // Remove the transparent layer
-                    layers.removeLayer(i);
+                // Remove the transparent layer
+                layers.removeLayer(i);
 
-                    // Update our layer flags as this layer may change our flags.
-                    layers.updateLayerFlags();
-                    --numLayers;
-               }
-#endif
+                // Update our layer flags as this layer may change our flags.
+                layers.updateLayerFlags();
             }
         }
     }
@@ -431,14 +413,13 @@ HWCString TransparencyFilter::DetectionItem::dump()
 {
     if (!sbInternalBuild)
         return HWCString();
-#ifdef uncomment
     return HWCString::format("DetectionItem %s (%d,%d,%d,%d)", mbEnabled ? "true" : "false",
                             mBlackMask.left, mBlackMask.top, mBlackMask.right, mBlackMask.bottom);
-#endif
 }
 
 TransparencyFilter::TransparencyFilter() :
-    mDetectionNum(0)
+    mDetectionNum(0),
+    mbBufferHandlerFailed(false)
 {
     // Add this filter to the front of the filter list
     FilterManager::getInstance().add(*this, FilterPosition::Transparency);
@@ -454,6 +435,9 @@ TransparencyFilter::~TransparencyFilter()
 {
     // remove this filter
     FilterManager::getInstance().remove(*this);
+
+    // Stop the detection thread before the items it runs go.
+    mpDetectionThread.reset();
 }
 
 void TransparencyFilter::skipFilter(void)
@@ -536,15 +520,16 @@ const Content& TransparencyFilter::onApply(const Content& ref)
             curD->mbFirstDisabledFrame = true;
             bNeedChangeRef = true;
             curD->mbEnabled = false;
-#ifdef uncomment
-            curD->mpDetectionThread = NULL;
-#endif
         }
 
+        // Pick up any result from the detection thread.
+        curD->collectDetection();
+
         const Content::LayerStack& layers = ref.getDisplay(0).getLayerStack();
-#ifdef uncomment
-        // If the repeat count matches, then we need to trigger a check for enable
-        if (curD->mpDetectionThread == NULL && curD->mRepeatCount == curD->mFramesBeforeCheck)
+        // If the repeat count matches, then we need to trigger a check for enable.
+        // Each buffer is only checked once.
+        if (!curD->mbEnabled && curD->mRepeatCount >= curD->mFramesBeforeCheck &&
+            curD->mCheckedHandle != curD->mCurrentHandle)
         {
             // For some cases, there might have layers beneath video layer
             // If these layers are not transparent, we should combine their dst rect with video's
@@ -559,19 +544,30 @@ const Content& TransparencyFilter::onApply(const Content& ref)
                 }
             }
 
+            if (!mpBufferHandler && !mbBufferHandlerFailed)
+            {
+                mpBufferHandler.reset(NativeBufferHandler::CreateInstance(Drm::get().getDrmHandle()));
+                if (!mpBufferHandler)
+                {
+                    ETRACE("TransparencyFilter: Failed to create native buffer handler");
+                    mbBufferHandlerFailed = true;
+                }
+            }
+
             DTRACEIF(TRANSPARENCY_FILTER_DEBUG, "Start to detect %dth layer", i);
-            curD->initiateDetection(layers[i], activeRect);
-        }
-        if (!curD->mbEnabled && curD->mpDetectionThread != NULL && curD->mpDetectionThread->isFinished())
-        {
-            if (curD->mpDetectionThread->isDetected(&curD->mBlackMask) && curD->mRepeatCount >= curD->mFramesBeforeCheck)
+            if (curD->initiateDetection(layers[i], activeRect, mpBufferHandler.get()))
             {
-                curD->mbEnabled = true;
-                curD->mbFirstEnabledFrame = true;
+                if (!mpDetectionThread)
+                {
+                    mpDetectionThread.reset(new DetectionThread(mDetection, MAX_DETECT_LAYERS));
+                    if (!mpDetectionThread->start())
+                    {
+                        ETRACE("TransparencyFilter: Failed to start detection thread");
+                    }
+                }
+                mpDetectionThread->signal();
             }
-            curD->mpDetectionThread = NULL;
         }
-#endif
 
         if (curD->mbEnabled)
         {
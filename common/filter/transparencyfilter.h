@@ -20,10 +20,13 @@
 #include <hwcdefs.h>
 
 #include "abstractfilter.h"
+#include "nativebufferhandler.h"
+#include "transparencydetector.h"
 #ifdef uncomment
 #include "abstractbuffermanager.h"
 #endif
 
+#include <atomic>
 #include <memory>
 
 
@@ -41,11 +44,49 @@ public:
     virtual ~TransparencyFilter();
 
     const char* getName() const { return "TransparencyFilter"; }
+    // Inspects buffer contents and times how long layers stay unchanged.
+    uint32_t getDependencies() const { return DEPENDS_ON_GEOMETRY | DEPENDS_ON_BUFFERS | DEPENDS_ON_STATE; }
     const Content& onApply(const Content& ref);
     HWCString dump();
 
 private:
     class DetectionThread;
+
+    // Pixels of a layer to check, mapped by the detection thread once they are ready.
+    class Source
+    {
+    public:
+        virtual ~Source() {}
+        // Returns NULL if the pixels could not be mapped.
+        virtual const uint32_t* map(uint32_t* pWidth, uint32_t* pHeight, uint32_t* pStrideInPixels) = 0;
+        virtual void unmap() = 0;
+    };
+#ifdef uncomment
+    class LinearCopySource;
+#else
+    class MappedSource;
+#endif
+
+    // A check handed to the detection thread.
+    // The filter only writes a job while it is IDLE and only reads the result once it is DONE,
+    // so onApply never waits for the detection thread.
+    class DetectionJob
+    {
+    public:
+        enum EState
+        {
+            IDLE,
+            QUEUED,
+            DONE,
+        };
+        DetectionJob() : mState(IDLE), mHandle(0), mbResult(false) {}
+        std::atomic<uint32_t>   mState;
+        std::shared_ptr<Source> mpSource;       // Released by the detection thread.
+        HWCNativeHandle         mHandle;        // Layer buffer being checked.
+        HwcRect<int>            mMask;          // Region expected to be transparent, in buffer coordinates.
+        bool                    mbResult;
+    };
+
     class DetectionItem
     {
         friend TransparencyFilter;
@@ -54,25 +95,24 @@ private:
         virtual ~DetectionItem();
         void reset();
         void updateRepeatCounts(const Layer& ly);
-        void initiateDetection(const Layer& layer, HwcRect<float> videoRect);
+        // Queues a check of layer for the detection thread. Returns false if none was queued.
+        bool initiateDetection(const Layer& layer, HwcRect<float> videoRect, NativeBufferHandler* pHandler);
+        void collectDetection();
         void filterLayers(Content& ref);
         void garbageCollect(void);
         HWCString dump();
     private:
 #ifdef uncomment
         AbstractBufferManager&  mBM;
-        buffer_handle_t         mCurrentHandle;     // Handle of the currently repeating frame
-        hwc_rect                mBlackMask;
+        std::sp<GraphicBuffer>  mpLinearBuffer;
 #endif
+        HWCNativeHandle         mCurrentHandle;     // Handle of the currently repeating frame
+        HWCNativeHandle         mCheckedHandle;     // Handle last handed to the detection thread
+        HwcRect<int>            mBlackMask;
         uint32_t                mRepeatCount;
         bool                    mbEnabled;
-#ifdef uncomment
-       std::sp<GraphicBuffer>       mpLinearBuffer;
-#endif
         uint32_t                mFramesBeforeCheck;
-#ifdef uncomment
-        std::sp<DetectionThread>     mpDetectionThread;
-#endif
+        DetectionJob            mJob;
         bool                    mbFirstEnabledFrame;
         bool                    mbFirstDisabledFrame;
     };
@@ -82,6 +122,13 @@ private:
     DetectionItem       mDetection[MAX_DETECT_LAYERS];
     uint32_t            mDetectionNum;
     Content             mReference;
+
+    // Maps layer buffers for the detection thread. Created on the first detection.
+    std::unique_ptr<NativeBufferHandler> mpBufferHandler;
+    bool                mbBufferHandlerFailed;
+
+    // Started on the first detection that has pixels to check.
+    std::unique_ptr<DetectionThread> mpDetectionThread;
 };
 
 };
@@ -41,20 +41,38 @@ VisibleRectFilter::~VisibleRectFilter()
 const Content& VisibleRectFilter::onApply(const Content& ref)
 {
     bool bModified = false;
-    mReference = ref;
 
-    for (uint32_t d = 0; d < mReference.size(); d++)
+    for (uint32_t d = 0; d < ref.size(); d++)
     {
-        Content::Display& display = mReference.editDisplay(d);
-        Content::LayerStack& layerStack = display.editLayerStack();
+        const Content::Display& refDisplay = ref.getDisplay(d);
         struct DisplayState& displayState = mDisplayState[d];
+        displayState.mbWasModified = false;
+
+        // Keep the last clipping, to flag a change to it.
+        std::vector<std::pair<uint32_t, uint32_t>>& lastClipped = displayState.mLastClipped;
+        std::vector<uint32_t>& lastRemoved = displayState.mLastRemoved;
+        std::vector<HwcRect<int>>& lastClippedDst = displayState.mLastClippedDst;
+        lastClipped.swap( displayState.mClipped );
+        lastRemoved.swap( displayState.mRemoved );
+        displayState.mClipped.clear();
+        displayState.mRemoved.clear();
+        lastClippedDst.clear();
+        for ( const auto& clipped : lastClipped )
+        {
+            lastClippedDst.push_back( displayState.mLayers[clipped.second].getDst() );
+        }
 
-        if ( display.isEnabled() )
+        if ( refDisplay.isEnabled() )
         {
-            displayStatePrepare( d, layerStack.size() );
-            for ( uint32_t ly = 0; ly < layerStack.size(); )
+            // Read from the input until a layer needs clipping, then from our own copy of the display.
+            // Displays with nothing to clip stay shared with the input.
+            const Content::LayerStack* pLayerStack = &refDisplay.getLayerStack();
+            Content::LayerStack* pEditStack = NULL;
+
+            displayStatePrepare( d, pLayerStack->size() );
+            for ( uint32_t ly = 0; ly < pLayerStack->size(); )
             {
-                const Layer& layer = layerStack.getLayer(ly);
+                const Layer& layer = pLayerStack->getLayer(ly);
                 bool isVisibleLayer = true;
 
                 // Get visible rect that can cover all visible rects of this layer
@@ -68,6 +86,21 @@ const Content& VisibleRectFilter::onApply(const Content& ref)
                 }
                 DTRACEIF ( VISIBLERECTFILTER_DEBUG, "\nBegin to clip layer in D%d: \n%s", d, layer.dump("").string());
 
+                if ( pEditStack == NULL )
+                {
+                    if ( !bModified )
+                    {
+                        mReference = ref;
+                        bModified = true;
+                    }
+                    pEditStack = &mReference.editDisplay(d).editLayerStack();
+                    pLayerStack = pEditStack;
+                    displayState.mbWasModified = true;
+                }
+                // Layers before ly that were removed moved the rest down.
+                const uint32_t in = ly + displayState.mRemoved.size();
+                Content::LayerStack& layerStack = *pEditStack;
+
                 // Copy layer
                 displayState.mLayers[ly] = layer;
                 displayState.mLayers[ly].onUpdateFrameState(layer);
@@ -80,6 +113,7 @@ const Content& VisibleRectFilter::onApply(const Content& ref)
                 if( isVisibleLayer )
                 {
                    layerStack.setLayer(ly, &displayState.mLayers[ly]);
+                   displayState.mClipped.push_back( std::make_pair( in, ly ) );
                    ly++;
                    DTRACEIF ( VISIBLERECTFILTER_DEBUG,"Clip layer to visible region.");
                 }
@@ -89,10 +123,29 @@ const Content& VisibleRectFilter::onApply(const Content& ref)
                     // If this layer is not removed, the src/dst rect can be set zero rect, and it would not sent to composer
                     // but to waste some CPU resources, so it is better to remove this layer
                     layerStack.removeLayer( ly );
+                    displayState.mRemoved.push_back( in );
                     DTRACEIF ( VISIBLERECTFILTER_DEBUG,"Remove zero visible region layer.");
                  }
                  layerStack.updateLayerFlags();
-                 bModified = true;
+            }
+
+            // We are also applied for changes that are not flagged as geometry changes (eg a new
+            // layer count). Filters after us skip onApply without the flag, so if that changed what
+            // we clip or remove, flag it on our output.
+            bool bClippingChanged = ( lastClipped != displayState.mClipped ) || ( lastRemoved != displayState.mRemoved );
+            for ( uint32_t c = 0; !bClippingChanged && ( c < lastClipped.size() ); c++ )
+            {
+                bClippingChanged = ( lastClippedDst[c] != displayState.mLayers[displayState.mClipped[c].second].getDst() );
+            }
+            if ( bClippingChanged && !refDisplay.isGeometryChanged() )
+            {
+                DTRACEIF( VISIBLERECTFILTER_DEBUG, "D%d clipping changed without a geometry change, flagging one", d );
+                if ( !bModified )
+                {
+                    mReference = ref;
+                    bModified = true;
+                }
+                mReference.editDisplay(d).setGeometryChanged( true );
             }
         }
     }
@@ -112,6 +165,40 @@ const Content& VisibleRectFilter::onApply(const Content& ref)
     return mReference;
 }
 
+const Content& VisibleRectFilter::onUpdateFrameState(const Content& ref)
+{
+    if ( mReference.size() == 0 )
+    {
+        // Nothing was clipped last time.
+        return ref;
+    }
+
+    // Repeat the clipping on the new buffers: only the clipped layers need their frame state.
+    mReference = ref;
+    for (uint32_t d = 0; d < ref.size() && d < cMaxSupportedSFDisplays; d++)
+    {
+        const struct DisplayState& displayState = mDisplayState[d];
+        if ( !displayState.mbWasModified )
+        {
+            continue;
+        }
+        const Content::LayerStack& refStack = ref.getDisplay(d).getLayerStack();
+        Content::LayerStack& layerStack = mReference.editDisplay(d).editLayerStack();
+        for ( const auto& clipped : displayState.mClipped )
+        {
+            Layer& layer = mDisplayState[d].mLayers[clipped.second];
+            layer.onUpdateFrameState( refStack.getLayer( clipped.first ) );
+            layerStack.setLayer( clipped.first, &layer );
+        }
+        for ( uint32_t r = displayState.mRemoved.size(); r > 0; r-- )
+        {
+            layerStack.removeLayer( displayState.mRemoved[r - 1] );
+        }
+        layerStack.updateLayerFlags();
+    }
+    return mReference;
+}
+
 HWCString VisibleRectFilter::dump()
 {
     HWCString output("VisibleRectFilter: ");
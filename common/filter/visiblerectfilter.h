@@ -28,7 +28,9 @@ public:
     virtual ~VisibleRectFilter();
 
     const char* getName() const { return "VisibleRectFilter"; }
+    uint32_t getDependencies() const { return DEPENDS_ON_GEOMETRY; }
     const Content& onApply(const Content& ref);
+    const Content& onUpdateFrameState(const Content& ref);
     HWCString dump();
 protected:
     bool displayStatePrepare( uint32_t d, uint32_t layerCount);
@@ -45,6 +47,15 @@ protected:
         DisplayState() : mbWasModified(false) {}
         bool mbWasModified;
         std::vector<Layer>  mLayers;   // layer list for this display
+
+        // What onApply did to the input, for onUpdateFrameState to repeat.
+        std::vector<std::pair<uint32_t, uint32_t>> mClipped;   // Input layer index and its clipped copy in mLayers
+        std::vector<uint32_t>  mRemoved;                       // Input layer index of each removed layer, ascending
+
+        // The clipping before the last onApply, kept here so its storage is reused.
+        std::vector<std::pair<uint32_t, uint32_t>> mLastClipped;
+        std::vector<uint32_t>  mLastRemoved;
+        std::vector<HwcRect<int>> mLastClippedDst;             // Destination of each of mLastClipped
     };
     DisplayState mDisplayState[cMaxSupportedSFDisplays];
 };
@@ -19,6 +19,8 @@
 #include <stdint.h>
 #include <xf86drmMode.h>
 
+#include "platformdefines.h"
+
 namespace hwcomposer {
 void DrmResourcesDeleter::operator()(drmModeRes* resources) const {
   drmModeFreeResources(resources);
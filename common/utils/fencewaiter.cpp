@@ -0,0 +1,322 @@
+/*
+// Copyright (c) 2017 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+#include "fencewaiter.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <vector>
+
+#include "hwctrace.h"
+
+namespace hwcomposer {
+
+static const int kMaxEvents = 16;
+
+static int64_t NowMs() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+static int64_t DeadlineMs(int timeout_ms) {
+  return timeout_ms < 0 ? -1 : NowMs() + timeout_ms;
+}
+
+// Milliseconds left until deadline_ms, or -1 for no deadline.
+static int RemainingMs(int64_t deadline_ms) {
+  if (deadline_ms < 0)
+    return -1;
+  int64_t remaining = deadline_ms - NowMs();
+  return remaining > 0 ? static_cast<int>(remaining) : 0;
+}
+
+FenceWaiter::FenceWaiter(int priority, const char *name)
+    : HWCThread(priority, name), epoll_fd_(-1) {
+}
+
+FenceWaiter::~FenceWaiter() {
+  HWCThread::Exit();
+  if (epoll_fd_ >= 0)
+    close(epoll_fd_);
+}
+
+bool FenceWaiter::Initialize() {
+  if (epoll_fd_ < 0) {
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd_ < 0) {
+      ETRACE("Failed to create epoll set for FenceWaiter. %s", PRINTERROR());
+      return false;
+    }
+    // The epoll fd becomes readable when any fence in the set signals.
+    fd_handler_.AddFd(epoll_fd_);
+  }
+
+  if (!InitWorker()) {
+    ETRACE("Failed to initalize thread for FenceWaiter. %s", PRINTERROR());
+    return false;
+  }
+
+  return true;
+}
+
+bool FenceWaiter::Add(int fence, int timeout_ms, const Callback &callback) {
+  if (fence < 0 || epoll_fd_ < 0) {
+    if (fence >= 0)
+      close(fence);
+    return false;
+  }
+
+  lock_.lock();
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.fd = fence;
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fence, &ev) < 0) {
+    lock_.unlock();
+    ETRACE("Failed to watch fence %d. %s", fence, PRINTERROR());
+    close(fence);
+    return false;
+  }
+  Waiter &waiter = waiters_[fence];
+  waiter.callback = callback;
+  waiter.deadline_ms = DeadlineMs(timeout_ms);
+  lock_.unlock();
+
+  // Wake the thread so it picks up the new deadline.
+  if (timeout_ms >= 0)
+    Resume();
+  return true;
+}
+
+void FenceWaiter::ExitThread() {
+  HWCThread::Exit();
+}
+
+void FenceWaiter::HandleWait() {
+  int64_t deadline_ms = -1;
+  lock_.lock();
+  for (const auto &it : waiters_) {
+    if (it.second.deadline_ms >= 0 &&
+        (deadline_ms < 0 || it.second.deadline_ms < deadline_ms))
+      deadline_ms = it.second.deadline_ms;
+  }
+  lock_.unlock();
+
+  WaitForEvent(RemainingMs(deadline_ms));
+}
+
+void FenceWaiter::HandleRoutine() {
+  struct epoll_event events[kMaxEvents];
+  int ready;
+  do {
+    ready = epoll_wait(epoll_fd_, events, kMaxEvents, 0);
+    for (int i = 0; i < ready; ++i) {
+      Dispatch(events[i].data.fd,
+               !(events[i].events & (EPOLLERR | EPOLLHUP)));
+    }
+  } while (ready == kMaxEvents);
+
+  std::vector<int> expired;
+  int64_t now = NowMs();
+  lock_.lock();
+  for (const auto &it : waiters_) {
+    if (it.second.deadline_ms >= 0 && it.second.deadline_ms <= now)
+      expired.emplace_back(it.first);
+  }
+  lock_.unlock();
+
+  for (int fence : expired) {
+    ETRACE("FenceWaiter: fence %d timed out", fence);
+    Dispatch(fence, false);
+  }
+}
+
+void FenceWaiter::HandleExit() {
+  // Fences still pending at exit are closed without calling back.
+  lock_.lock();
+  for (const auto &it : waiters_) {
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, it.first, NULL);
+    close(it.first);
+  }
+  waiters_.clear();
+  lock_.unlock();
+}
+
+void FenceWaiter::Dispatch(int fence, bool signalled) {
+  lock_.lock();
+  auto it = waiters_.find(fence);
+  if (it == waiters_.end()) {
+    lock_.unlock();
+    return;
+  }
+  Callback callback;
+  callback.swap(it->second.callback);
+  waiters_.erase(it);
+  epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fence, NULL);
+  lock_.unlock();
+
+  if (callback)
+    callback(signalled);
+  close(fence);
+}
+
+size_t FenceWaiter::WaitAll(
+    const int *fences, size_t count, int timeout_ms,
+    const std::function<void(size_t index)> &on_signalled) {
+  size_t skipped = 0;
+  for (size_t i = 0; i < count; ++i) {
+    if (fences[i] < 0)
+      skipped++;
+  }
+  return skipped + Wait(fences, count, timeout_ms, on_signalled, count);
+}
+
+int FenceWaiter::WaitAny(const int *fences, size_t count, int timeout_ms) {
+  int first = -1;
+  Wait(fences, count, timeout_ms, [&first](size_t index) {
+    if (first < 0)
+      first = static_cast<int>(index);
+  }, 1);
+  return first;
+}
+
+size_t FenceWaiter::Wait(
+    const int *fences, size_t count, int timeout_ms,
+    const std::function<void(size_t index)> &on_signalled,
+    size_t stop_after) {
+  size_t signalled = 0;
+  size_t pending = 0;
+  int epoll_fd = -1;
+  bool epoll_failed = false;
+  // Fences that cannot join the epoll set are polled directly, together
+  // with the epoll fd, rather than dropped. polled_index holds the index of
+  // each one, or count for the epoll fd.
+  std::vector<struct pollfd> polled;
+  std::vector<size_t> polled_index;
+
+  for (size_t i = 0; i < count; ++i) {
+    if (fences[i] < 0)
+      continue;
+    if (epoll_fd < 0 && !epoll_failed) {
+      epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+      if (epoll_fd < 0) {
+        ETRACE("Failed to create epoll set. %s", PRINTERROR());
+        epoll_failed = true;
+      }
+    }
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u64 = i;
+    if (epoll_fd < 0 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fences[i], &ev) < 0) {
+      if (epoll_fd >= 0)
+        ETRACE("Failed to watch fence %d, polling it. %s", fences[i],
+               PRINTERROR());
+      struct pollfd fd;
+      fd.fd = fences[i];
+      fd.events = POLLIN;
+      fd.revents = 0;
+      polled.emplace_back(fd);
+      polled_index.emplace_back(i);
+      continue;
+    }
+    pending++;
+  }
+
+  size_t waiting = pending + polled.size();
+  if (pending && !polled.empty()) {
+    struct pollfd fd;
+    fd.fd = epoll_fd;
+    fd.events = POLLIN;
+    fd.revents = 0;
+    polled.emplace_back(fd);
+    polled_index.emplace_back(count);
+  }
+
+  int64_t deadline_ms = DeadlineMs(timeout_ms);
+  while (waiting && signalled < stop_after) {
+    struct epoll_event events[kMaxEvents];
+    int ready = 0;
+    if (polled.empty()) {
+      ready = epoll_wait(epoll_fd, events, kMaxEvents,
+                         RemainingMs(deadline_ms));
+      if (ready < 0 && errno == EINTR)
+        continue;
+      if (ready <= 0) {
+        if (ready < 0)
+          ETRACE("epoll_wait failed waiting for fences. %s", PRINTERROR());
+        break;
+      }
+    } else {
+      int ret = poll(polled.data(), polled.size(), RemainingMs(deadline_ms));
+      if (ret < 0 && errno == EINTR)
+        continue;
+      if (ret <= 0) {
+        if (ret < 0)
+          ETRACE("poll failed waiting for fences. %s", PRINTERROR());
+        break;
+      }
+      for (size_t p = 0; p < polled.size(); ++p) {
+        if (!polled[p].revents)
+          continue;
+        size_t index = polled_index[p];
+        if (index == count) {
+          ready = epoll_wait(epoll_fd, events, kMaxEvents, 0);
+          if (ready < 0)
+            ready = 0;
+          continue;
+        }
+        // Negative fds are ignored by poll from now on.
+        polled[p].fd = -1;
+        waiting--;
+        if (polled[p].revents & (POLLERR | POLLHUP | POLLNVAL)) {
+          ETRACE("Fence %d reported an error", fences[index]);
+          continue;
+        }
+        signalled++;
+        if (on_signalled)
+          on_signalled(index);
+      }
+    }
+    for (int i = 0; i < ready; ++i) {
+      size_t index = static_cast<size_t>(events[i].data.u64);
+      epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fences[index], NULL);
+      pending--;
+      waiting--;
+      if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+        ETRACE("Fence %d reported an error", fences[index]);
+        continue;
+      }
+      signalled++;
+      if (on_signalled)
+        on_signalled(index);
+    }
+    if (!pending && !polled.empty() && polled_index.back() == count)
+      polled.back().fd = -1;
+  }
+
+  if (epoll_fd >= 0)
+    close(epoll_fd);
+  return signalled;
+}
+
+}  // namespace hwcomposer
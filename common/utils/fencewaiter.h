@@ -0,0 +1,95 @@
+/*
+// Copyright (c) 2017 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+#ifndef COMMON_UTILS_FENCEWAITER_H_
+#define COMMON_UTILS_FENCEWAITER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <spinlock.h>
+
+#include <functional>
+#include <map>
+
+#include "hwcthread.h"
+
+namespace hwcomposer {
+
+// Waits on any number of sync fences from a single thread. All fences are
+// registered on one epoll set, so a fence that signals early is dispatched
+// straight away rather than after fences added before it.
+class FenceWaiter : public HWCThread {
+ public:
+  // Called on the waiter thread with signalled true once the fence signals,
+  // or false if the timeout expired or the fence reported an error.
+  typedef std::function<void(bool signalled)> Callback;
+
+  FenceWaiter(int priority, const char *name);
+  ~FenceWaiter() override;
+
+  bool Initialize();
+
+  // Watch fence and call callback once it signals or timeout_ms expires
+  // (a negative timeout never expires). The waiter takes ownership of fence
+  // and closes it after the callback returns. Returns false, and closes
+  // fence without calling callback, if the fence could not be watched.
+  bool Add(int fence, int timeout_ms, const Callback &callback);
+
+  void ExitThread();
+
+  // Block the calling thread until every fence has signalled or timeout_ms
+  // expires (a negative timeout never expires). on_signalled, if set, is
+  // called with the index of each fence in the order they signal. Fences are
+  // not closed. Returns the number of fences that signalled; negative fences
+  // are skipped and count as signalled. A fence that cannot be added to an
+  // epoll set is polled directly instead.
+  static size_t WaitAll(const int *fences, size_t count, int timeout_ms,
+                        const std::function<void(size_t index)> &on_signalled);
+
+  // Block the calling thread until any fence signals or timeout_ms expires.
+  // Returns the index of a fence that signalled, or -1 on timeout or if no
+  // fence could be waited on. Negative fences are skipped and fences are not
+  // closed.
+  static int WaitAny(const int *fences, size_t count, int timeout_ms);
+
+ protected:
+  void HandleWait() override;
+  void HandleRoutine() override;
+  void HandleExit() override;
+
+ private:
+  struct Waiter {
+    Callback callback;
+    int64_t deadline_ms;
+  };
+
+  void Dispatch(int fence, bool signalled);
+
+  // Wait until stop_after fences have signalled, all have signalled or
+  // failed, or timeout_ms expires. Returns the number that signalled,
+  // not counting negative fences.
+  static size_t Wait(const int *fences, size_t count, int timeout_ms,
+                     const std::function<void(size_t index)> &on_signalled,
+                     size_t stop_after);
+
+  SpinLock lock_;
+  std::map<int, Waiter> waiters_;
+  int epoll_fd_;
+};
+
+}  // namespace hwcomposer
+#endif  // COMMON_UTILS_FENCEWAITER_H_
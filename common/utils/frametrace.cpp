@@ -0,0 +1,202 @@
+/*
+// Copyright (c) 2017 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+#include "frametrace.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <memory>
+
+#include "hwctrace.h"
+#include "spinlock.h"
+
+namespace hwcomposer {
+
+namespace {
+
+// sequence is the record's index + 1 once it is written, and 0 while it is
+// being written, so that a reader can tell a record it copied was complete.
+struct Slot {
+  std::atomic<uint64_t> sequence;
+  FrameTrace::Record record;
+};
+
+struct Ring {
+  explicit Ring(uint64_t size) : mask(size - 1), slots(new Slot[size]) {
+    for (uint64_t i = 0; i < size; i++)
+      slots[i].sequence.store(0, std::memory_order_relaxed);
+  }
+
+  const uint64_t mask;
+  std::unique_ptr<Slot[]> slots;
+};
+
+struct ThreadContext {
+  uint32_t tid = 0;
+  uint32_t display = 0;
+  uint32_t frame = 0;
+};
+
+std::atomic<Ring*> ring_(nullptr);
+std::atomic<uint64_t> next_(0);
+SpinLock enable_lock_;
+thread_local ThreadContext context_;
+
+const char* const kEventNames[FrameTrace::kNumEvents] = {
+    "Present", "ValidateLayers", "TestCommit", "Draw",
+    "Commit",  "OutFence",       "BufferRelease"};
+
+}  // namespace
+
+std::atomic<bool> FrameTrace::enabled_(false);
+const char FrameTrace::kMagic[8] = "HWCFTRC";
+
+void FrameTrace::Enable(uint32_t capacity) {
+  ScopedSpinLock lock(enable_lock_);
+  if (!ring_.load(std::memory_order_relaxed)) {
+    uint64_t size = 1024;
+    while (size < capacity)
+      size <<= 1;
+    ring_.store(new Ring(size), std::memory_order_release);
+    ITRACE("FrameTrace: recording the last %u events", uint32_t(size));
+  }
+  enabled_.store(true, std::memory_order_relaxed);
+}
+
+void FrameTrace::Disable() {
+  enabled_.store(false, std::memory_order_relaxed);
+}
+
+void FrameTrace::Add(Event event, Phase phase, int32_t arg) {
+  Add(event, phase, context_.display, context_.frame, arg);
+}
+
+void FrameTrace::Add(Event event, Phase phase, uint32_t display,
+                     uint32_t frame, int32_t arg) {
+  Ring* ring = ring_.load(std::memory_order_acquire);
+  if (!ring)
+    return;
+
+  if (!context_.tid)
+    context_.tid = gettid();
+
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+
+  const uint64_t index = next_.fetch_add(1, std::memory_order_relaxed);
+  Slot& slot = ring->slots[index & ring->mask];
+  slot.sequence.store(0, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  Record& record = slot.record;
+  record.timestamp = int64_t(t.tv_sec) * 1000000000 + t.tv_nsec;
+  record.frame = frame;
+  record.tid = context_.tid;
+  record.arg = arg;
+  record.event = event;
+  record.phase = phase;
+  record.display = display;
+  record.reserved = 0;
+  slot.sequence.store(index + 1, std::memory_order_release);
+}
+
+void FrameTrace::GetCurrentFrame(uint32_t& display, uint32_t& frame) {
+  display = context_.display;
+  frame = context_.frame;
+}
+
+uint64_t FrameTrace::Read(std::vector<Record>& records) {
+  records.clear();
+  Ring* ring = ring_.load(std::memory_order_acquire);
+  if (!ring)
+    return 0;
+
+  const uint64_t end = next_.load(std::memory_order_acquire);
+  const uint64_t begin = end > ring->mask + 1 ? end - (ring->mask + 1) : 0;
+  uint64_t dropped = begin;
+  records.reserve(end - begin);
+  for (uint64_t i = begin; i < end; i++) {
+    const Slot& slot = ring->slots[i & ring->mask];
+    const uint64_t sequence = slot.sequence.load(std::memory_order_acquire);
+    const Record record = slot.record;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (sequence == i + 1 &&
+        slot.sequence.load(std::memory_order_relaxed) == sequence) {
+      records.push_back(record);
+    } else {
+      // Still being written, or already overwritten.
+      dropped++;
+    }
+  }
+  return dropped;
+}
+
+bool FrameTrace::Save(const char* path) {
+  std::vector<Record> records;
+  FileHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, kMagic, sizeof(header.magic));
+  header.version = kVersion;
+  header.record_size = sizeof(Record);
+  header.dropped = Read(records);
+  header.count = records.size();
+
+  FILE* file = fopen(path, "wb");
+  if (!file) {
+    ETRACE("FrameTrace: Failed to open %s %s", path, PRINTERROR());
+    return false;
+  }
+  bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+  if (ok && !records.empty())
+    ok = fwrite(records.data(), sizeof(Record), records.size(), file) ==
+         records.size();
+  ok = (fclose(file) == 0) && ok;
+  if (!ok) {
+    ETRACE("FrameTrace: Failed to write %s", path);
+    return false;
+  }
+  ITRACE("FrameTrace: Saved %zu events to %s", records.size(), path);
+  return true;
+}
+
+const char* FrameTrace::GetEventName(uint8_t event) {
+  return event < kNumEvents ? kEventNames[event] : "Unknown";
+}
+
+FrameTrace::Scope::Scope(Event event, uint32_t display, uint32_t frame)
+    : event_(event), active_(IsEnabled()) {
+  if (!active_)
+    return;
+  has_context_ = true;
+  previous_display_ = context_.display;
+  previous_frame_ = context_.frame;
+  context_.display = display;
+  context_.frame = frame;
+  Add(event_, kBegin);
+}
+
+void FrameTrace::Scope::End() {
+  Add(event_, kEnd, result_);
+  if (has_context_) {
+    context_.display = previous_display_;
+    context_.frame = previous_frame_;
+  }
+}
+
+}  // namespace hwcomposer
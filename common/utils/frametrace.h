@@ -0,0 +1,151 @@
+/*
+// Copyright (c) 2017 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+#ifndef COMMON_UTILS_FRAMETRACE_H_
+#define COMMON_UTILS_FRAMETRACE_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <vector>
+
+namespace hwcomposer {
+
+// Binary flight recorder of frame lifecycle events. Each event is a fixed
+// size record with a display, a frame id and a CLOCK_MONOTONIC timestamp,
+// kept in a ring that overwrites the oldest records. Nothing is formatted
+// while recording; Save() writes the ring out and frametrace2json converts
+// it to a Chrome/Perfetto JSON timeline.
+//
+// While disabled each event costs one load and one branch. Enable with the
+// frametrace option (the ring size in K records); the trace is written to
+// the frametracefile option's path when the HWC is dumped or shut down.
+class FrameTrace {
+ public:
+  enum Event : uint8_t {
+    kPresent = 0,
+    kValidateLayers,
+    kTestCommit,
+    kDraw,
+    kCommit,
+    kOutFence,
+    kBufferRelease,
+    kNumEvents
+  };
+
+  enum Phase : uint8_t { kBegin = 0, kEnd, kInstant };
+
+  struct Record {
+    int64_t timestamp;  // CLOCK_MONOTONIC, ns.
+    uint32_t frame;
+    uint32_t tid;
+    int32_t arg;  // Event specific, e.g. the result of a commit.
+    uint8_t event;
+    uint8_t phase;
+    uint8_t display;
+    uint8_t reserved;
+  };
+
+  // Save() writes this followed by count records, oldest first.
+  struct FileHeader {
+    char magic[8];  // kMagic
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t count;
+    uint64_t dropped;  // Overwritten before they were saved.
+  };
+
+  static const char kMagic[8];
+  static const uint32_t kVersion = 1;
+
+  static bool IsEnabled() {
+    return enabled_.load(std::memory_order_relaxed);
+  }
+
+  // Starts recording into a ring of at least capacity records. The ring is
+  // allocated on first use and kept, so a trace survives Disable().
+  static void Enable(uint32_t capacity);
+  static void Disable();
+
+  // Records an event for the frame being presented on this thread, as set
+  // by the innermost Scope.
+  static void Add(Event event, Phase phase, int32_t arg = 0);
+  static void Add(Event event, Phase phase, uint32_t display, uint32_t frame,
+                  int32_t arg = 0);
+
+  // The display and frame of the innermost Scope on this thread, for
+  // events that complete on another thread.
+  static void GetCurrentFrame(uint32_t& display, uint32_t& frame);
+
+  // Copies out the recorded events, oldest first. Returns how many were lost.
+  static uint64_t Read(std::vector<Record>& records);
+  static bool Save(const char* path);
+
+  static const char* GetEventName(uint8_t event);
+
+  // Marks the begin and end of an event. With a display and frame, also
+  // makes them the current frame for events recorded on this thread.
+  class Scope {
+   public:
+    Scope(Event event) : event_(event), active_(IsEnabled()) {
+      if (active_)
+        Add(event_, kBegin);
+    }
+    Scope(Event event, uint32_t display, uint32_t frame);
+    ~Scope() {
+      if (active_)
+        End();
+    }
+
+    void SetResult(int32_t result) {
+      result_ = result;
+    }
+
+   private:
+    void End();
+
+    Event event_;
+    bool active_;
+    bool has_context_ = false;
+    int32_t result_ = 0;
+    uint32_t previous_display_ = 0;
+    uint32_t previous_frame_ = 0;
+  };
+
+ private:
+  static std::atomic<bool> enabled_;
+};
+
+// A single event, or the begin and end of a scope, in the current frame or
+// in the given one.
+#define FRAME_TRACE(event, arg)                                            \
+  do {                                                                     \
+    if (__builtin_expect(FrameTrace::IsEnabled(), 0))                      \
+      FrameTrace::Add(FrameTrace::event, FrameTrace::kInstant, arg);       \
+  } while (0)
+
+#define FRAME_TRACE_FOR(event, display, frame, arg)                         \
+  do {                                                                      \
+    if (__builtin_expect(FrameTrace::IsEnabled(), 0))                       \
+      FrameTrace::Add(FrameTrace::event, FrameTrace::kInstant, display, frame, \
+                      arg);                                                 \
+  } while (0)
+
+#define FRAME_TRACE_SCOPE(event) \
+  FrameTrace::Scope frame_trace_scope_(FrameTrace::event)
+
+}  // namespace hwcomposer
+#endif  // COMMON_UTILS_FRAMETRACE_H_
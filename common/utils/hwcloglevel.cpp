@@ -0,0 +1,33 @@
+/*
+// Copyright (c) 2017 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+#include "hwcloglevel.h"
+
+namespace hwcomposer {
+
+std::atomic<int> gLogLevel(HWC_LOG_LEVEL_DEFAULT < HWC_LOG_LEVEL_MAX
+                               ? HWC_LOG_LEVEL_DEFAULT
+                               : HWC_LOG_LEVEL_MAX);
+
+void SetLogLevel(int level) {
+  if (level < HWC_LOG_LEVEL_NONE)
+    level = HWC_LOG_LEVEL_NONE;
+  if (level > HWC_LOG_LEVEL_MAX)
+    level = HWC_LOG_LEVEL_MAX;
+  gLogLevel.store(level, std::memory_order_relaxed);
+}
+
+}  // namespace hwcomposer
@@ -0,0 +1,68 @@
+/*
+// Copyright (c) 2017 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+#ifndef COMMON_UTILS_HWCLOGLEVEL_H_
+#define COMMON_UTILS_HWCLOGLEVEL_H_
+
+// Log levels, most severe first.
+#define HWC_LOG_LEVEL_NONE 0
+#define HWC_LOG_LEVEL_ERROR 1
+#define HWC_LOG_LEVEL_WARN 2
+#define HWC_LOG_LEVEL_INFO 3
+#define HWC_LOG_LEVEL_DEBUG 4
+#define HWC_LOG_LEVEL_VERBOSE 5
+
+// Messages above this level are compiled out, format strings, arguments and
+// all. Set with --with-max-log-level at configure time (info by default),
+// or BOARD_HWC_MAX_LOG_LEVEL on Android.
+#ifndef HWC_LOG_LEVEL_MAX
+#define HWC_LOG_LEVEL_MAX HWC_LOG_LEVEL_VERBOSE
+#endif
+
+// The runtime level to start at, until the "loglevel" option changes it.
+// Set with --with-log-level at configure time (info by default); Android
+// builds start at HWC_LOG_LEVEL_MAX and leave filtering to logcat.
+#ifndef HWC_LOG_LEVEL_DEFAULT
+#define HWC_LOG_LEVEL_DEFAULT HWC_LOG_LEVEL_MAX
+#endif
+
+#include <atomic>
+
+namespace hwcomposer {
+
+// Messages above this level are skipped at runtime. It starts at
+// HWC_LOG_LEVEL_DEFAULT and can not be raised above HWC_LOG_LEVEL_MAX.
+// Call sites only need to see a change eventually, so they load it relaxed.
+extern std::atomic<int> gLogLevel;
+
+void SetLogLevel(int level);
+
+}  // namespace hwcomposer
+
+// Calls sink(...) if level is compiled in, cond holds and level is enabled
+// at runtime. The arguments are only evaluated when it does. A level above
+// HWC_LOG_LEVEL_MAX, or a constant false cond (most debug sites test a
+// constant *_DEBUG switch), makes the whole condition a constant false, so
+// the call site generates no code. cond is tested before the runtime level
+// for that reason, as the Android *_IF macros always did.
+#define HWC_LOG_IF(level, cond, sink, ...)                              \
+  do {                                                                  \
+    if ((level) <= HWC_LOG_LEVEL_MAX && (cond) &&                       \
+        (level) <= hwcomposer::gLogLevel.load(std::memory_order_relaxed)) \
+      sink(__VA_ARGS__);                                                \
+  } while (0)
+
+#endif  // COMMON_UTILS_HWCLOGLEVEL_H_
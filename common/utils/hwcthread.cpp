@@ -72,7 +72,15 @@ void HWCThread::HandleExit() {
 }
 
 void HWCThread::HandleWait() {
-  if (fd_handler_.Poll(-1) <= 0) {
+  WaitForEvent(-1);
+}
+
+void HWCThread::WaitForEvent(int timeout) {
+  int ret = fd_handler_.Poll(timeout);
+  if (ret == 0)
+    return;
+
+  if (ret < 0) {
     ETRACE("Poll Failed in DisplayManager %s", PRINTERROR());
     return;
   }
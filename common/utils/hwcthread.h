@@ -41,6 +41,10 @@ class HWCThread {
   virtual void HandleExit();
   virtual void HandleWait();
 
+  // Block until Resume() is called or timeout (in milliseconds) expires.
+  // A negative timeout blocks indefinitely.
+  void WaitForEvent(int timeout);
+
   FDHandler fd_handler_;
   bool initialized_;
 
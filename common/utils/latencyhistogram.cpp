@@ -0,0 +1,73 @@
+/*
+// Copyright (c) 2017 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+#include "latencyhistogram.h"
+
+#include <algorithm>
+
+namespace hwcomposer {
+
+LatencyHistogram::LatencyHistogram() {
+  Reset();
+}
+
+void LatencyHistogram::Add(int64_t ns) {
+  int64_t us = ns > 0 ? ns / 1000 : 0;
+  if (us > UINT32_MAX)
+    us = UINT32_MAX;
+  const uint64_t index = count_.fetch_add(1, std::memory_order_relaxed);
+  samples_[index & (kWindow - 1)].store(uint32_t(us),
+                                        std::memory_order_relaxed);
+}
+
+LatencyHistogram::Summary LatencyHistogram::GetSummary() const {
+  Summary summary;
+  summary.count = count_.load(std::memory_order_relaxed);
+  summary.samples = uint32_t(std::min<uint64_t>(summary.count, kWindow));
+
+  // Until the window fills only the first slots have been written.
+  uint32_t values[kWindow];
+  for (uint32_t i = 0; i < summary.samples; i++)
+    values[i] = samples_[i].load(std::memory_order_relaxed);
+  std::sort(values, values + summary.samples);
+
+  summary.p50 = Percentile(values, summary.samples, 50);
+  summary.p90 = Percentile(values, summary.samples, 90);
+  summary.p99 = Percentile(values, summary.samples, 99);
+  summary.max = summary.samples ? values[summary.samples - 1] : 0;
+  return summary;
+}
+
+void LatencyHistogram::Reset() {
+  for (uint32_t i = 0; i < kWindow; i++)
+    samples_[i].store(0, std::memory_order_relaxed);
+  count_.store(0, std::memory_order_relaxed);
+}
+
+uint32_t LatencyHistogram::Percentile(const uint32_t* values, uint32_t count,
+                                      uint32_t percent) {
+  if (!count)
+    return 0;
+  // Rank is ceil(percent * count / 100), counting from 1.
+  uint64_t rank = (uint64_t(percent) * count + 99) / 100;
+  if (rank < 1)
+    rank = 1;
+  if (rank > count)
+    rank = count;
+  return values[rank - 1];
+}
+
+}  // namespace hwcomposer
@@ -0,0 +1,67 @@
+/*
+// Copyright (c) 2017 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+#ifndef COMMON_UTILS_LATENCYHISTOGRAM_H_
+#define COMMON_UTILS_LATENCYHISTOGRAM_H_
+
+#include <stdint.h>
+
+#include <atomic>
+
+namespace hwcomposer {
+
+// Latency percentiles over the last kWindow samples. Adding a sample is one
+// atomic increment and one store, so any number of threads can add without
+// a lock; the percentiles are only worked out when a summary is asked for.
+class LatencyHistogram {
+ public:
+  // Samples kept for the percentiles. A power of 2.
+  static const uint32_t kWindow = 512;
+
+  // Times are in microseconds.
+  struct Summary {
+    uint64_t count;    // Samples ever added.
+    uint32_t samples;  // Samples in the window.
+    uint32_t p50;
+    uint32_t p90;
+    uint32_t p99;
+    uint32_t max;
+  };
+
+  LatencyHistogram();
+
+  // Adds a latency in nanoseconds. Negative latencies count as 0.
+  void Add(int64_t ns);
+
+  // Percentiles of the window. A sample still being added by another thread
+  // may read as the sample it replaces.
+  Summary GetSummary() const;
+
+  // Samples added while resetting may survive it.
+  void Reset();
+
+  // Nearest rank percentile: the smallest value that is at least percent of
+  // the count values. values must be sorted.
+  static uint32_t Percentile(const uint32_t* values, uint32_t count,
+                             uint32_t percent);
+
+ private:
+  std::atomic<uint64_t> count_;
+  std::atomic<uint32_t> samples_[kWindow];
+};
+
+}  // namespace hwcomposer
+#endif  // COMMON_UTILS_LATENCYHISTOGRAM_H_
@@ -20,6 +20,7 @@
 #include <string>
 #include <sys/types.h>
 #include <time.h>
+#include <unistd.h>
 
 #include "platformdefines.h"
 
@@ -85,16 +86,13 @@ public:
         }
 
         char* ptr = entry;
-	// FIXME:
-	/*
+
         // Write the tid
         pid_t threadid = gettid();
         serialize(ptr, threadid);
 
         // Write the time
-        nsecs_t timestamp = systemTime(CLOCK_MONOTONIC);
-        serialize(ptr, timestamp);
-	*/
+        serialize(ptr, getTimestamp());
 
         // Write the formatted string
         int maxlen = entry + logAllocSize - ptr;
@@ -121,6 +119,14 @@ public:
         return ptr;
     }
 
+    // CLOCK_MONOTONIC time in nanoseconds, as written to each entry.
+    static int64_t getTimestamp()
+    {
+        struct timespec t;
+        clock_gettime(CLOCK_MONOTONIC, &t);
+        return int64_t(t.tv_sec) * 1000000000 + t.tv_nsec;
+    }
+
     const char* unpack(const char* ptr, pid_t& pid, int64_t& timestamp)
     {
         pid = unserialize<pid_t>(ptr);
@@ -24,12 +24,18 @@
 
 #include <spinlock.h>
 
-namespace hwcomposer {
+#include <atomic>
+#include <memory>
 
-#define ENTRY_LOST_MASK 0x8000
+namespace hwcomposer {
 
 // This is primarily a debug logging class expected to generate data thats expected
 // to be used by the validation team to check that the HWC is operating correctly.
+//
+// Every thread that logs writes to a ring of its own, so logging threads never
+// wait on each other or on a reader. read() merges the rings in timestamp
+// order; an entry still being written when the log is read can come out after
+// newer entries from other threads.
 class BasicLog : public AbstractLogRead, public AbstractLogWrite, public NonCopyable
 {
 public:
@@ -45,133 +51,319 @@ protected:
     virtual void        log(char* endPtr);
 
 private:
+    // Entries are 8 byte aligned and never wrap around the end of a ring.
+    // A zero size marks the rest of the ring as unused.
+    struct EntryHeader
+    {
+        uint32_t            mSize;          // Including this header.
+        uint32_t            mReserved;
+        int64_t             mTimestamp;
+    };
+
+    static uint64_t align(uint64_t size)    { return (size + 7) & ~uint64_t(7); }
+
+    // Single producer ring. mHead and mTail are byte positions that only ever
+    // increase. Both the producer, when it needs space, and the reader consume
+    // entries by advancing mTail with a compare and swap, so the reader only
+    // keeps its copy of an entry if the producer didn't discard it meanwhile.
+    class Ring
+    {
+    public:
+        Ring(uint32_t size);
+
+        // Producer side.
+        char*               reserve(uint32_t maxSize);
+        char*               getEntry()          { return reinterpret_cast<char*>(header(mEntry) + 1); }
+        bool                commit(char* endPtr, int64_t timestamp);
+
+        // Reader side. peek() returns the oldest entry's position and time;
+        // consume() copies it out, failing if it was discarded meanwhile.
+        bool                peek(uint64_t& tail, int64_t& timestamp);
+        bool                consume(uint64_t tail, std::vector<char>& copy);
+
+        std::atomic<bool>   mbOwned;
+        std::atomic<bool>   mbLost;
+
+    private:
+        EntryHeader*        header(uint64_t pos)
+        {
+            return reinterpret_cast<EntryHeader*>(reinterpret_cast<char*>(mBuf.get()) + pos % mSize);
+        }
+        void                discard(uint64_t end);
+
+        const uint32_t              mSize;
+        std::unique_ptr<uint64_t[]> mBuf;
+        std::atomic<uint64_t>       mHead;
+        std::atomic<uint64_t>       mTail;
+        uint64_t                    mEntry;         // Entry being written.
+        uint64_t                    mEntryEnd;      // End of its reservation.
+    };
+
+    // The calling thread's ring. Rings are shared so that a thread can hand
+    // its ring back when it exits even if the log has gone. The next new
+    // thread takes it over, along with any entries not read yet.
+    struct ThreadRing
+    {
+        uint32_t                mGeneration = 0;
+        std::shared_ptr<Ring>   mpRing;
+
+        ~ThreadRing()
+        {
+            if (mpRing)
+                mpRing->mbOwned = false;
+        }
+    };
+
+    Ring*               getRing()
+    {
+        return (stRing.mGeneration == mGeneration) ? stRing.mpRing.get() : registerThread();
+    }
+    Ring*               registerThread();
+
     Option                  mOptionLogSizeK;
-    char*                   mLogBuf;
-    char*                   mFront;
-    char*                   mBack;
     bool                    mbLogviewToLogcat;
-    uint32_t                mAllocatedSize;
-    SpinLock                mLock;
+    uint32_t                mRingSize;
+    const uint32_t          mGeneration;        // Tells this log's rings from those of earlier logs.
+    SpinLock                mLock;              // Guards mRings and reading.
+    std::vector<std::shared_ptr<Ring> > mRings;
+    std::vector<char>       mReadBuf;
+
+    static std::atomic<uint32_t>    sGeneration;
+    static thread_local ThreadRing  stRing;
 };
 
+std::atomic<uint32_t> BasicLog::sGeneration(0);
+thread_local BasicLog::ThreadRing BasicLog::stRing;
+
+BasicLog::Ring::Ring(uint32_t size) :
+    mbOwned(false),
+    mbLost(false),
+    mSize(size),
+    mBuf(new uint64_t[size / sizeof(uint64_t)]),
+    mHead(0),
+    mTail(0),
+    mEntry(0),
+    mEntryEnd(0)
+{
+}
+
+// Discards the oldest entries until everything before end fits in the ring.
+void BasicLog::Ring::discard(uint64_t end)
+{
+    const uint64_t head = mHead.load(std::memory_order_relaxed);
+    uint64_t tail = mTail.load(std::memory_order_relaxed);
+    while (end - tail > mSize)
+    {
+        uint64_t next;
+        if (tail >= head)
+        {
+            // Nothing left to read: the new entry starts an empty ring.
+            next = mEntry;
+        }
+        else
+        {
+            const uint32_t size = header(tail)->mSize;
+            next = size ? tail + align(size) : tail + mSize - tail % mSize;
+        }
+        if (mTail.compare_exchange_weak(tail, next, std::memory_order_relaxed))
+        {
+            if (tail < head)
+            {
+                DTRACEIF(HWCLOG_DEBUG, "Log: Discarding entry at %u", uint32_t(tail % mSize));
+                mbLost = true;
+            }
+            tail = next;
+        }
+    }
+    // Keep the discard ahead of the writes that overwrite the discarded entries.
+    std::atomic_thread_fence(std::memory_order_release);
+}
+
+char* BasicLog::Ring::reserve(uint32_t maxSize)
+{
+    const uint64_t size = align(sizeof(EntryHeader) + maxSize);
+    if (size > mSize)
+    {
+        return 0;
+    }
+
+    const uint64_t head = mHead.load(std::memory_order_relaxed);
+    const uint64_t offset = head % mSize;
+    mEntry = (offset + size > mSize) ? head + mSize - offset : head;
+    mEntryEnd = mEntry + size;
+    discard(mEntryEnd);
+
+    // Mark the rest of the ring unused if the reader could still get there.
+    if (mEntry != head && mTail.load(std::memory_order_relaxed) <= head)
+    {
+        header(head)->mSize = 0;
+    }
+    return getEntry();
+}
+
+bool BasicLog::Ring::commit(char* endPtr, int64_t timestamp)
+{
+    EntryHeader* pHeader = header(mEntry);
+    const uint64_t size = endPtr - reinterpret_cast<char*>(pHeader);
+    if (size > mEntryEnd - mEntry)
+    {
+        return false;
+    }
+    pHeader->mSize = size;
+    pHeader->mTimestamp = timestamp;
+    mHead.store(mEntry + align(size), std::memory_order_release);
+    return true;
+}
+
+bool BasicLog::Ring::peek(uint64_t& tail, int64_t& timestamp)
+{
+    for (;;)
+    {
+        tail = mTail.load(std::memory_order_acquire);
+        if (tail >= mHead.load(std::memory_order_acquire))
+        {
+            return false;
+        }
+        const EntryHeader* pHeader = header(tail);
+        const uint32_t size = pHeader->mSize;
+        timestamp = pHeader->mTimestamp;
+        if (size)
+        {
+            return true;
+        }
+        // Skip the unused end of the ring.
+        std::atomic_thread_fence(std::memory_order_acquire);
+        mTail.compare_exchange_strong(tail, tail + mSize - tail % mSize, std::memory_order_relaxed);
+    }
+}
+
+bool BasicLog::Ring::consume(uint64_t tail, std::vector<char>& copy)
+{
+    const char* pEntry = reinterpret_cast<const char*>(header(tail));
+    const uint32_t size = reinterpret_cast<const EntryHeader*>(pEntry)->mSize;
+    if (size >= sizeof(EntryHeader) && tail % mSize + size <= mSize)
+    {
+        copy.assign(pEntry, pEntry + size);
+    }
+    else
+    {
+        copy.clear();
+    }
+
+    // Anything the producer overwrote during the copy was discarded first.
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (copy.empty())
+    {
+        if (mTail.load(std::memory_order_relaxed) == tail)
+        {
+            ETRACE("Log error : Entry length %u at %u - resetting log", size, uint32_t(tail % mSize));
+            mTail.compare_exchange_strong(tail, mHead.load(std::memory_order_acquire), std::memory_order_relaxed);
+        }
+        return false;
+    }
+    return mTail.compare_exchange_strong(tail, tail + align(size), std::memory_order_relaxed);
+}
+
 BasicLog::BasicLog(uint32_t maxLogSize) :
     mOptionLogSizeK("debuglogbufk", 64),
-    mbLogviewToLogcat(false)
+    mbLogviewToLogcat(false),
+    mGeneration(++sGeneration)
 {
+    // Per thread.
     int32_t logSizeK = mOptionLogSizeK;
     if (logSizeK < 16) logSizeK = 16;
     if (logSizeK > 1024) logSizeK = 1024;
     maxLogSize = logSizeK * 1024;
 
-    mLogBuf = new char[maxLogSize + sizeof(uint16_t)];
-    DTRACEIF(HWCLOG_DEBUG, "Log: Allocated HWC Log buffer %d bytes @%p",
-             maxLogSize, mLogBuf);
-
-    HWCASSERT(mLogBuf != 0);
-    mFront = mBack = mLogBuf;
-    mAllocatedSize = maxLogSize;
+    mRingSize = maxLogSize;
 }
 
 BasicLog::~BasicLog() {
   ScopedSpinLock _l(mLock);
-  delete[] mLogBuf;
+  mRings.clear();
 }
 
-char* BasicLog::reserve(uint32_t maxSize) {
-  mLock.lock();
-  DTRACEIF(HWCLOG_DEBUG, "Log: OpenNewLogEntry mBack=%p", mBack);
-  char* possibleEntryEnd = mBack + maxSize;
-  if (possibleEntryEnd > mLogBuf + mAllocatedSize) {
-    if (mFront > mBack) {
-      DTRACEIF(HWCLOG_DEBUG,
-               "Log: Discarding remaining entries at %p and base entry at %p",
-               mFront, mLogBuf);
-      mFront = mLogBuf + ((*((uint16_t*)mLogBuf)) & ~ENTRY_LOST_MASK);
-      *((uint16_t*)mFront) |= ENTRY_LOST_MASK;
-    }
-    // Mark the rest of the buffer is not used
-    *((uint16_t*)mBack) = 0;
-    mBack = mLogBuf;
+BasicLog::Ring* BasicLog::registerThread() {
+  ScopedSpinLock _l(mLock);
+  if (stRing.mpRing) {
+    stRing.mpRing->mbOwned = false;
   }
 
-  // Discard any entries we MIGHT overflow on to
-  while ((mBack + maxSize > mFront) && (mBack < mFront)) {
-    uint16_t entrySize = *((uint16_t*)mFront) & ~ENTRY_LOST_MASK;
-
-    if (entrySize == 0) {
-      mFront = mLogBuf;
-    } else {
-      DTRACEIF(HWCLOG_DEBUG, "Log: Discarding %d byte entry at %p", entrySize,
-               mFront);
-      mFront += entrySize;
+  std::shared_ptr<Ring> ring;
+  for (const std::shared_ptr<Ring>& r : mRings) {
+    if (!r->mbOwned) {
+      ring = r;
+      break;
     }
+  }
+  if (!ring) {
+    ring = std::make_shared<Ring>(mRingSize);
+    mRings.push_back(ring);
+    DTRACEIF(HWCLOG_DEBUG, "Log: Allocated HWC Log ring %zu, %u bytes",
+             mRings.size(), mRingSize);
+  }
+  ring->mbOwned = true;
+  stRing.mpRing = ring;
+  stRing.mGeneration = mGeneration;
+  return ring.get();
+}
 
-    *((uint16_t*)mFront) |= ENTRY_LOST_MASK;
-    VTRACEIF(HWCLOG_DEBUG, "Log: Now front=%p", mFront);
+char* BasicLog::reserve(uint32_t maxSize) {
+  char* entry = getRing()->reserve(maxSize);
+  if (entry == 0) {
+    DTRACEIF(HWCLOG_DEBUG, "Log: %u byte entry too big for %u byte ring",
+             maxSize, mRingSize);
   }
-  DTRACEIF(HWCLOG_DEBUG, "Log: OpenNewLogEntry returning mBack=%p", mBack);
-  return mBack + sizeof(uint16_t);
+  return entry;
 }
 
 void BasicLog::log(char* endPtr) {
-  DTRACEIF(HWCLOG_DEBUG, "Log: %zd byte entry written @ %p", endPtr - mBack,
-           mBack);
-  if ((mBack < mFront) && (endPtr > mFront)) {
-    ETRACE("Log error : entry @ %p too big (%zd bytes) - resetting log", mBack,
-           endPtr - mBack);
-    if (endPtr > mLogBuf + mAllocatedSize) {
-      ETRACE(
-          "WARNING: Buffer at [%p - %p], entry ends @ %p, possible memory "
-          "corruption",
-          mLogBuf, mLogBuf + mAllocatedSize, endPtr);
-    }
-    mFront = mBack = mLogBuf;
-  } else {
-    *((uint16_t*)mBack) = (uint16_t)(endPtr - mBack);
-
-    if (mbLogviewToLogcat) {
-      logToLogcat(mBack + sizeof(uint16_t));
-    }
-
-    mBack = endPtr;
+  Ring* ring = getRing();
+  char* entry = ring->getEntry();
+  pid_t threadid;
+  int64_t timestamp;
+  unpack(entry, threadid, timestamp);
+
+  if (mbLogviewToLogcat) {
+    logToLogcat(entry);
   }
 
-  mLock.unlock();
+  if (!ring->commit(endPtr, timestamp)) {
+    ETRACE("Log error : entry @ %p too big (%zd bytes) - dropping it", entry,
+           endPtr - entry);
+  }
 }
 
 char* BasicLog::read(uint32_t& size, bool& lost) {
   // Caller must place a lock on mLock
-  if (mFront == mBack) {
-    // Log empty
-    return 0;
-  } else {
-    uint16_t entryHeader = (*((uint16_t*)mFront));
-    if (entryHeader == 0) {
-      mFront = mLogBuf;
-      entryHeader = (*((uint16_t*)mFront));
-    }
-
-    char* entry = mFront + sizeof(uint16_t);
-    bool entryLost = (entryHeader & ENTRY_LOST_MASK) != 0;
-    uint32_t entrySize = entryHeader & ~ENTRY_LOST_MASK;
-
-    if (entryLost) {
-      DTRACEIF(HWCLOG_DEBUG, "Log: Entry/ies lost");
+  for (;;) {
+    Ring* oldest = NULL;
+    uint64_t oldestTail = 0;
+    int64_t oldestTimestamp = 0;
+    for (const std::shared_ptr<Ring>& ring : mRings) {
+      uint64_t tail;
+      int64_t timestamp;
+      if (ring->peek(tail, timestamp) &&
+          (oldest == NULL || timestamp < oldestTimestamp)) {
+        oldest = ring.get();
+        oldestTail = tail;
+        oldestTimestamp = timestamp;
+      }
     }
 
-    if (entrySize < sizeof(uint16_t)) {
-      ETRACE("Log error : Entry length %d at %p - resetting log", entrySize,
-             mFront);
-      mFront = mBack = mLogBuf;
+    if (oldest == NULL) {
+      // Log empty
       return 0;
     }
 
-    DTRACEIF(HWCLOG_DEBUG, "Log: %d byte entry read at %p", entrySize, mFront);
-    mFront += entrySize;
-
-    size = entrySize - sizeof(uint16_t);
-    lost = entryLost;
-    return entry;
+    if (oldest->consume(oldestTail, mReadBuf)) {
+      lost = oldest->mbLost.exchange(false);
+      if (lost) {
+        DTRACEIF(HWCLOG_DEBUG, "Log: Entry/ies lost");
+      }
+      size = mReadBuf.size() - sizeof(EntryHeader);
+      return mReadBuf.data() + sizeof(EntryHeader);
+    }
   }
 }
 
@@ -356,6 +548,20 @@ void Log::addInternal(const Content& content, const char* description,
   return 0;
 }*/
 
+bool Log::read(std::vector<char>& entry, bool& lost) {
+  if (spLog == NULL) {
+    return false;
+  }
+  ScopedSpinLock _l(spLog->mLog->getLock());
+  uint32_t size = 0;
+  const char* ptr = spLog->mLog->read(size, lost);
+  if (ptr == NULL) {
+    return false;
+  }
+  entry.assign(ptr, ptr + size);
+  return true;
+}
+
 void Log::enableLogviewToLogcat(bool en) {
   if (en == true) {
     enable();
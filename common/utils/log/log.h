@@ -23,6 +23,8 @@
 #include "abstractlog.h"
 #include "platformdefines.h"
 
+#include <vector>
+
 namespace hwcomposer {
 
 namespace validation
@@ -194,6 +196,10 @@ public:
     // FIXME:
     // static err_status_t readLogParcel(Parcel* parcel);
 
+    // Copies out the oldest unread entry of any thread. Returns false if
+    // there is none. lost is set if entries before it were overwritten.
+    static bool read(std::vector<char>& entry, bool& lost);
+
     static void enable();
     static void disable();
     static Log* get()               { return spLog; }
@@ -0,0 +1,134 @@
+/*
+// Copyright (c) 2017 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+#ifndef COMMON_UTILS_MPSCQUEUE_H_
+#define COMMON_UTILS_MPSCQUEUE_H_
+
+#include <stddef.h>
+
+#include <atomic>
+#include <thread>
+
+namespace hwcomposer {
+
+// Bounded multi-producer single-consumer FIFO.
+// Push() may be called concurrently from any number of threads and never
+// blocks; it returns false if the queue is full. Pop() must only be called by
+// one thread at a time (the consumer), either because it is the only thread
+// that pops or because the caller serialises consumers with its own lock.
+// Items pushed by one producer are popped in the order they were pushed;
+// items from different producers are popped in the order their slots were
+// claimed. Capacity must be a power of two.
+template <typename T, size_t Capacity>
+class MPSCQueue {
+ public:
+  MPSCQueue() : enqueue_pos_(0), dequeue_pos_(0) {
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0,
+                  "MPSCQueue capacity must be a power of two");
+    for (size_t i = 0; i < Capacity; ++i)
+      cells_[i].sequence.store(i, std::memory_order_relaxed);
+  }
+
+  MPSCQueue(const MPSCQueue&) = delete;
+  MPSCQueue& operator=(const MPSCQueue&) = delete;
+
+  // Returns true if value has been queued.
+  bool Push(const T& value) {
+    size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+    Cell* cell;
+    for (;;) {
+      cell = &cells_[pos & (Capacity - 1)];
+      size_t seq = cell->sequence.load(std::memory_order_acquire);
+      intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+      if (diff == 0) {
+        if (enqueue_pos_.compare_exchange_weak(pos, pos + 1,
+                                               std::memory_order_relaxed))
+          break;
+      } else if (diff < 0) {
+        // The consumer has not yet released this slot.
+        return false;
+      } else {
+        pos = enqueue_pos_.load(std::memory_order_relaxed);
+      }
+    }
+    cell->value = value;
+    cell->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Returns true and sets *value if an item has been dequeued.
+  bool Pop(T* value) {
+    size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+    Cell* cell = &cells_[pos & (Capacity - 1)];
+    size_t seq = cell->sequence.load(std::memory_order_acquire);
+    if ((intptr_t)seq - (intptr_t)(pos + 1) < 0)
+      return false;
+    *value = cell->value;
+    cell->sequence.store(pos + Capacity, std::memory_order_release);
+    dequeue_pos_.store(pos + 1, std::memory_order_relaxed);
+    return true;
+  }
+
+  // Returns the position just past the last slot claimed by any producer.
+  // A Push() that has returned on the calling thread is always before it.
+  size_t Claimed() const {
+    return enqueue_pos_.load(std::memory_order_acquire);
+  }
+
+  // Like Pop(), but only for items whose slot was claimed before end (see
+  // Claimed()). A producer that has claimed the next slot but not yet
+  // published it is waited for, so no item claimed before end is left
+  // behind one popped after it. Returns false once all of them are popped.
+  bool PopBefore(size_t end, T* value) {
+    size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+    if ((intptr_t)(end - pos) <= 0)
+      return false;
+    Cell* cell = &cells_[pos & (Capacity - 1)];
+    while ((intptr_t)cell->sequence.load(std::memory_order_acquire) -
+               (intptr_t)(pos + 1) < 0)
+      std::this_thread::yield();
+    *value = cell->value;
+    cell->sequence.store(pos + Capacity, std::memory_order_release);
+    dequeue_pos_.store(pos + 1, std::memory_order_relaxed);
+    return true;
+  }
+
+  // Returns true if no item is published. This is a snapshot only and is
+  // exact only when called from the consumer with no producer active.
+  bool Empty() const {
+    size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+    const Cell* cell = &cells_[pos & (Capacity - 1)];
+    return (intptr_t)cell->sequence.load(std::memory_order_acquire) -
+               (intptr_t)(pos + 1) < 0;
+  }
+
+ private:
+  struct Cell {
+    std::atomic<size_t> sequence;
+    T value;
+  };
+
+  // Keep producer and consumer indices on separate cache lines.
+  static const size_t kCacheLine = 64;
+
+  Cell cells_[Capacity];
+  alignas(kCacheLine) std::atomic<size_t> enqueue_pos_;
+  alignas(kCacheLine) std::atomic<size_t> dequeue_pos_;
+};
+
+}  // namespace hwcomposer
+
+#endif  // COMMON_UTILS_MPSCQUEUE_H_
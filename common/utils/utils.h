@@ -219,6 +219,12 @@ inline void swap_uint32(uint32_t &a, uint32_t &b)
     b = tmp;
 }
 
+// Mix value into a running hash.
+inline uint64_t hashCombine( uint64_t seed, uint64_t value )
+{
+    return seed ^ ( value + 0x9e3779b97f4a7c15ULL + ( seed << 6 ) + ( seed >> 2 ) );
+}
+
 // Percentage difference.
 inline float pctDiff( const float a, const float b )
 {
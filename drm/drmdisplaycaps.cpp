@@ -20,6 +20,7 @@
 #include "log.h"
 #include "displaystate.h"
 
+#include <inttypes.h>
 #include <unistd.h>
 #include <xf86drm.h>
 #include <xf86drmMode.h>
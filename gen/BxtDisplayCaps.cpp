@@ -21,6 +21,8 @@
 #include "Transform.h"
 #include "GenCompression.h"
 
+#include <string.h>
+
 namespace intel {
 namespace ufo {
 namespace hwc {
@@ -41,9 +43,11 @@ BxtDisplayCaps::BxtDisplayCaps(uint32_t pipe, uint32_t scalarcount) :
     DisplayCaps(),
     mOptionScale("bxtscale", enableDownscale | enableUpscale),  // Enable both upscale and downscale by default
     mOptionLatencyL0("latencyl0", 20000 ),                      // 20.0us
+    mOptionDBufCache("bxtdbufcache", 1, false ),
     mPipe(pipe),
     mScalarCount(scalarcount),
-    mDisplayState(*this)
+    mDisplayState(*this),
+    mDBufTotal(0)
 {
 }
 
@@ -632,7 +636,7 @@ uint32_t BxtDisplayCaps::calculateMinimumBlocks( const uint32_t pipeHTotal, cons
     }
 }
 
-uint32_t BxtDisplayCaps::calculateDBuf( const Content::Display&  display, const Timing& timing ) const
+uint32_t BxtDisplayCaps::calculateDBuf( const Content::Display& display, const Timing& timing, std::vector<uint32_t>* pPlaneBlocks ) const
 {
     const Content::LayerStack& stack = display.getLayerStack( );
 
@@ -645,19 +649,149 @@ uint32_t BxtDisplayCaps::calculateDBuf( const Content::Display&  display, const
     }
 
     const uint32_t layers = stack.size();
+    if ( pPlaneBlocks )
+        pPlaneBlocks->assign( layers, 0 );
+
+    if ( !mOptionDBufCache )
+    {
+        uint32_t reqDBuf = 0;
+        for ( uint32_t i = 0; i < layers; ++i )
+        {
+            const Layer& ly = stack.getLayer( i );
+            if ( ly.isDisabled() )
+                continue;
+
+            const uint32_t planeDBuf = calculateMinimumBlocks( pipeHTotal, adjustedPipePixelRate, ly );
+            reqDBuf += planeDBuf;
+            if ( pPlaneBlocks )
+                (*pPlaneBlocks)[i] = planeDBuf;
+            ALOGD_IF( PLANEALLOC_CAPS_DEBUG, " DBUF : Plane %u  +%u DBUF Blocks (%u)", i, planeDBuf, reqDBuf );
+        }
+        return reqDBuf;
+    }
+
+    // Only layers that differ from the last stack at the same index are looked up,
+    // and the total is adjusted by the difference.
+    // Block counts may be ~0U (unsupported) so this relies on the same unsigned wrap as the sum.
+    for ( uint32_t i = layers; i < mDBufSlots.size(); ++i )
+    {
+        mDBufTotal -= mDBufSlots[i].mBlocks;
+    }
+    mDBufSlots.resize( layers );
 
-    uint32_t reqDBuf = 0;
+    const int32_t latency = mOptionLatencyL0;
     for ( uint32_t i = 0; i < layers; ++i )
     {
         const Layer& ly = stack.getLayer( i );
+        DBufSlot& slot = mDBufSlots[i];
+        uint32_t planeDBuf = 0;
+        if ( pPlaneBlocks )
+            (*pPlaneBlocks)[i] = slot.mBlocks;
         if ( ly.isDisabled() )
-            continue;
+        {
+            if ( !slot.mbEnabled )
+                continue;
+            slot.mbEnabled = false;
+        }
+        else
+        {
+            const DBufKey key( pipeHTotal, adjustedPipePixelRate, latency, ly );
+            if ( slot.mbEnabled && ( slot.mKey == key ) )
+                continue;
+            planeDBuf = lookupMinimumBlocks( key, ly );
+            slot.mKey = key;
+            slot.mbEnabled = true;
+        }
+        mDBufTotal += planeDBuf - slot.mBlocks;
+        slot.mBlocks = planeDBuf;
+        if ( pPlaneBlocks )
+            (*pPlaneBlocks)[i] = planeDBuf;
+        ALOGD_IF( PLANEALLOC_CAPS_DEBUG, " DBUF : Plane %u  =%u DBUF Blocks (%u)", i, planeDBuf, mDBufTotal );
+    }
+    return mDBufTotal;
+}
 
-        const uint32_t planeDBuf = calculateMinimumBlocks( pipeHTotal, adjustedPipePixelRate, ly );
-        reqDBuf += planeDBuf;
-        ALOGD_IF( PLANEALLOC_CAPS_DEBUG, " DBUF : Plane %u  +%u DBUF Blocks (%u)", i, planeDBuf, reqDBuf );
+BxtDisplayCaps::DBufKey::DBufKey() :
+    mPipePixelRate( 0 ),
+    mPipeHTotal( 0 ),
+    mLatency( 0 ),
+    mSrcWidth( 0.0f ),
+    mSrcHeight( 0.0f ),
+    mDstWidth( 0 ),
+    mDstHeight( 0 ),
+    mFormat( 0 ),
+    mbScale( false ),
+    mbTransposed( false ),
+    mbYTiled( false ),
+    mbCompressed( false )
+{
+}
+
+// Everything calculateMinimumBlocks() reads from the layer.
+BxtDisplayCaps::DBufKey::DBufKey( uint32_t pipeHTotal, uint64_t adjustedPipePixelRate, int32_t latency, const Layer& ly ) :
+    mPipePixelRate( adjustedPipePixelRate ),
+    mPipeHTotal( pipeHTotal ),
+    mLatency( latency ),
+    mSrcWidth( ly.getSrcWidth() ),
+    mSrcHeight( ly.getSrcHeight() ),
+    mDstWidth( ly.getDstWidth() ),
+    mDstHeight( ly.getDstHeight() ),
+    mFormat( ly.getBufferFormat() ),
+    mbScale( ly.isScale() ),
+    mbTransposed( isTranspose( ly.getTransform() ) ),
+    mbYTiled( ly.getBufferTilingFormat() == TILE_Y ),
+    mbCompressed( ly.getBufferCompression() != COMPRESSION_NONE )
+{
+}
+
+bool BxtDisplayCaps::DBufKey::operator==( const DBufKey& other ) const
+{
+    return ( mPipePixelRate == other.mPipePixelRate )
+        && ( mPipeHTotal    == other.mPipeHTotal )
+        && ( mLatency       == other.mLatency )
+        && ( mSrcWidth      == other.mSrcWidth )
+        && ( mSrcHeight     == other.mSrcHeight )
+        && ( mDstWidth      == other.mDstWidth )
+        && ( mDstHeight     == other.mDstHeight )
+        && ( mFormat        == other.mFormat )
+        && ( mbScale        == other.mbScale )
+        && ( mbTransposed   == other.mbTransposed )
+        && ( mbYTiled       == other.mbYTiled )
+        && ( mbCompressed   == other.mbCompressed );
+}
+
+uint32_t BxtDisplayCaps::DBufKey::hash( void ) const
+{
+    uint32_t srcWidth, srcHeight;
+    memcpy( &srcWidth, &mSrcWidth, sizeof( srcWidth ) );
+    memcpy( &srcHeight, &mSrcHeight, sizeof( srcHeight ) );
+    const uint32_t words[] =
+    {
+        uint32_t( mPipePixelRate ), uint32_t( mPipePixelRate >> 32 ), mPipeHTotal, uint32_t( mLatency ),
+        srcWidth, srcHeight, mDstWidth, mDstHeight, mFormat,
+        uint32_t( mbScale ) | ( uint32_t( mbTransposed ) << 1 ) | ( uint32_t( mbYTiled ) << 2 ) | ( uint32_t( mbCompressed ) << 3 ),
+    };
+    // FNV-1a over the words.
+    uint32_t h = 2166136261U;
+    for ( uint32_t w = 0; w < DISPLAY_CAPS_COUNT_OF( words ); ++w )
+    {
+        h = ( h ^ words[w] ) * 16777619U;
+    }
+    return h ^ ( h >> 16 );
+}
+
+uint32_t BxtDisplayCaps::lookupMinimumBlocks( const DBufKey& key, const Layer& ly ) const
+{
+    DBufEntry& entry = maDBufCache[ key.hash() % cDBufCacheSize ];
+    if ( entry.mbValid && ( entry.mKey == key ) )
+    {
+        ALOGD_IF( PLANEALLOC_CAPS_DEBUG, "  lookupMinimumBlocks cached %u Layer:%s", entry.mBlocks, ly.dump().string() );
+        return entry.mBlocks;
     }
-    return reqDBuf;
+    entry.mBlocks = calculateMinimumBlocks( key.mPipeHTotal, key.mPipePixelRate, ly );
+    entry.mKey = key;
+    entry.mbValid = true;
+    return entry.mBlocks;
 }
 
 }; // namespace hwc
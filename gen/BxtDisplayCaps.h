@@ -20,6 +20,7 @@
 
 #include "DisplayCaps.h"
 #include "DisplayState.h"
+#include <vector>
 #define BXT_PLATFORM_SCALAR_COUNT 2
 #define GLV_PLATFORM_SCALAR_COUNT 1
 // TODO:
@@ -77,9 +78,17 @@ public:
 
     const DisplayState& getState( void ) const { return mDisplayState; }
 
+    // DBuf blocks needed by the display's enabled layers with this timing.
+    // If pPlaneBlocks is provided it is set to the blocks of each layer (0 if disabled).
+    uint32_t calculateDBuf( const Content::Display& display, const Timing& timing, std::vector<uint32_t>* pPlaneBlocks = NULL ) const;
+
+    // Enable or disable caching of DBuf block requirements (the "bxtdbufcache" option).
+    void setDBufCache( bool bEnable )   { mOptionDBufCache.set( bEnable ? 1 : 0 ); }
+
 private:
     Option                  mOptionScale;
     Option                  mOptionLatencyL0;
+    Option                  mOptionDBufCache;
     BxtPlaneCaps            mPlanes[cPlaneCount];
     uint32_t                mPipe;
     uint32_t                mScalarCount;
@@ -104,7 +113,61 @@ private:
                                    const bool bTransposed,
                                    const bool bCompressed ) const;
     uint32_t calculateMinimumBlocks( const uint32_t pipeHTotal, const uint64_t adjustedPipePixelRate, const Layer& ly ) const;
-    uint32_t calculateDBuf( const Content::Display&  display, const Timing& timing ) const;
+
+    // DBuf cache.
+    // isSupported() is called for each candidate z-order and the layers and timing rarely change
+    // between candidates or frames, so block requirements are cached on the inputs they depend on.
+    class DBufKey
+    {
+    public:
+        DBufKey();
+        DBufKey( uint32_t pipeHTotal, uint64_t adjustedPipePixelRate, int32_t latency, const Layer& ly );
+        bool operator==( const DBufKey& other ) const;
+        uint32_t hash( void ) const;
+
+        uint64_t    mPipePixelRate;     //< Adjusted (pipe downscaled) pixel rate.
+        uint32_t    mPipeHTotal;
+        int32_t     mLatency;           //< mOptionLatencyL0 in use.
+        float       mSrcWidth;
+        float       mSrcHeight;
+        uint32_t    mDstWidth;
+        uint32_t    mDstHeight;
+        uint32_t    mFormat;
+        bool        mbScale:1;
+        bool        mbTransposed:1;
+        bool        mbYTiled:1;
+        bool        mbCompressed:1;
+    };
+
+    // Per layer cache of calculateMinimumBlocks() results, direct mapped on DBufKey::hash().
+    class DBufEntry
+    {
+    public:
+        DBufEntry() : mBlocks( 0 ), mbValid( false ) { }
+        DBufKey     mKey;
+        uint32_t    mBlocks;
+        bool        mbValid;
+    };
+    static const uint32_t cDBufCacheSize = 32;
+
+    // Blocks for the layer at one index of the last stack passed to calculateDBuf().
+    // The pipe total is updated from the slots that change.
+    class DBufSlot
+    {
+    public:
+        DBufSlot() : mBlocks( 0 ), mbEnabled( false ) { }
+        DBufKey     mKey;
+        uint32_t    mBlocks;
+        bool        mbEnabled;
+    };
+
+    uint32_t lookupMinimumBlocks( const DBufKey& key, const Layer& ly ) const;
+
+    // Mutable so isSupported() can remain const.
+    // Only the display's own plane allocation uses these, so no locking is required.
+    mutable DBufEntry               maDBufCache[ cDBufCacheSize ];
+    mutable std::vector<DBufSlot>   mDBufSlots;
+    mutable uint32_t                mDBufTotal;
 };
 
 }; // namespace hwc
@@ -40,7 +40,8 @@ public:
         TRANSACT_ENABLE_DISPLAY,
         TRANSACT_DISABLE_DISPLAY,
         TRANSACT_MASK_LAYER,
-        TRANSACT_DUMP_FRAMES
+        TRANSACT_DUMP_FRAMES,
+        TRANSACT_READ_LATENCY_PARCEL
     };
 
     virtual ~BpDiagnostic()
@@ -114,6 +115,19 @@ public:
         }
     }
 
+    status_t readLatencyParcel(uint32_t d, Parcel* reply)
+    {
+        Parcel data;
+        data.writeInterfaceToken(IDiagnostic::getInterfaceDescriptor());
+        data.writeInt32(d);
+        status_t ret = remote()->transact(TRANSACT_READ_LATENCY_PARCEL, data, reply);
+        if (ret != NO_ERROR)
+        {
+            ALOGW("%s() transact failed: %d", __FUNCTION__, ret);
+        }
+        return ret;
+    }
+
 private:
     Parcel* mReply;
 };
@@ -172,6 +186,14 @@ status_t BnDiagnostic::onTransact(
             return NO_ERROR;
         }
 
+        case BpDiagnostic::TRANSACT_READ_LATENCY_PARCEL:
+        {
+            CHECK_INTERFACE(IDiagnostic, data, reply);
+            uint32_t d = data.readInt32();
+            status_t err = readLatencyParcel(d, reply);
+            return err;
+        }
+
         default:
         return BBinder::onTransact(code, data, reply, flags);
     }
@@ -41,6 +41,14 @@ public:
 
     virtual status_t readLogParcel(android::Parcel* reply) = 0;
 
+    // Frame latency of display d over its last few hundred frames. Returns
+    // NAME_NOT_FOUND if the display has none. The reply holds the stage
+    // count then, for each of present-to-commit, commit-to-flip and
+    // acquire-wait, int64 samples ever recorded followed by int32 samples in
+    // the window, p50, p90, p99 and max in microseconds. Then int64 frames
+    // and int64 missed vblanks.
+    virtual status_t readLatencyParcel(uint32_t d, android::Parcel* reply) = 0;
+
     // Debug API
     virtual void enableDisplay(uint32_t d) = 0;
     virtual void disableDisplay(uint32_t d, bool bBlank) = 0;
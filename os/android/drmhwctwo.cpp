@@ -23,6 +23,7 @@
 #include <xf86drmMode.h>
 
 #include <inttypes.h>
+#include <string.h>
 
 #include <cutils/log.h>
 #include <cutils/properties.h>
@@ -33,6 +34,8 @@
 #include <hwcdefs.h>
 #include <nativedisplay.h>
 
+#include "framelatency.h"
+
 #include <string>
 #include <memory>
 #include <algorithm>
@@ -120,8 +123,18 @@ HWC2::Error DrmHwcTwo::DestroyVirtualDisplay(hwc2_display_t display) {
 }
 
 void DrmHwcTwo::Dump(uint32_t *size, char *buffer) {
-  // TODO: Implement dump
-  unsupported(__func__, size, buffer);
+  supported(__func__);
+  // SurfaceFlinger asks for the size first, then for the dump itself.
+  if (!buffer) {
+    device_.SaveFrameTrace();
+    device_.SaveLayerCapture();
+    dump_string_ = hwcomposer::FrameLatency::DumpAll().string();
+    *size = dump_string_.size();
+    return;
+  }
+
+  *size = std::min<uint32_t>(*size, dump_string_.size());
+  memcpy(buffer, dump_string_.data(), *size);
 }
 
 uint32_t DrmHwcTwo::GetMaxVirtualDisplayCount() {
@@ -26,6 +26,7 @@
 #include <scopedfd.h>
 
 #include <map>
+#include <string>
 #include <utility>
 
 namespace hwcomposer {
@@ -241,6 +242,7 @@ class DrmHwcTwo : public hwc2_device_t {
   hwcomposer::GpuDevice device_;
   std::map<hwc2_display_t, HwcDisplay> displays_;
   std::map<HWC2::Callback, HwcCallback> callbacks_;
+  std::string dump_string_;
 
   bool disable_explicit_sync_ = false;
 };
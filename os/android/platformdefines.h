@@ -25,6 +25,12 @@
 #define ATRACE_TAG ATRACE_TAG_GRAPHICS
 #endif
 
+// Default path for the frame trace written by GpuDevice::SaveFrameTrace().
+#define HWC_FRAME_TRACE_FILE "/data/local/tmp/hwcframetrace.bin"
+
+// Default path for the capture written by GpuDevice::SaveLayerCapture().
+#define HWC_LAYER_CAPTURE_FILE "/data/local/tmp/hwclayercapture.bin"
+
 #include <utils/Trace.h>
 #include <cutils/log.h>
 #include <cutils/properties.h>
@@ -39,6 +45,7 @@
 #include <utils/Timers.h>
 
 #include "hwcdefs_internal.h"
+#include "hwcloglevel.h"
 #include "drmutils_android.h"
 
 #ifdef _cplusplus
@@ -54,16 +61,38 @@ typedef struct gralloc_handle* HWCNativeHandle;
 typedef android::String8 HWCString;
 typedef android::status_t err_status_t;
 
-#define VTRACE(fmt, ...) ALOGV("%s: " fmt, __func__, ##__VA_ARGS__)
-#define DTRACE(fmt, ...) ALOGD("%s: " fmt, __func__, ##__VA_ARGS__)
-#define ITRACE(fmt, ...) ALOGI(fmt, ##__VA_ARGS__)
-#define WTRACE(fmt, ...) ALOGW("%s: " fmt, __func__, ##__VA_ARGS__)
-#define ETRACE(fmt, ...) ALOGE("%s: " fmt, __func__, ##__VA_ARGS__)
-#define ETRACEIF(fmt, ...) ALOGE_IF("%s: " fmt, __func__, ##__VA_ARGS__)
-#define ITRACEIF(fmt, ...) ALOGI_IF(fmt, ##__VA_ARGS__)
-#define DTRACEIF(fmt, ...) ALOGD_IF("%s: " fmt, __func__, ##__VA_ARGS__)
-#define VTRACEIF(fmt, ...) ALOGV_IF("%s: " fmt, __func__, ##__VA_ARGS__)
-#define WTRACEIF(fmt, ...) ALOGW_IF("%s: " fmt, __func__, ##__VA_ARGS__)
+// The conditional Android log macros go through the HWC log level too, so
+// that levels above HWC_LOG_LEVEL_MAX leave nothing behind.
+#undef ALOGV_IF
+#undef ALOGD_IF
+#undef ALOGI_IF
+#undef ALOGW_IF
+#undef ALOGE_IF
+#define ALOGV_IF(cond, ...) \
+  HWC_LOG_IF(HWC_LOG_LEVEL_VERBOSE, cond, ALOGV, __VA_ARGS__)
+#define ALOGD_IF(cond, ...) \
+  HWC_LOG_IF(HWC_LOG_LEVEL_DEBUG, cond, ALOGD, __VA_ARGS__)
+#define ALOGI_IF(cond, ...) \
+  HWC_LOG_IF(HWC_LOG_LEVEL_INFO, cond, ALOGI, __VA_ARGS__)
+#define ALOGW_IF(cond, ...) \
+  HWC_LOG_IF(HWC_LOG_LEVEL_WARN, cond, ALOGW, __VA_ARGS__)
+#define ALOGE_IF(cond, ...) \
+  HWC_LOG_IF(HWC_LOG_LEVEL_ERROR, cond, ALOGE, __VA_ARGS__)
+
+#define VTRACEIF(cond, fmt, ...) \
+  ALOGV_IF(cond, "%s: " fmt, __func__, ##__VA_ARGS__)
+#define DTRACEIF(cond, fmt, ...) \
+  ALOGD_IF(cond, "%s: " fmt, __func__, ##__VA_ARGS__)
+#define ITRACEIF(cond, fmt, ...) ALOGI_IF(cond, fmt, ##__VA_ARGS__)
+#define WTRACEIF(cond, fmt, ...) \
+  ALOGW_IF(cond, "%s: " fmt, __func__, ##__VA_ARGS__)
+#define ETRACEIF(cond, fmt, ...) \
+  ALOGE_IF(cond, "%s: " fmt, __func__, ##__VA_ARGS__)
+#define VTRACE(fmt, ...) VTRACEIF(true, fmt, ##__VA_ARGS__)
+#define DTRACE(fmt, ...) DTRACEIF(true, fmt, ##__VA_ARGS__)
+#define ITRACE(fmt, ...) ITRACEIF(true, fmt, ##__VA_ARGS__)
+#define WTRACE(fmt, ...) WTRACEIF(true, fmt, ##__VA_ARGS__)
+#define ETRACE(fmt, ...) ETRACEIF(true, fmt, ##__VA_ARGS__)
 #define HWCASSERT(fmt, ...) \
   ALOG_ASSERT(stderr, "%s: \n" fmt, __func__, ##__VA_ARGS__)
 #define STRACE() ATRACE_CALL()
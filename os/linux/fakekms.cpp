@@ -0,0 +1,1693 @@
+/*
+// Copyright (c) 2017 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+// This file implements the libdrm calls, so it must see the real ones.
+#define FAKE_KMS_IMPLEMENTATION
+
+#include "fakekms.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <drm_fourcc.h>
+
+#include <atomic>
+#include <set>
+
+#include "hwcthread.h"
+#include "hwctrace.h"
+#include "nativesync.h"
+#include "spinlock.h"
+
+#ifndef DRM_MODE_PROP_OBJECT
+#define DRM_MODE_PROP_OBJECT (1 << 6)
+#endif
+#ifndef DRM_MODE_PROP_SIGNED_RANGE
+#define DRM_MODE_PROP_SIGNED_RANGE (2 << 6)
+#endif
+#ifndef DRM_MODE_PROP_ATOMIC
+#define DRM_MODE_PROP_ATOMIC 0x80000000
+#endif
+#ifndef DRM_MODE_ROTATE_0
+#define DRM_MODE_ROTATE_0 (1 << 0)
+#endif
+#ifndef DRM_MODE_CONNECTOR_VIRTUAL
+#define DRM_MODE_CONNECTOR_VIRTUAL 15
+#endif
+#ifndef DRM_MODE_ENCODER_VIRTUAL
+#define DRM_MODE_ENCODER_VIRTUAL 5
+#endif
+
+namespace hwcomposer {
+
+namespace {
+
+const uint64_t kModLinear = 0;
+const uint64_t kModXTiled = (1ULL << 56) | 1;
+const uint64_t kModYTiled = (1ULL << 56) | 2;
+
+// The IN_FORMATS blob layout, struct drm_format_modifier_blob and struct
+// drm_format_modifier, for headers that predate it.
+struct FormatModifierBlob {
+  uint32_t version;
+  uint32_t flags;
+  uint32_t count_formats;
+  uint32_t formats_offset;
+  uint32_t count_modifiers;
+  uint32_t modifiers_offset;
+};
+
+struct FormatModifier {
+  uint64_t formats;
+  uint32_t offset;
+  uint32_t pad;
+  uint64_t modifier;
+};
+
+const char kUevent[] =
+    "change@/devices/platform/fakekms/drm/card0\0"
+    "ACTION=change\0"
+    "DEVPATH=/devices/platform/fakekms/drm/card0\0"
+    "SUBSYSTEM=drm\0"
+    "HOTPLUG=1\0"
+    "DEVNAME=dri/card0\0"
+    "DEVTYPE=drm_minor";
+
+// Each call holds a reference to its device, so drmClose() on another thread
+// only frees it once the calls in flight return.
+SpinLock registry_lock_;
+std::map<int, std::pair<ino_t, std::shared_ptr<FakeKms>>> registry_;
+std::atomic<int> device_count_(0);
+std::unique_ptr<FakeKms::Config> selected_;
+
+int64_t Now() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return int64_t(t.tv_sec) * 1000000000 + t.tv_nsec;
+}
+
+// libdrm returns -errno from its mode calls and sets errno too on older
+// versions; do both.
+int Fail(int error) {
+  errno = error;
+  return -error;
+}
+
+// libdrm frees what it returns with free(), member arrays included, so the
+// results are built the same way and can go to the drmModeFree* calls.
+template <typename T>
+T *Allocate() {
+  return static_cast<T *>(calloc(1, sizeof(T)));
+}
+
+template <typename T>
+T *Copy(const std::vector<T> &values) {
+  if (values.empty())
+    return NULL;
+  T *copy = static_cast<T *>(malloc(values.size() * sizeof(T)));
+  memcpy(copy, values.data(), values.size() * sizeof(T));
+  return copy;
+}
+
+bool IsSignalled(int fence, int timeout) {
+  struct pollfd fds;
+  fds.fd = fence;
+  fds.events = POLLIN;
+  fds.revents = 0;
+  return poll(&fds, 1, timeout) > 0;
+}
+
+}  // namespace
+
+// Wakes up for the next vblank of the realtime clock.
+class FakeKms::Ticker : public HWCThread {
+ public:
+  explicit Ticker(FakeKms *kms)
+      : HWCThread(-8, "FakeKmsTicker"), kms_(kms), timeout_(-1) {
+  }
+
+  bool Start() {
+    return InitWorker();
+  }
+
+  void Stop() {
+    Exit();
+  }
+
+  void Wake() {
+    Resume();
+  }
+
+ protected:
+  void HandleWait() override {
+    WaitForEvent(timeout_);
+  }
+
+  void HandleRoutine() override {
+    int64_t next = kms_->Tick();
+    if (next < 0) {
+      timeout_ = -1;
+      return;
+    }
+
+    int64_t wait = next - Now();
+    timeout_ = wait > 0 ? (wait + 999999) / 1000000 : 0;
+  }
+
+ private:
+  FakeKms *kms_;
+  int timeout_;
+};
+
+struct FakeKms::AtomicReq {
+  struct Item {
+    uint32_t object;
+    uint32_t property;
+    uint64_t value;
+  };
+
+  std::vector<Item> items;
+};
+
+FakeKms::Config::Config()
+    : pipes(1),
+      overlays(3),
+      cursor(true),
+      width(1920),
+      height(1080),
+      refresh(60),
+      clock(kRealtime),
+      max_planes(0),
+      reject_scaling(false),
+      reject_rotation(false),
+      fail_every(0) {
+}
+
+bool FakeKms::ParseConfig(const char *spec, Config *config) {
+  std::string settings(spec);
+  size_t start = 0;
+  while (start <= settings.size()) {
+    size_t end = settings.find(',', start);
+    if (end == std::string::npos)
+      end = settings.size();
+    std::string setting = settings.substr(start, end - start);
+    start = end + 1;
+    if (setting.empty() || setting == "1")
+      continue;
+
+    std::string key = setting, value;
+    size_t equals = setting.find('=');
+    if (equals != std::string::npos) {
+      key = setting.substr(0, equals);
+      value = setting.substr(equals + 1);
+    }
+    uint32_t number = strtoul(value.c_str(), NULL, 0);
+    bool flag = value.empty() || number;
+
+    if (key == "pipes" && number) {
+      config->pipes = number;
+    } else if (key == "overlays") {
+      config->overlays = number;
+    } else if (key == "cursor") {
+      config->cursor = flag;
+    } else if (key == "mode") {
+      unsigned width, height, refresh = config->refresh;
+      if (sscanf(value.c_str(), "%ux%u@%u", &width, &height, &refresh) < 2 ||
+          !width || !height || !refresh)
+        return false;
+      config->width = width;
+      config->height = height;
+      config->refresh = refresh;
+    } else if (key == "clock") {
+      if (value == "realtime")
+        config->clock = kRealtime;
+      else if (value == "immediate")
+        config->clock = kImmediate;
+      else if (value == "manual")
+        config->clock = kManual;
+      else
+        return false;
+    } else if (key == "max-planes") {
+      config->max_planes = number;
+    } else if (key == "reject-scaling") {
+      config->reject_scaling = flag;
+    } else if (key == "reject-rotation") {
+      config->reject_rotation = flag;
+    } else if (key == "fail-every") {
+      config->fail_every = number;
+    } else {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+int FakeKms::Open(const Config &config) {
+  std::unique_ptr<FakeKms> kms(new FakeKms(config));
+  if (!kms->Init())
+    return -1;
+
+  struct stat st;
+  int fd = kms->fd_[0];
+  fstat(fd, &st);
+  if (config.clock == kRealtime) {
+    kms->ticker_.reset(new Ticker(kms.get()));
+    if (!kms->ticker_->Start()) {
+      ETRACE("Failed to start the fake KMS vblank thread. %s", PRINTERROR());
+      return -1;
+    }
+  }
+
+  ScopedSpinLock lock(registry_lock_);
+  registry_[fd] =
+      std::make_pair(st.st_ino, std::shared_ptr<FakeKms>(kms.release()));
+  device_count_++;
+  return fd;
+}
+
+void FakeKms::Select(const Config *config) {
+  ScopedSpinLock lock(registry_lock_);
+  selected_.reset(config ? new Config(*config) : NULL);
+}
+
+std::shared_ptr<FakeKms> FakeKms::Get(int fd) {
+  if (!device_count_.load(std::memory_order_relaxed))
+    return NULL;
+
+  std::shared_ptr<FakeKms> stale;
+  {
+    ScopedSpinLock lock(registry_lock_);
+    std::map<int, std::pair<ino_t, std::shared_ptr<FakeKms>>>::iterator it =
+        registry_.find(fd);
+    if (it == registry_.end())
+      return NULL;
+
+    // The fd may have been closed without drmClose() and reused since.
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_ino == it->second.first)
+      return it->second.second;
+
+    stale.swap(it->second.second);
+    stale->fd_[0] = -1;
+    registry_.erase(it);
+    device_count_--;
+  }
+
+  // Freed here, outside the lock, unless a call is still using it.
+  return NULL;
+}
+
+FakeKms::FakeKms(const Config &config)
+    : config_(config),
+      render_fd_(-1),
+      atomic_(false),
+      closing_(false),
+      next_id_(1) {
+  fd_[0] = fd_[1] = -1;
+  hotplug_fd_[0] = hotplug_fd_[1] = -1;
+  memset(&stats_, 0, sizeof(stats_));
+  memset(&prop_, 0, sizeof(prop_));
+}
+
+FakeKms::~FakeKms() {
+  if (ticker_)
+    ticker_->Stop();
+
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    closing_ = true;
+    for (Crtc &crtc : crtcs_)
+      CompleteFlips(crtc, true);
+  }
+  vblank_cond_.notify_all();
+
+  for (int fd : {fd_[0], fd_[1], hotplug_fd_[0], hotplug_fd_[1], render_fd_}) {
+    if (fd >= 0)
+      close(fd);
+  }
+}
+
+bool FakeKms::Init() {
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fd_) ||
+      socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, hotplug_fd_)) {
+    ETRACE("Failed to create fake KMS device. %s", PRINTERROR());
+    return false;
+  }
+
+  for (int i = 128; i < 136 && render_fd_ < 0; i++) {
+    char path[32];
+    snprintf(path, sizeof(path), "/dev/dri/renderD%d", i);
+    render_fd_ = open(path, O_RDWR | O_CLOEXEC);
+  }
+
+  const uint32_t atomic = DRM_MODE_PROP_ATOMIC;
+  const uint64_t int_max = INT_MAX;
+  prop_.active = AddProperty("ACTIVE", DRM_MODE_PROP_RANGE | atomic, {0, 1});
+  prop_.mode_id = AddProperty("MODE_ID", DRM_MODE_PROP_BLOB | atomic, {});
+  prop_.out_fence_ptr = AddProperty(
+      "OUT_FENCE_PTR", DRM_MODE_PROP_RANGE | atomic, {0, UINT64_MAX});
+  prop_.gamma_lut = AddProperty("GAMMA_LUT", DRM_MODE_PROP_BLOB, {});
+  prop_.gamma_lut_size = AddProperty(
+      "GAMMA_LUT_SIZE", DRM_MODE_PROP_RANGE | DRM_MODE_PROP_IMMUTABLE,
+      {0, UINT_MAX});
+
+  prop_.crtc_id = AddProperty("CRTC_ID", DRM_MODE_PROP_OBJECT | atomic,
+                              {DRM_MODE_OBJECT_CRTC});
+  prop_.dpms = AddProperty("DPMS", DRM_MODE_PROP_ENUM, {0, 1, 2, 3},
+                           {"On", "Standby", "Suspend", "Off"});
+  prop_.broadcast_rgb =
+      AddProperty("Broadcast RGB", DRM_MODE_PROP_ENUM, {0, 1, 2},
+                  {"Automatic", "Full", "Limited 16:235"});
+
+  prop_.type = AddProperty("type", DRM_MODE_PROP_ENUM | DRM_MODE_PROP_IMMUTABLE,
+                           {DRM_PLANE_TYPE_OVERLAY, DRM_PLANE_TYPE_PRIMARY,
+                            DRM_PLANE_TYPE_CURSOR},
+                           {"Overlay", "Primary", "Cursor"});
+  prop_.fb_id = AddProperty("FB_ID", DRM_MODE_PROP_OBJECT | atomic,
+                            {DRM_MODE_OBJECT_FB});
+  prop_.plane_crtc_id = AddProperty("CRTC_ID", DRM_MODE_PROP_OBJECT | atomic,
+                                    {DRM_MODE_OBJECT_CRTC});
+  prop_.crtc_x = AddProperty("CRTC_X", DRM_MODE_PROP_SIGNED_RANGE | atomic,
+                             {uint64_t(int64_t(INT_MIN)), int_max});
+  prop_.crtc_y = AddProperty("CRTC_Y", DRM_MODE_PROP_SIGNED_RANGE | atomic,
+                             {uint64_t(int64_t(INT_MIN)), int_max});
+  prop_.crtc_w = AddProperty("CRTC_W", DRM_MODE_PROP_RANGE | atomic,
+                             {0, int_max});
+  prop_.crtc_h = AddProperty("CRTC_H", DRM_MODE_PROP_RANGE | atomic,
+                             {0, int_max});
+  prop_.src_x = AddProperty("SRC_X", DRM_MODE_PROP_RANGE | atomic,
+                            {0, UINT_MAX});
+  prop_.src_y = AddProperty("SRC_Y", DRM_MODE_PROP_RANGE | atomic,
+                            {0, UINT_MAX});
+  prop_.src_w = AddProperty("SRC_W", DRM_MODE_PROP_RANGE | atomic,
+                            {0, UINT_MAX});
+  prop_.src_h = AddProperty("SRC_H", DRM_MODE_PROP_RANGE | atomic,
+                            {0, UINT_MAX});
+  prop_.in_fence_fd = AddProperty("IN_FENCE_FD",
+                                  DRM_MODE_PROP_SIGNED_RANGE | atomic,
+                                  {uint64_t(int64_t(-1)), int_max});
+  prop_.rotation = AddProperty("rotation", DRM_MODE_PROP_BITMASK,
+                               {0, 1, 2, 3, 4, 5},
+                               {"rotate-0", "rotate-90", "rotate-180",
+                                "rotate-270", "reflect-x", "reflect-y"});
+  prop_.alpha = AddProperty("alpha", DRM_MODE_PROP_RANGE, {0, 0xffff});
+  prop_.in_formats = AddProperty(
+      "IN_FORMATS", DRM_MODE_PROP_BLOB | DRM_MODE_PROP_IMMUTABLE, {});
+
+  crtcs_.resize(config_.pipes);
+  for (uint32_t pipe = 0; pipe < config_.pipes; pipe++)
+    AddPipe(pipe);
+
+  for (uint32_t pipe = 0; pipe < config_.pipes; pipe++) {
+    AddPlane(pipe, DRM_PLANE_TYPE_PRIMARY);
+    for (uint32_t i = 0; i < config_.overlays; i++)
+      AddPlane(pipe, DRM_PLANE_TYPE_OVERLAY);
+    if (config_.cursor)
+      AddPlane(pipe, DRM_PLANE_TYPE_CURSOR);
+  }
+
+  return true;
+}
+
+uint32_t FakeKms::AddProperty(const char *name, uint32_t flags,
+                              std::vector<uint64_t> values,
+                              std::vector<std::string> enums) {
+  uint32_t id = next_id_++;
+  Property &property = properties_[id];
+  property.name = name;
+  property.flags = flags;
+  property.values.swap(values);
+  property.enums.swap(enums);
+  return id;
+}
+
+uint32_t FakeKms::AddBlob(const void *data, size_t size) {
+  uint32_t id = next_id_++;
+  const uint8_t *bytes = static_cast<const uint8_t *>(data);
+  blobs_[id].assign(bytes, bytes + size);
+  return id;
+}
+
+void FakeKms::AddPipe(uint32_t pipe) {
+  Crtc &crtc = crtcs_[pipe];
+  crtc.id = next_id_++;
+  crtc.encoder = next_id_++;
+  crtc.connector = next_id_++;
+  crtc.connected = true;
+  crtc.period_ns = 1000000000 / config_.refresh;
+  crtc.sequence = 0;
+  crtc.vblank_ns = Now();
+  crtc.next_vblank_ns = 0;
+  crtc.fence_point = 0;
+
+  // Reduced blanking timings.
+  drmModeModeInfo &mode = crtc.mode;
+  memset(&mode, 0, sizeof(mode));
+  mode.hdisplay = config_.width;
+  mode.hsync_start = config_.width + 48;
+  mode.hsync_end = config_.width + 80;
+  mode.htotal = config_.width + 160;
+  mode.vdisplay = config_.height;
+  mode.vsync_start = config_.height + 3;
+  mode.vsync_end = config_.height + 8;
+  mode.vtotal = config_.height + 45;
+  mode.clock = uint64_t(mode.htotal) * mode.vtotal * config_.refresh / 1000;
+  mode.vrefresh = config_.refresh;
+  mode.flags = DRM_MODE_FLAG_PHSYNC | DRM_MODE_FLAG_PVSYNC;
+  mode.type = DRM_MODE_TYPE_PREFERRED | DRM_MODE_TYPE_DRIVER;
+  snprintf(mode.name, sizeof(mode.name), "%ux%u", config_.width,
+           config_.height);
+
+  if (access("/sys/kernel/debug/sync/sw_sync", W_OK) == 0 ||
+      access("/dev/sw_sync", W_OK) == 0) {
+    crtc.sync.reset(new NativeSync());
+    if (!crtc.sync->Init())
+      crtc.sync.reset();
+  }
+
+  Object &object = objects_[crtc.id];
+  object.type = DRM_MODE_OBJECT_CRTC;
+  object.props = {{prop_.active, 0},
+                  {prop_.mode_id, 0},
+                  {prop_.out_fence_ptr, 0},
+                  {prop_.gamma_lut, 0},
+                  {prop_.gamma_lut_size, 256}};
+
+  objects_[crtc.encoder].type = DRM_MODE_OBJECT_ENCODER;
+
+  Object &connector = objects_[crtc.connector];
+  connector.type = DRM_MODE_OBJECT_CONNECTOR;
+  connector.props = {{prop_.crtc_id, 0},
+                     {prop_.dpms, DRM_MODE_DPMS_OFF},
+                     {prop_.broadcast_rgb, 0}};
+
+  encoders_.push_back(crtc.encoder);
+  connectors_.push_back(crtc.connector);
+}
+
+void FakeKms::AddPlane(uint32_t pipe, uint32_t type) {
+  Plane plane;
+  plane.id = next_id_++;
+  plane.type = type;
+  plane.possible_crtcs = 1 << pipe;
+
+  std::vector<uint64_t> modifiers;
+  if (type == DRM_PLANE_TYPE_CURSOR) {
+    plane.formats = {DRM_FORMAT_ARGB8888};
+    modifiers = {kModLinear};
+  } else {
+    plane.formats = {DRM_FORMAT_XRGB8888, DRM_FORMAT_ARGB8888,
+                     DRM_FORMAT_XBGR8888, DRM_FORMAT_ABGR8888,
+                     DRM_FORMAT_RGB565};
+    if (type == DRM_PLANE_TYPE_OVERLAY) {
+      plane.formats.push_back(DRM_FORMAT_NV12);
+      plane.formats.push_back(DRM_FORMAT_YUYV);
+      plane.formats.push_back(DRM_FORMAT_UYVY);
+    }
+    modifiers = {kModLinear, kModXTiled, kModYTiled};
+  }
+
+  // Every format comes with every modifier.
+  FormatModifierBlob header;
+  header.version = 1;
+  header.flags = 0;
+  header.count_formats = plane.formats.size();
+  header.formats_offset = sizeof(header);
+  header.count_modifiers = modifiers.size();
+  header.modifiers_offset =
+      (sizeof(header) + plane.formats.size() * sizeof(uint32_t) + 7) & ~7;
+  std::vector<uint8_t> blob(header.modifiers_offset +
+                            modifiers.size() * sizeof(FormatModifier));
+  memcpy(blob.data(), &header, sizeof(header));
+  memcpy(blob.data() + header.formats_offset, plane.formats.data(),
+         plane.formats.size() * sizeof(uint32_t));
+  for (size_t i = 0; i < modifiers.size(); i++) {
+    FormatModifier modifier;
+    modifier.formats = (1ULL << plane.formats.size()) - 1;
+    modifier.offset = 0;
+    modifier.pad = 0;
+    modifier.modifier = modifiers[i];
+    memcpy(blob.data() + header.modifiers_offset + i * sizeof(modifier),
+           &modifier, sizeof(modifier));
+  }
+
+  Object &object = objects_[plane.id];
+  object.type = DRM_MODE_OBJECT_PLANE;
+  object.props = {{prop_.type, type},
+                  {prop_.fb_id, 0},
+                  {prop_.plane_crtc_id, 0},
+                  {prop_.crtc_x, 0},
+                  {prop_.crtc_y, 0},
+                  {prop_.crtc_w, 0},
+                  {prop_.crtc_h, 0},
+                  {prop_.src_x, 0},
+                  {prop_.src_y, 0},
+                  {prop_.src_w, 0},
+                  {prop_.src_h, 0},
+                  {prop_.in_fence_fd, uint64_t(int64_t(-1))},
+                  {prop_.rotation, DRM_MODE_ROTATE_0},
+                  {prop_.alpha, 0xffff},
+                  {prop_.in_formats, AddBlob(blob.data(), blob.size())}};
+  planes_.push_back(plane);
+}
+
+FakeKms::Object *FakeKms::GetObject(uint32_t id, uint32_t type) {
+  std::map<uint32_t, Object>::iterator it = objects_.find(id);
+  if (it == objects_.end() ||
+      (type != DRM_MODE_OBJECT_ANY && it->second.type != type))
+    return NULL;
+  return &it->second;
+}
+
+FakeKms::Crtc *FakeKms::GetCrtc(uint32_t id) {
+  for (Crtc &crtc : crtcs_) {
+    if (crtc.id == id)
+      return &crtc;
+  }
+  return NULL;
+}
+
+FakeKms::Crtc *FakeKms::GetCrtcForPipe(uint32_t pipe) {
+  return pipe < crtcs_.size() ? &crtcs_[pipe] : NULL;
+}
+
+uint64_t FakeKms::GetValue(uint32_t object, uint32_t property,
+                           const Changes *changes) const {
+  if (changes) {
+    Changes::const_iterator change =
+        changes->find(std::make_pair(object, property));
+    if (change != changes->end())
+      return change->second;
+  }
+
+  std::map<uint32_t, Object>::const_iterator it = objects_.find(object);
+  if (it == objects_.end())
+    return 0;
+  for (const std::pair<uint32_t, uint64_t> &prop : it->second.props) {
+    if (prop.first == property)
+      return prop.second;
+  }
+  return 0;
+}
+
+bool FakeKms::IsActive(uint32_t crtc, const Changes *changes) const {
+  return GetValue(crtc, prop_.active, changes) != 0;
+}
+
+bool FakeKms::CheckValue(uint32_t property, uint64_t value) const {
+  const Property &prop = properties_.find(property)->second;
+  if (prop.flags & DRM_MODE_PROP_RANGE)
+    return value >= prop.values[0] && value <= prop.values[1];
+
+  if (prop.flags & DRM_MODE_PROP_SIGNED_RANGE)
+    return int64_t(value) >= int64_t(prop.values[0]) &&
+           int64_t(value) <= int64_t(prop.values[1]);
+
+  if (prop.flags & DRM_MODE_PROP_ENUM) {
+    for (uint64_t allowed : prop.values) {
+      if (value == allowed)
+        return true;
+    }
+    return false;
+  }
+
+  if (prop.flags & DRM_MODE_PROP_BITMASK) {
+    uint64_t mask = 0;
+    for (uint64_t bit : prop.values)
+      mask |= 1ULL << bit;
+    return !(value & ~mask);
+  }
+
+  if (prop.flags & DRM_MODE_PROP_BLOB)
+    return !value || blobs_.count(value);
+
+  if (prop.flags & DRM_MODE_PROP_OBJECT) {
+    if (!value)
+      return true;
+    if (prop.values[0] == DRM_MODE_OBJECT_FB)
+      return framebuffers_.count(value);
+    std::map<uint32_t, Object>::const_iterator it = objects_.find(value);
+    return it != objects_.end() && it->second.type == prop.values[0];
+  }
+
+  return true;
+}
+
+int FakeKms::CheckPlanes(uint32_t crtc_id, const Changes &changes) {
+  uint32_t pipe = GetCrtc(crtc_id) - crtcs_.data();
+  bool active = IsActive(crtc_id, &changes);
+  std::vector<PlaneState> enabled;
+  for (const Plane &plane : planes_) {
+    if (GetValue(plane.id, prop_.plane_crtc_id, &changes) != crtc_id)
+      continue;
+
+    PlaneState state;
+    state.plane_id = plane.id;
+    state.type = plane.type;
+    state.crtc_id = crtc_id;
+    state.fb_id = GetValue(plane.id, prop_.fb_id, &changes);
+    if (!state.fb_id || !active || !(plane.possible_crtcs & (1 << pipe)))
+      return -EINVAL;
+
+    const Framebuffer &fb = framebuffers_.find(state.fb_id)->second;
+    state.format = fb.format;
+    bool supported = false;
+    for (uint32_t format : plane.formats)
+      supported |= format == fb.format;
+    if (!supported)
+      return -EINVAL;
+
+    state.crtc_x = GetValue(plane.id, prop_.crtc_x, &changes);
+    state.crtc_y = GetValue(plane.id, prop_.crtc_y, &changes);
+    state.crtc_w = GetValue(plane.id, prop_.crtc_w, &changes);
+    state.crtc_h = GetValue(plane.id, prop_.crtc_h, &changes);
+    if (!state.crtc_w || !state.crtc_h)
+      return -EINVAL;
+
+    // Source coordinates are 16.16 fixed point.
+    uint64_t src_x = GetValue(plane.id, prop_.src_x, &changes);
+    uint64_t src_y = GetValue(plane.id, prop_.src_y, &changes);
+    uint64_t src_w = GetValue(plane.id, prop_.src_w, &changes);
+    uint64_t src_h = GetValue(plane.id, prop_.src_h, &changes);
+    if (src_x + src_w > uint64_t(fb.width) << 16 ||
+        src_y + src_h > uint64_t(fb.height) << 16)
+      return -ENOSPC;
+    state.src_x = src_x >> 16;
+    state.src_y = src_y >> 16;
+    state.src_w = src_w >> 16;
+    state.src_h = src_h >> 16;
+    state.rotation = GetValue(plane.id, prop_.rotation, &changes);
+    state.alpha = GetValue(plane.id, prop_.alpha, &changes);
+    enabled.push_back(state);
+  }
+
+  if (config_.max_planes && enabled.size() > config_.max_planes)
+    return -EINVAL;
+
+  for (const PlaneState &state : enabled) {
+    if (config_.reject_scaling &&
+        (state.src_w != state.crtc_w || state.src_h != state.crtc_h))
+      return -EINVAL;
+    if (config_.reject_rotation && state.rotation != DRM_MODE_ROTATE_0)
+      return -EINVAL;
+  }
+
+  if (config_.rule && config_.rule(enabled))
+    return -EINVAL;
+
+  return 0;
+}
+
+int FakeKms::Commit(const AtomicReq &req, uint32_t flags, void *user_data) {
+  std::unique_lock<std::mutex> lock(lock_);
+  if (!atomic_)
+    return -EINVAL;
+
+  const bool test_only = flags & DRM_MODE_ATOMIC_TEST_ONLY;
+  const bool nonblock = flags & DRM_MODE_ATOMIC_NONBLOCK;
+  if (test_only) {
+    stats_.test_commits++;
+  } else {
+    stats_.commits++;
+    // A blocking commit waits for the commits before it to complete.
+    if (!nonblock && config_.clock != kManual) {
+      vblank_cond_.wait(lock, [this]() {
+        for (const Crtc &crtc : crtcs_) {
+          if (!crtc.flips.empty() && !closing_)
+            return false;
+        }
+        return true;
+      });
+    }
+  }
+
+  Changes changes;
+  std::map<uint32_t, int32_t *> out_fences;
+  std::map<uint32_t, int> in_fences;
+  std::set<uint32_t> crtcs;
+  int ret = 0;
+  for (const AtomicReq::Item &item : req.items) {
+    Object *object = GetObject(item.object, DRM_MODE_OBJECT_ANY);
+    if (!object) {
+      ret = -ENOENT;
+      break;
+    }
+
+    bool found = false;
+    for (const std::pair<uint32_t, uint64_t> &prop : object->props)
+      found |= prop.first == item.property;
+    if (!found ||
+        (properties_[item.property].flags & DRM_MODE_PROP_IMMUTABLE) ||
+        !CheckValue(item.property, item.value)) {
+      ret = -EINVAL;
+      break;
+    }
+
+    // The fence properties only apply to this commit.
+    if (item.property == prop_.out_fence_ptr) {
+      if (item.value)
+        out_fences[item.object] =
+            reinterpret_cast<int32_t *>(uintptr_t(item.value));
+      crtcs.insert(item.object);
+      continue;
+    }
+
+    if (item.property == prop_.in_fence_fd) {
+      if (int64_t(item.value) >= 0)
+        in_fences[item.object] = int(item.value);
+      continue;
+    }
+
+    if (object->type == DRM_MODE_OBJECT_CRTC) {
+      crtcs.insert(item.object);
+    } else if (item.property == prop_.plane_crtc_id ||
+               item.property == prop_.crtc_id) {
+      if (item.value)
+        crtcs.insert(item.value);
+    }
+    if (object->type == DRM_MODE_OBJECT_PLANE ||
+        object->type == DRM_MODE_OBJECT_CONNECTOR) {
+      uint32_t crtc = GetValue(item.object,
+                               object->type == DRM_MODE_OBJECT_PLANE
+                                   ? prop_.plane_crtc_id
+                                   : prop_.crtc_id);
+      if (crtc)
+        crtcs.insert(crtc);
+    }
+    changes[std::make_pair(item.object, item.property)] = item.value;
+  }
+
+  for (std::set<uint32_t>::iterator crtc = crtcs.begin();
+       !ret && crtc != crtcs.end(); ++crtc) {
+    bool modeset =
+        IsActive(*crtc, &changes) != IsActive(*crtc) ||
+        GetValue(*crtc, prop_.mode_id, &changes) !=
+            GetValue(*crtc, prop_.mode_id);
+    for (uint32_t connector : connectors_) {
+      modeset |= GetValue(connector, prop_.crtc_id, &changes) !=
+                     GetValue(connector, prop_.crtc_id) &&
+                 (GetValue(connector, prop_.crtc_id, &changes) == *crtc ||
+                  GetValue(connector, prop_.crtc_id) == *crtc);
+    }
+    if (modeset && !(flags & DRM_MODE_ATOMIC_ALLOW_MODESET)) {
+      ret = -EINVAL;
+      break;
+    }
+
+    if (IsActive(*crtc, &changes)) {
+      std::map<uint32_t, std::vector<uint8_t>>::const_iterator mode =
+          blobs_.find(GetValue(*crtc, prop_.mode_id, &changes));
+      if (mode == blobs_.end() ||
+          mode->second.size() != sizeof(drmModeModeInfo)) {
+        ret = -EINVAL;
+        break;
+      }
+    }
+
+    ret = CheckPlanes(*crtc, changes);
+  }
+
+  // A framebuffer needs a CRTC to show on.
+  for (const Plane &plane : planes_) {
+    if (!ret && GetValue(plane.id, prop_.fb_id, &changes) &&
+        !GetValue(plane.id, prop_.plane_crtc_id, &changes))
+      ret = -EINVAL;
+  }
+
+  if (!ret && test_only && config_.fail_every &&
+      stats_.test_commits % config_.fail_every == 0)
+    ret = -EINVAL;
+
+  if (ret) {
+    stats_.rejected++;
+    return ret;
+  }
+
+  if (test_only)
+    return 0;
+
+  if (nonblock) {
+    for (uint32_t crtc : crtcs) {
+      if (!GetCrtc(crtc)->flips.empty())
+        return -EBUSY;
+    }
+  }
+
+  for (const Changes::value_type &change : changes) {
+    Object &object = objects_[change.first.first];
+    for (std::pair<uint32_t, uint64_t> &prop : object.props) {
+      if (prop.first == change.first.second)
+        prop.second = change.second;
+    }
+  }
+
+  for (uint32_t id : crtcs) {
+    Crtc &crtc = *GetCrtc(id);
+    bool active = IsActive(id);
+    if (active && GetValue(id, prop_.mode_id) != 0 &&
+        crtc.next_vblank_ns == 0)
+      Activate(crtc);
+    else if (!active)
+      crtc.next_vblank_ns = 0;
+
+    std::vector<int> fences;
+    for (const std::pair<const uint32_t, int> &fence : in_fences) {
+      if (GetValue(fence.first, prop_.plane_crtc_id) == id)
+        fences.push_back(dup(fence.second));
+    }
+
+    std::map<uint32_t, int32_t *>::iterator out_fence = out_fences.find(id);
+    QueueFlip(crtc, fences,
+              out_fence != out_fences.end() ? out_fence->second : NULL,
+              flags & DRM_MODE_PAGE_FLIP_EVENT, uintptr_t(user_data));
+
+    // Nothing would end a blocking commit on the manual clock, so it takes
+    // effect at once.
+    if (!active || (!nonblock && config_.clock == kManual))
+      CompleteFlips(crtc, true);
+    else if (config_.clock == kImmediate)
+      DoVblank(crtc, crtc.vblank_ns + crtc.period_ns);
+  }
+
+  if (!nonblock && config_.clock == kRealtime) {
+    vblank_cond_.wait(lock, [this, &crtcs]() {
+      for (uint32_t id : crtcs) {
+        if (!GetCrtc(id)->flips.empty() && !closing_)
+          return false;
+      }
+      return true;
+    });
+  }
+
+  return 0;
+}
+
+void FakeKms::Activate(Crtc &crtc) {
+  const std::vector<uint8_t> &blob =
+      blobs_[GetValue(crtc.id, prop_.mode_id)];
+  memcpy(&crtc.mode, blob.data(), sizeof(crtc.mode));
+  const drmModeModeInfo &mode = crtc.mode;
+  if (mode.clock && mode.htotal && mode.vtotal)
+    crtc.period_ns =
+        int64_t(mode.htotal) * mode.vtotal * 1000000 / mode.clock;
+  else if (mode.vrefresh)
+    crtc.period_ns = 1000000000 / mode.vrefresh;
+
+  int64_t now = Now();
+  crtc.vblank_ns = now;
+  crtc.next_vblank_ns = now + crtc.period_ns;
+  if (ticker_)
+    ticker_->Wake();
+}
+
+void FakeKms::QueueFlip(Crtc &crtc, std::vector<int> in_fences,
+                        int32_t *out_fence, bool event, uint64_t user_data) {
+  Flip flip;
+  flip.fence = -1;
+  flip.fence_point = 0;
+  flip.in_fences.swap(in_fences);
+  flip.event = event;
+  flip.user_data = user_data;
+
+  if (out_fence) {
+    int fence = -1;
+    if (crtc.sync) {
+      fence = crtc.sync->CreateNextTimelineFence();
+      if (fence >= 0)
+        flip.fence_point = ++crtc.fence_point;
+    }
+
+    // Without sw_sync an eventfd stands in. It polls the same way, but can
+    // not be merged.
+    if (fence < 0) {
+      fence = eventfd(0, EFD_CLOEXEC);
+      flip.fence = dup(fence);
+    }
+    *out_fence = fence;
+  }
+
+  crtc.flips.push_back(flip);
+}
+
+bool FakeKms::CompleteFlips(Crtc &crtc, bool force) {
+  while (!crtc.flips.empty()) {
+    Flip &flip = crtc.flips.front();
+    // The flip waits for its buffers to be ready, and the flips after it
+    // wait for it.
+    for (int fence : flip.in_fences) {
+      if (!force && !IsSignalled(fence, 0))
+        return false;
+    }
+
+    for (int fence : flip.in_fences)
+      close(fence);
+
+    if (flip.fence_point) {
+      crtc.sync->IncreaseTimelineToPoint(flip.fence_point);
+    } else if (flip.fence >= 0) {
+      eventfd_write(flip.fence, 1);
+      close(flip.fence);
+    }
+
+    if (flip.event)
+      SendEvent(DRM_EVENT_FLIP_COMPLETE, flip.user_data, crtc);
+
+    stats_.flips++;
+    crtc.flips.erase(crtc.flips.begin());
+  }
+
+  return true;
+}
+
+void FakeKms::DoVblank(Crtc &crtc, int64_t timestamp_ns) {
+  crtc.sequence++;
+  crtc.vblank_ns = timestamp_ns;
+  stats_.vblanks++;
+  CompleteFlips(crtc, false);
+
+  std::vector<std::pair<uint32_t, uint64_t>>::iterator event =
+      crtc.vblank_events.begin();
+  while (event != crtc.vblank_events.end()) {
+    if (int32_t(event->first - crtc.sequence) > 0) {
+      ++event;
+      continue;
+    }
+    SendEvent(DRM_EVENT_VBLANK, event->second, crtc);
+    event = crtc.vblank_events.erase(event);
+  }
+
+  vblank_cond_.notify_all();
+}
+
+void FakeKms::SendEvent(uint32_t type, uint64_t user_data, const Crtc &crtc) {
+  struct drm_event_vblank event;
+  memset(&event, 0, sizeof(event));
+  event.base.type = type;
+  event.base.length = sizeof(event);
+  event.user_data = user_data;
+  event.tv_sec = crtc.vblank_ns / 1000000000;
+  event.tv_usec = (crtc.vblank_ns % 1000000000) / 1000;
+  event.sequence = crtc.sequence;
+  event.crtc_id = crtc.id;
+  if (send(fd_[1], &event, sizeof(event), MSG_NOSIGNAL | MSG_DONTWAIT) < 0)
+    ETRACE("Dropped fake KMS event. %s", PRINTERROR());
+}
+
+int FakeKms::WaitVblank(drmVBlankPtr vbl) {
+  std::unique_lock<std::mutex> lock(lock_);
+  uint32_t type = vbl->request.type;
+  uint32_t pipe = (type & DRM_VBLANK_HIGH_CRTC_MASK) >>
+                  DRM_VBLANK_HIGH_CRTC_SHIFT;
+  if (type & DRM_VBLANK_SECONDARY)
+    pipe = 1;
+
+  Crtc *crtc = GetCrtcForPipe(pipe);
+  if (!crtc || !IsActive(crtc->id) || (type & DRM_VBLANK_SIGNAL))
+    return -EINVAL;
+
+  uint32_t target = vbl->request.sequence;
+  if (type & DRM_VBLANK_RELATIVE)
+    target += crtc->sequence;
+  if ((type & DRM_VBLANK_NEXTONMISS) && int32_t(target - crtc->sequence) <= 0)
+    target = crtc->sequence + 1;
+
+  if (type & DRM_VBLANK_EVENT) {
+    if (int32_t(target - crtc->sequence) <= 0)
+      SendEvent(DRM_EVENT_VBLANK, vbl->request.signal, *crtc);
+    else
+      crtc->vblank_events.push_back(
+          std::make_pair(target, uint64_t(vbl->request.signal)));
+    vbl->reply.sequence = target;
+    return 0;
+  }
+
+  vblank_cond_.wait(lock, [this, crtc, target]() {
+    return closing_ || !IsActive(crtc->id) ||
+           int32_t(target - crtc->sequence) <= 0;
+  });
+  if (closing_ || !IsActive(crtc->id))
+    return -EINVAL;
+
+  vbl->reply.sequence = crtc->sequence;
+  vbl->reply.tval_sec = crtc->vblank_ns / 1000000000;
+  vbl->reply.tval_usec = (crtc->vblank_ns % 1000000000) / 1000;
+  return 0;
+}
+
+int64_t FakeKms::Tick() {
+  std::lock_guard<std::mutex> lock(lock_);
+  int64_t now = Now();
+  int64_t next = -1;
+  for (Crtc &crtc : crtcs_) {
+    if (!crtc.next_vblank_ns)
+      continue;
+
+    // Vblanks missed while the thread was late still count.
+    while (crtc.next_vblank_ns <= now) {
+      DoVblank(crtc, crtc.next_vblank_ns);
+      crtc.next_vblank_ns += crtc.period_ns;
+    }
+
+    if (next < 0 || crtc.next_vblank_ns < next)
+      next = crtc.next_vblank_ns;
+  }
+
+  return next;
+}
+
+void FakeKms::SetConnected(uint32_t pipe, bool connected) {
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    Crtc *crtc = GetCrtcForPipe(pipe);
+    if (!crtc || crtc->connected == connected)
+      return;
+    crtc->connected = connected;
+  }
+
+  if (send(hotplug_fd_[1], kUevent, sizeof(kUevent), MSG_NOSIGNAL) < 0)
+    ETRACE("Failed to send fake hotplug event. %s", PRINTERROR());
+}
+
+void FakeKms::Vblank(uint32_t pipe) {
+  std::lock_guard<std::mutex> lock(lock_);
+  Crtc *crtc = GetCrtcForPipe(pipe);
+  if (!crtc || !IsActive(crtc->id))
+    return;
+
+  DoVblank(*crtc, config_.clock == kRealtime
+                      ? Now()
+                      : crtc->vblank_ns + crtc->period_ns);
+}
+
+FakeKms::Stats FakeKms::GetStats() const {
+  std::lock_guard<std::mutex> lock(lock_);
+  return stats_;
+}
+
+int FakeKms::drmOpen(const char *name, const char *busid) {
+  std::unique_ptr<Config> config;
+  {
+    ScopedSpinLock lock(registry_lock_);
+    if (selected_)
+      config.reset(new Config(*selected_));
+  }
+
+  const char *spec = getenv("HWC_FAKE_KMS");
+  if (!config && spec && *spec && strcmp(spec, "0")) {
+    config.reset(new Config());
+    if (!ParseConfig(spec, config.get())) {
+      ETRACE("Invalid HWC_FAKE_KMS settings \"%s\".", spec);
+      return -1;
+    }
+  }
+
+  if (!config)
+    return ::drmOpen(name, busid);
+
+  return Open(*config);
+}
+
+int FakeKms::drmClose(int fd) {
+  std::shared_ptr<FakeKms> kms = Get(fd);
+  if (!kms)
+    return ::drmClose(fd);
+
+  {
+    ScopedSpinLock lock(registry_lock_);
+    if (registry_.erase(fd))
+      device_count_--;
+  }
+  // The last reference, this one or that of a call in flight, frees it.
+  return 0;
+}
+
+int FakeKms::drmIoctl(int fd, unsigned long request, void *arg) {
+  std::shared_ptr<FakeKms> kms = Get(fd);
+  if (!kms)
+    return ::drmIoctl(fd, request, arg);
+
+  int ret = 0;
+  if (request == DRM_IOCTL_SET_CLIENT_CAP) {
+    struct drm_set_client_cap *cap =
+        static_cast<struct drm_set_client_cap *>(arg);
+    ret = drmSetClientCap(fd, cap->capability, cap->value);
+  } else if (request == DRM_IOCTL_GET_CAP) {
+    struct drm_get_cap *cap = static_cast<struct drm_get_cap *>(arg);
+    uint64_t value = 0;
+    ret = drmGetCap(fd, cap->capability, &value);
+    cap->value = value;
+  } else if (kms->render_fd_ >= 0) {
+    // Buffers live on the render node.
+    return ::drmIoctl(kms->render_fd_, request, arg);
+  } else if (request == DRM_IOCTL_PRIME_FD_TO_HANDLE) {
+    struct drm_prime_handle *prime =
+        static_cast<struct drm_prime_handle *>(arg);
+    ret = drmPrimeFDToHandle(fd, prime->fd, &prime->handle);
+  } else if (request == DRM_IOCTL_GEM_CLOSE) {
+    std::lock_guard<std::mutex> lock(kms->lock_);
+    uint32_t handle = static_cast<struct drm_gem_close *>(arg)->handle;
+    ret = -EINVAL;
+    for (std::map<uint64_t, uint32_t>::iterator it = kms->handles_.begin();
+         it != kms->handles_.end(); ++it) {
+      if (it->second == handle) {
+        kms->handles_.erase(it);
+        ret = 0;
+        break;
+      }
+    }
+  } else {
+    ret = -ENOTTY;
+  }
+
+  if (ret) {
+    errno = -ret;
+    return -1;
+  }
+  return 0;
+}
+
+int FakeKms::drmSetClientCap(int fd, uint64_t capability, uint64_t value) {
+  std::shared_ptr<FakeKms> kms = Get(fd);
+  if (!kms)
+    return ::drmSetClientCap(fd, capability, value);
+
+  std::lock_guard<std::mutex> lock(kms->lock_);
+  switch (capability) {
+    case DRM_CLIENT_CAP_STEREO_3D:
+    case DRM_CLIENT_CAP_UNIVERSAL_PLANES:
+      return 0;
+    case DRM_CLIENT_CAP_ATOMIC:
+      kms->atomic_ = value;
+      return 0;
+    default:
+      return Fail(EINVAL);
+  }
+}
+
+int FakeKms::drmGetCap(int fd, uint64_t capability, uint64_t *value) {
+  std::shared_ptr<FakeKms> kms = Get(fd);
+  if (!kms)
+    return ::drmGetCap(fd, capability, value);
+
+  switch (capability) {
+    case DRM_CAP_DUMB_BUFFER:
+      *value = 0;
+      return 0;
+    case DRM_CAP_CURSOR_WIDTH:
+    case DRM_CAP_CURSOR_HEIGHT:
+      *value = 256;
+      return 0;
+    case DRM_CAP_PRIME:
+      *value = 3;
+      return 0;
+    case DRM_CAP_VBLANK_HIGH_CRTC:
+    case DRM_CAP_TIMESTAMP_MONOTONIC:
+    case DRM_CAP_ADDFB2_MODIFIERS:
+    case DRM_CAP_CRTC_IN_VBLANK_EVENT:
+      *value = 1;
+      return 0;
+    default:
+      return Fail(EINVAL);
+  }
+}
+
+int FakeKms::drmWaitVBlank(int fd, drmVBlankPtr vbl) {
+  std::shared_ptr<FakeKms> kms = Get(fd);
+  if (!kms)
+    return ::drmWaitVBlank(fd, vbl);
+
+  int ret = kms->WaitVblank(vbl);
+  if (ret) {
+    errno = -ret;
+    return -1;
+  }
+  return 0;
+}
+
+int FakeKms::drmPrimeFDToHandle(int fd, int prime_fd, uint32_t *handle) {
+  std::shared_ptr<FakeKms> kms = Get(fd);
+  if (!kms)
+    return ::drmPrimeFDToHandle(fd, prime_fd, handle);
+  if (kms->render_fd_ >= 0)
+    return ::drmPrimeFDToHandle(kms->render_fd_, prime_fd, handle);
+
+  // Without a render node, any fd imports; the same file gets the same
+  // handle.
+  struct stat st;
+  if (fstat(prime_fd, &st))
+    return Fail(EBADF);
+
+  std::lock_guard<std::mutex> lock(kms->lock_);
+  uint32_t &id = kms->handles_[st.st_ino];
+  if (!id)
+    id = kms->next_id_++;
+  *handle = id;
+  return 0;
+}
+
+drmModeResPtr FakeKms::drmModeGetResources(int fd) {
+  std::shared_ptr<FakeKms> kms = Get(fd);
+  if (!kms)
+    return ::drmModeGetResources(fd);
+
+  std::lock_guard<std::mutex> lock(kms->lock_);
+  std::vector<uint32_t> fbs, crtcs;
+  for (const std::pair<const uint32_t, Framebuffer> &fb : kms->framebuffers_)
+    fbs.push_back(fb.first);
+  for (const Crtc &crtc : kms->crtcs_)
+    crtcs.push_back(crtc.id);
+
+  drmModeResPtr res = Allocate<drmModeRes>();
+  res->count_fbs = fbs.size();
+  res->fbs = Copy(fbs);
+  res->count_crtcs = crtcs.size();
+  res->crtcs = Copy(crtcs);
+  res->count_connectors = kms->connectors_.size();
+  res->connectors = Copy(kms->connectors_);
+  res->count_encoders = kms->encoders_.size();
+  res->encoders = Copy(kms->encoders_);
+  res->min_width = 1;
+  res->max_width = 8192;
+  res->min_height = 1;
+  res->max_height = 8192;
+  return res;
+}
+
+drmModeCrtcPtr FakeKms::drmModeGetCrtc(int fd, uint32_t crtc_id) {
+  std::shared_ptr<FakeKms> kms = Get(fd);
+  if (!kms)
+    return ::drmModeGetCrtc(fd, crtc_id);
+
+  std::lock_guard<std::mutex> lock(kms->lock_);
+  Crtc *crtc = kms->GetCrtc(crtc_id);
+  if (!crtc) {
+    errno = ENOENT;
+    return NULL;
+  }
+
+  drmModeCrtcPtr result = Allocate<drmModeCrtc>();
+  result->crtc_id = crtc->id;
+  result->gamma_size = kms->GetValue(crtc->id, kms->prop_.gamma_lut_size);
+  if (kms->IsActive(crtc->id)) {
+    result->mode_valid = 1;
+    result->mode = crtc->mode;
+    result->width = crtc->mode.hdisplay;
+    result->height = crtc->mode.vdisplay;
+  }
+  for (const Plane &plane : kms->planes_) {
+    if (plane.type == DRM_PLANE_TYPE_PRIMARY &&
+        kms->GetValue(plane.id, kms->prop_.plane_crtc_id) == crtc->id)
+      result->buffer_id = kms->GetValue(plane.id, kms->prop_.fb_id);
+  }
+  return result;
+}
+
+drmModeEncoderPtr FakeKms::drmModeGetEncoder(int fd, uint32_t encoder_id) {
+  std::shared_ptr<FakeKms> kms = Get(fd);
+  if (!kms)
+    return ::drmModeGetEncoder(fd, encoder_id);
+
+  std::lock_guard<std::mutex> lock(kms->lock_);
+  for (size_t pipe = 0; pipe < kms->crtcs_.size(); pipe++) {
+    if (kms->crtcs_[pipe].encoder != encoder_id)
+      continue;
+
+    drmModeEncoderPtr encoder = Allocate<drmModeEncoder>();
+    encoder->encoder_id = encoder_id;
+    encoder->encoder_type = DRM_MODE_ENCODER_VIRTUAL;
+    encoder->crtc_id = kms->crtcs_[pipe].id;
+    encoder->possible_crtcs = 1 << pipe;
+    return encoder;
+  }
+
+  errno = ENOENT;
+  return NULL;
+}
+
+drmModeConnectorPtr FakeKms::drmModeGetConnector(int fd,
+                                                 uint32_t connector_id) {
+  std::shared_ptr<FakeKms> kms = Get(fd);
+  if (!kms)
+    return ::drmModeGetConnector(fd, connector_id);
+
+  std::lock_guard<std::mutex> lock(kms->lock_);
+  for (size_t pipe = 0; pipe < kms->crtcs_.size(); pipe++) {
+    const Crtc &crtc = kms->crtcs_[pipe];
+    if (crtc.connector != connector_id)
+      continue;
+
+    drmModeConnectorPtr connector = Allocate<drmModeConnector>();
+    connector->connector_id = connector_id;
+    connector->connector_type = DRM_MODE_CONNECTOR_VIRTUAL;
+    connector->connector_type_id = pipe + 1;
+    connector->count_encoders = 1;
+    connector->encoders = Copy(std::vector<uint32_t>(1, crtc.encoder));
+
+    std::vector<uint32_t> props;
+    std::vector<uint64_t> values;
+    for (const std::pair<uint32_t, uint64_t> &prop :
+         kms->objects_[connector_id].props) {
+      props.push_back(prop.first);
+      values.push_back(prop.second);
+    }
+    connector->count_props = props.size();
+    connector->props = Copy(props);
+    connector->prop_values = Copy(values);
+
+    if (!crtc.connected) {
+      connector->connection = DRM_MODE_DISCONNECTED;
+      return connector;
+    }
+
+    // A 96 dpi panel showing the configured mode.
+    connector->connection = DRM_MODE_CONNECTED;
+    connector->encoder_id = crtc.encoder;
+    connector->mmWidth = kms->config_.width * 254 / 960;
+    connector->mmHeight = kms->config_.height * 254 / 960;
+    connector->subpixel = DRM_MODE_SUBPIXEL_UNKNOWN;
+    connector->count_modes = 1;
+    connector->modes = Copy(std::vector<drmModeModeInfo>(1, crtc.mode));
+    return connector;
+  }
+
+  errno = ENOENT;
+  return NULL;
+}
+
+drmModePlaneResPtr FakeKms::drmModeGetPlaneResources(int fd) {
+  std::shared_ptr<FakeKms> kms = Get(fd);
+  if (!kms)
+    return ::drmModeGetPlaneResources(fd);
+
+  std::lock_guard<std::mutex> lock(kms->lock_);
+  std::vector<uint32_t> planes;
+  for (const Plane &plane : kms->planes_)
+    planes.push_back(plane.id);
+
+  drmModePlaneResPtr res = Allocate<drmModePlaneRes>();
+  res->count_planes = planes.size();
+  res->planes = Copy(planes);
+  return res;
+}
+
+drmModePlanePtr FakeKms::drmModeGetPlane(int fd, uint32_t plane_id) {
+  std::shared_ptr<FakeKms> kms = Get(fd);
+  if (!kms)
+    return ::drmModeGetPlane(fd, plane_id);
+
+  std::lock_guard<std::mutex> lock(kms->lock_);
+  for (const Plane &plane : kms->planes_) {
+    if (plane.id != plane_id)
+      continue;
+
+    drmModePlanePtr result = Allocate<drmModePlane>();
+    result->count_formats = plane.formats.size();
+    result->formats = Copy(plane.formats);
+    result->plane_id = plane.id;
+    result->crtc_id = kms->GetValue(plane.id, kms->prop_.plane_crtc_id);
+    result->fb_id = kms->GetValue(plane.id, kms->prop_.fb_id);
+    result->crtc_x = kms->GetValue(plane.id, kms->prop_.crtc_x);
+    result->crtc_y = kms->GetValue(plane.id, kms->prop_.crtc_y);
+    result->x = kms->GetValue(plane.id, kms->prop_.src_x) >> 16;
+    result->y = kms->GetValue(plane.id, kms->prop_.src_y) >> 16;
+    result->possible_crtcs = plane.possible_crtcs;
+    return result;
+  }
+
+  errno = ENOENT;
+  return NULL;
+}
+
+drmModeObjectPropertiesPtr FakeKms::drmModeObjectGetProperties(
+    int fd, uint32_t object_id, uint32_t object_type) {
+  std::shared_ptr<FakeKms> kms = Get(fd);
+  if (!kms)
+    return ::drmModeObjectGetProperties(fd, object_id, object_type);
+
+  std::lock_guard<std::mutex> lock(kms->lock_);
+  Object *object = kms->GetObject(object_id, object_type);
+  if (!object) {
+    errno = ENOENT;
+    return NULL;
+  }
+
+  std::vector<uint32_t> props;
+  std::vector<uint64_t> values;
+  for (const std::pair<uint32_t, uint64_t> &prop : object->props) {
+    props.push_back(prop.first);
+    values.push_back(prop.second);
+  }
+
+  drmModeObjectPropertiesPtr result = Allocate<drmModeObjectProperties>();
+  result->count_props = props.size();
+  result->props = Copy(props);
+  result->prop_values = Copy(values);
+  return result;
+}
+
+drmModePropertyPtr FakeKms::drmModeGetProperty(int fd, uint32_t property_id) {
+  std::shared_ptr<FakeKms> kms = Get(fd);
+  if (!kms)
+    return ::drmModeGetProperty(fd, property_id);
+
+  std::lock_guard<std::mutex> lock(kms->lock_);
+  std::map<uint32_t, Property>::const_iterator it =
+      kms->properties_.find(property_id);
+  if (it == kms->properties_.end()) {
+    errno = ENOENT;
+    return NULL;
+  }
+
+  const Property &property = it->second;
+  drmModePropertyPtr result = Allocate<drmModePropertyRes>();
+  result->prop_id = property_id;
+  result->flags = property.flags;
+  strncpy(result->name, property.name.c_str(), DRM_PROP_NAME_LEN - 1);
+  result->count_values = property.values.size();
+  result->values = Copy(property.values);
+  if (!property.enums.empty()) {
+    std::vector<struct drm_mode_property_enum> enums(property.enums.size());
+    for (size_t i = 0; i < enums.size(); i++) {
+      memset(&enums[i], 0, sizeof(enums[i]));
+      enums[i].value = property.values[i];
+      strncpy(enums[i].name, property.enums[i].c_str(),
+              DRM_PROP_NAME_LEN - 1);
+    }
+    result->count_enums = enums.size();
+    result->enums = Copy(enums);
+  }
+  return result;
+}
+
+drmModePropertyBlobPtr FakeKms::drmModeGetPropertyBlob(int fd,
+                                                       uint32_t blob_id) {
+  std::shared_ptr<FakeKms> kms = Get(fd);
+  if (!kms)
+    return ::drmModeGetPropertyBlob(fd, blob_id);
+
+  std::lock_guard<std::mutex> lock(kms->lock_);
+  std::map<uint32_t, std::vector<uint8_t>>::const_iterator it =
+      kms->blobs_.find(blob_id);
+  if (it == kms->blobs_.end()) {
+    errno = ENOENT;
+    return NULL;
+  }
+
+  drmModePropertyBlobPtr blob = Allocate<drmModePropertyBlobRes>();
+  blob->id = blob_id;
+  blob->length = it->second.size();
+  blob->data = Copy(it->second);
+  return blob;
+}
+
+int FakeKms::drmModeCreatePropertyBlob(int fd, const void *data, size_t size,
+                                       uint32_t *id) {
+  std::shared_ptr<FakeKms> kms = Get(fd);
+  if (!kms)
+    return ::drmModeCreatePropertyBlob(fd, data, size, id);
+  if (!size)
+    return Fail(EINVAL);
+
+  std::lock_guard<std::mutex> lock(kms->lock_);
+  *id = kms->AddBlob(data, size);
+  return 0;
+}
+
+int FakeKms::drmModeDestroyPropertyBlob(int fd, uint32_t id) {
+  std::shared_ptr<FakeKms> kms = Get(fd);
+  if (!kms)
+    return ::drmModeDestroyPropertyBlob(fd, id);
+
+  std::lock_guard<std::mutex> lock(kms->lock_);
+  return kms->blobs_.erase(id) ? 0 : Fail(ENOENT);
+}
+
+int FakeKms::drmModeObjectSetProperty(int fd, uint32_t object_id,
+                                      uint32_t object_type,
+                                      uint32_t property_id, uint64_t value) {
+  std::shared_ptr<FakeKms> kms = Get(fd);
+  if (!kms)
+    return ::drmModeObjectSetProperty(fd, object_id, object_type, property_id,
+                                      value);
+
+  std::lock_guard<std::mutex> lock(kms->lock_);
+  Object *object = kms->GetObject(object_id, object_type);
+  if (!object)
+    return Fail(ENOENT);
+
+  // Atomic properties can only be set by atomic commits.
+  for (std::pair<uint32_t, uint64_t> &prop : object->props) {
+    if (prop.first != property_id)
+      continue;
+    if (kms->properties_[property_id].flags &
+            (DRM_MODE_PROP_ATOMIC | DRM_MODE_PROP_IMMUTABLE) ||
+        !kms->CheckValue(property_id, value))
+      return Fail(EINVAL);
+    prop.second = value;
+    return 0;
+  }
+  return Fail(EINVAL);
+}
+
+int FakeKms::drmModeConnectorSetProperty(int fd, uint32_t connector_id,
+                                         uint32_t property_id,
+                                         uint64_t value) {
+  if (!Get(fd))
+    return ::drmModeConnectorSetProperty(fd, connector_id, property_id, value);
+  return drmModeObjectSetProperty(fd, connector_id, DRM_MODE_OBJECT_CONNECTOR,
+                                  property_id, value);
+}
+
+int FakeKms::drmModeAddFB2(int fd, uint32_t width, uint32_t height,
+                           uint32_t pixel_format, const uint32_t handles[4],
+                           const uint32_t pitches[4],
+                           const uint32_t offsets[4], uint32_t *fb_id,
+                           uint32_t flags) {
+  std::shared_ptr<FakeKms> kms = Get(fd);
+  if (!kms)
+    return ::drmModeAddFB2(fd, width, height, pixel_format, handles, pitches,
+                           offsets, fb_id, flags);
+  if (!width || !height || !pixel_format || !handles[0] || !pitches[0])
+    return Fail(EINVAL);
+
+  std::lock_guard<std::mutex> lock(kms->lock_);
+  *fb_id = kms->next_id_++;
+  Framebuffer &fb = kms->framebuffers_[*fb_id];
+  fb.width = width;
+  fb.height = height;
+  fb.format = pixel_format;
+  return 0;
+}
+
+int FakeKms::drmModeRmFB(int fd, uint32_t fb_id) {
+  std::shared_ptr<FakeKms> kms = Get(fd);
+  if (!kms)
+    return ::drmModeRmFB(fd, fb_id);
+
+  std::lock_guard<std::mutex> lock(kms->lock_);
+  if (!kms->framebuffers_.erase(fb_id))
+    return Fail(ENOENT);
+
+  // Planes still showing the framebuffer are turned off.
+  for (const Plane &plane : kms->planes_) {
+    if (kms->GetValue(plane.id, kms->prop_.fb_id) != fb_id)
+      continue;
+    for (std::pair<uint32_t, uint64_t> &prop : kms->objects_[plane.id].props) {
+      if (prop.first == kms->prop_.fb_id ||
+          prop.first == kms->prop_.plane_crtc_id)
+        prop.second = 0;
+    }
+  }
+  return 0;
+}
+
+drmModeAtomicReqPtr FakeKms::drmModeAtomicAlloc() {
+  return reinterpret_cast<drmModeAtomicReqPtr>(new AtomicReq());
+}
+
+void FakeKms::drmModeAtomicFree(drmModeAtomicReqPtr req) {
+  delete reinterpret_cast<AtomicReq *>(req);
+}
+
+int FakeKms::drmModeAtomicGetCursor(drmModeAtomicReqPtr req) {
+  if (!req)
+    return -EINVAL;
+  return reinterpret_cast<AtomicReq *>(req)->items.size();
+}
+
+void FakeKms::drmModeAtomicSetCursor(drmModeAtomicReqPtr req, int cursor) {
+  if (req)
+    reinterpret_cast<AtomicReq *>(req)->items.resize(cursor);
+}
+
+int FakeKms::drmModeAtomicAddProperty(drmModeAtomicReqPtr req,
+                                      uint32_t object_id,
+                                      uint32_t property_id, uint64_t value) {
+  if (!req)
+    return -EINVAL;
+
+  AtomicReq::Item item;
+  item.object = object_id;
+  item.property = property_id;
+  item.value = value;
+  std::vector<AtomicReq::Item> &items =
+      reinterpret_cast<AtomicReq *>(req)->items;
+  items.push_back(item);
+  return items.size();
+}
+
+int FakeKms::drmModeAtomicCommit(int fd, drmModeAtomicReqPtr req,
+                                 uint32_t flags, void *user_data) {
+  if (!req)
+    return Fail(EINVAL);
+
+  const AtomicReq &fake_req = *reinterpret_cast<AtomicReq *>(req);
+  std::shared_ptr<FakeKms> kms = Get(fd);
+  if (!kms) {
+    drmModeAtomicReqPtr real_req = ::drmModeAtomicAlloc();
+    for (const AtomicReq::Item &item : fake_req.items)
+      ::drmModeAtomicAddProperty(real_req, item.object, item.property,
+                                 item.value);
+    int ret = ::drmModeAtomicCommit(fd, real_req, flags, user_data);
+    ::drmModeAtomicFree(real_req);
+    return ret;
+  }
+
+  // Flips happen within the commit, so wait for the buffers first, without
+  // holding up the device.
+  if (kms->config_.clock == kImmediate &&
+      !(flags & DRM_MODE_ATOMIC_TEST_ONLY)) {
+    for (const AtomicReq::Item &item : fake_req.items) {
+      if (item.property == kms->prop_.in_fence_fd && int64_t(item.value) >= 0)
+        IsSignalled(int(item.value), -1);
+    }
+  }
+
+  int ret = kms->Commit(fake_req, flags, user_data);
+  return ret ? Fail(-ret) : 0;
+}
+
+}  // namespace hwcomposer
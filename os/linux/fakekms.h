@@ -0,0 +1,355 @@
+/*
+// Copyright (c) 2017 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+#ifndef OS_LINUX_FAKEKMS_H_
+#define OS_LINUX_FAKEKMS_H_
+
+#include <stdint.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace hwcomposer {
+
+class NativeSync;
+
+// An in-process KMS device, so that the display stack can run and be
+// benchmarked without display hardware. It has a CRTC, an encoder and a
+// connector per pipe, and a primary, overlay and cursor planes per CRTC, all
+// with the properties the stack looks up, IN_FORMATS included. Atomic commits
+// are checked the way the kernel would and against configurable rejection
+// rules; real commits signal OUT_FENCE_PTR fences and page flip events at the
+// next vblank of a simulated clock. Connectors can be hotplugged.
+//
+// Builds configured with --enable-fake-kms define USE_FAKE_KMS, which makes
+// the libdrm calls of the stack go to the static members of the same name
+// below. Those handle fake devices and pass any other fd on to libdrm, so a
+// fake build still drives real hardware. drmOpen() opens a fake device when
+// HWC_FAKE_KMS is set in the environment, to "1" or a ParseConfig() string,
+// or after Select().
+class FakeKms {
+ public:
+  enum ClockMode {
+    // Vblanks follow the monotonic clock at the refresh rate of each CRTC.
+    kRealtime,
+    // A commit flips at once, as the next vblank; the clock jumps a refresh
+    // period. Frames run as fast as the stack can produce them.
+    kImmediate,
+    // Vblanks only happen on Vblank(), for deterministic tests. Blocking
+    // commits complete without one.
+    kManual
+  };
+
+  // A plane as a commit would leave it, in whole pixels.
+  struct PlaneState {
+    uint32_t plane_id;
+    uint32_t type;  // DRM_PLANE_TYPE_*
+    uint32_t crtc_id;
+    uint32_t fb_id;
+    uint32_t format;
+    int32_t crtc_x;
+    int32_t crtc_y;
+    uint32_t crtc_w;
+    uint32_t crtc_h;
+    uint32_t src_x;
+    uint32_t src_y;
+    uint32_t src_w;
+    uint32_t src_h;
+    uint64_t rotation;
+    uint64_t alpha;
+  };
+
+  // Returns true to reject the enabled planes of a CRTC.
+  typedef std::function<bool(const std::vector<PlaneState> &planes)> Rule;
+
+  struct Config {
+    Config();
+
+    uint32_t pipes;
+    uint32_t overlays;  // Overlay planes per CRTC.
+    bool cursor;        // A cursor plane per CRTC.
+    uint32_t width;
+    uint32_t height;
+    uint32_t refresh;
+    ClockMode clock;
+
+    // Rejection rules, checked by test and real commits alike.
+    uint32_t max_planes;  // Enabled planes per CRTC; 0 for no limit.
+    bool reject_scaling;
+    bool reject_rotation;
+    uint32_t fail_every;  // Fail every Nth test commit; 0 never.
+    Rule rule;
+  };
+
+  struct Stats {
+    uint64_t commits;
+    uint64_t test_commits;
+    uint64_t rejected;  // Test and real commits that failed their checks.
+    uint64_t flips;
+    uint64_t vblanks;
+  };
+
+  // Applies a comma separated list of settings to config, e.g.
+  // "pipes=2,overlays=1,mode=1280x720@60,clock=immediate,max-planes=3,
+  // reject-scaling,reject-rotation,fail-every=5,cursor=0". "1" keeps the
+  // defaults.
+  static bool ParseConfig(const char *spec, Config *config);
+
+  // Creates a device and returns its fd, or -1. The fd reads like a DRM fd:
+  // it polls readable when vblank and page flip events are queued, and
+  // drmHandleEvent() parses them.
+  static int Open(const Config &config);
+
+  // Makes drmOpen() open fake devices with config, or real ones again when
+  // config is NULL.
+  static void Select(const Config *config);
+
+  // The device behind fd, or NULL if fd is not a fake device. The device
+  // stays valid while the reference is held, even if fd is closed.
+  static std::shared_ptr<FakeKms> Get(int fd);
+
+  ~FakeKms();
+
+  // Connects or disconnects the connector of pipe and sends a hotplug uevent.
+  void SetConnected(uint32_t pipe, bool connected);
+
+  // Receives hotplug uevents, in the format of a NETLINK_KOBJECT_UEVENT
+  // socket.
+  int GetHotplugFd() const {
+    return hotplug_fd_[0];
+  }
+
+  // A render node to allocate buffers on, or -1 if there is none.
+  int GetRenderFd() const {
+    return render_fd_;
+  }
+
+  // Signals a vblank on pipe. In kManual mode this is the only way vblanks
+  // happen.
+  void Vblank(uint32_t pipe);
+
+  Stats GetStats() const;
+
+  // libdrm.
+  static int drmOpen(const char *name, const char *busid);
+  static int drmClose(int fd);
+  static int drmIoctl(int fd, unsigned long request, void *arg);
+  static int drmSetClientCap(int fd, uint64_t capability, uint64_t value);
+  static int drmGetCap(int fd, uint64_t capability, uint64_t *value);
+  static int drmWaitVBlank(int fd, drmVBlankPtr vbl);
+  static int drmPrimeFDToHandle(int fd, int prime_fd, uint32_t *handle);
+  static drmModeResPtr drmModeGetResources(int fd);
+  static drmModeCrtcPtr drmModeGetCrtc(int fd, uint32_t crtc_id);
+  static drmModeEncoderPtr drmModeGetEncoder(int fd, uint32_t encoder_id);
+  static drmModeConnectorPtr drmModeGetConnector(int fd,
+                                                 uint32_t connector_id);
+  static drmModePlaneResPtr drmModeGetPlaneResources(int fd);
+  static drmModePlanePtr drmModeGetPlane(int fd, uint32_t plane_id);
+  static drmModeObjectPropertiesPtr drmModeObjectGetProperties(
+      int fd, uint32_t object_id, uint32_t object_type);
+  static drmModePropertyPtr drmModeGetProperty(int fd, uint32_t property_id);
+  static drmModePropertyBlobPtr drmModeGetPropertyBlob(int fd,
+                                                       uint32_t blob_id);
+  static int drmModeCreatePropertyBlob(int fd, const void *data, size_t size,
+                                       uint32_t *id);
+  static int drmModeDestroyPropertyBlob(int fd, uint32_t id);
+  static int drmModeObjectSetProperty(int fd, uint32_t object_id,
+                                      uint32_t object_type,
+                                      uint32_t property_id, uint64_t value);
+  static int drmModeConnectorSetProperty(int fd, uint32_t connector_id,
+                                         uint32_t property_id,
+                                         uint64_t value);
+  static int drmModeAddFB2(int fd, uint32_t width, uint32_t height,
+                           uint32_t pixel_format, const uint32_t handles[4],
+                           const uint32_t pitches[4],
+                           const uint32_t offsets[4], uint32_t *fb_id,
+                           uint32_t flags);
+  static int drmModeRmFB(int fd, uint32_t fb_id);
+
+  // Requests are built the same way for fake and real devices; a commit on a
+  // real device copies them into a libdrm request.
+  static drmModeAtomicReqPtr drmModeAtomicAlloc();
+  static void drmModeAtomicFree(drmModeAtomicReqPtr req);
+  static int drmModeAtomicGetCursor(drmModeAtomicReqPtr req);
+  static void drmModeAtomicSetCursor(drmModeAtomicReqPtr req, int cursor);
+  static int drmModeAtomicAddProperty(drmModeAtomicReqPtr req,
+                                      uint32_t object_id,
+                                      uint32_t property_id, uint64_t value);
+  static int drmModeAtomicCommit(int fd, drmModeAtomicReqPtr req,
+                                 uint32_t flags, void *user_data);
+
+ private:
+  class Ticker;
+  struct AtomicReq;
+
+  struct Property {
+    std::string name;
+    uint32_t flags;
+    std::vector<uint64_t> values;  // Range bounds, enum values or bits.
+    std::vector<std::string> enums;
+  };
+
+  struct Object {
+    uint32_t type;
+    std::vector<std::pair<uint32_t, uint64_t>> props;
+  };
+
+  struct Flip {
+    int fence;  // Our end of the OUT_FENCE_PTR fence, or -1.
+    uint32_t fence_point;
+    std::vector<int> in_fences;
+    bool event;
+    uint64_t user_data;
+  };
+
+  struct Crtc {
+    uint32_t id;
+    uint32_t encoder;
+    uint32_t connector;
+    bool connected;
+    drmModeModeInfo mode;
+    int64_t period_ns;
+    uint32_t sequence;
+    int64_t vblank_ns;
+    int64_t next_vblank_ns;
+    std::unique_ptr<NativeSync> sync;
+    uint32_t fence_point;
+    std::vector<Flip> flips;
+    std::vector<std::pair<uint32_t, uint64_t>> vblank_events;
+  };
+
+  struct Plane {
+    uint32_t id;
+    uint32_t type;
+    uint32_t possible_crtcs;
+    std::vector<uint32_t> formats;
+  };
+
+  struct Framebuffer {
+    uint32_t width;
+    uint32_t height;
+    uint32_t format;
+  };
+
+  // Property values set by a commit, on top of the current ones.
+  typedef std::map<std::pair<uint32_t, uint32_t>, uint64_t> Changes;
+
+  explicit FakeKms(const Config &config);
+
+  bool Init();
+  uint32_t AddProperty(const char *name, uint32_t flags,
+                       std::vector<uint64_t> values,
+                       std::vector<std::string> enums =
+                           std::vector<std::string>());
+  uint32_t AddBlob(const void *data, size_t size);
+  void AddPipe(uint32_t pipe);
+  void AddPlane(uint32_t pipe, uint32_t type);
+
+  Object *GetObject(uint32_t id, uint32_t type);
+  Crtc *GetCrtc(uint32_t id);
+  Crtc *GetCrtcForPipe(uint32_t pipe);
+  uint64_t GetValue(uint32_t object, uint32_t property,
+                    const Changes *changes = NULL) const;
+  bool IsActive(uint32_t crtc, const Changes *changes = NULL) const;
+  bool CheckValue(uint32_t property, uint64_t value) const;
+  int CheckPlanes(uint32_t crtc, const Changes &changes);
+  int Commit(const AtomicReq &req, uint32_t flags, void *user_data);
+  void Activate(Crtc &crtc);
+  void QueueFlip(Crtc &crtc, std::vector<int> in_fences, int32_t *out_fence,
+                 bool event, uint64_t user_data);
+  bool CompleteFlips(Crtc &crtc, bool force);
+  void DoVblank(Crtc &crtc, int64_t timestamp_ns);
+  void SendEvent(uint32_t type, uint64_t user_data, const Crtc &crtc);
+  int WaitVblank(drmVBlankPtr vbl);
+  int64_t Tick();
+
+  Config config_;
+  int fd_[2];
+  int hotplug_fd_[2];
+  int render_fd_;
+  bool atomic_;
+  bool closing_;
+
+  std::map<uint32_t, Property> properties_;
+  std::map<uint32_t, Object> objects_;
+  std::map<uint32_t, std::vector<uint8_t>> blobs_;
+  std::map<uint32_t, Framebuffer> framebuffers_;
+  std::map<uint64_t, uint32_t> handles_;
+  std::vector<Crtc> crtcs_;
+  std::vector<Plane> planes_;
+  std::vector<uint32_t> connectors_;
+  std::vector<uint32_t> encoders_;
+  uint32_t next_id_;
+  Stats stats_;
+
+  struct {
+    uint32_t active, mode_id, out_fence_ptr, gamma_lut, gamma_lut_size;
+    uint32_t crtc_id, dpms, broadcast_rgb;
+    uint32_t type, fb_id, plane_crtc_id, crtc_x, crtc_y, crtc_w, crtc_h;
+    uint32_t src_x, src_y, src_w, src_h, in_fence_fd, rotation, alpha;
+    uint32_t in_formats;
+  } prop_;
+
+  mutable std::mutex lock_;
+  std::condition_variable vblank_cond_;
+  std::unique_ptr<Ticker> ticker_;
+};
+
+}  // namespace hwcomposer
+
+#if defined(USE_FAKE_KMS) && !defined(FAKE_KMS_IMPLEMENTATION)
+#define drmOpen hwcomposer::FakeKms::drmOpen
+#define drmClose hwcomposer::FakeKms::drmClose
+#define drmIoctl hwcomposer::FakeKms::drmIoctl
+#define drmSetClientCap hwcomposer::FakeKms::drmSetClientCap
+#define drmGetCap hwcomposer::FakeKms::drmGetCap
+#define drmWaitVBlank hwcomposer::FakeKms::drmWaitVBlank
+#define drmPrimeFDToHandle hwcomposer::FakeKms::drmPrimeFDToHandle
+#define drmModeGetResources hwcomposer::FakeKms::drmModeGetResources
+#define drmModeGetCrtc hwcomposer::FakeKms::drmModeGetCrtc
+#define drmModeGetEncoder hwcomposer::FakeKms::drmModeGetEncoder
+#define drmModeGetConnector hwcomposer::FakeKms::drmModeGetConnector
+#define drmModeGetPlaneResources hwcomposer::FakeKms::drmModeGetPlaneResources
+#define drmModeGetPlane hwcomposer::FakeKms::drmModeGetPlane
+#define drmModeObjectGetProperties \
+  hwcomposer::FakeKms::drmModeObjectGetProperties
+#define drmModeGetProperty hwcomposer::FakeKms::drmModeGetProperty
+#define drmModeGetPropertyBlob hwcomposer::FakeKms::drmModeGetPropertyBlob
+#define drmModeCreatePropertyBlob hwcomposer::FakeKms::drmModeCreatePropertyBlob
+#define drmModeDestroyPropertyBlob \
+  hwcomposer::FakeKms::drmModeDestroyPropertyBlob
+#define drmModeObjectSetProperty hwcomposer::FakeKms::drmModeObjectSetProperty
+#define drmModeConnectorSetProperty \
+  hwcomposer::FakeKms::drmModeConnectorSetProperty
+#define drmModeAddFB2 hwcomposer::FakeKms::drmModeAddFB2
+#define drmModeRmFB hwcomposer::FakeKms::drmModeRmFB
+#define drmModeAtomicAlloc hwcomposer::FakeKms::drmModeAtomicAlloc
+#define drmModeAtomicFree hwcomposer::FakeKms::drmModeAtomicFree
+#define drmModeAtomicGetCursor hwcomposer::FakeKms::drmModeAtomicGetCursor
+#define drmModeAtomicSetCursor hwcomposer::FakeKms::drmModeAtomicSetCursor
+#define drmModeAtomicAddProperty hwcomposer::FakeKms::drmModeAtomicAddProperty
+#define drmModeAtomicCommit hwcomposer::FakeKms::drmModeAtomicCommit
+#endif
+
+#endif  // OS_LINUX_FAKEKMS_H_
@@ -53,7 +53,17 @@ GbmBufferHandler::~GbmBufferHandler() {
 }
 
 bool GbmBufferHandler::Init() {
+#ifdef USE_FAKE_KMS
+  // A fake KMS device has no memory of its own; allocate on a render node.
+  std::shared_ptr<FakeKms> fake_kms = FakeKms::Get(fd_);
+  if (fake_kms && fake_kms->GetRenderFd() >= 0) {
+    device_ = gbm_create_device(fake_kms->GetRenderFd());
+  } else {
+    device_ = gbm_create_device(fd_);
+  }
+#else
   device_ = gbm_create_device(fd_);
+#endif
   if (!device_) {
     ETRACE("failed to create gbm device \n");
     return false;
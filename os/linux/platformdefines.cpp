@@ -16,15 +16,28 @@
 
 #include "platformdefines.h"
 
+#include <string.h>
+
 namespace hwcomposer {
+// There is no property store on Linux, so every property has its default
+// value and cannot be set.
 int property_get(const char *key, char *value, const char *default_value) {
+  if (!default_value) {
+    value[0] = '\0';
+    return 0;
+  }
+  strncpy(value, default_value, PROPERTY_VALUE_MAX - 1);
+  value[PROPERTY_VALUE_MAX - 1] = '\0';
+  return strlen(value);
 }
 
 int property_set(const char *key, const char *value) {
+  return -1;
 }
 
 int property_list(void (*propfn)(const char *key, const char *value,
                                  void *cookie),
                   void *cookie) {
+  return 0;
 }
 }
@@ -30,8 +30,18 @@
 
 #include "string8.h"
 #include "hwcdefs_internal.h"
+// Debug and verbose messages are compiled out unless configure asked for
+// them; see --with-max-log-level.
+#ifndef HWC_LOG_LEVEL_MAX
+#define HWC_LOG_LEVEL_MAX 3  // HWC_LOG_LEVEL_INFO
+#endif
+#include "hwcloglevel.h"
 #include "drmutils_linux.h"
 
+#ifdef USE_FAKE_KMS
+#include "fakekms.h"
+#endif
+
 struct gbm_handle {
 #ifdef USE_MINIGBM
   struct gbm_import_fd_planar_data import_data;
@@ -61,20 +71,35 @@ int property_list(void (*propfn)(const char *key, const char *value,
 
 #define PROPERTY_VALUE_MAX 92
 
+// Default path for the frame trace written by GpuDevice::SaveFrameTrace().
+#define HWC_FRAME_TRACE_FILE "/tmp/hwcframetrace.bin"
+
+// Default path for the capture written by GpuDevice::SaveLayerCapture().
+#define HWC_LAYER_CAPTURE_FILE "/tmp/hwclayercapture.bin"
+
 #ifdef _cplusplus
 extern "C" {
 #endif
 
-#define VTRACE(fmt, ...) fprintf(stderr, "%s: \n" fmt, __func__, ##__VA_ARGS__)
-#define DTRACE(fmt, ...) fprintf(stderr, "%s: \n" fmt, __func__, ##__VA_ARGS__)
-#define ITRACE(fmt, ...) fprintf(stderr, "\n" fmt, ##__VA_ARGS__)
-#define WTRACE(fmt, ...) fprintf(stderr, "%s: \n" fmt, __func__, ##__VA_ARGS__)
-#define ETRACE(fmt, ...) fprintf(stderr, "%s: \n" fmt, __func__, ##__VA_ARGS__)
-#define ETRACEIF(fmt, ...) ((void)0)
-#define ITRACEIF(fmt, ...) ((void)0)
-#define DTRACEIF(fmt, ...) ((void)0)
-#define VTRACEIF(fmt, ...) ((void)0)
-#define WTRACEIF(fmt, ...) ((void)0)
+#define VTRACEIF(cond, fmt, ...) \
+  HWC_LOG_IF(HWC_LOG_LEVEL_VERBOSE, cond, fprintf, stderr, "%s: \n" fmt, \
+             __func__, ##__VA_ARGS__)
+#define DTRACEIF(cond, fmt, ...) \
+  HWC_LOG_IF(HWC_LOG_LEVEL_DEBUG, cond, fprintf, stderr, "%s: \n" fmt, \
+             __func__, ##__VA_ARGS__)
+#define ITRACEIF(cond, fmt, ...) \
+  HWC_LOG_IF(HWC_LOG_LEVEL_INFO, cond, fprintf, stderr, "\n" fmt, ##__VA_ARGS__)
+#define WTRACEIF(cond, fmt, ...) \
+  HWC_LOG_IF(HWC_LOG_LEVEL_WARN, cond, fprintf, stderr, "%s: \n" fmt, \
+             __func__, ##__VA_ARGS__)
+#define ETRACEIF(cond, fmt, ...) \
+  HWC_LOG_IF(HWC_LOG_LEVEL_ERROR, cond, fprintf, stderr, "%s: \n" fmt, \
+             __func__, ##__VA_ARGS__)
+#define VTRACE(fmt, ...) VTRACEIF(true, fmt, ##__VA_ARGS__)
+#define DTRACE(fmt, ...) DTRACEIF(true, fmt, ##__VA_ARGS__)
+#define ITRACE(fmt, ...) ITRACEIF(true, fmt, ##__VA_ARGS__)
+#define WTRACE(fmt, ...) WTRACEIF(true, fmt, ##__VA_ARGS__)
+#define ETRACE(fmt, ...) ETRACEIF(true, fmt, ##__VA_ARGS__)
 #define HWCASSERT(fmt, ...) ((void)0)
 #define STRACE() ((void)0)
 
@@ -84,6 +84,13 @@ class GpuDevice {
   // fully serialized and synchronized.
   void notifyPlugChangeCompleted( ) { }
 
+  // Write the frame trace, if enabled, to the frametracefile option's path.
+  bool SaveFrameTrace();
+
+  // Write the layer capture, if enabled, to the layercapturefile option's
+  // path.
+  bool SaveLayerCapture();
+
  private:
   class DisplayManager;
   // Order is important here as we need fd_ to be valid
@@ -92,6 +99,11 @@ class GpuDevice {
   std::unique_ptr<DisplayManager> display_manager_;
   Option mOptionVppComposer;
   Option mOptionPartGlComp;
+  Option mOptionFrameTrace;
+  Option mOptionFrameTraceFile;
+  Option mOptionLayerCapture;
+  Option mOptionLayerCaptureFile;
+  Option mOptionLogLevel;
   PhysicalDisplayManager* mPhysicalDisplayManager_;
   bool initialized_;
 };
@@ -0,0 +1,264 @@
+/*
+// Copyright (c) 2017 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+// Calibrates the composer cost model on this device. Composes stacks of 1 to
+// 8 layers of several sizes and formats with each composer, times every
+// composition to the end of its GPU work, and records it with the workload the
+// composer estimates for it as a ComposerCostModel::Sample. The samples of
+// each composer are passed to ComposerCostModel::fit() and the fitted
+// coefficients are printed, and written in the calibration file format if an
+// output file is given (load it with the "composercost" option).
+//
+// The partitioned composer is driven through PartitionedComposer::onCompose.
+// SurfaceFlinger composes outside the HWC, so its workload (a clear, then one
+// draw of each layer over its destination) is replayed through the same GL
+// cell composer.
+
+#include <getopt.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "AbstractBufferManager.h"
+#include "ComposerCostModel.h"
+#include "GlCellComposer.h"
+#include "PartitionedComposer.h"
+#include "SurfaceFlingerComposer.h"
+
+using hwcomposer::AbstractBufferManager;
+using hwcomposer::AbstractComposer;
+using hwcomposer::ComposerCostModel;
+using hwcomposer::Content;
+using hwcomposer::GLContext;
+using hwcomposer::GlCellComposer;
+using hwcomposer::HwcRect;
+using hwcomposer::Layer;
+using hwcomposer::PartitionedComposer;
+using hwcomposer::SurfaceFlingerComposer;
+
+static const uint32_t kMaxLayers = 8;
+static const uint32_t kTargetWidth = 1920;
+static const uint32_t kTargetHeight = 1080;
+static const uint32_t kUsage = GBM_BO_USE_RENDERING | GBM_BO_USE_SCANOUT;
+
+static const char* kSurfaceFlinger = "SurfaceFlingerComposer";
+
+struct StackSize {
+  uint32_t width;
+  uint32_t height;
+};
+
+static const StackSize kSizes[] = {
+    {320, 240}, {960, 540}, {kTargetWidth, kTargetHeight},
+};
+
+struct StackFormat {
+  const char* name;
+  int32_t format;
+};
+
+static const StackFormat kFormats[] = {
+    {"RGBA", DRM_FORMAT_ABGR8888},
+    {"RGBX", DRM_FORMAT_XBGR8888},
+    {"NV12", hwcomposer::HWC_PIXEL_FORMAT_NV12_Y_TILED_INTEL},
+};
+
+// One composer under calibration: composes a stack into the target and
+// estimates the workload of doing so.
+struct Calibration {
+  const char* name;
+  std::function<bool(const Content::LayerStack&, const Layer&)> compose;
+  void (*estimate)(const Content::LayerStack&, const Layer&,
+                   ComposerCostModel::Workload&);
+  std::vector<ComposerCostModel::Sample> samples;
+};
+
+// Time of count compositions in microseconds, each to the end of its GPU
+// work, after one untimed composition to build programs and import buffers.
+static float measure_us(GLContext& context, uint32_t count,
+                        const std::function<bool()>& compose) {
+  if (!compose())
+    return -1;
+  double total = 0;
+  for (uint32_t i = 0; i < count; i++) {
+    auto start = std::chrono::steady_clock::now();
+    if (!compose())
+      return -1;
+    auto saved = context.makeCurrent();
+    glFinish();
+    total += std::chrono::duration<double, std::micro>(
+                 std::chrono::steady_clock::now() - start)
+                 .count();
+  }
+  return total / count;
+}
+
+static void usage(const char* name) {
+  printf(
+      "usage: %s [-n frames] [-o calibration file]\n"
+      "  -n  compositions timed per stack and composer (8)\n"
+      "  -o  write the fitted coefficients to this file\n",
+      name);
+}
+
+int main(int argc, char* argv[]) {
+  uint32_t frames = 8;
+  const char* output = NULL;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:o:h")) != -1) {
+    switch (opt) {
+      case 'n':
+        frames = atoi(optarg) > 0 ? atoi(optarg) : 1;
+        break;
+      case 'o':
+        output = optarg;
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+
+  std::shared_ptr<GLContext> context = GLContext::create();
+  std::shared_ptr<GlCellComposer> cells =
+      context ? GlCellComposer::create(context) : NULL;
+  if (!cells) {
+    fprintf(stderr, "Failed to create the GL cell composer\n");
+    return 1;
+  }
+  PartitionedComposer partitioned(cells);
+  AbstractBufferManager& bm = AbstractBufferManager::get();
+
+  std::shared_ptr<HWCNativeHandlesp> target_buffer =
+      bm.createGraphicBuffer("CALIBRATE", kTargetWidth, kTargetHeight,
+                             INTEL_HWC_DEFAULT_HAL_PIXEL_FORMAT, kUsage);
+  if (!target_buffer) {
+    fprintf(stderr, "Failed to allocate the %ux%u target\n", kTargetWidth,
+            kTargetHeight);
+    return 1;
+  }
+  Layer target;
+  target.onUpdateAll(target_buffer.get(), true);
+
+  std::vector<Calibration> calibrations(2);
+  calibrations[0].name = partitioned.getName();
+  calibrations[0].estimate = PartitionedComposer::estimateWorkload;
+  calibrations[0].compose = [&](const Content::LayerStack& stack,
+                                const Layer& target) {
+    AbstractComposer::CompositionState* state = NULL;
+    if (partitioned.onEvaluate(stack, target, &state,
+                               AbstractComposer::Performance) <
+        AbstractComposer::Eval_Cost_Min)
+      return false;
+    partitioned.onCompose(stack, target, state);
+    delete state;
+    return true;
+  };
+  calibrations[1].name = kSurfaceFlinger;
+  calibrations[1].estimate = SurfaceFlingerComposer::estimateWorkload;
+  calibrations[1].compose = [&](const Content::LayerStack& stack,
+                                const Layer& target) {
+    if (!cells->beginFrame(stack, target))
+      return false;
+    const HwcRect<int>& all = target.getDst();
+    bool ok = cells->drawLayerSet(0, NULL, 1, &all);
+    for (uint32_t ly = 0; ok && ly < stack.size(); ly++)
+      ok = cells->drawLayerSet(1, &ly, 1, &stack[ly].getDst());
+    return cells->endFrame() && ok;
+  };
+
+  for (const StackFormat& format : kFormats) {
+    for (const StackSize& size : kSizes) {
+      std::vector<std::shared_ptr<HWCNativeHandlesp>> buffers(kMaxLayers);
+      std::vector<Layer> layers(kMaxLayers);
+      bool allocated = true;
+      for (uint32_t ly = 0; allocated && ly < kMaxLayers; ly++) {
+        buffers[ly] = bm.createGraphicBuffer("CALIBRATE", size.width,
+                                             size.height, format.format,
+                                             kUsage);
+        allocated = buffers[ly] != NULL;
+        if (!allocated)
+          break;
+        // Cascade the layers so that each covers part of the one below.
+        Layer& layer = layers[ly];
+        layer.onUpdateAll(buffers[ly].get());
+        int32_t x = (ly * (kTargetWidth - size.width)) / kMaxLayers;
+        int32_t y = (ly * (kTargetHeight - size.height)) / kMaxLayers;
+        layer.setDst(HwcRect<int>(x, y, x + size.width, y + size.height));
+        layer.editVisibleRegions().assign(1, layer.getDst());
+        layer.onUpdateFlags();
+      }
+      if (!allocated) {
+        printf("%ux%u %s: cannot allocate, skipped\n", size.width, size.height,
+               format.name);
+        continue;
+      }
+
+      printf("%ux%u %s us:", size.width, size.height, format.name);
+      for (uint32_t n = 1; n <= kMaxLayers; n++) {
+        Content::LayerStack stack(layers.data(), n);
+        for (Calibration& c : calibrations) {
+          ComposerCostModel::Sample sample;
+          c.estimate(stack, target, sample.mWorkload);
+          sample.mMeasuredUs = measure_us(
+              *context, frames, [&]() { return c.compose(stack, target); });
+          printf(" %.0f", sample.mMeasuredUs);
+          if (sample.mMeasuredUs >= 0)
+            c.samples.push_back(sample);
+        }
+      }
+      printf("\n");
+    }
+  }
+
+  ComposerCostModel& model = ComposerCostModel::getInstance();
+  bool ok = true;
+  for (const Calibration& c : calibrations) {
+    ComposerCostModel::Coefficients coefficients = model.getCoefficients(c.name);
+    if (!ComposerCostModel::fit(c.samples, coefficients)) {
+      printf("%s: %zu samples do not determine the coefficients\n", c.name,
+             c.samples.size());
+      ok = false;
+      continue;
+    }
+    model.setCoefficients(c.name, coefficients);
+
+    float worst = 0;
+    for (const ComposerCostModel::Sample& s : c.samples) {
+      float error =
+          ComposerCostModel::estimateUs(coefficients, s.mWorkload) -
+          s.mMeasuredUs;
+      if (s.mMeasuredUs > 0 && fabsf(error) / s.mMeasuredUs > worst)
+        worst = fabsf(error) / s.mMeasuredUs;
+    }
+    printf("%s: %zu samples, worst prediction error %.1f%%\n", c.name,
+           c.samples.size(), worst * 100);
+  }
+  printf("%s\n", model.dump().string());
+
+  if (ok && output && !model.save(output)) {
+    fprintf(stderr, "Failed to write %s\n", output);
+    ok = false;
+  }
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,136 @@
+/*
+// Copyright (c) 2017 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+// Converts a frame trace saved by FrameTrace::Save() to the Chrome trace
+// event JSON format, which chrome://tracing and ui.perfetto.dev both open.
+// Each display is shown as a process and each HWC thread as a thread in it.
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include "frametrace.h"
+
+using hwcomposer::FrameTrace;
+
+static bool read_trace(const char* path, FrameTrace::FileHeader& header,
+                       std::vector<FrameTrace::Record>& records) {
+  FILE* file = fopen(path, "rb");
+  if (!file) {
+    fprintf(stderr, "Failed to open %s\n", path);
+    return false;
+  }
+
+  bool ok = fread(&header, sizeof(header), 1, file) == 1 &&
+            memcmp(header.magic, FrameTrace::kMagic, sizeof(header.magic)) ==
+                0 &&
+            header.version == FrameTrace::kVersion &&
+            header.record_size == sizeof(FrameTrace::Record);
+  if (!ok) {
+    fprintf(stderr, "%s is not a version %u frame trace\n", path,
+            FrameTrace::kVersion);
+  } else {
+    records.resize(header.count);
+    ok = records.empty() ||
+         fread(records.data(), sizeof(FrameTrace::Record), records.size(),
+               file) == records.size();
+    if (!ok)
+      fprintf(stderr, "%s is truncated\n", path);
+  }
+  fclose(file);
+  return ok;
+}
+
+static void write_json(FILE* out, const FrameTrace::FileHeader& header,
+                       std::vector<FrameTrace::Record>& records) {
+  // Records are in the order they were added, which can be a little out of
+  // timestamp order across threads.
+  std::stable_sort(records.begin(), records.end(),
+                   [](const FrameTrace::Record& a,
+                      const FrameTrace::Record& b) {
+                     return a.timestamp < b.timestamp;
+                   });
+
+  fprintf(out, "{\"displayTimeUnit\":\"ns\",\"otherData\":{\"dropped\":%llu},",
+          (unsigned long long)header.dropped);
+  fprintf(out, "\"traceEvents\":[\n");
+
+  std::set<std::pair<uint32_t, uint32_t>> threads;
+  std::set<uint32_t> displays;
+  const char* separator = "";
+  for (const FrameTrace::Record& r : records) {
+    static const char* const kPhases[] = {"B", "E", "i"};
+    const char* phase = r.phase < 3 ? kPhases[r.phase] : "i";
+    // Timestamps are in microseconds.
+    fprintf(out,
+            "%s{\"name\":\"%s\",\"ph\":\"%s\",\"ts\":%lld.%03lld,"
+            "\"pid\":%u,\"tid\":%u,%s\"args\":{\"frame\":%u,\"arg\":%d}}",
+            separator, FrameTrace::GetEventName(r.event), phase,
+            (long long)(r.timestamp / 1000), (long long)(r.timestamp % 1000),
+            r.display, r.tid, r.phase == FrameTrace::kInstant ? "\"s\":\"t\"," : "",
+            r.frame, r.arg);
+    separator = ",\n";
+    displays.insert(r.display);
+    threads.insert(std::make_pair(uint32_t(r.display), r.tid));
+  }
+
+  for (uint32_t display : displays) {
+    fprintf(out,
+            "%s{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%u,"
+            "\"args\":{\"name\":\"Display %u\"}}",
+            separator, display, display);
+    separator = ",\n";
+  }
+  for (const std::pair<uint32_t, uint32_t>& thread : threads) {
+    fprintf(out,
+            "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%u,\"tid\":%u,"
+            "\"args\":{\"name\":\"tid %u\"}}",
+            separator, thread.first, thread.second, thread.second);
+    separator = ",\n";
+  }
+  fprintf(out, "\n]}\n");
+}
+
+int main(int argc, char* argv[]) {
+  if (argc < 2 || argc > 3) {
+    printf("usage: %s trace.bin [trace.json]\n", argv[0]);
+    return 1;
+  }
+
+  FrameTrace::FileHeader header;
+  std::vector<FrameTrace::Record> records;
+  if (!read_trace(argv[1], header, records))
+    return 1;
+
+  FILE* out = argc == 3 ? fopen(argv[2], "w") : stdout;
+  if (!out) {
+    fprintf(stderr, "Failed to open %s\n", argv[2]);
+    return 1;
+  }
+  write_json(out, header, records);
+  if (out != stdout && fclose(out) != 0) {
+    fprintf(stderr, "Failed to write %s\n", argv[2]);
+    return 1;
+  }
+  if (header.dropped)
+    fprintf(stderr, "%llu events were overwritten before the trace was saved\n",
+            (unsigned long long)header.dropped);
+  return 0;
+}
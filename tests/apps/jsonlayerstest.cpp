@@ -34,6 +34,9 @@
 #include <errno.h>
 #include <unistd.h>
 #include <getopt.h>
+#include <time.h>
+
+#include <algorithm>
 
 #include <xf86drm.h>
 #include <xf86drmMode.h>
@@ -52,7 +55,10 @@
 #include <platformdefines.h>
 #include <nativefence.h>
 #include <spinlock.h>
+#include <framelatency.h>
+#include <latencyhistogram.h>
 
+#include "cpulayerrenderer.h"
 #include "glcubelayerrenderer.h"
 #include "videolayerrenderer.h"
 #include "imagelayerrenderer.h"
@@ -67,6 +73,12 @@
  */
 static uint64_t arg_frames = 0;
 
+/* Frames presented before a benchmark starts measuring. */
+static uint64_t arg_warmup = 60;
+
+/* Benchmark result file, if benchmarking. */
+static char benchmark_path[1024];
+
 glContext gl;
 
 struct frame {
@@ -414,8 +426,6 @@ static void fill_hwclayer(hwcomposer::HwcLayer *pHwcLayer,
 }
 
 static void init_frames(int32_t width, int32_t height) {
-  parseParametersJson(json_path, &test_parameters);
-
   for (size_t i = 0; i < ARRAY_SIZE(frames); ++i) {
     struct frame *frame = &frames[i];
     frame->layers_fences.resize(test_parameters.layers_parameters.size());
@@ -431,6 +441,9 @@ static void init_frames(int32_t width, int32_t height) {
         case LAYER_TYPE_GL:
           renderer = new GLCubeLayerRenderer(buffer_handler, false);
           break;
+        case LAYER_TYPE_CPU:
+          renderer = new CPULayerRenderer(buffer_handler);
+          break;
 #ifdef USE_MINIGBM
         case LAYER_TYPE_VIDEO:
           renderer = new VideoLayerRenderer(buffer_handler);
@@ -463,10 +476,203 @@ static void init_frames(int32_t width, int32_t height) {
   }
 }
 
+static bool needs_gl() {
+  for (const LAYER_PARAMETER &layer_parameter :
+       test_parameters.layers_parameters) {
+    if (layer_parameter.type == LAYER_TYPE_GL ||
+        layer_parameter.type == LAYER_TYPE_GL_TEXTURE)
+      return true;
+  }
+
+  return false;
+}
+
+static bool layer_event_due(const LAYER_EVENT &event, uint64_t frame) {
+  if (frame == event.frame)
+    return true;
+  if (!event.every || frame < event.frame)
+    return false;
+  if (event.until && frame >= event.until)
+    return false;
+  return (frame - event.frame) % event.every == 0;
+}
+
+static uint32_t wrap(uint32_t position, int32_t delta, uint32_t size) {
+  if (!size)
+    return position;
+  int64_t wrapped = (int64_t(position) + delta) % size;
+  return wrapped < 0 ? wrapped + size : wrapped;
+}
+
+/* Applies the layer events due at frame to both frames' layers. */
+static void apply_layer_events(uint64_t frame, uint32_t width,
+                               uint32_t height) {
+  for (const LAYER_EVENT &event : test_parameters.layer_events) {
+    if (event.layer >= test_parameters.layers_parameters.size() ||
+        !layer_event_due(event, frame))
+      continue;
+
+    LAYER_PARAMETER &layer_parameter =
+        test_parameters.layers_parameters[event.layer];
+    switch (event.type) {
+      case LAYER_EVENT_ADD:
+        layer_parameter.hidden = false;
+        break;
+      case LAYER_EVENT_REMOVE:
+        layer_parameter.hidden = true;
+        break;
+      case LAYER_EVENT_MOVE:
+        layer_parameter.frame_x = wrap(layer_parameter.frame_x, event.x, width);
+        layer_parameter.frame_y =
+            wrap(layer_parameter.frame_y, event.y, height);
+        break;
+      case LAYER_EVENT_RESIZE:
+        layer_parameter.frame_width = event.width;
+        layer_parameter.frame_height = event.height;
+        break;
+      default:
+        continue;
+    }
+
+    for (size_t i = 0; i < ARRAY_SIZE(frames); ++i) {
+      fill_hwclayer(frames[i].layers[event.layer].get(), &layer_parameter,
+                    frames[i].layer_renderers[event.layer].get());
+    }
+  }
+}
+
+static int64_t clock_ns(clockid_t clock) {
+  struct timespec t;
+  clock_gettime(clock, &t);
+  return int64_t(t.tv_sec) * 1000000000 + t.tv_nsec;
+}
+
+/* Statistics of one measured frame, in microseconds. */
+struct benchmark_sample {
+  uint32_t frame_time;
+  uint32_t hwc_cpu;
+};
+
+static std::vector<benchmark_sample> benchmark_samples;
+
+/* Reads the statistics the HWC keeps for each connected display. */
+static void read_display_summaries(
+    const std::vector<hwcomposer::NativeDisplay *> &displays,
+    std::vector<hwcomposer::FrameLatency::Summary> &summaries) {
+  summaries.resize(displays.size());
+  for (size_t i = 0; i < displays.size(); ++i) {
+    if (!hwcomposer::FrameLatency::GetSummary(displays[i]->Pipe(),
+                                              summaries[i]))
+      memset(&summaries[i], 0, sizeof(summaries[i]));
+  }
+}
+
+static void write_distribution(FILE *file, const char *name,
+                               std::vector<uint32_t> &values) {
+  std::sort(values.begin(), values.end());
+  uint64_t total = 0;
+  for (uint32_t value : values)
+    total += value;
+
+  const uint32_t count = values.size();
+  fprintf(file,
+          "  \"%s\": {\"mean\": %llu, \"p50\": %u, \"p90\": %u, "
+          "\"p99\": %u, \"max\": %u},\n",
+          name, (unsigned long long)(count ? total / count : 0),
+          hwcomposer::LatencyHistogram::Percentile(values.data(), count, 50),
+          hwcomposer::LatencyHistogram::Percentile(values.data(), count, 90),
+          hwcomposer::LatencyHistogram::Percentile(values.data(), count, 99),
+          count ? values.back() : 0);
+}
+
+/* Writes the benchmark results as JSON. The counters are the difference
+ * over the measured frames; the latency percentiles cover the HWC's most
+ * recent window of frames.
+ */
+static bool write_benchmark_results(
+    const std::vector<hwcomposer::NativeDisplay *> &displays,
+    const std::vector<hwcomposer::FrameLatency::Summary> &before,
+    const std::vector<hwcomposer::FrameLatency::Summary> &after) {
+  FILE *file = fopen(benchmark_path, "w");
+  if (!file) {
+    fprintf(stderr, "Can't open benchmark result file %s\n", benchmark_path);
+    return false;
+  }
+
+  std::vector<uint32_t> frame_times;
+  std::vector<uint32_t> hwc_cpu;
+  for (const benchmark_sample &sample : benchmark_samples) {
+    frame_times.push_back(sample.frame_time);
+    hwc_cpu.push_back(sample.hwc_cpu);
+  }
+
+  uint64_t commits = 0;
+  uint64_t test_commits = 0;
+  uint64_t composed_pixels = 0;
+  uint64_t missed_vblanks = 0;
+  for (size_t i = 0; i < after.size() && i < before.size(); ++i) {
+    commits += after[i].frames - before[i].frames;
+    test_commits += after[i].test_commits - before[i].test_commits;
+    composed_pixels += after[i].composed_pixels - before[i].composed_pixels;
+    missed_vblanks += after[i].missed_vblanks - before[i].missed_vblanks;
+  }
+
+  const uint64_t measured = benchmark_samples.size();
+  const uint64_t divisor = measured ? measured : 1;
+  fprintf(file, "{\n");
+  fprintf(file, "  \"scenario\": \"%s\",\n", json_path);
+  fprintf(file, "  \"frames\": %llu,\n", (unsigned long long)measured);
+  fprintf(file, "  \"warmup\": %llu,\n", (unsigned long long)arg_warmup);
+  fprintf(file, "  \"displays\": %zu,\n", displays.size());
+  write_distribution(file, "frame_time_us", frame_times);
+  write_distribution(file, "hwc_cpu_us", hwc_cpu);
+  fprintf(file, "  \"commits\": %llu,\n", (unsigned long long)commits);
+  fprintf(file, "  \"test_commits\": %llu,\n",
+          (unsigned long long)test_commits);
+  fprintf(file, "  \"test_commits_per_frame\": %.2f,\n",
+          double(test_commits) / divisor);
+  fprintf(file, "  \"composed_pixels\": %llu,\n",
+          (unsigned long long)composed_pixels);
+  fprintf(file, "  \"composed_pixels_per_frame\": %llu,\n",
+          (unsigned long long)(composed_pixels / divisor));
+  fprintf(file, "  \"missed_vblanks\": %llu,\n",
+          (unsigned long long)missed_vblanks);
+  fprintf(file, "  \"latency_us\": [");
+  for (size_t i = 0; i < after.size(); ++i) {
+    fprintf(file, "%s\n    {\"pipe\": %u", i ? "," : "", displays[i]->Pipe());
+    for (uint32_t stage = 0; stage < hwcomposer::FrameLatency::kNumStages;
+         stage++) {
+      const hwcomposer::LatencyHistogram::Summary &summary =
+          after[i].stages[stage];
+      fprintf(file,
+              ", \"%s\": {\"p50\": %u, \"p90\": %u, \"p99\": %u, "
+              "\"max\": %u}",
+              hwcomposer::FrameLatency::GetStageName(stage), summary.p50,
+              summary.p90, summary.p99, summary.max);
+    }
+    fprintf(file, "}");
+  }
+  fprintf(file, "\n  ]\n}\n");
+
+  bool ok = !ferror(file);
+  ok &= fclose(file) == 0;
+  if (!ok)
+    fprintf(stderr, "Failed to write benchmark result file %s\n",
+            benchmark_path);
+  return ok;
+}
+
 static void print_help(void) {
   printf(
       "usage: testjsonlayers [-h|--help] [-f|--frames <frames>] [-j|--json "
-      "<jsonfile>] [-p|--powermode <on/off/doze/dozesuspend>]\n");
+      "<jsonfile>] [-p|--powermode <on/off/doze/dozesuspend>]\n"
+      "                      [-b|--benchmark <resultfile> [-w|--warmup "
+      "<frames>]]\n"
+      "\n"
+      "With --benchmark, <frames> frames (600 by default) are measured after "
+      "<warmup>\n"
+      "frames (60 by default) and the results are written to <resultfile> as "
+      "JSON.\n");
 }
 
 static void parse_args(int argc, char *argv[]) {
@@ -474,6 +680,8 @@ static void parse_args(int argc, char *argv[]) {
       {"help", no_argument, NULL, 'h'},
       {"frames", required_argument, NULL, 'f'},
       {"json", required_argument, NULL, 'j'},
+      {"benchmark", required_argument, NULL, 'b'},
+      {"warmup", required_argument, NULL, 'w'},
       {0},
   };
 
@@ -484,7 +692,7 @@ static void parse_args(int argc, char *argv[]) {
   /* Suppress getopt's poor error messages */
   opterr = 0;
 
-  while ((opt = getopt_long(argc, argv, "+:hf:j:", longopts,
+  while ((opt = getopt_long(argc, argv, "+:hf:j:b:w:", longopts,
                             /*longindex*/ &longindex)) != -1) {
     switch (opt) {
       case 'h':
@@ -507,6 +715,21 @@ static void parse_args(int argc, char *argv[]) {
           exit(EXIT_FAILURE);
         }
         break;
+      case 'b':
+        if (strlen(optarg) >= 1024) {
+          printf("too long benchmark file path, litmited less than 1024!\n");
+          exit(0);
+        }
+        strcpy(benchmark_path, optarg);
+        break;
+      case 'w':
+        errno = 0;
+        arg_warmup = strtoul(optarg, &endptr, 0);
+        if (errno || *endptr != '\0') {
+          fprintf(stderr, "usage error: invalid value for <warmup>\n");
+          exit(EXIT_FAILURE);
+        }
+        break;
       case ':':
         fprintf(stderr, "usage error: %s requires an argument\n",
                 argv[optind - 1]);
@@ -525,6 +748,9 @@ static void parse_args(int argc, char *argv[]) {
     fprintf(stderr, "usage error: trailing args\n");
     exit(EXIT_FAILURE);
   }
+
+  if (benchmark_path[0] && arg_frames == 0)
+    arg_frames = 600;
 }
 
 int main(int argc, char *argv[]) {
@@ -554,7 +780,10 @@ int main(int argc, char *argv[]) {
   if (!buffer_handler)
     exit(-1);
 
-  if (!init_gl()) {
+  parseParametersJson(json_path, &test_parameters);
+
+  // Scenarios made only of CPU layers run without EGL.
+  if (needs_gl() && !init_gl()) {
     delete buffer_handler;
     exit(-1);
   }
@@ -574,9 +803,23 @@ int main(int argc, char *argv[]) {
   int64_t gpu_fence_fd = -1; /* out-fence from gpu, in-fence to kms */
   std::vector<hwcomposer::HwcLayer *> layers;
   uint32_t frame_total = 0;
+  const bool benchmark = benchmark_path[0] != '\0';
+  const uint64_t total_frames = arg_frames + (benchmark ? arg_warmup : 0);
+  std::vector<hwcomposer::FrameLatency::Summary> summaries_before;
+  if (benchmark)
+    benchmark_samples.reserve(arg_frames);
 
-  for (uint64_t i = 0; arg_frames == 0 || i < arg_frames; ++i) {
+  for (uint64_t i = 0; arg_frames == 0 || i < total_frames; ++i) {
     struct frame *frame = &frames[i % ARRAY_SIZE(frames)];
+    if (benchmark && i == arg_warmup)
+      read_display_summaries(displays, summaries_before);
+
+    const int64_t frame_start = clock_ns(CLOCK_MONOTONIC);
+    const int64_t cpu_start = clock_ns(CLOCK_PROCESS_CPUTIME_ID);
+    int64_t render_cpu = 0;
+    if (!test_parameters.layer_events.empty())
+      apply_layer_events(i, primary_width, primary_height);
+
     std::vector<hwcomposer::HwcLayer *>().swap(layers);
     for (int32_t &fence : frame->fences) {
       if (fence == -1)
@@ -595,7 +838,12 @@ int main(int argc, char *argv[]) {
       }
 
       frame->layers_fences[j].clear();
+      if (test_parameters.layers_parameters[j].hidden)
+        continue;
+
+      const int64_t render_start = clock_ns(CLOCK_THREAD_CPUTIME_ID);
       frame->layer_renderers[j]->Draw(&gpu_fence_fd);
+      render_cpu += clock_ns(CLOCK_THREAD_CPUTIME_ID) - render_start;
       frame->layers[j]->acquire_fence.Reset(gpu_fence_fd);
       layers.emplace_back(frame->layers[j].get());
     }
@@ -603,6 +851,18 @@ int main(int argc, char *argv[]) {
     callback->PresentLayers(layers, frame->layers_fences, frame->fences);
     frame_total++;
 
+    // Each frame starts by waiting for the fences of the frame that last
+    // used its buffers, so frame times follow the display's pace. The HWC
+    // CPU time is the whole process's, less the time spent drawing layers.
+    if (benchmark && i >= arg_warmup) {
+      const int64_t hwc_cpu =
+          clock_ns(CLOCK_PROCESS_CPUTIME_ID) - cpu_start - render_cpu;
+      benchmark_sample sample;
+      sample.frame_time = (clock_ns(CLOCK_MONOTONIC) - frame_start) / 1000;
+      sample.hwc_cpu = hwc_cpu > 0 ? hwc_cpu / 1000 : 0;
+      benchmark_samples.push_back(sample);
+    }
+
     if (!strcmp(test_parameters.power_mode.c_str(), "on")) {
       if (frame_total == 500) {
         usleep(10000);
@@ -638,6 +898,13 @@ int main(int argc, char *argv[]) {
     }
   }
 
+  if (benchmark) {
+    std::vector<hwcomposer::FrameLatency::Summary> summaries_after;
+    read_display_summaries(displays, summaries_after);
+    if (!write_benchmark_results(displays, summaries_before, summaries_after))
+      ret = -1;
+  }
+
   callback->SetBroadcastRGB("Automatic");
   callback->SetGamma(1, 1, 1);
   callback->SetBrightness(0x80, 0x80, 0x80);
@@ -0,0 +1,303 @@
+/*
+// Copyright (c) 2017 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+// Replays a layer capture saved by LayerCapture::Save() through the HWC.
+// Each captured buffer is stood in for by a buffer of the same size and
+// format, and each frame's layers are presented to the display with the
+// captured pipe, so that plane allocation and composition see the layer
+// stacks the device saw. The HWC's statistics for each display are printed
+// at the end, to compare one build against another.
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <map>
+#include <memory>
+#include <vector>
+
+#include <libsync.h>
+
+#include <gpudevice.h>
+#include <hwcdefs.h>
+#include <hwclayer.h>
+#include <nativebufferhandler.h>
+#include <nativedisplay.h>
+#include <platformdefines.h>
+
+#include "framelatency.h"
+#include "layercapture.h"
+
+using hwcomposer::LayerCapture;
+
+struct SyntheticBuffer {
+  HWCNativeHandle handle = 0;
+  uint32_t width = 0;
+  uint32_t height = 0;
+  uint32_t format = 0;
+};
+
+struct DisplayState {
+  hwcomposer::NativeDisplay* display = NULL;
+  std::vector<std::unique_ptr<hwcomposer::HwcLayer>> layers;
+  std::vector<hwcomposer::HwcRect<int>> damage;
+  int32_t retire_fence = -1;
+};
+
+static hwcomposer::NativeBufferHandler* buffer_handler;
+static std::map<uint32_t, SyntheticBuffer> buffers;
+
+static int64_t now_ns() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return int64_t(t.tv_sec) * 1000000000 + t.tv_nsec;
+}
+
+// Returns a buffer to stand in for the captured one, making it, or making
+// it again if the id now names a buffer of another size or format. The
+// contents are opaque white where the buffer can be mapped, so that no
+// layer is dropped as transparent.
+static HWCNativeHandle get_buffer(const LayerCapture::Layer& layer) {
+  if (!layer.width || !layer.height)
+    return 0;
+
+  SyntheticBuffer& buffer = buffers[layer.buffer];
+  if (buffer.handle && buffer.width == layer.width &&
+      buffer.height == layer.height && buffer.format == layer.format)
+    return buffer.handle;
+
+  if (buffer.handle)
+    buffer_handler->DestroyBuffer(buffer.handle);
+  buffer = SyntheticBuffer();
+  if (!buffer_handler->CreateBuffer(layer.width, layer.height, layer.format,
+                                    &buffer.handle)) {
+    fprintf(stderr, "Failed to create a %ux%u buffer of format %4.4s\n",
+            layer.width, layer.height, (const char*)&layer.format);
+    buffer.handle = 0;
+    return 0;
+  }
+  buffer.width = layer.width;
+  buffer.height = layer.height;
+  buffer.format = layer.format;
+
+  uint32_t stride = 0;
+  void* map_data = NULL;
+  void* map = buffer_handler->Map(buffer.handle, 0, 0, layer.width,
+                                  layer.height, &stride, &map_data, 0);
+  if (map) {
+    memset(map, 0xff, size_t(stride) * layer.height);
+    buffer_handler->UnMap(buffer.handle, map_data);
+  }
+  return buffer.handle;
+}
+
+// Layers whose buffer can't be stood in for are left out.
+static void set_layers(DisplayState& state, const LayerCapture::Layer* layers,
+                       uint32_t count) {
+  while (state.layers.size() < count)
+    state.layers.emplace_back(new hwcomposer::HwcLayer());
+  state.damage.resize(count);
+
+  uint32_t used = 0;
+  for (uint32_t i = 0; i < count; i++) {
+    const LayerCapture::Layer& captured = layers[i];
+    HWCNativeHandle handle = get_buffer(captured);
+    if (!handle)
+      continue;
+
+    hwcomposer::HwcLayer* layer = state.layers[used].get();
+    layer->SetNativeHandle(handle);
+    layer->SetTransform(captured.transform);
+    layer->SetAlpha(captured.alpha);
+    layer->SetBlending(static_cast<hwcomposer::HWCBlending>(captured.blending));
+    layer->SetSourceCrop(hwcomposer::HwcRect<float>(
+        captured.source_crop[0], captured.source_crop[1],
+        captured.source_crop[2], captured.source_crop[3]));
+    layer->SetDisplayFrame(hwcomposer::HwcRect<int>(
+        captured.display_frame[0], captured.display_frame[1],
+        captured.display_frame[2], captured.display_frame[3]));
+
+    // The damage is replayed as its bounds.
+    state.damage[used] =
+        hwcomposer::HwcRect<int>(captured.damage[0], captured.damage[1],
+                                 captured.damage[2], captured.damage[3]);
+    hwcomposer::HwcRegion damage;
+    damage.kNumRects = captured.damage_rects ? 1 : 0;
+    damage.kRects = &state.damage[used];
+    layer->SetSurfaceDamage(damage);
+    used++;
+  }
+  state.layers.resize(used);
+}
+
+static void clear_damage(DisplayState& state) {
+  hwcomposer::HwcRegion damage;
+  damage.kNumRects = 0;
+  damage.kRects = NULL;
+  for (auto& layer : state.layers)
+    layer->SetSurfaceDamage(damage);
+}
+
+static void wait_retire_fence(DisplayState& state) {
+  if (state.retire_fence < 0)
+    return;
+  sync_wait(state.retire_fence, -1);
+  close(state.retire_fence);
+  state.retire_fence = -1;
+}
+
+static void usage(const char* name) {
+  printf(
+      "usage: %s [-l loops] [-r] [-g gpu device] capture\n"
+      "  -l  replay the capture this many times (1)\n"
+      "  -r  keep the captured time between frames, rather than presenting\n"
+      "      each frame as soon as the display has taken the last one\n"
+      "  -g  render node to allocate buffers from (/dev/dri/renderD128)\n",
+      name);
+}
+
+int main(int argc, char* argv[]) {
+  uint32_t loops = 1;
+  bool realtime = false;
+  const char* gpu_path = "/dev/dri/renderD128";
+  int opt;
+
+  while ((opt = getopt(argc, argv, "l:rg:h")) != -1) {
+    switch (opt) {
+      case 'l':
+        loops = atoi(optarg) > 0 ? atoi(optarg) : 1;
+        break;
+      case 'r':
+        realtime = true;
+        break;
+      case 'g':
+        gpu_path = optarg;
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+  if (optind + 1 != argc) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  LayerCapture::FileHeader header;
+  std::vector<LayerCapture::Frame> frames;
+  std::vector<LayerCapture::Layer> layers;
+  if (!LayerCapture::Load(argv[optind], header, frames, layers)) {
+    fprintf(stderr, "Failed to load %s\n", argv[optind]);
+    return 1;
+  }
+  printf("%s: %zu frames, %zu layers, %llu frames dropped while capturing\n",
+         argv[optind], frames.size(), layers.size(),
+         (unsigned long long)header.dropped);
+  if (frames.empty())
+    return 0;
+
+  hwcomposer::GpuDevice device;
+  if (!device.Initialize()) {
+    fprintf(stderr, "Failed to initialize the GPU device\n");
+    return 1;
+  }
+
+  std::map<uint32_t, DisplayState> displays;
+  for (hwcomposer::NativeDisplay* display :
+       device.GetConnectedPhysicalDisplays()) {
+    display->SetPowerMode(hwcomposer::kOn);
+    displays[display->Pipe()].display = display;
+  }
+
+  int fd = open(gpu_path, O_RDWR);
+  if (fd < 0) {
+    fprintf(stderr, "Failed to open %s\n", gpu_path);
+    return 1;
+  }
+  buffer_handler = hwcomposer::NativeBufferHandler::CreateInstance(fd);
+  if (!buffer_handler) {
+    close(fd);
+    return 1;
+  }
+
+  uint64_t presented = 0, skipped = 0, failed = 0;
+  const int64_t start = now_ns();
+  for (uint32_t loop = 0; loop < loops; loop++) {
+    const int64_t loop_start = now_ns();
+    const LayerCapture::Layer* frame_layers = layers.data();
+    for (const LayerCapture::Frame& frame : frames) {
+      const LayerCapture::Layer* next_layers = frame_layers + frame.num_layers;
+      std::map<uint32_t, DisplayState>::iterator it =
+          displays.find(frame.display);
+      if (it == displays.end()) {
+        // Not connected here.
+        skipped++;
+        frame_layers = next_layers;
+        continue;
+      }
+      DisplayState& state = it->second;
+
+      if (realtime) {
+        const int64_t due =
+            loop_start + (frame.timestamp - frames.front().timestamp);
+        const int64_t wait = due - now_ns();
+        if (wait > 0)
+          usleep(wait / 1000);
+      }
+
+      if (frame.flags & LayerCapture::kUnchanged)
+        clear_damage(state);
+      else
+        set_layers(state, frame_layers, frame.num_layers);
+      frame_layers = next_layers;
+
+      wait_retire_fence(state);
+      std::vector<hwcomposer::HwcLayer*> present_layers;
+      for (auto& layer : state.layers)
+        present_layers.push_back(layer.get());
+      if (state.display->Present(present_layers, &state.retire_fence))
+        presented++;
+      else
+        failed++;
+    }
+  }
+
+  for (auto& entry : displays)
+    wait_retire_fence(entry.second);
+  const double seconds = (now_ns() - start) / 1e9;
+
+  printf("presented %llu frames in %.3f s (%.1f fps), %llu failed, %llu for "
+         "displays not connected\n",
+         (unsigned long long)presented, seconds,
+         seconds > 0 ? presented / seconds : 0.0, (unsigned long long)failed,
+         (unsigned long long)skipped);
+  printf("%s", hwcomposer::FrameLatency::DumpAll().string());
+
+  for (auto& entry : displays)
+    entry.second.layers.clear();
+  for (auto& entry : buffers) {
+    if (entry.second.handle)
+      buffer_handler->DestroyBuffer(entry.second.handle);
+  }
+  delete buffer_handler;
+  close(fd);
+  return failed ? 1 : 0;
+}
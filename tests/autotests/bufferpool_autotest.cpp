@@ -0,0 +1,347 @@
+/*
+// Copyright (c) 2017 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+// Runs a synthetic resize animation through BufferQueue, with size classes
+// enabled, on a stand-in buffer manager: one render target grows from 640x360 to 1920x1080, holds, and
+// shrinks back, next to a small target of constant size. Reports buffer
+// allocations and peak bytes against the number of size changes (each of
+// which would reallocate a target with exact-size matching), and checks the
+// byte budget from setConstraints is respected. Then runs the animation
+// through CompositionManager, whose BufferQueue pools by size class by
+// default, and checks every composition target crops to its requested size.
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include <deque>
+#include <map>
+#include <memory>
+
+#include "AbstractBufferManager.h"
+#include "BufferQueue.h"
+#include "CompositionManager.h"
+#include "stubcomposer.h"
+
+using hwcomposer::AbstractBufferManager;
+using hwcomposer::AbstractComposition;
+using hwcomposer::BufferQueue;
+using hwcomposer::CompositionManager;
+using hwcomposer::Content;
+using hwcomposer::ECompressionType;
+using hwcomposer::HwcRect;
+using hwcomposer::Layer;
+using hwcomposer::Timeline;
+
+static const uint32_t kGrowFrames = 60;
+static const uint32_t kHoldFrames = 30;
+static const uint32_t kBudget = 40 * 1024 * 1024;
+static const uint32_t kUsage = GBM_BO_USE_RENDERING | GBM_BO_USE_SCANOUT;
+// A target is released by the display one frame after it is queued.
+static const uint32_t kFramesInFlight = 1;
+
+// Allocates nothing, just hands out handles and remembers their sizes.
+class StandInBufferManager : public AbstractBufferManager {
+ public:
+  std::shared_ptr<HWCNativeHandlesp> createGraphicBuffer(const char*,
+                                                         uint32_t w, uint32_t h,
+                                                         int32_t format,
+                                                         uint32_t usage) {
+    HWCNativeHandle handle = new HWCNativeHandlesp();
+    handle->handle = reinterpret_cast<struct gbm_bo*>(++next_);
+    HwcBuffer& bo = buffers_[handle];
+    bo.width = w;
+    bo.height = h;
+    bo.format = format;
+    bo.usage = usage;
+    live_bytes_ += getBufferSizeBytes(handle);
+    return std::shared_ptr<HWCNativeHandlesp>(
+        handle, [this](HWCNativeHandlesp* freed) {
+          live_bytes_ -= getBufferSizeBytes(freed);
+          buffers_.erase(freed);
+          delete freed;
+        });
+  }
+  void reallocateGraphicBuffer(std::shared_ptr<HWCNativeHandlesp>& pGB,
+                               const char* pchTag, uint32_t w, uint32_t h,
+                               int32_t format, uint32_t usage) {
+    pGB = createGraphicBuffer(pchTag, w, h, format, usage);
+  }
+  std::shared_ptr<HWCNativeHandlesp> createPurgedGraphicBuffer(
+      const char* pchTag, uint32_t w, uint32_t h, uint32_t format,
+      uint32_t usage, bool* pbIsPurged) {
+    if (pbIsPurged)
+      *pbIsPurged = false;
+    return createGraphicBuffer(pchTag, w, h, format, usage);
+  }
+  uint32_t getBufferSizeBytes(HWCNativeHandle handle) {
+    auto it = buffers_.find(handle);
+    return it == buffers_.end() ? 0 : it->second.width * it->second.height * 4;
+  }
+  bool getBufferDetails(HWCNativeHandle handle, HwcBuffer* bo) {
+    auto it = buffers_.find(handle);
+    if (it == buffers_.end())
+      return false;
+    *bo = it->second;
+    return true;
+  }
+  uint32_t getLiveBytes() const {
+    return live_bytes_;
+  }
+
+  void registerTracker(Tracker&) {
+  }
+  void unregisterTracker(Tracker&) {
+  }
+  void getLayerBufferDetails(Layer*, Layer::BufferDetails*) {
+  }
+  void setPavpSession(HWCNativeHandle, uint32_t, uint32_t, uint32_t) {
+  }
+  void setBufferKeyFrame(HWCNativeHandle, bool) {
+  }
+  bool wait(HWCNativeHandle, nsecs_t) {
+    return true;
+  }
+  std::shared_ptr<Buffer> acquireBuffer(HWCNativeHandle) {
+    return NULL;
+  }
+  void setBufferUsage(HWCNativeHandle, BufferUsage) {
+  }
+  void requestCompression(HWCNativeHandle, ECompressionType) {
+  }
+  void validate(std::shared_ptr<Buffer>, HWCNativeHandle, uint64_t) {
+  }
+  void onEndOfFrame() {
+  }
+  bool isCompressionSupportedByGL(ECompressionType) {
+    return false;
+  }
+  const char* getCompressionName(ECompressionType) {
+    return "none";
+  }
+  ECompressionType getSurfaceFlingerCompression() {
+    return hwcomposer::COMPRESSION_NONE;
+  }
+  void setSurfaceFlingerRT(HWCNativeHandle, uint32_t) {
+  }
+  void purgeSurfaceFlingerRenderTargets(uint32_t) {
+  }
+  void realizeSurfaceFlingerRenderTargets(uint32_t) {
+  }
+  uint32_t purgeBuffer(HWCNativeHandle) {
+    return 0;
+  }
+  uint32_t realizeBuffer(HWCNativeHandle) {
+    return 0;
+  }
+  hwcomposer::String8 dump() {
+    return hwcomposer::String8();
+  }
+
+ private:
+  std::map<HWCNativeHandle, HwcBuffer> buffers_;
+  uintptr_t next_ = 0;
+  uint32_t live_bytes_ = 0;
+};
+
+static uint32_t lerp(uint32_t from, uint32_t to, uint32_t step,
+                     uint32_t steps) {
+  return from + (int32_t)(to - from) * (int32_t)step / (int32_t)steps;
+}
+
+// The size of the animated target in frame.
+static void animation_size(uint32_t frame, uint32_t* w, uint32_t* h) {
+  if (frame < kGrowFrames) {
+    *w = lerp(640, 1920, frame, kGrowFrames - 1);
+    *h = lerp(360, 1080, frame, kGrowFrames - 1);
+  } else if (frame < kGrowFrames + kHoldFrames) {
+    *w = 1920;
+    *h = 1080;
+  } else {
+    uint32_t step = frame - kGrowFrames - kHoldFrames;
+    *w = lerp(1920, 640, step, kGrowFrames - 1);
+    *h = lerp(1080, 360, step, kGrowFrames - 1);
+  }
+}
+
+// Composes one layer to a target of the animated size each frame, as a
+// display would. onCompose dequeues the targets from the manager's own
+// BufferQueue, with its default options.
+static bool run_composition(uint32_t size_changes) {
+  CompositionManager& cm = CompositionManager::getInstance();
+  cm.add(new StubComposer());
+  const BufferQueue& bq = cm.getCompositionBuffers();
+  std::deque<Timeline::FenceReference> in_flight;
+  const uint32_t frames = kGrowFrames * 2 + kHoldFrames;
+  nsecs_t timestamp = 0;
+  bool ok = true;
+
+  for (uint32_t frame = 0; frame < frames; frame++) {
+    uint32_t w, h;
+    animation_size(frame, &w, &h);
+    timestamp += 16666667;
+    cm.onFrameBegin(timestamp);
+
+    Layer layer;
+    layer.setHandle(reinterpret_cast<HWCNativeHandle>(0x1000));
+    layer.setSrc(HwcRect<float>(0, 0, 1920, 1080));
+    layer.setDst(HwcRect<int>(0, 0, w, h));
+    layer.setPlaneAlpha(1.0f);
+    layer.setBlending(hwcomposer::EBlendMode::PREMULT);
+    layer.setBufferFormat(INTEL_HWC_DEFAULT_HAL_PIXEL_FORMAT);
+    layer.onUpdateFlags();
+    Content::LayerStack stack(&layer, 1);
+    AbstractComposition* pc =
+        cm.requestComposition(stack, w, h, INTEL_HWC_DEFAULT_HAL_PIXEL_FORMAT,
+                              hwcomposer::COMPRESSION_NONE);
+    if (!pc || !pc->onAcquire()) {
+      printf("frame %u: composition %ux%u failed\n", frame, w, h);
+      return false;
+    }
+    pc->onCompose();
+
+    // Only the requested size at the top left of the buffer is the target's.
+    const Layer& target = pc->getTarget();
+    const HwcRect<float>& src = target.getSrc();
+    if (target.getDstWidth() != w || target.getDstHeight() != h ||
+        src.left != 0 || src.top != 0 || src.right != w || src.bottom != h ||
+        target.getBufferWidth() < w || target.getBufferHeight() < h ||
+        target.getBufferAllocWidth() < target.getBufferWidth() ||
+        target.getBufferAllocHeight() < target.getBufferHeight()) {
+      printf("frame %u: %ux%u target crops %gx%g of %ux%u in %ux%u\n", frame,
+             w, h, src.right - src.left, src.bottom - src.top,
+             target.getBufferWidth(), target.getBufferHeight(),
+             target.getBufferAllocWidth(), target.getBufferAllocHeight());
+      ok = false;
+    }
+    in_flight.push_back(target.getReleaseFenceReturn());
+    pc->onRelease();
+    cm.onEndOfFrame(frame);
+
+    // The display is done with the targets from earlier frames.
+    while (in_flight.size() > kFramesInFlight) {
+      in_flight.front().set(Timeline::NullNativeFence);
+      in_flight.pop_front();
+    }
+  }
+
+  printf("composition: allocations %u, peak %u KB\n", bq.getAllocationCount(),
+         bq.getPeakAllocBytes() / 1024);
+  const uint32_t max_allocations = size_changes * 3 / 5;
+  if (bq.getAllocationCount() > max_allocations) {
+    printf("composition: expected at most %u allocations\n", max_allocations);
+    ok = false;
+  }
+  for (const Timeline::FenceReference& fence : in_flight)
+    fence.set(Timeline::NullNativeFence);
+  return ok;
+}
+
+int main(int argc, char* argv[]) {
+  StandInBufferManager bm;
+  bool ok = true;
+  uint32_t size_changes = 0;
+  uint32_t hold_allocations = 0;
+  uint32_t over_budget_frames = 0;
+
+  {
+    BufferQueue bq(bm);
+    bq.setConstraints(0, kBudget);
+    bq.setSizeClasses(true);
+    std::deque<Timeline::Fence*> in_flight;
+    uint32_t last_w = 0, last_h = 0;
+    const uint32_t frames = kGrowFrames * 2 + kHoldFrames;
+
+    for (uint32_t frame = 0; frame < frames; frame++) {
+      uint32_t w, h;
+      animation_size(frame, &w, &h);
+      if (w != last_w || h != last_h)
+        size_changes++;
+      last_w = w;
+      last_h = h;
+
+      uint32_t allocations = bq.getAllocationCount();
+      bq.onSetBegin();
+      const uint32_t sizes[][2] = {{w, h}, {256, 256}};
+      for (const auto& size : sizes) {
+        Timeline::Fence* fence = NULL;
+        BufferQueue::BufferHandle handle =
+            bq.dequeue(size[0], size[1], INTEL_HWC_DEFAULT_HAL_PIXEL_FORMAT,
+                       kUsage, &fence);
+        if (!handle) {
+          printf("frame %u: dequeue %ux%u failed\n", frame, size[0], size[1]);
+          return 1;
+        }
+        const HwcBuffer& details = bq.getBufferDetails(handle);
+        if (details.width < size[0] || details.height < size[1]) {
+          printf("frame %u: dequeue %ux%u returned %ux%u\n", frame, size[0],
+                 size[1], details.width, details.height);
+          ok = false;
+        }
+        bq.markUsed(handle);
+        bq.queue();
+        in_flight.push_back(fence);
+      }
+      bq.onSetEnd();
+
+      // The display is done with the targets from earlier frames.
+      while (in_flight.size() > kFramesInFlight * 2) {
+        in_flight.front()->set(Timeline::NullNativeFence);
+        in_flight.pop_front();
+      }
+
+      if (frame >= kGrowFrames + 1 && frame < kGrowFrames + kHoldFrames)
+        hold_allocations += bq.getAllocationCount() - allocations;
+      if (bm.getLiveBytes() > kBudget)
+        over_budget_frames++;
+    }
+
+    printf("%u frames, %u target size changes\n", frames, size_changes);
+    printf("allocations %u, peak %u KB, budget %u KB\n",
+           bq.getAllocationCount(), bq.getPeakAllocBytes() / 1024,
+           kBudget / 1024);
+    printf("%s", bq.dump().string());
+
+    // Each size change reallocates with exact-size matching. Growing still
+    // needs a pair of buffers per new class, but shrinking should mostly reuse
+    // larger buffers for the sub-rect.
+    const uint32_t max_allocations = size_changes * 3 / 5;
+    if (bq.getAllocationCount() > max_allocations) {
+      printf("expected at most %u allocations\n", max_allocations);
+      ok = false;
+    }
+    if (hold_allocations) {
+      printf("%u allocations while the size was constant\n", hold_allocations);
+      ok = false;
+    }
+    if (bq.getPeakAllocBytes() > kBudget || over_budget_frames) {
+      printf("budget exceeded (%u frames over)\n", over_budget_frames);
+      ok = false;
+    }
+    for (Timeline::Fence* fence : in_flight)
+      fence->set(Timeline::NullNativeFence);
+  }
+
+  if (bm.getLiveBytes()) {
+    printf("%u bytes still allocated after the queue was destroyed\n",
+           bm.getLiveBytes());
+    ok = false;
+  }
+
+  ok = run_composition(size_changes) && ok;
+
+  printf("\n%s\n", ok ? "PASSED" : "FAILED");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,289 @@
+/*
+// Copyright (c) 2017 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+// Checks the Broxton DBuf block cache ("bxtdbufcache") against the uncached
+// calculation. Each step changes the stack the way frames and allocator
+// candidates do: layers are replaced (from a pool larger than the 32 entry
+// cache, so entries are evicted), disabled, dropped from or added to the top
+// of the stack (so per index slots are released and reused), and the timing
+// and pipe scaling change. Every stack is evaluated with the cache off and
+// then on; the blocks of every layer and the total must match, and the
+// total kept incrementally must equal the sum of the layers. Then times the
+// allocator's pattern, all 31 subsets of a 5 layer stack evaluated in turn,
+// with the cache off and on.
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <vector>
+
+#include "BxtDisplayCaps.h"
+#include "Content.h"
+#include "GenCompression.h"
+#include "Layer.h"
+#include "Timing.h"
+
+using intel::ufo::hwc::BxtDisplayCaps;
+using intel::ufo::hwc::Content;
+using intel::ufo::hwc::ECompressionType;
+using intel::ufo::hwc::ETransform;
+using intel::ufo::hwc::Layer;
+using intel::ufo::hwc::Timing;
+
+static const uint32_t kWidth = 1920;
+static const uint32_t kHeight = 1080;
+static const uint32_t kPoolSize = 48;
+static const uint32_t kMaxLayers = 7;
+
+static const int32_t kFormats[] = {
+    HAL_PIXEL_FORMAT_RGBA_8888, HAL_PIXEL_FORMAT_RGB_565,
+    HAL_PIXEL_FORMAT_YCbCr_422_I, HAL_PIXEL_FORMAT_NV12_Y_TILED_INTEL,
+};
+static const uint32_t kNumFormats = sizeof(kFormats) / sizeof(kFormats[0]);
+
+static uint32_t sRandom = 1;
+
+static uint32_t rnd(uint32_t n) {
+  sRandom = sRandom * 1103515245u + 12345u;
+  return (sRandom >> 8) % n;
+}
+
+static Layer random_layer(uint32_t id) {
+  Layer layer;
+  float sw = 64 + rnd(kWidth - 64);
+  float sh = 64 + rnd(kHeight - 64);
+  if (rnd(4) == 0)
+    sw += 0.5f;
+  int32_t dw = rnd(2) ? int32_t(sw) : 64 + rnd(kWidth - 64);
+  int32_t dh = rnd(2) ? int32_t(sh) : 64 + rnd(kHeight - 64);
+  hwc_frect_t src = {0, 0, sw, sh};
+  hwc_rect_t dst = {0, 0, dw, dh};
+  layer.setSrc(src);
+  layer.setDst(dst);
+  layer.setBufferFormat(kFormats[rnd(kNumFormats)]);
+  layer.setBufferTilingFormat(rnd(2) ? TILE_Y : TILE_X);
+  layer.setTransform(rnd(3) == 0 ? ETransform::ROT_90 : ETransform::NONE);
+  layer.setBufferCompression(rnd(4) == 0 ? ECompressionType::GL_RC
+                                         : COMPRESSION_NONE);
+  // Layers without a buffer are disabled.
+  layer.setHandle(rnd(8) ? reinterpret_cast<buffer_handle_t>(
+                               static_cast<uintptr_t>(0x1000 + id))
+                         : NULL);
+  layer.onUpdateFlags();
+  return layer;
+}
+
+static void set_stack(Content::Display& display, std::vector<Layer>& layers) {
+  display.editLayerStack() = Content::LayerStack(layers.data(), layers.size());
+  display.editLayerStack().updateLayerFlags();
+}
+
+static bool test_random(BxtDisplayCaps& caps, uint32_t steps) {
+  std::vector<Layer> pool;
+  for (uint32_t i = 0; i < kPoolSize; i++)
+    pool.push_back(random_layer(i));
+
+  Content::Display display;
+  display.setWidth(kWidth);
+  display.setHeight(kHeight);
+  Timing timing(kWidth, kHeight, 60, 148500, 2200, 1125);
+  std::vector<Layer> layers(1 + rnd(kMaxLayers), pool[0]);
+  std::vector<uint32_t> uncached, cached;
+  uint32_t mismatches = 0, bad_totals = 0, resized = 0;
+
+  for (uint32_t step = 0; step < steps; step++) {
+    switch (rnd(8)) {
+      case 0:
+      case 1:
+        // A different layer at some index.
+        layers[rnd(layers.size())] = pool[rnd(kPoolSize)];
+        break;
+      case 2:
+        // A pool layer changes, as a buffer or geometry update would.
+        pool[rnd(kPoolSize)] = random_layer(step);
+        break;
+      case 3:
+        // Layers come and go at the top of the stack.
+        layers.resize(1 + rnd(kMaxLayers), pool[rnd(kPoolSize)]);
+        resized++;
+        break;
+      case 4:
+        timing = Timing(kWidth, kHeight, 60, 25000 + rnd(600000),
+                        kWidth + rnd(2000), 1125);
+        break;
+      case 5:
+        if (display.isOutputScaled()) {
+          display = Content::Display();
+          display.setWidth(kWidth);
+          display.setHeight(kHeight);
+        } else {
+          int32_t w = 800 + rnd(kWidth - 800);
+          int32_t h = 600 + rnd(kHeight - 600);
+          hwc_rect_t dst = {0, 0, w, h};
+          display.setOutputScaled(dst);
+        }
+        break;
+      default:
+        // Several candidates for the same frame.
+        for (uint32_t ly = 0; ly < layers.size(); ly++)
+          layers[ly] = pool[(step + ly) % kPoolSize];
+        break;
+    }
+    set_stack(display, layers);
+
+    caps.setDBufCache(false);
+    uint32_t total_uncached = caps.calculateDBuf(display, timing, &uncached);
+    caps.setDBufCache(true);
+    uint32_t total_cached = caps.calculateDBuf(display, timing, &cached);
+
+    uint32_t sum = 0;
+    for (uint32_t blocks : cached)
+      sum += blocks;
+    if (total_cached != total_uncached || cached != uncached) {
+      if (mismatches++ < 5)
+        printf("step %u: %zu layers, %u blocks cached v %u uncached\n", step,
+               layers.size(), total_cached, total_uncached);
+    }
+    if (sum != total_cached) {
+      if (bad_totals++ < 5)
+        printf("step %u: running total %u v sum of layers %u\n", step,
+               total_cached, sum);
+    }
+  }
+
+  bool ok = mismatches == 0 && bad_totals == 0;
+  printf("%s: %u steps (%u resizes), %u mismatches, %u bad totals\n",
+         ok ? "ok" : "FAIL", steps, resized, mismatches, bad_totals);
+  return ok;
+}
+
+// A stack shrinks, its top layers change while dropped, and it grows back.
+static bool test_slots(BxtDisplayCaps& caps) {
+  Content::Display display;
+  display.setWidth(kWidth);
+  display.setHeight(kHeight);
+  Timing timing(kWidth, kHeight, 60, 148500, 2200, 1125);
+  std::vector<Layer> layers;
+  for (uint32_t ly = 0; ly < 6; ly++) {
+    layers.push_back(random_layer(ly));
+    layers.back().setHandle(reinterpret_cast<buffer_handle_t>(
+        static_cast<uintptr_t>(0x2000 + ly)));
+    layers.back().onUpdateFlags();
+  }
+
+  const uint32_t sizes[] = {6, 2, 0, 6, 3, 6};
+  bool ok = true;
+  for (uint32_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+    std::vector<Layer> stack(layers.begin(), layers.begin() + sizes[s]);
+    set_stack(display, stack);
+    caps.setDBufCache(false);
+    uint32_t expected = caps.calculateDBuf(display, timing);
+    caps.setDBufCache(true);
+    uint32_t total = caps.calculateDBuf(display, timing);
+    if (total != expected) {
+      printf("FAIL: %u layers, %u blocks v %u\n", sizes[s], total, expected);
+      ok = false;
+    }
+    // Change a layer that is not in the stack.
+    if (sizes[s] < layers.size())
+      layers[layers.size() - 1] = random_layer(0x3000 + s);
+  }
+  printf("%s: slots released and reused\n", ok ? "ok" : "FAIL");
+  return ok;
+}
+
+// The allocator asks for each candidate arrangement in turn.
+static void benchmark(BxtDisplayCaps& caps, uint32_t iterations) {
+  Timing timing(kWidth, kHeight, 60, 148500, 2200, 1125);
+  std::vector<Layer> layers;
+  for (uint32_t ly = 0; ly < 5; ly++) {
+    layers.push_back(random_layer(ly));
+    layers.back().setHandle(reinterpret_cast<buffer_handle_t>(
+        static_cast<uintptr_t>(0x4000 + ly)));
+    layers.back().onUpdateFlags();
+  }
+  std::vector<std::vector<Layer>> subsets;
+  std::vector<Content::Display> candidates;
+  for (uint32_t mask = 1; mask < 32; mask++) {
+    subsets.push_back(std::vector<Layer>());
+    for (uint32_t ly = 0; ly < 5; ly++) {
+      if (mask & (1 << ly))
+        subsets.back().push_back(layers[ly]);
+    }
+  }
+  candidates.resize(subsets.size());
+  for (uint32_t c = 0; c < subsets.size(); c++) {
+    candidates[c].setWidth(kWidth);
+    candidates[c].setHeight(kHeight);
+    set_stack(candidates[c], subsets[c]);
+  }
+
+  printf("\n%8s %16s\n", "cache", "ns/calculation");
+  for (uint32_t enable = 0; enable < 2; enable++) {
+    caps.setDBufCache(enable);
+    volatile uint32_t sink = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < iterations; i++) {
+      for (const Content::Display& candidate : candidates)
+        sink += caps.calculateDBuf(candidate, timing);
+    }
+    double ns = std::chrono::duration<double, std::nano>(
+                    std::chrono::steady_clock::now() - start)
+                    .count();
+    printf("%8s %16.1f\n", enable ? "on" : "off",
+           ns / (double(iterations) * candidates.size()));
+  }
+}
+
+static void usage(const char* name) {
+  printf(
+      "usage: %s [-s steps] [-n benchmark iterations]\n"
+      "  -s  random steps (200000)\n"
+      "  -n  passes over the 31 candidates timed (20000)\n",
+      name);
+}
+
+int main(int argc, char* argv[]) {
+  uint32_t steps = 200000;
+  uint32_t iterations = 20000;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "s:n:h")) != -1) {
+    switch (opt) {
+      case 's':
+        steps = atoi(optarg) > 0 ? atoi(optarg) : 1;
+        break;
+      case 'n':
+        iterations = atoi(optarg) > 0 ? atoi(optarg) : 1;
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+
+  BxtDisplayCaps caps(0, BXT_PLATFORM_SCALAR_COUNT);
+  bool ok = true;
+  ok = test_random(caps, steps) && ok;
+  ok = test_slots(caps) && ok;
+  benchmark(caps, iterations);
+
+  printf("\n%s\n", ok ? "PASSED" : "FAILED");
+  return ok ? 0 : 1;
+}
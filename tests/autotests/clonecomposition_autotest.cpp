@@ -0,0 +1,205 @@
+/*
+// Copyright (c) 2017 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+// Shows one layer stack on two fake displays, as with a cloned output, and
+// counts the compositions CompositionManager hands out each frame and the
+// layers they compose. A clone at the same resolution must share the primary
+// display's composition; a smaller clone must get a one layer scaling pass of
+// it instead of composing the stack again, but only of the same buffers. A
+// scaling pass that is not requested in a frame is dropped, and rebuilt when
+// the clone comes back.
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include <set>
+#include <vector>
+
+#include "CompositionManager.h"
+#include "stubcomposer.h"
+
+using hwcomposer::AbstractComposition;
+using hwcomposer::CompositionManager;
+using hwcomposer::Content;
+using hwcomposer::HwcRect;
+using hwcomposer::Layer;
+
+static const uint32_t kLayers = 4;
+static const uint32_t kWidth = 1920;
+static const uint32_t kHeight = 1080;
+static const uint32_t kFrames = 5;
+
+// Stands in for a display: shows the stack laid out for kWidth x kHeight,
+// scaled to its own resolution as the clone path does, and asks for one
+// composition of all of it.
+class FakeDisplay {
+ public:
+  FakeDisplay(uint32_t width, uint32_t height)
+      : width_(width), height_(height) {
+  }
+
+  AbstractComposition* present(CompositionManager& cm,
+                               const std::vector<Layer>& content) {
+    layers_ = content;
+    const float sx = float(width_) / kWidth, sy = float(height_) / kHeight;
+    for (Layer& layer : layers_) {
+      const HwcRect<int>& d = layer.getDst();
+      layer.setDst(HwcRect<int>(int(d.left * sx + 0.5f),
+                                int(d.top * sy + 0.5f),
+                                int(d.right * sx + 0.5f),
+                                int(d.bottom * sy + 0.5f)));
+      layer.onUpdateFlags();
+    }
+    Content::LayerStack stack(layers_.data(), layers_.size());
+    AbstractComposition* pc = cm.requestComposition(
+        stack, width_, height_, INTEL_HWC_DEFAULT_HAL_PIXEL_FORMAT,
+        hwcomposer::COMPRESSION_NONE);
+    if (pc && !pc->onAcquire())
+      pc = NULL;
+    return pc;
+  }
+
+ private:
+  uint32_t width_;
+  uint32_t height_;
+  // Requested compositions keep pointing at these until the next frame.
+  std::vector<Layer> layers_;
+};
+
+static std::vector<Layer> make_stack(uint32_t x, uintptr_t handles) {
+  std::vector<Layer> layers(kLayers);
+  for (uint32_t ly = 0; ly < kLayers; ly++) {
+    Layer& layer = layers[ly];
+    layer.setHandle(reinterpret_cast<HWCNativeHandle>(handles + ly));
+    layer.setSrc(HwcRect<float>(0, 0, 640, 480));
+    int32_t left = ly == kLayers - 1 ? x : ly * 300;
+    layer.setDst(HwcRect<int>(left, ly * 150, left + 640, ly * 150 + 480));
+    layer.setPlaneAlpha(1.0f);
+    layer.setBlending(hwcomposer::EBlendMode::PREMULT);
+    layer.setBufferFormat(INTEL_HWC_DEFAULT_HAL_PIXEL_FORMAT);
+    layer.onUpdateFlags();
+  }
+  return layers;
+}
+
+struct FrameCounts {
+  uint32_t compositions;
+  uint32_t layers;
+  uint32_t evaluations;
+};
+
+// Presents kFrames frames on both displays (in order) and checks every frame
+// composes as expected. second_content moves a layer on the second display,
+// second_buffers shows other buffers there.
+static bool run(const char* name, CompositionManager& cm, StubComposer& sc,
+                FakeDisplay& first, FakeDisplay& second,
+                uint32_t expect_compositions, uint32_t expect_layers,
+                bool second_content = false, bool second_buffers = false) {
+  static nsecs_t timestamp = 0;
+  const uint32_t evaluations = sc.evaluations_;
+  bool ok = true;
+  FrameCounts counts = {0, 0, 0};
+  for (uint32_t frame = 0; frame < kFrames; frame++) {
+    timestamp += 16666667;
+    cm.onFrameBegin(timestamp);
+    sc.layers_.clear();
+
+    std::set<AbstractComposition*> compositions;
+    AbstractComposition* a = first.present(cm, make_stack(900, 0x1000));
+    AbstractComposition* b =
+        second.present(cm, make_stack(second_content ? 1000 : 900,
+                                      second_buffers ? 0x2000 : 0x1000));
+    if (!a || !b) {
+      printf("%s: frame %u composition failed\n", name, frame);
+      return false;
+    }
+    compositions.insert(a);
+    compositions.insert(b);
+    a->onRelease();
+    b->onRelease();
+
+    counts.compositions = compositions.size();
+    counts.layers = 0;
+    for (auto& entry : sc.layers_)
+      counts.layers += entry.second;
+    if (counts.compositions != expect_compositions ||
+        counts.layers != expect_layers) {
+      printf("%s: frame %u %u compositions of %u layers, expected %u of %u\n",
+             name, frame, counts.compositions, counts.layers,
+             expect_compositions, expect_layers);
+      ok = false;
+    }
+  }
+  counts.evaluations = sc.evaluations_ - evaluations;
+  // Each composition is evaluated once, when it is first requested.
+  if (counts.evaluations > expect_compositions) {
+    printf("%s: %u evaluations over %u frames\n", name, counts.evaluations,
+           kFrames);
+    ok = false;
+  }
+  printf("%-28s %s %u compositions/frame, %u layers/frame, %u evaluations\n",
+         name, ok ? "ok    " : "FAILED", counts.compositions, counts.layers,
+         counts.evaluations);
+  return ok;
+}
+
+int main() {
+  CompositionManager& cm = CompositionManager::getInstance();
+  StubComposer* sc = new StubComposer();
+  cm.add(sc);
+
+  FakeDisplay primary(kWidth, kHeight);
+  FakeDisplay clone(kWidth, kHeight);
+  FakeDisplay small(1280, 720);
+  bool ok = true;
+
+  // Without sharing each clone composes all kLayers layers.
+  printf("%u layers, %u frames; unshared clones compose %u layers/frame\n",
+         kLayers, kFrames, 2 * kLayers);
+
+  ok = run("same resolution", cm, *sc, primary, clone, 1, kLayers) && ok;
+  // The smaller clone scales the primary's composition: one layer.
+  ok = run("smaller clone", cm, *sc, primary, small, 2, kLayers + 1) && ok;
+  // Scaling up would lose detail, so a larger display composes its own.
+  ok = run("smaller display first", cm, *sc, small, primary, 2,
+           2 * kLayers) &&
+       ok;
+  // Different content on the clone can't share.
+  ok = run("different content", cm, *sc, primary, small, 2, 2 * kLayers,
+           true) &&
+       ok;
+  // The same layout of other buffers can't share either.
+  ok = run("different buffers", cm, *sc, primary, small, 2, 2 * kLayers,
+           false, true) &&
+       ok;
+
+  // A clone that goes away for a frame drops its scaling pass, so it is
+  // evaluated again when the clone comes back. (A size not shown before, as
+  // the small clone's own compositions above would be reused.)
+  FakeDisplay quarter(960, 540);
+  ok = run("quarter size clone", cm, *sc, primary, quarter, 2, kLayers + 1) &&
+       ok;
+  ok = run("clone gone", cm, *sc, primary, clone, 1, kLayers) && ok;
+  const uint32_t evaluations = sc->evaluations_;
+  ok = run("clone back", cm, *sc, primary, quarter, 2, kLayers + 1) && ok;
+  if (sc->evaluations_ == evaluations) {
+    printf("clone back: the dropped scaling pass was reused\n");
+    ok = false;
+  }
+
+  printf("\n%s\n", ok ? "PASSED" : "FAILED");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,199 @@
+/*
+// Copyright (c) 2017 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+// Checks ColorLutCache::Compute against the pow() based LUT generation that
+// DisplayQueue used before, over a sweep of gamma, contrast and brightness,
+// and compares how long each takes to build a table.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+
+#include <chrono>
+#include <vector>
+
+#include <colorlut.h>
+
+using hwcomposer::ColorLutCache;
+
+// Maximum difference allowed from the pow() table, in 16-bit LUT steps.
+static const int kMaxError = 1;
+
+static float transform_contrast_brightness(float value, float brightness,
+                                           float contrast) {
+  float result;
+  result = (value - 0.5) * contrast + 0.5 + brightness;
+
+  if (result < 0.0)
+    result = 0.0;
+  if (result > 1.0)
+    result = 1.0;
+  return result;
+}
+
+static float transform_gamma(float value, float gamma) {
+  float result;
+
+  result = pow(value, gamma);
+  if (result < 0.0)
+    result = 0.0;
+  if (result > 1.0)
+    result = 1.0;
+
+  return result;
+}
+
+// The original DisplayQueue_old::SetColorCorrection table.
+static void reference_lut(const struct hwcomposer::gamma_colors &gamma,
+                          uint32_t contrast_c, uint32_t brightness_c,
+                          struct drm_color_lut *lut, size_t lut_size) {
+  float brightness[3];
+  float contrast[3];
+  uint8_t temp[3];
+
+  temp[0] = (brightness_c >> 16) & 0xFF;
+  temp[1] = (brightness_c >> 8) & 0xFF;
+  temp[2] = (brightness_c)&0xFF;
+  for (int i = 0; i < 3; i++)
+    brightness[i] = (float)(temp[i]) / 255 - 0.5;
+
+  temp[0] = (contrast_c >> 16) & 0xFF;
+  temp[1] = (contrast_c >> 8) & 0xFF;
+  temp[2] = (contrast_c)&0xFF;
+  for (int i = 0; i < 3; i++)
+    contrast[i] = (float)(temp[i]) / 128;
+
+  for (uint64_t i = 0; i < lut_size; i++) {
+    if (i == 0) {
+      lut[i].red = 0;
+      lut[i].green = 0;
+      lut[i].blue = 0;
+      continue;
+    }
+
+    lut[i].red = 0xFFFF * transform_gamma(transform_contrast_brightness(
+                                              (float)(i) / lut_size,
+                                              brightness[0], contrast[0]),
+                                          gamma.red);
+    lut[i].green = 0xFFFF * transform_gamma(transform_contrast_brightness(
+                                                (float)(i) / lut_size,
+                                                brightness[1], contrast[1]),
+                                            gamma.green);
+    lut[i].blue = 0xFFFF * transform_gamma(transform_contrast_brightness(
+                                               (float)(i) / lut_size,
+                                               brightness[2], contrast[2]),
+                                           gamma.blue);
+  }
+}
+
+static int channel_error(uint16_t a, uint16_t b) {
+  return a > b ? a - b : b - a;
+}
+
+static bool test_accuracy(size_t lut_size) {
+  std::vector<struct drm_color_lut> expected(lut_size), actual(lut_size);
+  int max_error = 0;
+  uint64_t mismatches = 0, entries = 0;
+
+  for (float g = 0.1f; g <= 4.0f; g += 0.05f) {
+    for (uint32_t c = 0; c < 256; c += 17) {
+      for (uint32_t b = 0; b < 256; b += 15) {
+        struct hwcomposer::gamma_colors gamma = {g, g * 1.1f, g * 0.9f};
+        uint32_t contrast = c << 16 | ((c * 3) & 0xFF) << 8 | c;
+        uint32_t brightness = b << 16 | b << 8 | ((b * 7) & 0xFF);
+        reference_lut(gamma, contrast, brightness, expected.data(), lut_size);
+        ColorLutCache::Compute(gamma, contrast, brightness, actual.data(),
+                               lut_size);
+        for (size_t i = 0; i < lut_size; i++) {
+          int error = channel_error(expected[i].red, actual[i].red);
+          int green = channel_error(expected[i].green, actual[i].green);
+          int blue = channel_error(expected[i].blue, actual[i].blue);
+          if (green > error)
+            error = green;
+          if (blue > error)
+            error = blue;
+          if (error > max_error)
+            max_error = error;
+          if (error)
+            mismatches++;
+          entries++;
+        }
+      }
+    }
+  }
+
+  printf("accuracy (%zu entries): max error %d, %.3f%% of entries differ\n",
+         lut_size, max_error, 100.0 * mismatches / entries);
+  return max_error <= kMaxError;
+}
+
+static double bench(bool reference, bool shared, size_t lut_size,
+                    uint32_t iterations) {
+  std::vector<struct drm_color_lut> lut(lut_size);
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < iterations; i++) {
+    // A slider sweep: every table is new.
+    float g = 2.2f + i * 1e-4f;
+    struct hwcomposer::gamma_colors gamma = {g, shared ? g : 1.8f,
+                                             shared ? g : 2.4f};
+    if (reference)
+      reference_lut(gamma, 0x808080, 0x808080, lut.data(), lut_size);
+    else
+      ColorLutCache::Compute(gamma, 0x808080, 0x808080, lut.data(), lut_size);
+  }
+  return std::chrono::duration<double, std::micro>(
+             std::chrono::steady_clock::now() - start)
+             .count() /
+         iterations;
+}
+
+static void usage(const char *name) {
+  printf("usage: %s [-s lut size] [-n benchmark iterations]\n", name);
+}
+
+int main(int argc, char *argv[]) {
+  size_t lut_size = 1024;
+  uint32_t iterations = 2000;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "s:n:h")) != -1) {
+    switch (opt) {
+      case 's':
+        lut_size = atoi(optarg) > 1 ? atoi(optarg) : 2;
+        break;
+      case 'n':
+        iterations = atoi(optarg) > 0 ? atoi(optarg) : 1;
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+
+  bool ok = test_accuracy(lut_size);
+
+  printf("table build time (%zu entries):\n", lut_size);
+  printf("  pow():                       %8.2f us\n",
+         bench(true, false, lut_size, iterations));
+  printf("  Compute(), distinct channels %8.2f us\n",
+         bench(false, false, lut_size, iterations));
+  printf("  Compute(), shared channels   %8.2f us\n",
+         bench(false, true, lut_size, iterations));
+
+  printf("\n%s\n", ok ? "PASSED" : "FAILED");
+  return ok ? 0 : 1;
+}
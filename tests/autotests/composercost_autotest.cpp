@@ -0,0 +1,330 @@
+/*
+// Copyright (c) 2017 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+// Requests compositions of stacks of 1 to 8 layers of several sizes and
+// formats from CompositionManager, with SurfaceFlinger and the partitioned
+// composer added, and prints which engine chooseBestCompositionEngine picks.
+// Checks that the choice moves from SurfaceFlinger to the partitioned
+// composer as layers are added, that blended formats move it earlier, and
+// that calibration files and the least squares fit round trip.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "ComposerCostModel.h"
+#include "CompositionManager.h"
+#include "PartitionedComposer.h"
+#include "SurfaceFlingerComposer.h"
+
+using hwcomposer::AbstractComposer;
+using hwcomposer::AbstractComposition;
+using hwcomposer::ComposerCostModel;
+using hwcomposer::CompositionManager;
+using hwcomposer::Content;
+using hwcomposer::HwcRect;
+using hwcomposer::Layer;
+using hwcomposer::PartitionedComposer;
+using hwcomposer::SurfaceFlingerComposer;
+
+static const uint32_t kMaxLayers = 8;
+static const uint32_t kTargetWidth = 1920;
+static const uint32_t kTargetHeight = 1080;
+
+static const char* kSurfaceFlinger = "SurfaceFlingerComposer";
+static const char* kPartitioned = "PartitionedComp";
+
+// Accepts every layer, so that PartitionedComposer::onEvaluate always costs.
+class StubCellComposer : public PartitionedComposer::CellComposer {
+ public:
+  bool beginFrame(const Content::LayerStack&, const Layer&) {
+    return true;
+  }
+  bool drawLayerSet(uint32_t, const uint32_t*, uint32_t,
+                    const HwcRect<int>*) {
+    return true;
+  }
+  bool endFrame() {
+    return true;
+  }
+  bool isLayerSupportedAsInput(const Layer&) {
+    return true;
+  }
+  bool isLayerSupportedAsOutput(const Layer&) {
+    return true;
+  }
+  bool canBlankUnsupportedInputLayers() {
+    return false;
+  }
+};
+
+// SurfaceFlingerComposer only takes stacks that match what SurfaceFlinger was
+// given this frame. This stands in for it, costing any stack as it would.
+class SurfaceFlingerCost : public AbstractComposer {
+ public:
+  const char* getName() const {
+    return kSurfaceFlinger;
+  }
+  float onEvaluate(const Content::LayerStack& source, const Layer& target,
+                   AbstractComposer::CompositionState**, Cost type) {
+    ComposerCostModel::Workload workload;
+    SurfaceFlingerComposer::estimateWorkload(source, target, workload);
+    return ComposerCostModel::getInstance().evaluate(getName(), workload, type);
+  }
+  void onCompose(const Content::LayerStack&, const Layer&,
+                 AbstractComposer::CompositionState*) {
+  }
+  ResourceHandle onAcquire(const Content::LayerStack&, const Layer&) {
+    return this;
+  }
+  void onRelease(ResourceHandle) {
+  }
+};
+
+struct StackFormat {
+  const char* name;
+  int32_t format;
+};
+
+static const StackFormat kFormats[] = {
+    {"RGBA", DRM_FORMAT_ABGR8888},
+    {"RGBX", DRM_FORMAT_XBGR8888},
+    {"NV12", hwcomposer::HWC_PIXEL_FORMAT_NV12_Y_TILED_INTEL},
+};
+
+static void setup_layer(Layer& layer, uint32_t w, uint32_t h, int32_t x,
+                        int32_t y, int32_t format) {
+  layer.setHandle(reinterpret_cast<HWCNativeHandle>(
+      static_cast<uintptr_t>(0x1000 + x + y)));
+  layer.setSrc(HwcRect<float>(0, 0, w, h));
+  layer.setDst(HwcRect<int>(x, y, x + w, y + h));
+  layer.setPlaneAlpha(1.0f);
+  layer.setBlending(hwcomposer::EBlendMode::PREMULT);
+  layer.setBufferFormat(format);
+  layer.onUpdateFlags();
+}
+
+// Returns the layer count from which CompositionManager chooses the
+// partitioned composer, or 0 if the choice ever goes back to SurfaceFlinger
+// after that. Each call offsets its stacks by one more pixel, so that no
+// request finds a composition an earlier call made (and costed differently).
+static uint32_t crossover(uint32_t w, uint32_t h, int32_t format,
+                          AbstractComposer::Cost type, const char* label) {
+  static int32_t offset = 0;
+  CompositionManager& cm = CompositionManager::getInstance();
+  std::vector<Layer> layers(kMaxLayers);
+  uint32_t first = kMaxLayers + 1;
+  bool monotonic = true;
+
+  offset++;
+  printf("  %-22s", label);
+  for (uint32_t n = 1; n <= kMaxLayers; n++) {
+    setup_layer(layers[n - 1], w, h, (n - 1) * 64 + offset, (n - 1) * 32,
+                format);
+    Content::LayerStack stack(layers.data(), n);
+
+    AbstractComposition* composition = cm.requestComposition(
+        stack, kTargetWidth, kTargetHeight, INTEL_HWC_DEFAULT_HAL_PIXEL_FORMAT,
+        hwcomposer::COMPRESSION_NONE, type);
+    const char* name = composition ? composition->getName() : "none";
+    const bool partitioned = !strcmp(name, kPartitioned);
+    if (!partitioned && strcmp(name, kSurfaceFlinger)) {
+      printf(" %s\n", name);
+      return 0;
+    }
+    printf(" %s", partitioned ? "PC" : "SF");
+    if (partitioned && first > n)
+      first = n;
+    else if (!partitioned && first < n)
+      monotonic = false;
+  }
+  printf("\n");
+  return monotonic ? first : 0;
+}
+
+static bool test_engine_choice() {
+  CompositionManager& cm = CompositionManager::getInstance();
+  cm.add(new SurfaceFlingerCost());
+  cm.add(new PartitionedComposer(std::make_shared<StubCellComposer>()));
+
+  bool ok = true;
+  printf("Chosen engine for 1..%u layers on %ux%u (SF = SurfaceFlinger, PC = "
+         "partitioned), power cost\n",
+         kMaxLayers, kTargetWidth, kTargetHeight);
+
+  uint32_t small[3];
+  for (uint32_t f = 0; f < 3; f++) {
+    char label[64];
+    snprintf(label, sizeof(label), "320x240 %s", kFormats[f].name);
+    small[f] = crossover(320, 240, kFormats[f].format,
+                         AbstractComposer::Power, label);
+    if (!small[f] || small[f] == 1 || small[f] > kMaxLayers) {
+      printf("  expected SurfaceFlinger for few small %s layers and "
+             "partitioned for many\n",
+             kFormats[f].name);
+      ok = false;
+    }
+  }
+  // Blending reads back the destination for every SurfaceFlinger draw.
+  if (small[0] > small[1]) {
+    printf("  blended layers should favour the partitioned composer sooner\n");
+    ok = false;
+  }
+
+  uint32_t full = crossover(kTargetWidth, kTargetHeight,
+                            DRM_FORMAT_ABGR8888, AbstractComposer::Power,
+                            "1920x1080 RGBA");
+  if (full != 1) {
+    printf("  expected partitioned for full screen blended layers\n");
+    ok = false;
+  }
+
+  // The partitioned composer commits a render target, SurfaceFlinger doesn't.
+  uint32_t memory = crossover(320, 240, DRM_FORMAT_ABGR8888,
+                              AbstractComposer::Memory, "320x240 RGBA memory");
+  if (memory <= kMaxLayers) {
+    printf("  expected SurfaceFlinger when costing memory\n");
+    ok = false;
+  }
+  return ok;
+}
+
+static bool test_evaluate(const Layer& target) {
+  std::vector<Layer> layers(3);
+  for (uint32_t ly = 0; ly < layers.size(); ly++)
+    setup_layer(layers[ly], 640, 480, ly * 100, 0, DRM_FORMAT_ABGR8888);
+  Content::LayerStack stack(layers.data(), layers.size());
+
+  PartitionedComposer composer(std::make_shared<StubCellComposer>());
+  ComposerCostModel::Workload workload;
+  PartitionedComposer::estimateWorkload(stack, target, workload);
+  float expected = ComposerCostModel::getInstance().evaluate(
+      composer.getName(), workload, AbstractComposer::Performance);
+  float cost = composer.onEvaluate(stack, target, NULL,
+                                   AbstractComposer::Performance);
+  printf("PartitionedComposer::onEvaluate %.1fus, model %.1fus\n", cost,
+         expected);
+  return cost == expected && cost > 0;
+}
+
+static bool test_fit() {
+  ComposerCostModel::Coefficients truth;
+  truth.mCallUs = 75;
+  truth.mLayerUs = 12;
+  truth.mReadUsPerMB = 45;
+  truth.mWriteUsPerMB = 80;
+  truth.mAluUsPerMPixel = 140;
+  truth.mYuvUsPerMPixel = 90;
+
+  // Varied workloads with +-2% measurement noise.
+  std::vector<ComposerCostModel::Sample> samples;
+  srand(1);
+  for (uint32_t i = 0; i < 200; i++) {
+    ComposerCostModel::Sample s;
+    s.mWorkload.mCalls = 1 + rand() % 9;
+    s.mWorkload.mLayers = 1 + rand() % 8;
+    s.mWorkload.mReadMB = (rand() % 4000) / 100.0f;
+    s.mWorkload.mWriteMB = (rand() % 2000) / 100.0f;
+    s.mWorkload.mMPixels = (rand() % 1600) / 100.0f;
+    s.mWorkload.mYuvMPixels = (rand() % 800) / 100.0f;
+    float noise = 1.0f + ((rand() % 401) - 200) / 10000.0f;
+    s.mMeasuredUs = ComposerCostModel::estimateUs(truth, s.mWorkload) * noise;
+    samples.push_back(s);
+  }
+
+  ComposerCostModel::Coefficients fitted;
+  if (!ComposerCostModel::fit(samples, fitted)) {
+    printf("fit failed\n");
+    return false;
+  }
+  printf("fit: call %.1f layer %.1f read %.1f write %.1f alu %.1f yuv %.1f\n",
+         fitted.mCallUs, fitted.mLayerUs, fitted.mReadUsPerMB,
+         fitted.mWriteUsPerMB, fitted.mAluUsPerMPixel, fitted.mYuvUsPerMPixel);
+
+  // Predictions matter more than individual coefficients.
+  float worst = 0;
+  for (const auto& s : samples) {
+    float predicted = ComposerCostModel::estimateUs(fitted, s.mWorkload);
+    float actual = ComposerCostModel::estimateUs(truth, s.mWorkload);
+    float error = predicted > actual ? predicted - actual : actual - predicted;
+    if (error / actual > worst)
+      worst = error / actual;
+  }
+  printf("fit: worst prediction error %.2f%%\n", worst * 100);
+  if (worst > 0.03f)
+    return false;
+
+  // Too few samples to determine six coefficients.
+  samples.resize(3);
+  return !ComposerCostModel::fit(samples, fitted);
+}
+
+static bool test_file() {
+  ComposerCostModel& model = ComposerCostModel::getInstance();
+  char path[] = "/tmp/composercostXXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0)
+    return false;
+  close(fd);
+
+  ComposerCostModel::Coefficients original = model.getCoefficients(kPartitioned);
+  ComposerCostModel::Coefficients changed = original;
+  changed.mCallUs = 123;
+  changed.mDramNjPerMB = 4567;
+  model.setCoefficients(kPartitioned, changed);
+  bool ok = model.save(path);
+  model.setCoefficients(kPartitioned, original);
+  ok = ok && model.load(path);
+  const ComposerCostModel::Coefficients& loaded =
+      model.getCoefficients(kPartitioned);
+  ok = ok && loaded.mCallUs == 123 && loaded.mDramNjPerMB == 4567;
+
+  // Malformed lines are reported; the rest still applies.
+  FILE* fp = fopen(path, "w");
+  fprintf(fp, "# calibration\n%s.callUs 99\nbogus 1\n%s.noSuchThing 2\n",
+          kPartitioned, kPartitioned);
+  fclose(fp);
+  ok = ok && !model.load(path) &&
+       model.getCoefficients(kPartitioned).mCallUs == 99;
+
+  model.setCoefficients(kPartitioned, original);
+  unlink(path);
+  printf("calibration file round trip %s\n", ok ? "ok" : "FAILED");
+  return ok;
+}
+
+int main(int argc, char* argv[]) {
+  Layer target;
+  target.setSrc(HwcRect<float>(0, 0, kTargetWidth, kTargetHeight));
+  target.setDst(HwcRect<int>(0, 0, kTargetWidth, kTargetHeight));
+  target.setBufferFormat(INTEL_HWC_DEFAULT_HAL_PIXEL_FORMAT);
+  target.onUpdateFlags();
+
+  printf("%s\n", ComposerCostModel::getInstance().dump().string());
+
+  bool ok = true;
+  ok = test_engine_choice() && ok;
+  ok = test_evaluate(target) && ok;
+  ok = test_fit() && ok;
+  ok = test_file() && ok;
+
+  printf("\n%s\n", ok ? "PASSED" : "FAILED");
+  return ok ? 0 : 1;
+}
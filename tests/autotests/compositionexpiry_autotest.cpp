@@ -0,0 +1,297 @@
+/*
+// Copyright (c) 2017 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+// Frees 64 buffers used across 32 cached compositions and measures how long
+// the handle index CompositionManager::expireBuffers uses takes to find the
+// compositions to expire, next to the nested handle x composition x layer
+// scan it replaced. Compositions are indexed the way
+// CompositionManager::Composition::updateHandleIndex indexes them, with
+// synthetic non-null handles. Checks that expiry reaches exactly the
+// compositions using a buffer, including after compositions have moved on to
+// new buffers, that compositions with composition layers are always reached,
+// and, on random stacks, that the index agrees with a full scan.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <getopt.h>
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <set>
+#include <vector>
+
+#include "HandleIndex.h"
+
+using hwcomposer::HandleIndex;
+
+static const uint32_t kCompositions = 32;
+static const uint32_t kLayers = 4;
+// Layers 0 and 1 of each composition come from the app's swapchains, so
+// there are 64 of those. Layers 2 and 3 are shared by every composition.
+static const uint32_t kAppLayers = 2;
+static const uint32_t kRandomRounds = 2000;
+
+// A composition as far as the handle index is concerned: its source layer
+// handles (0 for a composition layer) and what it is indexed under.
+struct Composition {
+  std::vector<HWCNativeHandle> layers;
+  std::vector<HWCNativeHandle> indexed;
+  bool nested = false;
+};
+
+typedef HandleIndex<Composition> Index;
+
+// As Composition::updateHandleIndex.
+static void update_index(Index& index, Composition& c) {
+  std::vector<HWCNativeHandle> handles;
+  bool nested = false;
+  for (HWCNativeHandle handle : c.layers) {
+    if (handle)
+      handles.push_back(handle);
+    else
+      nested = true;
+  }
+  std::sort(handles.begin(), handles.end());
+  handles.erase(std::unique(handles.begin(), handles.end()), handles.end());
+  if (handles == c.indexed && nested == c.nested)
+    return;
+  index.update(&c, c.indexed, c.nested, handles, nested);
+}
+
+static HWCNativeHandle app_handle(uint32_t generation, uint32_t composition,
+                                  uint32_t layer) {
+  return reinterpret_cast<HWCNativeHandle>(static_cast<uintptr_t>(
+      0x100000 + generation * 0x1000 + composition * kAppLayers + layer));
+}
+
+static HWCNativeHandle shared_handle(uint32_t layer) {
+  return reinterpret_cast<HWCNativeHandle>(
+      static_cast<uintptr_t>(0x1000 + layer));
+}
+
+static void update(Index& index, std::vector<Composition>& compositions,
+                   uint32_t generation) {
+  for (uint32_t i = 0; i < kCompositions; i++) {
+    Composition& c = compositions[i];
+    c.layers.resize(kLayers);
+    for (uint32_t ly = 0; ly < kLayers; ly++)
+      c.layers[ly] = ly < kAppLayers ? app_handle(generation, i, ly)
+                                     : shared_handle(ly);
+    update_index(index, c);
+  }
+}
+
+// The compositions expiring handle reaches.
+static std::set<Composition*> expire(const Index& index,
+                                     HWCNativeHandle handle) {
+  std::vector<Composition*> users;
+  index.find(handle, users);
+  return std::set<Composition*>(users.begin(), users.end());
+}
+
+// The compositions a full scan finds using handle.
+static std::set<Composition*> scan(std::vector<Composition>& compositions,
+                                   HWCNativeHandle handle) {
+  std::set<Composition*> users;
+  for (Composition& c : compositions) {
+    for (HWCNativeHandle layer : c.layers) {
+      if (!layer || layer == handle) {
+        users.insert(&c);
+        break;
+      }
+    }
+  }
+  return users;
+}
+
+// The expiry loop before the handle index, run over copies of the stacks.
+static void nested_expiry(std::vector<Composition>& compositions,
+                          uint32_t generation) {
+  for (uint32_t i = 0; i < kCompositions; i++) {
+    for (uint32_t ly = 0; ly < kAppLayers; ly++) {
+      HWCNativeHandle handle = app_handle(generation, i, ly);
+      for (Composition& c : compositions)
+        for (HWCNativeHandle& layer : c.layers)
+          if (layer == handle)
+            layer = 0;
+    }
+  }
+}
+
+static double elapsed_us(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::micro>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+static bool check(const char* name, bool ok) {
+  printf("%-44s %s\n", name, ok ? "ok" : "FAILED");
+  return ok;
+}
+
+static bool test_expiry() {
+  Index index;
+  std::vector<Composition> compositions(kCompositions);
+  bool ok = true;
+
+  update(index, compositions, 0);
+  bool reached = true;
+  for (uint32_t i = 0; i < kCompositions; i++)
+    for (uint32_t ly = 0; ly < kAppLayers; ly++)
+      reached &= expire(index, app_handle(0, i, ly)) ==
+                 std::set<Composition*>{&compositions[i]};
+  ok = check("app buffer reaches only its composition", reached) && ok;
+  ok = check("shared buffer reaches every composition",
+             expire(index, shared_handle(kAppLayers)).size() ==
+                 kCompositions) &&
+       ok;
+  ok = check("one entry per buffer",
+             index.size() == kCompositions * kAppLayers + kLayers -
+                                 kAppLayers) &&
+       ok;
+
+  // Move every composition on to new buffers. The old ones are no longer
+  // used, so freeing them must expire nothing.
+  update(index, compositions, 1);
+  bool none = true;
+  for (uint32_t i = 0; i < kCompositions; i++)
+    for (uint32_t ly = 0; ly < kAppLayers; ly++)
+      none &= expire(index, app_handle(0, i, ly)).empty();
+  ok = check("buffers no longer used reach nothing", none) && ok;
+  ok = check("new buffers reach their composition",
+             expire(index, app_handle(1, 5, 1)) ==
+                 std::set<Composition*>{&compositions[5]}) &&
+       ok;
+
+  // A composition layer's handle can change without the composition being
+  // updated, so that composition is reached by every buffer.
+  compositions[7].layers[3] = 0;
+  update_index(index, compositions[7]);
+  ok = check("nested composition reached by any buffer",
+             expire(index, app_handle(1, 5, 1)) ==
+                     std::set<Composition*>{&compositions[5],
+                                            &compositions[7]} &&
+                 expire(index, app_handle(9, 9, 0)) ==
+                     std::set<Composition*>{&compositions[7]}) &&
+       ok;
+  compositions[7].layers[3] = shared_handle(3);
+  update_index(index, compositions[7]);
+  ok = check("no longer nested",
+             expire(index, app_handle(9, 9, 0)).empty()) &&
+       ok;
+
+  // Compositions that are freed are removed from the index.
+  for (Composition& c : compositions) {
+    c.layers.clear();
+    update_index(index, c);
+  }
+  ok = check("index empty once compositions are freed", index.size() == 0) &&
+       ok;
+  return ok;
+}
+
+// Random stacks drawn from a small pool of handles, with some composition
+// layers, must reach the same compositions as a full scan.
+static bool test_random() {
+  std::mt19937 rng(1);
+  Index index;
+  std::vector<Composition> compositions(kCompositions);
+  const uint32_t pool = 48;
+  uint32_t mismatches = 0;
+
+  for (uint32_t round = 0; round < kRandomRounds; round++) {
+    Composition& c = compositions[rng() % kCompositions];
+    c.layers.resize(rng() % (kLayers * 2));
+    for (HWCNativeHandle& layer : c.layers)
+      layer = rng() % 16 == 0 ? 0 : shared_handle(rng() % pool);
+    update_index(index, c);
+
+    HWCNativeHandle handle = shared_handle(rng() % pool);
+    if (expire(index, handle) != scan(compositions, handle))
+      mismatches++;
+  }
+  for (uint32_t h = 0; h < pool; h++) {
+    if (expire(index, shared_handle(h)) != scan(compositions, shared_handle(h)))
+      mismatches++;
+  }
+  if (mismatches)
+    printf("%u lookups disagree with a full scan\n", mismatches);
+  return check("random stacks agree with a full scan", !mismatches);
+}
+
+static void usage(const char* name) {
+  printf("usage: %s [-n rounds]\n", name);
+}
+
+int main(int argc, char* argv[]) {
+  uint32_t rounds = 200;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:h")) != -1) {
+    switch (opt) {
+      case 'n':
+        rounds = atoi(optarg) > 0 ? atoi(optarg) : 1;
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+
+  bool ok = test_expiry();
+  ok = test_random() && ok;
+
+  // Free the 64 buffers in use and time finding what to expire.
+  Index index;
+  std::vector<Composition> compositions(kCompositions);
+  std::vector<double> times, nested_times;
+  size_t reached = 0;
+  for (uint32_t round = 0; round < rounds; round++) {
+    uint32_t generation = round;
+    update(index, compositions, generation);
+    std::vector<Composition> copies = compositions;
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<Composition*> users;
+    for (uint32_t i = 0; i < kCompositions; i++) {
+      for (uint32_t ly = 0; ly < kAppLayers; ly++) {
+        index.find(app_handle(generation, i, ly), users);
+        reached += users.size();
+      }
+    }
+    times.push_back(elapsed_us(start));
+
+    start = std::chrono::steady_clock::now();
+    nested_expiry(copies, generation);
+    nested_times.push_back(elapsed_us(start));
+  }
+  ok = check("each freed buffer reaches one composition",
+             reached == (size_t)rounds * kCompositions * kAppLayers) &&
+       ok;
+  std::sort(times.begin(), times.end());
+  std::sort(nested_times.begin(), nested_times.end());
+  printf("expire 64 buffers over %u compositions (%u rounds):\n",
+         kCompositions, rounds);
+  printf("  handle index   median %8.2f us  max %8.2f us\n",
+         times[times.size() / 2], times.back());
+  printf("  nested scan    median %8.2f us  max %8.2f us\n",
+         nested_times[nested_times.size() / 2], nested_times.back());
+
+  printf("\n%s\n", ok ? "PASSED" : "FAILED");
+  return ok ? 0 : 1;
+}
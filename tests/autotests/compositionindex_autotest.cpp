@@ -0,0 +1,168 @@
+/*
+// Copyright (c) 2017 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+// Measures CompositionManager::requestComposition as the composition cache
+// grows from 8 to 128 entries, next to a linear Layer::matches() scan of the
+// same stacks (what every request cost before the signature index), and
+// checks that repeated requests find the composition they created.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <getopt.h>
+
+#include <chrono>
+#include <vector>
+
+#include "CompositionManager.h"
+#include "stubcomposer.h"
+
+using hwcomposer::AbstractComposition;
+using hwcomposer::CompositionManager;
+using hwcomposer::Content;
+using hwcomposer::HwcRect;
+using hwcomposer::Layer;
+
+static const uint32_t kLayers = 4;
+static const uint32_t kWidth = 1920;
+static const uint32_t kHeight = 1080;
+static const uint32_t kCacheSizes[] = {8, 16, 32, 64, 128};
+
+// Stacks differ only in where the top layer is, as with a window being moved.
+static std::vector<Layer> make_stack(uint32_t index) {
+  std::vector<Layer> layers(kLayers);
+  for (uint32_t ly = 0; ly < kLayers; ly++) {
+    Layer& layer = layers[ly];
+    layer.setHandle(reinterpret_cast<HWCNativeHandle>(
+        static_cast<uintptr_t>(0x1000 + ly)));
+    layer.setSrc(HwcRect<float>(0, 0, 640, 480));
+    int32_t x = ly == kLayers - 1 ? index : ly * 100;
+    layer.setDst(HwcRect<int>(x, 0, x + 640, 480));
+    layer.setPlaneAlpha(1.0f);
+    layer.setBlending(hwcomposer::EBlendMode::PREMULT);
+    layer.setBufferFormat(INTEL_HWC_DEFAULT_HAL_PIXEL_FORMAT);
+    layer.onUpdateFlags();
+  }
+  return layers;
+}
+
+static AbstractComposition* request(CompositionManager& cm,
+                                    const std::vector<Layer>& layers) {
+  Content::LayerStack stack(layers.data(), layers.size());
+  return cm.requestComposition(stack, kWidth, kHeight,
+                               INTEL_HWC_DEFAULT_HAL_PIXEL_FORMAT,
+                               hwcomposer::COMPRESSION_NONE);
+}
+
+// The pre-index lookup: compare every cached stack layer by layer.
+static size_t linear_find(const std::vector<std::vector<Layer>>& cache,
+                          const std::vector<Layer>& layers) {
+  for (size_t i = 0; i < cache.size(); i++) {
+    const std::vector<Layer>& cached = cache[i];
+    bool match = cached.size() == layers.size();
+    for (size_t ly = 0; match && ly < layers.size(); ly++)
+      match = cached[ly].matches(layers[ly]);
+    if (match)
+      return i;
+  }
+  return cache.size();
+}
+
+template <typename Lookup>
+static double time_us(uint32_t iterations, Lookup lookup) {
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < iterations; i++)
+    lookup(i);
+  return std::chrono::duration<double, std::micro>(
+             std::chrono::steady_clock::now() - start)
+             .count() /
+         iterations;
+}
+
+static void usage(const char* name) {
+  printf("usage: %s [-n benchmark iterations]\n", name);
+}
+
+int main(int argc, char* argv[]) {
+  uint32_t iterations = 20000;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:h")) != -1) {
+    switch (opt) {
+      case 'n':
+        iterations = atoi(optarg) > 0 ? atoi(optarg) : 1;
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+
+  CompositionManager& cm = CompositionManager::getInstance();
+  cm.add(new StubComposer());
+
+  std::vector<std::vector<Layer>> stacks;
+  std::vector<AbstractComposition*> compositions;
+  bool ok = true;
+
+  printf("%8s %16s %16s\n", "entries", "request us", "linear scan us");
+  for (uint32_t size : kCacheSizes) {
+    while (stacks.size() < size) {
+      stacks.push_back(make_stack(stacks.size()));
+      compositions.push_back(request(cm, stacks.back()));
+      if (!compositions.back()) {
+        printf("request %zu failed\n", stacks.size() - 1);
+        return 1;
+      }
+    }
+
+    // Every cached stack must find its own composition again.
+    for (uint32_t i = 0; i < size; i++) {
+      if (request(cm, stacks[i]) != compositions[i]) {
+        printf("entries %u: stack %u did not find its composition\n", size,
+               i);
+        ok = false;
+      }
+    }
+
+    // A stack that differs only in plane alpha must not match.
+    std::vector<Layer> faded = stacks[size - 1];
+    faded[0].setPlaneAlpha(0.5f);
+    faded[0].onUpdateFlags();
+    if (request(cm, faded) == compositions[size - 1]) {
+      printf("entries %u: plane alpha change matched\n", size);
+      ok = false;
+    }
+    // Both are cached now; the original must still find its own entry.
+    if (request(cm, stacks[size - 1]) != compositions[size - 1]) {
+      printf("entries %u: lost composition after a near miss\n", size);
+      ok = false;
+    }
+
+    double hit = time_us(iterations, [&](uint32_t i) {
+      request(cm, stacks[size - 1 - i % 4]);
+    });
+    // The most recent stacks are the worst case for a scan in cache order.
+    volatile size_t found = 0;
+    double linear = time_us(iterations, [&](uint32_t i) {
+      found = linear_find(stacks, stacks[size - 1 - i % 4]);
+    });
+    printf("%8u %16.3f %16.3f\n", size, hit, linear);
+  }
+
+  printf("\n%s\n", ok ? "PASSED" : "FAILED");
+  return ok ? 0 : 1;
+}
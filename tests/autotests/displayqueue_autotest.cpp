@@ -0,0 +1,243 @@
+/*
+// Copyright (c) 2017 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+// Checks the order in which a DisplayQueue worker consumes frames and events
+// queued from several threads. One thread queues frames, each followed by a
+// marker event, as a display queueing a frame and then a mode change would;
+// the other threads queue events through the lock-free path. Every event
+// must be consumed once, each thread's events in the order it queued them; a
+// marker must come after its frame and before any later frame and carry its
+// frame as its effective frame; consumed frames and effective frames must
+// never go backwards, and the last frame must reach the display.
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "DisplayQueue.h"
+#include "gpudevice.h"
+
+using hwcomposer::Content;
+using hwcomposer::DisplayQueue;
+using hwcomposer::GpuDevice;
+
+// Event ids: the producer in the top byte, its sequence number below.
+// Producer 0 is the frame thread; its sequence number is the frame's.
+static const uint32_t kProducerShift = 24;
+static const uint32_t kSequenceMask = (1 << kProducerShift) - 1;
+
+struct Consumed {
+  bool frame;
+  uint32_t id;         // Frame index or event id.
+  uint32_t effective;  // Effective frame index.
+};
+
+class TestQueue : public DisplayQueue {
+ public:
+  TestQueue() : DisplayQueue(0), mConsumedEvents(0) {
+    init(HWCString("DisplayQueueTest"));
+  }
+
+  ~TestQueue() {
+    stopWorker();
+  }
+
+  bool available() override {
+    return true;
+  }
+
+  void syncFlip() override {
+  }
+
+  GpuDevice& getGpuDevice() override {
+    return mDevice;
+  }
+
+  // Runs on the worker thread only.
+  void consumeWork(WorkItem* pWork) override {
+    Consumed consumed;
+    consumed.frame = pWork->getWorkItemType() == WorkItem::WORK_ITEM_FRAME;
+    consumed.effective = pWork->getEffectiveFrame().getHwcIndex();
+    if (consumed.frame) {
+      Frame* pFrame = static_cast<Frame*>(pWork);
+      consumed.id = pFrame->getFrameId().getHwcIndex();
+      // The flip completes at once.
+      releaseFrame(pFrame);
+    } else {
+      consumed.id = static_cast<Event*>(pWork)->getId();
+    }
+    {
+      std::lock_guard<std::mutex> lock(mLockConsumed);
+      mConsumed.push_back(consumed);
+    }
+    if (!consumed.frame)
+      mConsumedEvents++;
+  }
+
+  uint32_t getConsumedEvents() const {
+    return mConsumedEvents.load();
+  }
+
+  uint32_t getPending() {
+    return getQueuedWork();
+  }
+
+  std::vector<Consumed> getConsumed() {
+    std::lock_guard<std::mutex> lock(mLockConsumed);
+    return mConsumed;
+  }
+
+ private:
+  GpuDevice mDevice;
+  std::mutex mLockConsumed;
+  std::vector<Consumed> mConsumed;
+  std::atomic<uint32_t> mConsumedEvents;
+};
+
+static bool check(const char* name, bool ok) {
+  printf("%s: %s\n", ok ? "ok" : "FAIL", name);
+  return ok;
+}
+
+static bool run(uint32_t producers, uint32_t frames, uint32_t events) {
+  TestQueue queue;
+  const Content::LayerStack stack;
+  const DisplayQueue::Frame::Config config;
+
+  // Producer 0 queues the frames and their markers.
+  std::vector<std::thread> threads;
+  threads.emplace_back([&]() {
+    for (uint32_t f = 1; f <= frames; f++) {
+      queue.queueFrame(stack, 0, DisplayQueue::FrameId(f, f, 0), config);
+      queue.queueEvent(new DisplayQueue::Event(f));
+      if ((f % 16) == 0)
+        std::this_thread::yield();
+    }
+  });
+  for (uint32_t p = 1; p <= producers; p++) {
+    threads.emplace_back([&, p]() {
+      for (uint32_t e = 0; e < events; e++)
+        queue.queueEvent(new DisplayQueue::Event((p << kProducerShift) | e));
+    });
+  }
+  for (std::thread& thread : threads)
+    thread.join();
+
+  const uint32_t total = frames + producers * events;
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  while ((queue.getConsumedEvents() < total || queue.getPending()) &&
+         std::chrono::steady_clock::now() < deadline)
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  const std::vector<Consumed> consumed = queue.getConsumed();
+
+  bool ok = check("all events consumed", queue.getConsumedEvents() == total &&
+                                             queue.getPending() == 0);
+
+  std::vector<uint32_t> next(producers + 1, 0);
+  next[0] = 1;
+  uint32_t bad_order = 0, bad_markers = 0, backwards = 0;
+  uint32_t last_frame = 0, last_effective = 0, frames_consumed = 0;
+  for (const Consumed& item : consumed) {
+    if (item.effective < last_effective)
+      backwards++;
+    last_effective = item.effective;
+
+    if (item.frame) {
+      // A frame may be dropped, but never consumed out of order, and never
+      // before the marker queued ahead of it.
+      if (item.id <= last_frame)
+        backwards++;
+      if (item.id != next[0] && bad_markers++ < 5)
+        printf("frame %u consumed after marker %u\n", item.id, next[0] - 1);
+      last_frame = item.id;
+      frames_consumed++;
+      continue;
+    }
+
+    const uint32_t producer = item.id >> kProducerShift;
+    const uint32_t sequence = item.id & kSequenceMask;
+    if (producer > producers || sequence != next[producer]) {
+      if (bad_order++ < 5)
+        printf("producer %u event %u, expected %u\n", producer, sequence,
+               producer <= producers ? next[producer] : 0);
+      continue;
+    }
+    next[producer]++;
+    if (producer == 0 &&
+        (item.effective != sequence || last_frame > sequence)) {
+      if (bad_markers++ < 5)
+        printf("marker %u consumed after frame %u with effective frame %u\n",
+               sequence, last_frame, item.effective);
+    }
+  }
+
+  ok = check("each producer's events in order", bad_order == 0) && ok;
+  ok = check("markers between their frame and the next", bad_markers == 0) &&
+       ok;
+  ok = check("frames and effective frames never go backwards",
+             backwards == 0) &&
+       ok;
+  ok = check("last frame displayed", last_frame == frames) && ok;
+  printf("%u frames queued, %u displayed, %u events from %u threads\n", frames,
+         frames_consumed, total, producers + 1);
+  return ok;
+}
+
+static void usage(const char* name) {
+  printf(
+      "usage: %s [-p producers] [-f frames] [-n events per producer]\n"
+      "  -p  threads queueing events besides the frame thread (3)\n"
+      "  -f  frames queued (5000)\n"
+      "  -n  events queued by each of the other threads (5000)\n",
+      name);
+}
+
+int main(int argc, char* argv[]) {
+  uint32_t producers = 3;
+  uint32_t frames = 5000;
+  uint32_t events = 5000;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "p:f:n:h")) != -1) {
+    switch (opt) {
+      case 'p':
+        producers = std::min(std::max(1, atoi(optarg)), 127);
+        break;
+      case 'f':
+        frames = std::max(1, atoi(optarg));
+        break;
+      case 'n':
+        events = std::max(1, atoi(optarg));
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+
+  bool ok = run(producers, frames, events);
+
+  printf("\n%s\n", ok ? "PASSED" : "FAILED");
+  return ok ? 0 : 1;
+}
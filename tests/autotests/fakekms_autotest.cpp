@@ -0,0 +1,700 @@
+/*
+// Copyright (c) 2017 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+// Checks the fake KMS device through the libdrm calls the display stack
+// makes: the resources and properties it reports, modesets, TEST_ONLY
+// commits against the rejection rules, OUT_FENCE_PTR fences and page flip
+// events on the manual clock, vblanks on the realtime clock and hotplug.
+// Also measures the cost of a TEST_ONLY commit.
+
+#include <errno.h>
+#include <getopt.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <drm_fourcc.h>
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "fakekms.h"
+
+#ifndef DRM_MODE_ROTATE_90
+#define DRM_MODE_ROTATE_90 (1 << 1)
+#endif
+
+using hwcomposer::FakeKms;
+
+struct Device {
+  int fd = -1;
+  std::shared_ptr<FakeKms> kms;
+  std::vector<uint32_t> crtcs;
+  std::vector<uint32_t> connectors;
+  std::vector<uint32_t> planes;
+
+  ~Device() {
+    if (fd >= 0)
+      drmClose(fd);
+  }
+};
+
+static bool open_device(const char* spec, Device* device,
+                        const FakeKms::Rule& rule = FakeKms::Rule()) {
+  FakeKms::Config config;
+  if (!FakeKms::ParseConfig(spec, &config))
+    return false;
+  config.rule = rule;
+
+  FakeKms::Select(&config);
+  device->fd = drmOpen("i915", NULL);
+  FakeKms::Select(NULL);
+  device->kms = FakeKms::Get(device->fd);
+  if (!device->kms || drmSetClientCap(device->fd, DRM_CLIENT_CAP_ATOMIC, 1))
+    return false;
+
+  drmModeResPtr res = drmModeGetResources(device->fd);
+  device->crtcs.assign(res->crtcs, res->crtcs + res->count_crtcs);
+  device->connectors.assign(res->connectors,
+                            res->connectors + res->count_connectors);
+  drmModeFreeResources(res);
+
+  drmModePlaneResPtr planes = drmModeGetPlaneResources(device->fd);
+  device->planes.assign(planes->planes, planes->planes + planes->count_planes);
+  drmModeFreePlaneResources(planes);
+  return true;
+}
+
+// Looks up a property by name, the way DisplayQueue does.
+static uint32_t get_prop(int fd, uint32_t object, uint32_t type,
+                         const char* name, uint64_t* value = NULL) {
+  drmModeObjectPropertiesPtr props =
+      drmModeObjectGetProperties(fd, object, type);
+  uint32_t id = 0;
+  for (uint32_t i = 0; props && i < props->count_props && !id; i++) {
+    drmModePropertyPtr prop = drmModeGetProperty(fd, props->props[i]);
+    if (prop && !strcmp(prop->name, name)) {
+      id = prop->prop_id;
+      if (value)
+        *value = props->prop_values[i];
+    }
+    drmModeFreeProperty(prop);
+  }
+  drmModeFreeObjectProperties(props);
+  return id;
+}
+
+static uint32_t add_fb(int fd, uint32_t width, uint32_t height,
+                       uint32_t format) {
+  uint32_t handles[4] = {1, 0, 0, 0}, pitches[4] = {width * 4, 0, 0, 0};
+  uint32_t offsets[4] = {0, 0, 0, 0}, fb = 0;
+  drmModeAddFB2(fd, width, height, format, handles, pitches, offsets, &fb, 0);
+  return fb;
+}
+
+// A plane at (x, y), w x h on screen, showing an src_w x src_h fb.
+struct PlaneSetup {
+  uint32_t plane;
+  uint32_t fb;
+  int32_t x, y;
+  uint32_t w, h, src_w, src_h;
+  uint64_t rotation;
+};
+
+static void add_plane(int fd, drmModeAtomicReqPtr req, uint32_t crtc,
+                      const PlaneSetup& p) {
+  const uint32_t type = DRM_MODE_OBJECT_PLANE;
+  drmModeAtomicAddProperty(req, p.plane, get_prop(fd, p.plane, type, "FB_ID"),
+                           p.fb);
+  drmModeAtomicAddProperty(req, p.plane,
+                           get_prop(fd, p.plane, type, "CRTC_ID"),
+                           p.fb ? crtc : 0);
+  drmModeAtomicAddProperty(req, p.plane, get_prop(fd, p.plane, type, "CRTC_X"),
+                           p.x);
+  drmModeAtomicAddProperty(req, p.plane, get_prop(fd, p.plane, type, "CRTC_Y"),
+                           p.y);
+  drmModeAtomicAddProperty(req, p.plane, get_prop(fd, p.plane, type, "CRTC_W"),
+                           p.w);
+  drmModeAtomicAddProperty(req, p.plane, get_prop(fd, p.plane, type, "CRTC_H"),
+                           p.h);
+  drmModeAtomicAddProperty(req, p.plane, get_prop(fd, p.plane, type, "SRC_X"),
+                           0);
+  drmModeAtomicAddProperty(req, p.plane, get_prop(fd, p.plane, type, "SRC_Y"),
+                           0);
+  drmModeAtomicAddProperty(req, p.plane, get_prop(fd, p.plane, type, "SRC_W"),
+                           uint64_t(p.src_w) << 16);
+  drmModeAtomicAddProperty(req, p.plane, get_prop(fd, p.plane, type, "SRC_H"),
+                           uint64_t(p.src_h) << 16);
+  drmModeAtomicAddProperty(req, p.plane,
+                           get_prop(fd, p.plane, type, "rotation"),
+                           p.rotation ? p.rotation : 1);
+}
+
+// Lights up pipe 0 with its preferred mode and a full screen primary plane.
+static int modeset(Device* device, uint32_t flags) {
+  const int fd = device->fd;
+  const uint32_t crtc = device->crtcs[0], connector = device->connectors[0];
+  drmModeConnectorPtr conn = drmModeGetConnector(fd, connector);
+  drmModeModeInfo mode = conn->modes[0];
+  drmModeFreeConnector(conn);
+
+  uint32_t blob = 0;
+  drmModeCreatePropertyBlob(fd, &mode, sizeof(mode), &blob);
+  drmModeAtomicReqPtr req = drmModeAtomicAlloc();
+  drmModeAtomicAddProperty(
+      req, connector,
+      get_prop(fd, connector, DRM_MODE_OBJECT_CONNECTOR, "CRTC_ID"), crtc);
+  drmModeAtomicAddProperty(
+      req, crtc, get_prop(fd, crtc, DRM_MODE_OBJECT_CRTC, "ACTIVE"), 1);
+  drmModeAtomicAddProperty(
+      req, crtc, get_prop(fd, crtc, DRM_MODE_OBJECT_CRTC, "MODE_ID"), blob);
+  uint32_t fb = add_fb(fd, mode.hdisplay, mode.vdisplay, DRM_FORMAT_XRGB8888);
+  add_plane(fd, req, crtc,
+            {device->planes[0], fb, 0, 0, mode.hdisplay, mode.vdisplay,
+             mode.hdisplay, mode.vdisplay, 0});
+  int ret = drmModeAtomicCommit(fd, req, flags, NULL);
+  drmModeAtomicFree(req);
+  return ret;
+}
+
+static bool is_readable(int fd) {
+  struct pollfd p = {fd, POLLIN, 0};
+  return poll(&p, 1, 0) > 0;
+}
+
+static bool check(const char* name, const char* what, bool ok) {
+  if (!ok)
+    printf("%s: %s\n", name, what);
+  return ok;
+}
+
+static bool test_resources() {
+  const char* name = "resources";
+  Device device;
+  bool ok = check(name, "open",
+                  open_device("pipes=2,overlays=2,mode=1280x720@50", &device));
+  if (!ok) {
+    printf("%-28s FAILED\n", name);
+    return false;
+  }
+
+  const int fd = device.fd;
+  ok = check(name, "crtcs", device.crtcs.size() == 2) && ok;
+  ok = check(name, "connectors", device.connectors.size() == 2) && ok;
+  ok = check(name, "planes", device.planes.size() == 8) && ok;
+
+  drmModeConnectorPtr conn = drmModeGetConnector(fd, device.connectors[1]);
+  ok = check(name, "connected", conn->connection == DRM_MODE_CONNECTED) && ok;
+  ok = check(name, "mode", conn->count_modes == 1 &&
+                               conn->modes[0].hdisplay == 1280 &&
+                               conn->modes[0].vdisplay == 720 &&
+                               conn->modes[0].vrefresh == 50) &&
+       ok;
+  drmModeEncoderPtr encoder = drmModeGetEncoder(fd, conn->encoders[0]);
+  ok = check(name, "encoder", encoder->possible_crtcs == 2) && ok;
+  drmModeFreeEncoder(encoder);
+  drmModeFreeConnector(conn);
+
+  // Broadcast RGB as DisplayQueue reads it.
+  drmModePropertyPtr rgb = drmModeGetProperty(
+      fd, get_prop(fd, device.connectors[0], DRM_MODE_OBJECT_CONNECTOR,
+                   "Broadcast RGB"));
+  bool full = false;
+  for (int i = 0; rgb && i < rgb->count_enums; i++)
+    full |= !strcmp(rgb->enums[i].name, "Full");
+  ok = check(name, "Broadcast RGB", full) && ok;
+  drmModeFreeProperty(rgb);
+
+  // Plane types per pipe: primary, overlays, cursor.
+  const uint64_t types[] = {DRM_PLANE_TYPE_PRIMARY, DRM_PLANE_TYPE_OVERLAY,
+                            DRM_PLANE_TYPE_OVERLAY, DRM_PLANE_TYPE_CURSOR};
+  for (size_t i = 0; i < device.planes.size(); i++) {
+    uint64_t type = ~0ULL;
+    get_prop(fd, device.planes[i], DRM_MODE_OBJECT_PLANE, "type", &type);
+    ok = check(name, "plane type", type == types[i % 4]) && ok;
+    drmModePlanePtr plane = drmModeGetPlane(fd, device.planes[i]);
+    ok = check(name, "possible crtcs", plane->possible_crtcs == 1u << i / 4) &&
+         ok;
+    drmModeFreePlane(plane);
+  }
+
+  // IN_FORMATS of an overlay lists NV12 with the Y tiled modifier.
+  uint64_t blob_id = 0;
+  get_prop(fd, device.planes[1], DRM_MODE_OBJECT_PLANE, "IN_FORMATS",
+           &blob_id);
+  drmModePropertyBlobPtr blob = drmModeGetPropertyBlob(fd, blob_id);
+  ok = check(name, "IN_FORMATS", blob != NULL) && ok;
+  if (blob) {
+    const uint8_t* data = static_cast<const uint8_t*>(blob->data);
+    const uint32_t* header = reinterpret_cast<const uint32_t*>(data);
+    const uint32_t* formats =
+        reinterpret_cast<const uint32_t*>(data + header[3]);
+    int nv12 = -1;
+    for (uint32_t i = 0; i < header[2]; i++) {
+      if (formats[i] == DRM_FORMAT_NV12)
+        nv12 = i;
+    }
+    bool y_tiled = false;
+    for (uint32_t i = 0; nv12 >= 0 && i < header[4]; i++) {
+      const uint8_t* mod = data + header[5] + i * 24;
+      uint64_t mask, modifier;
+      memcpy(&mask, mod, sizeof(mask));
+      memcpy(&modifier, mod + 16, sizeof(modifier));
+      y_tiled |= modifier == ((1ULL << 56) | 2) && (mask >> nv12 & 1);
+    }
+    ok = check(name, "IN_FORMATS NV12 Y tiled", y_tiled) && ok;
+    drmModeFreePropertyBlob(blob);
+  }
+
+  printf("%-28s %s\n", name, ok ? "ok    " : "FAILED");
+  return ok;
+}
+
+static bool test_modeset() {
+  const char* name = "modeset";
+  Device device;
+  bool ok = check(name, "open", open_device("clock=manual", &device));
+  if (!ok) {
+    printf("%-28s FAILED\n", name);
+    return false;
+  }
+
+  ok = check(name, "without ALLOW_MODESET", modeset(&device, 0) == -EINVAL) &&
+       ok;
+  drmModeCrtcPtr crtc = drmModeGetCrtc(device.fd, device.crtcs[0]);
+  ok = check(name, "inactive", !crtc->mode_valid) && ok;
+  drmModeFreeCrtc(crtc);
+
+  ok = check(name, "commit",
+             modeset(&device, DRM_MODE_ATOMIC_ALLOW_MODESET) == 0) &&
+       ok;
+  crtc = drmModeGetCrtc(device.fd, device.crtcs[0]);
+  ok = check(name, "active", crtc->mode_valid && crtc->width == 1920 &&
+                                 crtc->buffer_id != 0) &&
+       ok;
+  drmModeFreeCrtc(crtc);
+
+  // Legacy properties only.
+  uint32_t dpms = get_prop(device.fd, device.connectors[0],
+                           DRM_MODE_OBJECT_CONNECTOR, "DPMS");
+  ok = check(name, "DPMS", !drmModeConnectorSetProperty(
+                               device.fd, device.connectors[0], dpms,
+                               DRM_MODE_DPMS_ON)) &&
+       ok;
+  uint32_t active = get_prop(device.fd, device.crtcs[0],
+                             DRM_MODE_OBJECT_CRTC, "ACTIVE");
+  ok = check(name, "legacy ACTIVE",
+             drmModeObjectSetProperty(device.fd, device.crtcs[0],
+                                      DRM_MODE_OBJECT_CRTC, active, 0) != 0) &&
+       ok;
+
+  FakeKms::Stats stats = device.kms->GetStats();
+  ok = check(name, "stats", stats.commits == 2 && stats.rejected == 1) && ok;
+  printf("%-28s %s\n", name, ok ? "ok    " : "FAILED");
+  return ok;
+}
+
+// Commits the primary plane and an overlay with TEST_ONLY.
+static int test_overlay(Device* device, const PlaneSetup& overlay) {
+  drmModeAtomicReqPtr req = drmModeAtomicAlloc();
+  add_plane(device->fd, req, device->crtcs[0], overlay);
+  int ret = drmModeAtomicCommit(device->fd, req, DRM_MODE_ATOMIC_TEST_ONLY,
+                                NULL);
+  drmModeAtomicFree(req);
+  return ret;
+}
+
+// A custom rule: no plane may start left of the screen.
+static bool off_left_edge(const std::vector<FakeKms::PlaneState>& planes) {
+  for (const FakeKms::PlaneState& p : planes) {
+    if (p.crtc_x < 0)
+      return true;
+  }
+  return false;
+}
+
+static bool test_rules() {
+  const char* name = "test only";
+  Device device;
+  bool ok = check(name, "open",
+                  open_device("clock=manual,reject-scaling,reject-rotation,"
+                              "max-planes=2",
+                              &device, off_left_edge));
+  ok = ok && check(name, "modeset",
+                   !modeset(&device, DRM_MODE_ATOMIC_ALLOW_MODESET));
+  if (!ok) {
+    printf("%-28s FAILED\n", name);
+    return false;
+  }
+
+  const int fd = device.fd;
+  uint32_t fb = add_fb(fd, 256, 256, DRM_FORMAT_ARGB8888);
+  uint32_t nv12 = add_fb(fd, 256, 256, DRM_FORMAT_NV12);
+  uint32_t overlay = device.planes[1], overlay2 = device.planes[2];
+  uint32_t cursor = device.planes[4];
+
+  ok = check(name, "overlay",
+             !test_overlay(&device, {overlay, fb, 8, 8, 256, 256, 256, 256,
+                                     0})) &&
+       ok;
+  ok = check(name, "scaling",
+             test_overlay(&device, {overlay, fb, 8, 8, 512, 512, 256, 256,
+                                    0}) == -EINVAL) &&
+       ok;
+  ok = check(name, "rotation",
+             test_overlay(&device, {overlay, fb, 8, 8, 256, 256, 256, 256,
+                                    DRM_MODE_ROTATE_90}) == -EINVAL) &&
+       ok;
+  ok = check(name, "custom rule",
+             test_overlay(&device, {overlay, fb, -8, 8, 256, 256, 256, 256,
+                                    0}) == -EINVAL) &&
+       ok;
+  ok = check(name, "source outside fb",
+             test_overlay(&device, {overlay, fb, 8, 8, 512, 512, 512, 512,
+                                    0}) == -ENOSPC) &&
+       ok;
+  ok = check(name, "cursor NV12",
+             test_overlay(&device, {cursor, nv12, 8, 8, 256, 256, 256, 256,
+                                    0}) == -EINVAL) &&
+       ok;
+  ok = check(name, "overlay NV12",
+             !test_overlay(&device, {overlay, nv12, 8, 8, 256, 256, 256, 256,
+                                     0})) &&
+       ok;
+
+  // Primary and two overlays are over max-planes.
+  drmModeAtomicReqPtr req = drmModeAtomicAlloc();
+  add_plane(fd, req, device.crtcs[0],
+            {overlay, fb, 8, 8, 256, 256, 256, 256, 0});
+  add_plane(fd, req, device.crtcs[0],
+            {overlay2, fb, 8, 8, 256, 256, 256, 256, 0});
+  ok = check(name, "max planes",
+             drmModeAtomicCommit(fd, req, DRM_MODE_ATOMIC_TEST_ONLY, NULL) ==
+                 -EINVAL) &&
+       ok;
+  drmModeAtomicFree(req);
+
+  // Nothing a TEST_ONLY commit does sticks.
+  uint64_t fb_id = 1;
+  get_prop(fd, overlay, DRM_MODE_OBJECT_PLANE, "FB_ID", &fb_id);
+  ok = check(name, "state unchanged", fb_id == 0) && ok;
+
+  FakeKms::Stats stats = device.kms->GetStats();
+  ok = check(name, "stats", stats.test_commits == 8 && stats.rejected == 6 &&
+                                stats.commits == 1) &&
+       ok;
+  printf("%-28s %s\n", name, ok ? "ok    " : "FAILED");
+  return ok;
+}
+
+static bool test_fail_every() {
+  const char* name = "fail every";
+  Device device;
+  bool ok = check(name, "open",
+                  open_device("clock=manual,fail-every=3", &device));
+  ok = ok && check(name, "modeset",
+                   !modeset(&device, DRM_MODE_ATOMIC_ALLOW_MODESET));
+  if (!ok) {
+    printf("%-28s FAILED\n", name);
+    return false;
+  }
+
+  uint32_t fb = add_fb(device.fd, 64, 64, DRM_FORMAT_ARGB8888);
+  std::string results;
+  for (int i = 0; i < 6; i++)
+    results += test_overlay(&device, {device.planes[1], fb, 0, 0, 64, 64, 64,
+                                      64, 0})
+                   ? 'x'
+                   : '.';
+  ok = check(name, results.c_str(), results == "..x..x") && ok;
+  printf("%-28s %s\n", name, ok ? "ok    " : "FAILED");
+  return ok;
+}
+
+struct Events {
+  int flips = 0;
+  int vblanks = 0;
+  unsigned sequence = 0;
+};
+
+static void on_flip(int, unsigned sequence, unsigned, unsigned,
+                    void* user_data) {
+  Events* events = static_cast<Events*>(user_data);
+  events->flips++;
+  events->sequence = sequence;
+}
+
+static void on_vblank(int, unsigned sequence, unsigned, unsigned,
+                      void* user_data) {
+  Events* events = static_cast<Events*>(user_data);
+  events->vblanks++;
+  events->sequence = sequence;
+}
+
+static int handle_events(int fd) {
+  drmEventContext context;
+  memset(&context, 0, sizeof(context));
+  context.version = 2;
+  context.vblank_handler = on_vblank;
+  context.page_flip_handler = on_flip;
+  return drmHandleEvent(fd, &context);
+}
+
+static bool test_flips() {
+  const char* name = "flips";
+  Device device;
+  bool ok = check(name, "open", open_device("clock=manual", &device));
+  ok = ok && check(name, "modeset",
+                   !modeset(&device, DRM_MODE_ATOMIC_ALLOW_MODESET));
+  if (!ok) {
+    printf("%-28s FAILED\n", name);
+    return false;
+  }
+
+  const int fd = device.fd;
+  const uint32_t crtc = device.crtcs[0];
+  uint32_t out_fence_ptr =
+      get_prop(fd, crtc, DRM_MODE_OBJECT_CRTC, "OUT_FENCE_PTR");
+  uint32_t in_fence_fd = get_prop(fd, device.planes[1],
+                                  DRM_MODE_OBJECT_PLANE, "IN_FENCE_FD");
+  uint32_t fb = add_fb(fd, 64, 64, DRM_FORMAT_ARGB8888);
+
+  // The overlay waits for a buffer that is not ready yet.
+  int buffer[2];
+  socketpair(AF_UNIX, SOCK_STREAM, 0, buffer);
+  int32_t out_fence = -1;
+  Events events;
+  drmModeAtomicReqPtr req = drmModeAtomicAlloc();
+  add_plane(fd, req, crtc, {device.planes[1], fb, 0, 0, 64, 64, 64, 64, 0});
+  drmModeAtomicAddProperty(req, device.planes[1], in_fence_fd, buffer[0]);
+  drmModeAtomicAddProperty(req, crtc, out_fence_ptr,
+                           reinterpret_cast<uintptr_t>(&out_fence));
+  int ret = drmModeAtomicCommit(
+      fd, req, DRM_MODE_ATOMIC_NONBLOCK | DRM_MODE_PAGE_FLIP_EVENT, &events);
+  ok = check(name, "commit", !ret && out_fence >= 0) && ok;
+  ok = check(name, "pending", !is_readable(out_fence)) && ok;
+  ok = check(name, "busy", drmModeAtomicCommit(fd, req,
+                                               DRM_MODE_ATOMIC_NONBLOCK,
+                                               NULL) == -EBUSY) &&
+       ok;
+  drmModeAtomicFree(req);
+
+  device.kms->Vblank(0);
+  ok = check(name, "waits for buffer", !is_readable(out_fence)) && ok;
+
+  char c = 0;
+  write(buffer[1], &c, 1);
+  device.kms->Vblank(0);
+  ok = check(name, "signalled", is_readable(out_fence)) && ok;
+  ok = check(name, "event", is_readable(fd) && !handle_events(fd) &&
+                                events.flips == 1 && events.sequence == 2) &&
+       ok;
+  close(out_fence);
+  close(buffer[0]);
+  close(buffer[1]);
+
+  // A vblank event two vblanks from now.
+  drmVBlank vblank;
+  memset(&vblank, 0, sizeof(vblank));
+  vblank.request.type =
+      static_cast<drmVBlankSeqType>(DRM_VBLANK_RELATIVE | DRM_VBLANK_EVENT);
+  vblank.request.sequence = 2;
+  vblank.request.signal = reinterpret_cast<unsigned long>(&events);
+  ok = check(name, "vblank request", !drmWaitVBlank(fd, &vblank)) && ok;
+  device.kms->Vblank(0);
+  ok = check(name, "vblank early", !is_readable(fd)) && ok;
+  device.kms->Vblank(0);
+  ok = check(name, "vblank event", is_readable(fd) && !handle_events(fd) &&
+                                       events.vblanks == 1 &&
+                                       events.sequence == 4) &&
+       ok;
+
+  // Pipe 1 does not exist.
+  vblank.request.type = static_cast<drmVBlankSeqType>(
+      DRM_VBLANK_RELATIVE | (1 << DRM_VBLANK_HIGH_CRTC_SHIFT));
+  ok = check(name, "no pipe", drmWaitVBlank(fd, &vblank) == -1 &&
+                                  errno == EINVAL) &&
+       ok;
+
+  FakeKms::Stats stats = device.kms->GetStats();
+  ok = check(name, "stats", stats.flips == 2 && stats.vblanks == 4) && ok;
+  printf("%-28s %s\n", name, ok ? "ok    " : "FAILED");
+  return ok;
+}
+
+// Blocking vblank waits follow the refresh rate of the mode.
+static bool test_realtime() {
+  const char* name = "realtime";
+  Device device;
+  bool ok = check(name, "open", open_device("mode=640x480@100", &device));
+  ok = ok && check(name, "modeset",
+                   !modeset(&device, DRM_MODE_ATOMIC_ALLOW_MODESET));
+  if (!ok) {
+    printf("%-28s FAILED\n", name);
+    return false;
+  }
+
+  const int kVblanks = 10;
+  drmVBlank vblank;
+  int64_t first = 0, last = 0;
+  unsigned sequence = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i <= kVblanks && ok; i++) {
+    memset(&vblank, 0, sizeof(vblank));
+    vblank.request.type = DRM_VBLANK_RELATIVE;
+    vblank.request.sequence = 1;
+    ok = check(name, "wait", !drmWaitVBlank(device.fd, &vblank));
+    last = int64_t(vblank.reply.tval_sec) * 1000000 + vblank.reply.tval_usec;
+    if (!i) {
+      first = last;
+      sequence = vblank.reply.sequence;
+    }
+  }
+  std::chrono::duration<double, std::milli> elapsed =
+      std::chrono::steady_clock::now() - start;
+
+  // Timestamps are exact; the wall clock gets some slack.
+  double period = double(last - first) / kVblanks / 1000;
+  ok = check(name, "sequence", vblank.reply.sequence == sequence + kVblanks) &&
+       ok;
+  ok = check(name, "period", period > 9.9 && period < 10.1) && ok;
+  ok = check(name, "elapsed", elapsed.count() > 90 && elapsed.count() < 500) &&
+       ok;
+  printf("%-28s %s %.2f ms period\n", name, ok ? "ok    " : "FAILED", period);
+  return ok;
+}
+
+static bool test_hotplug() {
+  const char* name = "hotplug";
+  Device device;
+  bool ok = check(name, "open", open_device("pipes=2", &device));
+  if (!ok) {
+    printf("%-28s FAILED\n", name);
+    return false;
+  }
+
+  const int hotplug = device.kms->GetHotplugFd();
+  device.kms->SetConnected(1, false);
+  ok = check(name, "uevent", is_readable(hotplug)) && ok;
+
+  // The strings GpuDevice looks for.
+  char buffer[1024];
+  ssize_t size = recv(hotplug, buffer, sizeof(buffer) - 1, MSG_DONTWAIT);
+  bool drm_minor = false, hotplug_event = false;
+  for (ssize_t i = 0; i < size; i += strlen(buffer + i) + 1) {
+    drm_minor |= !strcmp(buffer + i, "DEVTYPE=drm_minor");
+    hotplug_event |= !strcmp(buffer + i, "HOTPLUG=1");
+  }
+  ok = check(name, "uevent contents", drm_minor && hotplug_event) && ok;
+
+  drmModeConnectorPtr conn = drmModeGetConnector(device.fd,
+                                                 device.connectors[1]);
+  ok = check(name, "disconnected",
+             conn->connection == DRM_MODE_DISCONNECTED && !conn->count_modes) &&
+       ok;
+  drmModeFreeConnector(conn);
+
+  // No change, no uevent.
+  device.kms->SetConnected(1, false);
+  ok = check(name, "no change", !is_readable(hotplug)) && ok;
+  device.kms->SetConnected(1, true);
+  ok = check(name, "reconnect", is_readable(hotplug)) && ok;
+  printf("%-28s %s\n", name, ok ? "ok    " : "FAILED");
+  return ok;
+}
+
+// The fd of a closed device is not mistaken for it after reuse, and a
+// reference taken before the close keeps the device alive.
+static bool test_close() {
+  const char* name = "close";
+  Device device;
+  bool ok = check(name, "open", open_device("1", &device));
+  ok = check(name, "real fd", FakeKms::Get(0) == NULL) && ok;
+  drmClose(device.fd);
+  ok = check(name, "closed", FakeKms::Get(device.fd) == NULL) && ok;
+  ok = check(name, "held", device.kms.use_count() == 1 &&
+                               device.kms->GetStats().commits == 0) &&
+       ok;
+  device.kms.reset();
+  device.fd = -1;
+  printf("%-28s %s\n", name, ok ? "ok    " : "FAILED");
+  return ok;
+}
+
+static void benchmark(uint32_t commits) {
+  Device device;
+  if (!open_device("clock=manual,overlays=3", &device) ||
+      modeset(&device, DRM_MODE_ATOMIC_ALLOW_MODESET)) {
+    printf("benchmark: failed to set up\n");
+    return;
+  }
+
+  uint32_t fb = add_fb(device.fd, 256, 256, DRM_FORMAT_ARGB8888);
+  drmModeAtomicReqPtr req = drmModeAtomicAlloc();
+  for (uint32_t i = 1; i <= 3; i++)
+    add_plane(device.fd, req, device.crtcs[0],
+              {device.planes[i], fb, int32_t(i * 64), 0, 256, 256, 256, 256,
+               0});
+
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < commits; i++)
+    drmModeAtomicCommit(device.fd, req, DRM_MODE_ATOMIC_TEST_ONLY, NULL);
+  std::chrono::duration<double, std::nano> elapsed =
+      std::chrono::steady_clock::now() - start;
+  drmModeAtomicFree(req);
+
+  printf("\n%u TEST_ONLY commits of 4 planes\n", commits);
+  printf("%-8s %16s\n", "planes", "ns/commit");
+  printf("%-8u %16.2f\n", 4, elapsed.count() / commits);
+}
+
+static void usage(const char* name) {
+  printf("usage: %s [-n benchmark commits]\n", name);
+}
+
+int main(int argc, char* argv[]) {
+  uint32_t commits = 100000;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:h")) != -1) {
+    switch (opt) {
+      case 'n':
+        commits = atoi(optarg) > 0 ? atoi(optarg) : 1;
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+
+  bool ok = test_resources();
+  ok = test_modeset() && ok;
+  ok = test_rules() && ok;
+  ok = test_fail_every() && ok;
+  ok = test_flips() && ok;
+  ok = test_realtime() && ok;
+  ok = test_hotplug() && ok;
+  ok = test_close() && ok;
+  benchmark(commits);
+
+  printf("\n%s\n", ok ? "PASSED" : "FAILED");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,410 @@
+/*
+// Copyright (c) 2017 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+// Fence tests using sw_sync timelines (requires sw_sync in debugfs).
+//  merge: chains Timeline::mergeFence over 2-16 input fences, as layers
+//         merge release fences, with none and with half of them already
+//         signalled, and reports merge time. Signalled inputs are closed
+//         rather than merged, so the merged fence must still block on the
+//         others and no input may be left open.
+//  waiter: signals sw_sync timelines out of order and checks that FenceWaiter
+//          and FenceWaiter::WaitAll dispatch each fence in signal order, and
+//          that a fence which never signals times out.
+//  waitany: signals one of several fences at controlled times and compares
+//           how soon Timeline::waitAny wakes with the 10ms sleep-poll that
+//           BufferQueue used to wait for a release, and checks the timeout.
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <fencewaiter.h>
+#include <timeline.h>
+
+using hwcomposer::FenceWaiter;
+
+using hwcomposer::Timeline;
+
+static const uint32_t kIterations = 200;
+
+static int64_t now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+static int count_open_fds() {
+  int count = 0;
+  DIR *dir = opendir("/proc/self/fd");
+  if (!dir)
+    return -1;
+  while (readdir(dir))
+    count++;
+  closedir(dir);
+  return count;
+}
+
+// One sw_sync timeline per input fence, as with layers from different producers.
+class FenceSet {
+ public:
+  explicit FenceSet(uint32_t count) {
+    for (uint32_t i = 0; i < count; ++i) {
+      timelines_.emplace_back(new Timeline());
+      timelines_.back()->init(HWCString::format("fence_autotest%u", i));
+    }
+  }
+
+  // Create one fence per timeline.
+  bool Create(std::vector<int> &fences) {
+    fences.clear();
+    for (size_t i = 0; i < timelines_.size(); ++i) {
+      uint32_t index;
+      int fence = timelines_[i]->createFence(&index);
+      if (fence < 0)
+        return false;
+      fences.push_back(fence);
+    }
+    return true;
+  }
+
+  // Signal every other fence.
+  void SignalHalf() {
+    for (size_t i = 0; i < timelines_.size(); i += 2)
+      timelines_[i]->advance();
+  }
+
+  void Signal(uint32_t index) {
+    timelines_[index]->advance();
+  }
+
+  void SignalAll() {
+    for (auto &timeline : timelines_)
+      timeline->advanceTo(timeline->getFutureTime() - 1);
+  }
+
+ private:
+  std::vector<std::unique_ptr<Timeline>> timelines_;
+};
+
+// Chain mergeFence over one fence per timeline of set, signalling every other
+// input first if signal_half. Returns the time taken in ns, or -1 on failure.
+static int64_t merge_chain(FenceSet &set, uint32_t n, bool signal_half,
+                           bool &ok) {
+  std::vector<int> fences;
+  if (!set.Create(fences)) {
+    printf("failed to create sw_sync fences\n");
+    return -1;
+  }
+  if (signal_half)
+    set.SignalHalf();
+
+  int merged = -1;
+  int64_t start = now_ns();
+  for (uint32_t i = 0; i < n; ++i) {
+    if (!Timeline::mergeFence(&merged, &fences[i])) {
+      printf("mergeFence failed for input %u of %u\n", i, n);
+      ok = false;
+    }
+  }
+  int64_t elapsed = now_ns() - start;
+
+  // At least one input is still blocking so the result must block too.
+  if (Timeline::check(&merged)) {
+    printf("merged fence of %u inputs signalled early\n", n);
+    ok = false;
+  }
+  set.SignalAll();
+  if (!Timeline::waitAndClose(&merged, 1000)) {
+    printf("merged fence of %u inputs did not signal\n", n);
+    ok = false;
+  }
+  for (int fence : fences) {
+    if (fence != -1) {
+      printf("input fence left open\n");
+      ok = false;
+    }
+  }
+  return elapsed;
+}
+
+static bool test_merge() {
+  bool ok = true;
+  printf("fences  blocking(us)  half signalled(us)\n");
+  for (uint32_t n = 2; n <= 16; ++n) {
+    FenceSet set(n);
+    int64_t blocking_ns = 0, half_ns = 0;
+    int fds_before = count_open_fds();
+
+    for (uint32_t it = 0; it < kIterations; ++it) {
+      int64_t ns = merge_chain(set, n, false, ok);
+      if (ns < 0)
+        return false;
+      blocking_ns += ns;
+      ns = merge_chain(set, n, true, ok);
+      if (ns < 0)
+        return false;
+      half_ns += ns;
+    }
+
+    int fds_after = count_open_fds();
+    if (fds_after != fds_before) {
+      printf("fd leak: %d before, %d after\n", fds_before, fds_after);
+      ok = false;
+    }
+
+    printf("%6u  %12.2f  %18.2f\n", n, blocking_ns / 1000.0 / kIterations,
+           half_ns / 1000.0 / kIterations);
+  }
+  return ok;
+}
+
+// Signal order used by the waiter tests: neither the order fences were
+// added in nor its reverse.
+static const uint32_t kSignalOrder[] = {5, 2, 7, 0, 3, 6, 1, 4};
+static const uint32_t kWaiterFences =
+    sizeof(kSignalOrder) / sizeof(kSignalOrder[0]);
+
+static bool check_order(const char *name, const std::vector<uint32_t> &order) {
+  bool ok = order.size() == kWaiterFences &&
+            std::equal(order.begin(), order.end(), kSignalOrder);
+  if (!ok) {
+    printf("%s: dispatch order", name);
+    for (uint32_t index : order)
+      printf(" %u", index);
+    printf(" does not match signal order\n");
+  }
+  return ok;
+}
+
+static bool test_waiter() {
+  bool ok = true;
+  FenceSet set(kWaiterFences);
+  std::vector<int> fences;
+  int fds_before = count_open_fds();
+
+  // Asynchronous dispatch on the waiter thread.
+  {
+    FenceWaiter waiter(0, "fence_autotest");
+    if (!waiter.Initialize()) {
+      printf("waiter: failed to initialize\n");
+      return false;
+    }
+    if (!set.Create(fences))
+      return false;
+
+    std::mutex lock;
+    std::condition_variable cond;
+    std::vector<uint32_t> order;
+    uint32_t timed_out = 0;
+    for (uint32_t i = 0; i < kWaiterFences; ++i) {
+      waiter.Add(fences[i], 5000, [&, i](bool signalled) {
+        std::lock_guard<std::mutex> guard(lock);
+        if (signalled)
+          order.push_back(i);
+        else
+          timed_out++;
+        cond.notify_all();
+      });
+    }
+
+    for (uint32_t i = 0; i < kWaiterFences; ++i) {
+      set.Signal(kSignalOrder[i]);
+      // Each callback must arrive before the next fence signals.
+      std::unique_lock<std::mutex> guard(lock);
+      if (!cond.wait_for(guard, std::chrono::seconds(1),
+                         [&] { return order.size() + timed_out > i; })) {
+        printf("waiter: no callback for fence %u\n", kSignalOrder[i]);
+        ok = false;
+        break;
+      }
+    }
+    if (timed_out) {
+      printf("waiter: %u fences timed out\n", timed_out);
+      ok = false;
+    }
+    std::lock_guard<std::mutex> guard(lock);
+    ok = check_order("waiter", order) && ok;
+  }
+
+  // A fence that never signals must time out.
+  {
+    FenceWaiter waiter(0, "fence_autotest");
+    if (!waiter.Initialize())
+      return false;
+    FenceSet unsignalled(1);
+    if (!unsignalled.Create(fences))
+      return false;
+
+    std::mutex lock;
+    std::condition_variable cond;
+    int result = -1;
+    int64_t start = now_ns();
+    waiter.Add(fences[0], 50, [&](bool signalled) {
+      std::lock_guard<std::mutex> guard(lock);
+      result = signalled;
+      cond.notify_all();
+    });
+    std::unique_lock<std::mutex> guard(lock);
+    cond.wait_for(guard, std::chrono::seconds(1), [&] { return result >= 0; });
+    int64_t elapsed_ms = (now_ns() - start) / 1000000;
+    if (result != 0 || elapsed_ms < 50) {
+      printf("waiter: timeout result %d after %lld ms\n", result,
+             (long long)elapsed_ms);
+      ok = false;
+    }
+    unsignalled.SignalAll();
+  }
+
+  // Synchronous WaitAll with a signalling thread.
+  {
+    if (!set.Create(fences))
+      return false;
+    std::vector<uint32_t> order;
+    std::thread signaller([&set]() {
+      for (uint32_t i = 0; i < kWaiterFences; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        set.Signal(kSignalOrder[i]);
+      }
+    });
+    size_t signalled = FenceWaiter::WaitAll(
+        fences.data(), fences.size(), 5000,
+        [&order](size_t index) { order.push_back(index); });
+    signaller.join();
+    if (signalled != kWaiterFences) {
+      printf("WaitAll: %zu of %u fences signalled\n", signalled,
+             kWaiterFences);
+      ok = false;
+    }
+    ok = check_order("WaitAll", order) && ok;
+    for (int &fence : fences)
+      Timeline::closeFence(&fence);
+  }
+
+  int fds_after = count_open_fds();
+  if (fds_after != fds_before) {
+    printf("waiter: fd leak: %d before, %d after\n", fds_before, fds_after);
+    ok = false;
+  }
+  return ok;
+}
+
+// Delays after which one of the fences is signalled, as a render target
+// released at different points within a frame.
+static const uint32_t kSignalDelaysUs[] = {500, 1000, 3000, 7000, 15000};
+static const uint32_t kWaitFences = 4;
+static const uint32_t kWaitIterations = 20;
+
+// Signal fence index of set delay_us after start, on another thread.
+static std::thread signal_at(FenceSet &set, uint32_t index, int64_t start,
+                             uint32_t delay_us) {
+  return std::thread([&set, index, start, delay_us]() {
+    std::this_thread::sleep_for(
+        std::chrono::nanoseconds(start + delay_us * 1000LL - now_ns()));
+    set.Signal(index);
+  });
+}
+
+static bool test_wait_any() {
+  bool ok = true;
+  FenceSet set(kWaitFences);
+  std::vector<int> fences;
+  int fds_before = count_open_fds();
+
+  printf("signal(us)  waitAny late(us)  max  sleep-poll late(us)  max\n");
+  for (uint32_t delay_us : kSignalDelaysUs) {
+    int64_t any_ns = 0, any_max_ns = 0, poll_ns = 0, poll_max_ns = 0;
+    for (uint32_t it = 0; it < kWaitIterations; ++it) {
+      uint32_t target = it % kWaitFences;
+
+      if (!set.Create(fences)) {
+        printf("failed to create sw_sync fences\n");
+        return false;
+      }
+      int64_t start = now_ns();
+      std::thread signaller = signal_at(set, target, start, delay_us);
+      int32_t index = Timeline::waitAny(fences.data(), fences.size(), 1000);
+      int64_t late = now_ns() - (start + delay_us * 1000LL);
+      signaller.join();
+      if (index != (int32_t)target) {
+        printf("waitAny: returned %d, fence %u signalled\n", index, target);
+        ok = false;
+      }
+      any_ns += late;
+      any_max_ns = std::max(any_max_ns, late);
+      set.SignalAll();
+      for (int &fence : fences)
+        Timeline::closeFence(&fence);
+
+      // The wait BufferQueue used before: check, then sleep 10ms.
+      if (!set.Create(fences))
+        return false;
+      start = now_ns();
+      signaller = signal_at(set, target, start, delay_us);
+      while (!Timeline::check(&fences[target]))
+        usleep(10000);
+      late = now_ns() - (start + delay_us * 1000LL);
+      signaller.join();
+      poll_ns += late;
+      poll_max_ns = std::max(poll_max_ns, late);
+      set.SignalAll();
+      for (int &fence : fences)
+        Timeline::closeFence(&fence);
+    }
+    printf("%10u  %16.1f  %5.1f  %19.1f  %5.1f\n", delay_us,
+           any_ns / 1000.0 / kWaitIterations, any_max_ns / 1000.0,
+           poll_ns / 1000.0 / kWaitIterations, poll_max_ns / 1000.0);
+  }
+
+  // Nothing signals: waitAny must give up after the timeout.
+  if (!set.Create(fences))
+    return false;
+  int64_t start = now_ns();
+  int32_t index = Timeline::waitAny(fences.data(), fences.size(), 20);
+  int64_t elapsed_ms = (now_ns() - start) / 1000000;
+  if (index != -1 || elapsed_ms < 20) {
+    printf("waitAny: timeout returned %d after %lld ms\n", index,
+           (long long)elapsed_ms);
+    ok = false;
+  }
+  set.SignalAll();
+  for (int &fence : fences)
+    Timeline::closeFence(&fence);
+
+  int fds_after = count_open_fds();
+  if (fds_after != fds_before) {
+    printf("waitany: fd leak: %d before, %d after\n", fds_before, fds_after);
+    ok = false;
+  }
+  return ok;
+}
+
+int main(int argc, char *argv[]) {
+  bool ok = test_merge();
+  ok = test_waiter() && ok;
+  ok = test_wait_any() && ok;
+  printf("\n%s\n", ok ? "PASSED" : "FAILED");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,400 @@
+/*
+// Copyright (c) 2017 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+// Checks Content and LayerStack copies are copy-on-write: changing one layer
+// of a copy only copies that display, and the original is left alone. Then
+// times the filter pipeline on three displays, with every registered filter,
+// and counts heap allocations per frame. Assigning a copy of every display
+// and its layer list, as Content copies used to, is measured alongside.
+// Frames without a geometry change must reuse the filters' last output with
+// the new frame's buffers; a video scene is timed with and without one. A
+// filter reapplied for a change that was not flagged must flag a geometry
+// change on its output if that changed its clipping.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <getopt.h>
+
+#include <chrono>
+#include <new>
+#include <vector>
+
+#include "filtermanager.h"
+#include "layer.h"
+
+using hwcomposer::Content;
+using hwcomposer::FilterManager;
+using hwcomposer::FilterPosition;
+using hwcomposer::HwcRect;
+using hwcomposer::Layer;
+
+static const uint32_t kDisplays = 3;
+static const uint32_t kLayers = 12;
+// The layer on display 0 that is partly hidden, so VisibleRectFilter clips it.
+static const uint32_t kClippedLayer = 5;
+
+static uint64_t allocations = 0;
+
+void* operator new(size_t size) {
+  allocations++;
+  void* p = malloc(size ? size : 1);
+  if (!p)
+    throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void* p) noexcept {
+  free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+  free(p);
+}
+
+struct Scene {
+  std::vector<Layer> layers[kDisplays];
+  Content content;
+};
+
+// plane_alpha stands in for the frame state of a new frame's buffers.
+static void make_scene(Scene& scene, float plane_alpha = 1.0f) {
+  scene.content.resize(kDisplays);
+  for (uint32_t d = 0; d < kDisplays; d++) {
+    std::vector<Layer>& layers = scene.layers[d];
+    layers.resize(kLayers);
+    for (uint32_t ly = 0; ly < kLayers; ly++) {
+      Layer& layer = layers[ly];
+      layer.setHandle(reinterpret_cast<HWCNativeHandle>(
+          static_cast<uintptr_t>(0x1000 + d * kLayers + ly)));
+      int32_t x = ly * 100, y = ly * 50;
+      layer.setSrc(HwcRect<float>(0, 0, 640, 480));
+      layer.setDst(HwcRect<int>(x, y, x + 640, y + 480));
+      std::vector<HwcRect<int>> visible(1, layer.getDst());
+      if (d == 0 && ly == kClippedLayer)
+        visible[0].right -= 320;
+      layer.setVisibleRegions(visible);
+      layer.setPlaneAlpha(plane_alpha);
+      layer.setBlending(hwcomposer::EBlendMode::PREMULT);
+      layer.setBufferFormat(INTEL_HWC_DEFAULT_HAL_PIXEL_FORMAT);
+      layer.onUpdateFlags();
+    }
+    Content::Display& display = scene.content.editDisplay(d);
+    display.setEnabled(true);
+    display.setWidth(1920);
+    display.setHeight(1080);
+    display.setFrameIndex(1);
+    display.editLayerStack() = Content::LayerStack(layers.data(), kLayers);
+    display.editLayerStack().updateLayerFlags();
+  }
+}
+
+static bool check(const char* name, bool ok) {
+  printf("%-44s %s\n", name, ok ? "ok" : "FAILED");
+  return ok;
+}
+
+static bool test_copy_on_write(const Scene& scene) {
+  bool ok = true;
+  const Content& in = scene.content;
+  Layer replacement = scene.layers[1][3];
+
+  Content copy = in;
+  bool shared = true;
+  for (uint32_t d = 0; d < kDisplays; d++)
+    shared = shared && copy.isDisplayShared(in, d);
+  ok = check("copy shares every display", shared) && ok;
+
+  // Flags only: the display is copied, its layer list is not.
+  copy.editDisplay(0).setBlanked(true);
+  ok = check("editing a display copies only that display",
+             !copy.isDisplayShared(in, 0) && copy.isDisplayShared(in, 1) &&
+                 copy.getDisplay(0).getLayerStack().isShared(
+                     in.getDisplay(0).getLayerStack()) &&
+                 !in.getDisplay(0).isBlanked()) &&
+       ok;
+
+  copy.editDisplay(1).editLayerStack().setLayer(3, &replacement);
+  ok = check("changing a layer leaves the original alone",
+             &copy.getDisplay(1).getLayerStack().getLayer(3) == &replacement &&
+                 &in.getDisplay(1).getLayerStack().getLayer(3) ==
+                     &scene.layers[1][3] &&
+                 copy.isDisplayShared(in, 2)) &&
+       ok;
+
+  copy.editDisplay(2).editLayerStack().removeLayer(0, false);
+  ok = check("removing a layer leaves the original alone",
+             copy.getDisplay(2).getNumLayers() == kLayers - 1 &&
+                 in.getDisplay(2).getNumLayers() == kLayers) &&
+       ok;
+
+  // Changing a layer of a copy only pays for the display list, that display
+  // and its layer list (a shared block and the array).
+  uint64_t before = allocations;
+  {
+    Content edited = in;
+    edited.editDisplay(1).editLayerStack().setLayer(3, &replacement);
+  }
+  uint64_t cow = allocations - before;
+  printf("copy and change one layer: %llu allocations\n",
+         (unsigned long long)cow);
+  ok = check("copy and change one layer allocates 4 or fewer", cow <= 4) &&
+       ok;
+
+  // Filters assign over the same copy every frame; later edits reuse the
+  // display and list the earlier ones allocated.
+  Content reused;
+  for (uint32_t frame = 0; frame < 3; frame++) {
+    before = allocations;
+    reused = in;
+    reused.editDisplay(1).editLayerStack().setLayer(3, &replacement);
+  }
+  ok = check("editing again after assignment does not allocate",
+             allocations == before) &&
+       ok;
+  return ok;
+}
+
+static bool test_visible_rect(const Scene& scene) {
+  bool ok = true;
+  const Content& in = scene.content;
+  const Content& out = FilterManager::getInstance().onApply(
+      in, FilterPosition::VisibleRect, FilterPosition::VisibleRect);
+  if (&out == &in) {
+    // The filter library was not linked in, or did not register.
+    return check("VisibleRectFilter clipped display 0", false);
+  }
+  const HwcRect<int>& dst =
+      out.getDisplay(0).getLayerStack().getLayer(kClippedLayer).getDst();
+  ok = check("VisibleRectFilter clipped display 0",
+             dst == scene.layers[0][kClippedLayer].getVisibleRegions()[0]) &&
+       ok;
+  ok = check("unclipped displays are shared with the input",
+             out.isDisplayShared(in, 1) && out.isDisplayShared(in, 2)) &&
+       ok;
+  ok = check("unclipped layers are not copied",
+             &out.getDisplay(0).getLayerStack().getLayer(0) ==
+                 &scene.layers[0][0]) &&
+       ok;
+  return ok;
+}
+
+// Two frames of the same layers with new buffers: the second must reuse the
+// first's clipping with the second's frame state.
+static bool test_frame_state_update(Scene& first, Scene& second) {
+  bool ok = true;
+  FilterManager& fm = FilterManager::getInstance();
+  first.content.setGeometryChanged(true);
+  fm.onApply(first.content, FilterPosition::VisibleRect,
+             FilterPosition::VisibleRect);
+  second.content.setGeometryChanged(false);
+  const Content& out = fm.onApply(second.content, FilterPosition::VisibleRect,
+                                  FilterPosition::VisibleRect);
+  const Layer& clipped =
+      out.getDisplay(0).getLayerStack().getLayer(kClippedLayer);
+  ok = check("update keeps the clipping",
+             clipped.getDst() ==
+                 second.layers[0][kClippedLayer].getVisibleRegions()[0]) &&
+       ok;
+  ok = check("update takes the new frame state",
+             clipped.getPlaneAlpha() ==
+                 second.layers[0][kClippedLayer].getPlaneAlpha()) &&
+       ok;
+  ok = check("update uses the new layers",
+             &out.getDisplay(0).getLayerStack().getLayer(0) ==
+                     &second.layers[0][0] &&
+                 out.isDisplayShared(second.content, 1)) &&
+       ok;
+
+  // Visible regions only change with a geometry change, so until one is
+  // flagged a newly hidden layer is not clipped.
+  Layer& hidden = second.layers[0][kClippedLayer + 1];
+  const std::vector<HwcRect<int>> visible = hidden.getVisibleRegions();
+  std::vector<HwcRect<int>> narrowed = visible;
+  narrowed[0].bottom -= 100;
+  hidden.setVisibleRegions(narrowed);
+  const Content& unflagged = fm.onApply(
+      second.content, FilterPosition::VisibleRect, FilterPosition::VisibleRect);
+  ok = check("no geometry change, filter not reapplied",
+             &unflagged.getDisplay(0).getLayerStack().getLayer(
+                 kClippedLayer + 1) == &hidden) &&
+       ok;
+  second.content.setGeometryChanged(true);
+  const Content& flagged = fm.onApply(
+      second.content, FilterPosition::VisibleRect, FilterPosition::VisibleRect);
+  ok = check("geometry change, filter reapplied",
+             flagged.getDisplay(0)
+                     .getLayerStack()
+                     .getLayer(kClippedLayer + 1)
+                     .getDst() == narrowed[0]) &&
+       ok;
+  hidden.setVisibleRegions(visible);
+  second.content.setGeometryChanged(false);
+  return ok;
+}
+
+// A layer count change reapplies the filter without a geometry change flagged.
+// Its output must be flagged only if the clipping changed, as filters after it
+// would otherwise keep their old output.
+static bool test_unflagged_reapply(Scene& scene) {
+  bool ok = true;
+  FilterManager& fm = FilterManager::getInstance();
+  Content::Display& display = scene.content.editDisplay(0);
+  scene.content.setGeometryChanged(true);
+  fm.onApply(scene.content, FilterPosition::VisibleRect,
+             FilterPosition::VisibleRect);
+  scene.content.setGeometryChanged(false);
+
+  // Dropping the top layer leaves the clipping as it was.
+  display.editLayerStack() =
+      Content::LayerStack(scene.layers[0].data(), kLayers - 1);
+  const Content& same = fm.onApply(scene.content, FilterPosition::VisibleRect,
+                                   FilterPosition::VisibleRect);
+  ok = check("same clipping, no geometry change flagged",
+             !same.getDisplay(0).isGeometryChanged()) &&
+       ok;
+
+  // Adding it back with another layer hidden changes the clipping.
+  Layer& hidden = scene.layers[0][kClippedLayer + 1];
+  const std::vector<HwcRect<int>> visible = hidden.getVisibleRegions();
+  std::vector<HwcRect<int>> narrowed = visible;
+  narrowed[0].bottom -= 100;
+  hidden.setVisibleRegions(narrowed);
+  display.editLayerStack() =
+      Content::LayerStack(scene.layers[0].data(), kLayers);
+  const Content& changed = fm.onApply(
+      scene.content, FilterPosition::VisibleRect, FilterPosition::VisibleRect);
+  ok = check("changed clipping flags a geometry change",
+             changed.getDisplay(0).isGeometryChanged() &&
+                 !changed.getDisplay(1).isGeometryChanged()) &&
+       ok;
+
+  hidden.setVisibleRegions(visible);
+  display.editLayerStack().updateLayerFlags();
+  scene.content.setGeometryChanged(true);
+  fm.onApply(scene.content, FilterPosition::VisibleRect,
+             FilterPosition::VisibleRect);
+  scene.content.setGeometryChanged(false);
+  return ok;
+}
+
+// What a Content copy used to hold: every display by value, each with its own
+// layer list.
+struct DeepDisplay {
+  Content::Display display;
+  std::vector<const Layer*> layers;
+};
+
+static std::vector<DeepDisplay> make_deep(const Content& from) {
+  std::vector<DeepDisplay> deep(from.size());
+  for (uint32_t d = 0; d < from.size(); d++) {
+    const Content::LayerStack& stack = from.getDisplay(d).getLayerStack();
+    deep[d].display = from.getDisplay(d);
+    for (uint32_t ly = 0; ly < stack.size(); ly++)
+      deep[d].layers.push_back(&stack.getLayer(ly));
+  }
+  return deep;
+}
+
+template <typename Frame>
+static void measure(const char* name, uint32_t frames, Frame frame) {
+  frame();
+  uint64_t before = allocations;
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < frames; i++)
+    frame();
+  double us = std::chrono::duration<double, std::micro>(
+                  std::chrono::steady_clock::now() - start)
+                  .count();
+  printf("%-36s %10.3f %14.1f\n", name, us / frames,
+         double(allocations - before) / frames);
+}
+
+// A video playing on an unchanged layout: each frame alternates between two
+// sets of buffers, with or without a geometry change flagged.
+static void measure_static_geometry(Scene& a, Scene& b, uint32_t frames,
+                                    bool geometry) {
+  FilterManager& fm = FilterManager::getInstance();
+  uint32_t frame = 0;
+  measure(geometry ? "video, geometry change every frame"
+                   : "video, static geometry",
+          frames, [&]() {
+            Scene& scene = (frame++ & 1) ? b : a;
+            scene.content.setGeometryChanged(geometry);
+            fm.onPrepare(scene.content);
+          });
+}
+
+static void benchmark(const Scene& scene, uint32_t frames) {
+  FilterManager& fm = FilterManager::getInstance();
+  const Content& in = scene.content;
+  Content copy;
+  Layer replacement = scene.layers[0][kClippedLayer];
+  const std::vector<DeepDisplay> deep = make_deep(in);
+  std::vector<DeepDisplay> deep_copy;
+
+  printf("\n%u displays x %u layers, %u frames\n", kDisplays, kLayers, frames);
+  printf("%-36s %10s %14s\n", "", "us/frame", "allocs/frame");
+  measure("filter pipeline, all filters", frames,
+          [&]() { fm.onPrepare(in); });
+  measure("VisibleRectFilter", frames, [&]() {
+    fm.onApply(in, FilterPosition::VisibleRect, FilterPosition::VisibleRect);
+  });
+  measure("copy, change one layer", frames, [&]() {
+    copy = in;
+    copy.editDisplay(0).editLayerStack().setLayer(kClippedLayer,
+                                                  &replacement);
+  });
+  measure("per display copy, change one layer", frames, [&]() {
+    deep_copy = deep;
+    deep_copy[0].layers[kClippedLayer] = &replacement;
+  });
+}
+
+static void usage(const char* name) {
+  printf("usage: %s [-n benchmark frames]\n", name);
+}
+
+int main(int argc, char* argv[]) {
+  uint32_t frames = 20000;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:h")) != -1) {
+    switch (opt) {
+      case 'n':
+        frames = atoi(optarg) > 0 ? atoi(optarg) : 1;
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+
+  Scene scene, next;
+  make_scene(scene);
+  make_scene(next, 0.5f);
+
+  bool ok = test_copy_on_write(scene);
+  ok = test_visible_rect(scene) && ok;
+  ok = test_frame_state_update(scene, next) && ok;
+  ok = test_unflagged_reapply(scene) && ok;
+  benchmark(scene, frames);
+  measure_static_geometry(scene, next, frames, true);
+  measure_static_geometry(scene, next, frames, false);
+
+  printf("\n%s\n", ok ? "PASSED" : "FAILED");
+  return ok ? 0 : 1;
+}
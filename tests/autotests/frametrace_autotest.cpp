@@ -0,0 +1,258 @@
+/*
+// Copyright (c) 2017 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+// Checks the binary frame trace: nothing is recorded while it is disabled,
+// scopes tag nested events with their display and frame, events from
+// several threads all arrive in order, the ring keeps the newest events, and
+// a saved trace reads back unchanged. Also measures the cost of an event
+// with the trace disabled and enabled.
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "frametrace.h"
+
+using hwcomposer::FrameTrace;
+
+static const uint32_t kCapacity = 4096;
+
+static bool test_disabled() {
+  FRAME_TRACE(kCommit, 0);
+  {
+    FrameTrace::Scope scope(FrameTrace::kPresent, 0, 1);
+    FRAME_TRACE_SCOPE(kDraw);
+  }
+  std::vector<FrameTrace::Record> records;
+  FrameTrace::Read(records);
+  const bool ok = records.empty();
+  printf("%-28s %s %zu events\n", "disabled", ok ? "ok    " : "FAILED",
+         records.size());
+  return ok;
+}
+
+static bool check(const char* name, const FrameTrace::Record& r,
+                  FrameTrace::Event event, FrameTrace::Phase phase,
+                  uint32_t display, uint32_t frame, int32_t arg) {
+  if (r.event == event && r.phase == phase && r.display == display &&
+      r.frame == frame && r.arg == arg)
+    return true;
+  printf("%s: %s/%u display %u frame %u arg %d, expected %s/%u %u %u %d\n",
+         name, FrameTrace::GetEventName(r.event), r.phase, r.display, r.frame,
+         r.arg, FrameTrace::GetEventName(event), phase, display, frame, arg);
+  return false;
+}
+
+static bool test_scopes() {
+  std::vector<FrameTrace::Record> records;
+  FrameTrace::Read(records);
+  const size_t first = records.size();
+  {
+    FrameTrace::Scope present(FrameTrace::kPresent, 2, 42);
+    {
+      FRAME_TRACE_SCOPE(kValidateLayers);
+      FRAME_TRACE(kTestCommit, -22);
+    }
+    FrameTrace::Scope commit(FrameTrace::kCommit);
+    commit.SetResult(7);
+  }
+  FRAME_TRACE(kBufferRelease, 3);
+  FRAME_TRACE_FOR(kOutFence, 1, 41, 1);
+
+  FrameTrace::Read(records);
+  bool ok = records.size() == first + 9;
+  if (!ok) {
+    printf("scopes: %zu events\n", records.size() - first);
+  } else {
+    const FrameTrace::Record* r = &records[first];
+    using F = FrameTrace;
+    ok = check("scopes", r[0], F::kPresent, F::kBegin, 2, 42, 0) && ok;
+    ok = check("scopes", r[1], F::kValidateLayers, F::kBegin, 2, 42, 0) && ok;
+    ok = check("scopes", r[2], F::kTestCommit, F::kInstant, 2, 42, -22) && ok;
+    ok = check("scopes", r[3], F::kValidateLayers, F::kEnd, 2, 42, 0) && ok;
+    ok = check("scopes", r[4], F::kCommit, F::kBegin, 2, 42, 0) && ok;
+    ok = check("scopes", r[5], F::kCommit, F::kEnd, 2, 42, 7) && ok;
+    ok = check("scopes", r[6], F::kPresent, F::kEnd, 2, 42, 0) && ok;
+    // Outside the scope the current frame is back to what it was.
+    ok = check("scopes", r[7], F::kBufferRelease, F::kInstant, 0, 0, 3) && ok;
+    ok = check("scopes", r[8], F::kOutFence, F::kInstant, 1, 41, 1) && ok;
+    for (uint32_t i = 1; i < 9; i++) {
+      if (r[i].timestamp < r[i - 1].timestamp || r[i].tid != r[0].tid) {
+        printf("scopes: event %u out of order or on another thread\n", i);
+        ok = false;
+      }
+    }
+  }
+  printf("%-28s %s\n", "scopes", ok ? "ok    " : "FAILED");
+  return ok;
+}
+
+static void add_events(uint32_t display, uint32_t events) {
+  for (uint32_t frame = 0; frame < events; frame++)
+    FRAME_TRACE_FOR(kCommit, display, frame, 0);
+}
+
+static bool test_threads() {
+  const uint32_t kThreads = 4, kEvents = kCapacity / 8;
+  std::vector<std::thread> threads;
+  for (uint32_t t = 0; t < kThreads; t++)
+    threads.push_back(std::thread(add_events, t, kEvents));
+  for (std::thread& thread : threads)
+    thread.join();
+
+  std::vector<FrameTrace::Record> records;
+  FrameTrace::Read(records);
+  std::vector<uint32_t> next(kThreads, 0);
+  bool ok = true;
+  for (const FrameTrace::Record& r : records) {
+    if (r.event != FrameTrace::kCommit || r.phase != FrameTrace::kInstant)
+      continue;
+    if (r.display >= kThreads || r.frame != next[r.display]) {
+      printf("threads: display %u frame %u out of order\n", r.display,
+             r.frame);
+      ok = false;
+      break;
+    }
+    next[r.display]++;
+  }
+  for (uint32_t t = 0; t < kThreads; t++) {
+    if (next[t] != kEvents) {
+      printf("threads: %u of %u events from thread %u\n", next[t], kEvents,
+             t);
+      ok = false;
+    }
+  }
+  printf("%-28s %s %u threads, %u events each\n", "threads",
+         ok ? "ok    " : "FAILED", kThreads, kEvents);
+  return ok;
+}
+
+static bool test_wrap() {
+  const uint32_t kEvents = kCapacity * 3 + 5;
+  std::vector<FrameTrace::Record> records;
+  const uint64_t dropped_before = FrameTrace::Read(records);
+  const uint64_t total = dropped_before + records.size() + kEvents;
+  add_events(7, kEvents);
+
+  const uint64_t dropped = FrameTrace::Read(records);
+  bool ok = records.size() == kCapacity && dropped == total - kCapacity;
+  for (uint32_t i = 0; ok && i < kCapacity; i++) {
+    const FrameTrace::Record& r = records[i];
+    ok = r.display == 7 && r.frame == kEvents - kCapacity + i;
+  }
+  printf("%-28s %s kept %zu, dropped %llu\n", "wrap", ok ? "ok    " : "FAILED",
+         records.size(), (unsigned long long)dropped);
+  return ok;
+}
+
+static bool test_save() {
+  char path[] = "/tmp/frametraceXXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0) {
+    printf("save: can't create a temporary file\n");
+    return false;
+  }
+  close(fd);
+
+  std::vector<FrameTrace::Record> expected;
+  bool ok = FrameTrace::Save(path);
+  const uint64_t dropped = FrameTrace::Read(expected);
+
+  FrameTrace::FileHeader header;
+  std::vector<FrameTrace::Record> records;
+  FILE* file = fopen(path, "rb");
+  ok = file && fread(&header, sizeof(header), 1, file) == 1 && ok;
+  if (ok) {
+    records.resize(header.count);
+    ok = fread(records.data(), sizeof(FrameTrace::Record), records.size(),
+               file) == records.size();
+  }
+  if (file)
+    fclose(file);
+  unlink(path);
+
+  ok = ok && !memcmp(header.magic, FrameTrace::kMagic, sizeof(header.magic)) &&
+       header.version == FrameTrace::kVersion &&
+       header.record_size == sizeof(FrameTrace::Record) &&
+       header.dropped == dropped && records.size() == expected.size() &&
+       !memcmp(records.data(), expected.data(),
+               records.size() * sizeof(FrameTrace::Record));
+  printf("%-28s %s %zu events\n", "save", ok ? "ok    " : "FAILED",
+         records.size());
+  return ok;
+}
+
+static double ns_per_event(uint32_t threads, uint32_t events) {
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> workers;
+  for (uint32_t t = 0; t < threads; t++)
+    workers.push_back(std::thread(add_events, t, events));
+  for (std::thread& w : workers)
+    w.join();
+  std::chrono::duration<double, std::nano> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return elapsed.count() / (threads * events);
+}
+
+static void benchmark(uint32_t events) {
+  printf("\n%u events per thread\n", events);
+  printf("%-8s %16s %16s\n", "threads", "disabled ns", "enabled ns");
+  for (uint32_t threads = 1; threads <= 4; threads *= 2) {
+    FrameTrace::Disable();
+    const double disabled = ns_per_event(threads, events);
+    FrameTrace::Enable(kCapacity);
+    const double enabled = ns_per_event(threads, events);
+    printf("%-8u %16.2f %16.2f\n", threads, disabled, enabled);
+  }
+}
+
+static void usage(const char* name) {
+  printf("usage: %s [-n benchmark events per thread]\n", name);
+}
+
+int main(int argc, char* argv[]) {
+  uint32_t events = 1000000;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:h")) != -1) {
+    switch (opt) {
+      case 'n':
+        events = atoi(optarg) > 0 ? atoi(optarg) : 1;
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+
+  bool ok = test_disabled();
+  FrameTrace::Enable(kCapacity);
+  ok = test_scopes() && ok;
+  ok = test_threads() && ok;
+  ok = test_wrap() && ok;
+  ok = test_save() && ok;
+  benchmark(events);
+
+  printf("\n%s\n", ok ? "PASSED" : "FAILED");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,223 @@
+/*
+// Copyright (c) 2017 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+// Checks the latency histogram: nearest rank percentiles, unit conversion,
+// that only the newest samples are kept, and that samples added from several
+// threads are all counted while a reader takes summaries. Also measures the
+// cost of adding a sample.
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "latencyhistogram.h"
+
+using hwcomposer::LatencyHistogram;
+
+static bool expect(const char* name, const char* what, uint32_t value,
+                   uint32_t expected) {
+  if (value == expected)
+    return true;
+  printf("%s: %s %u, expected %u\n", name, what, value, expected);
+  return false;
+}
+
+static bool test_percentile() {
+  std::vector<uint32_t> values;
+  for (uint32_t i = 1; i <= 1000; i++)
+    values.push_back(i);
+
+  const char* name = "percentile";
+  bool ok = expect(name, "p50 of 1..100",
+                   LatencyHistogram::Percentile(values.data(), 100, 50), 50);
+  ok = expect(name, "p90 of 1..100",
+              LatencyHistogram::Percentile(values.data(), 100, 90), 90) && ok;
+  ok = expect(name, "p99 of 1..100",
+              LatencyHistogram::Percentile(values.data(), 100, 99), 99) && ok;
+  ok = expect(name, "p99 of 1..1000",
+              LatencyHistogram::Percentile(values.data(), 1000, 99), 990) && ok;
+  // Ranks round up: p50 of 1..3 is 2 and p90 of 1..10 is 9.
+  ok = expect(name, "p50 of 1..3",
+              LatencyHistogram::Percentile(values.data(), 3, 50), 2) && ok;
+  ok = expect(name, "p90 of 1..10",
+              LatencyHistogram::Percentile(values.data(), 10, 90), 9) && ok;
+  ok = expect(name, "p50 of 1",
+              LatencyHistogram::Percentile(values.data(), 1, 50), 1) && ok;
+  ok = expect(name, "p0 of 1..10",
+              LatencyHistogram::Percentile(values.data(), 10, 0), 1) && ok;
+  ok = expect(name, "p100 of 1..10",
+              LatencyHistogram::Percentile(values.data(), 10, 100), 10) && ok;
+  ok = expect(name, "p50 of none",
+              LatencyHistogram::Percentile(values.data(), 0, 50), 0) && ok;
+  printf("%-28s %s\n", name, ok ? "ok    " : "FAILED");
+  return ok;
+}
+
+static bool test_summary() {
+  const char* name = "summary";
+  LatencyHistogram histogram;
+  LatencyHistogram::Summary s = histogram.GetSummary();
+  bool ok = s.count == 0 && expect(name, "empty samples", s.samples, 0) &&
+            expect(name, "empty max", s.max, 0);
+
+  // Added in nanoseconds, reported in microseconds, in any order.
+  for (uint32_t i = 100; i >= 1; i--)
+    histogram.Add(int64_t(i) * 1000 + 999);
+  s = histogram.GetSummary();
+  ok = s.count == 100 && ok;
+  ok = expect(name, "samples", s.samples, 100) && ok;
+  ok = expect(name, "p50", s.p50, 50) && ok;
+  ok = expect(name, "p90", s.p90, 90) && ok;
+  ok = expect(name, "p99", s.p99, 99) && ok;
+  ok = expect(name, "max", s.max, 100) && ok;
+
+  histogram.Reset();
+  histogram.Add(-5000);
+  histogram.Add(int64_t(1) << 60);
+  s = histogram.GetSummary();
+  ok = expect(name, "negative", s.p50, 0) && ok;
+  ok = expect(name, "saturated", s.max, UINT32_MAX) && ok;
+  printf("%-28s %s\n", name, ok ? "ok    " : "FAILED");
+  return ok;
+}
+
+// Older samples drop out of the window, however large they were.
+static bool test_window() {
+  const char* name = "window";
+  const uint32_t kWindow = LatencyHistogram::kWindow;
+  LatencyHistogram histogram;
+  for (uint32_t i = 0; i < kWindow; i++)
+    histogram.Add(1000000000);
+  for (uint32_t i = 1; i <= kWindow * 2 + 10; i++)
+    histogram.Add(int64_t(i) * 1000);
+
+  LatencyHistogram::Summary s = histogram.GetSummary();
+  const uint32_t first = kWindow + 11;
+  bool ok = s.count == kWindow * 3 + 10;
+  ok = expect(name, "samples", s.samples, kWindow) && ok;
+  ok = expect(name, "p50", s.p50, first + kWindow / 2 - 1) && ok;
+  ok = expect(name, "max", s.max, kWindow * 2 + 10) && ok;
+  printf("%-28s %s\n", name, ok ? "ok    " : "FAILED");
+  return ok;
+}
+
+static void add_samples(LatencyHistogram* histogram, uint32_t thread,
+                        uint32_t samples) {
+  for (uint32_t i = 0; i < samples; i++)
+    histogram->Add(int64_t(thread + 1) * 1000000);
+}
+
+static bool valid(uint32_t value, uint32_t threads) {
+  return value % 1000 == 0 && value >= 1000 && value <= threads * 1000;
+}
+
+// Each thread adds its own latency. Every sample is counted and a summary
+// taken meanwhile only ever sees latencies that were added.
+static bool test_threads() {
+  const uint32_t kThreads = 4, kSamples = 200000;
+  LatencyHistogram histogram;
+  add_samples(&histogram, 0, LatencyHistogram::kWindow);
+
+  std::atomic<bool> done(false);
+  bool ok = true;
+  uint32_t summaries = 0;
+  std::thread reader([&]() {
+    while (!done) {
+      LatencyHistogram::Summary s = histogram.GetSummary();
+      if (!valid(s.p50, kThreads) || !valid(s.p90, kThreads) ||
+          !valid(s.p99, kThreads) || !valid(s.max, kThreads) ||
+          s.p50 > s.p90 || s.p90 > s.p99 || s.p99 > s.max) {
+        printf("threads: p50 %u p90 %u p99 %u max %u\n", s.p50, s.p90, s.p99,
+               s.max);
+        ok = false;
+        break;
+      }
+      summaries++;
+    }
+  });
+
+  std::vector<std::thread> writers;
+  for (uint32_t t = 0; t < kThreads; t++)
+    writers.push_back(std::thread(add_samples, &histogram, t, kSamples));
+  for (std::thread& w : writers)
+    w.join();
+  done = true;
+  reader.join();
+
+  LatencyHistogram::Summary s = histogram.GetSummary();
+  const uint64_t expected = uint64_t(kThreads) * kSamples +
+                            LatencyHistogram::kWindow;
+  if (s.count != expected) {
+    printf("threads: counted %llu of %llu samples\n",
+           (unsigned long long)s.count, (unsigned long long)expected);
+    ok = false;
+  }
+  printf("%-28s %s %u threads, %u summaries\n", "threads",
+         ok ? "ok    " : "FAILED", kThreads, summaries);
+  return ok;
+}
+
+static void benchmark(uint32_t samples) {
+  printf("\n%u samples per thread\n", samples);
+  printf("%-8s %16s\n", "threads", "ns/sample");
+  for (uint32_t threads = 1; threads <= 4; threads *= 2) {
+    LatencyHistogram histogram;
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (uint32_t t = 0; t < threads; t++)
+      workers.push_back(std::thread(add_samples, &histogram, t, samples));
+    for (std::thread& w : workers)
+      w.join();
+    std::chrono::duration<double, std::nano> elapsed =
+        std::chrono::steady_clock::now() - start;
+    printf("%-8u %16.2f\n", threads, elapsed.count() / (threads * samples));
+  }
+}
+
+static void usage(const char* name) {
+  printf("usage: %s [-n benchmark samples per thread]\n", name);
+}
+
+int main(int argc, char* argv[]) {
+  uint32_t samples = 1000000;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:h")) != -1) {
+    switch (opt) {
+      case 'n':
+        samples = atoi(optarg) > 0 ? atoi(optarg) : 1;
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+
+  bool ok = test_percentile();
+  ok = test_summary() && ok;
+  ok = test_window() && ok;
+  ok = test_threads() && ok;
+  benchmark(samples);
+
+  printf("\n%s\n", ok ? "PASSED" : "FAILED");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,301 @@
+/*
+// Copyright (c) 2017 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+// Checks the layer capture: nothing is recorded before it is enabled, a
+// frame's layers are recorded with their geometry, buffer and damage, a
+// buffer keeps its id from frame to frame, a reused GEM handle or a buffer
+// gone for a whole ring gets a new id, unchanged frames are marked as such,
+// the ring keeps the newest frames, and a saved capture loads back
+// unchanged. Also measures the cost of recording a frame.
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <vector>
+
+#include <drm_fourcc.h>
+
+#include <hwcbuffer.h>
+#include <hwclayer.h>
+
+#include "layercapture.h"
+#include "overlaybuffermanager.h"
+#include "overlaylayer.h"
+
+using hwcomposer::HwcLayer;
+using hwcomposer::HwcRect;
+using hwcomposer::LayerCapture;
+using hwcomposer::OverlayLayer;
+
+static const uint32_t kLayers = 4;
+
+// Stands in for the display queue: HwcLayers and the OverlayLayers made
+// from them, with buffers of distinct sizes on GEM handles from
+// first_handle.
+struct Stack {
+  explicit Stack(uint32_t first_handle = 1, uint32_t width = 64)
+      : source_layers(kLayers), layers(kLayers) {
+    for (uint32_t i = 0; i < kLayers; i++) {
+      HwcBuffer bo;
+      memset(&bo, 0, sizeof(bo));
+      bo.width = width * (i + 1);
+      bo.height = 32 * (i + 1);
+      bo.format = DRM_FORMAT_XRGB8888 + i;
+      bo.gem_handles[0] = first_handle + i;
+      layers[i].SetBuffer(buffer_manager.CreateBuffer(bo));
+
+      HwcLayer& layer = hwc_layers[i];
+      layer.SetNativeHandle(&handles[i]);
+      layer.SetTransform(i);
+      layer.SetAlpha(0xff - i);
+      layer.SetBlending(hwcomposer::HWCBlending::kBlendingPremult);
+      layer.SetSourceCrop(HwcRect<float>(0, 0, bo.width, bo.height));
+      layer.SetDisplayFrame(HwcRect<int>(10 * i, 20 * i, 10 * i + bo.width,
+                                         20 * i + bo.height));
+      source_layers[i] = &layer;
+    }
+  }
+
+  hwcomposer::OverlayBufferManager buffer_manager;
+  HWCNativeHandlesp handles[kLayers];
+  HwcLayer hwc_layers[kLayers];
+  std::vector<HwcLayer*> source_layers;
+  std::vector<OverlayLayer> layers;
+};
+
+static bool save_and_load(LayerCapture::FileHeader& header,
+                          std::vector<LayerCapture::Frame>& frames,
+                          std::vector<LayerCapture::Layer>& layers) {
+  char path[] = "/tmp/layercaptureXXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0) {
+    printf("can't create a temporary file\n");
+    return false;
+  }
+  close(fd);
+
+  bool ok = LayerCapture::Save(path) &&
+            LayerCapture::Load(path, header, frames, layers);
+  unlink(path);
+  return ok;
+}
+
+static bool test_disabled(Stack& stack) {
+  // Recording is up to the caller, but a capture that was never enabled
+  // has nowhere to record to.
+  LayerCapture::Add(0, 1, 100, stack.source_layers, stack.layers);
+  LayerCapture::AddUnchanged(0, 2, 200);
+
+  LayerCapture::FileHeader header;
+  std::vector<LayerCapture::Frame> frames;
+  std::vector<LayerCapture::Layer> layers;
+  const bool ok = !LayerCapture::IsEnabled() &&
+                  save_and_load(header, frames, layers) && frames.empty();
+  printf("%-28s %s %zu frames\n", "disabled", ok ? "ok    " : "FAILED",
+         frames.size());
+  return ok;
+}
+
+static bool check_layer(const LayerCapture::Layer& layer, uint32_t i,
+                        uint32_t buffer) {
+  const uint32_t width = 64 * (i + 1), height = 32 * (i + 1);
+  bool ok = layer.buffer == buffer && layer.width == width &&
+            layer.height == height &&
+            layer.format == DRM_FORMAT_XRGB8888 + i && layer.transform == i &&
+            layer.alpha == 0xff - i &&
+            layer.blending == uint16_t(
+                hwcomposer::HWCBlending::kBlendingPremult) &&
+            layer.source_crop[2] == width && layer.source_crop[3] == height &&
+            layer.display_frame[0] == int32_t(10 * i) &&
+            layer.display_frame[1] == int32_t(20 * i) &&
+            layer.display_frame[2] == int32_t(10 * i + width) &&
+            layer.display_frame[3] == int32_t(20 * i + height);
+  if (!ok)
+    printf("record: layer %u buffer %u %ux%u format %x transform %u\n", i,
+           layer.buffer, layer.width, layer.height, layer.format,
+           layer.transform);
+  return ok;
+}
+
+static bool test_record(Stack& stack) {
+  LayerCapture::Enable(16);
+
+  const HwcRect<int> damage[] = {HwcRect<int>(5, 6, 10, 12),
+                                 HwcRect<int>(1, 8, 7, 20)};
+  hwcomposer::HwcRegion region;
+  region.kNumRects = 2;
+  region.kRects = damage;
+  stack.hwc_layers[1].SetSurfaceDamage(region);
+  LayerCapture::Add(3, 10, 1000, stack.source_layers, stack.layers);
+  LayerCapture::AddUnchanged(3, 11, 2000);
+
+  // The same buffers in another order keep their ids.
+  std::swap(stack.hwc_layers[0], stack.hwc_layers[3]);
+  std::swap(stack.layers[0], stack.layers[3]);
+  LayerCapture::Add(3, 12, 3000, stack.source_layers, stack.layers);
+
+  LayerCapture::FileHeader header;
+  std::vector<LayerCapture::Frame> frames;
+  std::vector<LayerCapture::Layer> layers;
+  bool ok = save_and_load(header, frames, layers) && frames.size() == 3 &&
+            layers.size() == 2 * kLayers && header.dropped == 0;
+  if (ok) {
+    ok = frames[0].display == 3 && frames[0].frame == 10 &&
+         frames[0].timestamp == 1000 && frames[0].num_layers == kLayers &&
+         frames[0].flags == 0;
+    ok = ok && frames[1].frame == 11 && frames[1].num_layers == 0 &&
+         frames[1].flags == LayerCapture::kUnchanged;
+    ok = ok && frames[2].frame == 12 && frames[2].num_layers == kLayers;
+    for (uint32_t i = 0; i < kLayers; i++) {
+      ok = check_layer(layers[i], i, i + 1) && ok;
+      const uint32_t swapped = i == 0 ? 3 : i == 3 ? 0 : i;
+      ok = check_layer(layers[kLayers + i], swapped, swapped + 1) && ok;
+    }
+    const LayerCapture::Layer& damaged = layers[1];
+    ok = ok && damaged.damage_rects == 2 && damaged.damage[0] == 1 &&
+         damaged.damage[1] == 6 && damaged.damage[2] == 10 &&
+         damaged.damage[3] == 20 && layers[0].damage_rects == 0;
+  }
+  printf("%-28s %s %zu frames, %zu layers\n", "record",
+         ok ? "ok    " : "FAILED", frames.size(), layers.size());
+  return ok;
+}
+
+// Checks that the layers of frame hold buffers first..first + kLayers - 1.
+static bool check_ids(const std::vector<LayerCapture::Layer>& layers,
+                      uint32_t frame, uint32_t first) {
+  bool ok = true;
+  for (uint32_t i = 0; i < kLayers; i++)
+    ok = ok && layers[frame * kLayers + i].buffer == first + i;
+  return ok;
+}
+
+static bool test_buffer_ids(Stack& stack) {
+  const uint32_t kFrames = 4;
+  LayerCapture::FileHeader header;
+  std::vector<LayerCapture::Frame> frames;
+  std::vector<LayerCapture::Layer> layers;
+
+  // The same GEM handles on buffers of other sizes, as after the first
+  // buffers were freed.
+  Stack reused(1, 48);
+  LayerCapture::Enable(kFrames);
+  LayerCapture::Add(0, 0, 0, stack.source_layers, stack.layers);
+  LayerCapture::Add(0, 1, 1, reused.source_layers, reused.layers);
+  bool ok = save_and_load(header, frames, layers) && frames.size() == 2 &&
+            check_ids(layers, 0, 1) && check_ids(layers, 1, 1 + kLayers);
+
+  // Once no frame in the ring shows them, the first buffers are forgotten
+  // and come back with new ids.
+  Stack other(100);
+  for (uint32_t frame = 2; frame < 2 + 6; frame++)
+    LayerCapture::Add(0, frame, frame, other.source_layers, other.layers);
+  LayerCapture::Add(0, 8, 8, stack.source_layers, stack.layers);
+  ok = ok && save_and_load(header, frames, layers) &&
+       frames.size() == kFrames && check_ids(layers, 0, 1 + 2 * kLayers) &&
+       check_ids(layers, kFrames - 1, 1 + 3 * kLayers);
+  printf("%-28s %s\n", "buffer ids", ok ? "ok    " : "FAILED");
+  return ok;
+}
+
+static bool test_wrap(Stack& stack) {
+  const uint32_t kFrames = 8, kAdded = 21;
+  LayerCapture::Enable(kFrames);
+  for (uint32_t frame = 0; frame < kAdded; frame++) {
+    if (frame % 2)
+      LayerCapture::AddUnchanged(0, frame, frame);
+    else
+      LayerCapture::Add(0, frame, frame, stack.source_layers, stack.layers);
+  }
+
+  LayerCapture::FileHeader header;
+  std::vector<LayerCapture::Frame> frames;
+  std::vector<LayerCapture::Layer> layers;
+  bool ok = save_and_load(header, frames, layers) &&
+            frames.size() == kFrames && header.dropped == kAdded - kFrames &&
+            layers.size() == (kFrames / 2) * kLayers;
+  for (uint32_t i = 0; ok && i < kFrames; i++)
+    ok = frames[i].frame == kAdded - kFrames + i;
+  printf("%-28s %s kept %zu, dropped %llu\n", "wrap", ok ? "ok    " : "FAILED",
+         frames.size(), (unsigned long long)header.dropped);
+  return ok;
+}
+
+static bool test_bad_file() {
+  char path[] = "/tmp/layercaptureXXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0)
+    return false;
+  const char garbage[] = "not a layer capture at all, just some text";
+  bool ok = write(fd, garbage, sizeof(garbage)) == sizeof(garbage);
+  close(fd);
+
+  LayerCapture::FileHeader header;
+  std::vector<LayerCapture::Frame> frames;
+  std::vector<LayerCapture::Layer> layers;
+  ok = ok && !LayerCapture::Load(path, header, frames, layers) &&
+       !LayerCapture::Load("/nonexistent/capture", header, frames, layers);
+  unlink(path);
+  printf("%-28s %s\n", "bad file", ok ? "ok    " : "FAILED");
+  return ok;
+}
+
+static void benchmark(Stack& stack, uint32_t frames) {
+  LayerCapture::Enable(1024);
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t frame = 0; frame < frames; frame++)
+    LayerCapture::Add(0, frame, frame, stack.source_layers, stack.layers);
+  std::chrono::duration<double, std::nano> elapsed =
+      std::chrono::steady_clock::now() - start;
+  printf("\n%u frames of %u layers: %.2f ns per frame\n", frames, kLayers,
+         elapsed.count() / frames);
+}
+
+static void usage(const char* name) {
+  printf("usage: %s [-n benchmark frames]\n", name);
+}
+
+int main(int argc, char* argv[]) {
+  uint32_t frames = 1000000;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:h")) != -1) {
+    switch (opt) {
+      case 'n':
+        frames = atoi(optarg) > 0 ? atoi(optarg) : 1;
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+
+  Stack stack;
+  bool ok = test_disabled(stack);
+  ok = test_record(stack) && ok;
+  ok = test_buffer_ids(stack) && ok;
+  ok = test_wrap(stack) && ok;
+  ok = test_bad_file() && ok;
+  benchmark(stack, frames);
+
+  printf("\n%s\n", ok ? "PASSED" : "FAILED");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,266 @@
+/*
+// Copyright (c) 2017 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+// Logs from several threads at once and checks the HWC log reads back every
+// entry merged in timestamp order, each thread's entries in the order it
+// logged them, and reports overwritten entries as lost. Also measures logging
+// throughput with 1 to 8 threads logging as fast as they can.
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "log.h"
+
+using hwcomposer::AbstractLogWrite;
+using hwcomposer::Log;
+
+struct Entry {
+  pid_t tid;
+  int64_t timestamp;
+  uint32_t thread;
+  uint32_t seq;
+  bool lost;
+};
+
+// Entries are a tid, a timestamp and the string logged by log_thread().
+static bool read_entry(Entry& e) {
+  std::vector<char> data;
+  if (!Log::read(data, e.lost))
+    return false;
+  if (data.size() < AbstractLogWrite::cStrOffset + 1) {
+    e.thread = e.seq = ~0u;
+    return true;
+  }
+  memcpy(&e.tid, data.data(), sizeof(e.tid));
+  memcpy(&e.timestamp, data.data() + sizeof(e.tid), sizeof(e.timestamp));
+  if (sscanf(data.data() + AbstractLogWrite::cStrOffset, "thread %u seq %u",
+             &e.thread, &e.seq) != 2)
+    e.thread = e.seq = ~0u;
+  return true;
+}
+
+static void drain() {
+  Entry e;
+  while (read_entry(e)) {
+  }
+}
+
+// Threads start logging together and stay alive until they have all
+// finished, so that each keeps a ring of its own.
+struct Barrier {
+  std::atomic<bool> go;
+  std::atomic<uint32_t> finished;
+  uint32_t threads;
+};
+
+static void log_thread(uint32_t thread, uint32_t entries, Barrier* barrier) {
+  while (barrier && !barrier->go)
+    std::this_thread::yield();
+  for (uint32_t seq = 0; seq < entries; seq++)
+    Log::add("thread %u seq %u", thread, seq);
+  if (barrier) {
+    barrier->finished++;
+    while (barrier->finished != barrier->threads)
+      std::this_thread::yield();
+  }
+}
+
+static void run_threads(uint32_t threads, uint32_t entries) {
+  Barrier barrier;
+  barrier.go = false;
+  barrier.finished = 0;
+  barrier.threads = threads;
+  std::vector<std::thread> workers;
+  for (uint32_t t = 0; t < threads; t++)
+    workers.push_back(std::thread(log_thread, t, entries, &barrier));
+  barrier.go = true;
+  for (std::thread& w : workers)
+    w.join();
+}
+
+// Threads log fewer entries than their rings hold, then everything is read.
+static bool test_merged_order() {
+  const uint32_t kThreads = 4, kEntries = 1000;
+  run_threads(kThreads, kEntries);
+
+  bool ok = true;
+  std::vector<uint32_t> next(kThreads, 0);
+  int64_t last = 0;
+  uint32_t count = 0;
+  Entry e;
+  while (read_entry(e)) {
+    if (e.thread >= kThreads) {
+      printf("merged order: unexpected entry\n");
+      ok = false;
+      continue;
+    }
+    if (e.timestamp < last) {
+      printf("merged order: entry %u at %lld before %lld\n", count,
+             (long long)e.timestamp, (long long)last);
+      ok = false;
+    }
+    if (e.seq != next[e.thread] || e.lost) {
+      printf("merged order: thread %u seq %u, expected %u%s\n", e.thread,
+             e.seq, next[e.thread], e.lost ? " (lost)" : "");
+      ok = false;
+    }
+    last = e.timestamp;
+    next[e.thread] = e.seq + 1;
+    count++;
+  }
+  if (count != kThreads * kEntries) {
+    printf("merged order: read %u of %u entries\n", count,
+           kThreads * kEntries);
+    ok = false;
+  }
+  printf("%-28s %s %u threads, %u entries\n", "merged order",
+         ok ? "ok    " : "FAILED", kThreads, count);
+  return ok;
+}
+
+// One thread overruns its ring: the oldest entries go, the first entry read
+// is flagged lost and the rest follow on up to the last one logged.
+static bool test_overwrite() {
+  const uint32_t kEntries = 100000;
+  std::thread(log_thread, 0, kEntries, nullptr).join();
+
+  bool ok = true;
+  uint32_t count = 0, first = 0, next = 0;
+  Entry e;
+  while (read_entry(e)) {
+    if (count == 0) {
+      first = e.seq;
+      ok = e.lost && e.seq > 0 && ok;
+    } else if (e.seq != next || e.lost) {
+      printf("overwrite: seq %u, expected %u%s\n", e.seq, next,
+             e.lost ? " (lost)" : "");
+      ok = false;
+    }
+    next = e.seq + 1;
+    count++;
+  }
+  if (count == 0 || next != kEntries) {
+    printf("overwrite: read %u entries ending at %u\n", count, next);
+    ok = false;
+  }
+  printf("%-28s %s kept %u..%u of %u\n", "overwrite", ok ? "ok    " : "FAILED",
+         first, next - 1, kEntries);
+  return ok;
+}
+
+// Reads while the threads log. Each thread's entries must come out in order,
+// with gaps only where entries were reported lost.
+static bool test_concurrent_read() {
+  const uint32_t kThreads = 4, kEntries = 50000;
+  std::atomic<bool> done(false);
+  std::thread writers([&]() {
+    run_threads(kThreads, kEntries);
+    done = true;
+  });
+
+  bool ok = true;
+  std::vector<int64_t> next(kThreads, 0);
+  uint32_t count = 0, gaps = 0;
+  Entry e;
+  for (;;) {
+    const bool finished = done;
+    while (read_entry(e)) {
+      if (e.thread >= kThreads) {
+        printf("concurrent read: unexpected entry\n");
+        ok = false;
+        continue;
+      }
+      if (e.seq < next[e.thread] || (e.seq > next[e.thread] && !e.lost)) {
+        printf("concurrent read: thread %u seq %u, expected %lld%s\n",
+               e.thread, e.seq, (long long)next[e.thread],
+               e.lost ? " (lost)" : "");
+        ok = false;
+      }
+      gaps += e.seq != next[e.thread];
+      next[e.thread] = e.seq + 1;
+      count++;
+    }
+    if (finished)
+      break;
+  }
+  writers.join();
+  for (uint32_t t = 0; t < kThreads; t++) {
+    if (next[t] != kEntries) {
+      printf("concurrent read: thread %u ended at %lld\n", t,
+             (long long)next[t]);
+      ok = false;
+    }
+  }
+  printf("%-28s %s read %u of %u, %u gaps\n", "concurrent read",
+         ok ? "ok    " : "FAILED", count, kThreads * kEntries, gaps);
+  return ok;
+}
+
+static void benchmark(uint32_t entries) {
+  printf("\n%u entries per thread\n", entries);
+  printf("%-8s %16s %16s\n", "threads", "entries/s", "ns/entry");
+  for (uint32_t threads = 1; threads <= 8; threads *= 2) {
+    drain();
+    auto start = std::chrono::steady_clock::now();
+    run_threads(threads, entries);
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    printf("%-8u %16.0f %16.1f\n", threads,
+           threads * entries / elapsed.count(),
+           elapsed.count() * 1e9 / (threads * entries));
+  }
+  drain();
+}
+
+static void usage(const char* name) {
+  printf("usage: %s [-n benchmark entries per thread]\n", name);
+}
+
+int main(int argc, char* argv[]) {
+  uint32_t entries = 200000;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:h")) != -1) {
+    switch (opt) {
+      case 'n':
+        entries = atoi(optarg) > 0 ? atoi(optarg) : 1;
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+
+  Log::enable();
+  drain();
+
+  bool ok = test_merged_order();
+  ok = test_overwrite() && ok;
+  ok = test_concurrent_read() && ok;
+  benchmark(entries);
+
+  Log::disable();
+  printf("\n%s\n", ok ? "PASSED" : "FAILED");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,158 @@
+/*
+// Copyright (c) 2017 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+// Checks the runtime log level: it starts at the configured level, a message
+// is only emitted (and its arguments evaluated) at or below it, and it can not
+// be set outside none..HWC_LOG_LEVEL_MAX. Then times a frame with 64 debug
+// call sites, as a frame of DisplayQueue and composition work has, at the
+// default level, with debug enabled but every condition false, and with the
+// sites compiled out.
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <chrono>
+
+#include "hwcloglevel.h"
+
+using hwcomposer::SetLogLevel;
+using hwcomposer::gLogLevel;
+
+static uint32_t sEmitted = 0;
+static uint32_t sEvaluated = 0;
+
+static void count_sink(const char* /*fmt*/, ...) {
+  sEmitted++;
+}
+
+static int evaluate(int value) {
+  sEvaluated++;
+  return value;
+}
+
+static bool check(const char* name, bool ok) {
+  printf("%s: %s\n", ok ? "ok" : "FAIL", name);
+  return ok;
+}
+
+static bool test_levels() {
+  bool ok = true;
+  const int start = HWC_LOG_LEVEL_DEFAULT < HWC_LOG_LEVEL_MAX
+                        ? HWC_LOG_LEVEL_DEFAULT
+                        : HWC_LOG_LEVEL_MAX;
+  ok = check("starts at the configured level", gLogLevel.load() == start) && ok;
+
+  for (int level = HWC_LOG_LEVEL_NONE; level <= HWC_LOG_LEVEL_MAX; level++) {
+    SetLogLevel(level);
+    sEmitted = sEvaluated = 0;
+    HWC_LOG_IF(HWC_LOG_LEVEL_ERROR, true, count_sink, "%d", evaluate(1));
+    HWC_LOG_IF(HWC_LOG_LEVEL_WARN, true, count_sink, "%d", evaluate(2));
+    HWC_LOG_IF(HWC_LOG_LEVEL_INFO, true, count_sink, "%d", evaluate(3));
+    HWC_LOG_IF(HWC_LOG_LEVEL_DEBUG, true, count_sink, "%d", evaluate(4));
+    HWC_LOG_IF(HWC_LOG_LEVEL_VERBOSE, true, count_sink, "%d", evaluate(5));
+    HWC_LOG_IF(HWC_LOG_LEVEL_ERROR, false, count_sink, "%d", evaluate(6));
+    if (sEmitted != uint32_t(level) || sEvaluated != uint32_t(level)) {
+      printf("level %d: %u emitted, %u evaluated\n", level, sEmitted,
+             sEvaluated);
+      ok = false;
+    }
+  }
+  ok = check("messages above the level are skipped unevaluated", ok) && ok;
+
+  SetLogLevel(HWC_LOG_LEVEL_MAX + 1);
+  bool clamped = gLogLevel.load() == HWC_LOG_LEVEL_MAX;
+  SetLogLevel(-1);
+  clamped = clamped && gLogLevel.load() == HWC_LOG_LEVEL_NONE;
+  ok = check("level clamped to none..max", clamped) && ok;
+  return ok;
+}
+
+#define SITE(level, n) \
+  HWC_LOG_IF(level, debug, count_sink, "site %d %u", n, frame)
+#define SITES8(level, n)                                                   \
+  SITE(level, n); SITE(level, n + 1); SITE(level, n + 2); SITE(level, n + 3); \
+  SITE(level, n + 4); SITE(level, n + 5); SITE(level, n + 6);              \
+  SITE(level, n + 7)
+#define SITES64(level)                                                      \
+  SITES8(level, 0); SITES8(level, 8); SITES8(level, 16); SITES8(level, 24); \
+  SITES8(level, 32); SITES8(level, 40); SITES8(level, 48);                 \
+  SITES8(level, 56)
+
+// A frame's worth of debug logging. debug is false, as the per-module debug
+// switches normally are, but is not known to the compiler.
+static void __attribute__((noinline)) frame_debug(bool debug, uint32_t frame) {
+  SITES64(HWC_LOG_LEVEL_DEBUG);
+}
+
+// The same sites at a level above any ceiling, so compiled out.
+static void __attribute__((noinline)) frame_compiled_out(bool debug,
+                                                         uint32_t frame) {
+  SITES64(HWC_LOG_LEVEL_VERBOSE + 1);
+}
+
+static double time_frames(void (*frame)(bool, uint32_t), uint32_t frames) {
+  volatile bool debug = false;
+  for (uint32_t f = 0; f < frames / 10; f++)
+    frame(debug, f);
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t f = 0; f < frames; f++)
+    frame(debug, f);
+  return std::chrono::duration<double, std::nano>(
+             std::chrono::steady_clock::now() - start)
+             .count() /
+         frames;
+}
+
+static void benchmark(uint32_t frames) {
+  printf("\n%-36s %12s\n", "64 debug sites per frame", "ns/frame");
+  SetLogLevel(HWC_LOG_LEVEL_DEFAULT);
+  printf("%-36s %12.1f\n", "default level", time_frames(frame_debug, frames));
+  if (HWC_LOG_LEVEL_MAX >= HWC_LOG_LEVEL_DEBUG) {
+    SetLogLevel(HWC_LOG_LEVEL_DEBUG);
+    printf("%-36s %12.1f\n", "debug level, conditions false",
+           time_frames(frame_debug, frames));
+  }
+  printf("%-36s %12.1f\n", "compiled out",
+         time_frames(frame_compiled_out, frames));
+}
+
+static void usage(const char* name) {
+  printf("usage: %s [-n benchmark frames]\n", name);
+}
+
+int main(int argc, char* argv[]) {
+  uint32_t frames = 1000000;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:h")) != -1) {
+    switch (opt) {
+      case 'n':
+        frames = atoi(optarg) > 0 ? atoi(optarg) : 1;
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+
+  bool ok = test_levels();
+  benchmark(frames);
+
+  printf("\n%s\n", ok ? "PASSED" : "FAILED");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,158 @@
+/*
+// Copyright (c) 2017 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+// Stress test and latency benchmark for the DisplayQueue incoming work queue.
+// Several producers push sequenced items while one consumer, woken through an
+// eventfd as the DisplayQueue worker is, checks that nothing is lost or
+// duplicated and that each producer's items arrive in order.
+// Configure with --enable-tsan to check the queue under ThreadSanitizer.
+
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include <mpscqueue.h>
+
+struct work_item {
+  uint32_t producer;
+  uint32_t sequence;
+  int64_t queued_ns;
+};
+
+static const size_t kQueueCapacity = 64;
+
+static int64_t now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+static void usage(const char *name) {
+  printf("usage: %s [-p producers] [-n items per producer]\n", name);
+}
+
+int main(int argc, char *argv[]) {
+  uint32_t producers = 3;
+  uint32_t items = 200000;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "p:n:h")) != -1) {
+    switch (opt) {
+      case 'p':
+        producers = std::max(1, atoi(optarg));
+        break;
+      case 'n':
+        items = std::max(1, atoi(optarg));
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+
+  hwcomposer::MPSCQueue<work_item, kQueueCapacity> queue;
+  int wake_fd = eventfd(0, EFD_SEMAPHORE);
+  if (wake_fd < 0) {
+    printf("eventfd failed\n");
+    return 1;
+  }
+
+  std::atomic<uint32_t> full_retries(0);
+  std::vector<std::thread> threads;
+  for (uint32_t p = 0; p < producers; ++p) {
+    threads.emplace_back([&, p]() {
+      for (uint32_t i = 0; i < items; ++i) {
+        work_item item = {p, i, now_ns()};
+        while (!queue.Push(item)) {
+          ++full_retries;
+          std::this_thread::yield();
+          item.queued_ns = now_ns();
+        }
+        uint64_t inc = 1;
+        if (write(wake_fd, &inc, sizeof(inc)) < 0)
+          printf("eventfd write failed\n");
+      }
+    });
+  }
+
+  std::vector<uint32_t> next(producers, 0);
+  std::vector<int64_t> latency;
+  latency.reserve((size_t)producers * items);
+  uint64_t total = (uint64_t)producers * items;
+  uint64_t received = 0;
+  int errors = 0;
+
+  while (received < total) {
+    work_item item;
+    if (!queue.Pop(&item)) {
+      struct pollfd pfd = {wake_fd, POLLIN, 0};
+      if (poll(&pfd, 1, 1000) <= 0) {
+        printf("timeout waiting for work (%llu/%llu)\n",
+               (unsigned long long)received, (unsigned long long)total);
+        errors++;
+        break;
+      }
+      uint64_t count;
+      if (read(wake_fd, &count, sizeof(count)) < 0)
+        printf("eventfd read failed\n");
+      continue;
+    }
+    latency.push_back(now_ns() - item.queued_ns);
+    if (item.producer >= producers || item.sequence != next[item.producer]) {
+      if (errors++ < 10)
+        printf("out of order: producer %u got %u expected %u\n", item.producer,
+               item.sequence,
+               item.producer < producers ? next[item.producer] : 0);
+    } else {
+      next[item.producer]++;
+    }
+    received++;
+  }
+
+  for (auto &t : threads)
+    t.join();
+  close(wake_fd);
+
+  work_item extra;
+  if (queue.Pop(&extra)) {
+    printf("unexpected extra item\n");
+    errors++;
+  }
+
+  if (!latency.empty()) {
+    std::sort(latency.begin(), latency.end());
+    size_t n = latency.size();
+    printf("enqueue-to-consume latency over %zu items (%u producers):\n", n,
+           producers);
+    printf("  p50 %lld ns  p90 %lld ns  p99 %lld ns  max %lld ns\n",
+           (long long)latency[n / 2], (long long)latency[n * 9 / 10],
+           (long long)latency[n * 99 / 100], (long long)latency[n - 1]);
+    printf("  queue full retries %u\n", full_retries.load());
+  }
+
+  printf("\n%s\n", errors ? "FAILED" : "PASSED");
+  return errors ? 1 : 0;
+}
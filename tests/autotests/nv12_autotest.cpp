@@ -0,0 +1,383 @@
+/*
+// Copyright (c) 2017 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+// Checks the RGB to NV12 conversion the GL cell composer uses for video
+// targets against a double precision reference written from the BT.601 and
+// BT.709 definitions, for both matrices, both ranges and both chroma sitings,
+// with PSNR thresholds per plane. Also checks the reference is sensitive
+// enough to catch the wrong matrix or siting, that passes blended over each
+// other in YUV give the conversion of the RGB blend, and reports the bytes
+// written per frame against an RGBA target.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+#include "Nv12Converter.h"
+#include "layer.h"
+
+using hwcomposer::HwcRect;
+using hwcomposer::Layer;
+using hwcomposer::Nv12Converter;
+
+// A conversion matching the reference differs by at most rounding.
+static const double kMinPsnr = 48.0;
+
+struct Image {
+  uint32_t width;
+  uint32_t height;
+  std::vector<uint8_t> rgba;
+};
+
+struct Planes {
+  std::vector<uint8_t> y;
+  std::vector<uint8_t> uv;
+};
+
+static void make_gradient(Image& image) {
+  for (uint32_t y = 0; y < image.height; y++) {
+    for (uint32_t x = 0; x < image.width; x++) {
+      uint8_t* p = &image.rgba[(y * image.width + x) * 4];
+      p[0] = x * 255 / (image.width - 1);
+      p[1] = y * 255 / (image.height - 1);
+      p[2] = 128 + 127 * sin(x * 0.05) * cos(y * 0.03);
+      p[3] = 255;
+    }
+  }
+}
+
+// Saturated bars 7 pixels wide, so the edges fall on odd and even columns.
+static void make_bars(Image& image) {
+  static const uint8_t kBars[][3] = {{255, 255, 255}, {255, 255, 0},
+                                     {0, 255, 255},   {0, 255, 0},
+                                     {255, 0, 255},   {255, 0, 0},
+                                     {0, 0, 255},     {0, 0, 0}};
+  for (uint32_t y = 0; y < image.height; y++) {
+    for (uint32_t x = 0; x < image.width; x++) {
+      const uint8_t* bar = kBars[(x / 7 + y / 9) % 8];
+      uint8_t* p = &image.rgba[(y * image.width + x) * 4];
+      memcpy(p, bar, 3);
+      p[3] = 255;
+    }
+  }
+}
+
+static void make_noise(Image& image) {
+  srand(1);
+  for (uint8_t& c : image.rgba)
+    c = rand() & 0xff;
+}
+
+static uint8_t to_byte(double v) {
+  v = floor(v + 0.5);
+  return v < 0 ? 0 : (v > 255 ? 255 : v);
+}
+
+// Reference conversion in double precision, 0-255 scale.
+static void reference(const Image& image, Nv12Converter::EMatrix matrix,
+                      bool full_range, Nv12Converter::ESiting siting,
+                      Planes& out) {
+  const double kr = matrix == Nv12Converter::BT709 ? 0.2126 : 0.299;
+  const double kb = matrix == Nv12Converter::BT709 ? 0.0722 : 0.114;
+  const double kg = 1 - kr - kb;
+  const double y_scale = full_range ? 1.0 : 219.0 / 255.0;
+  const double y_offset = full_range ? 0.0 : 16.0;
+  const double c_scale = full_range ? 1.0 : 224.0 / 255.0;
+  const int32_t w = image.width, h = image.height;
+  const int32_t cw = (w + 1) / 2, ch = (h + 1) / 2;
+
+  auto pixel = [&](int32_t x, int32_t y, int32_t c) -> double {
+    x = x < 0 ? 0 : (x >= w ? w - 1 : x);
+    y = y < 0 ? 0 : (y >= h ? h - 1 : y);
+    return image.rgba[(y * w + x) * 4 + c];
+  };
+
+  out.y.resize(w * h);
+  for (int32_t y = 0; y < h; y++) {
+    for (int32_t x = 0; x < w; x++) {
+      const double luma = kr * pixel(x, y, 0) + kg * pixel(x, y, 1) +
+                          kb * pixel(x, y, 2);
+      out.y[y * w + x] = to_byte(y_offset + y_scale * luma);
+    }
+  }
+
+  // MPEG-2 chroma sits on the even column, halfway between two rows: a
+  // [1 2 1] filter across columns. MPEG-1 chroma sits in the middle of the
+  // 2x2 block. Both are halfway between the two rows.
+  out.uv.resize(cw * ch * 2);
+  for (int32_t cy = 0; cy < ch; cy++) {
+    for (int32_t cx = 0; cx < cw; cx++) {
+      double rgb[3] = {0, 0, 0};
+      for (int32_t c = 0; c < 3; c++) {
+        for (int32_t row = 2 * cy; row <= 2 * cy + 1; row++) {
+          if (siting == Nv12Converter::SitingLeft)
+            rgb[c] += (pixel(2 * cx - 1, row, c) + 2 * pixel(2 * cx, row, c) +
+                       pixel(2 * cx + 1, row, c)) / 8;
+          else
+            rgb[c] += (pixel(2 * cx, row, c) + pixel(2 * cx + 1, row, c)) / 4;
+        }
+      }
+      const double luma = kr * rgb[0] + kg * rgb[1] + kb * rgb[2];
+      out.uv[(cy * cw + cx) * 2 + 0] =
+          to_byte(128 + c_scale * (rgb[2] - luma) / (2 * (1 - kb)));
+      out.uv[(cy * cw + cx) * 2 + 1] =
+          to_byte(128 + c_scale * (rgb[0] - luma) / (2 * (1 - kr)));
+    }
+  }
+}
+
+static void convert(const Image& image, const Nv12Converter& converter,
+                    Planes& out) {
+  const uint32_t cw = (image.width + 1) / 2, ch = (image.height + 1) / 2;
+  out.y.resize(image.width * image.height);
+  out.uv.resize(cw * ch * 2);
+  converter.convert(image.rgba.data(), image.width * 4, image.width,
+                    image.height, out.y.data(), image.width, out.uv.data(),
+                    cw * 2);
+}
+
+static double psnr(const std::vector<uint8_t>& a,
+                   const std::vector<uint8_t>& b, uint32_t* max_error) {
+  double sse = 0;
+  *max_error = 0;
+  for (size_t i = 0; i < a.size(); i++) {
+    const int32_t d = int32_t(a[i]) - b[i];
+    sse += d * d;
+    if (uint32_t(abs(d)) > *max_error)
+      *max_error = abs(d);
+  }
+  if (sse == 0)
+    return INFINITY;
+  return 10 * log10(255.0 * 255.0 * a.size() / sse);
+}
+
+// Converts the image and compares it with the reference for the given
+// parameters. Returns the lower of the two plane PSNRs.
+static double compare(const Image& image, const Nv12Converter& converter,
+                      Nv12Converter::EMatrix matrix, bool full_range,
+                      Nv12Converter::ESiting siting, const char* name,
+                      bool print) {
+  Planes actual, expected;
+  convert(image, converter, actual);
+  reference(image, matrix, full_range, siting, expected);
+  uint32_t y_error, uv_error;
+  const double y_psnr = psnr(actual.y, expected.y, &y_error);
+  const double uv_psnr = psnr(actual.uv, expected.uv, &uv_error);
+  if (print)
+    printf("  %-10s %ux%u %-50s Y %6.1fdB (max %u) CbCr %6.1fdB (max %u)\n",
+           name, image.width, image.height, converter.dump().string(), y_psnr,
+           y_error, uv_psnr, uv_error);
+  return y_psnr < uv_psnr ? y_psnr : uv_psnr;
+}
+
+static bool test_against_reference() {
+  bool ok = true;
+  static const uint32_t kSizes[][2] = {{640, 360}, {63, 35}};
+  static const struct {
+    const char* name;
+    void (*make)(Image&);
+  } kImages[] = {
+      {"gradient", make_gradient}, {"bars", make_bars}, {"noise", make_noise}};
+
+  printf("Conversion against the reference, PSNR threshold %.0fdB:\n",
+         kMinPsnr);
+  for (const auto& size : kSizes) {
+    for (const auto& source : kImages) {
+      Image image;
+      image.width = size[0];
+      image.height = size[1];
+      image.rgba.resize(image.width * image.height * 4);
+      source.make(image);
+
+      for (uint32_t m = 0; m < 2; m++) {
+        for (uint32_t s = 0; s < 2; s++) {
+          for (uint32_t full = 0; full < 2; full++) {
+            const auto matrix = Nv12Converter::EMatrix(m);
+            const auto siting = Nv12Converter::ESiting(s);
+            Nv12Converter converter(
+                Nv12Converter::Params(matrix, full, siting));
+            if (compare(image, converter, matrix, full, siting, source.name,
+                        true) < kMinPsnr)
+              ok = false;
+          }
+        }
+      }
+
+      // The reference must catch the wrong matrix or siting on hard edges.
+      if (source.make == make_bars) {
+        Nv12Converter left(Nv12Converter::Params(Nv12Converter::BT709, false,
+                                                 Nv12Converter::SitingLeft));
+        const double wrong_siting =
+            compare(image, left, Nv12Converter::BT709, false,
+                    Nv12Converter::SitingCenter, "", false);
+        const double wrong_matrix =
+            compare(image, left, Nv12Converter::BT601, false,
+                    Nv12Converter::SitingLeft, "", false);
+        printf("  wrong siting %.1fdB, wrong matrix %.1fdB\n", wrong_siting,
+               wrong_matrix);
+        if (wrong_siting >= kMinPsnr || wrong_matrix >= kMinPsnr)
+          ok = false;
+      }
+    }
+  }
+  return ok;
+}
+
+// Primaries in limited range, from the standards' tables.
+static bool test_known_values() {
+  static const struct {
+    Nv12Converter::EMatrix matrix;
+    uint8_t rgb[3];
+    uint8_t yuv[3];
+  } kValues[] = {
+      {Nv12Converter::BT601, {255, 255, 255}, {235, 128, 128}},
+      {Nv12Converter::BT601, {0, 0, 0}, {16, 128, 128}},
+      {Nv12Converter::BT601, {255, 0, 0}, {81, 90, 240}},
+      {Nv12Converter::BT601, {0, 0, 255}, {41, 240, 110}},
+      {Nv12Converter::BT709, {255, 0, 0}, {63, 102, 240}},
+      {Nv12Converter::BT709, {0, 255, 0}, {173, 42, 26}},
+  };
+  bool ok = true;
+  for (const auto& v : kValues) {
+    uint8_t rgba[2 * 2 * 4], y[4], uv[2];
+    for (uint32_t i = 0; i < 4; i++) {
+      memcpy(&rgba[i * 4], v.rgb, 3);
+      rgba[i * 4 + 3] = 255;
+    }
+    Nv12Converter converter(Nv12Converter::Params(v.matrix));
+    converter.convert(rgba, 8, 2, 2, y, 2, uv, 2);
+    if (y[0] != v.yuv[0] || uv[0] != v.yuv[1] || uv[1] != v.yuv[2]) {
+      printf("%s (%u,%u,%u) -> (%u,%u,%u), expected (%u,%u,%u)\n",
+             converter.dump().string(), v.rgb[0], v.rgb[1], v.rgb[2], y[0],
+             uv[0], uv[1], v.yuv[0], v.yuv[1], v.yuv[2]);
+      ok = false;
+    }
+  }
+  printf("Known values %s\n", ok ? "ok" : "FAILED");
+  return ok;
+}
+
+static bool test_select() {
+  Layer target;
+  target.setSrc(HwcRect<float>(0, 0, 1920, 1080));
+  target.setDst(HwcRect<int>(0, 0, 1920, 1080));
+  bool ok = Nv12Converter::select(target, 0).mMatrix == Nv12Converter::BT709;
+  ok = ok && Nv12Converter::select(target, 601).mMatrix == Nv12Converter::BT601;
+
+  target.setDst(HwcRect<int>(0, 0, 720, 480));
+  ok = ok && Nv12Converter::select(target, 0).mMatrix == Nv12Converter::BT601;
+  ok = ok && Nv12Converter::select(target, 709).mMatrix == Nv12Converter::BT709;
+
+  hwcomposer::DataSpace dataSpace = target.getDataSpace();
+  dataSpace.standard = hwcomposer::EDataSpaceStandard::BT709;
+  dataSpace.range = hwcomposer::EDataSpaceRange::Full;
+  target.setDataSpace(dataSpace);
+  const Nv12Converter::Params params = Nv12Converter::select(target, 0);
+  ok = ok && params.mMatrix == Nv12Converter::BT709 && params.mbFullRange &&
+       params.mSiting == Nv12Converter::SitingLeft;
+
+  // The cell is composed once per chroma tap.
+  Nv12Converter converter(params);
+  HWCString shader = converter.getChromaOutput(false);
+  uint32_t composes = 0;
+  for (const char* p = shader.string(); (p = strstr(p, "compose(")); p++)
+    composes++;
+  ok = ok && composes == converter.getNumChromaTaps();
+
+  printf("Matrix selection %s\n", ok ? "ok" : "FAILED");
+  return ok;
+}
+
+// A cell needing two passes writes the conversion of the first pass, then
+// blends the second over it with (ONE, ONE_MINUS_SRC_ALPHA), its offsets
+// scaled by its alpha. This must equal converting the RGB blend.
+static bool test_blend_passes() {
+  bool ok = true;
+  srand(37);
+  for (uint32_t m = 0; m < 4; m++) {
+    Nv12Converter converter(Nv12Converter::Params(
+        (m & 1) ? Nv12Converter::BT709 : Nv12Converter::BT601, m & 2));
+    double worst = 0;
+    for (uint32_t i = 0; i < 1000; i++) {
+      // Premultiplied source over an opaque destination.
+      double dst[3], src[3], alpha = rand() / double(RAND_MAX);
+      for (uint32_t c = 0; c < 3; c++) {
+        dst[c] = rand() / double(RAND_MAX);
+        src[c] = alpha * rand() / double(RAND_MAX);
+      }
+      for (uint32_t r = 0; r < 3; r++) {
+        double first = converter.getMatrix(r, 3);
+        double second = alpha * converter.getMatrix(r, 3);
+        double blended = converter.getMatrix(r, 3);
+        for (uint32_t c = 0; c < 3; c++) {
+          first += converter.getMatrix(r, c) * dst[c];
+          second += converter.getMatrix(r, c) * src[c];
+          blended += converter.getMatrix(r, c) * (src[c] + (1 - alpha) * dst[c]);
+        }
+        worst = fmax(worst, fabs(second + (1 - alpha) * first - blended));
+      }
+    }
+    if (worst > 1e-9) {
+      printf("%s: blended passes differ by %g\n",
+             converter.dump().string(), worst);
+      ok = false;
+    }
+  }
+
+  // Only the blended outputs scale their offsets.
+  Nv12Converter converter{Nv12Converter::Params()};
+  ok = ok && !strstr(converter.getLumaOutput(false).string(), "* color.a");
+  ok = ok && strstr(converter.getLumaOutput(true).string(), "* color.a");
+  ok = ok && !strstr(converter.getChromaOutput(false).string(), "* color.a");
+  ok = ok && strstr(converter.getChromaOutput(true).string(), "* color.a");
+
+  printf("Blended passes %s\n", ok ? "ok" : "FAILED");
+  return ok;
+}
+
+static void report_bytes() {
+  static const uint32_t kSizes[][2] = {
+      {1280, 720}, {1920, 1080}, {3840, 2160}};
+  printf("\nBytes written to the target per frame:\n");
+  printf("%12s %12s %16s %12s %8s\n", "target", "NV12", "via RGBA copy",
+         "RGBA", "ratio");
+  for (const auto& size : kSizes) {
+    const uint32_t nv12 = Nv12Converter::getBytesWritten(size[0], size[1]);
+    const uint32_t rgba = size[0] * size[1] * 4;
+    char name[32];
+    snprintf(name, sizeof(name), "%ux%u", size[0], size[1]);
+    printf("%12s %12u %16u %12u %7.2fx\n", name, nv12, rgba + nv12, rgba,
+           double(rgba) / nv12);
+  }
+  printf("(the cells are drawn straight into the planes; \"via RGBA copy\" is "
+         "what composing into a full size RGBA texture first would write)\n");
+}
+
+int main(int, char*[]) {
+  bool ok = true;
+  ok = test_against_reference() && ok;
+  ok = test_known_values() && ok;
+  ok = test_select() && ok;
+  ok = test_blend_passes() && ok;
+  report_bytes();
+
+  printf("\n%s\n", ok ? "PASSED" : "FAILED");
+  return ok ? 0 : 1;
+}
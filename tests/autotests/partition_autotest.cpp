@@ -0,0 +1,259 @@
+/*
+// Copyright (c) 2017 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+// Checks PartitionedComposer::Partitioner on overlapping, abutting and fully
+// covered layers against a per-pixel reference, then benchmarks partitioning
+// random stacks and compares the pixels the cell composer shades with drawing
+// every layer whole.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <getopt.h>
+
+#include <chrono>
+#include <vector>
+
+#include "PartitionedComposer.h"
+#include "layer.h"
+
+using hwcomposer::Content;
+using hwcomposer::HwcRect;
+using hwcomposer::Layer;
+using hwcomposer::PartitionedComposer;
+
+typedef PartitionedComposer::Partitioner Partitioner;
+
+static const int32_t kWidth = 1920;
+static const int32_t kHeight = 1080;
+static const uint32_t kLayerCounts[] = {2, 4, 8, 16, 32};
+
+static void setup_layer(Layer& layer, int32_t left, int32_t top,
+                        int32_t right, int32_t bottom, bool opaque) {
+  layer.setHandle(
+      reinterpret_cast<HWCNativeHandle>(static_cast<uintptr_t>(0x1000)));
+  layer.setSrc(HwcRect<float>(0, 0, right - left, bottom - top));
+  layer.setDst(HwcRect<int>(left, top, right, bottom));
+  layer.setPlaneAlpha(1.0f);
+  layer.setBlending(hwcomposer::EBlendMode::PREMULT);
+  layer.setBufferFormat(opaque ? DRM_FORMAT_XBGR8888 : DRM_FORMAT_ABGR8888);
+  layer.onUpdateFlags();
+}
+
+// The layers visible at (x, y), as a mask: front to back down to the first
+// opaque layer.
+static uint64_t expected_layers(const std::vector<Layer>& layers, int32_t x,
+                                int32_t y) {
+  uint64_t mask = 0;
+  for (int32_t ly = layers.size() - 1; ly >= 0; ly--) {
+    const HwcRect<int>& r = layers[ly].getDst();
+    if (x < r.left || x >= r.right || y < r.top || y >= r.bottom)
+      continue;
+    mask |= uint64_t(1) << ly;
+    if (layers[ly].isOpaque())
+      break;
+  }
+  return mask;
+}
+
+// Checks the sets tile the target exactly and every pixel of every rect sees
+// the set's layers. Returns the number of sets, or -1 on failure.
+static int32_t check(const char* name, const std::vector<Layer>& layers,
+                     int32_t width, int32_t height) {
+  Partitioner partitioner;
+  Content::LayerStack stack(layers.data(), layers.size());
+  if (!partitioner.partition(stack, HwcRect<int>(0, 0, width, height))) {
+    printf("%s: partition failed\n", name);
+    return -1;
+  }
+
+  std::vector<uint8_t> covered(width * height, 0);
+  uint32_t indices[Partitioner::cMaxLayers];
+  bool ok = true;
+  for (uint32_t s = 0; s < partitioner.getNumSets(); s++) {
+    uint64_t mask = 0;
+    uint32_t n = partitioner.getLayers(s, indices);
+    for (uint32_t i = 0; i < n; i++) {
+      if (i && indices[i] <= indices[i - 1])
+        ok = false;
+      mask |= uint64_t(1) << indices[i];
+    }
+    const HwcRect<int>* rects = partitioner.getRects(s);
+    for (uint32_t i = 0; i < partitioner.getNumRects(s); i++) {
+      for (int32_t y = rects[i].top; y < rects[i].bottom; y++) {
+        for (int32_t x = rects[i].left; x < rects[i].right; x++) {
+          covered[y * width + x]++;
+          if (expected_layers(layers, x, y) != mask)
+            ok = false;
+        }
+      }
+    }
+  }
+  for (uint8_t c : covered) {
+    if (c != 1)
+      ok = false;
+  }
+  const uint32_t n = layers.size();
+  if (partitioner.getNumCells() > (2 * n + 1) * (2 * n + 1))
+    ok = false;
+
+  printf("%-24s %s%s", name, ok ? "ok" : "FAILED\n",
+         ok ? "" : partitioner.dump().string());
+  if (ok)
+    printf(" (%u sets, %u cells)\n", partitioner.getNumSets(),
+           partitioner.getNumCells());
+  return ok ? partitioner.getNumSets() : -1;
+}
+
+static bool test_configurations() {
+  bool ok = true;
+  const int32_t w = 64, h = 48;
+  std::vector<Layer> layers(3);
+
+  // Two translucent layers overlapping in a corner: each alone, both, and the
+  // uncovered background.
+  layers.resize(2);
+  setup_layer(layers[0], 4, 4, 32, 28, false);
+  setup_layer(layers[1], 20, 16, 56, 40, false);
+  ok = check("overlapping", layers, w, h) == 4 && ok;
+
+  // An opaque layer over a translucent one hides what is behind it.
+  setup_layer(layers[1], 20, 16, 56, 40, true);
+  ok = check("overlapping opaque", layers, w, h) == 3 && ok;
+
+  // Abutting layers share an edge but never a cell.
+  setup_layer(layers[0], 0, 0, 32, h, false);
+  setup_layer(layers[1], 32, 0, w, h, false);
+  ok = check("abutting", layers, w, h) == 2 && ok;
+
+  // A full screen opaque layer covers everything below it.
+  layers.resize(3);
+  setup_layer(layers[0], 0, 0, w, h, false);
+  setup_layer(layers[1], 10, 10, 30, 30, false);
+  setup_layer(layers[2], 0, 0, w, h, true);
+  ok = check("fully covered", layers, w, h) == 1 && ok;
+
+  // A translucent layer over all of the target keeps everything below.
+  setup_layer(layers[2], 0, 0, w, h, false);
+  ok = check("covered translucent", layers, w, h) == 2 && ok;
+
+  // Layers hanging off the target are clipped.
+  setup_layer(layers[0], -10, -10, 20, 20, false);
+  setup_layer(layers[1], 50, 40, 80, 60, true);
+  setup_layer(layers[2], 30, -5, 40, 100, false);
+  ok = check("clipped", layers, w, h) > 0 && ok;
+
+  // Random stacks.
+  srand(7);
+  for (uint32_t i = 0; i < 20; i++) {
+    layers.resize(1 + rand() % 12);
+    for (Layer& layer : layers) {
+      int32_t left = rand() % w - 8, top = rand() % h - 8;
+      setup_layer(layer, left, top, left + 1 + rand() % w,
+                  top + 1 + rand() % h, rand() % 4 == 0);
+    }
+    char name[32];
+    snprintf(name, sizeof(name), "random %u (%zu layers)", i, layers.size());
+    ok = check(name, layers, w, h) > 0 && ok;
+  }
+
+  // The cells are tracked in a 64 bit mask.
+  layers.resize(Partitioner::cMaxLayers + 1);
+  for (Layer& layer : layers)
+    setup_layer(layer, 0, 0, w, h, false);
+  Partitioner partitioner;
+  Content::LayerStack stack(layers.data(), layers.size());
+  if (partitioner.partition(stack, HwcRect<int>(0, 0, w, h))) {
+    printf("partitioned %zu layers\n", layers.size());
+    ok = false;
+  }
+  return ok;
+}
+
+// Window-like stacks: a full screen opaque background and windows of random
+// size and position, a third of them opaque.
+static void make_stack(std::vector<Layer>& layers, uint32_t count) {
+  layers.resize(count);
+  setup_layer(layers[0], 0, 0, kWidth, kHeight, true);
+  for (uint32_t ly = 1; ly < count; ly++) {
+    int32_t w = 200 + rand() % 1000, h = 150 + rand() % 600;
+    int32_t left = rand() % (kWidth - w), top = rand() % (kHeight - h);
+    setup_layer(layers[ly], left, top, left + w, top + h, rand() % 3 == 0);
+  }
+}
+
+static void benchmark(uint32_t iterations) {
+  printf("\nPartitioning %ux%u, %u random stacks per layer count\n", kWidth,
+         kHeight, iterations);
+  printf("%7s %10s %8s %8s %12s %12s %12s\n", "layers", "us/frame", "sets",
+         "cells", "whole MP", "cell MP", "samples MP");
+
+  Partitioner partitioner;
+  std::vector<Layer> layers;
+  srand(1);
+  for (uint32_t count : kLayerCounts) {
+    double us = 0;
+    uint64_t sets = 0, cells = 0, whole = 0, samples = 0;
+    for (uint32_t i = 0; i < iterations; i++) {
+      make_stack(layers, count);
+      Content::LayerStack stack(layers.data(), layers.size());
+
+      auto start = std::chrono::steady_clock::now();
+      partitioner.partition(stack, HwcRect<int>(0, 0, kWidth, kHeight));
+      us += std::chrono::duration<double, std::micro>(
+                std::chrono::steady_clock::now() - start)
+                .count();
+
+      sets += partitioner.getNumSets();
+      cells += partitioner.getNumCells();
+      samples += partitioner.getLayerSamples();
+      // Drawing every layer whole shades each of its pixels.
+      for (const Layer& layer : layers)
+        whole += uint64_t(layer.getDstWidth()) * layer.getDstHeight();
+    }
+    // The cells shade every target pixel once, sampling each of their layers.
+    printf("%7u %10.2f %8.1f %8.1f %12.2f %12.2f %12.2f\n", count,
+           us / iterations, double(sets) / iterations,
+           double(cells) / iterations, whole / 1e6 / iterations,
+           double(kWidth) * kHeight / 1e6, samples / 1e6 / iterations);
+  }
+}
+
+static void usage(const char* name) {
+  printf("usage: %s [-n benchmark iterations]\n", name);
+}
+
+int main(int argc, char* argv[]) {
+  uint32_t iterations = 200;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:h")) != -1) {
+    switch (opt) {
+      case 'n':
+        iterations = atoi(optarg) > 0 ? atoi(optarg) : 1;
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+
+  bool ok = test_configurations();
+  benchmark(iterations);
+
+  printf("\n%s\n", ok ? "PASSED" : "FAILED");
+  return ok ? 0 : 1;
+}
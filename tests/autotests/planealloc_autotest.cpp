@@ -0,0 +1,313 @@
+/*
+// Copyright (c) 2017 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+// Checks that the plane allocator's pruned and memoized searches choose the
+// same assignment as the exhaustive one. Random layer stacks (formats,
+// tiling, scaling, blending, protection) are allocated to random displays
+// (2 to 5 planes with random formats, capabilities, ZOrder tables and, on
+// some, complex constraints) by PlaneAllocatorJB::analyze in each search
+// mode. The memoized search runs twice, so the second run reuses the first
+// run's assignment; it must still match. With -t the modes are also timed.
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "Content.h"
+#include "DisplayCaps.h"
+#include "Layer.h"
+#include "PlaneAllocatorJB.h"
+#include "PlaneComposition.h"
+
+using intel::ufo::hwc::Content;
+using intel::ufo::hwc::DisplayCaps;
+using intel::ufo::hwc::EBlendMode;
+using intel::ufo::hwc::Layer;
+using intel::ufo::hwc::PlaneAllocatorJB;
+using intel::ufo::hwc::PlaneComposition;
+
+static const uint32_t kWidth = 1920;
+static const uint32_t kHeight = 1080;
+static const uint32_t kMaxPlanes = 5;
+
+static const int32_t kFormats[] = {
+    HAL_PIXEL_FORMAT_RGBA_8888, HAL_PIXEL_FORMAT_RGBX_8888,
+    HAL_PIXEL_FORMAT_RGB_565, HAL_PIXEL_FORMAT_NV12_Y_TILED_INTEL,
+};
+static const uint32_t kNumFormats = sizeof(kFormats) / sizeof(kFormats[0]);
+
+static const char* kModeNames[] = {"exhaustive", "pruned", "memoized"};
+
+static uint32_t sRandom = 1;
+
+static uint32_t rnd(uint32_t n) {
+  sRandom = sRandom * 1103515245u + 12345u;
+  return (sRandom >> 8) % n;
+}
+
+// A display with random planes. Complex constraints reject a fixed random
+// subset of the proposed plane arrangements.
+class RandomCaps : public DisplayCaps {
+ public:
+  RandomCaps(uint32_t numPlanes, bool complex) : mSeed(rnd(1 << 16)) {
+    setName("Random");
+    for (uint32_t pl = 0; pl < numPlanes; pl++) {
+      PlaneCaps* pCaps = new PlaneCaps();
+      std::vector<int32_t> formats;
+      for (uint32_t f = 0; f < kNumFormats; f++) {
+        if (pl == 0 || rnd(3))
+          formats.push_back(kFormats[f]);
+      }
+      pCaps->setDisplayFormats(formats);
+      pCaps->setTilingFormats(rnd(4) ? (TILE_LINEAR | TILE_X | TILE_Y)
+                                     : (TILE_LINEAR | TILE_X));
+      pCaps->setBlendingMasks(pl == 0 ? 0 : (rnd(4) ? ~0U : 0));
+      pCaps->enablePlaneAlpha(rnd(2));
+      pCaps->enableScaling(pl != 0 && rnd(2));
+      pCaps->enableDecrypt(rnd(3) == 0);
+      pCaps->enableWindowing(pl != 0 || rnd(2));
+      pCaps->enableSourceOffset();
+      pCaps->enableSourceCrop();
+      pCaps->enableDisable(pl != 0 || rnd(2));
+      pCaps->setMaxSourceWidth(kWidth * 2);
+      pCaps->setMaxSourceHeight(kHeight * 2);
+      pCaps->setMaxSourcePitch(kWidth * 8);
+      add(pCaps);
+    }
+
+    // Allow a random subset of the plane orders, always including A first.
+    std::string order;
+    for (uint32_t pl = 0; pl < numPlanes; pl++)
+      order += char('A' + pl);
+    do {
+      if (order[0] == 'A' || rnd(3))
+        mOrders.push_back(order);
+    } while (std::next_permutation(order.begin(), order.end()));
+    std::vector<ZOrderLUTEntry> lut;
+    for (uint32_t z = 0; z < mOrders.size(); z++)
+      lut.push_back(ZOrderLUTEntry(mOrders[z].c_str(), z, mOrders[z].c_str()));
+    setZOrderLUT(lut);
+
+    if (complex)
+      setComplexConstraints();
+  }
+
+  virtual void probe() {
+  }
+
+  virtual bool isSupported(const Content::Display& display,
+                           uint32_t zorder) const {
+    const Content::LayerStack& stack = display.getLayerStack();
+    uint32_t hash = mSeed ^ (zorder * 2654435761u);
+    for (uint32_t pl = 0; pl < stack.size(); pl++) {
+      hash = hash * 31 + stack[pl].getBufferFormat();
+      hash = hash * 31 + uint32_t(stack[pl].getDst().right);
+    }
+    return (hash % 5) != 0;
+  }
+
+ private:
+  uint32_t mSeed;
+  std::vector<std::string> mOrders;
+};
+
+// One random case: the display and a stack to put on it.
+struct Case {
+  Case(uint32_t seed, uint32_t maxLayers) {
+    sRandom = seed * 7919 + 17;
+    caps = new RandomCaps(2 + rnd(kMaxPlanes - 1), rnd(3) == 0);
+    layers.resize(1 + rnd(maxLayers));
+    for (uint32_t ly = 0; ly < layers.size(); ly++) {
+      Layer& layer = layers[ly];
+      bool full = ly == 0 || rnd(4) == 0;
+      int32_t x = full ? 0 : rnd(kWidth / 2);
+      int32_t y = full ? 0 : rnd(kHeight / 2);
+      int32_t w = full ? kWidth : 64 + rnd(kWidth / 2);
+      int32_t h = full ? kHeight : 64 + rnd(kHeight / 2);
+      float scale = rnd(3) == 0 ? 0.5f : 1.0f;
+      hwc_rect_t dst = {x, y, x + w, y + h};
+      hwc_frect_t src = {0, 0, w * scale, h * scale};
+      layer.setDst(dst);
+      layer.setSrc(src);
+      layer.setBufferFormat(kFormats[rnd(kNumFormats)]);
+      layer.setBufferTilingFormat(rnd(2) ? TILE_X : TILE_LINEAR);
+      layer.setBlending(ly && rnd(2) ? EBlendMode::PREMULT : EBlendMode::NONE);
+      layer.setPlaneAlpha(rnd(6) ? 1.0f : 0.5f);
+      if (rnd(12) == 0)
+        layer.setBufferPavpSession(1, 1, 1);
+      layer.onUpdateFlags();
+    }
+    display.setWidth(kWidth);
+    display.setHeight(kHeight);
+    display.setRefresh(60);
+    display.setFormat(INTEL_HWC_DEFAULT_HAL_PIXEL_FORMAT);
+    display.editLayerStack() =
+        Content::LayerStack(layers.data(), layers.size());
+    display.editLayerStack().updateLayerFlags();
+    bIdle = rnd(4) == 0;
+  }
+  ~Case() {
+    delete caps;
+  }
+
+  RandomCaps* caps;
+  std::vector<Layer> layers;
+  Content::Display display;
+  bool bIdle;
+};
+
+struct Result {
+  bool ok;
+  uint32_t zorder;
+  PlaneAllocatorJB::Stats stats;
+};
+
+static Result analyze(const Case& c, PlaneAllocatorJB::ESearch search) {
+  Result result;
+  PlaneComposition composition;
+  PlaneAllocatorJB allocator(c.bIdle);
+  allocator.setSearch(search);
+  result.ok = allocator.analyze(c.display, *c.caps, composition);
+  result.zorder = composition.getZOrder();
+  result.stats = allocator.getStats();
+  return result;
+}
+
+// The shared plane only means something for collapsed layers.
+static bool same(const Result& a, const Result& b, uint32_t numPlanes) {
+  if (a.ok != b.ok)
+    return false;
+  if (!a.ok)
+    return true;
+  if (a.zorder != b.zorder || a.stats.mScore != b.stats.mScore ||
+      a.stats.mAssigned != b.stats.mAssigned)
+    return false;
+  for (uint32_t ly = 0; ly < a.stats.mAssigned.size(); ly++) {
+    if (a.stats.mAssigned[ly] == numPlanes &&
+        a.stats.mShared[ly] != b.stats.mShared[ly])
+      return false;
+  }
+  return true;
+}
+
+static bool test_search(uint32_t cases, uint32_t maxLayers) {
+  uint32_t mismatches = 0, solved = 0, reused = 0;
+  uint64_t permutations = 0, prunedPermutations = 0;
+  for (uint32_t i = 0; i < cases; i++) {
+    Case c(i, maxLayers);
+    const uint32_t numPlanes = c.caps->getNumPlanes();
+    Result exhaustive = analyze(c, PlaneAllocatorJB::SEARCH_EXHAUSTIVE);
+    Result pruned = analyze(c, PlaneAllocatorJB::SEARCH_PRUNED);
+    Result memoized = analyze(c, PlaneAllocatorJB::SEARCH_MEMOIZED);
+    Result again = analyze(c, PlaneAllocatorJB::SEARCH_MEMOIZED);
+
+    const Result* results[] = {&pruned, &memoized, &again};
+    for (uint32_t m = 0; m < 3; m++) {
+      if (!same(exhaustive, *results[m], numPlanes)) {
+        printf("case %u (%zu layers, %u planes): %s%s differs from exhaustive\n",
+               i, c.layers.size(), numPlanes, kModeNames[std::min(m + 1, 2u)],
+               m == 2 ? " (reused)" : "");
+        mismatches++;
+      }
+    }
+    if (exhaustive.ok) {
+      solved++;
+      reused += again.stats.mbReused ? 1 : 0;
+      permutations += exhaustive.stats.mPermutations;
+      prunedPermutations += pruned.stats.mPermutations;
+    }
+  }
+
+  printf("%u cases, %u solved, %u mismatches, %u reused; permutations scored: "
+         "exhaustive %llu pruned %llu\n",
+         cases, solved, mismatches, reused, (unsigned long long)permutations,
+         (unsigned long long)prunedPermutations);
+  bool ok = mismatches == 0 && solved > 0 && reused == solved;
+  printf("%s: search modes agree\n", ok ? "ok" : "FAIL");
+  return ok;
+}
+
+// Average time of analyze in each mode, over the same cases.
+static void time_search(uint32_t cases, uint32_t maxLayers, uint32_t repeats) {
+  printf("\n%10s %12s\n", "search", "analyze us");
+  const PlaneAllocatorJB::ESearch modes[] = {
+      PlaneAllocatorJB::SEARCH_EXHAUSTIVE, PlaneAllocatorJB::SEARCH_PRUNED,
+      PlaneAllocatorJB::SEARCH_MEMOIZED};
+  for (uint32_t m = 0; m < 3; m++) {
+    double total = 0;
+    for (uint32_t i = 0; i < cases; i++) {
+      Case c(i, maxLayers);
+      auto start = std::chrono::steady_clock::now();
+      for (uint32_t r = 0; r < repeats; r++)
+        analyze(c, modes[m]);
+      total += std::chrono::duration<double, std::micro>(
+                   std::chrono::steady_clock::now() - start)
+                   .count();
+    }
+    printf("%10s %12.2f\n", kModeNames[m], total / (cases * repeats));
+  }
+}
+
+static void usage(const char* name) {
+  printf(
+      "usage: %s [-c cases] [-l max layers] [-t] [-n repeats]\n"
+      "  -c  random cases (1000)\n"
+      "  -l  most layers in a stack (9)\n"
+      "  -t  also time each search mode\n"
+      "  -n  analyses timed per case (10)\n",
+      name);
+}
+
+int main(int argc, char* argv[]) {
+  uint32_t cases = 1000;
+  uint32_t maxLayers = 9;
+  uint32_t repeats = 10;
+  bool timing = false;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "c:l:n:th")) != -1) {
+    switch (opt) {
+      case 'c':
+        cases = atoi(optarg) > 0 ? atoi(optarg) : 1;
+        break;
+      case 'l':
+        maxLayers = atoi(optarg) > 0 ? atoi(optarg) : 1;
+        break;
+      case 'n':
+        repeats = atoi(optarg) > 0 ? atoi(optarg) : 1;
+        break;
+      case 't':
+        timing = true;
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+
+  bool ok = test_search(cases, maxLayers);
+  if (timing)
+    time_search(cases, maxLayers, repeats);
+
+  printf("\n%s\n", ok ? "PASSED" : "FAILED");
+  return ok ? 0 : 1;
+}
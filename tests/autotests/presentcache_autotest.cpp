@@ -0,0 +1,487 @@
+/*
+// Copyright (c) 2017 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+// Counts the atomic commits DisplayQueue_old::QueueUpdate makes on a fake
+// KMS device for static and changing scenes. An idle present must be
+// answered from the present cache without a commit; damage, a new buffer,
+// new geometry or a new acquire fence must commit. Checks that reused
+// presents hand every layer the release fence of the last commit and return
+// its retire fence, that a pending modeset or LUT always commits, and that a
+// rejected commit is not reused and leaves the LUT pending.
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <deque>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include <drm_fourcc.h>
+
+#include <hwcbuffer.h>
+#include <hwclayer.h>
+#include <nativebufferhandler.h>
+
+#include "displayqueue.h"
+#include "fakekms.h"
+#include "overlaybuffermanager.h"
+
+using hwcomposer::DisplayQueue_old;
+using hwcomposer::FakeKms;
+using hwcomposer::HwcLayer;
+using hwcomposer::HwcRect;
+using hwcomposer::NativeBufferHandler;
+using hwcomposer::OverlayBufferManager;
+
+static const uint32_t kPresents = 600;
+static const uint32_t kLayers = 3;
+
+static int count_open_fds() {
+  int count = 0;
+  DIR *dir = opendir("/proc/self/fd");
+  if (!dir)
+    return -1;
+  while (readdir(dir))
+    count++;
+  closedir(dir);
+  return count;
+}
+
+// Each acquire fence is the read end of its own pipe, already signalled.
+static int create_fence() {
+  int fds[2];
+  if (pipe(fds) < 0)
+    return -1;
+  close(fds[1]);
+  return fds[0];
+}
+
+static ino_t fence_inode(int fence) {
+  struct stat st;
+  if (fence <= 0 || fstat(fence, &st) < 0)
+    return 0;
+  return st.st_ino;
+}
+
+// Looks up a property by name, the way DisplayQueue does.
+static uint32_t get_prop(int fd, uint32_t object, uint32_t type,
+                         const char *name) {
+  drmModeObjectPropertiesPtr props =
+      drmModeObjectGetProperties(fd, object, type);
+  uint32_t id = 0;
+  for (uint32_t i = 0; props && i < props->count_props && !id; i++) {
+    drmModePropertyPtr prop = drmModeGetProperty(fd, props->props[i]);
+    if (prop && !strcmp(prop->name, name))
+      id = prop->prop_id;
+    drmModeFreeProperty(prop);
+  }
+  drmModeFreeObjectProperties(props);
+  return id;
+}
+
+// Lights up crtc as the firmware would have. The planes of the first frame
+// are checked with TEST_ONLY commits that leave the mode out, which an
+// inactive CRTC would refuse, sending the frame to the GPU.
+static bool light_up(int fd, uint32_t crtc, uint32_t connector,
+                     drmModeModeInfo &mode) {
+  uint32_t blob = 0;
+  if (drmModeCreatePropertyBlob(fd, &mode, sizeof(mode), &blob))
+    return false;
+  drmModeAtomicReqPtr req = drmModeAtomicAlloc();
+  drmModeAtomicAddProperty(
+      req, connector,
+      get_prop(fd, connector, DRM_MODE_OBJECT_CONNECTOR, "CRTC_ID"), crtc);
+  drmModeAtomicAddProperty(
+      req, crtc, get_prop(fd, crtc, DRM_MODE_OBJECT_CRTC, "ACTIVE"), 1);
+  drmModeAtomicAddProperty(
+      req, crtc, get_prop(fd, crtc, DRM_MODE_OBJECT_CRTC, "MODE_ID"), blob);
+  int ret =
+      drmModeAtomicCommit(fd, req, DRM_MODE_ATOMIC_ALLOW_MODESET, NULL);
+  drmModeAtomicFree(req);
+  return !ret;
+}
+
+// Imports the buffers of the scene, which only exist as far as the fake
+// device is concerned.
+class SceneBufferHandler : public NativeBufferHandler {
+ public:
+  void Add(HWCNativeHandle handle, uint32_t width, uint32_t height) {
+    HwcBuffer &bo = buffers_[handle];
+    memset(&bo, 0, sizeof(bo));
+    bo.width = width;
+    bo.height = height;
+    bo.format = DRM_FORMAT_XRGB8888;
+    bo.pitches[0] = width * 4;
+    bo.gem_handles[0] = next_gem_handle_++;
+    bo.prime_fd = -1;
+  }
+
+  bool CreateBuffer(uint32_t, uint32_t, int, HWCNativeHandle *) override {
+    return false;
+  }
+
+  HWCNativeHandle CreateGraphicsBuffer(uint32_t, uint32_t, int,
+                                       int) override {
+    return NULL;
+  }
+
+  HWCNativeHandle ReAllocateGraphicsBuffer(uint32_t, uint32_t, int, int,
+                                           HWCNativeHandle) override {
+    return NULL;
+  }
+
+  bool DestroyBuffer(HWCNativeHandle) override {
+    return true;
+  }
+
+  bool ImportBuffer(HWCNativeHandle handle, HwcBuffer *bo) override {
+    std::map<HWCNativeHandle, HwcBuffer>::const_iterator buffer =
+        buffers_.find(handle);
+    if (buffer == buffers_.end())
+      return false;
+    *bo = buffer->second;
+    return true;
+  }
+
+  uint32_t GetTotalPlanes(HWCNativeHandle) override {
+    return 1;
+  }
+
+  void *Map(HWCNativeHandle, uint32_t, uint32_t, uint32_t, uint32_t,
+            uint32_t *, void **, size_t) override {
+    return NULL;
+  }
+
+  void UnMap(HWCNativeHandle, void *) override {
+  }
+
+ private:
+  std::map<HWCNativeHandle, HwcBuffer> buffers_;
+  uint32_t next_gem_handle_ = 1;
+};
+
+// A display queue on pipe 0 of its own fake device, lit up and booted with a
+// single layer: with a modeset pending, more than one layer would have to be
+// composed on the GPU. While reject is set every commit, test or real, is
+// refused.
+class Display {
+ public:
+  Display() {
+    FakeKms::Config config;
+    FakeKms::ParseConfig("clock=immediate", &config);
+    config.rule = [this](const std::vector<FakeKms::PlaneState> &) {
+      return reject_;
+    };
+    fd_ = FakeKms::Open(config);
+    kms_ = FakeKms::Get(fd_);
+    if (!kms_ || drmSetClientCap(fd_, DRM_CLIENT_CAP_ATOMIC, 1))
+      return;
+
+    drmModeResPtr res = drmModeGetResources(fd_);
+    uint32_t crtc = res->crtcs[0];
+    uint32_t connector_id = res->connectors[0];
+    drmModeFreeResources(res);
+    drmModeConnectorPtr connector = drmModeGetConnector(fd_, connector_id);
+    drmModeModeInfo mode = connector->modes[0];
+    drmModeFreeConnector(connector);
+    if (!light_up(fd_, crtc, connector_id, mode))
+      return;
+
+    buffer_handler_ = new SceneBufferHandler();
+    buffer_manager_.reset(new OverlayBufferManager());
+    buffer_manager_->Initialize(buffer_handler_);
+    queue_.reset(new DisplayQueue_old(fd_, crtc, buffer_manager_.get()));
+    if (!queue_->Initialize(mode.hdisplay, mode.vdisplay, 0, connector_id,
+                            mode) ||
+        !queue_->SetPowerMode(hwcomposer::kOn))
+      return;
+
+    buffer_handler_->Add(&boot_handle_, mode.hdisplay, mode.vdisplay);
+    boot_layer_.SetNativeHandle(&boot_handle_);
+    boot_layer_.SetSourceCrop(HwcRect<float>(0, 0, mode.hdisplay,
+                                             mode.vdisplay));
+    boot_layer_.SetDisplayFrame(HwcRect<int>(0, 0, mode.hdisplay,
+                                             mode.vdisplay));
+    std::vector<HwcLayer *> boot_layers(1, &boot_layer_);
+    int32_t retire_fence = -1;
+    valid_ = queue_->QueueUpdate(boot_layers, &retire_fence);
+    if (retire_fence > 0)
+      close(retire_fence);
+    boot_layer_.release_fence.Reset(-1);
+    boot_commits_ = kms_->GetStats().commits;
+  }
+
+  ~Display() {
+    if (queue_)
+      queue_->SetPowerMode(hwcomposer::kOff);
+    queue_.reset();
+    buffer_manager_.reset();
+    if (fd_ >= 0)
+      drmClose(fd_);
+  }
+
+  bool IsValid() const {
+    return valid_;
+  }
+
+  DisplayQueue_old &GetQueue() {
+    return *queue_;
+  }
+
+  SceneBufferHandler &GetBufferHandler() {
+    return *buffer_handler_;
+  }
+
+  // Real commits since the display booted, rejected ones included.
+  uint64_t GetCommits() const {
+    return kms_->GetStats().commits - boot_commits_;
+  }
+
+  void SetReject(bool reject) {
+    reject_ = reject;
+  }
+
+ private:
+  int fd_ = -1;
+  std::shared_ptr<FakeKms> kms_;
+  SceneBufferHandler *buffer_handler_ = NULL;
+  // Removes its framebuffers on destruction, so it goes before fd_ closes.
+  std::unique_ptr<OverlayBufferManager> buffer_manager_;
+  std::unique_ptr<DisplayQueue_old> queue_;
+  HWCNativeHandlesp boot_handle_;
+  HwcLayer boot_layer_;
+  uint64_t boot_commits_ = 0;
+  bool reject_ = false;
+  bool valid_ = false;
+};
+
+struct Scene {
+  Scene(Display &display, uint32_t count) : display(display) {
+    for (uint32_t i = 0; i < count; i++) {
+      layers.emplace_back(new HwcLayer());
+      HwcLayer *layer = layers.back().get();
+      layer->SetNativeHandle(NewBuffer());
+      layer->SetSourceCrop(HwcRect<float>(0, 0, 640, 480));
+      layer->SetDisplayFrame(HwcRect<int>(i * 100, 0, i * 100 + 640, 480));
+      pointers.emplace_back(layer);
+    }
+  }
+
+  // A buffer the display can import.
+  HWCNativeHandle NewBuffer() {
+    handles.emplace_back();
+    HWCNativeHandle handle = &handles.back();
+    display.GetBufferHandler().Add(handle, 640, 480);
+    return handle;
+  }
+
+  Display &display;
+  std::deque<HWCNativeHandlesp> handles;
+  std::vector<std::unique_ptr<HwcLayer>> layers;
+  std::vector<HwcLayer *> pointers;
+};
+
+// Present the scene once and hand back its retire fence's inode, or 0 if
+// it has none, and each layer's release fence inode. Returns false if the
+// present failed.
+static bool present(Display &display, Scene &scene, ino_t *retire_inode,
+                    std::vector<ino_t> *release_inodes) {
+  int32_t retire_fence = -1;
+  bool presented = display.GetQueue().QueueUpdate(scene.pointers,
+                                                  &retire_fence);
+  *retire_inode = fence_inode(retire_fence);
+  if (retire_fence > 0)
+    close(retire_fence);
+
+  release_inodes->clear();
+  for (HwcLayer *layer : scene.pointers) {
+    release_inodes->emplace_back(fence_inode(layer->release_fence.get()));
+    // The client is done with the fences once it has them.
+    layer->release_fence.Reset(-1);
+  }
+  return presented;
+}
+
+// Present the scene kPresents times on a new display, calling
+// change(frame, scene) before each present, and check every present that
+// did not commit returns the fences of the last commit.
+template <typename Change>
+static bool run(const char *name, uint64_t expected_commits, Change change) {
+  Display display;
+  if (!display.IsValid()) {
+    printf("%s: failed to set up the display\n", name);
+    return false;
+  }
+  Scene scene(display, kLayers);
+  bool ok = true;
+  ino_t last_retire = 0;
+  std::vector<ino_t> last_release;
+  uint64_t last_commits = 0;
+
+  for (uint32_t frame = 0; frame < kPresents; frame++) {
+    change(frame, scene);
+    ino_t retire;
+    std::vector<ino_t> release;
+    if (!present(display, scene, &retire, &release)) {
+      printf("%s: frame %u failed\n", name, frame);
+      ok = false;
+    }
+
+    // A reused frame must return the fences of the last commit.
+    if (display.GetCommits() == last_commits &&
+        (retire != last_retire || release != last_release)) {
+      printf("%s: frame %u returned different fences\n", name, frame);
+      ok = false;
+    }
+    last_retire = retire;
+    last_release = release;
+    last_commits = display.GetCommits();
+  }
+
+  printf("%-28s %4u presents  %4llu commits\n", name, kPresents,
+         (unsigned long long)display.GetCommits());
+  if (display.GetCommits() != expected_commits) {
+    printf("%s: expected %llu commits\n", name,
+           (unsigned long long)expected_commits);
+    ok = false;
+  }
+  return ok;
+}
+
+static bool check(const char *name, bool ok) {
+  printf("%-28s %s\n", name, ok ? "ok" : "FAILED");
+  return ok;
+}
+
+static bool test_guards() {
+  Display display;
+  if (!check("display set up", display.IsValid()))
+    return false;
+  // One layer, so the modeset below commits without GPU composition.
+  Scene scene(display, 1);
+  DisplayQueue_old &queue = display.GetQueue();
+  ino_t retire;
+  std::vector<ino_t> release;
+  bool ok = true;
+
+  ok = check("first present commits",
+             present(display, scene, &retire, &release) &&
+                 display.GetCommits() == 1) &&
+       ok;
+  ok = check("unchanged present is reused",
+             present(display, scene, &retire, &release) &&
+                 display.GetCommits() == 1) &&
+       ok;
+
+  queue.SetPowerMode(hwcomposer::kOn);
+  ok = check("pending modeset commits",
+             present(display, scene, &retire, &release) &&
+                 display.GetCommits() == 2) &&
+       ok;
+  ok = check("reused after modeset",
+             present(display, scene, &retire, &release) &&
+                 display.GetCommits() == 2) &&
+       ok;
+
+  queue.SetGamma(0.5, 0.5, 0.5);
+  ok = check("pending LUT commits",
+             present(display, scene, &retire, &release) &&
+                 display.GetCommits() == 3) &&
+       ok;
+
+  // A rejected commit, which still counts, leaves the LUT pending and
+  // nothing to reuse.
+  queue.SetGamma(1, 1, 1);
+  display.SetReject(true);
+  ok = check("rejected commit fails",
+             !present(display, scene, &retire, &release) &&
+                 display.GetCommits() == 4) &&
+       ok;
+  display.SetReject(false);
+  ok = check("LUT retried after rejection",
+             present(display, scene, &retire, &release) &&
+                 display.GetCommits() == 5) &&
+       ok;
+  ok = check("reused after LUT",
+             present(display, scene, &retire, &release) &&
+                 display.GetCommits() == 5) &&
+       ok;
+  return ok;
+}
+
+int main(int argc, char *argv[]) {
+  int fds_before = count_open_fds();
+  bool ok = test_guards();
+
+  ok = run("idle", 1, [](uint32_t, Scene &) {}) && ok;
+
+  hwcomposer::HwcRect<int> damage_rect(0, 0, 16, 16);
+  ok = run("damaged every 20 frames", kPresents / 20,
+           [&damage_rect](uint32_t frame, Scene &scene) {
+             hwcomposer::HwcRegion damage;
+             damage.kNumRects = frame % 20 == 0 ? 1 : 0;
+             damage.kRects = &damage_rect;
+             scene.layers[0]->SetSurfaceDamage(damage);
+           }) &&
+       ok;
+
+  // The same buffer rendered to again comes with an acquire fence.
+  ok = run("re-rendered every 10 frames", kPresents / 10,
+           [](uint32_t frame, Scene &scene) {
+             if (frame % 10 == 0)
+               scene.layers[2]->acquire_fence.Reset(create_fence());
+           }) &&
+       ok;
+
+  // A new buffer every 60 frames, as with a clock updating once a second.
+  ok = run("buffer every 60 frames", kPresents / 60,
+           [](uint32_t frame, Scene &scene) {
+             if (frame % 60 == 0)
+               scene.layers[0]->SetNativeHandle(scene.NewBuffer());
+           }) &&
+       ok;
+
+  ok = run("move every 100 frames", kPresents / 100,
+           [](uint32_t frame, Scene &scene) {
+             if (frame % 100 == 0)
+               scene.layers[1]->SetDisplayFrame(
+                   HwcRect<int>(frame, 0, frame + 640, 480));
+           }) &&
+       ok;
+
+  // Any change in layer count has to commit.
+  ok = run("layer added and removed", 3, [](uint32_t frame, Scene &scene) {
+         if (frame == 200)
+           scene.pointers.pop_back();
+         if (frame == 400)
+           scene.pointers.push_back(scene.layers.back().get());
+       }) &&
+       ok;
+
+  int fds_after = count_open_fds();
+  if (fds_after != fds_before) {
+    printf("fd leak: %d before, %d after\n", fds_before, fds_after);
+    ok = false;
+  }
+
+  printf("\n%s\n", ok ? "PASSED" : "FAILED");
+  return ok ? 0 : 1;
+}
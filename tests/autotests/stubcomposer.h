@@ -0,0 +1,57 @@
+/*
+// Copyright (c) 2017 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+#ifndef TESTS_AUTOTESTS_STUBCOMPOSER_H_
+#define TESTS_AUTOTESTS_STUBCOMPOSER_H_
+
+#include <stdint.h>
+
+#include <map>
+
+#include "CompositionManager.h"
+
+// Composer for CompositionManager tests. Accepts every composition at the
+// same cost, so requests for a stack it has seen return the cached entry,
+// and composes nothing. Counts evaluations and records the source layer
+// count of each target it is asked to acquire.
+class StubComposer : public hwcomposer::AbstractComposer {
+ public:
+  const char* getName() const {
+    return "StubComposer";
+  }
+  float onEvaluate(const hwcomposer::Content::LayerStack&,
+                   const hwcomposer::Layer&,
+                   AbstractComposer::CompositionState**, Cost) {
+    evaluations_++;
+    return 1.0f;
+  }
+  void onCompose(const hwcomposer::Content::LayerStack&,
+                 const hwcomposer::Layer&,
+                 AbstractComposer::CompositionState*) {
+  }
+  ResourceHandle onAcquire(const hwcomposer::Content::LayerStack& src,
+                           const hwcomposer::Layer& target) {
+    layers_[&target] = src.size();
+    return this;
+  }
+  void onRelease(ResourceHandle) {
+  }
+
+  uint32_t evaluations_ = 0;
+  std::map<const hwcomposer::Layer*, uint32_t> layers_;
+};
+
+#endif  // TESTS_AUTOTESTS_STUBCOMPOSER_H_
@@ -0,0 +1,262 @@
+/*
+// Copyright (c) 2017 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+// Checks the transparency detection the TransparencyFilter runs on UI layers
+// over video: synthetic buffers with a transparent hole over the video and a
+// black or transparent surround must be detected, and any single pixel of
+// another color, in any region, on a sampled row or not, must stop it. Every
+// available implementation must agree with the scalar one. Also times each
+// implementation on 1080p and 4K buffers.
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <vector>
+
+#include "transparencydetector.h"
+
+using hwcomposer::HwcRect;
+using hwcomposer::TransparencyDetector;
+
+static const uint32_t kBlack = TransparencyDetector::BLACK;
+static const uint32_t kTransparent = TransparencyDetector::TRANSPARENT;
+
+static const TransparencyDetector::EImplementation kImplementations[] = {
+    TransparencyDetector::IMPL_SCALAR, TransparencyDetector::IMPL_SSE2,
+    TransparencyDetector::IMPL_AVX2};
+
+struct Buffer {
+  uint32_t width;
+  uint32_t height;
+  uint32_t stride;
+  HwcRect<int> mask;
+  std::vector<uint32_t> pixels;
+
+  uint32_t& at(uint32_t x, uint32_t y) {
+    return pixels[y * stride + x];
+  }
+};
+
+// A letterboxed video hole: transparent inside mask, black bars outside.
+// Padding beyond width is filled with a color detection must never read.
+static void make_buffer(Buffer& b, uint32_t width, uint32_t height,
+                        uint32_t padding, const HwcRect<int>& mask,
+                        uint32_t surround = kBlack) {
+  b.width = width;
+  b.height = height;
+  b.stride = width + padding;
+  b.mask = mask;
+  b.pixels.assign(b.stride * height, 0xFFFFFFFF);
+  for (uint32_t y = 0; y < height; y++) {
+    for (uint32_t x = 0; x < width; x++) {
+      const bool inside = int(x) >= mask.left && int(x) < mask.right &&
+                          int(y) >= mask.top && int(y) < mask.bottom;
+      b.at(x, y) = inside ? kTransparent : surround;
+    }
+  }
+}
+
+static bool detect(const TransparencyDetector& detector, Buffer& b) {
+  return detector.detect(b.pixels.data(), b.width, b.height, b.stride, b.mask);
+}
+
+// Every available implementation must return expected.
+static bool check(const char* name, Buffer& b, bool expected) {
+  bool ok = true;
+  for (TransparencyDetector::EImplementation impl : kImplementations) {
+    if (!TransparencyDetector::isAvailable(impl))
+      continue;
+    TransparencyDetector detector(impl);
+    if (detect(detector, b) != expected) {
+      printf("%s: %s detected %d, expected %d\n", name, detector.getName(),
+             !expected, expected);
+      ok = false;
+    }
+  }
+  return ok;
+}
+
+static bool test_masks() {
+  bool ok = true;
+  Buffer b;
+
+  make_buffer(b, 1920, 1080, 64, HwcRect<int>(0, 140, 1920, 940));
+  ok = check("letterbox", b, true) && ok;
+  make_buffer(b, 1920, 1080, 0, HwcRect<int>(240, 0, 1680, 1080));
+  ok = check("pillarbox", b, true) && ok;
+  make_buffer(b, 1280, 720, 0, HwcRect<int>(0, 0, 1280, 720));
+  ok = check("no border", b, true) && ok;
+  make_buffer(b, 1280, 720, 0, HwcRect<int>(100, 100, 300, 200),
+              kTransparent);
+  ok = check("fully transparent", b, true) && ok;
+  // Odd sizes leave a remainder after the vector loops.
+  make_buffer(b, 1283, 721, 5, HwcRect<int>(7, 3, 1277, 719));
+  ok = check("odd sizes", b, true) && ok;
+  // Masks outside the buffer are clipped to it.
+  make_buffer(b, 640, 480, 0, HwcRect<int>(0, 0, 640, 480));
+  b.mask = HwcRect<int>(-10, -10, 700, 500);
+  ok = check("clipped mask", b, true) && ok;
+
+  // Black is only allowed outside the hole.
+  make_buffer(b, 640, 480, 0, HwcRect<int>(0, 0, 0, 0));
+  b.mask = HwcRect<int>(100, 100, 200, 200);
+  ok = check("black hole", b, false) && ok;
+  return ok;
+}
+
+// Sets one pixel to color at a time, at the edges and corners of each region
+// and on rows the sampled pass skips, and checks detection fails.
+static bool test_single_pixel(uint32_t color) {
+  const uint32_t kW = 1000, kH = 600;
+  const HwcRect<int> mask(101, 77, 899, 523);
+  Buffer b;
+  make_buffer(b, kW, kH, 24, mask);
+
+  const uint32_t xs[] = {0, 1, 7, 8, 31, 32, 100, 101, 102, 500,
+                         897, 898, 899, 900, 968, 991, 992, 998, 999};
+  const uint32_t ys[] = {0, 1, 7, 8, 9, 76, 77, 78, 300, 301,
+                         522, 523, 524, 590, 598, 599};
+  bool ok = true;
+  uint32_t cases = 0;
+  for (uint32_t y : ys) {
+    for (uint32_t x : xs) {
+      const uint32_t saved = b.at(x, y);
+      if (saved == color)
+        continue;
+      b.at(x, y) = color;
+      char name[64];
+      snprintf(name, sizeof(name), "pixel 0x%08x at %u,%u", color, x, y);
+      ok = check(name, b, false) && ok;
+      b.at(x, y) = saved;
+      cases++;
+    }
+  }
+  ok = check("after restoring pixels", b, true) && ok;
+  char name[64];
+  snprintf(name, sizeof(name), "single pixel 0x%08x", color);
+  printf("%-28s %s %u cases\n", name, ok ? "ok    " : "FAILED", cases);
+  return ok;
+}
+
+// Random buffers that are mostly valid, compared against the scalar result.
+static bool test_random(uint32_t cases) {
+  TransparencyDetector scalar(TransparencyDetector::IMPL_SCALAR);
+  uint32_t seed = 1;
+  auto next = [&seed]() {
+    seed = seed * 1103515245 + 12345;
+    return seed >> 8;
+  };
+
+  bool ok = true;
+  uint32_t detected = 0;
+  Buffer b;
+  for (uint32_t c = 0; c < cases; c++) {
+    const uint32_t w = 1 + next() % 200, h = 1 + next() % 60;
+    const int l = next() % (w + 1), t = next() % (h + 1);
+    const int r = l + next() % (w - l + 1), btm = t + next() % (h - t + 1);
+    make_buffer(b, w, h, next() % 9, HwcRect<int>(l, t, r, btm),
+                next() & 1 ? kBlack : kTransparent);
+    for (uint32_t n = next() % 3; n > 0; n--) {
+      static const uint32_t kColors[] = {kBlack, kTransparent, 0xFF000001,
+                                         0x01000000, 0x80000000};
+      b.at(next() % w, next() % h) = kColors[next() % 5];
+    }
+    const bool expected = detect(scalar, b);
+    detected += expected;
+    char name[64];
+    snprintf(name, sizeof(name), "random case %u", c);
+    ok = check(name, b, expected) && ok;
+  }
+  printf("%-28s %s %u cases, %u detected\n", "random", ok ? "ok    " : "FAILED",
+         cases, detected);
+  return ok;
+}
+
+// Times a full verify (a detected buffer, the worst case) and an early reject
+// (an opaque 64x64 icon over the video, which the sampled pass finds).
+static void benchmark(uint32_t width, uint32_t height, uint32_t iterations) {
+  Buffer pass, reject;
+  const HwcRect<int> mask(0, height / 8, width, height * 7 / 8);
+  make_buffer(pass, width, height, 0, mask);
+  make_buffer(reject, width, height, 0, mask);
+  for (uint32_t y = height / 2; y < height / 2 + 64; y++) {
+    for (uint32_t x = width / 2; x < width / 2 + 64; x++)
+      reject.at(x, y) = 0xFFFFFFFF;
+  }
+
+  printf("\n%ux%u, %u iterations\n", width, height, iterations);
+  printf("%-10s %14s %14s\n", "", "verify ms", "reject ms");
+  for (TransparencyDetector::EImplementation impl : kImplementations) {
+    if (!TransparencyDetector::isAvailable(impl))
+      continue;
+    TransparencyDetector detector(impl);
+    double ms[2];
+    Buffer* buffers[2] = {&pass, &reject};
+    for (uint32_t i = 0; i < 2; i++) {
+      uint32_t found = 0;
+      auto start = std::chrono::steady_clock::now();
+      for (uint32_t n = 0; n < iterations; n++)
+        found += detect(detector, *buffers[i]);
+      std::chrono::duration<double, std::milli> elapsed =
+          std::chrono::steady_clock::now() - start;
+      ms[i] = elapsed.count() / iterations;
+      if (found != (i == 0 ? iterations : 0))
+        printf("%s: unexpected result\n", detector.getName());
+    }
+    printf("%-10s %14.3f %14.3f\n", detector.getName(), ms[0], ms[1]);
+  }
+}
+
+static void usage(const char* name) {
+  printf("usage: %s [-n benchmark iterations]\n", name);
+}
+
+int main(int argc, char* argv[]) {
+  uint32_t iterations = 50;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:h")) != -1) {
+    switch (opt) {
+      case 'n':
+        iterations = atoi(optarg) > 0 ? atoi(optarg) : 1;
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+
+  printf("Implementations:");
+  for (TransparencyDetector::EImplementation impl : kImplementations) {
+    if (TransparencyDetector::isAvailable(impl))
+      printf(" %s", TransparencyDetector(impl).getName());
+  }
+  printf("\n");
+
+  bool ok = test_masks();
+  printf("%-28s %s\n", "masks", ok ? "ok    " : "FAILED");
+  ok = test_single_pixel(0xFFFFFFFF) && ok;
+  ok = test_single_pixel(0x01000000) && ok;
+  ok = test_random(2000) && ok;
+  benchmark(1920, 1080, iterations);
+  benchmark(3840, 2160, iterations);
+
+  printf("\n%s\n", ok ? "PASSED" : "FAILED");
+  return ok ? 0 : 1;
+}
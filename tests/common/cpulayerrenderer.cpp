@@ -0,0 +1,61 @@
+/*
+// Copyright (c) 2016 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+#include "cpulayerrenderer.h"
+#include <string.h>
+
+#include <nativebufferhandler.h>
+
+CPULayerRenderer::CPULayerRenderer(
+    hwcomposer::NativeBufferHandler* buffer_handler)
+    : LayerRenderer(buffer_handler) {
+}
+
+CPULayerRenderer::~CPULayerRenderer() {
+}
+
+bool CPULayerRenderer::Init(uint32_t width, uint32_t height, uint32_t format,
+                            glContext* gl, const char* resource_path) {
+  return LayerRenderer::Init(width, height, format, gl, resource_path);
+}
+
+void CPULayerRenderer::Draw(int64_t* pfence) {
+  *pfence = -1;
+
+  void* map_data = NULL;
+  uint32_t stride = 0;
+  void* map = buffer_handler_->Map(handle_, 0, 0, width_, height_, &stride,
+                                   &map_data, 0);
+  if (!map) {
+    ETRACE("CPULayerRenderer: Map failed");
+    return;
+  }
+
+  // Only the first plane is written: the rows are filled bytewise, so any
+  // packed format shows the band, in whatever colour its bytes make.
+  uint32_t band = height_ / 8 ? height_ / 8 : 1;
+  uint32_t band_top = (frame_ * 4) % height_;
+  uint8_t background = 0x40 + (frame_ & 0x3f);
+  char* row = (char*)map;
+  for (uint32_t y = 0; y < height_; y++) {
+    bool in_band = y >= band_top && y < band_top + band;
+    memset(row, in_band ? 0xff : background, stride);
+    row += stride;
+  }
+
+  buffer_handler_->UnMap(handle_, map_data);
+  frame_++;
+}
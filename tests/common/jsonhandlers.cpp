@@ -48,6 +48,8 @@ bool parseParametersJson(const char* json_path, TEST_PARAMETERS* parameters) {
           } else if (strcmp(layer_key, "transform") == 0) {
             layer_parameter.transform =
                 (LAYER_TRANSFORM)json_object_get_int(layer_value);
+          } else if (strcmp(layer_key, "hidden") == 0) {
+            layer_parameter.hidden = json_object_get_boolean(layer_value);
           } else if (strcmp(layer_key, "resource_path") == 0) {
             layer_parameter.resource_path =
                 std::string(json_object_get_string(layer_value));
@@ -93,6 +95,44 @@ bool parseParametersJson(const char* json_path, TEST_PARAMETERS* parameters) {
         }
         parameters->layers_parameters.push_back(layer_parameter);
       }
+    } else if (!strcmp(key, "layer_events")) {
+      struct array_list* array = json_object_get_array(value);
+      int len = json_object_array_length(value);
+      for (int i = 0; i < len; i++) {
+        LAYER_EVENT layer_event;
+        struct json_object* object =
+            (struct json_object*)array_list_get_idx(array, i);
+        json_object_object_foreach(object, event_key, event_value) {
+          if (strcmp(event_key, "type") == 0) {
+            const char* type = json_object_get_string(event_value);
+            if (strcmp(type, "add") == 0)
+              layer_event.type = LAYER_EVENT_ADD;
+            else if (strcmp(type, "remove") == 0)
+              layer_event.type = LAYER_EVENT_REMOVE;
+            else if (strcmp(type, "move") == 0)
+              layer_event.type = LAYER_EVENT_MOVE;
+            else if (strcmp(type, "resize") == 0)
+              layer_event.type = LAYER_EVENT_RESIZE;
+          } else if (strcmp(event_key, "layer") == 0) {
+            layer_event.layer = json_object_get_int(event_value);
+          } else if (strcmp(event_key, "frame") == 0) {
+            layer_event.frame = json_object_get_int64(event_value);
+          } else if (strcmp(event_key, "every") == 0) {
+            layer_event.every = json_object_get_int64(event_value);
+          } else if (strcmp(event_key, "until") == 0) {
+            layer_event.until = json_object_get_int64(event_value);
+          } else if (strcmp(event_key, "x") == 0) {
+            layer_event.x = json_object_get_int(event_value);
+          } else if (strcmp(event_key, "y") == 0) {
+            layer_event.y = json_object_get_int(event_value);
+          } else if (strcmp(event_key, "width") == 0) {
+            layer_event.width = json_object_get_int(event_value);
+          } else if (strcmp(event_key, "height") == 0) {
+            layer_event.height = json_object_get_int(event_value);
+          }
+        }
+        parameters->layer_events.push_back(layer_event);
+      }
     }
   }
 
@@ -172,6 +172,7 @@ typedef enum {
   LAYER_TYPE_VIDEO = 1,
   LAYER_TYPE_IMAGE = 2,
   LAYER_TYPE_GL_TEXTURE = 3,
+  LAYER_TYPE_CPU = 4,
   LAYER_TYPE_UNDEFINED
 } LAYER_TYPE;
 
@@ -199,10 +200,36 @@ typedef struct {
   uint32_t frame_y;
   uint32_t frame_width;
   uint32_t frame_height;
+  // Hidden layers are not presented until an "add" event shows them.
+  bool hidden = false;
 } LAYER_PARAMETER;
 
 typedef std::vector<LAYER_PARAMETER> LAYER_PARAMETERS;
 
+typedef enum {
+  LAYER_EVENT_ADD = 0,     // shows a hidden layer
+  LAYER_EVENT_REMOVE = 1,  // hides a layer
+  LAYER_EVENT_MOVE = 2,    // moves the frame by x, y, wrapping at the display
+  LAYER_EVENT_RESIZE = 3,  // sets the frame size to width x height
+  LAYER_EVENT_UNDEFINED
+} LAYER_EVENT_TYPE;
+
+// Scripted layer churn: applied to layer at frame, then again every "every"
+// frames while the frame number is below until, when those are non zero.
+typedef struct {
+  LAYER_EVENT_TYPE type = LAYER_EVENT_UNDEFINED;
+  uint32_t layer = 0;
+  uint64_t frame = 0;
+  uint64_t every = 0;
+  uint64_t until = 0;
+  int32_t x = 0;
+  int32_t y = 0;
+  uint32_t width = 0;
+  uint32_t height = 0;
+} LAYER_EVENT;
+
+typedef std::vector<LAYER_EVENT> LAYER_EVENTS;
+
 typedef struct {
   float gamma_r = 1;
   float gamma_g = 1;
@@ -216,6 +243,7 @@ typedef struct {
   std::string broadcast_rgb = "Automatic";
   std::string power_mode = "none";
   LAYER_PARAMETERS layers_parameters;
+  LAYER_EVENTS layer_events;
 } TEST_PARAMETERS;
 
 bool parseParametersJson(const char* json_path, TEST_PARAMETERS* parameters);
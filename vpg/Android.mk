@@ -52,3 +52,21 @@ endif
 include $(LOCAL_PATH)/../Android.common.mk
 LOCAL_MULTILIB := $(INTEL_HWC_LIBRARY_MULTILIB)
 include $(BUILD_SHARED_LIBRARY)
+
+# Checks the plane allocator's search modes agree (tests/autotests/planealloc_autotest.cpp).
+include $(CLEAR_VARS)
+LOCAL_MODULE := hwcplanealloc_autotest
+LOCAL_SRC_FILES := ../tests/autotests/planealloc_autotest.cpp
+LOCAL_WHOLE_STATIC_LIBRARIES += libhwccommon$(INTEL_HWC_BUILD_EXTENSION) libhwcplatform$(INTEL_HWC_BUILD_EXTENSION) libhwcdrm$(INTEL_HWC_BUILD_EXTENSION) libhwcgen$(INTEL_HWC_BUILD_EXTENSION)
+LOCAL_SHARED_LIBRARIES += libgrallocclient libGLESv1_CM libGLESv2 libEGL libivp libdrm_intel
+include $(LOCAL_PATH)/../Android.common.mk
+include $(BUILD_EXECUTABLE)
+
+# Checks the Broxton DBuf cache against the uncached calculation (tests/autotests/bxtdbuf_autotest.cpp).
+include $(CLEAR_VARS)
+LOCAL_MODULE := hwcbxtdbuf_autotest
+LOCAL_SRC_FILES := ../tests/autotests/bxtdbuf_autotest.cpp
+LOCAL_WHOLE_STATIC_LIBRARIES += libhwccommon$(INTEL_HWC_BUILD_EXTENSION) libhwcplatform$(INTEL_HWC_BUILD_EXTENSION) libhwcdrm$(INTEL_HWC_BUILD_EXTENSION) libhwcgen$(INTEL_HWC_BUILD_EXTENSION)
+LOCAL_SHARED_LIBRARIES += libgrallocclient libGLESv1_CM libGLESv2 libEGL libivp libdrm_intel
+include $(LOCAL_PATH)/../Android.common.mk
+include $(BUILD_EXECUTABLE)